@@ -30,6 +30,7 @@ typedef struct tagADUShell_LaunchArguments
     char* logFile; /**< Custom log file path */
     bool showVersion; /**< Show an agent version */
     const char* configFolder; /**< Custom config folder. Default is /etc/adu */
+    int brokerFd; /**< The broker socket to serve, in broker mode; otherwise -1. See aduc/adushell_broker.h */
 } ADUShell_LaunchArguments;
 
 /**
@@ -7,6 +7,7 @@
  */
 #include <getopt.h>
 
+#include <limits.h> // INT_MAX
 #include <string.h>
 
 #include <aducpal/grp.h> // getgrnam
@@ -18,6 +19,7 @@
 #include <vector>
 
 #include "aduc/aduc_banned.h"
+#include "aduc/adushell_broker.h"
 #include "aduc/c_utils.h"
 #include "aduc/config_utils.h"
 #include "aduc/logging.h"
@@ -64,6 +66,7 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
     launchArgs->targetData = nullptr;
     launchArgs->logFile = nullptr;
     launchArgs->showVersion = false;
+    launchArgs->brokerFd = -1;
 
 #if _ADU_DEBUG
     launchArgs->logLevel = ADUC_LOG_DEBUG;
@@ -100,6 +103,9 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
         //
         // "--config-folder"     |   Path to the folder containing the ADU configuration files.
         //
+        // "--broker-fd"         |   Serve the tasks requested on this socket, until it is closed.
+        //                             See aduc/adushell_broker.h.
+        //
         static struct option long_options[] =
         {
             { "version",           no_argument,       nullptr, 'v' },
@@ -110,6 +116,7 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
             { "target-log-folder", required_argument, nullptr, 'f' },
             { "log-level",         required_argument, nullptr, 'l' },
             { "config-folder",     required_argument, nullptr, 'F' },
+            { "broker-fd",         required_argument, nullptr, 'B' },
             { nullptr, 0, nullptr, 0 }
         };
 
@@ -139,6 +146,23 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
             launchArgs->configFolder = optarg;
             break;
 
+        case 'B': {
+            char* endptr;
+            errno = 0;
+            const long brokerFd = strtol(optarg, &endptr, 10);
+            if (errno != 0 || endptr == optarg || *endptr != '\0' || brokerFd <= STDERR_FILENO || brokerFd > INT_MAX)
+            {
+                printf("Invalid socket after '--broker-fd' option.");
+                result = -1;
+            }
+            else
+            {
+                launchArgs->brokerFd = static_cast<int>(brokerFd);
+            }
+
+            break;
+        }
+
         case 'a':
             launchArgs->updateAction = optarg;
             launchArgs->action = ADUShellActionFromString(launchArgs->updateAction);
@@ -207,6 +231,12 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
         }
     }
 
+    // A broker gets the update type and action with each task.
+    if (launchArgs->brokerFd != -1)
+    {
+        return result;
+    }
+
     if (launchArgs->updateType == nullptr)
     {
         printf("Missing --update-type option.\n");
@@ -269,10 +299,14 @@ int ADUShell_Dowork(const ADUShell_LaunchArguments& launchArgs)
 /**
  * @brief Checking if the process has permission to run the adu shell operations
  *
+ * @param geteuidFunc Optional. The function for getting the user id to check. Default is geteuid.
+ * @param getegidFunc Optional. The function for getting the group id to check. Default is getegid.
  * @return true if the process is either in the trusted Group, or is one of the adu shell trusted users.
  * @return false otherwise
  */
-bool ADUShell_PermissionCheck()
+bool ADUShell_PermissionCheck(
+    const std::function<uid_t()>& geteuidFunc = ADUCPAL_geteuid,
+    const std::function<gid_t()>& getegidFunc = ADUCPAL_getegid)
 {
     bool isTrusted = false;
 
@@ -282,7 +316,7 @@ bool ADUShell_PermissionCheck()
     {
         VECTOR_HANDLE aduShellTrustedUsers = ADUC_ConfigInfo_GetAduShellTrustedUsers(config);
 
-        isTrusted = VerifyProcessEffectiveUser(aduShellTrustedUsers);
+        isTrusted = VerifyProcessEffectiveUser(aduShellTrustedUsers, geteuidFunc);
 
         ADUC_ConfigInfo_FreeAduShellTrustedUsers(aduShellTrustedUsers);
         aduShellTrustedUsers = nullptr;
@@ -293,7 +327,7 @@ bool ADUShell_PermissionCheck()
     // check whether the effective user is in the trusted group
     if (!isTrusted)
     {
-        isTrusted = VerifyProcessEffectiveGroup(ADUSHELL_EFFECTIVE_GROUP_NAME);
+        isTrusted = VerifyProcessEffectiveGroup(ADUSHELL_EFFECTIVE_GROUP_NAME, getegidFunc);
     }
 
     // If a trusted user list is provided, the permission check passes if the user is either in trusted group,
@@ -301,6 +335,86 @@ bool ADUShell_PermissionCheck()
     return isTrusted;
 }
 
+/**
+ * @brief The log level of the broker, for its tasks.
+ */
+static ADUC_LOG_SEVERITY s_brokerLogLevel = ADUC_LOG_INFO;
+
+/**
+ * @brief Checks a process that requests a task from the broker against the trusted users and group, like the user
+ * that launches adu-shell. Its supplementary groups are also checked.
+ */
+static bool ADUShell_IsTrustedBrokerPeer(uid_t uid, gid_t gid, const gid_t* groups, size_t groupCount)
+{
+    if (ADUShell_PermissionCheck([uid]() { return uid; }, [gid]() { return gid; }))
+    {
+        return true;
+    }
+
+    for (size_t i = 0; i < groupCount; ++i)
+    {
+        const gid_t group = groups[i];
+        if (VerifyProcessEffectiveGroup(ADUSHELL_EFFECTIVE_GROUP_NAME, [group]() { return group; }))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Runs one task requested from the broker, in a process forked from the broker.
+ *
+ * @param argc The number of @p argv.
+ * @param argv "adu-shell", then the task arguments.
+ * @return int The exit status of the task.
+ */
+static int ADUShell_RunBrokerTask(int argc, char** argv)
+{
+    // Re-initializes getopt, which the broker used for its own arguments.
+    optind = 0;
+
+    // Each task has its own log file, like a launched adu-shell.
+    ADUC_Logging_Init(s_brokerLogLevel, "adu-shell");
+
+    // Note: the configuration and the log level are the broker's.
+    ADUShell_LaunchArguments launchArgs;
+    int ret = ParseLaunchArguments(argc, argv, &launchArgs);
+    if (ret != 0 || launchArgs.brokerFd != -1)
+    {
+        printf("Failed to parse task arguments.\n");
+        ret = EXIT_FAILURE;
+    }
+    else
+    {
+        ret = ADUShell_Dowork(launchArgs);
+    }
+
+    ADUC_Logging_Uninit();
+    return ret;
+}
+
+/**
+ * @brief Serves the tasks requested on the broker socket, until the agent closes it at the end of the workflow.
+ *
+ * @param brokerFd The broker socket.
+ * @param logLevel The log level, for the tasks.
+ * @return int The exit code of the broker.
+ */
+static int ADUShell_RunBroker(int brokerFd, ADUC_LOG_SEVERITY logLevel)
+{
+    s_brokerLogLevel = logLevel;
+
+    Log_Info("Serving adu-shell tasks.");
+
+    // A forked task does not have the log writer thread of the broker, so it initializes logging itself. The broker
+    // logs to the console from now on.
+    ADUC_Logging_Uninit();
+
+    return ADUC_AduShellBroker_Serve(brokerFd, ADUShell_IsTrustedBrokerPeer, ADUShell_RunBrokerTask);
+}
+
 /**
  * @brief Main method.
  *
@@ -350,12 +464,19 @@ int main(int argc, char** argv)
 
     ADUC_Logging_Init(launchArgs.logLevel, "adu-shell");
 
-    Log_Debug("Update type: %s", launchArgs.updateType);
-    Log_Debug("Update action: %s", launchArgs.updateAction);
-    Log_Debug("Target data: %s", launchArgs.targetData);
-    for (const std::string& option : launchArgs.targetOptions)
+    if (launchArgs.brokerFd != -1)
     {
-        Log_Debug("Target options: %s", option.c_str());
+        Log_Debug("Broker socket: %d", launchArgs.brokerFd);
+    }
+    else
+    {
+        Log_Debug("Update type: %s", launchArgs.updateType);
+        Log_Debug("Update action: %s", launchArgs.updateAction);
+        Log_Debug("Target data: %s", launchArgs.targetData);
+        for (const std::string& option : launchArgs.targetOptions)
+        {
+            Log_Debug("Target options: %s", option.c_str());
+        }
     }
     Log_Debug("Log level: %d", launchArgs.logLevel);
 
@@ -371,7 +492,8 @@ int main(int argc, char** argv)
             effectiveUserId,
             ADUCPAL_getegid());
 
-        ret = ADUShell_Dowork(launchArgs);
+        ret = launchArgs.brokerFd != -1 ? ADUShell_RunBroker(launchArgs.brokerFd, launchArgs.logLevel)
+                                         : ADUShell_Dowork(launchArgs);
 
         ADUC_Logging_Uninit();
 
@@ -74,6 +74,11 @@ EXTERN_C_BEGIN
  */
 #define ADUCITF_FIELDNAME_RESULTDETAILS "resultDetails"
 
+/**
+ * @brief JSON field name for the resourceUsage property of a step result.
+ */
+#define ADUCITF_FIELDNAME_RESOURCEUSAGE "resourceUsage"
+
 /**
  * @brief JSON field name for installedCriteria property.
  */
@@ -10,6 +10,7 @@
 
 #include "aduc/types/workflow.h"
 #include <stdbool.h> // for bool
+#include <stdint.h> // for uint64_t
 
 EXTERN_C_BEGIN
 
@@ -33,6 +34,7 @@ typedef struct tagADUC_MethodCall_Data
 {
     ADUC_WorkCompletionData WorkCompletionData; //!< data for the work completion
     ADUC_WorkflowData* WorkflowData; //!< The data for the workflow
+    uint64_t StartTimeUs; //!< The monotonic time at which the operation started, in microseconds
 } ADUC_MethodCall_Data;
 
 
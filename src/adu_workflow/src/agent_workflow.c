@@ -19,15 +19,19 @@
 #include <time.h>
 
 #include "aduc/adu_core_export_helpers.h" // ADUC_MethodCall_RestartAgent
+#include "aduc/adushell_broker.h" // ADUC_AduShellBroker_Start
 #include "aduc/agent_orchestration.h"
 #include "aduc/config_utils.h"
 #include "aduc/download_handler_factory.h" // ADUC_DownloadHandlerFactory_LoadDownloadHandler
 #include "aduc/download_handler_plugin.h" // ADUC_DownloadHandlerPlugin_OnUpdateWorkflowCompleted
 #include "aduc/logging.h"
+#include "aduc/metrics_utils.h"
 #include "aduc/parser_utils.h" // ADUC_FileEntity_Uninit
+#include "aduc/reactor_utils.h" // ADUC_Reactor_Wakeup
 #include "aduc/result.h"
 #include "aduc/string_c_utils.h"
 #include "aduc/system_utils.h"
+#include "aduc/trace_utils.h"
 #include "aduc/types/workflow.h"
 #include "aduc/workflow_data_utils.h"
 #include "aduc/workflow_utils.h"
@@ -103,6 +107,183 @@ static const char* ADUCITF_WorkflowStepToString(ADUCITF_WorkflowStep workflowSte
     return "<Unknown>";
 }
 
+/**
+ * @brief The upper bounds of the workflow phase duration histograms, in milliseconds.
+ */
+static const uint64_t s_phaseDurationBoundsMs[] = { 100, 500, 1000, 5000, 15000, 60000, 300000, 900000, 3600000 };
+
+/**
+ * @brief The workflow metrics, registered once by RegisterWorkflowMetrics.
+ */
+static pthread_once_t s_workflowMetricsOnce = PTHREAD_ONCE_INIT;
+static ADUC_Metric* s_processDeploymentDurationMetric = NULL;
+static ADUC_Metric* s_downloadDurationMetric = NULL;
+static ADUC_Metric* s_backupDurationMetric = NULL;
+static ADUC_Metric* s_installDurationMetric = NULL;
+static ADUC_Metric* s_applyDurationMetric = NULL;
+static ADUC_Metric* s_restoreDurationMetric = NULL;
+static ADUC_Metric* s_stepFailuresMetric = NULL;
+static ADUC_Metric* s_downloadBytesMetric = NULL;
+
+/**
+ * @brief Registers a workflow step duration histogram.
+ *
+ * @param name The histogram name.
+ * @return ADUC_Metric* The histogram, or NULL on failure.
+ */
+static ADUC_Metric* RegisterWorkflowStepDurationMetric(const char* name)
+{
+    return ADUC_Metrics_RegisterHistogram(
+        name,
+        "Duration of the workflow step, in milliseconds.",
+        s_phaseDurationBoundsMs,
+        ARRAY_SIZE(s_phaseDurationBoundsMs));
+}
+
+/**
+ * @brief Registers the workflow metrics. Called once, through s_workflowMetricsOnce.
+ */
+static void RegisterWorkflowMetrics(void)
+{
+    s_processDeploymentDurationMetric =
+        RegisterWorkflowStepDurationMetric("adu_workflow_processdeployment_duration_ms");
+    s_downloadDurationMetric = RegisterWorkflowStepDurationMetric("adu_workflow_download_duration_ms");
+    s_backupDurationMetric = RegisterWorkflowStepDurationMetric("adu_workflow_backup_duration_ms");
+    s_installDurationMetric = RegisterWorkflowStepDurationMetric("adu_workflow_install_duration_ms");
+    s_applyDurationMetric = RegisterWorkflowStepDurationMetric("adu_workflow_apply_duration_ms");
+    s_restoreDurationMetric = RegisterWorkflowStepDurationMetric("adu_workflow_restore_duration_ms");
+    s_stepFailuresMetric =
+        ADUC_Metrics_RegisterCounter("adu_workflow_step_failures_total", "Number of failed workflow steps.");
+    s_downloadBytesMetric =
+        ADUC_Metrics_RegisterCounter("adu_download_bytes_total", "Number of payload bytes downloaded.");
+}
+
+/**
+ * @brief Gets the duration histogram of a workflow step.
+ *
+ * @param workflowStep The workflow step.
+ * @return ADUC_Metric* The histogram, or NULL if the step is not timed.
+ */
+static ADUC_Metric* GetWorkflowStepDurationMetric(ADUCITF_WorkflowStep workflowStep)
+{
+    switch (workflowStep)
+    {
+    case ADUCITF_WorkflowStep_ProcessDeployment:
+        return s_processDeploymentDurationMetric;
+    case ADUCITF_WorkflowStep_Download:
+        return s_downloadDurationMetric;
+    case ADUCITF_WorkflowStep_Backup:
+        return s_backupDurationMetric;
+    case ADUCITF_WorkflowStep_Install:
+        return s_installDurationMetric;
+    case ADUCITF_WorkflowStep_Apply:
+        return s_applyDurationMetric;
+    case ADUCITF_WorkflowStep_Restore:
+        return s_restoreDurationMetric;
+    case ADUCITF_WorkflowStep_Undefined:
+        break;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Records the span of a completed workflow step in the workflow trace, if any.
+ *
+ * @param workflowData The workflow data.
+ * @param workflowStep The completed workflow step.
+ * @param startUs The monotonic time at which the step started, in microseconds.
+ * @param result The step result.
+ */
+static void TraceWorkflowStep(
+    ADUC_WorkflowData* workflowData, ADUCITF_WorkflowStep workflowStep, uint64_t startUs, ADUC_Result result)
+{
+    char detail[64];
+    ADUC_TraceSpan span = { "workflow", ADUCITF_WorkflowStepToString(workflowStep), startUs };
+
+    char* workFolder = ADUC_WorkflowData_GetWorkFolder(workflowData);
+    if (workFolder == NULL)
+    {
+        return;
+    }
+
+    snprintf(detail, sizeof(detail), "rc:%d erc:0x%x", result.ResultCode, result.ExtendedResultCode);
+    ADUC_Trace_EndSpan(&span, workFolder, detail);
+
+    workflow_free_string(workFolder);
+}
+
+/**
+ * @brief Creates the workflow trace file in the sandbox, if workflow tracing is enabled.
+ *
+ * @param workFolder The workflow sandbox. May be NULL.
+ * @param workflowId The workflow id.
+ */
+static void StartWorkflowTraceIfEnabled(const char* workFolder, const char* workflowId)
+{
+    if (workFolder == NULL)
+    {
+        return;
+    }
+
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config == NULL)
+    {
+        return;
+    }
+
+    if (config->enableWorkflowTracing)
+    {
+        ADUC_Trace_StartWorkflowTrace(workFolder, workflowId);
+    }
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Copies the workflow trace to the log folder so that it is collected with the diagnostics logs, if configured.
+ *
+ * @param workFolder The workflow sandbox.
+ * @param workflowId The workflow id.
+ */
+static void ExportWorkflowTraceIfEnabled(const char* workFolder, const char* workflowId)
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config == NULL)
+    {
+        return;
+    }
+
+    if (config->enableWorkflowTracing && config->includeWorkflowTraceInDiagnostics)
+    {
+        ADUC_Trace_ExportWorkflowTrace(workFolder, workflowId, ADUC_LOG_FOLDER);
+    }
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Starts an adu-shell broker for the workflow, if configured. It is stopped when the workflow goes idle.
+ *
+ * @param handle The workflow handle.
+ */
+static void StartAduShellBrokerIfEnabled(ADUC_WorkflowHandle handle)
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config == NULL)
+    {
+        return;
+    }
+
+    if (config->enableAduShellBroker)
+    {
+        workflow_set_adushell_broker(
+            handle, ADUC_AduShellBroker_Start(config->aduShellFilePath, config->configFolder));
+    }
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
 /**
  * @brief Cleans up previously created sandboxes, excluding the current workflowId.
  *
@@ -818,6 +999,7 @@ void ADUC_Workflow_TransitionWorkflow(ADUC_WorkflowData* workflowData)
     }
 
     methodCallData->WorkflowData = workflowData;
+    methodCallData->StartTimeUs = ADUC_Trace_GetTimestampUs();
 
     // workCompletionData is sent to the upper-layer which will pass the WorkCompletionToken back
     // when it makes the async work complete call.
@@ -872,6 +1054,14 @@ void ADUC_Workflow_WorkCompletionCallback(const void* workCompletionToken, ADUC_
         s_workflow_lock();
     }
 
+    if (result.ResultCode == ADUC_Result_Failure_Cancelled && result.ExtendedResultCode == ADUC_ERC_SHUTDOWN)
+    {
+        // The platform layer is shutting down. Leave the workflow state as is; the workflow resumes from its persisted
+        // state when the agent restarts.
+        Log_Warn("Operation cancelled by the agent shutdown.");
+        goto done;
+    }
+
     ADUCITF_WorkflowStep currentWorkflowStep = workflow_get_current_workflowstep(workflowData->WorkflowHandle);
 
     const ADUC_WorkflowHandlerMapEntry* entry = GetWorkflowHandlerMapEntryForAction(currentWorkflowStep);
@@ -895,6 +1085,19 @@ void ADUC_Workflow_WorkCompletionCallback(const void* workCompletionToken, ADUC_
         result.ExtendedResultCode,
         result.ExtendedResultCode);
 
+    TraceWorkflowStep(workflowData, entry->WorkflowStep, methodCallData->StartTimeUs, result);
+
+    (void)pthread_once(&s_workflowMetricsOnce, RegisterWorkflowMetrics);
+
+    ADUC_Metrics_HistogramObserve(
+        GetWorkflowStepDurationMetric(entry->WorkflowStep),
+        (ADUC_Trace_GetTimestampUs() - methodCallData->StartTimeUs) / 1000);
+
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        ADUC_Metrics_CounterAdd(s_stepFailuresMetric, 1);
+    }
+
     entry->OperationCompleteFunc(methodCallData, result);
 
     if (IsAducResultCodeSuccess(result.ResultCode))
@@ -1034,6 +1237,9 @@ done:
     if (isAsync)
     {
         s_workflow_unlock();
+
+        // Completion came from a worker thread; let the main loop report it right away.
+        ADUC_Reactor_Wakeup();
     }
 }
 
@@ -1073,6 +1279,12 @@ void ADUC_Workflow_DefaultDownloadProgressCallback(
         DownloadProgressStateToString(state),
         bytesTransferred,
         bytesTotal);
+
+    if (state == ADUC_DownloadProgressState_Completed)
+    {
+        (void)pthread_once(&s_workflowMetricsOnce, RegisterWorkflowMetrics);
+        ADUC_Metrics_CounterAdd(s_downloadBytesMetric, bytesTransferred);
+    }
 }
 
 /**
@@ -1301,6 +1513,8 @@ void ADUC_Workflow_MethodCall_Idle(ADUC_WorkflowData* workflowData)
         Log_Info("UpdateAction: Idle. Ending workflow with WorkflowId: %s", workflowId);
         if (workFolder != NULL)
         {
+            ExportWorkflowTraceIfEnabled(workFolder, workflowId);
+
             Log_Info("Calling SandboxDestroyCallback");
 
             updateActionCallbacks->SandboxDestroyCallback(
@@ -1316,6 +1530,8 @@ void ADUC_Workflow_MethodCall_Idle(ADUC_WorkflowData* workflowData)
     // Notify callback that we're now back to idle.
     //
 
+    workflow_set_adushell_broker(workflowData->WorkflowHandle, NULL);
+
     Log_Info("Calling IdleCallback");
 
     updateActionCallbacks->IdleCallback(updateActionCallbacks->PlatformLayerHandle, workflowId);
@@ -1369,6 +1585,10 @@ ADUC_Result ADUC_Workflow_MethodCall_Download(ADUC_MethodCall_Data* methodCallDa
 
     Log_Info("Using sandbox %s", workFolder != NULL ? workFolder : "(null)");
 
+    StartWorkflowTraceIfEnabled(workFolder, workflow_peek_id(workflowData->WorkflowHandle));
+
+    StartAduShellBrokerIfEnabled(workflowData->WorkflowHandle);
+
     ADUC_Workflow_SetUpdateState(workflowData, ADUCITF_State_DownloadStarted);
 
     result = updateActionCallbacks->DownloadCallback(
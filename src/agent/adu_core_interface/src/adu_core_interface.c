@@ -29,10 +29,14 @@
 
 #include "startup_msg_helper.h"
 
+#include <aducpal/dirent.h> // ADUCPAL_opendir, ADUCPAL_readdir, ADUCPAL_closedir
+#include <aducpal/stdio.h> // ADUCPAL_rename
 #include <azure_c_shared_utility/strings.h> // STRING_*
 #include <iothub_client_version.h>
 #include <parson.h>
 #include <pnp_protocol.h>
+#include <string.h> // strlen, strncmp
+#include <sys/stat.h> // stat
 
 // Name of an Device Update Agent component that this device implements.
 static const char g_aduPnPComponentName[] = "deviceUpdate";
@@ -47,6 +51,13 @@ static const char g_aduPnPComponentAgentPropertyName[] = "agent";
 // ADU Management send an 'Update Action' to this device by setting this property on IoTHub.
 static const char g_aduPnPComponentServicePropertyName[] = "service";
 
+// Prefix of the file, in the log folder, that keeps the untrimmed results of a workflow whose reported results
+// did not fit the reported property size budget. The log folder is uploaded with the diagnostics logs.
+static const char g_fullResultsFilePrefix[] = "aduc-full-results-";
+
+// The number of full results files kept in the log folder; the oldest are deleted.
+#define ADUC_FULL_RESULTS_MAX_FILES 5
+
 /**
  * @brief Handle for Device Update Agent component to communication to service.
  */
@@ -586,6 +597,27 @@ done:
     return status;
 }
 
+/**
+ * @brief Sets the resource usage of the child processes of a workflow, by phase, on its result, if any was recorded.
+ */
+static JSON_Status _json_object_set_resource_usage(JSON_Object* object, ADUC_WorkflowHandle handle)
+{
+    JSON_Value* usage = workflow_get_resource_usage(handle);
+    if (usage == NULL)
+    {
+        return JSONSuccess;
+    }
+
+    JSON_Status status = json_object_set_value(object, ADUCITF_FIELDNAME_RESOURCEUSAGE, usage);
+    if (status != JSONSuccess)
+    {
+        Log_Error("Could not set value for field: %s", ADUCITF_FIELDNAME_RESOURCEUSAGE);
+        json_value_free(usage);
+    }
+
+    return status;
+}
+
 /**
  * @brief Sets workflow properties on the workflow json value.
  *
@@ -722,7 +754,8 @@ JSON_Value* GetReportingJsonValue(
     //             "step_0" : {
     //                 "resultCode" : ####,
     //                 "extendedResultCodes" : "########",
-    //                 "resultDetails" : "..."
+    //                 "resultDetails" : "...",
+    //                 "resourceUsage" : { "install" : { "userTimeMs" : ###, ... } }
     //             },
     //             ...
     //             "step_N" : {
@@ -841,6 +874,9 @@ JSON_Value* GetReportingJsonValue(
         goto done;
     }
 
+    // A single-step update records the resource usage on the root workflow.
+    (void)_json_object_set_resource_usage(lastInstallResultObject, handle);
+
     // Report all steps result.
     if (updateState != ADUCITF_State_DownloadStarted)
     {
@@ -900,6 +936,9 @@ JSON_Value* GetReportingJsonValue(
                 goto childDone;
             }
 
+            // Note: a missing resource usage does not fail the report.
+            (void)_json_object_set_resource_usage(childResultObject, childHandle);
+
         childDone:
             STRING_delete(childUpdateId);
             STRING_delete(childExtendedResultCodes);
@@ -922,6 +961,153 @@ done:
     return resultValue;
 }
 
+/**
+ * @brief Deletes the oldest full results files in the log folder so that at most ADUC_FULL_RESULTS_MAX_FILES remain.
+ */
+static void PruneFullResults()
+{
+    const size_t prefixLength = strlen(g_fullResultsFilePrefix);
+    const size_t suffixLength = strlen(".json");
+
+    for (;;)
+    {
+        unsigned int count = 0;
+        time_t oldestTime = 0;
+        char* oldestPath = NULL;
+
+        DIR* dir = ADUCPAL_opendir(ADUC_LOG_FOLDER);
+        if (dir == NULL)
+        {
+            return;
+        }
+
+        struct dirent* entry = NULL;
+        while ((entry = ADUCPAL_readdir(dir)) != NULL)
+        {
+            const size_t nameLength = strlen(entry->d_name);
+            if (nameLength < prefixLength + suffixLength
+                || strncmp(entry->d_name, g_fullResultsFilePrefix, prefixLength) != 0
+                || strcmp(entry->d_name + nameLength - suffixLength, ".json") != 0)
+            {
+                continue;
+            }
+
+            char* path = ADUC_StringFormat("%s/%s", ADUC_LOG_FOLDER, entry->d_name);
+            struct stat st;
+            if (path == NULL || stat(path, &st) != 0)
+            {
+                free(path);
+                continue;
+            }
+
+            ++count;
+            if (oldestPath == NULL || st.st_mtime < oldestTime)
+            {
+                free(oldestPath);
+                oldestPath = path;
+                oldestTime = st.st_mtime;
+            }
+            else
+            {
+                free(path);
+            }
+        }
+
+        ADUCPAL_closedir(dir);
+
+        const bool removed = count > ADUC_FULL_RESULTS_MAX_FILES && oldestPath != NULL && remove(oldestPath) == 0;
+        free(oldestPath);
+
+        if (!removed)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Writes the untrimmed reporting value of a workflow to the log folder, so that the details that are trimmed
+ * from the reported property still reach the diagnostics logs.
+ *
+ * @param workflowId The workflow id, used to name the file.
+ * @param reportingValue The untrimmed reporting value.
+ */
+static void SaveFullResults(const char* workflowId, const JSON_Value* reportingValue)
+{
+    char* filePath = ADUC_StringFormat(
+        "%s/%s%s.json", ADUC_LOG_FOLDER, g_fullResultsFilePrefix, IsNullOrEmpty(workflowId) ? "none" : workflowId);
+    char* tempFilePath = filePath == NULL ? NULL : ADUC_StringFormat("%s-temp", filePath);
+
+    if (tempFilePath == NULL)
+    {
+        Log_Error("Could not build the full results file path");
+        goto done;
+    }
+
+    if (json_serialize_to_file_pretty(reportingValue, tempFilePath) != JSONSuccess
+        || ADUCPAL_rename(tempFilePath, filePath) != 0)
+    {
+        Log_Warn("Could not save the full results to '%s'", filePath);
+        remove(tempFilePath);
+        goto done;
+    }
+
+    Log_Info("Saved the full results to '%s'", filePath);
+
+    // A device that keeps running oversized workflows would otherwise fill the log folder.
+    PruneFullResults();
+
+done:
+    free(tempFilePath);
+    free(filePath);
+}
+
+/**
+ * @brief Trims the step results of a reporting value to the configured reported property size budget, after saving
+ * the untrimmed value locally. IoT Hub rejects an oversized reported-property patch, and retrying it would only fail
+ * again.
+ *
+ * @param workflowData The workflow data.
+ * @param reportingValue The reporting value to trim.
+ */
+static void FitReportingValueToBudget(ADUC_WorkflowData* workflowData, JSON_Value* reportingValue)
+{
+    size_t maxSizeInBytes = ADUC_REPORTING_DEFAULT_MAX_SIZE_IN_BYTES;
+
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config != NULL && config->maxReportedPropertySizeInBytes > 0)
+    {
+        maxSizeInBytes = config->maxReportedPropertySizeInBytes;
+    }
+    ADUC_ConfigInfo_ReleaseInstance(config);
+
+    // Note: the serialization size includes the null terminator, and is 0 if the value cannot be serialized.
+    const size_t serializationSize = json_serialization_size(reportingValue);
+    if (serializationSize == 0)
+    {
+        Log_Error("Could not get the serialized size of the reporting value.");
+        return;
+    }
+
+    if (serializationSize - 1 <= maxSizeInBytes)
+    {
+        return;
+    }
+
+    SaveFullResults(workflow_peek_id(workflowData->WorkflowHandle), reportingValue);
+
+    if (ADUC_ReportingUtils_FitStepResultsToBudget(reportingValue, maxSizeInBytes))
+    {
+        Log_Warn("Step results trimmed to fit the reported property size budget of %zu bytes.", maxSizeInBytes);
+    }
+    else
+    {
+        Log_Error(
+            "Results exceed the reported property size budget of %zu bytes, even without step results.",
+            maxSizeInBytes);
+    }
+}
+
 /**
  * @brief Report state, and optionally result to service.
  *
@@ -968,6 +1154,8 @@ bool AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
         goto done;
     }
 
+    FitReportingValueToBudget(workflowData, rootValue);
+
     jsonString = json_serialize_to_string(rootValue);
     if (jsonString == NULL)
     {
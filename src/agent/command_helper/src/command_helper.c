@@ -9,6 +9,7 @@
 #include "aduc/command_helper.h"
 #include "aduc/logging.h"
 #include "aduc/permission_utils.h"
+#include "aduc/reactor_utils.h" // ADUC_Reactor_Wakeup
 
 #include <errno.h>
 #include <fcntl.h>
@@ -296,6 +297,9 @@ static void* ADUC_CommandListenerThread(void* unused)
             Log_Error("Cannot execute a command handler for '%s'.", commandLine);
             continue;
         }
+
+        // The handler typically queues work for the main loop (e.g. a twin request), so wake it up.
+        ADUC_Reactor_Wakeup();
     } while (!g_terminate_thread_request);
 
 done:
@@ -24,13 +24,14 @@
 #include "aduc/https_proxy_utils.h"
 #include "aduc/iothub_communication_manager.h"
 #include "aduc/logging.h"
+#include "aduc/metrics_utils.h"
 #include "aduc/permission_utils.h"
+#include "aduc/reactor_utils.h"
 #include "aduc/shutdown_service.h"
 #include "aduc/string_c_utils.h"
 #include "aduc/system_utils.h" // ADUC_SystemUtils_MkDirRecursiveDefault
 #include "aducpal/stdlib.h" // setenv
 #include <azure_c_shared_utility/shared_util_options.h>
-#include <azure_c_shared_utility/threadapi.h> // ThreadAPI_Sleep
 #include <ctype.h>
 #include <diagnostics_devicename.h>
 #include <diagnostics_interface.h>
@@ -195,6 +196,19 @@ static PnPComponentEntry componentList[] = {
 };
 
 // clang-format on
+
+/**
+ * @brief The client handle each D2C message type is sent through, for replaying the outbox journal.
+ */
+static ADUC_ClientHandle* const d2cMessageClientHandles[ADUC_D2C_Message_Type_Max] = {
+    [ADUC_D2C_Message_Type_Device_Update_Result] = &g_iotHubClientHandleForADUComponent,
+    [ADUC_D2C_Message_Type_Device_Update_ACK] = &g_iotHubClientHandleForADUComponent,
+    [ADUC_D2C_Message_Type_Device_Information] = &g_iotHubClientHandleForDeviceInfoComponent,
+    [ADUC_D2C_Message_Type_Diagnostics] = &g_iotHubClientHandleForDiagnosticsComponent,
+    [ADUC_D2C_Message_Type_Diagnostics_ACK] = &g_iotHubClientHandleForDiagnosticsComponent,
+    [ADUC_D2C_Message_Type_Device_Properties] = &g_iotHubClientHandleForADUComponent,
+};
+
 ADUC_ExtensionRegistrationType GetRegistrationTypeFromArg(const char* arg)
 {
     if (strcmp(arg, "updateContentHandler") == 0)
@@ -615,6 +629,9 @@ static void ADUC_PnPDeviceTwin_RetryUpdateCommand_Callback(
         // there is no action we can take beyond logging.
         Log_Error("Unable to process twin JSON.  Ignoring any desired property update requests.");
     }
+
+    // Run the main loop for the work the desired properties queued, rather than on its next timeout.
+    ADUC_Reactor_Wakeup();
 }
 
 //
@@ -657,6 +674,9 @@ static void ADUC_PnPDeviceTwin_Callback(
             }
         }
     }
+
+    // Run the main loop for the work the desired properties queued, rather than on its next timeout.
+    ADUC_Reactor_Wakeup();
 }
 
 #ifdef ADUC_COMMAND_HELPER_H
@@ -699,11 +719,25 @@ bool StartupAgent(const ADUC_LaunchArguments* launchArgs)
     ADUC_ConnectionInfo info;
     memset(&info, 0, sizeof(info));
 
+    if (!ADUC_Reactor_Init())
+    {
+        goto done;
+    }
+
     if (!ADUC_D2C_Messaging_Init())
     {
         goto done;
     }
 
+    if (!ADUC_D2C_Messaging_EnableJournal(ADUC_D2C_JOURNAL_FILE_PATH, ADUC_D2C_JOURNAL_MAX_SIZE_BYTES))
+    {
+        // Messages are still sent, but those undelivered at shutdown are lost.
+        Log_Warn("D2C outbox journal is not available");
+    }
+
+    // Batches the startup reports of the PnP components into fewer round trips, if configured.
+    ADUC_D2C_Messaging_EnableBatching(ADUC_D2C_COALESCING_WINDOW_MS);
+
     if (launchArgs->connectionString != NULL)
     {
         ADUC_ConnType connType = GetConnTypeFromConnectionString(launchArgs->connectionString);
@@ -764,6 +798,12 @@ bool StartupAgent(const ADUC_LaunchArguments* launchArgs)
         goto done;
     }
 
+    // Resend the messages left undelivered by a crash or the last shutdown, now that the handles are set.
+    for (int type = 0; type < ADUC_D2C_Message_Type_Max; ++type)
+    {
+        ADUC_D2C_Messaging_ReplayJournal((ADUC_D2C_Message_Type)type, d2cMessageClientHandles[type]);
+    }
+
     ADUC_Result result;
 
     // The connection string is valid (IoT hub connection successful) and we are ready for further processing.
@@ -822,6 +862,8 @@ void ShutdownAgent()
     DiagnosticsComponent_DestroyDeviceName();
     ADUC_Logging_Uninit();
     ExtensionManager_Uninit();
+    ADUC_Metrics_StopSocketExporter();
+    ADUC_Reactor_Uninit();
 }
 
 /**
@@ -833,6 +875,7 @@ void OnShutdownSignal(int sig)
 {
     Log_Warn("Shutdown signal detected: %d", sig);
     ADUC_ShutdownService_RequestShutdown();
+    ADUC_Reactor_Wakeup();
 }
 
 /**
@@ -842,6 +885,7 @@ void OnRestartSignal()
 {
     Log_Warn("Restart signal detected.");
     ADUC_ShutdownService_RequestShutdown();
+    ADUC_Reactor_Wakeup();
 }
 
 /**
@@ -1068,11 +1112,21 @@ int main(int argc, char** argv)
         goto done;
     }
 
+    // The metrics exporter is optional. The agent keeps running without it.
+    if (config->metricsSocketPath != NULL && !ADUC_Metrics_StartSocketExporter(config->metricsSocketPath))
+    {
+        Log_Warn("Cannot start the metrics exporter on '%s'.", config->metricsSocketPath);
+    }
+
     //
     // Main Loop
     //
 
-    Log_Info("Agent running.");
+    unsigned int maxIdleIntervalMs = config->mainLoopMaxIdleIntervalInMilliseconds != 0
+        ? config->mainLoopMaxIdleIntervalInMilliseconds
+        : ADUC_REACTOR_DEFAULT_MAX_IDLE_INTERVAL_MS;
+
+    Log_Info("Agent running. (max idle interval: %u ms)", maxIdleIntervalMs);
     while (ADUC_ShutdownService_ShouldKeepRunning())
     {
         // If any components have requested a DoWork callback, regularly call it.
@@ -1094,8 +1148,12 @@ int main(int argc, char** argv)
         // See: https://github.com/Azure/azure-iot-sdk-c/tree/master/iothub_client/samples
         // NOTE: For this example the above has been wrapped to support module and device client methods using
         // the client_handle_helper.h function ClientHandle_DoWork()
-
-        ThreadAPI_Sleep(100);
+        //
+        // The components that have in-flight transport work (connection, pending D2C responses) request
+        // the 100 ms cadence through the reactor. Otherwise, sleep until woken by a D2C submission, a workflow
+        // completion, a command, or a signal, bounded by maxIdleIntervalMs so that cloud-initiated traffic
+        // (e.g. desired property updates) is still picked up.
+        ADUC_Reactor_Wait(maxIdleIntervalMs);
     };
 
     ret = 0; // Success.
@@ -107,6 +107,25 @@ MOCKABLE_FUNCTION(
     const void*,
     value);
 
+/**
+ * @brief Wrapper for the Device and Module SetRetryPolicy functions
+ * @details Uses either the device or module function depending on what the client type has been set to.
+ * @param iotHubClientHandle ADUC_ClientHandle to be used for the operation
+ * @param retryPolicy The retry policy to be used when the connection is lost
+ * @param retryTimeoutLimitInSeconds The time to keep retrying, or 0 for no limit
+ * @returns a value of IOTHUB_CLIENT_RESULT
+ */
+MOCKABLE_FUNCTION(
+    ,
+    IOTHUB_CLIENT_RESULT,
+    ClientHandle_SetRetryPolicy,
+    ADUC_ClientHandle,
+    iotHubClientHandle,
+    IOTHUB_CLIENT_RETRY_POLICY,
+    retryPolicy,
+    size_t,
+    retryTimeoutLimitInSeconds);
+
 /**
  * @brief Wrapper for the device or model GetTwinAsync functions
  * @details Uses either the device or module function depending on what the client type has been set to.
@@ -0,0 +1,73 @@
+/**
+ * @file hub_simulator.h
+ * @brief Declares the control interface of the in-process IoT Hub simulator.
+ *
+ * When the agent is built with ADUC_BUILD_HUB_SIMULATOR=ON, the ClientHandle_* functions (client_handle_helper.h)
+ * talk to an in-process stand-in for the IoT Hub instead of the Azure IoT SDK. The simulator keeps the device twin
+ * (desired and reported properties), delivers desired-property patches and direct methods to the agent, and
+ * acknowledges reported-property patches and telemetry, all from ClientHandle_DoWork().
+ *
+ * A scenario, loaded from the file named by the ADUC_HUB_SIMULATOR_SCENARIO environment variable or with
+ * ADUC_HubSimulator_LoadScenario(), drives the agent through a sequence of steps, and records how long the agent
+ * takes to report the expected state for each step. See docs/agent-reference/how-to-load-test-with-hub-simulator.md.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef HUB_SIMULATOR_H
+#define HUB_SIMULATOR_H
+
+#include <aduc/c_utils.h>
+#include <stdbool.h>
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief The environment variable that names the scenario file loaded when the first client is created.
+ */
+#define ADUC_HUB_SIMULATOR_SCENARIO_ENV "ADUC_HUB_SIMULATOR_SCENARIO"
+
+/**
+ * @brief Loads a scenario, replacing the current one. The scenario starts on the next ClientHandle_DoWork() once a
+ * client is connected.
+ *
+ * @param scenarioJson The scenario, as a JSON string.
+ * @return true on success; false if the scenario is invalid.
+ */
+bool ADUC_HubSimulator_LoadScenario(const char* scenarioJson);
+
+/**
+ * @brief Queues a desired-properties patch to be delivered to the agent.
+ *
+ * @param patchJson The patch, as a JSON object string, e.g. { "deviceUpdate": { "service": { ... } } }.
+ * @return true on success; false if the patch is not a JSON object.
+ */
+bool ADUC_HubSimulator_PushDesired(const char* patchJson);
+
+/**
+ * @brief Gets the reported properties of the simulated device twin.
+ *
+ * @return The reported properties, as a JSON string, to be freed with free(); or NULL on failure.
+ */
+char* ADUC_HubSimulator_GetReported();
+
+/**
+ * @brief Returns whether the loaded scenario has run all its iterations.
+ */
+bool ADUC_HubSimulator_IsScenarioDone();
+
+/**
+ * @brief Gets the results of the loaded scenario: step counts, timeouts, latency percentiles and throughput.
+ *
+ * @return The results, as a JSON string, to be freed with free(); or NULL if no scenario is loaded.
+ */
+char* ADUC_HubSimulator_GetResults();
+
+/**
+ * @brief Resets the simulated device twin and unloads the scenario. Live client handles are not affected.
+ */
+void ADUC_HubSimulator_Reset();
+
+EXTERN_C_END
+
+#endif // HUB_SIMULATOR_H
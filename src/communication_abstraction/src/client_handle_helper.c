@@ -14,6 +14,9 @@
 
 static ADUC_ConnType g_ClientHandleType = ADUC_ConnType_NotSet;
 
+// The number of live client handles. Two can be live while a client is replaced, e.g. on SAS token renewal.
+static unsigned int g_ClientHandleCount = 0;
+
 /**
  * @brief Safely casts @p handle to an IOTHUB_DEVICE_CLIENT_LL_HANDLE
  * @param handle the pointer to be cast
@@ -58,10 +61,10 @@ bool ClientHandle_CreateFromConnectionString(
     const char* connectionString,
     IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol)
 {
-    if (g_ClientHandleType != ADUC_ConnType_NotSet)
+    if (g_ClientHandleType != ADUC_ConnType_NotSet && g_ClientHandleType != type)
     {
         Log_Error(
-            "ClientHandle_CreateFromConnectionString called for a second time. Only supports a single connection per agent");
+            "ClientHandle_CreateFromConnectionString called with a different ADUC_ConnType. Only supports a single connection type per agent");
         return false;
     }
 
@@ -103,6 +106,7 @@ done:
     }
 
     g_ClientHandleType = type;
+    ++g_ClientHandleCount;
     return true;
 }
 
@@ -234,6 +238,38 @@ ClientHandle_SetOption(ADUC_ClientHandle iotHubClientHandle, const char* optionN
     return result;
 }
 
+/**
+ * @brief Wrapper for the Device and Module SetRetryPolicy functions
+ * @details Uses either the device or module function depending on what the client type has been set to.
+ * @param iotHubClientHandle ADUC_ClientHandle to be used for the operation
+ * @param retryPolicy The retry policy to be used when the connection is lost
+ * @param retryTimeoutLimitInSeconds The time to keep retrying, or 0 for no limit
+ * @returns a value of IOTHUB_CLIENT_RESULT
+ */
+IOTHUB_CLIENT_RESULT
+ClientHandle_SetRetryPolicy(
+    ADUC_ClientHandle iotHubClientHandle, IOTHUB_CLIENT_RETRY_POLICY retryPolicy, size_t retryTimeoutLimitInSeconds)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_INVALID_ARG;
+
+    if (g_ClientHandleType == ADUC_ConnType_Device)
+    {
+        result = IoTHubDeviceClient_LL_SetRetryPolicy(
+            GetDeviceClientHandle(iotHubClientHandle), retryPolicy, retryTimeoutLimitInSeconds);
+    }
+    else if (g_ClientHandleType == ADUC_ConnType_Module)
+    {
+        result = IoTHubModuleClient_LL_SetRetryPolicy(
+            GetModuleClientHandle(iotHubClientHandle), retryPolicy, retryTimeoutLimitInSeconds);
+    }
+    else
+    {
+        Log_Error("ClientHandle_SetRetryPolicy before called ClientHandle_CreateFromConnectionString");
+    }
+
+    return result;
+}
+
 /**
  * @brief Wrapper for the device or model GetTwinAsync functions
  * @details Uses either the device or module function depending on what the client type has been set to.
@@ -398,5 +434,13 @@ void ClientHandle_Destroy(ADUC_ClientHandle iotHubClientHandle)
         Log_Error("ClientHandle_Destroy before called ClientHandle_CreateFromConnectionString");
     }
 
-    g_ClientHandleType = ADUC_ConnType_NotSet;
+    if (iotHubClientHandle != NULL && g_ClientHandleCount > 0)
+    {
+        --g_ClientHandleCount;
+    }
+
+    if (g_ClientHandleCount == 0)
+    {
+        g_ClientHandleType = ADUC_ConnType_NotSet;
+    }
 }
@@ -0,0 +1,1296 @@
+/**
+ * @file client_handle_simulator.c
+ * @brief Implements the ClientHandle interface against an in-process IoT Hub simulator, for load testing the agent
+ * without an IoT Hub. See hub_simulator.h.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "aduc/client_handle_helper.h"
+#include "aduc/hub_simulator.h"
+
+#include <aduc/logging.h>
+#include <aduc/reactor_utils.h>
+#include <azure_c_shared_utility/crt_abstractions.h> // mallocAndStrcpy_s
+#include <limits.h>
+#include <parson.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief The default time the agent has to report the expected state of a scenario step.
+ */
+#define SIMULATOR_DEFAULT_STEP_TIMEOUT_MS (10 * 60 * 1000)
+
+/**
+ * @brief Replaced with the (zero-based) iteration number in the desired patches, method payloads and expected
+ * reported values of a scenario, e.g. to give each deployment its own workflow id.
+ */
+#define SIMULATOR_ITERATION_PLACEHOLDER "{{iteration}}"
+
+/**
+ * @brief A client created through ClientHandle_CreateFromConnectionString.
+ */
+typedef struct tagADUC_SimulatedClient
+{
+    IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback;
+    void* connectionStatusContext;
+    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK twinCallback;
+    void* twinContext;
+    IOTHUB_CLIENT_DEVICE_METHOD_CALLBACK_ASYNC methodCallback;
+    void* methodContext;
+    struct tagADUC_SimulatedClient* next;
+} ADUC_SimulatedClient;
+
+/**
+ * @brief The kinds of operations the simulator completes from ClientHandle_DoWork().
+ */
+typedef enum tagADUC_SimulatedOperationType
+{
+    ADUC_SimulatedOperationType_Connect, /**< Reports the client authenticated, then sends it the full twin. */
+    ADUC_SimulatedOperationType_DesiredPatch, /**< Sends a desired-properties patch to the client. */
+    ADUC_SimulatedOperationType_GetTwin, /**< Answers ClientHandle_GetTwinAsync() with the full twin. */
+    ADUC_SimulatedOperationType_ReportedState, /**< Applies a reported-properties patch and acknowledges it. */
+    ADUC_SimulatedOperationType_Event, /**< Acknowledges a telemetry message. */
+} ADUC_SimulatedOperationType;
+
+/**
+ * @brief An operation queued for ClientHandle_DoWork().
+ */
+typedef struct tagADUC_SimulatedOperation
+{
+    ADUC_SimulatedOperationType type;
+    ADUC_SimulatedClient* client;
+    uint64_t dueTimeMs; //!< When the operation completes (monotonic time).
+    char* payload; //!< The patch, for DesiredPatch and ReportedState operations.
+    size_t payloadSize;
+    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK twinCallback;
+    IOTHUB_CLIENT_REPORTED_STATE_CALLBACK reportedStateCallback;
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventCallback;
+    void* context;
+    struct tagADUC_SimulatedOperation* next;
+} ADUC_SimulatedOperation;
+
+/**
+ * @brief A step of a scenario: a desired-properties patch (or a direct method), and the reported value that
+ * completes it.
+ */
+typedef struct tagADUC_SimulatorStep
+{
+    char* name;
+    char* desiredTemplate; //!< The serialized desired patch, or NULL.
+    char* methodName; //!< The direct method to invoke, or NULL.
+    char* methodPayloadTemplate;
+    char* expectedPath; //!< The dotted path, in a reported patch, of the value that completes the step; or NULL.
+    char* expectedValueTemplate; //!< The serialized value that completes the step.
+    uint64_t timeoutMs;
+
+    unsigned int completed;
+    unsigned int timedOut;
+    uint64_t* latenciesMs;
+    size_t latencyCount;
+    size_t latencyCapacity;
+} ADUC_SimulatorStep;
+
+/**
+ * @brief A loaded scenario, and its progress.
+ */
+typedef struct tagADUC_SimulatorScenario
+{
+    ADUC_SimulatorStep* steps;
+    size_t stepCount;
+    unsigned int iterations;
+    unsigned int hubLatencyMs; //!< How long the simulated hub takes to complete each operation.
+    double reportedStateFailureRate; //!< The fraction of reported-properties patches rejected with a 500.
+    unsigned int randomState;
+    bool exitWhenDone; //!< Whether to request the agent shutdown (SIGTERM) when the scenario is done.
+    char* resultsFilePath;
+
+    bool done;
+    unsigned int iteration;
+    size_t stepIndex;
+    bool stepInFlight;
+    uint64_t stepStartedMs;
+    JSON_Value* expectedValue; //!< The value that completes the in-flight step, for the current iteration.
+    uint64_t startedMs;
+    uint64_t finishedMs;
+    unsigned int reportedPatches;
+    unsigned int injectedFailures;
+    unsigned int events;
+} ADUC_SimulatorScenario;
+
+static ADUC_SimulatedClient* s_clients = NULL;
+static ADUC_SimulatedClient* s_connectedClient = NULL; // The hub delivers to the most recently connected client.
+static ADUC_SimulatedOperation* s_operationsHead = NULL;
+static ADUC_SimulatedOperation* s_operationsTail = NULL;
+static JSON_Value* s_desired = NULL;
+static JSON_Value* s_reported = NULL;
+static unsigned int s_desiredVersion = 1;
+static unsigned int s_reportedVersion = 1;
+static ADUC_SimulatorScenario* s_scenario = NULL;
+static bool s_scenarioEnvironmentChecked = false;
+
+/**
+ * @brief Returns how long the simulated hub takes to complete an operation, in milliseconds.
+ */
+static unsigned int GetHubLatencyMs()
+{
+    return s_scenario == NULL ? 0 : s_scenario->hubLatencyMs;
+}
+
+/**
+ * @brief Appends an operation to the queue, and wakes the main loop when it is due.
+ */
+static void QueueOperation(ADUC_SimulatedOperation* operation)
+{
+    const unsigned int latencyMs = GetHubLatencyMs();
+    operation->dueTimeMs = ADUC_Reactor_GetMonotonicTimeMs() + latencyMs;
+    operation->next = NULL;
+
+    if (s_operationsTail == NULL)
+    {
+        s_operationsHead = operation;
+    }
+    else
+    {
+        s_operationsTail->next = operation;
+    }
+
+    s_operationsTail = operation;
+    ADUC_Reactor_RequestWakeupInMs(latencyMs);
+}
+
+static void FreeOperation(ADUC_SimulatedOperation* operation)
+{
+    free(operation->payload);
+    free(operation);
+}
+
+/**
+ * @brief Returns the object of @p *value, creating an empty object first if needed.
+ */
+static JSON_Object* GetOrCreateObject(JSON_Value** value)
+{
+    if (*value == NULL)
+    {
+        *value = json_value_init_object();
+    }
+
+    return json_value_get_object(*value);
+}
+
+/**
+ * @brief Applies the @p patch to @p target as a JSON merge patch: objects are merged, null removes a property, and
+ * any other value replaces the current one.
+ */
+static bool ApplyPatch(JSON_Object* target, const JSON_Object* patch)
+{
+    for (size_t i = 0; i < json_object_get_count(patch); ++i)
+    {
+        const char* name = json_object_get_name(patch, i);
+        const JSON_Value* patchValue = json_object_get_value_at(patch, i);
+        JSON_Value* targetValue = json_object_get_value(target, name);
+
+        if (json_value_get_type(patchValue) == JSONNull)
+        {
+            json_object_remove(target, name);
+        }
+        else if (json_value_get_type(patchValue) == JSONObject && json_value_get_type(targetValue) == JSONObject)
+        {
+            if (!ApplyPatch(json_value_get_object(targetValue), json_value_get_object(patchValue)))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            JSON_Value* copy = json_value_deep_copy(patchValue);
+            if (copy == NULL || json_object_set_value(target, name, copy) != JSONSuccess)
+            {
+                json_value_free(copy);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Serializes the full twin: { "desired": { ... }, "reported": { ... } }.
+ *
+ * @return The twin, to be freed with json_free_serialized_string(); or NULL on failure.
+ */
+static char* SerializeTwin()
+{
+    char* twin = NULL;
+    JSON_Value* twinValue = json_value_init_object();
+    JSON_Object* twinObject = json_value_get_object(twinValue);
+    JSON_Value* desired = GetOrCreateObject(&s_desired) != NULL ? json_value_deep_copy(s_desired) : NULL;
+    JSON_Value* reported = GetOrCreateObject(&s_reported) != NULL ? json_value_deep_copy(s_reported) : NULL;
+
+    if (twinObject == NULL || desired == NULL || reported == NULL)
+    {
+        json_value_free(desired);
+        json_value_free(reported);
+        goto done;
+    }
+
+    json_object_set_number(json_value_get_object(desired), "$version", s_desiredVersion);
+    json_object_set_number(json_value_get_object(reported), "$version", s_reportedVersion);
+
+    if (json_object_set_value(twinObject, "desired", desired) != JSONSuccess)
+    {
+        json_value_free(desired);
+        json_value_free(reported);
+        goto done;
+    }
+
+    if (json_object_set_value(twinObject, "reported", reported) != JSONSuccess)
+    {
+        json_value_free(reported);
+        goto done;
+    }
+
+    twin = json_serialize_to_string(twinValue);
+
+done:
+    json_value_free(twinValue);
+    return twin;
+}
+
+/**
+ * @brief Sends the full twin to @p callback.
+ */
+static void DeliverTwin(IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK callback, void* context)
+{
+    char* twin = SerializeTwin();
+    if (twin == NULL)
+    {
+        Log_Error("Hub simulator: cannot serialize the twin.");
+        return;
+    }
+
+    callback(DEVICE_TWIN_UPDATE_COMPLETE, (const unsigned char*)twin, strlen(twin), context);
+    json_free_serialized_string(twin);
+}
+
+/**
+ * @brief Returns a copy of @p source with every SIMULATOR_ITERATION_PLACEHOLDER replaced with @p iteration.
+ */
+static char* ExpandTemplate(const char* source, unsigned int iteration)
+{
+    char iterationString[16];
+    snprintf(iterationString, sizeof(iterationString), "%u", iteration);
+
+    const size_t placeholderLength = strlen(SIMULATOR_ITERATION_PLACEHOLDER);
+    size_t count = 0;
+    for (const char* p = strstr(source, SIMULATOR_ITERATION_PLACEHOLDER); p != NULL;
+         p = strstr(p + placeholderLength, SIMULATOR_ITERATION_PLACEHOLDER))
+    {
+        ++count;
+    }
+
+    char* result = malloc(strlen(source) + count * strlen(iterationString) + 1);
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    char* out = result;
+    const char* in = source;
+    for (const char* p = strstr(in, SIMULATOR_ITERATION_PLACEHOLDER); p != NULL;
+         p = strstr(in, SIMULATOR_ITERATION_PLACEHOLDER))
+    {
+        memcpy(out, in, (size_t)(p - in));
+        out += p - in;
+        strcpy(out, iterationString);
+        out += strlen(iterationString);
+        in = p + placeholderLength;
+    }
+
+    strcpy(out, in);
+    return result;
+}
+
+//
+// Scenario
+//
+
+static void FreeScenario(ADUC_SimulatorScenario* scenario)
+{
+    if (scenario == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < scenario->stepCount; ++i)
+    {
+        ADUC_SimulatorStep* step = &scenario->steps[i];
+        free(step->name);
+        json_free_serialized_string(step->desiredTemplate);
+        free(step->methodName);
+        json_free_serialized_string(step->methodPayloadTemplate);
+        free(step->expectedPath);
+        json_free_serialized_string(step->expectedValueTemplate);
+        free(step->latenciesMs);
+    }
+
+    free(scenario->steps);
+    free(scenario->resultsFilePath);
+    json_value_free(scenario->expectedValue);
+    free(scenario);
+}
+
+static char* DuplicateString(const char* str)
+{
+    char* copy = NULL;
+    if (str != NULL && mallocAndStrcpy_s(&copy, str) != 0)
+    {
+        copy = NULL;
+    }
+
+    return copy;
+}
+
+/**
+ * @brief Parses a step of a scenario.
+ */
+static bool ParseStep(const JSON_Object* stepObject, size_t index, ADUC_SimulatorStep* step)
+{
+    char defaultName[32];
+    snprintf(defaultName, sizeof(defaultName), "step%zu", index);
+    const char* name = json_object_get_string(stepObject, "name");
+    step->name = DuplicateString(name != NULL ? name : defaultName);
+
+    const JSON_Value* desired = json_object_get_value(stepObject, "desired");
+    if (desired != NULL)
+    {
+        if (json_value_get_type(desired) != JSONObject)
+        {
+            Log_Error("Hub simulator: 'desired' of step '%s' is not an object.", step->name);
+            return false;
+        }
+
+        step->desiredTemplate = json_serialize_to_string(desired);
+    }
+
+    const JSON_Object* method = json_object_get_object(stepObject, "method");
+    if (method != NULL)
+    {
+        step->methodName = DuplicateString(json_object_get_string(method, "name"));
+        const JSON_Value* payload = json_object_get_value(method, "payload");
+        step->methodPayloadTemplate = payload != NULL ? json_serialize_to_string(payload) : NULL;
+        if (step->methodName == NULL)
+        {
+            Log_Error("Hub simulator: the method of step '%s' has no name.", step->name);
+            return false;
+        }
+    }
+
+    if (step->desiredTemplate == NULL && step->methodName == NULL)
+    {
+        Log_Error("Hub simulator: step '%s' has neither 'desired' nor 'method'.", step->name);
+        return false;
+    }
+
+    const JSON_Object* expect = json_object_get_object(stepObject, "expectReported");
+    if (expect != NULL)
+    {
+        step->expectedPath = DuplicateString(json_object_get_string(expect, "path"));
+        const JSON_Value* value = json_object_get_value(expect, "value");
+        step->expectedValueTemplate = value != NULL ? json_serialize_to_string(value) : NULL;
+        if (step->expectedPath == NULL || step->expectedValueTemplate == NULL)
+        {
+            Log_Error("Hub simulator: 'expectReported' of step '%s' needs a 'path' and a 'value'.", step->name);
+            return false;
+        }
+    }
+
+    const double timeoutMs = json_object_get_number(stepObject, "timeoutMs");
+    step->timeoutMs = timeoutMs > 0 ? (uint64_t)timeoutMs : SIMULATOR_DEFAULT_STEP_TIMEOUT_MS;
+    return true;
+}
+
+/**
+ * @brief Parses a scenario. See docs/agent-reference/how-to-load-test-with-hub-simulator.md for the schema.
+ */
+static ADUC_SimulatorScenario* ParseScenario(const JSON_Value* scenarioValue)
+{
+    const JSON_Object* scenarioObject = json_value_get_object(scenarioValue);
+    const JSON_Array* stepsArray = json_object_get_array(scenarioObject, "steps");
+    ADUC_SimulatorScenario* scenario = NULL;
+
+    if (stepsArray == NULL || json_array_get_count(stepsArray) == 0)
+    {
+        Log_Error("Hub simulator: the scenario has no steps.");
+        goto fail;
+    }
+
+    scenario = calloc(1, sizeof(*scenario));
+    if (scenario == NULL)
+    {
+        goto fail;
+    }
+
+    scenario->stepCount = json_array_get_count(stepsArray);
+    scenario->steps = calloc(scenario->stepCount, sizeof(*scenario->steps));
+    if (scenario->steps == NULL)
+    {
+        goto fail;
+    }
+
+    for (size_t i = 0; i < scenario->stepCount; ++i)
+    {
+        const JSON_Object* stepObject = json_array_get_object(stepsArray, i);
+        if (stepObject == NULL || !ParseStep(stepObject, i, &scenario->steps[i]))
+        {
+            goto fail;
+        }
+    }
+
+    const double iterations = json_object_get_number(scenarioObject, "iterations");
+    const double hubLatencyMs = json_object_get_number(scenarioObject, "hubLatencyMs");
+    const double failureRate = json_object_get_number(scenarioObject, "reportedStateFailureRate");
+
+    scenario->iterations = (iterations >= 1 && iterations <= UINT_MAX) ? (unsigned int)iterations : 1;
+    scenario->hubLatencyMs = (hubLatencyMs > 0 && hubLatencyMs <= UINT_MAX) ? (unsigned int)hubLatencyMs : 0;
+    scenario->reportedStateFailureRate = (failureRate > 0 && failureRate <= 1) ? failureRate : 0;
+    scenario->randomState = (unsigned int)json_object_get_number(scenarioObject, "seed");
+    scenario->exitWhenDone = json_object_get_boolean(scenarioObject, "exitWhenDone") == 1;
+    scenario->resultsFilePath = DuplicateString(json_object_get_string(scenarioObject, "resultsFile"));
+    return scenario;
+
+fail:
+    FreeScenario(scenario);
+    return NULL;
+}
+
+/**
+ * @brief Loads the scenario named by ADUC_HUB_SIMULATOR_SCENARIO_ENV, once, unless one is already loaded.
+ */
+static void LoadScenarioFromEnvironment()
+{
+    if (s_scenarioEnvironmentChecked)
+    {
+        return;
+    }
+
+    s_scenarioEnvironmentChecked = true;
+    const char* scenarioFilePath = getenv(ADUC_HUB_SIMULATOR_SCENARIO_ENV);
+    if (s_scenario != NULL || scenarioFilePath == NULL || *scenarioFilePath == '\0')
+    {
+        return;
+    }
+
+    JSON_Value* scenarioValue = json_parse_file(scenarioFilePath);
+    if (scenarioValue == NULL)
+    {
+        Log_Error("Hub simulator: cannot parse the scenario file '%s'.", scenarioFilePath);
+        return;
+    }
+
+    s_scenario = ParseScenario(scenarioValue);
+    json_value_free(scenarioValue);
+
+    if (s_scenario != NULL)
+    {
+        Log_Info(
+            "Hub simulator: loaded scenario '%s' (%zu steps, %u iterations).",
+            scenarioFilePath,
+            s_scenario->stepCount,
+            s_scenario->iterations);
+    }
+}
+
+static int CompareLatencies(const void* a, const void* b)
+{
+    const uint64_t left = *(const uint64_t*)a;
+    const uint64_t right = *(const uint64_t*)b;
+    return (left > right) - (left < right);
+}
+
+/**
+ * @brief Returns the nearest-rank @p percentile of the sorted @p latencies.
+ */
+static uint64_t GetPercentile(const uint64_t* latencies, size_t count, unsigned int percentile)
+{
+    size_t rank = (count * percentile + 99) / 100;
+    return latencies[rank == 0 ? 0 : rank - 1];
+}
+
+/**
+ * @brief Builds the results of the current scenario.
+ */
+static JSON_Value* BuildResults(uint64_t nowMs)
+{
+    JSON_Value* resultsValue = json_value_init_object();
+    JSON_Object* results = json_value_get_object(resultsValue);
+    JSON_Value* stepsValue = json_value_init_array();
+    JSON_Array* steps = json_value_get_array(stepsValue);
+
+    if (results == NULL || steps == NULL)
+    {
+        json_value_free(resultsValue);
+        json_value_free(stepsValue);
+        return NULL;
+    }
+
+    const uint64_t endMs = s_scenario->done ? s_scenario->finishedMs : nowMs;
+    const uint64_t elapsedMs = s_scenario->startedMs == 0 ? 0 : endMs - s_scenario->startedMs;
+    unsigned int completed = 0;
+    unsigned int timedOut = 0;
+
+    for (size_t i = 0; i < s_scenario->stepCount; ++i)
+    {
+        ADUC_SimulatorStep* step = &s_scenario->steps[i];
+        JSON_Value* stepValue = json_value_init_object();
+        JSON_Object* stepObject = json_value_get_object(stepValue);
+        if (stepObject == NULL)
+        {
+            continue;
+        }
+
+        completed += step->completed;
+        timedOut += step->timedOut;
+
+        json_object_set_string(stepObject, "name", step->name);
+        json_object_set_number(stepObject, "completed", step->completed);
+        json_object_set_number(stepObject, "timedOut", step->timedOut);
+
+        if (step->latencyCount > 0)
+        {
+            uint64_t sum = 0;
+            qsort(step->latenciesMs, step->latencyCount, sizeof(*step->latenciesMs), CompareLatencies);
+            for (size_t j = 0; j < step->latencyCount; ++j)
+            {
+                sum += step->latenciesMs[j];
+            }
+
+            json_object_dotset_number(stepObject, "latencyMs.min", (double)step->latenciesMs[0]);
+            json_object_dotset_number(stepObject, "latencyMs.mean", (double)sum / (double)step->latencyCount);
+            json_object_dotset_number(
+                stepObject, "latencyMs.p50", (double)GetPercentile(step->latenciesMs, step->latencyCount, 50));
+            json_object_dotset_number(
+                stepObject, "latencyMs.p95", (double)GetPercentile(step->latenciesMs, step->latencyCount, 95));
+            json_object_dotset_number(
+                stepObject, "latencyMs.p99", (double)GetPercentile(step->latenciesMs, step->latencyCount, 99));
+            json_object_dotset_number(
+                stepObject, "latencyMs.max", (double)step->latenciesMs[step->latencyCount - 1]);
+        }
+
+        json_array_append_value(steps, stepValue);
+    }
+
+    json_object_set_boolean(results, "done", s_scenario->done);
+    json_object_set_number(results, "iterations", s_scenario->iteration);
+    json_object_set_number(results, "stepsCompleted", completed);
+    json_object_set_number(results, "stepsTimedOut", timedOut);
+    json_object_set_number(results, "reportedPatches", s_scenario->reportedPatches);
+    json_object_set_number(results, "injectedFailures", s_scenario->injectedFailures);
+    json_object_set_number(results, "events", s_scenario->events);
+    json_object_set_number(results, "elapsedMs", (double)elapsedMs);
+    json_object_set_number(
+        results, "stepsPerSecond", elapsedMs == 0 ? 0 : (double)(completed + timedOut) * 1000.0 / (double)elapsedMs);
+    json_object_set_value(results, "steps", stepsValue);
+
+    return resultsValue;
+}
+
+/**
+ * @brief Writes the results of the finished scenario to its results file, and requests the agent shutdown if asked.
+ */
+static void FinishScenario(uint64_t nowMs)
+{
+    s_scenario->done = true;
+    s_scenario->finishedMs = nowMs;
+
+    JSON_Value* resultsValue = BuildResults(nowMs);
+    char* results = resultsValue != NULL ? json_serialize_to_string_pretty(resultsValue) : NULL;
+
+    Log_Info("Hub simulator: scenario done. %s", results != NULL ? results : "");
+
+    if (results != NULL && s_scenario->resultsFilePath != NULL)
+    {
+        FILE* file = fopen(s_scenario->resultsFilePath, "w");
+        if (file == NULL || fputs(results, file) == EOF)
+        {
+            Log_Error("Hub simulator: cannot write the results to '%s'.", s_scenario->resultsFilePath);
+        }
+
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+    }
+
+    json_free_serialized_string(results);
+    json_value_free(resultsValue);
+
+    if (s_scenario->exitWhenDone)
+    {
+        raise(SIGTERM);
+    }
+}
+
+/**
+ * @brief Moves the scenario to its next step.
+ */
+static void AdvanceScenario(uint64_t nowMs)
+{
+    s_scenario->stepInFlight = false;
+    json_value_free(s_scenario->expectedValue);
+    s_scenario->expectedValue = NULL;
+
+    if (++s_scenario->stepIndex < s_scenario->stepCount)
+    {
+        return;
+    }
+
+    s_scenario->stepIndex = 0;
+    if (++s_scenario->iteration >= s_scenario->iterations)
+    {
+        FinishScenario(nowMs);
+    }
+}
+
+static void CompleteStep(ADUC_SimulatorStep* step, uint64_t nowMs)
+{
+    if (step->latencyCount == step->latencyCapacity)
+    {
+        const size_t capacity = step->latencyCapacity == 0 ? 64 : step->latencyCapacity * 2;
+        uint64_t* latencies = realloc(step->latenciesMs, capacity * sizeof(*latencies));
+        if (latencies != NULL)
+        {
+            step->latenciesMs = latencies;
+            step->latencyCapacity = capacity;
+        }
+    }
+
+    if (step->latencyCount < step->latencyCapacity)
+    {
+        step->latenciesMs[step->latencyCount++] = nowMs - s_scenario->stepStartedMs;
+    }
+
+    ++step->completed;
+    AdvanceScenario(nowMs);
+}
+
+/**
+ * @brief Completes the in-flight step if the reported @p patch carries its expected value.
+ */
+static void MatchReportedPatch(const JSON_Value* patch, uint64_t nowMs)
+{
+    if (s_scenario == NULL || s_scenario->done || !s_scenario->stepInFlight)
+    {
+        return;
+    }
+
+    ADUC_SimulatorStep* step = &s_scenario->steps[s_scenario->stepIndex];
+    if (step->expectedPath == NULL)
+    {
+        return;
+    }
+
+    const JSON_Value* value = json_object_dotget_value(json_value_get_object(patch), step->expectedPath);
+    if (value != NULL && json_value_equals(value, s_scenario->expectedValue))
+    {
+        CompleteStep(step, nowMs);
+    }
+}
+
+/**
+ * @brief Starts the current step: sends its desired patch, or invokes its method, to the connected client.
+ */
+static void StartStep(ADUC_SimulatorStep* step, uint64_t nowMs)
+{
+    s_scenario->stepInFlight = true;
+    s_scenario->stepStartedMs = nowMs;
+
+    if (step->expectedValueTemplate != NULL)
+    {
+        char* expectedValue = ExpandTemplate(step->expectedValueTemplate, s_scenario->iteration);
+        s_scenario->expectedValue = expectedValue != NULL ? json_parse_string(expectedValue) : NULL;
+        free(expectedValue);
+    }
+
+    if (step->desiredTemplate != NULL)
+    {
+        char* patch = ExpandTemplate(step->desiredTemplate, s_scenario->iteration);
+        if (patch == NULL || !ADUC_HubSimulator_PushDesired(patch))
+        {
+            Log_Error("Hub simulator: cannot send the desired patch of step '%s'.", step->name);
+        }
+
+        free(patch);
+    }
+
+    if (step->methodName != NULL && s_connectedClient->methodCallback != NULL)
+    {
+        char* payload = step->methodPayloadTemplate != NULL
+            ? ExpandTemplate(step->methodPayloadTemplate, s_scenario->iteration)
+            : NULL;
+        const size_t payloadSize = payload != NULL ? strlen(payload) : 0;
+
+        s_connectedClient->methodCallback(
+            step->methodName,
+            (const unsigned char*)payload,
+            payloadSize,
+            (METHOD_HANDLE)(uintptr_t)(s_scenario->iteration + 1),
+            s_connectedClient->methodContext);
+        free(payload);
+    }
+
+    if (step->expectedPath == NULL)
+    {
+        CompleteStep(step, nowMs);
+    }
+}
+
+/**
+ * @brief Runs the scenario: starts the next step once a client is connected, and times out the in-flight step.
+ */
+static void RunScenario(uint64_t nowMs)
+{
+    while (s_scenario != NULL && !s_scenario->done && s_connectedClient != NULL)
+    {
+        ADUC_SimulatorStep* step = &s_scenario->steps[s_scenario->stepIndex];
+
+        if (s_scenario->startedMs == 0)
+        {
+            s_scenario->startedMs = nowMs;
+        }
+
+        if (!s_scenario->stepInFlight)
+        {
+            StartStep(step, nowMs);
+            continue;
+        }
+
+        const uint64_t deadlineMs = s_scenario->stepStartedMs + step->timeoutMs;
+        if (nowMs < deadlineMs)
+        {
+            const uint64_t delayMs = deadlineMs - nowMs;
+            ADUC_Reactor_RequestWakeupInMs(delayMs > UINT_MAX ? UINT_MAX : (unsigned int)delayMs);
+            return;
+        }
+
+        Log_Warn("Hub simulator: step '%s' of iteration %u timed out.", step->name, s_scenario->iteration);
+        ++step->timedOut;
+        AdvanceScenario(nowMs);
+    }
+}
+
+//
+// Operations
+//
+
+static void CompleteReportedState(ADUC_SimulatedOperation* operation, uint64_t nowMs)
+{
+    int statusCode = 204;
+    JSON_Value* patch = json_parse_string(operation->payload);
+
+    if (json_value_get_type(patch) != JSONObject)
+    {
+        statusCode = 400;
+    }
+    else if (
+        s_scenario != NULL && s_scenario->reportedStateFailureRate > 0
+        && (double)rand_r(&s_scenario->randomState) / RAND_MAX < s_scenario->reportedStateFailureRate)
+    {
+        ++s_scenario->injectedFailures;
+        statusCode = 500;
+    }
+    else if (!ApplyPatch(GetOrCreateObject(&s_reported), json_value_get_object(patch)))
+    {
+        statusCode = 500;
+    }
+    else
+    {
+        ++s_reportedVersion;
+        if (s_scenario != NULL)
+        {
+            ++s_scenario->reportedPatches;
+        }
+    }
+
+    if (operation->reportedStateCallback != NULL)
+    {
+        operation->reportedStateCallback(statusCode, operation->context);
+    }
+
+    if (statusCode == 204)
+    {
+        MatchReportedPatch(patch, nowMs);
+    }
+
+    json_value_free(patch);
+}
+
+static void CompleteOperation(ADUC_SimulatedOperation* operation, uint64_t nowMs)
+{
+    ADUC_SimulatedClient* client = operation->client;
+
+    switch (operation->type)
+    {
+    case ADUC_SimulatedOperationType_Connect:
+        s_connectedClient = client;
+        if (client->connectionStatusCallback != NULL)
+        {
+            client->connectionStatusCallback(
+                IOTHUB_CLIENT_CONNECTION_AUTHENTICATED, IOTHUB_CLIENT_CONNECTION_OK, client->connectionStatusContext);
+        }
+
+        if (client->twinCallback != NULL)
+        {
+            DeliverTwin(client->twinCallback, client->twinContext);
+        }
+        break;
+
+    case ADUC_SimulatedOperationType_DesiredPatch:
+        if (client == s_connectedClient && client->twinCallback != NULL)
+        {
+            client->twinCallback(
+                DEVICE_TWIN_UPDATE_PARTIAL,
+                (const unsigned char*)operation->payload,
+                operation->payloadSize,
+                client->twinContext);
+        }
+        break;
+
+    case ADUC_SimulatedOperationType_GetTwin:
+        DeliverTwin(operation->twinCallback, operation->context);
+        break;
+
+    case ADUC_SimulatedOperationType_ReportedState:
+        CompleteReportedState(operation, nowMs);
+        break;
+
+    case ADUC_SimulatedOperationType_Event:
+        if (s_scenario != NULL)
+        {
+            ++s_scenario->events;
+        }
+
+        if (operation->eventCallback != NULL)
+        {
+            operation->eventCallback(IOTHUB_CLIENT_CONFIRMATION_OK, operation->context);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Queues an operation of @p type for @p client.
+ */
+static ADUC_SimulatedOperation* NewOperation(ADUC_SimulatedOperationType type, ADUC_SimulatedClient* client)
+{
+    ADUC_SimulatedOperation* operation = calloc(1, sizeof(*operation));
+    if (operation != NULL)
+    {
+        operation->type = type;
+        operation->client = client;
+    }
+
+    return operation;
+}
+
+//
+// Control interface (hub_simulator.h)
+//
+
+bool ADUC_HubSimulator_LoadScenario(const char* scenarioJson)
+{
+    JSON_Value* scenarioValue = json_parse_string(scenarioJson);
+    ADUC_SimulatorScenario* scenario = scenarioValue != NULL ? ParseScenario(scenarioValue) : NULL;
+    json_value_free(scenarioValue);
+
+    if (scenario == NULL)
+    {
+        return false;
+    }
+
+    FreeScenario(s_scenario);
+    s_scenario = scenario;
+    s_scenarioEnvironmentChecked = true;
+    ADUC_Reactor_Wakeup();
+    return true;
+}
+
+bool ADUC_HubSimulator_PushDesired(const char* patchJson)
+{
+    bool succeeded = false;
+    ADUC_SimulatedOperation* operation = NULL;
+    char* versionedPatch = NULL;
+    JSON_Value* patch = json_parse_string(patchJson);
+
+    if (json_value_get_type(patch) != JSONObject)
+    {
+        goto done;
+    }
+
+    if (!ApplyPatch(GetOrCreateObject(&s_desired), json_value_get_object(patch)))
+    {
+        goto done;
+    }
+
+    json_object_set_number(json_value_get_object(patch), "$version", ++s_desiredVersion);
+    versionedPatch = json_serialize_to_string(patch);
+
+    if (s_connectedClient != NULL)
+    {
+        operation = NewOperation(ADUC_SimulatedOperationType_DesiredPatch, s_connectedClient);
+        if (operation == NULL || versionedPatch == NULL)
+        {
+            goto done;
+        }
+
+        operation->payload = DuplicateString(versionedPatch);
+        operation->payloadSize = strlen(versionedPatch);
+        if (operation->payload == NULL)
+        {
+            goto done;
+        }
+
+        QueueOperation(operation);
+        operation = NULL;
+    }
+
+    succeeded = true;
+
+done:
+    if (operation != NULL)
+    {
+        FreeOperation(operation);
+    }
+
+    json_free_serialized_string(versionedPatch);
+    json_value_free(patch);
+    return succeeded;
+}
+
+char* ADUC_HubSimulator_GetReported()
+{
+    char* serialized = GetOrCreateObject(&s_reported) != NULL ? json_serialize_to_string(s_reported) : NULL;
+    char* reported = DuplicateString(serialized);
+    json_free_serialized_string(serialized);
+    return reported;
+}
+
+bool ADUC_HubSimulator_IsScenarioDone()
+{
+    return s_scenario != NULL && s_scenario->done;
+}
+
+char* ADUC_HubSimulator_GetResults()
+{
+    if (s_scenario == NULL)
+    {
+        return NULL;
+    }
+
+    JSON_Value* resultsValue = BuildResults(ADUC_Reactor_GetMonotonicTimeMs());
+    char* serialized = resultsValue != NULL ? json_serialize_to_string(resultsValue) : NULL;
+    char* results = DuplicateString(serialized);
+    json_free_serialized_string(serialized);
+    json_value_free(resultsValue);
+    return results;
+}
+
+void ADUC_HubSimulator_Reset()
+{
+    json_value_free(s_desired);
+    json_value_free(s_reported);
+    s_desired = NULL;
+    s_reported = NULL;
+    s_desiredVersion = 1;
+    s_reportedVersion = 1;
+
+    FreeScenario(s_scenario);
+    s_scenario = NULL;
+    s_scenarioEnvironmentChecked = false;
+}
+
+//
+// ClientHandle interface (client_handle_helper.h)
+//
+
+bool ClientHandle_CreateFromConnectionString(
+    ADUC_ClientHandle* iotHubClientHandle,
+    ADUC_ConnType type,
+    const char* connectionString,
+    IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol)
+{
+    UNREFERENCED_PARAMETER(protocol);
+
+    if (connectionString == NULL || iotHubClientHandle == NULL)
+    {
+        Log_Error("ClientHandle_CreateFromConnectionString called with NULL parameters");
+        return false;
+    }
+
+    if (type != ADUC_ConnType_Device && type != ADUC_ConnType_Module)
+    {
+        *iotHubClientHandle = NULL;
+        Log_Error("Invalid call of ClientHandle_CreateFromConnectionString without a valid ADUC_ConnType");
+        return false;
+    }
+
+    ADUC_SimulatedClient* client = calloc(1, sizeof(*client));
+    ADUC_SimulatedOperation* connect = NewOperation(ADUC_SimulatedOperationType_Connect, client);
+    if (client == NULL || connect == NULL)
+    {
+        free(client);
+        free(connect);
+        *iotHubClientHandle = NULL;
+        return false;
+    }
+
+    LoadScenarioFromEnvironment();
+
+    client->next = s_clients;
+    s_clients = client;
+    QueueOperation(connect);
+
+    *iotHubClientHandle = (ADUC_ClientHandle)client;
+    Log_Info("Hub simulator: created a simulated %s client.", type == ADUC_ConnType_Device ? "device" : "module");
+    return true;
+}
+
+IOTHUB_CLIENT_RESULT ClientHandle_SetConnectionStatusCallback(
+    ADUC_ClientHandle iotHubClientHandle,
+    IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback,
+    void* userContextCallback)
+{
+    ADUC_SimulatedClient* client = (ADUC_SimulatedClient*)iotHubClientHandle;
+    if (client == NULL)
+    {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    client->connectionStatusCallback = connectionStatusCallback;
+    client->connectionStatusContext = userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT ClientHandle_SendEventAsync(
+    ADUC_ClientHandle iotHubClientHandle,
+    IOTHUB_MESSAGE_HANDLE eventMessageHandle,
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback,
+    void* userContextCallback)
+{
+    ADUC_SimulatedClient* client = (ADUC_SimulatedClient*)iotHubClientHandle;
+    if (client == NULL || eventMessageHandle == NULL)
+    {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    ADUC_SimulatedOperation* operation = NewOperation(ADUC_SimulatedOperationType_Event, client);
+    if (operation == NULL)
+    {
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    operation->eventCallback = eventConfirmationCallback;
+    operation->context = userContextCallback;
+    QueueOperation(operation);
+    return IOTHUB_CLIENT_OK;
+}
+
+void ClientHandle_DoWork(ADUC_ClientHandle iotHubClientHandle)
+{
+    if (iotHubClientHandle == NULL)
+    {
+        return;
+    }
+
+    const uint64_t nowMs = ADUC_Reactor_GetMonotonicTimeMs();
+
+    // Complete the due operations, in order. Callbacks may queue more operations; those wait for the next call.
+    ADUC_SimulatedOperation* lastQueued = s_operationsTail;
+    while (s_operationsHead != NULL && s_operationsHead->dueTimeMs <= nowMs)
+    {
+        ADUC_SimulatedOperation* operation = s_operationsHead;
+        s_operationsHead = operation->next;
+        if (s_operationsHead == NULL)
+        {
+            s_operationsTail = NULL;
+        }
+
+        const bool wasLastQueued = operation == lastQueued;
+        CompleteOperation(operation, nowMs);
+        FreeOperation(operation);
+
+        if (wasLastQueued)
+        {
+            break;
+        }
+    }
+
+    if (s_operationsHead != NULL)
+    {
+        const uint64_t dueTimeMs = s_operationsHead->dueTimeMs;
+        ADUC_Reactor_RequestWakeupInMs(dueTimeMs > nowMs ? (unsigned int)(dueTimeMs - nowMs) : 0);
+    }
+
+    RunScenario(nowMs);
+}
+
+IOTHUB_CLIENT_RESULT
+ClientHandle_SetOption(ADUC_ClientHandle iotHubClientHandle, const char* optionName, const void* value)
+{
+    UNREFERENCED_PARAMETER(optionName);
+    UNREFERENCED_PARAMETER(value);
+    return iotHubClientHandle == NULL ? IOTHUB_CLIENT_INVALID_ARG : IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT ClientHandle_SetRetryPolicy(
+    ADUC_ClientHandle iotHubClientHandle, IOTHUB_CLIENT_RETRY_POLICY retryPolicy, size_t retryTimeoutLimitInSeconds)
+{
+    UNREFERENCED_PARAMETER(retryPolicy);
+    UNREFERENCED_PARAMETER(retryTimeoutLimitInSeconds);
+    return iotHubClientHandle == NULL ? IOTHUB_CLIENT_INVALID_ARG : IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT ClientHandle_GetTwinAsync(
+    ADUC_ClientHandle iotHubClientHandle,
+    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK deviceTwinCallback,
+    void* userContextCallback)
+{
+    ADUC_SimulatedClient* client = (ADUC_SimulatedClient*)iotHubClientHandle;
+    if (client == NULL || deviceTwinCallback == NULL)
+    {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    ADUC_SimulatedOperation* operation = NewOperation(ADUC_SimulatedOperationType_GetTwin, client);
+    if (operation == NULL)
+    {
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    operation->twinCallback = deviceTwinCallback;
+    operation->context = userContextCallback;
+    QueueOperation(operation);
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT ClientHandle_SetClientTwinCallback(
+    ADUC_ClientHandle iotHubClientHandle,
+    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK deviceTwinCallback,
+    void* userContextCallback)
+{
+    ADUC_SimulatedClient* client = (ADUC_SimulatedClient*)iotHubClientHandle;
+    if (client == NULL)
+    {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    client->twinCallback = deviceTwinCallback;
+    client->twinContext = userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT ClientHandle_SendReportedState(
+    ADUC_ClientHandle iotHubClientHandle,
+    const unsigned char* reportedState,
+    size_t size,
+    IOTHUB_CLIENT_REPORTED_STATE_CALLBACK reportedStateCallback,
+    void* userContextCallback)
+{
+    ADUC_SimulatedClient* client = (ADUC_SimulatedClient*)iotHubClientHandle;
+    if (client == NULL || reportedState == NULL || size == 0)
+    {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    ADUC_SimulatedOperation* operation = NewOperation(ADUC_SimulatedOperationType_ReportedState, client);
+    char* payload = malloc(size + 1);
+    if (operation == NULL || payload == NULL)
+    {
+        free(operation);
+        free(payload);
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    memcpy(payload, reportedState, size);
+    payload[size] = '\0';
+    operation->payload = payload;
+    operation->payloadSize = size;
+    operation->reportedStateCallback = reportedStateCallback;
+    operation->context = userContextCallback;
+    QueueOperation(operation);
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT ClientHandle_SetDeviceMethodCallback(
+    ADUC_ClientHandle iotHubClientHandle,
+    IOTHUB_CLIENT_DEVICE_METHOD_CALLBACK_ASYNC deviceMethodCallback,
+    void* userContextCallback)
+{
+    ADUC_SimulatedClient* client = (ADUC_SimulatedClient*)iotHubClientHandle;
+    if (client == NULL)
+    {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    client->methodCallback = deviceMethodCallback;
+    client->methodContext = userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+void ClientHandle_Destroy(ADUC_ClientHandle iotHubClientHandle)
+{
+    ADUC_SimulatedClient* client = (ADUC_SimulatedClient*)iotHubClientHandle;
+    if (client == NULL)
+    {
+        return;
+    }
+
+    // Like the SDK, complete the client's pending sends as failed, and drop its other operations.
+    ADUC_SimulatedOperation** link = &s_operationsHead;
+    s_operationsTail = NULL;
+    while (*link != NULL)
+    {
+        ADUC_SimulatedOperation* operation = *link;
+        if (operation->client != client)
+        {
+            s_operationsTail = operation;
+            link = &operation->next;
+            continue;
+        }
+
+        *link = operation->next;
+        if (operation->type == ADUC_SimulatedOperationType_Event && operation->eventCallback != NULL)
+        {
+            operation->eventCallback(IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY, operation->context);
+        }
+        else if (
+            operation->type == ADUC_SimulatedOperationType_ReportedState && operation->reportedStateCallback != NULL)
+        {
+            operation->reportedStateCallback(503, operation->context);
+        }
+
+        FreeOperation(operation);
+    }
+
+    for (ADUC_SimulatedClient** clientLink = &s_clients; *clientLink != NULL; clientLink = &(*clientLink)->next)
+    {
+        if (*clientLink == client)
+        {
+            *clientLink = client->next;
+            break;
+        }
+    }
+
+    if (s_connectedClient == client)
+    {
+        s_connectedClient = NULL;
+    }
+
+    free(client);
+}
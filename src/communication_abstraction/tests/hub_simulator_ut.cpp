@@ -0,0 +1,217 @@
+/**
+ * @file hub_simulator_ut.cpp
+ * @brief Unit tests for the in-process IoT Hub simulator.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/client_handle_helper.h"
+#include "aduc/hub_simulator.h"
+
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <parson.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Records what the simulator delivers to a client, and echoes the workflow id of each desired patch back
+ * as a reported property, like the agent reports the workflow it processes.
+ */
+class SimulatedAgent
+{
+public:
+    ADUC_ClientHandle handle = nullptr;
+    bool authenticated = false;
+    std::vector<std::pair<DEVICE_TWIN_UPDATE_STATE, std::string>> twinUpdates;
+    std::vector<int> reportedStatusCodes;
+
+    SimulatedAgent()
+    {
+        ADUC_HubSimulator_Reset();
+        REQUIRE(ClientHandle_CreateFromConnectionString(
+            &handle, ADUC_ConnType_Device, "HostName=sim;DeviceId=sim;SharedAccessKey=a2V5", nullptr));
+        REQUIRE(ClientHandle_SetClientTwinCallback(handle, OnTwin, this) == IOTHUB_CLIENT_OK);
+        REQUIRE(ClientHandle_SetConnectionStatusCallback(handle, OnConnectionStatus, this) == IOTHUB_CLIENT_OK);
+    }
+
+    SimulatedAgent(const SimulatedAgent&) = delete;
+    SimulatedAgent& operator=(const SimulatedAgent&) = delete;
+    SimulatedAgent(SimulatedAgent&&) = delete;
+    SimulatedAgent& operator=(SimulatedAgent&&) = delete;
+
+    ~SimulatedAgent()
+    {
+        ClientHandle_Destroy(handle);
+        ADUC_HubSimulator_Reset();
+    }
+
+    void Report(const std::string& patch)
+    {
+        REQUIRE(
+            ClientHandle_SendReportedState(
+                handle,
+                reinterpret_cast<const unsigned char*>(patch.c_str()),
+                patch.size(),
+                OnReportedState,
+                this)
+            == IOTHUB_CLIENT_OK);
+    }
+
+private:
+    static void OnConnectionStatus(
+        IOTHUB_CLIENT_CONNECTION_STATUS status, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void* context)
+    {
+        CHECK(reason == IOTHUB_CLIENT_CONNECTION_OK);
+        static_cast<SimulatedAgent*>(context)->authenticated = (status == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+    }
+
+    static void
+    OnTwin(DEVICE_TWIN_UPDATE_STATE state, const unsigned char* payload, size_t size, void* context)
+    {
+        auto* agent = static_cast<SimulatedAgent*>(context);
+        const std::string twin(reinterpret_cast<const char*>(payload), size);
+        agent->twinUpdates.emplace_back(state, twin);
+
+        JSON_Value* value = json_parse_string(twin.c_str());
+        const char* workflowId = json_object_dotget_string(
+            json_value_get_object(value),
+            state == DEVICE_TWIN_UPDATE_COMPLETE ? "desired.deviceUpdate.workflowId" : "deviceUpdate.workflowId");
+
+        if (workflowId != nullptr)
+        {
+            agent->Report(std::string(R"({"deviceUpdate":{"lastWorkflowId":")") + workflowId + R"("}})");
+        }
+
+        json_value_free(value);
+    }
+
+    static void OnReportedState(int statusCode, void* context)
+    {
+        static_cast<SimulatedAgent*>(context)->reportedStatusCodes.push_back(statusCode);
+    }
+};
+
+static std::string GetReported()
+{
+    char* reported = ADUC_HubSimulator_GetReported();
+    REQUIRE(reported != nullptr);
+    std::string result(reported);
+    free(reported);
+    return result;
+}
+
+TEST_CASE("The simulator connects the client and delivers the twin")
+{
+    SimulatedAgent agent;
+    REQUIRE(ADUC_HubSimulator_PushDesired(R"({"deviceUpdate":{"service":{"action":3}}})"));
+
+    ClientHandle_DoWork(agent.handle);
+
+    CHECK(agent.authenticated);
+    REQUIRE(agent.twinUpdates.size() == 1);
+    CHECK(agent.twinUpdates[0].first == DEVICE_TWIN_UPDATE_COMPLETE);
+    CHECK(agent.twinUpdates[0].second.find(R"("action":3)") != std::string::npos);
+
+    REQUIRE(ADUC_HubSimulator_PushDesired(R"({"deviceUpdate":{"service":{"action":255}}})"));
+    ClientHandle_DoWork(agent.handle);
+
+    REQUIRE(agent.twinUpdates.size() == 2);
+    CHECK(agent.twinUpdates[1].first == DEVICE_TWIN_UPDATE_PARTIAL);
+    CHECK(agent.twinUpdates[1].second.find(R"("action":255)") != std::string::npos);
+    CHECK(agent.twinUpdates[1].second.find(R"("$version":3)") != std::string::npos);
+
+    CHECK_FALSE(ADUC_HubSimulator_PushDesired("[1]"));
+}
+
+TEST_CASE("The simulator merges reported patches into the twin")
+{
+    SimulatedAgent agent;
+    ClientHandle_DoWork(agent.handle);
+
+    agent.Report(R"({"deviceUpdate":{"agent":{"state":0,"lastInstallResult":{"resultCode":700}}}})");
+    agent.Report(R"({"deviceUpdate":{"agent":{"state":6,"lastInstallResult":null}}})");
+    ClientHandle_DoWork(agent.handle);
+
+    CHECK(agent.reportedStatusCodes == std::vector<int>{ 204, 204 });
+    CHECK(GetReported() == R"({"deviceUpdate":{"agent":{"state":6}}})");
+}
+
+TEST_CASE("A scenario runs its steps and records their latency")
+{
+    SimulatedAgent agent;
+
+    SECTION("Each step completes when its expected value is reported")
+    {
+        REQUIRE(ADUC_HubSimulator_LoadScenario(
+            R"({ "iterations": 3, "steps": [ {)"
+            R"(   "name": "deploy",)"
+            R"(   "desired": { "deviceUpdate": { "workflowId": "w{{iteration}}" } },)"
+            R"(   "expectReported": { "path": "deviceUpdate.lastWorkflowId", "value": "w{{iteration}}" } } ] })"));
+
+        for (int i = 0; i < 100 && !ADUC_HubSimulator_IsScenarioDone(); ++i)
+        {
+            ClientHandle_DoWork(agent.handle);
+        }
+
+        REQUIRE(ADUC_HubSimulator_IsScenarioDone());
+
+        char* results = ADUC_HubSimulator_GetResults();
+        REQUIRE(results != nullptr);
+        JSON_Value* resultsValue = json_parse_string(results);
+        free(results);
+
+        const JSON_Object* resultsObject = json_value_get_object(resultsValue);
+        CHECK(json_object_get_number(resultsObject, "iterations") == 3);
+        CHECK(json_object_get_number(resultsObject, "stepsCompleted") == 3);
+        CHECK(json_object_get_number(resultsObject, "stepsTimedOut") == 0);
+        const JSON_Object* step = json_array_get_object(json_object_get_array(resultsObject, "steps"), 0);
+        CHECK(std::string(json_object_get_string(step, "name")) == "deploy");
+        CHECK(json_object_dotget_value(step, "latencyMs.p99") != nullptr);
+        json_value_free(resultsValue);
+
+        CHECK(GetReported().find(R"("lastWorkflowId":"w2")") != std::string::npos);
+    }
+
+    SECTION("A step times out when its expected value is not reported")
+    {
+        REQUIRE(ADUC_HubSimulator_LoadScenario(
+            R"({ "steps": [ { "desired": { "deviceUpdate": {} }, "timeoutMs": 1,)"
+            R"(   "expectReported": { "path": "deviceUpdate.agent.state", "value": 0 } } ] })"));
+
+        for (int i = 0; i < 100 && !ADUC_HubSimulator_IsScenarioDone(); ++i)
+        {
+            ClientHandle_DoWork(agent.handle);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+
+        REQUIRE(ADUC_HubSimulator_IsScenarioDone());
+        char* results = ADUC_HubSimulator_GetResults();
+        REQUIRE(results != nullptr);
+        CHECK(std::string(results).find(R"("stepsTimedOut":1)") != std::string::npos);
+        free(results);
+    }
+
+    SECTION("Reported patches fail at the configured rate")
+    {
+        REQUIRE(ADUC_HubSimulator_LoadScenario(
+            R"({ "reportedStateFailureRate": 1, "steps": [ { "desired": { "deviceUpdate": {} } } ] })"));
+
+        ClientHandle_DoWork(agent.handle);
+        agent.Report(R"({"deviceUpdate":{"agent":{"state":0}}})");
+        ClientHandle_DoWork(agent.handle);
+
+        CHECK(agent.reportedStatusCodes == std::vector<int>{ 500 });
+        CHECK(GetReported() == "{}");
+    }
+
+    SECTION("Invalid scenarios are rejected")
+    {
+        CHECK_FALSE(ADUC_HubSimulator_LoadScenario(R"({ "steps": [] })"));
+        CHECK_FALSE(ADUC_HubSimulator_LoadScenario(R"({ "steps": [ { "name": "nothing" } ] })"));
+        CHECK_FALSE(ADUC_HubSimulator_LoadScenario(
+            R"({ "steps": [ { "desired": {}, "expectReported": { "path": "a.b" } } ] })"));
+    }
+}
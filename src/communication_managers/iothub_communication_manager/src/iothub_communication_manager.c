@@ -13,6 +13,8 @@
 #include "aduc/connection_string_utils.h" // ConnectionStringUtils_DoesKeyExist
 #include "aduc/https_proxy_utils.h"
 #include "aduc/logging.h"
+#include "aduc/metrics_utils.h"
+#include "aduc/reactor_utils.h"
 #include "aduc/retry_utils.h"
 #include "aduc/string_c_utils.h" // LoadBufferWithFileContents
 #include <azure_c_shared_utility/shared_util_options.h>
@@ -33,8 +35,10 @@
 #include <aducpal/time.h> // ADUCPAL_clock_gettime
 #include <aducpal/unistd.h>
 #include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h> // strtol
 #include <sys/stat.h>
@@ -65,13 +69,63 @@ static bool g_iothub_client_initialized = false;
 static ADUC_PnPComponentClient_PropertyUpdate_Context* g_property_update_context = NULL;
 
 static time_t g_last_authenticated_time = 0; // The last authenticated timestamp (since epoch)
-static time_t g_next_authentication_attempt_time = 0; // Time stamp when we should try to authenticate with the hub.
+static uint64_t g_next_authentication_attempt_time_ms =
+    0; // Monotonic time when we should try to authenticate with the hub.
 static time_t g_first_unauthenticated_time = 0; // The first unauthenticated timestamp (since epoch)
-static time_t g_last_authentication_attempt_time = 0; // The last authentication attempt timestamp (since epoch)
+static uint64_t g_last_authentication_attempt_time_ms = 0; // The last authentication attempt (monotonic time)
 static time_t g_last_connection_status_callback_time =
     0; // The last time the connection callback was called (since epoch)
 static unsigned int g_authentication_retries = 0; // The total authentication retries count.
 
+/**
+ * @brief The backoff of the (re)authentication attempts. Jittered per device, so a fleet that lost its hub
+ * connection at the same time does not reconnect at the same time.
+ */
+static ADUC_Retry_Policy g_authentication_retry_policy;
+
+/**
+ * @brief How long before its expiry a SAS token from the Edge Identity Service is renewed.
+ */
+#define SAS_TOKEN_RENEWAL_MARGIN_SECONDS TIME_SPAN_ONE_HOUR_IN_SECONDS
+
+static time_t g_sas_token_expiry_time = 0; // The expiry of the current client's SAS token (since epoch), or 0.
+
+/**
+ * @brief Identifies the current client in the connection status callbacks. The callbacks of a client that was
+ * replaced carry an older generation, and are ignored.
+ */
+static unsigned int g_client_generation = 0;
+
+static uint64_t g_authentication_started_ms = 0; // When the pending (re)authentication started, or 0.
+
+/**
+ * @brief The SAS token renewal worker. The main thread starts and joins it; the fields below are guarded by
+ * g_token_renewal_mutex while it runs.
+ */
+static pthread_mutex_t g_token_renewal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t g_token_renewal_thread;
+static bool g_token_renewal_running = false; // Main thread only: the worker was started and not joined yet.
+static bool g_token_renewal_done = false;
+static bool g_token_renewal_succeeded = false;
+static ADUC_ConnectionInfo g_renewed_connection_info;
+static time_t g_renewed_token_expiry_time = 0;
+static uint64_t g_token_renewal_started_ms = 0;
+static uint64_t g_next_token_renewal_attempt_ms = 0;
+static ADUC_Retry_Policy g_token_renewal_retry_policy;
+
+static ADUC_Metric* g_reconnect_attempts_metric = NULL;
+static ADUC_Metric* g_connection_lost_metric = NULL;
+static ADUC_Metric* g_authenticated_metric = NULL;
+static ADUC_Metric* g_connection_state_transitions_metric = NULL;
+static ADUC_Metric* g_authentication_duration_metric = NULL;
+static ADUC_Metric* g_token_renewals_metric = NULL;
+static ADUC_Metric* g_token_renewal_failures_metric = NULL;
+
+/**
+ * @brief The bucket upper bounds of the authentication duration histogram, in milliseconds.
+ */
+static const uint64_t s_authenticationDurationBoundsMs[] = { 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000 };
+
 // Engine type for an OpenSSL Engine
 static const OPTION_OPENSSL_KEY_TYPE x509_key_from_engine = KEY_TYPE_ENGINE;
 
@@ -136,6 +190,50 @@ bool IoTHub_CommunicationManager_Init(
         return false;
     }
 
+    g_reconnect_attempts_metric = ADUC_Metrics_RegisterCounter(
+        "adu_iothub_reconnect_attempts_total", "Number of IoT Hub (re)authentication attempts.");
+    g_connection_lost_metric = ADUC_Metrics_RegisterCounter(
+        "adu_iothub_connection_lost_total", "Number of times the IoT Hub connection broke.");
+    g_authenticated_metric = ADUC_Metrics_RegisterGauge(
+        "adu_iothub_authenticated", "Whether the IoT Hub connection is authenticated (1) or not (0).");
+    g_connection_state_transitions_metric = ADUC_Metrics_RegisterCounter(
+        "adu_iothub_connection_state_transitions_total",
+        "Number of IoT Hub connection status changes (authenticated/unauthenticated).");
+    g_authentication_duration_metric = ADUC_Metrics_RegisterHistogram(
+        "adu_iothub_authentication_duration_ms",
+        "Time from starting a (re)authentication, or a SAS token renewal, to the client being authenticated.",
+        s_authenticationDurationBoundsMs,
+        ARRAY_SIZE(s_authenticationDurationBoundsMs));
+    g_token_renewals_metric = ADUC_Metrics_RegisterCounter(
+        "adu_iothub_sas_token_renewals_total", "Number of clients rolled over to a renewed SAS token.");
+    g_token_renewal_failures_metric = ADUC_Metrics_RegisterCounter(
+        "adu_iothub_sas_token_renewal_failures_total", "Number of failed SAS token renewals.");
+
+    if (!ADUC_Retry_Policy_Init(
+            &g_authentication_retry_policy,
+            ADUC_RETRY_DEFAULT_INITIAL_DELAY_MS,
+            TIME_SPAN_ONE_HOUR_IN_SECONDS * 1000UL,
+            0 /* failureThreshold */,
+            0 /* openDurationMs */))
+    {
+        Log_Error("Cannot initialize the authentication retry policy.");
+        IoTHub_Deinit();
+        return false;
+    }
+
+    if (!ADUC_Retry_Policy_Init(
+            &g_token_renewal_retry_policy,
+            TIME_SPAN_FIFTEEN_SECONDS_IN_SECONDS * 1000UL,
+            TIME_SPAN_FIVE_MINUTES_IN_SECONDS * 1000UL,
+            0 /* failureThreshold */,
+            0 /* openDurationMs */))
+    {
+        Log_Error("Cannot initialize the SAS token renewal retry policy.");
+        ADUC_Retry_Policy_Deinit(&g_authentication_retry_policy);
+        IoTHub_Deinit();
+        return false;
+    }
+
     g_aduc_client_handle_address = handle_address;
     g_device_twin_callback = device_twin_callback;
     g_property_update_context = property_update_context;
@@ -163,6 +261,14 @@ static void ADUC_DeviceClient_Destroy(ADUC_ClientHandle clientHandle)
  */
 void IoTHub_CommunicationManager_Deinit()
 {
+    if (g_token_renewal_running)
+    {
+        pthread_join(g_token_renewal_thread, NULL);
+        g_token_renewal_running = false;
+        g_token_renewal_done = false;
+        ADUC_ConnectionInfo_DeAlloc(&g_renewed_connection_info);
+    }
+
     if (g_aduc_client_handle_address != NULL && *g_aduc_client_handle_address != NULL)
     {
         ClientHandle_Destroy(*g_aduc_client_handle_address);
@@ -172,6 +278,8 @@ void IoTHub_CommunicationManager_Deinit()
     if (g_iothub_client_initialized)
     {
         IoTHub_Deinit();
+        ADUC_Retry_Policy_Deinit(&g_authentication_retry_policy);
+        ADUC_Retry_Policy_Deinit(&g_token_renewal_retry_policy);
         g_iothub_client_initialized = false;
     }
 }
@@ -199,39 +307,63 @@ ADUC_ClientHandle IoTHub_CommunicationManager_GetHandle()
  *
  * @param status An IoT Hub connection status
  * @param status_reason The value indicates the reason that the IoT Hub connection status change.
- * @param user_context_callback Additional context used for processing this status changed event.
+ * @param user_context_callback The generation of the client that reports the status.
  */
 void IoTHub_CommunicationManager_ConnectionStatus_Callback(
     IOTHUB_CLIENT_CONNECTION_STATUS status,
     IOTHUB_CLIENT_CONNECTION_STATUS_REASON status_reason,
     void* user_context_callback)
 {
-    UNREFERENCED_PARAMETER(user_context_callback);
     time_t now_time = GetTimeSinceEpochInSeconds();
+    const uint64_t now_time_ms = ADUC_Reactor_GetMonotonicTimeMs();
+
+    if ((unsigned int)(uintptr_t)user_context_callback != g_client_generation)
+    {
+        Log_Debug("Ignoring IotHub connection status %d of a replaced client, reason: %d", status, status_reason);
+        return;
+    }
 
     Log_Debug("IotHub connection status: %d, reason: %d", status, status_reason);
+
+    if (status != g_connection_status)
+    {
+        ADUC_Metrics_CounterAdd(g_connection_state_transitions_metric, 1);
+    }
+
     switch (status)
     {
     case IOTHUB_CLIENT_CONNECTION_AUTHENTICATED:
         g_last_authenticated_time = now_time;
         g_authentication_retries = 0;
+        ADUC_Retry_Policy_OnSuccess(&g_authentication_retry_policy);
+
+        if (g_authentication_started_ms != 0)
+        {
+            ADUC_Metrics_HistogramObserve(g_authentication_duration_metric, now_time_ms - g_authentication_started_ms);
+            g_authentication_started_ms = 0;
+        }
         break;
     case IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED:
         if (g_last_authenticated_time >= g_first_unauthenticated_time)
         {
             Log_Error("IoTHub connection is broken.");
             g_first_unauthenticated_time = now_time;
+            ADUC_Metrics_CounterAdd(g_connection_lost_metric, 1);
         }
         else
         {
             Log_Error(
                 "IoTHub connection is broken for %d seconds (will retry in %d seconds)",
                 now_time - g_first_unauthenticated_time,
-                g_next_authentication_attempt_time - now_time);
+                g_next_authentication_attempt_time_ms > now_time_ms
+                    ? (int)((g_next_authentication_attempt_time_ms - now_time_ms) / 1000)
+                    : 0);
         }
         break;
     }
 
+    ADUC_Metrics_GaugeSet(g_authenticated_metric, status == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED ? 1 : 0);
+
     g_connection_status = status;
     g_connection_status_reason = status_reason;
     g_last_connection_status_callback_time = now_time;
@@ -301,10 +433,14 @@ static IOTHUB_CLIENT_TRANSPORT_PROVIDER GetIotHubProtocolFromConfig()
  * @param outClientHandle clientHandle to be initialized with the connection info and launchArgs
  * @param connInfo struct containing the connection information for the DeviceClient
  * @param iotHubTracingEnabled A boolean indicates whether to enable the IoTHub tracing.
+ * @param generation The generation of the client, passed to the connection status callback.
  * @return true on success, false on failure
  */
 static bool ADUC_DeviceClient_Create(
-    ADUC_ClientHandle* outClientHandle, ADUC_ConnectionInfo* connInfo, const bool iotHubTracingEnabled)
+    ADUC_ClientHandle* outClientHandle,
+    ADUC_ConnectionInfo* connInfo,
+    const bool iotHubTracingEnabled,
+    unsigned int generation)
 {
     IOTHUB_CLIENT_RESULT iothubResult;
     HTTP_PROXY_OPTIONS proxyOptions;
@@ -407,7 +543,7 @@ static bool ADUC_DeviceClient_Create(
     }
     else if (
         (iothubResult = ClientHandle_SetConnectionStatusCallback(
-             *outClientHandle, IoTHub_CommunicationManager_ConnectionStatus_Callback, NULL))
+             *outClientHandle, IoTHub_CommunicationManager_ConnectionStatus_Callback, (void*)(uintptr_t)generation))
         != IOTHUB_CLIENT_OK)
     {
         Log_Error("Unable to set connection status callback, error=%d", iothubResult);
@@ -540,9 +676,12 @@ done:
 /**
  * @brief Get the Connection Info from Identity Service
  *
+ * @param[out] info The connection info.
+ * @param[out] tokenExpiryTime Optional. The expiry of the SAS token in @p info (since epoch), or 0 if @p info
+ *             authenticates with a certificate.
  * @return true if connection info can be obtained
  */
-bool GetConnectionInfoFromIdentityService(ADUC_ConnectionInfo* info)
+static bool GetConnectionInfoFromIdentityServiceWithExpiry(ADUC_ConnectionInfo* info, time_t* tokenExpiryTime)
 {
     bool succeeded = false;
     if (info == NULL)
@@ -565,25 +704,48 @@ bool GetConnectionInfoFromIdentityService(ADUC_ConnectionInfo* info)
         goto done;
     }
 
+    if (tokenExpiryTime != NULL)
+    {
+        *tokenExpiryTime = (info->authType == ADUC_AuthType_SASToken) ? expirySecsSinceEpoch : 0;
+    }
+
     succeeded = true;
 done:
 
     return succeeded;
 }
 
+/**
+ * @brief Get the Connection Info from Identity Service
+ *
+ * @return true if connection info can be obtained
+ */
+bool GetConnectionInfoFromIdentityService(ADUC_ConnectionInfo* info)
+{
+    return GetConnectionInfoFromIdentityServiceWithExpiry(info, NULL);
+}
+
 /**
  * @brief Gets the agent configuration information and loads it according to the provisioning scenario
  *
  * @param info the connection information that will be configured
+ * @param[out] tokenExpiryTime Optional. The expiry of a SAS token provisioned by the Edge Identity Service (since
+ *             epoch), or 0 if the connection info does not expire.
  * @return true on success; false on failure
  */
-bool GetAgentConfigInfo(ADUC_ConnectionInfo* info)
+static bool GetAgentConfigInfoWithTokenExpiry(ADUC_ConnectionInfo* info, time_t* tokenExpiryTime)
 {
     bool success = false;
     if (info == NULL)
     {
         return false;
     }
+
+    if (tokenExpiryTime != NULL)
+    {
+        *tokenExpiryTime = 0;
+    }
+
     const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
 
     if (config == NULL)
@@ -601,7 +763,7 @@ bool GetAgentConfigInfo(ADUC_ConnectionInfo* info)
 
     if (strcmp(agent->connectionType, "AIS") == 0)
     {
-        if (!GetConnectionInfoFromIdentityService(info))
+        if (!GetConnectionInfoFromIdentityServiceWithExpiry(info, tokenExpiryTime))
         {
             Log_Error("Failed to get connection information from AIS.");
             goto done;
@@ -633,6 +795,17 @@ done:
     return success;
 }
 
+/**
+ * @brief Gets the agent configuration information and loads it according to the provisioning scenario
+ *
+ * @param info the connection information that will be configured
+ * @return true on success; false on failure
+ */
+bool GetAgentConfigInfo(ADUC_ConnectionInfo* info)
+{
+    return GetAgentConfigInfoWithTokenExpiry(info, NULL);
+}
+
 /**
  * @brief Refresh the IotHub connection, then then set an IotHub client handle on every PnP sub-component.
  *
@@ -657,19 +830,27 @@ static void ADUC_Refresh_IotHub_Connection_SAS_Token()
         }
     }
 
+    g_authentication_started_ms = ADUC_Reactor_GetMonotonicTimeMs();
+
     ADUC_ConnectionInfo info;
     memset(&info, 0, sizeof(info));
-    if (!GetAgentConfigInfo(&info))
+    time_t tokenExpiryTime = 0;
+    if (!GetAgentConfigInfoWithTokenExpiry(&info, &tokenExpiryTime))
     {
         goto done;
     }
 
-    if (!ADUC_DeviceClient_Create(g_aduc_client_handle_address, &info, true /* iotHubTracingEnabled */))
+    if (!ADUC_DeviceClient_Create(
+            g_aduc_client_handle_address, &info, true /* iotHubTracingEnabled */, ++g_client_generation))
     {
         Log_Error("ADUC_DeviceClient_Create failed");
         goto done;
     }
 
+    g_sas_token_expiry_time = tokenExpiryTime;
+    g_next_token_renewal_attempt_ms = 0;
+    ADUC_Retry_Policy_OnSuccess(&g_token_renewal_retry_policy);
+
     if (g_iothub_client_handle_changed_callback != NULL)
     {
         g_iothub_client_handle_changed_callback(*g_aduc_client_handle_address);
@@ -696,9 +877,9 @@ static void Connection_Maintenance()
     // Try to (re)connect to the IoT Hub if:
     //   1. The connection is broken (or unauthenticated)
     //   2. It has been long enough since the last authentication attemps
-    time_t now_time = GetTimeSinceEpochInSeconds();
+    const uint64_t now_time_ms = ADUC_Reactor_GetMonotonicTimeMs();
 
-    if (now_time < g_next_authentication_attempt_time)
+    if (now_time_ms < g_next_authentication_attempt_time_ms)
     {
         return;
     }
@@ -707,8 +888,8 @@ static void Connection_Maintenance()
 
     // If we haven't tried to connect, no need to compute the next retry time.
     // Otherwise, compute next retry time we've attempted to authenticate after the previous time.
-    if (g_last_authentication_attempt_time != 0
-        && g_last_authentication_attempt_time >= g_next_authentication_attempt_time)
+    if (g_last_authentication_attempt_time_ms != 0
+        && g_last_authentication_attempt_time_ms >= g_next_authentication_attempt_time_ms)
     {
         // Decide whether to retry or not.
         // If retry needed, choose appropriate additional delay base on a nature of error.
@@ -758,25 +939,183 @@ static void Connection_Maintenance()
         }
 
         // Calculate the next retry time, then continue.
-        time_t nextRetryTime = ADUC_Retry_Delay_Calculator(
-            additionalDelayInSeconds,
-            g_authentication_retries /* current retires count */,
-            ADUC_RETRY_DEFAULT_INITIAL_DELAY_MS /* initialDelayUnitMilliSecs */,
-            TIME_SPAN_ONE_HOUR_IN_SECONDS,
-            ADUC_RETRY_DEFAULT_MAX_JITTER_PERCENT);
-
-        g_next_authentication_attempt_time = (nextRetryTime);
+        // The delay for the status reason is a floor; the policy backs off, with jitter, above it.
+        const unsigned long delayMs = ADUC_Retry_Policy_OnFailure(
+            &g_authentication_retry_policy, now_time_ms, (unsigned long)additionalDelayInSeconds * 1000UL);
+
+        g_next_authentication_attempt_time_ms = now_time_ms + delayMs;
         Log_Info(
-            "The connection is currently broken. Will try to authenticate in %d seconds.", nextRetryTime - now_time);
+            "The connection is currently broken. Will try to authenticate in %lu seconds (retries:%u).",
+            delayMs / 1000,
+            g_authentication_retries);
         return;
     }
 
     // Try to authenticate.
-    g_last_authentication_attempt_time = now_time;
+    g_last_authentication_attempt_time_ms = now_time_ms;
     g_authentication_retries++;
+    ADUC_Metrics_CounterAdd(g_reconnect_attempts_metric, 1);
     ADUC_Refresh_IotHub_Connection_SAS_Token();
 }
 
+/**
+ * @brief The SAS token renewal worker. Fetches the connection info with a new SAS token from the Edge Identity
+ * Service, which can take seconds, off the main thread.
+ *
+ * @param arg Unused.
+ * @return NULL
+ */
+static void* SasToken_RenewalWorker(void* arg)
+{
+    UNREFERENCED_PARAMETER(arg);
+
+    ADUC_ConnectionInfo info;
+    memset(&info, 0, sizeof(info));
+    time_t tokenExpiryTime = 0;
+    const bool succeeded = GetAgentConfigInfoWithTokenExpiry(&info, &tokenExpiryTime);
+
+    pthread_mutex_lock(&g_token_renewal_mutex);
+    g_renewed_connection_info = info;
+    g_renewed_token_expiry_time = tokenExpiryTime;
+    g_token_renewal_succeeded = succeeded;
+    g_token_renewal_done = true;
+    pthread_mutex_unlock(&g_token_renewal_mutex);
+
+    ADUC_Reactor_Wakeup();
+    return NULL;
+}
+
+/**
+ * @brief Replaces the current client with one that uses the renewed SAS token.
+ * The current client stops retrying its connection, so it does not reconnect with the old token while the new
+ * client is created, and is destroyed as soon as the new client is in place.
+ *
+ * @param nowMs The current monotonic time, in milliseconds.
+ */
+static void CompleteTokenRenewal(uint64_t nowMs)
+{
+    ADUC_ClientHandle newClientHandle = NULL;
+
+    pthread_mutex_lock(&g_token_renewal_mutex);
+    ADUC_ConnectionInfo info = g_renewed_connection_info;
+    memset(&g_renewed_connection_info, 0, sizeof(g_renewed_connection_info));
+    const time_t tokenExpiryTime = g_renewed_token_expiry_time;
+    const bool succeeded = g_token_renewal_succeeded;
+    g_token_renewal_done = false;
+    pthread_mutex_unlock(&g_token_renewal_mutex);
+
+    if (!succeeded)
+    {
+        Log_Error("Failed to get a renewed SAS token.");
+        goto done;
+    }
+
+    if (ClientHandle_SetRetryPolicy(*g_aduc_client_handle_address, IOTHUB_CLIENT_RETRY_NONE, 0) != IOTHUB_CLIENT_OK)
+    {
+        Log_Warn("Failed to stop the connection retries of the client being replaced.");
+    }
+
+    if (!ADUC_DeviceClient_Create(
+            &newClientHandle, &info, true /* iotHubTracingEnabled */, g_client_generation + 1))
+    {
+        Log_Error("Failed to create a client with the renewed SAS token.");
+        // The current client stays; let it reconnect again, with the SDK's default policy.
+        (void)ClientHandle_SetRetryPolicy(
+            *g_aduc_client_handle_address, IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER, 0);
+        goto done;
+    }
+
+    // From here on, the status callbacks of the replaced client are ignored.
+    g_client_generation++;
+    ADUC_ClientHandle oldClientHandle = *g_aduc_client_handle_address;
+    *g_aduc_client_handle_address = newClientHandle;
+    ADUC_DeviceClient_Destroy(oldClientHandle);
+
+    g_sas_token_expiry_time = tokenExpiryTime;
+    g_authentication_started_ms = g_token_renewal_started_ms;
+
+    if (g_iothub_client_handle_changed_callback != NULL)
+    {
+        g_iothub_client_handle_changed_callback(*g_aduc_client_handle_address);
+    }
+
+    ADUC_Retry_Policy_OnSuccess(&g_token_renewal_retry_policy);
+    ADUC_Metrics_CounterAdd(g_token_renewals_metric, 1);
+    Log_Info("Renewed the SAS token of the IoT Hub connection.");
+
+done:
+    if (newClientHandle == NULL)
+    {
+        ADUC_Metrics_CounterAdd(g_token_renewal_failures_metric, 1);
+        const unsigned long delayMs = ADUC_Retry_Policy_OnFailure(&g_token_renewal_retry_policy, nowMs, 0);
+        g_next_token_renewal_attempt_ms = nowMs + delayMs;
+        Log_Info("Will retry the SAS token renewal in %lu seconds.", delayMs / 1000);
+    }
+
+    ADUC_ConnectionInfo_DeAlloc(&info);
+}
+
+/**
+ * @brief Renews the SAS token of the connection ahead of its expiry, so the IoT Hub never drops the connection
+ * for an expired token.
+ */
+static void SasToken_Maintenance()
+{
+    const uint64_t now_time_ms = ADUC_Reactor_GetMonotonicTimeMs();
+
+    if (g_token_renewal_running)
+    {
+        pthread_mutex_lock(&g_token_renewal_mutex);
+        const bool done = g_token_renewal_done;
+        pthread_mutex_unlock(&g_token_renewal_mutex);
+
+        if (done)
+        {
+            pthread_join(g_token_renewal_thread, NULL);
+            g_token_renewal_running = false;
+            CompleteTokenRenewal(now_time_ms);
+        }
+        return;
+    }
+
+    if (g_sas_token_expiry_time == 0 || !IoTHub_CommunicationManager_IsAuthenticated())
+    {
+        return;
+    }
+
+    const time_t now_time = GetTimeSinceEpochInSeconds();
+    const time_t renewal_time = g_sas_token_expiry_time - SAS_TOKEN_RENEWAL_MARGIN_SECONDS;
+
+    if (now_time < renewal_time)
+    {
+        const time_t delaySeconds = renewal_time - now_time;
+        ADUC_Reactor_RequestWakeupInMs(
+            delaySeconds > (time_t)(UINT_MAX / 1000) ? UINT_MAX : (unsigned int)delaySeconds * 1000U);
+        return;
+    }
+
+    if (now_time_ms < g_next_token_renewal_attempt_ms)
+    {
+        ADUC_Reactor_RequestWakeupInMs((unsigned int)(g_next_token_renewal_attempt_ms - now_time_ms));
+        return;
+    }
+
+    Log_Info("The SAS token expires in %ld seconds. Renewing it.", (long)(g_sas_token_expiry_time - now_time));
+    g_token_renewal_started_ms = now_time_ms;
+    g_token_renewal_done = false;
+
+    if (pthread_create(&g_token_renewal_thread, NULL, SasToken_RenewalWorker, NULL) != 0)
+    {
+        Log_Error("Cannot start the SAS token renewal worker.");
+        ADUC_Metrics_CounterAdd(g_token_renewal_failures_metric, 1);
+        g_next_token_renewal_attempt_ms =
+            now_time_ms + ADUC_Retry_Policy_OnFailure(&g_token_renewal_retry_policy, now_time_ms, 0);
+        return;
+    }
+
+    g_token_renewal_running = true;
+}
+
 /**
  * @brief Performs the connection management tasks synchronously (in the caller's thread context).
  *
@@ -787,5 +1126,12 @@ void IoTHub_CommunicationManager_DoWork(void* user_context)
 {
     UNREFERENCED_PARAMETER(user_context);
     Connection_Maintenance();
+    SasToken_Maintenance();
     ClientHandle_DoWork(*g_aduc_client_handle_address);
+
+    // While (re)connecting, the low-level client must be serviced at the regular cadence.
+    if (!IoTHub_CommunicationManager_IsAuthenticated())
+    {
+        ADUC_Reactor_RequestWakeupInMs(ADUC_REACTOR_TRANSPORT_BUSY_INTERVAL_MS);
+    }
 }
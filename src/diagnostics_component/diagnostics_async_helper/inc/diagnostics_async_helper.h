@@ -18,6 +18,8 @@ typedef struct tagDiagnosticWorkflowData DiagnosticsWorkflowData;
 void DiagnosticsWorkflow_DiscoverAndUploadLogsAsync(
     const DiagnosticsWorkflowData* workflowData, const char* jsonString);
 
+void DiagnosticsWorkflow_StopAsyncUploads(void);
+
 EXTERN_C_END
 
 #endif // DIAGNOSTICS_ASYNC_HELPER_H
@@ -7,117 +7,107 @@
  */
 
 #include "diagnostics_async_helper.h"
+#include "diagnostics_job_queue.hpp"
 
 #include <aduc/logging.h>
-#include <aduc/string_handle_wrapper.hpp>
-#include <azure_c_shared_utility/strings.h>
+#include <diagnostics_interface.h>
 #include <diagnostics_workflow.h>
-#include <mutex>
 #include <operation_id_utils.h>
-#include <thread>
-#include <vector>
+#include <parson.h>
 
 /**
- * @brief Wraps the DiagnosticsWorkflow to work asynchronously
- * @details Only allows one DiagnosticsWorkflow at a time, will block until the old thread has finished otherwise
+ * @brief Maximum number of DiagnosticsWorkflows running at a time
+ * @details Workflows share the completed operation-id record, which OperationIdUtils_StoreCompletedOperationId
+ * does not protect, and uploads are already concurrent within a workflow.
  */
-class DiagnosticsWorkflowManager
+#define DIAGNOSTICS_MAX_CONCURRENT_WORKFLOWS 1
+
+/**
+ * @brief Maximum number of requests waiting for a worker; later requests are reported as Diagnostics_Result_QueueFull
+ */
+#define DIAGNOSTICS_MAX_QUEUED_WORKFLOWS 16
+
+/**
+ * @brief Cancellation callback for DiagnosticsWorkflow_DiscoverAndUploadLogsCancellable
+ * @param context the std::atomic<bool> set by DiagnosticsJobQueue::Stop()
+ */
+static bool IsWorkflowCancelled(void* context)
 {
-private:
-    std::thread worker; //!< current thread doing work
-
-public:
-    explicit DiagnosticsWorkflowManager() = default;
-    DiagnosticsWorkflowManager(const DiagnosticsWorkflowManager&) = delete;
-    DiagnosticsWorkflowManager(DiagnosticsWorkflowManager&&) = delete;
-    DiagnosticsWorkflowManager& operator=(const DiagnosticsWorkflowManager&) = delete;
-    DiagnosticsWorkflowManager& operator=(DiagnosticsWorkflowManager&&) = delete;
-
-    /**
-     *@brief Joins the old worker thread if it is still working and then starts a new diagnostics workflow using the parameters passed
-     * @param diagnosticsWorkflowData workflowData struct that describes the configuration for the DiagnosticsWorkflow
-     * @param jsonStringHandle the message from the PnP interface to be parsed for the operation-id and sas-credential
-     */
-    void
-    StartDiagnosticsWorkflow(const DiagnosticsWorkflowData* diagnosticsWorkflowData, STRING_HANDLE jsonStringHandle)
+    return static_cast<const std::atomic<bool>*>(context)->load();
+}
+
+/**
+ * @brief Runs one request on a DiagnosticsJobQueue worker
+ * @param workflowData struct that describes the configuration for the DiagnosticsWorkflow
+ * @param request the message from the PnP interface to be parsed for the operation-id and sas-credential
+ * @param cancelled set when the workflow should stop
+ */
+static void RunDiagnosticsWorkflow(
+    const DiagnosticsWorkflowData* workflowData, const std::string& request, const std::atomic<bool>& cancelled)
+{
+    //
+    // Required to prevent duplicate requests coming down from the service after
+    // restart or a connection refresh
+    //
+    if (OperationIdUtils_OperationIsComplete(request.c_str()))
     {
-        try
-        {
-            if (worker.joinable())
-            {
-                worker.join();
-            }
-
-            //
-            // Required to prevent duplicate requests coming down from the service after
-            // restart or a connection refresh
-            //
-            if (OperationIdUtils_OperationIsComplete(STRING_c_str(jsonStringHandle)))
-            {
-                return;
-            }
-
-            STRING_HANDLE jsonStringHandleClone = STRING_clone(jsonStringHandle);
-
-            std::thread newWorker{ [diagnosticsWorkflowData, jsonStringHandleClone] {
-                ADUC::StringUtils::STRING_HANDLE_wrapper cloneWrapper(jsonStringHandleClone);
-
-                try
-                {
-                    DiagnosticsWorkflow_DiscoverAndUploadLogs(diagnosticsWorkflowData, cloneWrapper.c_str());
-                }
-                catch (const std::exception& e)
-                {
-                    Log_Error("StartNewDiagnosticsWorkflowThread worker thread failed with exception: %s", e.what());
-                }
-                catch (...)
-                {
-                    Log_Error("StartNewDiagnosticsWorkflowThread worker thread failed with unknown exception");
-                }
-            } };
-
-            worker = std::move(newWorker);
-        }
-        catch (const std::exception& e)
-        {
-            Log_Error("StartNewDiagnosticsWorkflowThread worker thread failed with exception: %s", e.what());
-        }
-        catch (...)
-        {
-            Log_Error("StartNewDiagnosticsWorkflowThread failed with unknown exception");
-        }
-
-        STRING_delete(jsonStringHandle);
+        return;
     }
 
-    /**
-     * @brief Destructor assures that the worker thread will have been joined before exiting
-    */
-    ~DiagnosticsWorkflowManager()
+    DiagnosticsWorkflow_DiscoverAndUploadLogsCancellable(
+        workflowData, request.c_str(), IsWorkflowCancelled, const_cast<std::atomic<bool>*>(&cancelled));
+}
+
+/**
+ * @brief Returns the operation-id of @p jsonString, or an empty string if it has none
+ */
+static std::string GetOperationId(const char* jsonString)
+{
+    std::string operationId;
+
+    JSON_Value* requestJson = json_parse_string(jsonString);
+    const char* value =
+        json_object_get_string(json_value_get_object(requestJson), DIAGNOSTICSITF_FIELDNAME_OPERATIONID);
+    if (value != nullptr)
     {
-        if (worker.joinable())
-        {
-            worker.join();
-        }
+        operationId = value;
     }
-};
 
-static DiagnosticsWorkflowManager s_DiagnosticsManager;
+    json_value_free(requestJson);
+
+    return operationId;
+}
+
+static DiagnosticsJobQueue s_DiagnosticsJobQueue{
+    [](Diagnostics_Result result, const std::string& operationId) {
+        DiagnosticsInterface_ReportStateAndResultAsync(result, operationId.c_str());
+    },
+    DIAGNOSTICS_MAX_CONCURRENT_WORKFLOWS,
+    DIAGNOSTICS_MAX_QUEUED_WORKFLOWS
+};
 
 /**
  * @brief Asynchronously begins the Diagnosticss workflow for discovering and uploading logs
- * @details Only asynchronous when there is not already a thread running a workflow.
+ * @details Requests are queued and run in order; a request for an operation-id that is already queued or running
+ * is ignored.
  * @param[in] workflowData struct containing the configuration information for the diagnostics component
  * @param[in] jsonString json string from the service contianing the operation-id and sas url
  */
 void DiagnosticsWorkflow_DiscoverAndUploadLogsAsync(
     const DiagnosticsWorkflowData* workflowData, const char* jsonString)
 {
-    try
+    if (jsonString == nullptr)
     {
-        STRING_HANDLE jsonStringHandle = STRING_construct(jsonString);
+        return;
+    }
 
-        s_DiagnosticsManager.StartDiagnosticsWorkflow(workflowData, jsonStringHandle);
+    try
+    {
+        std::string request{ jsonString };
+        s_DiagnosticsJobQueue.Enqueue(
+            GetOperationId(jsonString), [workflowData, request](const std::atomic<bool>& cancelled) {
+                RunDiagnosticsWorkflow(workflowData, request, cancelled);
+            });
     }
     catch (const std::exception& e)
     {
@@ -129,3 +119,18 @@ void DiagnosticsWorkflow_DiscoverAndUploadLogsAsync(
         Log_Error("DiagnosticsAsyncHelper_DiscoverAndUploadFiles failed with unknown exception");
     }
 }
+
+/**
+ * @brief Cancels the queued and running Diagnostics workflows and waits for them to return
+ */
+void DiagnosticsWorkflow_StopAsyncUploads()
+{
+    try
+    {
+        s_DiagnosticsJobQueue.Stop();
+    }
+    catch (...)
+    {
+        Log_Error("DiagnosticsWorkflow_StopAsyncUploads failed with unknown exception");
+    }
+}
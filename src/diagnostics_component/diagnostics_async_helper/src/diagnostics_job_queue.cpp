@@ -0,0 +1,164 @@
+/**
+ * @file diagnostics_job_queue.cpp
+ * @brief Implementation of the queue of diagnostics log upload requests
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "diagnostics_job_queue.hpp"
+
+#include <aduc/logging.h>
+#include <utility>
+
+DiagnosticsJobQueue::DiagnosticsJobQueue(Reporter reporter, size_t maxConcurrentJobs, size_t maxQueuedJobs)
+    : reporter(std::move(reporter)), maxConcurrentJobs(maxConcurrentJobs == 0 ? 1 : maxConcurrentJobs),
+      maxQueuedJobs(maxQueuedJobs)
+{
+}
+
+DiagnosticsJobQueue::~DiagnosticsJobQueue()
+{
+    Stop();
+}
+
+DiagnosticsJobQueue::EnqueueResult DiagnosticsJobQueue::Enqueue(const std::string& operationId, Work work)
+{
+    EnqueueResult result = EnqueueResult::Queued;
+
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+
+        if (stopping)
+        {
+            result = EnqueueResult::Stopped;
+        }
+        else if (!operationId.empty() && pendingOperationIds.count(operationId) != 0)
+        {
+            Log_Info("Diagnostics operation '%s' is already pending", operationId.c_str());
+            return EnqueueResult::Coalesced;
+        }
+        else if (jobs.size() >= maxQueuedJobs)
+        {
+            result = EnqueueResult::QueueFull;
+        }
+        else
+        {
+            jobs.push_back(Job{ operationId, std::move(work) });
+            pendingOperationIds.insert(operationId);
+
+            // Start a worker unless the idle ones can take the job.
+            if (workers.size() < maxConcurrentJobs && workers.size() < runningJobs + jobs.size())
+            {
+                workers.emplace_back(&DiagnosticsJobQueue::WorkerMain, this);
+            }
+
+            Log_Info(
+                "Queued diagnostics operation '%s', %zu queued and %zu running",
+                operationId.c_str(),
+                jobs.size(),
+                runningJobs);
+        }
+    }
+
+    if (result == EnqueueResult::Queued)
+    {
+        jobAvailable.notify_one();
+    }
+    else if (result == EnqueueResult::QueueFull)
+    {
+        Log_Warn("Diagnostics queue is full, rejecting operation '%s'", operationId.c_str());
+        reporter(Diagnostics_Result_QueueFull, operationId);
+    }
+    else
+    {
+        Log_Info("Diagnostics queue is stopping, dropping operation '%s'", operationId.c_str());
+    }
+
+    return result;
+}
+
+void DiagnosticsJobQueue::Stop()
+{
+    std::deque<Job> droppedJobs;
+    std::vector<std::thread> stoppedWorkers;
+
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        if (stopping)
+        {
+            return;
+        }
+
+        stopping = true;
+        cancelled = true;
+        droppedJobs.swap(jobs);
+        for (const auto& job : droppedJobs)
+        {
+            pendingOperationIds.erase(pendingOperationIds.find(job.operationId));
+        }
+        stoppedWorkers.swap(workers);
+    }
+
+    jobAvailable.notify_all();
+
+    for (const auto& job : droppedJobs)
+    {
+        Log_Info("Dropping queued diagnostics operation '%s'", job.operationId.c_str());
+    }
+
+    for (auto& worker : stoppedWorkers)
+    {
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock{ mutex };
+    stopping = false;
+    cancelled = false;
+}
+
+size_t DiagnosticsJobQueue::PendingCount() const
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    return pendingOperationIds.size();
+}
+
+void DiagnosticsJobQueue::WorkerMain()
+{
+    std::unique_lock<std::mutex> lock{ mutex };
+
+    while (true)
+    {
+        jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (stopping)
+        {
+            return;
+        }
+
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        ++runningJobs;
+
+        lock.unlock();
+
+        try
+        {
+            job.work(cancelled);
+        }
+        catch (const std::exception& e)
+        {
+            Log_Error("Diagnostics operation '%s' failed with exception: %s", job.operationId.c_str(), e.what());
+        }
+        catch (...)
+        {
+            Log_Error("Diagnostics operation '%s' failed with unknown exception", job.operationId.c_str());
+        }
+
+        lock.lock();
+
+        --runningJobs;
+        pendingOperationIds.erase(pendingOperationIds.find(job.operationId));
+    }
+}
@@ -0,0 +1,108 @@
+/**
+ * @file diagnostics_job_queue.hpp
+ * @brief Queue of diagnostics log upload requests, serviced by a bounded number of worker threads
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef DIAGNOSTICS_JOB_QUEUE_HPP
+#define DIAGNOSTICS_JOB_QUEUE_HPP
+
+#include <diagnostics_result.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Queues diagnostics requests and runs them in order on up to maxConcurrentJobs worker threads
+ * @details A request whose operation-id is already queued or running is coalesced into it, so the service
+ * resending its desired property after a reconnect does not upload the logs twice.
+ * Workers are started on the first request and joined by Stop().
+ */
+class DiagnosticsJobQueue
+{
+public:
+    /**
+     * @brief Runs one request. Should return early once @p cancelled is set, without reporting.
+     */
+    using Work = std::function<void(const std::atomic<bool>& cancelled)>;
+
+    /**
+     * @brief Reports the result of a request that will not be run
+     */
+    using Reporter = std::function<void(Diagnostics_Result result, const std::string& operationId)>;
+
+    /**
+     * @brief The outcome of Enqueue()
+     */
+    enum class EnqueueResult
+    {
+        Queued, //!< the request will be run
+        Coalesced, //!< a request with the same operation-id is already queued or running
+        QueueFull, //!< the request was rejected and reported as Diagnostics_Result_QueueFull
+        Stopped, //!< the queue is stopping; the request was dropped without being reported
+    };
+
+    DiagnosticsJobQueue(Reporter reporter, size_t maxConcurrentJobs, size_t maxQueuedJobs);
+    DiagnosticsJobQueue(const DiagnosticsJobQueue&) = delete;
+    DiagnosticsJobQueue(DiagnosticsJobQueue&&) = delete;
+    DiagnosticsJobQueue& operator=(const DiagnosticsJobQueue&) = delete;
+    DiagnosticsJobQueue& operator=(DiagnosticsJobQueue&&) = delete;
+
+    /**
+     * @brief Stops the queue, see Stop()
+     */
+    ~DiagnosticsJobQueue();
+
+    /**
+     * @brief Queues the request identified by @p operationId
+     * @param operationId the operation-id of the request; requests without one are never coalesced
+     * @param work runs the request on a worker thread
+     * @returns how the request was handled
+     */
+    EnqueueResult Enqueue(const std::string& operationId, Work work);
+
+    /**
+     * @brief Cancels the running requests, drops the queued ones and joins the workers
+     * @details Stop() runs at shutdown, when results can no longer be reported, so the dropped requests are not
+     * reported: their operation-ids are not recorded as completed, and the service requests them again.
+     * The queue accepts requests again once Stop() returns.
+     */
+    void Stop();
+
+    /**
+     * @brief Returns the number of requests queued or running
+     */
+    size_t PendingCount() const;
+
+private:
+    struct Job
+    {
+        std::string operationId;
+        Work work;
+    };
+
+    void WorkerMain();
+
+    Reporter reporter;
+    const size_t maxConcurrentJobs;
+    const size_t maxQueuedJobs;
+
+    mutable std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::deque<Job> jobs; //!< queued requests, oldest first
+    std::multiset<std::string> pendingOperationIds; //!< operation-ids of the queued and running requests
+    size_t runningJobs = 0;
+    bool stopping = false;
+    std::atomic<bool> cancelled{ false };
+    std::vector<std::thread> workers;
+};
+
+#endif // DIAGNOSTICS_JOB_QUEUE_HPP
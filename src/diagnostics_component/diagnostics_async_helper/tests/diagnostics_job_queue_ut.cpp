@@ -0,0 +1,221 @@
+/**
+ * @file diagnostics_job_queue_ut.cpp
+ * @brief Unit Tests for the diagnostics job queue
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "diagnostics_job_queue.hpp"
+
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <future>
+#include <map>
+
+using namespace std::chrono_literals;
+
+/**
+ * @brief Records the reported results, by operation-id
+ */
+class ReportedResults
+{
+public:
+    DiagnosticsJobQueue::Reporter Reporter()
+    {
+        return [this](Diagnostics_Result result, const std::string& operationId) {
+            std::lock_guard<std::mutex> lock{ mutex };
+            results[operationId] = result;
+        };
+    }
+
+    std::map<std::string, Diagnostics_Result> Get()
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        return results;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::string, Diagnostics_Result> results;
+};
+
+/**
+ * @brief A gate that blocks jobs until it is opened
+ */
+class Gate
+{
+public:
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock{ mutex };
+        ++waiting;
+        changed.notify_all();
+        changed.wait(lock, [this] { return open; });
+        --waiting;
+    }
+
+    bool WaitForWaiting(int count)
+    {
+        std::unique_lock<std::mutex> lock{ mutex };
+        return changed.wait_for(lock, 5s, [this, count] { return waiting >= count; });
+    }
+
+    int Waiting()
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        return waiting;
+    }
+
+    void Open()
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        open = true;
+        changed.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    int waiting = 0;
+    bool open = false;
+};
+
+static bool WaitForIdle(const DiagnosticsJobQueue& queue)
+{
+    for (int i = 0; i < 500 && queue.PendingCount() != 0; ++i)
+    {
+        std::this_thread::sleep_for(10ms);
+    }
+    return queue.PendingCount() == 0;
+}
+
+TEST_CASE("DiagnosticsJobQueue runs every request in order")
+{
+    ReportedResults reported;
+    DiagnosticsJobQueue queue{ reported.Reporter(), 1, 16 };
+
+    std::mutex mutex;
+    std::vector<std::string> ran;
+    for (const char* operationId : { "op-1", "op-2", "op-3" })
+    {
+        CHECK(
+            queue.Enqueue(
+                operationId,
+                [&mutex, &ran, operationId](const std::atomic<bool>&) {
+                    std::lock_guard<std::mutex> lock{ mutex };
+                    ran.emplace_back(operationId);
+                })
+            == DiagnosticsJobQueue::EnqueueResult::Queued);
+    }
+
+    REQUIRE(WaitForIdle(queue));
+    CHECK(ran == std::vector<std::string>{ "op-1", "op-2", "op-3" });
+    CHECK(reported.Get().empty());
+}
+
+TEST_CASE("DiagnosticsJobQueue coalesces pending operation-ids")
+{
+    ReportedResults reported;
+    DiagnosticsJobQueue queue{ reported.Reporter(), 1, 16 };
+
+    Gate gate;
+    std::atomic<int> runs{ 0 };
+    const auto work = [&gate, &runs](const std::atomic<bool>&) {
+        ++runs;
+        gate.Wait();
+    };
+
+    CHECK(queue.Enqueue("op-1", work) == DiagnosticsJobQueue::EnqueueResult::Queued);
+    REQUIRE(gate.WaitForWaiting(1));
+
+    // Running and queued requests are both coalesced.
+    CHECK(queue.Enqueue("op-1", work) == DiagnosticsJobQueue::EnqueueResult::Coalesced);
+    CHECK(queue.Enqueue("op-2", work) == DiagnosticsJobQueue::EnqueueResult::Queued);
+    CHECK(queue.Enqueue("op-2", work) == DiagnosticsJobQueue::EnqueueResult::Coalesced);
+
+    // Requests without an operation-id are not.
+    CHECK(queue.Enqueue("", work) == DiagnosticsJobQueue::EnqueueResult::Queued);
+    CHECK(queue.Enqueue("", work) == DiagnosticsJobQueue::EnqueueResult::Queued);
+
+    gate.Open();
+    REQUIRE(WaitForIdle(queue));
+    CHECK(runs == 4);
+
+    // A completed operation-id can be queued again.
+    CHECK(queue.Enqueue("op-1", work) == DiagnosticsJobQueue::EnqueueResult::Queued);
+    REQUIRE(WaitForIdle(queue));
+    CHECK(runs == 5);
+}
+
+TEST_CASE("DiagnosticsJobQueue limits the concurrent requests")
+{
+    ReportedResults reported;
+    DiagnosticsJobQueue queue{ reported.Reporter(), 2, 16 };
+
+    Gate gate;
+    for (int i = 0; i < 5; ++i)
+    {
+        queue.Enqueue("op-" + std::to_string(i), [&gate](const std::atomic<bool>&) { gate.Wait(); });
+    }
+
+    REQUIRE(gate.WaitForWaiting(2));
+    std::this_thread::sleep_for(50ms);
+    CHECK(gate.Waiting() == 2);
+    CHECK(queue.PendingCount() == 5);
+
+    gate.Open();
+    CHECK(WaitForIdle(queue));
+}
+
+TEST_CASE("DiagnosticsJobQueue reports requests over the queue limit")
+{
+    ReportedResults reported;
+    DiagnosticsJobQueue queue{ reported.Reporter(), 1, 2 };
+
+    Gate gate;
+    const auto work = [&gate](const std::atomic<bool>&) { gate.Wait(); };
+
+    CHECK(queue.Enqueue("op-1", work) == DiagnosticsJobQueue::EnqueueResult::Queued);
+    REQUIRE(gate.WaitForWaiting(1));
+    CHECK(queue.Enqueue("op-2", work) == DiagnosticsJobQueue::EnqueueResult::Queued);
+    CHECK(queue.Enqueue("op-3", work) == DiagnosticsJobQueue::EnqueueResult::Queued);
+    CHECK(queue.Enqueue("op-4", work) == DiagnosticsJobQueue::EnqueueResult::QueueFull);
+
+    CHECK(reported.Get() == std::map<std::string, Diagnostics_Result>{ { "op-4", Diagnostics_Result_QueueFull } });
+
+    gate.Open();
+    CHECK(WaitForIdle(queue));
+}
+
+TEST_CASE("DiagnosticsJobQueue Stop cancels running requests and drops queued ones")
+{
+    ReportedResults reported;
+    DiagnosticsJobQueue queue{ reported.Reporter(), 1, 16 };
+
+    std::promise<void> started;
+    std::atomic<bool> sawCancel{ false };
+    queue.Enqueue("op-1", [&started, &sawCancel](const std::atomic<bool>& cancelled) {
+        started.set_value();
+        while (!cancelled)
+        {
+            std::this_thread::sleep_for(1ms);
+        }
+        sawCancel = true;
+    });
+    queue.Enqueue("op-2", [](const std::atomic<bool>&) { FAIL("op-2 should not run"); });
+
+    REQUIRE(started.get_future().wait_for(5s) == std::future_status::ready);
+
+    queue.Stop();
+
+    CHECK(sawCancel);
+    CHECK(queue.PendingCount() == 0);
+    // Nothing is reported at shutdown.
+    CHECK(reported.Get().empty());
+
+    // The queue runs requests again after Stop.
+    std::atomic<bool> ran{ false };
+    queue.Enqueue("op-3", [&ran](const std::atomic<bool>& cancelled) { ran = !cancelled; });
+    REQUIRE(WaitForIdle(queue));
+    CHECK(ran);
+}
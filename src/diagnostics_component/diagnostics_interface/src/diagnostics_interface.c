@@ -105,6 +105,9 @@ void DiagnosticsInterface_Destroy(void** componentContext)
         return;
     }
 
+    // The queued and running workflows use the workflow data.
+    DiagnosticsWorkflow_StopAsyncUploads();
+
     DiagnosticsWorkflowData* workflowData = (DiagnosticsWorkflowData*)*componentContext;
 
     DiagnosticsConfigUtils_UnInit(workflowData);
@@ -19,6 +19,8 @@ EXTERN_C_BEGIN
  */
 typedef enum tagDiagnostics_Result
 {
+    Diagnostics_Result_QueueFull = -9, //!< Too many requests are waiting; the request was not run
+    Diagnostics_Result_Cancelled = -8, //!< The request was cancelled before it completed, e.g. on agent shutdown
     Diagnostics_Result_NoSasCredential = -7, //!< Cloud to device message contains no sas credential
     Diagnostics_Result_NoOperationId = -6, // !< Cloud to device message contains no operation id
     Diagnostics_Result_NoDiagnosticsComponents = -5, // !< Diagnostics configuration doesn't contain any components
@@ -20,6 +20,27 @@ EXTERN_C_BEGIN
  */
 void DiagnosticsWorkflow_DiscoverAndUploadLogs(const DiagnosticsWorkflowData* workflowData, const char* jsonString);
 
+/**
+ * @brief Returns true once the workflow should stop
+ * @param context the context passed to DiagnosticsWorkflow_DiscoverAndUploadLogsCancellable
+ */
+typedef bool (*DiagnosticsWorkflow_IsCancelledFunc)(void* context);
+
+/**
+ * @brief Uploads the diagnostic logs described by @p workflowData, stopping once cancelled
+ * @details Cancellation is for shutdown, when reports can no longer be sent: a cancelled workflow is not reported,
+ * and its operation-id is not recorded as completed, so the service requests it again.
+ * @param workflowData the workflowData structure describing the log components
+ * @param jsonString the string from the diagnostics_interface describing where to upload the logs
+ * @param isCancelled polled between log components, files and blocks; may be NULL
+ * @param cancelContext the context passed to @p isCancelled
+ */
+void DiagnosticsWorkflow_DiscoverAndUploadLogsCancellable(
+    const DiagnosticsWorkflowData* workflowData,
+    const char* jsonString,
+    DiagnosticsWorkflow_IsCancelledFunc isCancelled,
+    void* cancelContext);
+
 EXTERN_C_END
 
 #endif // DIAGNOSTICS_WORKFLOW_H
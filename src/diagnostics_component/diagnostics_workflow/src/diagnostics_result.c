@@ -16,6 +16,10 @@ const char* DiagnosticsResult_ToString(Diagnostics_Result result)
 {
     switch (result)
     {
+    case Diagnostics_Result_QueueFull:
+        return "QueueFull";
+    case Diagnostics_Result_Cancelled:
+        return "Cancelled";
     case Diagnostics_Result_NoSasCredential:
         return "NoSasCredential";
     case Diagnostics_Result_NoOperationId:
@@ -18,12 +18,40 @@ typedef struct tagBlobStorageInfo
     STRING_HANDLE storageSasCredential; //!< Combined SAS URI and SAS Token for connecting to storage
 } BlobStorageInfo;
 
+typedef bool (*FileUploadUtility_IsCancelledFunc)(void* context);
+
 static bool FileUploadUtility_UploadFilesToContainer(
-    const BlobStorageInfo* blobInfo, VECTOR_HANDLE fileNames, const char* directoryPath)
+    const BlobStorageInfo* blobInfo,
+    VECTOR_HANDLE fileNames,
+    const char* directoryPath,
+    FileUploadUtility_IsCancelledFunc isCancelled,
+    void* cancelContext)
+{
+    UNREFERENCED_PARAMETER(blobInfo);
+    UNREFERENCED_PARAMETER(fileNames);
+    UNREFERENCED_PARAMETER(directoryPath);
+    UNREFERENCED_PARAMETER(isCancelled);
+    UNREFERENCED_PARAMETER(cancelContext);
+
+    return false;
+}
+
+static bool FileUploadUtility_UploadFilesAsCompressedArchive(
+    const BlobStorageInfo* blobInfo,
+    VECTOR_HANDLE fileNames,
+    const char* directoryPath,
+    const char* archiveName,
+    long long maxCompressedSize,
+    FileUploadUtility_IsCancelledFunc isCancelled,
+    void* cancelContext)
 {
     UNREFERENCED_PARAMETER(blobInfo);
     UNREFERENCED_PARAMETER(fileNames);
     UNREFERENCED_PARAMETER(directoryPath);
+    UNREFERENCED_PARAMETER(archiveName);
+    UNREFERENCED_PARAMETER(maxCompressedSize);
+    UNREFERENCED_PARAMETER(isCancelled);
+    UNREFERENCED_PARAMETER(cancelContext);
 
     return false;
 }
@@ -40,6 +68,13 @@ static bool FileUploadUtility_UploadFilesToContainer(
 #include <stdio.h>
 #include <stdlib.h>
 
+/**
+ * @brief In compressed archive mode, files are discovered up to this many times the upload budget in raw bytes;
+ * the archive upload then keeps the newest files that fit the budget once compressed, and stops reading at it.
+ * Text logs typically compress 8 to 10 times, so more raw bytes than this would rarely fit.
+ */
+#define DIAGNOSTICS_ARCHIVE_DISCOVERY_SIZE_FACTOR 10
+
 /**
  * @brief Sets the memory in @p memory which points to the storage location in @p sasCredential to 0 before calling STRING_delete() on sasCredential
  * @param sasCredential credential to be deleted
@@ -116,7 +151,12 @@ Diagnostics_Result DiagnosticsWorkflow_GetFilesForComponent(
 
     Diagnostics_Result result = Diagnostics_Result_Failure;
 
-    if (!FileInfoUtils_GetNewestFilesInDirUnderSize(fileNames, STRING_c_str(logComponent->logPath), maxUploadSize))
+    const bool found = logComponent->recursive
+        ? FileInfoUtils_GetNewestFilesInTreeUnderSize(
+            fileNames, STRING_c_str(logComponent->logPath), maxUploadSize, FILE_INFO_UTILS_DEFAULT_MAX_FILES_TO_SCAN)
+        : FileInfoUtils_GetNewestFilesInDirUnderSize(fileNames, STRING_c_str(logComponent->logPath), maxUploadSize);
+
+    if (!found)
     {
         result = Diagnostics_Result_NoLogsFound;
         Log_Debug(
@@ -139,6 +179,10 @@ done:
  * @param deviceName name of the device the DiagnosticsWorkflow is running on
  * @param operationId the id associated with this upload request sent down by Diagnostics Service
  * @param storageSasUrl credential to be used for the Azure Blob Storage upload
+ * @param uploadAsCompressedArchive true to upload @p fileNames as one <component-name>.tar.gz blob
+ * @param maxCompressedSize the maximum size of the archive in bytes; used if @p uploadAsCompressedArchive is true
+ * @param isCancelled polled between files and blocks of the upload; may be NULL
+ * @param cancelContext the context passed to @p isCancelled
  * @returns a value of Diagnostics_Result indicating the status of this component's upload
  */
 Diagnostics_Result DiagnosticsWorkflow_UploadFilesForComponent(
@@ -146,7 +190,11 @@ Diagnostics_Result DiagnosticsWorkflow_UploadFilesForComponent(
     const DiagnosticsLogComponent* logComponent,
     const char* deviceName,
     const char* operationId,
-    const char* storageSasUrl)
+    const char* storageSasUrl,
+    bool uploadAsCompressedArchive,
+    long long maxCompressedSize,
+    DiagnosticsWorkflow_IsCancelledFunc isCancelled,
+    void* cancelContext)
 {
     if (fileNames == NULL || logComponent == NULL || deviceName == NULL || operationId == NULL
         || storageSasUrl == NULL)
@@ -156,6 +204,7 @@ Diagnostics_Result DiagnosticsWorkflow_UploadFilesForComponent(
 
     char* storageSasCredentialMemory = NULL;
     Diagnostics_Result result = Diagnostics_Result_Failure;
+    STRING_HANDLE archiveName = NULL;
 
     BlobStorageInfo blobInfo;
     memset(&blobInfo, 0, sizeof(blobInfo));
@@ -187,7 +236,32 @@ Diagnostics_Result DiagnosticsWorkflow_UploadFilesForComponent(
         goto done;
     }
 
-    if (!FileUploadUtility_UploadFilesToContainer(&blobInfo, fileNames, STRING_c_str(logComponent->logPath)))
+    if (uploadAsCompressedArchive)
+    {
+        archiveName = STRING_construct_sprintf("%s.tar.gz", STRING_c_str(logComponent->componentName));
+        if (archiveName == NULL)
+        {
+            goto done;
+        }
+
+        if (!FileUploadUtility_UploadFilesAsCompressedArchive(
+                &blobInfo,
+                fileNames,
+                STRING_c_str(logComponent->logPath),
+                STRING_c_str(archiveName),
+                maxCompressedSize,
+                isCancelled,
+                cancelContext))
+        {
+            result = Diagnostics_Result_UploadFailed;
+            Log_Warn(
+                "DiagnosticsWorkflow_UploadFilesForComponent Archive upload failed for logComponent: %s",
+                STRING_c_str(logComponent->componentName));
+            goto done;
+        }
+    }
+    else if (!FileUploadUtility_UploadFilesToContainer(
+                 &blobInfo, fileNames, STRING_c_str(logComponent->logPath), isCancelled, cancelContext))
     {
         result = Diagnostics_Result_UploadFailed;
         Log_Warn(
@@ -200,6 +274,13 @@ Diagnostics_Result DiagnosticsWorkflow_UploadFilesForComponent(
 
 done:
 
+    if (result == Diagnostics_Result_UploadFailed && isCancelled != NULL && isCancelled(cancelContext))
+    {
+        result = Diagnostics_Result_Cancelled;
+    }
+
+    STRING_delete(archiveName);
+
     STRING_delete(blobInfo.virtualDirectoryPath);
     blobInfo.virtualDirectoryPath = NULL;
 
@@ -245,6 +326,22 @@ void DiagnosticsWorkflow_UnInitLogComponentFileNames(VECTOR_HANDLE logComponentF
  * @param jsonString the string from the diagnostics_interface describing where to upload the logs
  */
 void DiagnosticsWorkflow_DiscoverAndUploadLogs(const DiagnosticsWorkflowData* workflowData, const char* jsonString)
+{
+    DiagnosticsWorkflow_DiscoverAndUploadLogsCancellable(workflowData, jsonString, NULL, NULL);
+}
+
+/**
+ * @brief Uploads the diagnostic logs described by @p workflowData, stopping once cancelled
+ * @param workflowData the workflowData structure describing the log components
+ * @param jsonString the string from the diagnostics_interface describing where to upload the logs
+ * @param isCancelled polled between log components, files and blocks; may be NULL
+ * @param cancelContext the context passed to @p isCancelled
+ */
+void DiagnosticsWorkflow_DiscoverAndUploadLogsCancellable(
+    const DiagnosticsWorkflowData* workflowData,
+    const char* jsonString,
+    DiagnosticsWorkflow_IsCancelledFunc isCancelled,
+    void* cancelContext)
 {
     Log_Info("Starting Diagnostics Log Upload");
 
@@ -316,6 +413,11 @@ void DiagnosticsWorkflow_DiscoverAndUploadLogs(const DiagnosticsWorkflowData* wo
         goto done;
     }
 
+    // The archive upload enforces the budget on compressed bytes, so discover more raw bytes than it.
+    const long long discoverySizePerComponent = workflowData->uploadAsCompressedArchive
+        ? uploadSizePerComponent * DIAGNOSTICS_ARCHIVE_DISCOVERY_SIZE_FACTOR
+        : uploadSizePerComponent;
+
     if (!DiagnosticsComponent_GetDeviceName(&deviceName))
     {
         goto done;
@@ -342,9 +444,16 @@ void DiagnosticsWorkflow_DiscoverAndUploadLogs(const DiagnosticsWorkflowData* wo
             goto done;
         }
 
+        if (isCancelled != NULL && isCancelled(cancelContext))
+        {
+            result = Diagnostics_Result_Cancelled;
+            goto done;
+        }
+
         VECTOR_HANDLE discoveredFileNames = NULL;
 
-        result = DiagnosticsWorkflow_GetFilesForComponent(&discoveredFileNames, logComponent, uploadSizePerComponent);
+        result =
+            DiagnosticsWorkflow_GetFilesForComponent(&discoveredFileNames, logComponent, discoverySizePerComponent);
 
         if (result != Diagnostics_Result_Success || discoveredFileNames == NULL)
         {
@@ -371,6 +480,12 @@ void DiagnosticsWorkflow_DiscoverAndUploadLogs(const DiagnosticsWorkflowData* wo
             goto done;
         }
 
+        if (isCancelled != NULL && isCancelled(cancelContext))
+        {
+            result = Diagnostics_Result_Cancelled;
+            goto done;
+        }
+
         const VECTOR_HANDLE* discoveredLogFileNames = VECTOR_element(logComponentFileNames, i);
 
         if (discoveredLogFileNames == NULL)
@@ -383,7 +498,11 @@ void DiagnosticsWorkflow_DiscoverAndUploadLogs(const DiagnosticsWorkflowData* wo
             logComponent,
             deviceName,
             STRING_c_str(operationId),
-            STRING_c_str(storageSasCredential));
+            STRING_c_str(storageSasCredential),
+            workflowData->uploadAsCompressedArchive,
+            uploadSizePerComponent,
+            isCancelled,
+            cancelContext);
 
         if (result != Diagnostics_Result_Success)
         {
@@ -396,9 +515,15 @@ void DiagnosticsWorkflow_DiscoverAndUploadLogs(const DiagnosticsWorkflowData* wo
 done:
 
     //
-    // Report state back to the iothub
+    // Report state back to the iothub. Workflows are only cancelled when the agent shuts down, after the D2C
+    // messaging is uninitialized, so a cancelled operation is not reported, nor recorded as completed: the service
+    // requests it again after the restart.
     //
-    if (operationId == NULL)
+    if (result == Diagnostics_Result_Cancelled)
+    {
+        Log_Info("Diagnostics operation cancelled: %s", operationId == NULL ? "" : STRING_c_str(operationId));
+    }
+    else if (operationId == NULL)
     {
         DiagnosticsInterface_ReportStateAndResultAsync(result, "");
     }
@@ -5,6 +5,7 @@
 #include <azure_c_shared_utility/strings.h>
 #include <azure_c_shared_utility/vector.h>
 #include <parson.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
 EXTERN_C_BEGIN
@@ -21,6 +22,7 @@ typedef struct tagDiagnosticLogComponent
 {
     STRING_HANDLE componentName; //!< Name of the component for which to collect logs
     STRING_HANDLE logPath; //!< Absolute path to the directory where the logs are stored
+    bool recursive; //!< Whether logs are also collected from the subdirectories of logPath
 } DiagnosticsLogComponent;
 
 /**
@@ -30,6 +32,7 @@ typedef struct tagDiagnosticWorkflowData
 {
     VECTOR_HANDLE components; //!< Vector of DiagnosticLogComponent pointers for which to collect logs
     long long maxBytesToUploadPerLogPath; //!< The maximum number of bytes to upload per log file path
+    bool uploadAsCompressedArchive; //!< Upload each log path as one .tar.gz, budgeted in compressed bytes
 } DiagnosticsWorkflowData;
 
 /**
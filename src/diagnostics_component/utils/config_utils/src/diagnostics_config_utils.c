@@ -10,6 +10,7 @@
 #include <aduc/logging.h>
 #include <parson_json_utils.h> // for ADUC_JSON_GetUnsignedIntegerField
 #include <stdlib.h> // for free
+#include <string.h> // for strcmp
 
 /**
  * @brief Fieldname for the array of log components in the Diagnostics JSON Config File
@@ -26,11 +27,31 @@
  */
 #define DIAGNOSTICS_CONFIG_FILE_COMPONENT_FIELDNAME_LOGPATH "logPath"
 
+/**
+ * @brief Fieldname for whether the subdirectories of logPath are also scanned in the Diagnostics JSON Config File
+ */
+#define DIAGNOSTICS_CONFIG_FILE_COMPONENT_FIELDNAME_RECURSIVE "recursive"
+
 /**
  * @brief Fieldname for the maximum number of bytes to upload per diagnostics workflow
  */
 #define DIAGNOSTICS_CONFIG_FILE_FIELDNAME_MAXKILOBYTESTOUPLOADPERLOGPATH "maxKilobytesToUploadPerLogPath"
 
+/**
+ * @brief Fieldname for how the logs of each log path are uploaded in the Diagnostics JSON Config File
+ */
+#define DIAGNOSTICS_CONFIG_FILE_FIELDNAME_UPLOADMODE "uploadMode"
+
+/**
+ * @brief uploadMode value uploading each log file as its own blob. The default.
+ */
+#define DIAGNOSTICS_CONFIG_UPLOADMODE_FILES "files"
+
+/**
+ * @brief uploadMode value uploading the logs of each log path as one .tar.gz blob, built while uploading
+ */
+#define DIAGNOSTICS_CONFIG_UPLOADMODE_COMPRESSED_ARCHIVE "compressedArchive"
+
 /**
  * @brief Maximum number of kilobytes allowed to be uploaded per log path
  */
@@ -48,10 +69,18 @@
                 "componentName":"DO",
                 "logPath":"/var/cache/do/"
             },
+            {
+                "componentName":"syslog",
+                "logPath":"/var/log/",
+                "recursive":true
+            },
             ...
         ],
-        "maxKilobytesToUploadPerLogPath":5
+        "maxKilobytesToUploadPerLogPath":5,
+        "uploadMode":"compressedArchive"
     }
+ * "uploadMode" is optional, "files" or "compressedArchive".
+ * "recursive" is optional and defaults to false.
  */
 
 /**
@@ -99,6 +128,10 @@ DiagnosticsConfigUtils_LogComponentInitFromObj(DiagnosticsLogComponent* componen
         goto done;
     }
 
+    // json_object_get_boolean returns -1 when the field is absent.
+    component->recursive =
+        json_object_get_boolean(componentObj, DIAGNOSTICS_CONFIG_FILE_COMPONENT_FIELDNAME_RECURSIVE) == 1;
+
     succeeded = true;
 
 done:
@@ -164,6 +197,21 @@ bool DiagnosticsConfigUtils_InitFromJSON(DiagnosticsWorkflowData* workflowData,
 
     workflowData->maxBytesToUploadPerLogPath = maxKilobytesToUploadPerLogPath * 1024;
 
+    const char* uploadMode = ADUC_JSON_GetStringFieldPtr(fileJsonValue, DIAGNOSTICS_CONFIG_FILE_FIELDNAME_UPLOADMODE);
+    if (uploadMode == NULL || strcmp(uploadMode, DIAGNOSTICS_CONFIG_UPLOADMODE_FILES) == 0)
+    {
+        workflowData->uploadAsCompressedArchive = false;
+    }
+    else if (strcmp(uploadMode, DIAGNOSTICS_CONFIG_UPLOADMODE_COMPRESSED_ARCHIVE) == 0)
+    {
+        workflowData->uploadAsCompressedArchive = true;
+    }
+    else
+    {
+        Log_Warn("DiagnosticsConfigUtils_Init uploadMode config set to invalid value: %s", uploadMode);
+        goto done;
+    }
+
     JSON_Array* componentArray = json_object_get_array(fileJsonObj, DIAGNOSTICS_CONFIG_FILE_LOG_COMPONENTS_FIELDNAME);
 
     if (componentArray == NULL)
@@ -60,7 +60,8 @@ TEST_CASE("DiagnosticsConfigUtils_Init")
                                         R"(},)" <<
                                         R"({)" <<
                                             R"("componentName":"DO",)" <<
-                                            R"("logPath":"/var/cache/do/")" <<
+                                            R"("logPath":"/var/cache/do/",)" <<
+                                            R"("recursive":true)" <<
                                         R"(})" <<
                                     R"(],)" <<
                                     R"("maxKilobytesToUploadPerLogPath":)" << maxKilobytesToUploadPerLogPath <<
@@ -81,6 +82,7 @@ TEST_CASE("DiagnosticsConfigUtils_Init")
         CHECK(firstLogComponent != nullptr);
         CHECK(strcmp(STRING_c_str(firstLogComponent->componentName), "DU") == 0);
         CHECK(strcmp(STRING_c_str(firstLogComponent->logPath), ADUC_LOG_FOLDER) == 0);
+        CHECK_FALSE(firstLogComponent->recursive);
 
         const DiagnosticsLogComponent* secondLogComponent =
             DiagnosticsConfigUtils_GetLogComponentElem(&testHelper.workflowData, 1);
@@ -88,8 +90,54 @@ TEST_CASE("DiagnosticsConfigUtils_Init")
         CHECK(secondLogComponent != nullptr);
         CHECK(strcmp(STRING_c_str(secondLogComponent->componentName), "DO") == 0);
         CHECK(strcmp(STRING_c_str(secondLogComponent->logPath), "/var/cache/do/") == 0);
+        CHECK(secondLogComponent->recursive);
 
         CHECK(testHelper.workflowData.maxBytesToUploadPerLogPath == (maxKilobytesToUploadPerLogPath * 1024));
+        CHECK_FALSE(testHelper.workflowData.uploadAsCompressedArchive);
+    }
+
+    SECTION("DiagnosticsConfigUtils_Init- Compressed Archive Upload Mode")
+    {
+        // clang-format off
+        std::string compressedArchive = R"({)"
+                                            R"("logComponents":[)"
+                                                R"({)"
+                                                    R"("componentName":"DU",)"
+                                                    R"("logPath":"/var/logs/adu/")"
+                                                R"(})"
+                                            R"(],)"
+                                            R"("maxKilobytesToUploadPerLogPath":5,)"
+                                            R"("uploadMode":"compressedArchive")"
+                                        R"(})";
+        // clang-format on
+
+        DiagnosticConfigUtilsUnitTestHelper testHelper(compressedArchive.c_str());
+
+        CHECK(DiagnosticsConfigUtils_InitFromJSON(&testHelper.workflowData, testHelper.jsonValue));
+
+        CHECK(testHelper.workflowData.uploadAsCompressedArchive);
+    }
+
+    SECTION("DiagnosticsConfigUtils_Init- Unknown Upload Mode")
+    {
+        // clang-format off
+        std::string unknownUploadMode = R"({)"
+                                            R"("logComponents":[)"
+                                                R"({)"
+                                                    R"("componentName":"DU",)"
+                                                    R"("logPath":"/var/logs/adu/")"
+                                                R"(})"
+                                            R"(],)"
+                                            R"("maxKilobytesToUploadPerLogPath":5,)"
+                                            R"("uploadMode":"zip")"
+                                        R"(})";
+        // clang-format on
+
+        DiagnosticConfigUtilsUnitTestHelper testHelper(unknownUploadMode.c_str());
+
+        CHECK_FALSE(DiagnosticsConfigUtils_InitFromJSON(&testHelper.workflowData, testHelper.jsonValue));
+
+        CHECK(testHelper.workflowData.components == nullptr);
     }
 
     SECTION("DiagnosticsConfigUtils_Init- No logComponents")
@@ -28,9 +28,42 @@ typedef struct tagFileInfo
     time_t lastWrite; //!< the last time the file was modified
 } FileInfo;
 
+/**
+ * @brief Default maximum number of directory entries scanned per directory path
+ * @details this is to prevent a denial of service attack by some malicious attacker filling the directory with garbage to prevent the diagnostics component from running.
+ * Entries are scanned in directory order, not by age: once the cap is reached, a warning is logged and the entries
+ * left, which may include the newest files, are not considered.
+ */
+#    define FILE_INFO_UTILS_DEFAULT_MAX_FILES_TO_SCAN 65536
+
+/**
+ * @brief Gets up to 20 of the newest files directly in @p directoryPath whose total size is less than @p maxFileSize
+ * @details Scans at most FILE_INFO_UTILS_DEFAULT_MAX_FILES_TO_SCAN entries, see there.
+ * Subdirectories and symbolic links are skipped.
+ * @param[out] fileNameVector a VECTOR_HANDLE of STRING_HANDLE file names, newest first; to be freed by the caller
+ * @param[in] directoryPath path to the directory to scan
+ * @param[in] maxFileSize the maximum size of all the files in bytes
+ * @returns true if at least one file was found; false otherwise
+ */
 bool FileInfoUtils_GetNewestFilesInDirUnderSize(
     VECTOR_HANDLE* fileNameVector, const char* directoryPath, const long long maxFileSize);
 
+/**
+ * @brief Like FileInfoUtils_GetNewestFilesInDirUnderSize, but also scans the subdirectories of @p directoryPath
+ * @details The file names are relative to @p directoryPath, e.g. "archive/syslog.1". Symbolic links are not followed.
+ * @param[out] fileNameVector a VECTOR_HANDLE of STRING_HANDLE file names, newest first; to be freed by the caller
+ * @param[in] directoryPath path to the directory tree to scan
+ * @param[in] maxFileSize the maximum size of all the files in bytes
+ * @param[in] maxFilesToScan the maximum number of directory entries to scan across the tree, subdirectories
+ * included; see FILE_INFO_UTILS_DEFAULT_MAX_FILES_TO_SCAN
+ * @returns true if at least one file was found; false otherwise
+ */
+bool FileInfoUtils_GetNewestFilesInTreeUnderSize(
+    VECTOR_HANDLE* fileNameVector,
+    const char* directoryPath,
+    const long long maxFileSize,
+    unsigned int maxFilesToScan);
+
 bool FileInfoUtils_InsertFileInfoIntoArray(
     FileInfo* sortedLogFiles,
     size_t sortedLogFileLength,
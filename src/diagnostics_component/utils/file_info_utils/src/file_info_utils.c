@@ -1,5 +1,5 @@
 /**
- * @file file_info_utils.h
+ * @file file_info_utils.c
  * @brief Implementation file for utilities scanning, parsing, and interacting with the file system
  *
  * @copyright Copyright (c) Microsoft Corporation.
@@ -14,6 +14,7 @@
 #include <azure_c_shared_utility/strings.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -21,11 +22,24 @@
 #include <aducpal/dirent.h>
 #include <aducpal/sys_stat.h>
 
+#ifdef __linux__
+#    include <errno.h>
+#    include <fcntl.h>
+#    include <limits.h> // PATH_MAX
+#    include <stdint.h>
+#    include <sys/syscall.h> // SYS_getdents64
+#    include <unistd.h>
+#endif
+
+/**
+ * @brief Size of the buffer that directory entries are read into, per directory being scanned
+ */
+#define DIRENT_BUFFER_SIZE (32 * 1024)
+
 /**
- * @brief Maximum amount of files to scan before we quit
- * @details this is to prevent a denial of service attack by some malicious attacker filling the directory with garbage to prevent the diagnostics component from running.
+ * @brief Maximum depth of subdirectories scanned in recursive mode
  */
-#define MAX_FILES_TO_SCAN 100
+#define MAX_DIRECTORY_DEPTH 8
 
 /**
  * @brief this is the absolute max amount of files we will upload per component non-dependent on size
@@ -88,25 +102,326 @@ bool FileInfoUtils_InsertFileInfoIntoArray(
 }
 
 /**
- * @brief Fills @p logFiles with up to @p logFileSize newest files found in the directory at @p directoryPath
- * @details No spelunking, not recursively searching
- * @param[out] logFiles the array of FileInfo structs that will hold the newest files
- * @param[in] logFileSize the size of @p logFiles
- * @param[in] directoryPath the directory to scan for the newest files
- * @returns true if we're able to find new files to add to @p logFiles, false if unsuccessful
+ * @brief A bounded min-heap of the newest files seen so far, ordered by lastWrite
+ * @details The root is the oldest of the kept files, so a candidate costs one comparison unless it is newer than it.
  */
-bool FileInfoUtils_FillFileInfoWithNewestFilesInDir(FileInfo* logFiles, size_t logFileSize, const char* directoryPath)
+typedef struct tagNewestFilesHeap
 {
-    bool succeeded = false;
+    FileInfo* files; //!< the heap storage, of @p capacity entries
+    size_t capacity; //!< the maximum number of files kept
+    size_t count; //!< the number of files kept so far
+    unsigned int entriesScanned; //!< the number of directory entries looked at so far
+    unsigned int maxEntriesToScan; //!< the number of directory entries after which scanning stops
+    bool capReached; //!< true once an entry was left unscanned because of @p maxEntriesToScan
+} NewestFilesHeap;
 
-    if (logFiles == NULL || logFileSize == 0 || directoryPath == NULL)
+/**
+ * @brief Records that scanning stopped at the cap, before the entry @p name of @p directoryPath
+ * @details The entries are in directory order, not by age, so the newest files may be among those left unscanned.
+ */
+static void NewestFilesHeap_StopAtCap(NewestFilesHeap* heap, const char* directoryPath, const char* name)
+{
+    heap->capReached = true;
+    Log_Warn(
+        "Stopped scanning at '%s%s', after the cap of %u directory entries. The entries left are not considered.",
+        directoryPath,
+        name,
+        heap->maxEntriesToScan);
+}
+
+static void NewestFilesHeap_SiftDown(NewestFilesHeap* heap, size_t index)
+{
+    while (true)
+    {
+        const size_t left = 2 * index + 1;
+        const size_t right = left + 1;
+        size_t oldest = index;
+
+        if (left < heap->count && heap->files[left].lastWrite < heap->files[oldest].lastWrite)
+        {
+            oldest = left;
+        }
+
+        if (right < heap->count && heap->files[right].lastWrite < heap->files[oldest].lastWrite)
+        {
+            oldest = right;
+        }
+
+        if (oldest == index)
+        {
+            return;
+        }
+
+        const FileInfo swap = heap->files[index];
+        heap->files[index] = heap->files[oldest];
+        heap->files[oldest] = swap;
+        index = oldest;
+    }
+}
+
+static void NewestFilesHeap_SiftUp(NewestFilesHeap* heap, size_t index)
+{
+    while (index > 0)
+    {
+        const size_t parent = (index - 1) / 2;
+        if (heap->files[parent].lastWrite <= heap->files[index].lastWrite)
+        {
+            return;
+        }
+
+        const FileInfo swap = heap->files[index];
+        heap->files[index] = heap->files[parent];
+        heap->files[parent] = swap;
+        index = parent;
+    }
+}
+
+/**
+ * @brief Keeps the candidate file if the heap is not full or the candidate is newer than the oldest kept file
+ * @returns false on allocation failure; true otherwise
+ */
+static bool NewestFilesHeap_Offer(
+    NewestFilesHeap* heap, const char* candidateFileName, long long sizeOfCandidateFile, time_t candidateLastWrite)
+{
+    if (heap->count == heap->capacity && candidateLastWrite <= heap->files[0].lastWrite)
+    {
+        return true;
+    }
+
+    char* fileName = NULL;
+    if (mallocAndStrcpy_s(&fileName, candidateFileName) != 0)
     {
         return false;
     }
 
-    memset(logFiles, 0, sizeof(FileInfo) * logFileSize);
+    FileInfo candidate = { .fileSize = sizeOfCandidateFile, .fileName = fileName, .lastWrite = candidateLastWrite };
+
+    if (heap->count < heap->capacity)
+    {
+        heap->files[heap->count] = candidate;
+        NewestFilesHeap_SiftUp(heap, heap->count);
+        ++heap->count;
+    }
+    else
+    {
+        free(heap->files[0].fileName);
+        heap->files[0] = candidate;
+        NewestFilesHeap_SiftDown(heap, 0);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Reorders the heap in place from newest to oldest
+ */
+static void NewestFilesHeap_SortNewestFirst(NewestFilesHeap* heap)
+{
+    // Heap sort: moving the oldest kept file to the end each time leaves the newest at index 0.
+    const size_t count = heap->count;
+    while (heap->count > 1)
+    {
+        const FileInfo oldest = heap->files[0];
+        heap->files[0] = heap->files[heap->count - 1];
+        heap->files[heap->count - 1] = oldest;
+        --heap->count;
+        NewestFilesHeap_SiftDown(heap, 0);
+    }
+    heap->count = count;
+}
+
+#ifdef __linux__
+
+/**
+ * @brief Layout of the records returned by getdents64, see man getdents64
+ */
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/**
+ * @brief Offers every regular file under @p dirFd to @p heap, reading the entries in large batches
+ * @details Entries are stat'ed relative to @p dirFd, so no path is built or resolved per entry, and the d_type
+ * reported by the file system is used to skip directories and symbolic links without a stat at all.
+ * Scanning stops once @p heap->maxEntriesToScan entries were looked at, see NewestFilesHeap_StopAtCap().
+ * @param heap the heap the files are offered to
+ * @param dirFd the open directory to scan
+ * @param relativePath the path of @p dirFd relative to the scanned root, with a trailing '/' unless empty;
+ * extended in place when descending
+ * @param relativePathLength the length of @p relativePath
+ * @param depth the number of directories below the scanned root
+ * @param recursive true to descend into subdirectories
+ * @param direntBuffers the getdents64 buffer of each depth, of MAX_DIRECTORY_DEPTH + 1 entries; allocated on first
+ * use, and reused by the sibling directories of the same depth. To be freed by the caller.
+ * @returns false if the heap or a buffer could not allocate; true otherwise, including when scanning stopped at the
+ * cap
+ */
+static bool ScanDirectoryFd(
+    NewestFilesHeap* heap,
+    int dirFd,
+    char* relativePath,
+    size_t relativePathLength,
+    unsigned int depth,
+    bool recursive,
+    char** direntBuffers)
+{
+    if (direntBuffers[depth] == NULL)
+    {
+        direntBuffers[depth] = malloc(DIRENT_BUFFER_SIZE);
+        if (direntBuffers[depth] == NULL)
+        {
+            return false;
+        }
+    }
+
+    char* buffer = direntBuffers[depth];
+
+    while (!heap->capReached)
+    {
+        const long bytesRead = syscall(SYS_getdents64, dirFd, buffer, DIRENT_BUFFER_SIZE);
+        if (bytesRead <= 0)
+        {
+            if (bytesRead < 0)
+            {
+                Log_Warn("getdents64 failed on '%s', errno: %d", relativePath, errno);
+            }
+            break;
+        }
+
+        for (long offset = 0; offset < bytesRead && !heap->capReached;)
+        {
+            const struct linux_dirent64* entry = (const struct linux_dirent64*)(buffer + offset);
+            offset += entry->d_reclen;
+
+            const char* name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || entry->d_type == DT_LNK)
+            {
+                continue;
+            }
+
+            if (heap->entriesScanned >= heap->maxEntriesToScan)
+            {
+                NewestFilesHeap_StopAtCap(heap, relativePath, name);
+                break;
+            }
+
+            ++heap->entriesScanned;
+
+            unsigned char type = entry->d_type;
+            struct stat statbuf;
+            if (type == DT_REG || type == DT_UNKNOWN)
+            {
+                if (fstatat(dirFd, name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0)
+                {
+                    continue;
+                }
+
+                type = S_ISREG(statbuf.st_mode) ? DT_REG : S_ISDIR(statbuf.st_mode) ? DT_DIR : DT_UNKNOWN;
+            }
+
+            const size_t nameLength = strlen(name);
+            if (relativePathLength + nameLength + 1 >= PATH_MAX)
+            {
+                continue;
+            }
+
+            if (type == DT_DIR)
+            {
+                if (!recursive || depth >= MAX_DIRECTORY_DEPTH)
+                {
+                    continue;
+                }
+
+                const int subDirFd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (subDirFd == -1)
+                {
+                    continue;
+                }
+
+                memcpy(relativePath + relativePathLength, name, nameLength);
+                relativePath[relativePathLength + nameLength] = '/';
+                relativePath[relativePathLength + nameLength + 1] = '\0';
+
+                const bool scanned = ScanDirectoryFd(
+                    heap, subDirFd, relativePath, relativePathLength + nameLength + 1, depth + 1, true, direntBuffers);
+
+                relativePath[relativePathLength] = '\0';
+                close(subDirFd);
+
+                if (!scanned)
+                {
+                    return false;
+                }
+            }
+            else if (type == DT_REG && statbuf.st_size != 0)
+            {
+                memcpy(relativePath + relativePathLength, name, nameLength + 1);
+
+                const bool offered = NewestFilesHeap_Offer(heap, relativePath, statbuf.st_size, statbuf.st_mtime);
+
+                relativePath[relativePathLength] = '\0';
+
+                if (!offered)
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Offers the regular files in the directory at @p directoryPath to @p heap
+ * @returns true if the directory was scanned; false otherwise
+ */
+static bool ScanDirectory(NewestFilesHeap* heap, const char* directoryPath, bool recursive)
+{
+    const int dirFd = open(directoryPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd == -1)
+    {
+        return false;
+    }
+
+    char relativePath[PATH_MAX] = "";
+    char* direntBuffers[MAX_DIRECTORY_DEPTH + 1] = { NULL };
+    const bool succeeded = ScanDirectoryFd(heap, dirFd, relativePath, 0, 0, recursive, direntBuffers);
+
+    close(dirFd);
+
+    for (size_t i = 0; i < ARRAY_SIZE(direntBuffers); ++i)
+    {
+        free(direntBuffers[i]);
+    }
+
+    return succeeded;
+}
+
+#else
+
+/**
+ * @brief Offers the regular files in the directory at @p directoryPath to @p heap
+ * @details Portable fallback that resolves a path per entry; subdirectories are not scanned.
+ * @returns true if the directory was scanned; false otherwise
+ */
+static bool ScanDirectory(NewestFilesHeap* heap, const char* directoryPath, bool recursive)
+{
+    bool succeeded = false;
+    STRING_HANDLE filePath = NULL;
+
+    if (recursive)
+    {
+        Log_Warn(
+            "Recursive scanning is not supported on this platform, scanning the top level of '%s' only",
+            directoryPath);
+    }
 
-    unsigned int totalFilesRead = 0;
     DIR* dp = ADUCPAL_opendir(directoryPath);
 
     if (dp == NULL)
@@ -114,54 +429,107 @@ bool FileInfoUtils_FillFileInfoWithNewestFilesInDir(FileInfo* logFiles, size_t l
         goto done;
     }
 
-    // Walk through each file and find each top level file
-    do
+    filePath = STRING_new();
+
+    if (filePath == NULL)
+    {
+        goto done;
+    }
+
+    while (true)
     {
         struct dirent* entry = ADUCPAL_readdir(dp); //Note: No need to free according to man readdir is static
         struct stat statbuf;
 
-        STRING_HANDLE filePath = STRING_new();
-
-        if (filePath == NULL)
+        if (entry == NULL)
         {
-            goto done;
+            break;
         }
 
-        if (entry == NULL)
+        if (heap->entriesScanned >= heap->maxEntriesToScan)
         {
+            NewestFilesHeap_StopAtCap(heap, "", entry->d_name);
             break;
         }
 
+        ++heap->entriesScanned;
+
         if (STRING_sprintf(filePath, "%s/%s", directoryPath, entry->d_name) != 0)
         {
             continue;
         }
 
-        if (stat(STRING_c_str(filePath), &statbuf) == -1)
+        // Note: Only care about the first level files that are not symbolic
+        if (stat(STRING_c_str(filePath), &statbuf) == -1 || !S_ISREG(statbuf.st_mode) || statbuf.st_size == 0)
         {
-            STRING_delete(filePath);
             continue;
         }
 
-        // Note: Only care about the first level files that are not symbolic
-        if (S_ISDIR(statbuf.st_mode) || S_ISLNK(statbuf.st_mode) || statbuf.st_size == 0)
+        if (!NewestFilesHeap_Offer(heap, entry->d_name, statbuf.st_size, statbuf.st_mtime))
         {
-            STRING_delete(filePath);
-            continue;
+            goto done;
         }
+    }
 
-        FileInfoUtils_InsertFileInfoIntoArray(logFiles, logFileSize, entry->d_name, statbuf.st_size, statbuf.st_mtime);
+    succeeded = true;
 
-        STRING_delete(filePath);
-        ++totalFilesRead;
+done:
 
-    } while (totalFilesRead < MAX_FILES_TO_SCAN);
+    STRING_delete(filePath);
 
-    if (logFiles[0].fileName == NULL)
+    if (dp != NULL)
+    {
+        ADUCPAL_closedir(dp);
+    }
+
+    return succeeded;
+}
+
+#endif
+
+/**
+ * @brief Fills @p logFiles with up to @p logFileSize newest files found in the directory at @p directoryPath
+ * @details Scans at most @p maxFilesToScan directory entries, keeping the newest files in a bounded min-heap.
+ * @param[out] logFiles the array of FileInfo structs that will hold the newest files, newest first
+ * @param[in] logFileSize the size of @p logFiles
+ * @param[in] directoryPath the directory to scan for the newest files
+ * @param[in] recursive true to also scan subdirectories, in which case the file names are relative to @p directoryPath
+ * @param[in] maxFilesToScan the maximum number of directory entries to scan
+ * @returns true if we're able to find new files to add to @p logFiles, false if unsuccessful
+ */
+static bool FileInfoUtils_FillFileInfoWithNewestFiles(
+    FileInfo* logFiles, size_t logFileSize, const char* directoryPath, bool recursive, unsigned int maxFilesToScan)
+{
+    bool succeeded = false;
+
+    if (logFiles == NULL || logFileSize == 0 || directoryPath == NULL)
+    {
+        return false;
+    }
+
+    memset(logFiles, 0, sizeof(FileInfo) * logFileSize);
+
+    NewestFilesHeap heap = {
+        .files = logFiles,
+        .capacity = logFileSize,
+        .count = 0,
+        .entriesScanned = 0,
+        .maxEntriesToScan = maxFilesToScan,
+        .capReached = false,
+    };
+
+    if (!ScanDirectory(&heap, directoryPath, recursive))
+    {
+        goto done;
+    }
+
+    if (heap.count == 0)
     {
         goto done;
     }
 
+    NewestFilesHeap_SortNewestFirst(&heap);
+
     succeeded = true;
 
 done:
@@ -169,18 +537,13 @@ done:
     if (!succeeded)
     {
         // Free all the file names, if allocated.
-        for (int i = 0; i < logFileSize; ++i)
+        for (size_t i = 0; i < logFileSize; ++i)
         {
             free(logFiles[i].fileName);
             memset(&logFiles[i], 0, sizeof(FileInfo));
         }
     }
 
-    if (dp != NULL)
-    {
-        ADUCPAL_closedir(dp);
-    }
-
     return succeeded;
 }
 
@@ -189,10 +552,16 @@ done:
  * @param[out] fileNameVector a pointer to a VECTOR_HANDLE of STRING_HANDLEs to be populated with the newest file names who's total size is less than @p maxFileSize - up to the caller to free with Vector_destroy()
  * @param[in] directoryPath path to the directory to scan
  * @param[in] maxFileSize the maximum size of all the files that can be uploaded in bytes
+ * @param[in] recursive true to also scan subdirectories
+ * @param[in] maxFilesToScan the maximum number of directory entries to scan
  * @returns true on successful scanning and populating of filePathVectorHandle; false on failure
  */
-bool FileInfoUtils_GetNewestFilesInDirUnderSize(
-    VECTOR_HANDLE* fileNameVector, const char* directoryPath, const long long maxFileSize)
+static bool FileInfoUtils_GetNewestFilesUnderSize(
+    VECTOR_HANDLE* fileNameVector,
+    const char* directoryPath,
+    const long long maxFileSize,
+    bool recursive,
+    unsigned int maxFilesToScan)
 {
     bool succeeded = false;
 
@@ -216,7 +585,8 @@ bool FileInfoUtils_GetNewestFilesInDirUnderSize(
         goto done;
     }
 
-    if (!FileInfoUtils_FillFileInfoWithNewestFilesInDir(discoveredFiles, discoveredFilesSize, directoryPath))
+    if (!FileInfoUtils_FillFileInfoWithNewestFiles(
+            discoveredFiles, discoveredFilesSize, directoryPath, recursive, maxFilesToScan))
     {
         goto done;
     }
@@ -282,3 +652,16 @@ done:
 
     return succeeded;
 }
+
+bool FileInfoUtils_GetNewestFilesInDirUnderSize(
+    VECTOR_HANDLE* fileNameVector, const char* directoryPath, const long long maxFileSize)
+{
+    return FileInfoUtils_GetNewestFilesUnderSize(
+        fileNameVector, directoryPath, maxFileSize, false, FILE_INFO_UTILS_DEFAULT_MAX_FILES_TO_SCAN);
+}
+
+bool FileInfoUtils_GetNewestFilesInTreeUnderSize(
+    VECTOR_HANDLE* fileNameVector, const char* directoryPath, const long long maxFileSize, unsigned int maxFilesToScan)
+{
+    return FileInfoUtils_GetNewestFilesUnderSize(fileNameVector, directoryPath, maxFileSize, true, maxFilesToScan);
+}
@@ -7,12 +7,22 @@
  */
 #include "file_info_utils.h"
 
+#include <aduc/auto_dir.hpp>
 #include <aduc/c_utils.h>
 #include <aduc/calloc_wrapper.hpp>
 #include <catch2/catch.hpp>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <time.h>
 #include <umock_c/umock_c.h>
+#include <unistd.h>
+#include <vector>
 
 TEST_CASE("FileInfoUtils_FillFileInfoWithNewestFilesInDir")
 {
@@ -130,3 +140,192 @@ TEST_CASE("FileInfoUtils_FillFileInfoWithNewestFilesInDir")
         }
     }
 }
+
+#define FILE_INFO_UTILS_UT_DIR "/tmp/adu_file_info_utils_ut"
+
+/**
+ * @brief Creates a directory tree of log files with distinct modification times, removed on destruction
+ */
+class TestLogFolder
+{
+public:
+    TestLogFolder() : folder{ FILE_INFO_UTILS_UT_DIR }
+    {
+        REQUIRE(folder.CreateDir());
+    }
+
+    void AddDirectory(const std::string& name)
+    {
+        REQUIRE(mkdir((folder.GetDir() + "/" + name).c_str(), 0755) == 0);
+    }
+
+    void AddFile(const std::string& name, size_t size, time_t lastWrite)
+    {
+        const std::string filePath = folder.GetDir() + "/" + name;
+        std::ofstream file{ filePath, std::ios::binary };
+        file << std::string(size, 'x');
+        file.close();
+
+        struct timeval times[2] = { { lastWrite, 0 }, { lastWrite, 0 } };
+        REQUIRE(utimes(filePath.c_str(), times) == 0);
+    }
+
+    void AddSymlink(const std::string& name, const std::string& target)
+    {
+        REQUIRE(symlink(target.c_str(), (folder.GetDir() + "/" + name).c_str()) == 0);
+    }
+
+    const char* Path() const
+    {
+        return FILE_INFO_UTILS_UT_DIR;
+    }
+
+private:
+    aduc::AutoDir folder;
+};
+
+static std::vector<std::string> ToStringVector(VECTOR_HANDLE fileNames)
+{
+    std::vector<std::string> result;
+    const size_t size = VECTOR_size(fileNames);
+    for (size_t i = 0; i < size; ++i)
+    {
+        STRING_HANDLE* fileName = static_cast<STRING_HANDLE*>(VECTOR_element(fileNames, i));
+        result.emplace_back(STRING_c_str(*fileName));
+        STRING_delete(*fileName);
+    }
+    VECTOR_destroy(fileNames);
+    return result;
+}
+
+TEST_CASE("FileInfoUtils_GetNewestFilesInDirUnderSize")
+{
+    const time_t now = time(nullptr);
+
+    SECTION("Keeps the newest files, newest first")
+    {
+        TestLogFolder folder;
+        for (int i = 0; i < 200; ++i)
+        {
+            folder.AddFile("syslog." + std::to_string(i), 10, now - 1000 + ((i * 37) % 200));
+        }
+
+        VECTOR_HANDLE fileNames = nullptr;
+        REQUIRE(FileInfoUtils_GetNewestFilesInDirUnderSize(&fileNames, folder.Path(), 1024 * 1024));
+
+        const auto names = ToStringVector(fileNames);
+        REQUIRE(names.size() == 20);
+
+        // (i * 37) % 200 is 199 for i == 27, 198 for i == 54 and 197 for i == 81
+        CHECK(names[0] == "syslog.27");
+        CHECK(names[1] == "syslog.54");
+        CHECK(names[2] == "syslog.81");
+    }
+
+    SECTION("Stops at the size budget")
+    {
+        TestLogFolder folder;
+        folder.AddFile("du-agent.3.log", 100, now - 30);
+        folder.AddFile("du-agent.1.log", 100, now - 10);
+        folder.AddFile("du-agent.2.log", 100, now - 20);
+
+        VECTOR_HANDLE fileNames = nullptr;
+        REQUIRE(FileInfoUtils_GetNewestFilesInDirUnderSize(&fileNames, folder.Path(), 150));
+
+        const auto names = ToStringVector(fileNames);
+        REQUIRE(names.size() == 2);
+        CHECK(names[0] == "du-agent.1.log");
+        CHECK(names[1] == "du-agent.2.log");
+    }
+
+    SECTION("Skips empty files, symbolic links and subdirectories")
+    {
+        TestLogFolder folder;
+        folder.AddFile("du-agent.log", 100, now - 10);
+        folder.AddFile("empty.log", 0, now);
+        folder.AddSymlink("link.log", std::string{ folder.Path() } + "/du-agent.log");
+        folder.AddDirectory("archive");
+        folder.AddFile("archive/old.log", 100, now);
+
+        VECTOR_HANDLE fileNames = nullptr;
+        REQUIRE(FileInfoUtils_GetNewestFilesInDirUnderSize(&fileNames, folder.Path(), 1024));
+
+        const auto names = ToStringVector(fileNames);
+        REQUIRE(names.size() == 1);
+        CHECK(names[0] == "du-agent.log");
+    }
+
+    SECTION("Fails when no file is found")
+    {
+        TestLogFolder folder;
+        folder.AddDirectory("archive");
+
+        VECTOR_HANDLE fileNames = nullptr;
+        CHECK_FALSE(FileInfoUtils_GetNewestFilesInDirUnderSize(&fileNames, folder.Path(), 1024));
+        CHECK(fileNames == nullptr);
+
+        CHECK_FALSE(FileInfoUtils_GetNewestFilesInDirUnderSize(&fileNames, "/nonexistent/adu", 1024));
+    }
+}
+
+TEST_CASE("FileInfoUtils_GetNewestFilesInTreeUnderSize")
+{
+    const time_t now = time(nullptr);
+
+    SECTION("Includes files in subdirectories with relative names")
+    {
+        TestLogFolder folder;
+        folder.AddFile("syslog", 100, now - 30);
+        folder.AddDirectory("archive");
+        folder.AddFile("archive/syslog.1", 100, now - 10);
+        folder.AddDirectory("archive/2024");
+        folder.AddFile("archive/2024/syslog.2", 100, now - 20);
+
+        VECTOR_HANDLE fileNames = nullptr;
+        REQUIRE(FileInfoUtils_GetNewestFilesInTreeUnderSize(
+            &fileNames, folder.Path(), 1024, FILE_INFO_UTILS_DEFAULT_MAX_FILES_TO_SCAN));
+
+        const auto names = ToStringVector(fileNames);
+        REQUIRE(names.size() == 3);
+        CHECK(names[0] == "archive/syslog.1");
+        CHECK(names[1] == "archive/2024/syslog.2");
+        CHECK(names[2] == "syslog");
+    }
+
+    SECTION("Scans sibling subdirectories of the same depth")
+    {
+        TestLogFolder folder;
+        for (int i = 0; i < 4; ++i)
+        {
+            const std::string directory = "archive." + std::to_string(i);
+            folder.AddDirectory(directory);
+            folder.AddDirectory(directory + "/old");
+            folder.AddFile(directory + "/syslog", 100, now - 10 * i);
+            folder.AddFile(directory + "/old/syslog", 100, now - 10 * i - 5);
+        }
+
+        VECTOR_HANDLE fileNames = nullptr;
+        REQUIRE(FileInfoUtils_GetNewestFilesInTreeUnderSize(
+            &fileNames, folder.Path(), 1024 * 1024, FILE_INFO_UTILS_DEFAULT_MAX_FILES_TO_SCAN));
+
+        const auto names = ToStringVector(fileNames);
+        REQUIRE(names.size() == 8);
+        CHECK(names[0] == "archive.0/syslog");
+        CHECK(names[1] == "archive.0/old/syslog");
+        CHECK(names[7] == "archive.3/old/syslog");
+    }
+
+    SECTION("Stops scanning at the file count cap")
+    {
+        TestLogFolder folder;
+        for (int i = 0; i < 50; ++i)
+        {
+            folder.AddFile("syslog." + std::to_string(i), 10, now - i);
+        }
+
+        VECTOR_HANDLE fileNames = nullptr;
+        REQUIRE(FileInfoUtils_GetNewestFilesInTreeUnderSize(&fileNames, folder.Path(), 1024 * 1024, 5));
+
+        CHECK(ToStringVector(fileNames).size() == 5);
+    }
+}
@@ -25,8 +25,27 @@ typedef struct tagBlobStorageInfo
     STRING_HANDLE storageSasCredential; //!< Combined SAS URI and SAS Token for connecting to storage
 } BlobStorageInfo;
 
+/**
+ * @brief Returns true once an upload should stop
+ * @param context the context passed with the function to the upload
+ */
+typedef bool (*FileUploadUtility_IsCancelledFunc)(void* context);
+
 bool FileUploadUtility_UploadFilesToContainer(
-    const BlobStorageInfo* blobInfo, VECTOR_HANDLE fileNames, const char* directoryPath);
+    const BlobStorageInfo* blobInfo,
+    VECTOR_HANDLE fileNames,
+    const char* directoryPath,
+    FileUploadUtility_IsCancelledFunc isCancelled,
+    void* cancelContext);
+
+bool FileUploadUtility_UploadFilesAsCompressedArchive(
+    const BlobStorageInfo* blobInfo,
+    VECTOR_HANDLE fileNames,
+    const char* directoryPath,
+    const char* archiveName,
+    long long maxCompressedSize,
+    FileUploadUtility_IsCancelledFunc isCancelled,
+    void* cancelContext);
 
 EXTERN_C_END
 
@@ -0,0 +1,213 @@
+/**
+ * @file archive_upload.cpp
+ * @brief Implements uploading files as one gzip-compressed tar archive
+ *
+ * @copyright Copyright (c) Microsoft Corp.
+ */
+#include "archive_upload.hpp"
+#include "tar_gzip_writer.hpp"
+
+#include <aduc/logging.h>
+#include <sys/stat.h>
+
+// Room for the end-of-archive blocks and the gzip trailer.
+#define ARCHIVE_OVERHEAD_SIZE 1024ULL
+
+#define ARCHIVE_ENTRY_HEADER_SIZE 512ULL
+
+#define ARCHIVE_UPLOAD_BLOCK_SIZE (1024 * 1024)
+
+BlockUploadOptions GetArchiveUploadOptions()
+{
+    BlockUploadOptions options;
+    options.blockSize = ARCHIVE_UPLOAD_BLOCK_SIZE;
+    return options;
+}
+
+/**
+ * @brief Packs the files of @p fileNames into a .tar.gz archive uploaded to @p blobName, in one pass
+ * @details No more than @p maxCompressedSize bytes are ever written to the blob: a file whose compressed bytes
+ * would go past it breaks the archive, which is then not committed, and @p capReached is set.
+ * @param filesThatFit set to the number of files, first to last, that were packed before the cap was reached
+ * @param capReached set if the archive was abandoned at @p maxCompressedSize
+ * @returns true if at least one file was packed and the archive was committed; false otherwise
+ */
+static bool PackAndUploadFiles(
+    BlockBlobStager& stager,
+    const std::string& directoryPath,
+    const std::vector<std::string>& fileNames,
+    const std::string& blobName,
+    unsigned long long maxCompressedSize,
+    const BlockUploadOptions& options,
+    size_t& filesThatFit,
+    bool& capReached)
+{
+    filesThatFit = 0;
+    capReached = false;
+
+    BlockBlobStreamWriter blobWriter(stager, blobName, options);
+    TarGzipWriter archive([&blobWriter, &capReached, maxCompressedSize](const uint8_t* data, size_t size) -> bool {
+        if (blobWriter.BytesWritten() + size > maxCompressedSize)
+        {
+            capReached = true;
+            return false;
+        }
+
+        return blobWriter.Write(data, size);
+    });
+
+    size_t filesPacked = 0;
+    size_t filesThatFitBeforeLastPacked = 0;
+    for (const auto& fileName : fileNames)
+    {
+        if (archive.Failed() || options.IsCancelled())
+        {
+            break;
+        }
+
+        // CompressedBytes() is the actual size so far; stop once there is no room left to finish the archive.
+        if (archive.CompressedBytes() + ARCHIVE_OVERHEAD_SIZE >= maxCompressedSize)
+        {
+            break;
+        }
+
+        std::string filePath = directoryPath;
+        if (!filePath.empty() && filePath[filePath.length() - 1] != '/')
+        {
+            filePath += "/";
+        }
+        filePath += fileName;
+
+        struct stat st = {};
+        if (stat(filePath.c_str(), &st) != 0)
+        {
+            Log_Warn("Cannot stat '%s', skipping it", filePath.c_str());
+            ++filesThatFit;
+            continue;
+        }
+
+        const double ratio = archive.UncompressedBytes() == 0
+            ? 1.0
+            : static_cast<double>(archive.CompressedBytes()) / static_cast<double>(archive.UncompressedBytes());
+        const auto estimatedSize = static_cast<unsigned long long>(
+            static_cast<double>(static_cast<unsigned long long>(st.st_size) + ARCHIVE_ENTRY_HEADER_SIZE) * ratio);
+
+        if (archive.CompressedBytes() + estimatedSize + ARCHIVE_OVERHEAD_SIZE > maxCompressedSize)
+        {
+            break;
+        }
+
+        if (archive.AddFile(filePath, fileName))
+        {
+            ++filesPacked;
+            filesThatFitBeforeLastPacked = filesThatFit;
+        }
+
+        if (archive.Failed())
+        {
+            break;
+        }
+
+        if (archive.CompressedBytes() + ARCHIVE_OVERHEAD_SIZE > maxCompressedSize)
+        {
+            // Packed, but it leaves no room to finish the archive.
+            capReached = true;
+            break;
+        }
+
+        ++filesThatFit;
+    }
+
+    if (options.IsCancelled())
+    {
+        Log_Info("Uploading '%s' was cancelled", blobName.c_str());
+        return false;
+    }
+
+    if (capReached)
+    {
+        Log_Info(
+            "'%s' reached %llu compressed bytes after %zu of %zu files",
+            blobName.c_str(),
+            maxCompressedSize,
+            filesThatFit,
+            fileNames.size());
+        return false;
+    }
+
+    if (archive.Failed())
+    {
+        Log_Error("Building '%s' failed", blobName.c_str());
+        return false;
+    }
+
+    if (filesPacked == 0)
+    {
+        Log_Error("No file fits into '%s'", blobName.c_str());
+        return false;
+    }
+
+    if (filesPacked < fileNames.size())
+    {
+        Log_Info(
+            "Packed %zu of %zu files to stay under %llu compressed bytes",
+            filesPacked,
+            fileNames.size(),
+            maxCompressedSize);
+    }
+
+    if (!archive.Finish())
+    {
+        if (capReached)
+        {
+            // The files fit, the end of the archive did not.
+            filesThatFit = filesThatFitBeforeLastPacked;
+        }
+        return false;
+    }
+
+    if (!blobWriter.Commit())
+    {
+        return false;
+    }
+
+    Log_Info(
+        "Uploaded %zu files as '%s': %llu bytes compressed to %llu",
+        filesPacked,
+        blobName.c_str(),
+        static_cast<unsigned long long>(archive.UncompressedBytes()),
+        static_cast<unsigned long long>(archive.CompressedBytes()));
+
+    return true;
+}
+
+bool UploadFilesAsTarGzip(
+    BlockBlobStager& stager,
+    const std::string& directoryPath,
+    const std::vector<std::string>& fileNames,
+    const std::string& blobName,
+    unsigned long long maxCompressedSize,
+    const BlockUploadOptions& options)
+{
+    size_t filesThatFit = 0;
+    bool capReached = false;
+
+    if (PackAndUploadFiles(
+            stager, directoryPath, fileNames, blobName, maxCompressedSize, options, filesThatFit, capReached))
+    {
+        return true;
+    }
+
+    if (!capReached || filesThatFit == 0)
+    {
+        return false;
+    }
+
+    // The files before the one that went past the cap are known to fit: upload them again, without it.
+    // The blocks staged by the first pass were not committed, and are replaced.
+    const std::vector<std::string> fittingFileNames(
+        fileNames.begin(), fileNames.begin() + static_cast<std::ptrdiff_t>(filesThatFit));
+
+    return PackAndUploadFiles(
+        stager, directoryPath, fittingFileNames, blobName, maxCompressedSize, options, filesThatFit, capReached);
+}
@@ -0,0 +1,45 @@
+/**
+ * @file archive_upload.hpp
+ * @brief Uploads files as one gzip-compressed tar archive, streamed to a block blob while it is built
+ *
+ * @copyright Copyright (c) Microsoft Corp.
+ */
+#ifndef ARCHIVE_UPLOAD_HPP
+#define ARCHIVE_UPLOAD_HPP
+
+#include "block_blob_upload.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Default options for archive uploads. Blocks are smaller than for file uploads,
+ * because the archive is held in memory until its blocks are staged.
+ */
+BlockUploadOptions GetArchiveUploadOptions();
+
+/**
+ * @brief Packs the files in @p fileNames into a .tar.gz archive uploaded to @p blobName as it is built
+ * @details Files are packed in order while the archive is estimated to stay under @p maxCompressedSize:
+ * the size of the next file is scaled by the compression ratio achieved so far, starting at 1.
+ * Packing stops at the first file that does not fit, so with newest-first @p fileNames the newest logs are kept.
+ * The limit is enforced on the compressed bytes actually written: when a file compresses worse than estimated and
+ * goes past it, the archive is built again without that file, and the blob never exceeds @p maxCompressedSize.
+ * Once @p options.isCancelled returns true, packing stops and nothing is committed.
+ * @param stager the block blob operations
+ * @param directoryPath the directory that holds @p fileNames
+ * @param fileNames the names of the files, which are also their names in the archive
+ * @param blobName the name of the archive blob
+ * @param maxCompressedSize the maximum size of the archive in bytes
+ * @param options the block upload options
+ * @returns true if at least one file was packed and the archive was committed; false otherwise, or if cancelled
+ */
+bool UploadFilesAsTarGzip(
+    BlockBlobStager& stager,
+    const std::string& directoryPath,
+    const std::vector<std::string>& fileNames,
+    const std::string& blobName,
+    unsigned long long maxCompressedSize,
+    const BlockUploadOptions& options = GetArchiveUploadOptions());
+
+#endif // ARCHIVE_UPLOAD_HPP
@@ -5,13 +5,62 @@
  * @copyright Copyright (c) Microsoft Corp.
  */
 #include "blob_storage_helper.hpp"
+#include "archive_upload.hpp"
+#include "block_blob_upload.hpp"
 
 #include <aduc/exception_utils.hpp>
+#include <aduc/logging.h>
+#include <azure/core/base64.hpp>
 #include <azure_c_shared_utility/string_token.h>
 #include <azure_c_shared_utility/urlencode.h>
 #include <cstring>
 #include <fstream>
 
+/**
+ * @brief Stages and commits the blocks of block blobs in an Azure Storage container
+ */
+class AzureBlockBlobStager : public BlockBlobStager
+{
+public:
+    explicit AzureBlockBlobStager(Azure::Storage::Blobs::BlobContainerClient& containerClient)
+        : containerClient(containerClient)
+    {
+    }
+
+    void StageBlock(const std::string& blobName, const std::string& blockId, const uint8_t* data, size_t size) override
+    {
+        Azure::Core::IO::MemoryBodyStream blockStream(data, size);
+        containerClient.GetBlockBlobClient(blobName).StageBlock(EncodeBlockId(blockId), blockStream);
+    }
+
+    void CommitBlockList(const std::string& blobName, const std::vector<std::string>& blockIds) override
+    {
+        std::vector<std::string> encodedBlockIds;
+        encodedBlockIds.reserve(blockIds.size());
+        for (const auto& blockId : blockIds)
+        {
+            encodedBlockIds.emplace_back(EncodeBlockId(blockId));
+        }
+
+        containerClient.GetBlockBlobClient(blobName).CommitBlockList(encodedBlockIds);
+    }
+
+    void UploadBlob(const std::string& blobName, const uint8_t* data, size_t size) override
+    {
+        Azure::Core::IO::MemoryBodyStream blobStream(data, size);
+        containerClient.GetBlockBlobClient(blobName).Upload(blobStream);
+    }
+
+private:
+    // Block ids must be base64 encoded.
+    static std::string EncodeBlockId(const std::string& blockId)
+    {
+        return Azure::Core::Convert::Base64Encode(std::vector<uint8_t>(blockId.begin(), blockId.end()));
+    }
+
+    Azure::Storage::Blobs::BlobContainerClient& containerClient;
+};
+
 /**
  * @brief Creates the blob storage client using the information in @p blobInfo and then constructs the object
  * @param blobInfo information related to the blob storage account
@@ -56,13 +105,18 @@ AzureBlobStorageHelper::CreatePathFromFileAndDirectory(const std::string& fileNa
 
 /**
  * @brief Uploads all the files listed in @p files using the storage account associated with this object
+ * Each file is uploaded as staged blocks, several at a time, so a failed block is retried without restarting the file.
  * @param fileNames vector of file names to upload
  * @param directoryPath path to the directory where @p fileNames can be found
  * @param virtualDirectory a properly formatted virtual directory (ending in '/') to be used when uploading the files
- * @returns true on success; false on any failure
+ * @param isCancelled polled between files and blocks; may be empty
+ * @returns true on success; false on any failure, or once cancelled
  */
 bool AzureBlobStorageHelper::UploadFilesToContainer(
-    VECTOR_HANDLE fileNames, const std::string& directoryPath, const std::string& virtualDirectory)
+    VECTOR_HANDLE fileNames,
+    const std::string& directoryPath,
+    const std::string& virtualDirectory,
+    const std::function<bool()>& isCancelled)
 {
     if (VECTOR_size(fileNames) == 0)
     {
@@ -75,25 +129,85 @@ bool AzureBlobStorageHelper::UploadFilesToContainer(
         virtualDirectoryPath += "/";
     }
 
+    AzureBlockBlobStager stager(*client);
+    BlockUploadOptions options;
+    options.isCancelled = isCancelled;
+    bool succeeded = true;
+
     size_t fileNameSize = VECTOR_size(fileNames);
     for (unsigned int i = 0; i < fileNameSize; ++i)
     {
+        if (options.IsCancelled())
+        {
+            Log_Info("Uploading files was cancelled after %u of %zu files", i, fileNameSize);
+            return false;
+        }
+
         auto fileNameHandle = static_cast<const STRING_HANDLE*>(VECTOR_element(fileNames, i));
         const char* fileName = STRING_c_str(*fileNameHandle);
 
+        bool uploaded = false;
         ADUC::ExceptionUtils::CallVoidMethodAndHandleExceptions(
-            [fileName, directoryPath, virtualDirectoryPath, this]() -> void {
+            [fileName, directoryPath, virtualDirectoryPath, &stager, &options, &uploaded, this]() -> void {
                 std::string filePath = CreatePathFromFileAndDirectory(fileName, directoryPath);
 
-                Azure::Core::IO::FileBodyStream fileStream(filePath);
-
                 std::string blobName = virtualDirectoryPath + fileName;
 
-                std::vector<std::pair<std::string, std::string>> metadata;
-
-                this->client->UploadBlob(blobName, fileStream);
+                uploaded = UploadFileInBlocks(stager, filePath, blobName, options);
             });
+
+        if (!uploaded)
+        {
+            // Keep uploading the other files; the caller reports the partial upload.
+            Log_Error("Uploading '%s' failed", fileName);
+            succeeded = false;
+        }
+    }
+
+    return succeeded;
+}
+
+/**
+ * @brief Packs the files listed in @p fileNames into a gzip-compressed tar archive, uploaded as staged blocks
+ * while it is built, so the archive is never written to disk
+ * @param fileNames vector of file names to pack, newest first
+ * @param directoryPath path to the directory where @p fileNames can be found
+ * @param virtualDirectory a properly formatted virtual directory (ending in '/') to be used for the archive blob
+ * @param archiveName the name of the archive blob
+ * @param maxCompressedSize the maximum size of the archive in bytes
+ * @param isCancelled polled between files and blocks; may be empty
+ * @returns true on success; false on any failure, if no file fits, or once cancelled
+ */
+bool AzureBlobStorageHelper::UploadFilesAsCompressedArchive(
+    VECTOR_HANDLE fileNames,
+    const std::string& directoryPath,
+    const std::string& virtualDirectory,
+    const std::string& archiveName,
+    unsigned long long maxCompressedSize,
+    const std::function<bool()>& isCancelled)
+{
+    if (VECTOR_size(fileNames) == 0 || archiveName.empty())
+    {
+        throw std::invalid_argument(__FUNCTION__);
+    }
+
+    std::string blobName = virtualDirectory;
+    if (!blobName.empty() && blobName[blobName.length() - 1] != '/')
+    {
+        blobName += "/";
+    }
+    blobName += archiveName;
+
+    std::vector<std::string> archiveFileNames;
+    const size_t fileNameSize = VECTOR_size(fileNames);
+    for (size_t i = 0; i < fileNameSize; ++i)
+    {
+        auto fileNameHandle = static_cast<const STRING_HANDLE*>(VECTOR_element(fileNames, i));
+        archiveFileNames.emplace_back(STRING_c_str(*fileNameHandle));
     }
 
-    return true;
+    AzureBlockBlobStager stager(*client);
+    BlockUploadOptions options = GetArchiveUploadOptions();
+    options.isCancelled = isCancelled;
+    return UploadFilesAsTarGzip(stager, directoryPath, archiveFileNames, blobName, maxCompressedSize, options);
 }
@@ -9,6 +9,7 @@
 // Note: This is just the top level portion
 #include <azure/storage/blobs.hpp>
 #include <azure_c_shared_utility/vector.h>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -26,7 +27,18 @@ public:
     AzureBlobStorageHelper(const BlobStorageInfo& blobInfo);
 
     bool UploadFilesToContainer(
-        const VECTOR_HANDLE fileNames, const std::string& directoryPath, const std::string& virtualDirectory);
+        const VECTOR_HANDLE fileNames,
+        const std::string& directoryPath,
+        const std::string& virtualDirectory,
+        const std::function<bool()>& isCancelled);
+
+    bool UploadFilesAsCompressedArchive(
+        const VECTOR_HANDLE fileNames,
+        const std::string& directoryPath,
+        const std::string& virtualDirectory,
+        const std::string& archiveName,
+        unsigned long long maxCompressedSize,
+        const std::function<bool()>& isCancelled);
 
     ~AzureBlobStorageHelper() = default;
 };
@@ -0,0 +1,466 @@
+/**
+ * @file block_blob_upload.cpp
+ * @brief Implements uploading files and streams as block blobs, staging their blocks concurrently
+ *
+ * @copyright Copyright (c) Microsoft Corp.
+ */
+#include "block_blob_upload.hpp"
+
+#include <aduc/logging.h>
+#include <aduc/retry_utils.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+// How often a retry delay checks for cancellation.
+#define BLOCK_UPLOAD_CANCEL_POLL_MS 100
+
+std::string GetBlockId(size_t blockIndex)
+{
+    char blockId[sizeof("block-0000000000")];
+    (void)snprintf(blockId, sizeof(blockId), "block-%010zu", blockIndex);
+    return blockId;
+}
+
+/**
+ * @brief Sleeps for @p delayMs, returning early once the upload is cancelled
+ * @param options the upload options
+ * @param delayMs the delay in milliseconds
+ */
+static void SleepUnlessCancelled(const BlockUploadOptions& options, unsigned long delayMs)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs);
+    while (!options.IsCancelled() && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+            deadline - std::chrono::steady_clock::now(), std::chrono::milliseconds(BLOCK_UPLOAD_CANCEL_POLL_MS)));
+    }
+}
+
+/**
+ * @brief Runs one request of an upload, retrying it up to @p options.maxBlockAttempts times
+ * @param description what the request does, for the logs, e.g. "Staging block 3 of 'blob'"
+ * @param options the upload options
+ * @param abandoned set by other workers once the upload failed; stops the retries
+ * @param request the request; throws on failure
+ * @returns true if the request succeeded; false if it failed, or the upload was abandoned or cancelled
+ */
+static bool RunWithRetries(
+    const std::string& description,
+    const BlockUploadOptions& options,
+    const std::atomic<bool>& abandoned,
+    const std::function<void()>& request)
+{
+    bool succeeded = false;
+
+    // Jittered, so that the workers, and the devices that were asked for logs at the same time, spread their
+    // retries.
+    ADUC_Retry_Policy retryPolicy;
+    if (!ADUC_Retry_Policy_Init(
+            &retryPolicy,
+            options.retryDelayMilliseconds,
+            options.retryDelayMilliseconds * 32UL /* maxDelayMs */,
+            0 /* failureThreshold */,
+            0 /* openDurationMs */))
+    {
+        return false;
+    }
+
+    for (unsigned int attempt = 1; attempt <= options.maxBlockAttempts && !abandoned && !options.IsCancelled();
+         ++attempt)
+    {
+        try
+        {
+            request();
+            succeeded = true;
+            break;
+        }
+        catch (const std::exception& e)
+        {
+            Log_Warn(
+                "%s failed (attempt %u of %u): %s",
+                description.c_str(),
+                attempt,
+                options.maxBlockAttempts,
+                e.what());
+        }
+        catch (...)
+        {
+            Log_Warn("%s failed (attempt %u of %u)", description.c_str(), attempt, options.maxBlockAttempts);
+        }
+
+        if (attempt < options.maxBlockAttempts)
+        {
+            SleepUnlessCancelled(options, ADUC_Retry_Policy_OnFailure(&retryPolicy, 0, 0));
+        }
+    }
+
+    ADUC_Retry_Policy_Deinit(&retryPolicy);
+    return succeeded;
+}
+
+/**
+ * @brief Stages one block, retrying it up to @p options.maxBlockAttempts times
+ * @param stager the block blob operations
+ * @param blobName the name of the blob
+ * @param blockIndex the index of the block
+ * @param data the content of the block
+ * @param size the size of @p data in bytes
+ * @param options the upload options
+ * @param abandoned set by other workers once the upload failed; stops the retries
+ * @returns true if the block was staged; false if it failed, or the upload was abandoned or cancelled
+ */
+static bool StageBlockWithRetries(
+    BlockBlobStager& stager,
+    const std::string& blobName,
+    size_t blockIndex,
+    const uint8_t* data,
+    size_t size,
+    const BlockUploadOptions& options,
+    const std::atomic<bool>& abandoned)
+{
+    const std::string blockId = GetBlockId(blockIndex);
+    const std::string description = "Staging block " + std::to_string(blockIndex) + " of '" + blobName + "'";
+
+    return RunWithRetries(
+        description, options, abandoned, [&]() { stager.StageBlock(blobName, blockId, data, size); });
+}
+
+/**
+ * @brief Uploads content that fits in one block in a single request, retrying it up to @p options.maxBlockAttempts
+ * times. Saves the round trip of committing a block list, which is most of the cost of uploading a small file.
+ * @param stager the block blob operations
+ * @param blobName the name of the blob
+ * @param data the content of the blob
+ * @param size the size of @p data in bytes
+ * @param options the upload options
+ * @returns true if the blob was uploaded; false if it failed, or the upload was cancelled
+ */
+static bool UploadBlobWithRetries(
+    BlockBlobStager& stager,
+    const std::string& blobName,
+    const uint8_t* data,
+    size_t size,
+    const BlockUploadOptions& options)
+{
+    const std::atomic<bool> abandoned{ false };
+    const std::string description = "Uploading '" + blobName + "'";
+
+    if (!RunWithRetries(description, options, abandoned, [&]() { stager.UploadBlob(blobName, data, size); }))
+    {
+        Log_Error("Uploading '%s' failed", blobName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Uploads @p filePath, which fits in one block, in a single request
+ * @param stager the block blob operations
+ * @param filePath the path of the file to upload
+ * @param fileSize the size of the file in bytes
+ * @param blobName the name of the blob
+ * @param options the upload options
+ * @returns true on success
+ */
+static bool UploadSmallFile(
+    BlockBlobStager& stager,
+    const std::string& filePath,
+    size_t fileSize,
+    const std::string& blobName,
+    const BlockUploadOptions& options)
+{
+    std::vector<uint8_t> content(fileSize);
+
+    std::ifstream file(filePath, std::ios::binary);
+    file.read(reinterpret_cast<char*>(content.data()), static_cast<std::streamsize>(fileSize));
+    if (!file || static_cast<size_t>(file.gcount()) != fileSize)
+    {
+        Log_Error("Reading '%s' failed", filePath.c_str());
+        return false;
+    }
+
+    return UploadBlobWithRetries(stager, blobName, content.data(), content.size(), options);
+}
+
+bool UploadFileInBlocks(
+    BlockBlobStager& stager,
+    const std::string& filePath,
+    const std::string& blobName,
+    const BlockUploadOptions& options)
+{
+    if (options.blockSize == 0 || options.maxConcurrency == 0 || options.maxBlockAttempts == 0)
+    {
+        Log_Error("Invalid block upload options");
+        return false;
+    }
+
+    std::ifstream sizeStream(filePath, std::ios::binary | std::ios::ate);
+    if (!sizeStream)
+    {
+        Log_Error("Cannot open '%s'", filePath.c_str());
+        return false;
+    }
+
+    const auto fileSize = static_cast<size_t>(sizeStream.tellg());
+    sizeStream.close();
+
+    if (fileSize <= options.blockSize)
+    {
+        return UploadSmallFile(stager, filePath, fileSize, blobName, options);
+    }
+
+    const size_t blockCount = (fileSize + options.blockSize - 1) / options.blockSize;
+    const auto workerCount = static_cast<unsigned int>(std::min<size_t>(options.maxConcurrency, blockCount));
+
+    std::atomic<size_t> nextBlock{ 0 };
+    std::atomic<bool> failed{ false };
+
+    // Each worker reads the blocks it stages from its own stream, so at most
+    // workerCount blocks are in memory at once.
+    auto worker = [&]() noexcept -> void {
+        try
+        {
+            std::ifstream file(filePath, std::ios::binary);
+            std::vector<uint8_t> buffer(options.blockSize);
+
+            for (size_t blockIndex = nextBlock++; blockIndex < blockCount && !failed; blockIndex = nextBlock++)
+            {
+                if (options.IsCancelled())
+                {
+                    Log_Info("Uploading '%s' was cancelled", blobName.c_str());
+                    failed = true;
+                    break;
+                }
+
+                const size_t offset = blockIndex * options.blockSize;
+                const size_t size = std::min(options.blockSize, fileSize - offset);
+
+                file.seekg(static_cast<std::streamoff>(offset));
+                file.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(size));
+                if (!file || static_cast<size_t>(file.gcount()) != size)
+                {
+                    Log_Error("Reading block %zu of '%s' failed", blockIndex, filePath.c_str());
+                    failed = true;
+                    break;
+                }
+
+                if (!StageBlockWithRetries(stager, blobName, blockIndex, buffer.data(), size, options, failed))
+                {
+                    failed = true;
+                    break;
+                }
+            }
+        }
+        catch (const std::exception& e)
+        {
+            Log_Error("Uploading blocks of '%s' failed: %s", blobName.c_str(), e.what());
+            failed = true;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    try
+    {
+        for (unsigned int i = 1; i < workerCount; ++i)
+        {
+            workers.emplace_back(worker);
+        }
+    }
+    catch (const std::system_error& e)
+    {
+        // Stage with the threads that did start.
+        Log_Warn("Starting a block upload thread failed: %s", e.what());
+    }
+
+    if (workerCount > 0)
+    {
+        worker();
+    }
+
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+
+    if (failed)
+    {
+        Log_Error("Uploading '%s' failed; its blocks were not committed", blobName.c_str());
+        return false;
+    }
+
+    std::vector<std::string> blockIds;
+    blockIds.reserve(blockCount);
+    for (size_t blockIndex = 0; blockIndex < blockCount; ++blockIndex)
+    {
+        blockIds.emplace_back(GetBlockId(blockIndex));
+    }
+
+    try
+    {
+        stager.CommitBlockList(blobName, blockIds);
+    }
+    catch (const std::exception& e)
+    {
+        Log_Error("Committing the %zu blocks of '%s' failed: %s", blockCount, blobName.c_str(), e.what());
+        return false;
+    }
+    catch (...)
+    {
+        Log_Error("Committing the %zu blocks of '%s' failed", blockCount, blobName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+BlockBlobStreamWriter::BlockBlobStreamWriter(
+    BlockBlobStager& stager, std::string blobName, const BlockUploadOptions& options)
+    : stager(stager), blobName(std::move(blobName)), options(options)
+{
+    if (options.blockSize == 0 || options.maxConcurrency == 0 || options.maxBlockAttempts == 0)
+    {
+        Log_Error("Invalid block upload options");
+        failed = true;
+        return;
+    }
+
+    currentBlock.reserve(options.blockSize);
+}
+
+BlockBlobStreamWriter::~BlockBlobStreamWriter()
+{
+    failed = true;
+    while (!stagingThreads.empty())
+    {
+        WaitForOldestBlock();
+    }
+}
+
+void BlockBlobStreamWriter::WaitForOldestBlock()
+{
+    stagingThreads.front().join();
+    stagingThreads.erase(stagingThreads.begin());
+}
+
+void BlockBlobStreamWriter::StageCurrentBlock()
+{
+    if (stagingThreads.size() >= options.maxConcurrency)
+    {
+        WaitForOldestBlock();
+    }
+
+    const size_t blockIndex = blockCount++;
+
+    auto stageBlock = [this, blockIndex](const std::shared_ptr<std::vector<uint8_t>>& block) noexcept -> void {
+        if (!StageBlockWithRetries(stager, blobName, blockIndex, block->data(), block->size(), options, failed))
+        {
+            failed = true;
+        }
+    };
+
+    // Shared, so that the block is still here to be staged inline when the thread cannot be started: std::thread
+    // takes its arguments before it starts the thread.
+    auto block = std::make_shared<std::vector<uint8_t>>();
+    block->reserve(options.blockSize);
+    block->swap(currentBlock);
+
+    try
+    {
+        stagingThreads.emplace_back(stageBlock, block);
+    }
+    catch (const std::system_error& e)
+    {
+        Log_Warn("Starting a block upload thread failed, staging block %zu inline: %s", blockIndex, e.what());
+        stageBlock(block);
+    }
+}
+
+bool BlockBlobStreamWriter::Write(const uint8_t* data, size_t size)
+{
+    if (!failed && options.IsCancelled())
+    {
+        Log_Info("Uploading '%s' was cancelled", blobName.c_str());
+        failed = true;
+    }
+
+    while (size > 0 && !failed)
+    {
+        const size_t chunk = std::min(size, options.blockSize - currentBlock.size());
+        currentBlock.insert(currentBlock.end(), data, data + chunk);
+        data += chunk;
+        size -= chunk;
+        bytesWritten += chunk;
+
+        if (currentBlock.size() == options.blockSize)
+        {
+            StageCurrentBlock();
+        }
+    }
+
+    return !failed;
+}
+
+bool BlockBlobStreamWriter::Commit()
+{
+    if (!failed && options.IsCancelled())
+    {
+        Log_Info("Uploading '%s' was cancelled", blobName.c_str());
+        failed = true;
+    }
+
+    if (blockCount == 0 && !failed)
+    {
+        return UploadBlobWithRetries(stager, blobName, currentBlock.data(), currentBlock.size(), options);
+    }
+
+    if (!currentBlock.empty() && !failed)
+    {
+        StageCurrentBlock();
+    }
+
+    while (!stagingThreads.empty())
+    {
+        WaitForOldestBlock();
+    }
+
+    if (failed)
+    {
+        Log_Error("Uploading '%s' failed; its blocks were not committed", blobName.c_str());
+        return false;
+    }
+
+    std::vector<std::string> blockIds;
+    blockIds.reserve(blockCount);
+    for (size_t blockIndex = 0; blockIndex < blockCount; ++blockIndex)
+    {
+        blockIds.emplace_back(GetBlockId(blockIndex));
+    }
+
+    try
+    {
+        stager.CommitBlockList(blobName, blockIds);
+    }
+    catch (const std::exception& e)
+    {
+        Log_Error("Committing the %zu blocks of '%s' failed: %s", blockCount, blobName.c_str(), e.what());
+        return false;
+    }
+    catch (...)
+    {
+        Log_Error("Committing the %zu blocks of '%s' failed", blockCount, blobName.c_str());
+        return false;
+    }
+
+    return true;
+}
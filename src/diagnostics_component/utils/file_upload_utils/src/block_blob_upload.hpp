@@ -0,0 +1,155 @@
+/**
+ * @file block_blob_upload.hpp
+ * @brief Uploads files and streams as block blobs, staging their blocks concurrently
+ *
+ * @copyright Copyright (c) Microsoft Corp.
+ */
+#ifndef BLOCK_BLOB_UPLOAD_HPP
+#define BLOCK_BLOB_UPLOAD_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The block blob operations used by UploadFileInBlocks.
+ * Implemented over the Azure Storage SDK, and by the storage stand-in of the unit tests.
+ * Methods throw on failure, and may be called from several threads at once.
+ */
+class BlockBlobStager
+{
+public:
+    virtual ~BlockBlobStager() = default;
+
+    /**
+     * @brief Uploads an uncommitted block of @p blobName
+     * @param blobName the name of the blob
+     * @param blockId the id of the block; the ids of a blob all have the same length
+     * @param data the content of the block
+     * @param size the size of @p data in bytes
+     */
+    virtual void
+    StageBlock(const std::string& blobName, const std::string& blockId, const uint8_t* data, size_t size) = 0;
+
+    /**
+     * @brief Creates or replaces @p blobName with the staged blocks listed in @p blockIds, in order
+     * @param blobName the name of the blob
+     * @param blockIds the ids of the staged blocks
+     */
+    virtual void CommitBlockList(const std::string& blobName, const std::vector<std::string>& blockIds) = 0;
+
+    /**
+     * @brief Creates or replaces @p blobName with @p data in a single request, without staging blocks
+     * @param blobName the name of the blob
+     * @param data the content of the blob
+     * @param size the size of @p data in bytes; at most one block
+     */
+    virtual void UploadBlob(const std::string& blobName, const uint8_t* data, size_t size) = 0;
+};
+
+/**
+ * @brief Options for UploadFileInBlocks
+ */
+struct BlockUploadOptions
+{
+    size_t blockSize = 4 * 1024 * 1024; //!< The size of each block but the last
+    unsigned int maxConcurrency = 4; //!< The maximum number of blocks staged at once
+    unsigned int maxBlockAttempts = 3; //!< The number of times a block is staged before the upload fails
+    unsigned int retryDelayMilliseconds = 1000; //!< Minimum delay before a retry of a block, backed off with jitter
+    std::function<bool()> isCancelled; //!< Polled before each block and during retry delays; may be empty
+
+    /**
+     * @brief Returns true once the upload should stop. Called from several threads at once.
+     */
+    bool IsCancelled() const
+    {
+        return isCancelled && isCancelled();
+    }
+};
+
+/**
+ * @brief Gets the id of the block at @p blockIndex. All ids have the same length, as required by block blobs.
+ * @param blockIndex the index of the block in the file
+ * @returns the block id
+ */
+std::string GetBlockId(size_t blockIndex);
+
+/**
+ * @brief Uploads @p filePath to @p blobName in blocks of @p options.blockSize.
+ * Blocks are staged by up to @p options.maxConcurrency threads; a failed block is retried on its own,
+ * and the block list is committed once every block is staged. Once @p options.isCancelled returns true, no more
+ * blocks are staged and nothing is committed. A file that fits in one block is uploaded in a single request.
+ * @param stager the block blob operations
+ * @param filePath the path of the file to upload
+ * @param blobName the name of the blob
+ * @param options the upload options
+ * @returns true on success; false if the file cannot be read, a block could not be staged, the upload was
+ * cancelled, or the commit failed
+ */
+bool UploadFileInBlocks(
+    BlockBlobStager& stager,
+    const std::string& filePath,
+    const std::string& blobName,
+    const BlockUploadOptions& options = BlockUploadOptions{});
+
+/**
+ * @brief Uploads a stream of unknown length as a block blob. Written data is cut into blocks of
+ * @p options.blockSize, which are staged in the background by up to @p options.maxConcurrency threads,
+ * so at most maxConcurrency + 1 blocks are held in memory. A stream that fits in one block is uploaded in a single
+ * request on Commit().
+ */
+class BlockBlobStreamWriter
+{
+public:
+    BlockBlobStreamWriter(BlockBlobStager& stager, std::string blobName, const BlockUploadOptions& options);
+
+    BlockBlobStreamWriter(const BlockBlobStreamWriter&) = delete;
+    BlockBlobStreamWriter& operator=(const BlockBlobStreamWriter&) = delete;
+    BlockBlobStreamWriter(BlockBlobStreamWriter&&) = delete;
+    BlockBlobStreamWriter& operator=(BlockBlobStreamWriter&&) = delete;
+
+    /**
+     * @brief Waits for the blocks being staged. Nothing is committed unless Commit() was called.
+     */
+    ~BlockBlobStreamWriter();
+
+    /**
+     * @brief Appends @p size bytes to the blob
+     * @returns false once a block could not be staged, or the upload was cancelled
+     */
+    bool Write(const uint8_t* data, size_t size);
+
+    /**
+     * @brief Stages the last block, waits for all blocks, and commits the block list
+     * @returns true if every block was staged and the block list was committed, or the stream was uploaded
+     */
+    bool Commit();
+
+    /**
+     * @brief Gets the number of bytes written so far
+     */
+    size_t BytesWritten() const
+    {
+        return bytesWritten;
+    }
+
+private:
+    void StageCurrentBlock();
+    void WaitForOldestBlock();
+
+    BlockBlobStager& stager;
+    const std::string blobName;
+    const BlockUploadOptions options;
+
+    std::vector<uint8_t> currentBlock;
+    size_t blockCount = 0;
+    size_t bytesWritten = 0;
+    std::vector<std::thread> stagingThreads; // Oldest first.
+    std::atomic<bool> failed{ false };
+};
+
+#endif // BLOCK_BLOB_UPLOAD_HPP
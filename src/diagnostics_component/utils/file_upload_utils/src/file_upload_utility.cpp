@@ -12,8 +12,23 @@
 #include <azure_c_shared_utility/crt_abstractions.h>
 #include <azure_c_shared_utility/strings.h>
 #include <exception>
+#include <functional>
 #include <string.h>
 
+/**
+ * @brief Wraps @p isCancelled and @p cancelContext for the upload options
+ * @returns the cancel check, or an empty function if @p isCancelled is NULL
+ */
+static std::function<bool()> MakeCancelCheck(FileUploadUtility_IsCancelledFunc isCancelled, void* cancelContext)
+{
+    if (isCancelled == nullptr)
+    {
+        return {};
+    }
+
+    return [isCancelled, cancelContext]() -> bool { return isCancelled(cancelContext); };
+}
+
 EXTERN_C_BEGIN
 
 /**
@@ -22,10 +37,16 @@ EXTERN_C_BEGIN
  * @param maxConcurrency the max amount of concurrent threads for storage operations
  * @param fileNames vector of STRING_HANDLEs listing the names of the files to be uploaded
  * @param directoryPath path to the directory which holds the files listed in @p fileNames
- * @returns true on successful upload of all files; false on any failure
+ * @param isCancelled polled between files and blocks; may be NULL
+ * @param cancelContext the context passed to @p isCancelled
+ * @returns true on successful upload of all files; false on any failure, or once cancelled
  */
 bool FileUploadUtility_UploadFilesToContainer(
-    const BlobStorageInfo* blobInfo, VECTOR_HANDLE fileNames, const char* directoryPath)
+    const BlobStorageInfo* blobInfo,
+    VECTOR_HANDLE fileNames,
+    const char* directoryPath,
+    FileUploadUtility_IsCancelledFunc isCancelled,
+    void* cancelContext)
 {
     if (blobInfo == nullptr || fileNames == nullptr || directoryPath == nullptr)
     {
@@ -35,10 +56,58 @@ bool FileUploadUtility_UploadFilesToContainer(
     bool succeeded = false;
 
     ADUC::ExceptionUtils::CallVoidMethodAndHandleExceptions(
-        [blobInfo, &fileNames, directoryPath, &succeeded]() -> void {
+        [blobInfo, &fileNames, directoryPath, isCancelled, cancelContext, &succeeded]() -> void {
             AzureBlobStorageHelper storageHelper(*blobInfo);
             succeeded = storageHelper.UploadFilesToContainer(
-                fileNames, directoryPath, STRING_c_str(blobInfo->virtualDirectoryPath));
+                fileNames,
+                directoryPath,
+                STRING_c_str(blobInfo->virtualDirectoryPath),
+                MakeCancelCheck(isCancelled, cancelContext));
+        });
+
+    return succeeded;
+}
+
+/**
+ * @brief Packs the files listed in @p fileNames into one gzip-compressed tar archive, streamed to the blob
+ * @p archiveName while it is built, using the storage information in @p blobInfo
+ * @param blobInfo struct describing the connection information
+ * @param fileNames vector of STRING_HANDLEs listing the names of the files to be packed, newest first
+ * @param directoryPath path to the directory which holds the files listed in @p fileNames
+ * @param archiveName the name of the archive blob, relative to the virtual directory of @p blobInfo
+ * @param maxCompressedSize the maximum size of the archive; the newest files that fit are packed
+ * @param isCancelled polled between files and blocks; may be NULL
+ * @param cancelContext the context passed to @p isCancelled
+ * @returns true if the archive was uploaded; false on any failure, or once cancelled
+ */
+bool FileUploadUtility_UploadFilesAsCompressedArchive(
+    const BlobStorageInfo* blobInfo,
+    VECTOR_HANDLE fileNames,
+    const char* directoryPath,
+    const char* archiveName,
+    long long maxCompressedSize,
+    FileUploadUtility_IsCancelledFunc isCancelled,
+    void* cancelContext)
+{
+    if (blobInfo == nullptr || fileNames == nullptr || directoryPath == nullptr || archiveName == nullptr
+        || maxCompressedSize <= 0)
+    {
+        return false;
+    }
+
+    bool succeeded = false;
+
+    ADUC::ExceptionUtils::CallVoidMethodAndHandleExceptions(
+        [blobInfo, &fileNames, directoryPath, archiveName, maxCompressedSize, isCancelled, cancelContext, &succeeded]()
+            -> void {
+            AzureBlobStorageHelper storageHelper(*blobInfo);
+            succeeded = storageHelper.UploadFilesAsCompressedArchive(
+                fileNames,
+                directoryPath,
+                STRING_c_str(blobInfo->virtualDirectoryPath),
+                archiveName,
+                static_cast<unsigned long long>(maxCompressedSize),
+                MakeCancelCheck(isCancelled, cancelContext));
         });
 
     return succeeded;
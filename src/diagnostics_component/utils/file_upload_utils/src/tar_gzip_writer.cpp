@@ -0,0 +1,206 @@
+/**
+ * @file tar_gzip_writer.cpp
+ * @brief Implements writing files as a gzip-compressed tar stream
+ *
+ * @copyright Copyright (c) Microsoft Corp.
+ */
+#include "tar_gzip_writer.hpp"
+
+#include <aduc/logging.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include <utility>
+
+// The tar format is a sequence of 512-byte blocks.
+#define TAR_BLOCK_SIZE 512
+
+// Entry names are stored in the 100-byte name field of the ustar header; the prefix field is not used.
+#define TAR_MAX_NAME_LENGTH 100
+
+// The largest size that fits the 11 octal digits of the size field.
+#define TAR_MAX_FILE_SIZE 077777777777ULL
+
+#define TAR_GZIP_OUTPUT_BUFFER_SIZE (16 * 1024)
+#define TAR_GZIP_READ_BUFFER_SIZE (16 * 1024)
+
+// windowBits + 16 selects the gzip wrapper.
+#define TAR_GZIP_WINDOW_BITS (15 + 16)
+#define TAR_GZIP_MEMORY_LEVEL 8
+
+/**
+ * @brief Writes @p value as a zero-padded octal number of @p width - 1 digits and a terminator
+ */
+static void WriteOctal(char* field, size_t width, unsigned long long value)
+{
+    (void)snprintf(field, width, "%0*llo", static_cast<int>(width - 1), value);
+}
+
+/**
+ * @brief Fills a ustar header for a regular file
+ * @returns false if the name or size does not fit the header
+ */
+static bool FillTarHeader(uint8_t* header, const std::string& entryName, unsigned long long size, time_t mtime)
+{
+    if (entryName.empty() || entryName.length() > TAR_MAX_NAME_LENGTH || size > TAR_MAX_FILE_SIZE)
+    {
+        return false;
+    }
+
+    memset(header, 0, TAR_BLOCK_SIZE);
+
+    char* fields = reinterpret_cast<char*>(header);
+    memcpy(fields, entryName.data(), entryName.length()); // name, not terminated at 100 characters
+    WriteOctal(fields + 100, 8, 0644); // mode
+    WriteOctal(fields + 108, 8, 0); // uid
+    WriteOctal(fields + 116, 8, 0); // gid
+    WriteOctal(fields + 124, 12, size); // size
+    WriteOctal(fields + 136, 12, static_cast<unsigned long long>(mtime < 0 ? 0 : mtime)); // mtime
+    fields[156] = '0'; // typeflag: regular file
+    memcpy(fields + 257, "ustar", 6); // magic, including the terminator
+    memcpy(fields + 263, "00", 2); // version
+
+    // The checksum is computed with the checksum field set to spaces.
+    memset(fields + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i)
+    {
+        checksum += header[i];
+    }
+    WriteOctal(fields + 148, 7, checksum);
+    fields[155] = ' ';
+
+    return true;
+}
+
+TarGzipWriter::TarGzipWriter(Sink sink) : sink(std::move(sink)), output(TAR_GZIP_OUTPUT_BUFFER_SIZE)
+{
+    const int result = deflateInit2(
+        &stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, TAR_GZIP_WINDOW_BITS, TAR_GZIP_MEMORY_LEVEL, Z_DEFAULT_STRATEGY);
+    if (result != Z_OK)
+    {
+        Log_Error("deflateInit2 failed: %d", result);
+        failed = true;
+        return;
+    }
+
+    initialized = true;
+}
+
+TarGzipWriter::~TarGzipWriter()
+{
+    if (initialized)
+    {
+        (void)deflateEnd(&stream);
+    }
+}
+
+bool TarGzipWriter::Write(const uint8_t* data, size_t size, int flush)
+{
+    if (failed)
+    {
+        return false;
+    }
+
+    stream.next_in = const_cast<Bytef*>(data);
+    stream.avail_in = static_cast<uInt>(size);
+
+    int result = Z_OK;
+    do
+    {
+        stream.next_out = output.data();
+        stream.avail_out = static_cast<uInt>(output.size());
+
+        result = deflate(&stream, flush);
+        if (result == Z_STREAM_ERROR)
+        {
+            Log_Error("deflate failed");
+            failed = true;
+            return false;
+        }
+
+        const size_t produced = output.size() - stream.avail_out;
+        if (produced > 0)
+        {
+            if (!sink(output.data(), produced))
+            {
+                failed = true;
+                return false;
+            }
+            compressedBytes += produced;
+        }
+    } while (stream.avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+
+    uncompressedBytes += size;
+    return true;
+}
+
+bool TarGzipWriter::AddFile(const std::string& filePath, const std::string& entryName)
+{
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file)
+    {
+        Log_Warn("Cannot open '%s'", filePath.c_str());
+        return false;
+    }
+
+    struct stat st = {};
+    if (stat(filePath.c_str(), &st) != 0)
+    {
+        Log_Warn("Cannot stat '%s'", filePath.c_str());
+        return false;
+    }
+
+    const auto size = static_cast<unsigned long long>(st.st_size);
+
+    uint8_t header[TAR_BLOCK_SIZE];
+    if (!FillTarHeader(header, entryName, size, st.st_mtime))
+    {
+        Log_Warn("'%s' cannot be stored in a tar archive", entryName.c_str());
+        return false;
+    }
+
+    if (!Write(header, sizeof(header), Z_NO_FLUSH))
+    {
+        return false;
+    }
+
+    // From here on, the entry must be completed to keep the archive well formed.
+    uint8_t buffer[TAR_GZIP_READ_BUFFER_SIZE];
+    unsigned long long remaining = size;
+    while (remaining > 0)
+    {
+        const size_t chunk = remaining < sizeof(buffer) ? static_cast<size_t>(remaining) : sizeof(buffer);
+
+        file.read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(chunk));
+        const auto bytesRead = static_cast<size_t>(file.gcount());
+        if (bytesRead < chunk)
+        {
+            // The file shrank since stat.
+            memset(buffer + bytesRead, 0, chunk - bytesRead);
+            file.clear();
+        }
+
+        if (!Write(buffer, chunk, Z_NO_FLUSH))
+        {
+            return false;
+        }
+
+        remaining -= chunk;
+    }
+
+    // Flush at each entry, so CompressedBytes() accounts for every packed file.
+    const size_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    memset(buffer, 0, padding);
+
+    return Write(buffer, padding, Z_SYNC_FLUSH);
+}
+
+bool TarGzipWriter::Finish()
+{
+    // Two zero blocks mark the end of the archive.
+    uint8_t endOfArchive[2 * TAR_BLOCK_SIZE] = {};
+
+    return Write(endOfArchive, sizeof(endOfArchive), Z_FINISH);
+}
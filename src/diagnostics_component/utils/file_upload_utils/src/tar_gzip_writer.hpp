@@ -0,0 +1,91 @@
+/**
+ * @file tar_gzip_writer.hpp
+ * @brief Writes files as a gzip-compressed tar stream, without staging the archive on disk
+ *
+ * @copyright Copyright (c) Microsoft Corp.
+ */
+#ifndef TAR_GZIP_WRITER_HPP
+#define TAR_GZIP_WRITER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+/**
+ * @brief Packs files into a ustar archive and gzips it on the fly. The compressed bytes are passed to a sink,
+ * e.g. a BlockBlobStreamWriter, as they are produced.
+ */
+class TarGzipWriter
+{
+public:
+    /**
+     * @brief Receives compressed bytes. Returns false to abort the archive.
+     */
+    using Sink = std::function<bool(const uint8_t* data, size_t size)>;
+
+    explicit TarGzipWriter(Sink sink);
+
+    TarGzipWriter(const TarGzipWriter&) = delete;
+    TarGzipWriter& operator=(const TarGzipWriter&) = delete;
+    TarGzipWriter(TarGzipWriter&&) = delete;
+    TarGzipWriter& operator=(TarGzipWriter&&) = delete;
+
+    ~TarGzipWriter();
+
+    /**
+     * @brief Appends the file at @p filePath to the archive as @p entryName
+     * @details A file that grows while it is read is cut at the size it had when opened;
+     * a file that shrinks is padded with zeros.
+     * @param filePath the path of the file
+     * @param entryName the name of the file in the archive; at most 100 characters
+     * @returns true on success; false if the file cannot be read, or the archive failed
+     */
+    bool AddFile(const std::string& filePath, const std::string& entryName);
+
+    /**
+     * @brief Writes the end-of-archive blocks and the gzip trailer
+     * @returns true on success
+     */
+    bool Finish();
+
+    /**
+     * @brief Gets whether the archive is broken, e.g. because the sink failed. AddFile can fail without
+     * breaking the archive, when the file cannot be opened or stored; the archive can then be continued.
+     */
+    bool Failed() const
+    {
+        return failed;
+    }
+
+    /**
+     * @brief Gets the number of uncompressed archive bytes written so far
+     */
+    uint64_t UncompressedBytes() const
+    {
+        return uncompressedBytes;
+    }
+
+    /**
+     * @brief Gets the number of compressed bytes passed to the sink so far. Complete after each AddFile.
+     */
+    uint64_t CompressedBytes() const
+    {
+        return compressedBytes;
+    }
+
+private:
+    bool Write(const uint8_t* data, size_t size, int flush);
+
+    Sink sink;
+    z_stream stream{};
+    bool initialized = false;
+    bool failed = false;
+    uint64_t uncompressedBytes = 0;
+    uint64_t compressedBytes = 0;
+    std::vector<uint8_t> output;
+};
+
+#endif // TAR_GZIP_WRITER_HPP
@@ -0,0 +1,324 @@
+/**
+ * @file archive_upload_ut.cpp
+ * @brief Unit Tests for streaming files as a compressed tar archive
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "archive_upload.hpp"
+#include "in_memory_blob_container.hpp"
+#include "tar_gzip_writer.hpp"
+
+#include <aduc/auto_dir.hpp>
+#include <catch2/catch.hpp>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <zlib.h>
+
+#define ARCHIVE_UPLOAD_UT_DIR "/tmp/adu_archive_upload_ut"
+
+static void AddFile(const aduc::AutoDir& folder, const std::string& fileName, const std::string& content)
+{
+    std::ofstream file{ folder.GetDir() + "/" + fileName, std::ios::binary };
+    file << content;
+}
+
+static std::string Gunzip(const std::string& compressed)
+{
+    z_stream stream{};
+    REQUIRE(inflateInit2(&stream, 15 + 16) == Z_OK);
+
+    std::string result;
+    char buffer[4096];
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+    stream.avail_in = static_cast<uInt>(compressed.size());
+
+    int ret = Z_OK;
+    do
+    {
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = sizeof(buffer);
+        ret = inflate(&stream, Z_NO_FLUSH);
+        REQUIRE((ret == Z_OK || ret == Z_STREAM_END));
+        result.append(buffer, sizeof(buffer) - stream.avail_out);
+    } while (ret != Z_STREAM_END);
+
+    inflateEnd(&stream);
+    return result;
+}
+
+// Parses a ustar archive into (name, content) pairs, checking the header checksums.
+static std::vector<std::pair<std::string, std::string>> Untar(const std::string& tar)
+{
+    std::vector<std::pair<std::string, std::string>> entries;
+
+    size_t offset = 0;
+    while (true)
+    {
+        REQUIRE(offset + 512 <= tar.size());
+        const char* header = tar.data() + offset;
+        if (header[0] == '\0')
+        {
+            break;
+        }
+
+        unsigned int checksum = 0;
+        for (size_t i = 0; i < 512; ++i)
+        {
+            checksum += (i >= 148 && i < 156) ? ' ' : static_cast<unsigned char>(header[i]);
+        }
+        CHECK(strtoul(std::string(header + 148, 7).c_str(), nullptr, 8) == checksum);
+        CHECK(std::string(header + 257, 5) == "ustar");
+
+        const std::string name(header, strnlen(header, 100));
+        const size_t size = strtoull(std::string(header + 124, 11).c_str(), nullptr, 8);
+        offset += 512;
+
+        REQUIRE(offset + size <= tar.size());
+        entries.emplace_back(name, tar.substr(offset, size));
+        offset += (size + 511) / 512 * 512;
+    }
+
+    return entries;
+}
+
+// Log-like text, which compresses well.
+static std::string MakeLogContent(size_t lines, unsigned int seed)
+{
+    std::string content;
+    for (size_t i = 0; i < lines; ++i)
+    {
+        content += "2024-01-01T00:00:00.0000Z 1234[1234] [I] Download progress " + std::to_string(i * seed)
+            + " [DownloadProgress:42]\n";
+    }
+    return content;
+}
+
+// Random bytes, which do not compress.
+static std::string MakeRandomContent(size_t size)
+{
+    std::mt19937 generator{ 42 };
+    std::string content(size, '\0');
+    for (auto& c : content)
+    {
+        c = static_cast<char>(generator() & 0xff);
+    }
+    return content;
+}
+
+TEST_CASE("TarGzipWriter writes a gzip-compressed ustar archive")
+{
+    aduc::AutoDir folder{ ARCHIVE_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    AddFile(folder, "a.log", MakeLogContent(100, 1));
+    AddFile(folder, "b.log", "");
+    AddFile(folder, "c.log", std::string(512, 'x'));
+
+    std::string compressed;
+    TarGzipWriter archive([&compressed](const uint8_t* data, size_t size) -> bool {
+        compressed.append(reinterpret_cast<const char*>(data), size);
+        return true;
+    });
+
+    CHECK(archive.AddFile(folder.GetDir() + "/a.log", "a.log"));
+    CHECK(archive.AddFile(folder.GetDir() + "/b.log", "b.log"));
+    CHECK(archive.AddFile(folder.GetDir() + "/c.log", "c.log"));
+    CHECK_FALSE(archive.AddFile(folder.GetDir() + "/missing.log", "missing.log"));
+    CHECK_FALSE(archive.Failed());
+    REQUIRE(archive.Finish());
+
+    CHECK(archive.CompressedBytes() == compressed.size());
+    CHECK(archive.CompressedBytes() < archive.UncompressedBytes());
+
+    const auto entries = Untar(Gunzip(compressed));
+    REQUIRE(entries.size() == 3);
+    CHECK(entries[0].first == "a.log");
+    CHECK(entries[0].second == MakeLogContent(100, 1));
+    CHECK(entries[1].first == "b.log");
+    CHECK(entries[1].second.empty());
+    CHECK(entries[2].first == "c.log");
+    CHECK(entries[2].second == std::string(512, 'x'));
+}
+
+TEST_CASE("TarGzipWriter rejects names that do not fit the header")
+{
+    aduc::AutoDir folder{ ARCHIVE_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    AddFile(folder, "a.log", "content");
+
+    TarGzipWriter archive([](const uint8_t*, size_t) -> bool { return true; });
+
+    CHECK_FALSE(archive.AddFile(folder.GetDir() + "/a.log", std::string(101, 'n')));
+    CHECK_FALSE(archive.Failed());
+}
+
+TEST_CASE("TarGzipWriter fails once the sink fails")
+{
+    aduc::AutoDir folder{ ARCHIVE_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    AddFile(folder, "a.log", MakeRandomContent(64 * 1024));
+
+    TarGzipWriter archive([](const uint8_t*, size_t) -> bool { return false; });
+
+    CHECK_FALSE(archive.AddFile(folder.GetDir() + "/a.log", "a.log"));
+    CHECK(archive.Failed());
+    CHECK_FALSE(archive.Finish());
+}
+
+TEST_CASE("BlockBlobStreamWriter cuts the stream into blocks")
+{
+    InMemoryBlobContainer container;
+    BlockUploadOptions options;
+    options.blockSize = 1000;
+    options.maxConcurrency = 2;
+    options.retryDelayMilliseconds = 1;
+
+    const std::string content = MakeLogContent(200, 3);
+    container.failuresToInject[GetBlockId(1)] = 1;
+
+    {
+        BlockBlobStreamWriter writer(container, "stream", options);
+        for (size_t offset = 0; offset < content.size(); offset += 333)
+        {
+            const size_t size = std::min<size_t>(333, content.size() - offset);
+            REQUIRE(writer.Write(reinterpret_cast<const uint8_t*>(content.data()) + offset, size));
+        }
+        CHECK(writer.BytesWritten() == content.size());
+        CHECK(writer.Commit());
+    }
+
+    CHECK(container.committed["stream"] == content);
+    CHECK(container.stageCalls.size() == (content.size() + 999) / 1000);
+    CHECK(container.stageCalls[GetBlockId(1)] == 2);
+    CHECK(container.peakStagesInFlight <= 2);
+}
+
+TEST_CASE("BlockBlobStreamWriter uploads a stream that fits in one block in a single request")
+{
+    InMemoryBlobContainer container;
+    BlockUploadOptions options;
+    options.blockSize = 1000;
+
+    const std::string content = MakeLogContent(5, 1);
+    REQUIRE(content.size() < options.blockSize);
+
+    {
+        BlockBlobStreamWriter writer(container, "stream", options);
+        REQUIRE(writer.Write(reinterpret_cast<const uint8_t*>(content.data()), content.size()));
+        CHECK(writer.Commit());
+    }
+
+    CHECK(container.committed["stream"] == content);
+    CHECK(container.uploadCalls["stream"] == 1);
+    CHECK(container.stageCalls.empty());
+}
+
+TEST_CASE("BlockBlobStreamWriter does not commit without Commit")
+{
+    InMemoryBlobContainer container;
+    BlockUploadOptions options;
+    options.blockSize = 10;
+
+    {
+        BlockBlobStreamWriter writer(container, "stream", options);
+        REQUIRE(writer.Write(reinterpret_cast<const uint8_t*>("0123456789abcdef"), 16));
+    }
+
+    CHECK(container.committed.empty());
+}
+
+TEST_CASE("UploadFilesAsTarGzip packs the files in order")
+{
+    aduc::AutoDir folder{ ARCHIVE_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    AddFile(folder, "du-agent.3.log", MakeLogContent(300, 3));
+    AddFile(folder, "du-agent.2.log", MakeLogContent(300, 2));
+    AddFile(folder, "du-agent.1.log", MakeLogContent(300, 1));
+
+    InMemoryBlobContainer container;
+    BlockUploadOptions options = GetArchiveUploadOptions();
+    options.blockSize = 4096;
+
+    CHECK(UploadFilesAsTarGzip(
+        container,
+        folder.GetDir(),
+        { "du-agent.3.log", "du-agent.2.log", "du-agent.1.log" },
+        "device/operation/adu/adu.tar.gz",
+        1024 * 1024,
+        options));
+
+    const auto entries = Untar(Gunzip(container.committed["device/operation/adu/adu.tar.gz"]));
+    REQUIRE(entries.size() == 3);
+    CHECK(entries[0].first == "du-agent.3.log");
+    CHECK(entries[0].second == MakeLogContent(300, 3));
+    CHECK(entries[2].first == "du-agent.1.log");
+    CHECK(entries[2].second == MakeLogContent(300, 1));
+}
+
+TEST_CASE("UploadFilesAsTarGzip applies the budget to compressed bytes")
+{
+    aduc::AutoDir folder{ ARCHIVE_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    std::vector<std::string> fileNames;
+    for (int i = 0; i < 10; ++i)
+    {
+        const std::string fileName = "du-agent." + std::to_string(i) + ".log";
+        AddFile(folder, fileName, MakeLogContent(500, static_cast<unsigned int>(i + 1)));
+        fileNames.push_back(fileName);
+    }
+
+    const size_t rawFileSize = MakeLogContent(500, 1).size();
+    const unsigned long long budget = rawFileSize * 2;
+
+    InMemoryBlobContainer container;
+    CHECK(UploadFilesAsTarGzip(container, folder.GetDir(), fileNames, "adu.tar.gz", budget));
+
+    const std::string& compressed = container.committed["adu.tar.gz"];
+    CHECK(compressed.size() <= budget);
+
+    // More raw bytes than the budget fit, because the budget applies after compression.
+    const auto entries = Untar(Gunzip(compressed));
+    CHECK(entries.size() > 2);
+    CHECK(entries[0].first == "du-agent.0.log");
+}
+
+TEST_CASE("UploadFilesAsTarGzip fails when no file fits")
+{
+    aduc::AutoDir folder{ ARCHIVE_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    AddFile(folder, "big.bin", MakeRandomContent(64 * 1024));
+
+    InMemoryBlobContainer container;
+    CHECK_FALSE(UploadFilesAsTarGzip(container, folder.GetDir(), { "big.bin" }, "adu.tar.gz", 16 * 1024));
+    CHECK(container.committed.empty());
+}
+
+TEST_CASE("UploadFilesAsTarGzip enforces the budget when a file compresses worse than estimated")
+{
+    aduc::AutoDir folder{ ARCHIVE_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    AddFile(folder, "du-agent.1.log", MakeLogContent(500, 1));
+    AddFile(folder, "du-agent.2.bin", MakeRandomContent(128 * 1024));
+    AddFile(folder, "du-agent.3.log", MakeLogContent(10, 3));
+
+    // The ratio of the log makes the random file look like it fits.
+    const unsigned long long budget = 64 * 1024;
+
+    InMemoryBlobContainer container;
+    BlockUploadOptions options = GetArchiveUploadOptions();
+    options.blockSize = 4096;
+
+    CHECK(UploadFilesAsTarGzip(
+        container, folder.GetDir(), { "du-agent.1.log", "du-agent.2.bin", "du-agent.3.log" }, "adu.tar.gz", budget,
+        options));
+
+    const std::string& compressed = container.committed["adu.tar.gz"];
+    CHECK(compressed.size() <= budget);
+
+    // Packing stops at the file that went past the budget.
+    const auto entries = Untar(Gunzip(compressed));
+    REQUIRE(entries.size() == 1);
+    CHECK(entries[0].first == "du-agent.1.log");
+    CHECK(entries[0].second == MakeLogContent(500, 1));
+}
@@ -0,0 +1,214 @@
+/**
+ * @file block_blob_upload_ut.cpp
+ * @brief Unit Tests for uploading files as block blobs
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "block_blob_upload.hpp"
+#include "in_memory_blob_container.hpp"
+
+#include <aduc/auto_dir.hpp>
+#include <catch2/catch.hpp>
+#include <fstream>
+#include <mutex>
+
+#define BLOCK_BLOB_UPLOAD_UT_DIR "/tmp/adu_block_blob_upload_ut"
+#define BLOCK_BLOB_UPLOAD_UT_FILE BLOCK_BLOB_UPLOAD_UT_DIR "/du-agent.log"
+
+static std::string MakeContent(size_t size)
+{
+    std::string content;
+    content.reserve(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        content += static_cast<char>('a' + (i * 7) % 26);
+    }
+    return content;
+}
+
+// Writes BLOCK_BLOB_UPLOAD_UT_FILE.
+static void WriteFile(const std::string& content)
+{
+    std::ofstream file{ BLOCK_BLOB_UPLOAD_UT_FILE, std::ios::binary };
+    file << content;
+}
+
+static BlockUploadOptions MakeOptions(size_t blockSize, unsigned int maxConcurrency)
+{
+    BlockUploadOptions options;
+    options.blockSize = blockSize;
+    options.maxConcurrency = maxConcurrency;
+    options.retryDelayMilliseconds = 1;
+    return options;
+}
+
+TEST_CASE("GetBlockId returns ids of the same length")
+{
+    CHECK(GetBlockId(0) == "block-0000000000");
+    CHECK(GetBlockId(0).length() == GetBlockId(123456).length());
+}
+
+TEST_CASE("UploadFileInBlocks commits the blocks in file order")
+{
+    InMemoryBlobContainer container;
+    const std::string content = MakeContent(10 * 1024 + 17);
+    aduc::AutoDir folder{ BLOCK_BLOB_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    WriteFile(content);
+
+    CHECK(UploadFileInBlocks(container, BLOCK_BLOB_UPLOAD_UT_FILE, "logs/du-agent.log", MakeOptions(1024, 4)));
+
+    CHECK(container.committed["logs/du-agent.log"] == content);
+    CHECK(container.stageCalls.size() == 11);
+    CHECK(container.peakStagesInFlight <= 4);
+}
+
+TEST_CASE("UploadFileInBlocks stages blocks concurrently")
+{
+    InMemoryBlobContainer container;
+    aduc::AutoDir folder{ BLOCK_BLOB_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    WriteFile(MakeContent(64 * 1024));
+
+    CHECK(UploadFileInBlocks(container, BLOCK_BLOB_UPLOAD_UT_FILE, "blob", MakeOptions(1024, 4)));
+
+    CHECK(container.peakStagesInFlight > 1);
+    CHECK(container.peakStagesInFlight <= 4);
+}
+
+TEST_CASE("UploadFileInBlocks uploads a file that fits in one block in a single request")
+{
+    InMemoryBlobContainer container;
+    aduc::AutoDir folder{ BLOCK_BLOB_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+
+    SECTION("Smaller than a block")
+    {
+        const std::string content = MakeContent(1000);
+        WriteFile(content);
+
+        CHECK(UploadFileInBlocks(container, BLOCK_BLOB_UPLOAD_UT_FILE, "blob", MakeOptions(1024, 4)));
+        CHECK(container.committed["blob"] == content);
+    }
+
+    SECTION("Exactly one block")
+    {
+        const std::string content = MakeContent(1024);
+        WriteFile(content);
+
+        CHECK(UploadFileInBlocks(container, BLOCK_BLOB_UPLOAD_UT_FILE, "blob", MakeOptions(1024, 4)));
+        CHECK(container.committed["blob"] == content);
+    }
+
+    SECTION("Empty")
+    {
+        WriteFile("");
+
+        CHECK(UploadFileInBlocks(container, BLOCK_BLOB_UPLOAD_UT_FILE, "blob", MakeOptions(1024, 4)));
+        REQUIRE(container.committed.count("blob") == 1);
+        CHECK(container.committed["blob"].empty());
+    }
+
+    CHECK(container.uploadCalls["blob"] == 1);
+    CHECK(container.stageCalls.empty());
+}
+
+TEST_CASE("UploadFileInBlocks retries the single request of a file that fits in one block")
+{
+    InMemoryBlobContainer container;
+    aduc::AutoDir folder{ BLOCK_BLOB_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    const std::string content = MakeContent(100);
+    WriteFile(content);
+
+    BlockUploadOptions options = MakeOptions(1024, 4);
+    options.maxBlockAttempts = 3;
+
+    SECTION("Succeeds after failures")
+    {
+        container.failuresToInject["blob"] = 2;
+
+        CHECK(UploadFileInBlocks(container, BLOCK_BLOB_UPLOAD_UT_FILE, "blob", options));
+        CHECK(container.committed["blob"] == content);
+        CHECK(container.uploadCalls["blob"] == 3);
+    }
+
+    SECTION("Fails once out of attempts")
+    {
+        container.failuresToInject["blob"] = 3;
+
+        CHECK_FALSE(UploadFileInBlocks(container, BLOCK_BLOB_UPLOAD_UT_FILE, "blob", options));
+        CHECK(container.committed.count("blob") == 0);
+        CHECK(container.uploadCalls["blob"] == 3);
+    }
+}
+
+TEST_CASE("UploadFileInBlocks retries only the failed blocks")
+{
+    InMemoryBlobContainer container;
+    const std::string content = MakeContent(8 * 1024);
+    aduc::AutoDir folder{ BLOCK_BLOB_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    WriteFile(content);
+
+    container.failuresToInject[GetBlockId(3)] = 2;
+
+    CHECK(UploadFileInBlocks(container, BLOCK_BLOB_UPLOAD_UT_FILE, "blob", MakeOptions(1024, 2)));
+
+    CHECK(container.committed["blob"] == content);
+    CHECK(container.stageCalls[GetBlockId(3)] == 3);
+    CHECK(container.stageCalls[GetBlockId(2)] == 1);
+    CHECK(container.stageCalls[GetBlockId(4)] == 1);
+}
+
+TEST_CASE("UploadFileInBlocks does not commit when a block keeps failing")
+{
+    InMemoryBlobContainer container;
+    aduc::AutoDir folder{ BLOCK_BLOB_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    WriteFile(MakeContent(8 * 1024));
+
+    BlockUploadOptions options = MakeOptions(1024, 2);
+    options.maxBlockAttempts = 3;
+    container.failuresToInject[GetBlockId(5)] = 3;
+
+    CHECK_FALSE(UploadFileInBlocks(container, BLOCK_BLOB_UPLOAD_UT_FILE, "blob", options));
+
+    CHECK(container.committed.count("blob") == 0);
+    CHECK(container.stageCalls[GetBlockId(5)] == 3);
+}
+
+TEST_CASE("UploadFileInBlocks stops staging and does not commit once cancelled")
+{
+    InMemoryBlobContainer container;
+    aduc::AutoDir folder{ BLOCK_BLOB_UPLOAD_UT_DIR };
+    REQUIRE(folder.CreateDir());
+    WriteFile(MakeContent(8 * 1024));
+
+    // Block 2 keeps failing; the retry delay would take minutes, and the cancel cuts it short.
+    BlockUploadOptions options = MakeOptions(1024, 1);
+    options.maxBlockAttempts = 100;
+    options.retryDelayMilliseconds = 60 * 1000;
+    container.failuresToInject[GetBlockId(2)] = 100;
+
+    options.isCancelled = [&container]() {
+        std::lock_guard<std::mutex> lock{ container.mutex };
+        return container.stageCalls.count(GetBlockId(2)) != 0;
+    };
+
+    CHECK_FALSE(UploadFileInBlocks(container, BLOCK_BLOB_UPLOAD_UT_FILE, "blob", options));
+
+    CHECK(container.committed.count("blob") == 0);
+    CHECK(container.stageCalls[GetBlockId(2)] == 1);
+    CHECK(container.stageCalls.count(GetBlockId(3)) == 0);
+}
+
+TEST_CASE("UploadFileInBlocks fails for a missing file")
+{
+    InMemoryBlobContainer container;
+
+    CHECK_FALSE(UploadFileInBlocks(container, "/tmp/adu_block_upload_ut_missing", "blob", MakeOptions(1024, 4)));
+
+    CHECK(container.committed.empty());
+}
@@ -0,0 +1,97 @@
+/**
+ * @file in_memory_blob_container.hpp
+ * @brief A blob storage stand-in for the file upload unit tests
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef IN_MEMORY_BLOB_CONTAINER_HPP
+#define IN_MEMORY_BLOB_CONTAINER_HPP
+
+#include "block_blob_upload.hpp"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+/**
+ * @brief A stand-in for a blob storage container. Keeps staged and committed blocks in memory,
+ * fails the first stages of chosen blocks, or uploads of chosen blobs, and records the peak number of concurrent
+ * stages.
+ */
+class InMemoryBlobContainer : public BlockBlobStager
+{
+public:
+    void StageBlock(const std::string& blobName, const std::string& blockId, const uint8_t* data, size_t size) override
+    {
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            ++stagesInFlight;
+            peakStagesInFlight = std::max(peakStagesInFlight, stagesInFlight);
+        }
+
+        // Give the other workers a chance to overlap.
+        usleep(2000);
+
+        std::lock_guard<std::mutex> lock{ mutex };
+        --stagesInFlight;
+        ++stageCalls[blockId];
+
+        auto failures = failuresToInject.find(blockId);
+        if (failures != failuresToInject.end() && failures->second > 0)
+        {
+            --failures->second;
+            throw std::runtime_error("injected stage failure");
+        }
+
+        staged[blobName][blockId] = std::string(reinterpret_cast<const char*>(data), size);
+    }
+
+    void CommitBlockList(const std::string& blobName, const std::vector<std::string>& blockIds) override
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+
+        std::string content;
+        for (const auto& blockId : blockIds)
+        {
+            auto block = staged[blobName].find(blockId);
+            if (block == staged[blobName].end())
+            {
+                throw std::runtime_error("block not staged");
+            }
+            content += block->second;
+        }
+
+        committed[blobName] = content;
+        staged.erase(blobName);
+    }
+
+    void UploadBlob(const std::string& blobName, const uint8_t* data, size_t size) override
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        ++uploadCalls[blobName];
+
+        auto failures = failuresToInject.find(blobName);
+        if (failures != failuresToInject.end() && failures->second > 0)
+        {
+            --failures->second;
+            throw std::runtime_error("injected upload failure");
+        }
+
+        committed[blobName] = std::string(reinterpret_cast<const char*>(data), size);
+    }
+
+    std::mutex mutex;
+    std::map<std::string, std::map<std::string, std::string>> staged;
+    std::map<std::string, std::string> committed;
+    std::map<std::string, unsigned int> failuresToInject; // By block id for stages, by blob name for uploads.
+    std::map<std::string, unsigned int> stageCalls;
+    std::map<std::string, unsigned int> uploadCalls;
+    unsigned int stagesInFlight = 0;
+    unsigned int peakStagesInFlight = 0;
+};
+
+#endif // IN_MEMORY_BLOB_CONTAINER_HPP
@@ -19,6 +19,7 @@
 #include <aduc/types/update_content.h> // ADUC_FileEntity
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
@@ -108,6 +109,7 @@ private:
 
     static std::unordered_map<std::string, void*> _libs;
     static std::unordered_map<std::string, ContentHandler*> _contentHandlers;
+    static std::mutex _contentHandlersMutex; // Steps targeting disjoint components may load handlers concurrently.
     static void* _contentDownloader;
     static ADUC_ExtensionContractInfo _contentDownloaderContractVersion;
     static void* _componentEnumerator;
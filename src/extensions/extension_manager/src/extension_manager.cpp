@@ -26,13 +26,19 @@
 #include <aduc/path_utils.h> // PathUtils_SanitizePathSegment
 #include <aduc/plugin_exception.hpp>
 #include <aduc/result.h>
+#include <aduc/retry_utils.h>
 #include <aduc/string_c_utils.h>
 #include <aduc/string_handle_wrapper.hpp>
 #include <aduc/string_utils.hpp>
+#include <aduc/trace_utils.hpp> // ADUC::TraceSpan
 #include <aduc/types/workflow.h> // ADUC_WorkflowHandle
 #include <aduc/workflow_utils.h>
 
+#include <algorithm> // std::min
+#include <chrono>
 #include <cstring>
+#include <system_error> // std::errc
+#include <thread>
 #include <unordered_map>
 
 // Note: this requires ${CMAKE_DL_LIBS}
@@ -48,6 +54,7 @@ using ADUC::StringUtils::cstr_wrapper;
 // Static members.
 std::unordered_map<std::string, void*> ExtensionManager::_libs;
 std::unordered_map<std::string, ContentHandler*> ExtensionManager::_contentHandlers;
+std::mutex ExtensionManager::_contentHandlersMutex;
 void* ExtensionManager::_contentDownloader;
 ADUC_ExtensionContractInfo ExtensionManager::_contentDownloaderContractVersion;
 void* ExtensionManager::_componentEnumerator;
@@ -207,6 +214,8 @@ ExtensionManager::LoadUpdateContentHandlerExtension(const std::string& updateTyp
 
     Log_Info("Loading handler for '%s'.", updateType.c_str());
 
+    std::lock_guard<std::mutex> lock{ _contentHandlersMutex };
+
     if (handler == nullptr)
     {
         Log_Error("Invalid argument(s).");
@@ -378,10 +387,14 @@ ADUC_Result ExtensionManager::SetUpdateContentHandlerExtension(const std::string
         goto done;
     }
 
-    // Remove existing one.
-    _contentHandlers.erase(updateType);
+    {
+        std::lock_guard<std::mutex> lock{ _contentHandlersMutex };
+
+        // Remove existing one.
+        _contentHandlers.erase(updateType);
 
-    _contentHandlers.emplace(updateType, handler);
+        _contentHandlers.emplace(updateType, handler);
+    }
 
     result = { ADUC_GeneralResult_Success };
 
@@ -391,6 +404,8 @@ done:
 
 void ExtensionManager::UnloadAllUpdateContentHandlers()
 {
+    std::lock_guard<std::mutex> lock{ _contentHandlersMutex };
+
     for (auto& contentHandler : _contentHandlers)
     {
         delete (contentHandler.second); // NOLINT(cppcoreguidelines-owning-memory)
@@ -829,6 +844,171 @@ DownloadProc ExtensionManager::DefaultDownloadProcResolver(void* lib)
     return reinterpret_cast<DownloadProc>(ADUCPAL_dlsym(lib, CONTENT_DOWNLOADER__Download__EXPORT_SYMBOL));
 }
 
+/**
+ * @brief The number of times the content downloader is called for a file before the download fails.
+ */
+static const unsigned int CONTENT_DOWNLOAD_MAX_ATTEMPTS = 5;
+
+/**
+ * @brief How often a download retry delay checks whether the workflow was canceled.
+ */
+static const unsigned int CONTENT_DOWNLOAD_CANCEL_POLL_INTERVAL_MS = 100;
+
+/**
+ * @brief Returns whether the curl content downloader failed with a transient, network-level error.
+ *
+ * @param extendedResultCode The extended result code returned by the content downloader.
+ * @return true if the download can be retried.
+ */
+static bool IsTransientCurlDownloadFailure(ADUC_Result_t extendedResultCode)
+{
+    // curl exit codes for: couldn't resolve host, failed to connect to host, partial file, operation timeout,
+    // SSL connect error, empty reply from server, failed sending and failure receiving network data.
+    static const int transientCurlExitCodes[] = { 6, 7, 18, 28, 35, 52, 55, 56 };
+
+    for (int exitCode : transientCurlExitCodes)
+    {
+        if (extendedResultCode == ADUC_ERROR_CURL_DOWNLOADER_EXTERNAL_FAILURE(exitCode))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Returns whether the Delivery Optimization content downloader failed with a transient network or timeout
+ * error.
+ *
+ * @param extendedResultCode The extended result code returned by the content downloader.
+ * @return true if the download can be retried.
+ */
+static bool IsTransientDeliveryOptimizationDownloadFailure(ADUC_Result_t extendedResultCode)
+{
+    // DO reports the download timeout as std::errc::timed_out, and other failures as HRESULT-like codes:
+    // DO_E_NO_SERVICE (the DO agent is not reachable yet), DO_E_DOWNLOAD_NO_PROGRESS, and the HTTP_E_STATUS_*
+    // codes for HTTP 408 request timeout, 502 bad gateway, 503 service unavailable and 504 gateway timeout.
+    static const int32_t transientDeliveryOptimizationCodes[] = {
+        static_cast<int32_t>(std::errc::timed_out),
+        static_cast<int32_t>(0x80D01001),
+        static_cast<int32_t>(0x80D02002),
+        static_cast<int32_t>(0x80190198),
+        static_cast<int32_t>(0x801901F6),
+        static_cast<int32_t>(0x801901F7),
+        static_cast<int32_t>(0x801901F8),
+    };
+
+    for (int32_t code : transientDeliveryOptimizationCodes)
+    {
+        if (extendedResultCode == MAKE_ADUC_DELIVERY_OPTIMIZATION_EXTENDEDRESULTCODE(code))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Returns whether a content download failed with a transient, network-level error, worth retrying.
+ *
+ * @param extendedResultCode The extended result code returned by the content downloader.
+ * @return true if the download can be retried.
+ */
+static bool IsTransientContentDownloadFailure(ADUC_Result_t extendedResultCode)
+{
+    return IsTransientCurlDownloadFailure(extendedResultCode)
+        || IsTransientDeliveryOptimizationDownloadFailure(extendedResultCode);
+}
+
+/**
+ * @brief Waits @p delayMs before a content download is retried, unless the workflow is canceled first.
+ *
+ * @param workflowHandle The workflow of the download.
+ * @param delayMs The delay, in milliseconds.
+ * @return true if the delay elapsed, false if the workflow was canceled.
+ */
+static bool WaitForContentDownloadRetry(WorkflowHandle workflowHandle, unsigned long delayMs)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs);
+
+    while (!workflow_is_cancel_requested(workflowHandle))
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+        {
+            return true;
+        }
+
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+            deadline - now, std::chrono::milliseconds(CONTENT_DOWNLOAD_CANCEL_POLL_INTERVAL_MS)));
+    }
+
+    return false;
+}
+
+/**
+ * @brief Calls the content downloader, and retries transient network failures with a jittered backoff.
+ * A workflow cancellation ends the backoff.
+ *
+ * @return ADUC_Result The result of the last attempt, or ADUC_Result_Failure_Cancelled.
+ */
+static ADUC_Result DownloadContentWithRetries(
+    DownloadProc downloadProc,
+    const ADUC_FileEntity* entity,
+    WorkflowHandle workflowHandle,
+    const char* workFolder,
+    unsigned int timeoutInSeconds,
+    ADUC_DownloadProgressCallback downloadProgressCallback)
+{
+    const char* workflowId = workflow_peek_id(workflowHandle);
+    ADUC_Result result = downloadProc(entity, workflowId, workFolder, timeoutInSeconds, downloadProgressCallback);
+
+    if (IsAducResultCodeSuccess(result.ResultCode) || !IsTransientContentDownloadFailure(result.ExtendedResultCode))
+    {
+        return result;
+    }
+
+    // Devices that started a deployment together would retry together; the policy jitters their retries apart.
+    ADUC_Retry_Policy retryPolicy;
+    if (!ADUC_Retry_Policy_Init(
+            &retryPolicy,
+            ADUC_RETRY_DEFAULT_INITIAL_DELAY_MS,
+            ADUC_RETRY_DEFAULT_MAX_BACKOFF_TIME_MS,
+            0 /* failureThreshold */,
+            0 /* openDurationMs */))
+    {
+        return result;
+    }
+
+    for (unsigned int attempt = 1;
+         attempt < CONTENT_DOWNLOAD_MAX_ATTEMPTS && IsAducResultCodeFailure(result.ResultCode)
+         && IsTransientContentDownloadFailure(result.ExtendedResultCode);
+         ++attempt)
+    {
+        const unsigned long delayMs = ADUC_Retry_Policy_OnFailure(&retryPolicy, 0, 0);
+        Log_Warn(
+            "Download failed with transient error 0x%X (attempt %u of %u). Retrying in %lu ms.",
+            result.ExtendedResultCode,
+            attempt,
+            CONTENT_DOWNLOAD_MAX_ATTEMPTS,
+            delayMs);
+
+        if (!WaitForContentDownloadRetry(workflowHandle, delayMs))
+        {
+            Log_Info("Download retry canceled.");
+            result = { /* .ResultCode = */ ADUC_Result_Failure_Cancelled, /* .ExtendedResultCode = */ 0 };
+            break;
+        }
+
+        result = downloadProc(entity, workflowId, workFolder, timeoutInSeconds, downloadProgressCallback);
+    }
+
+    ADUC_Retry_Policy_Deinit(&retryPolicy);
+    return result;
+}
+
 ADUC_Result ExtensionManager::Download(
     const ADUC_FileEntity* entity,
     WorkflowHandle workflowHandle,
@@ -843,6 +1023,13 @@ ADUC_Result ExtensionManager::Download(
     ADUC_Result result = { /* .ResultCode = */ ADUC_Result_Failure, /* .ExtendedResultCode = */ 0 };
     ADUC::StringUtils::STRING_HANDLE_wrapper targetUpdateFilePath{ nullptr };
 
+    // Spans go to the trace file in the root workflow sandbox, if tracing is enabled.
+    cstr_wrapper rootWorkFolder{ workflow_get_workfolder(workflow_get_root(workflowHandle)) };
+    const std::string traceFolder{ rootWorkFolder.get() != nullptr ? rootWorkFolder.get() : "" };
+    const std::string traceDetail{ (entity != nullptr && entity->TargetFilename != nullptr) ? entity->TargetFilename
+                                                                                           : "" };
+    ADUC::TraceSpan downloadSpan{ traceFolder, "download", "ExtensionManager::Download", traceDetail };
+
     if (!workflow_get_entity_workfolder_filepath(workflowHandle, entity, targetUpdateFilePath.address_of()))
     {
         Log_Error("Cannot construct child manifest file path.");
@@ -903,8 +1090,10 @@ ADUC_Result ExtensionManager::Download(
 
         // If target file exists, validate file hash.
         // If file is valid, then skip the download.
+        ADUC::TraceSpan hashSpan{ traceFolder, "download", "Hash", traceDetail };
         bool validHash = ADUC_HashUtils_IsValidFileHash(
             targetUpdateFilePath.c_str(), hashValue, algVersion, false /* suppressErrorLog */);
+        hashSpan.End();
 
         if (!validHash)
         {
@@ -928,6 +1117,7 @@ ADUC_Result ExtensionManager::Download(
     // download handler exists in the entity (metadata).
     if (!IsNullOrEmpty(entity->DownloadHandlerId))
     {
+        ADUC::TraceSpan downloadHandlerSpan{ traceFolder, "download", "DownloadHandler", traceDetail };
         result = ProcessDownloadHandlerExtensibility(workflowHandle, entity, targetUpdateFilePath.c_str());
         // continue on to fallback to full content download if necessary
     }
@@ -937,7 +1127,6 @@ ADUC_Result ExtensionManager::Download(
         || result.ResultCode == ADUC_Result_Download_Handler_RequiredFullDownload)
     {
         // Either download handler id did not exist, or download handler failed and doing fallback here.
-        const char* workflowId = workflow_peek_id(workflowHandle);
         cstr_wrapper workFolder{ workflow_get_workfolder(workflowHandle) };
 
         Log_Info("Downloading full target update payload to '%s'", targetUpdateFilePath.c_str());
@@ -948,7 +1137,11 @@ ADUC_Result ExtensionManager::Download(
         // but the content downloader contract version is in terms of seconds.
         unsigned int timeoutInSeconds = 60 * timeoutInMinutes;
 
-        result = downloadProc(entity, workflowId, workFolder.get(), timeoutInSeconds, downloadProgressCallback);
+        ADUC::TraceSpan contentDownloadSpan{ traceFolder, "download", "ContentDownload", traceDetail };
+        result = DownloadContentWithRetries(
+            downloadProc, entity, workflowHandle, workFolder.get(), timeoutInSeconds, downloadProgressCallback);
+        contentDownloadSpan.End();
+
         if (IsAducResultCodeFailure(result.ResultCode))
         {
             goto done;
@@ -957,11 +1150,15 @@ ADUC_Result ExtensionManager::Download(
 
     if (IsAducResultCodeSuccess(result.ResultCode))
     {
-        if (!ADUC_HashUtils_IsValidFileHash(
-                targetUpdateFilePath.c_str(),
-                ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0),
-                algVersion,
-                false))
+        ADUC::TraceSpan hashSpan{ traceFolder, "download", "Hash", traceDetail };
+        const bool validHash = ADUC_HashUtils_IsValidFileHash(
+            targetUpdateFilePath.c_str(),
+            ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0),
+            algVersion,
+            false);
+        hashSpan.End();
+
+        if (!validHash)
         {
             result.ResultCode = ADUC_Result_Failure;
             result.ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_INVALID_FILE_HASH;
@@ -21,6 +21,9 @@ enum class DownloadTestScenario
     Invalid,
     BasicDownloadSuccess,
     BasicDownloadFailure,
+    TransientDownloadFailureCanceled,
+    TransientCurlDownloadFailureRetried,
+    TransientDeliveryOptimizationDownloadFailureRetried,
 };
 
 class ExtensionManagerDownloadTestCase
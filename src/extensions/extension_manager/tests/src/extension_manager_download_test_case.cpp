@@ -25,6 +25,7 @@
 #include <stdexcept>
 #include <stdio.h>
 #include <string>
+#include <system_error> // std::errc
 
 struct json_value_deleter
 {
@@ -89,6 +90,49 @@ static ADUC_Result MockDownloadFailureProc(
     return result;
 }
 
+// The workflow that MockDownloadTransientFailureProc cancels, as the agent does when a cancel arrives mid-download.
+static ADUC_WorkflowHandle s_workflowToCancel = nullptr;
+
+static ADUC_Result MockDownloadTransientFailureProc(
+    const ADUC_FileEntity* entity,
+    const char* workflowId,
+    const char* workFolder,
+    unsigned int timeoutInSeconds,
+    ADUC_DownloadProgressCallback downloadProgressCallback)
+{
+    UNREFERENCED_PARAMETER(entity);
+    UNREFERENCED_PARAMETER(workflowId);
+    UNREFERENCED_PARAMETER(workFolder);
+    UNREFERENCED_PARAMETER(timeoutInSeconds);
+    UNREFERENCED_PARAMETER(downloadProgressCallback);
+
+    workflow_request_cancel(s_workflowToCancel);
+
+    // curl exit code 7: failed to connect to host.
+    ADUC_Result result{ 0, ADUC_ERROR_CURL_DOWNLOADER_EXTERNAL_FAILURE(7) };
+    return result;
+}
+
+// The failure that MockDownloadFailsOnceProc returns from its first call, and the number of calls made so far.
+static ADUC_Result_t s_firstAttemptFailureERC = 0;
+static unsigned int s_downloadAttempts = 0;
+
+static ADUC_Result MockDownloadFailsOnceProc(
+    const ADUC_FileEntity* entity,
+    const char* workflowId,
+    const char* workFolder,
+    unsigned int timeoutInSeconds,
+    ADUC_DownloadProgressCallback downloadProgressCallback)
+{
+    if (s_downloadAttempts++ == 0)
+    {
+        ADUC_Result result{ 0, s_firstAttemptFailureERC };
+        return result;
+    }
+
+    return MockDownloadSuccessProc(entity, workflowId, workFolder, timeoutInSeconds, downloadProgressCallback);
+}
+
 static DownloadProc mockDownloadSuccessProcResolver(void* lib)
 {
     UNREFERENCED_PARAMETER(lib);
@@ -101,6 +145,18 @@ static DownloadProc mockDownloadFailureProcResolver(void* lib)
     return MockDownloadFailureProc;
 }
 
+static DownloadProc mockDownloadTransientFailureProcResolver(void* lib)
+{
+    UNREFERENCED_PARAMETER(lib);
+    return MockDownloadTransientFailureProc;
+}
+
+static DownloadProc mockDownloadFailsOnceProcResolver(void* lib)
+{
+    UNREFERENCED_PARAMETER(lib);
+    return MockDownloadFailsOnceProc;
+}
+
 static void setupWorkflowHandle(const char* msgJson, ADUC_WorkflowHandle* outWorkflowHandle)
 {
     ADUC_Result result{ workflow_init(msgJson, false /* validateManifest */, outWorkflowHandle) };
@@ -133,6 +189,32 @@ void ExtensionManagerDownloadTestCase::RunScenario()
         expected_result.ExtendedResultCode = FailureERC;
         break;
 
+    case DownloadTestScenario::TransientDownloadFailureCanceled:
+        mockProcResolver = mockDownloadTransientFailureProcResolver;
+        s_workflowToCancel = workflowHandle;
+        expected_result.ResultCode = ADUC_Result_Failure_Cancelled;
+        expected_result.ExtendedResultCode = 0;
+        break;
+
+    case DownloadTestScenario::TransientCurlDownloadFailureRetried:
+        mockProcResolver = mockDownloadFailsOnceProcResolver;
+        // curl exit code 28: operation timeout.
+        s_firstAttemptFailureERC = ADUC_ERROR_CURL_DOWNLOADER_EXTERNAL_FAILURE(28);
+        s_downloadAttempts = 0;
+        expected_result.ResultCode = 1;
+        expected_result.ExtendedResultCode = 0;
+        break;
+
+    case DownloadTestScenario::TransientDeliveryOptimizationDownloadFailureRetried:
+        mockProcResolver = mockDownloadFailsOnceProcResolver;
+        // The DO downloader's download timeout.
+        s_firstAttemptFailureERC =
+            MAKE_ADUC_DELIVERY_OPTIMIZATION_EXTENDEDRESULTCODE(static_cast<int32_t>(std::errc::timed_out));
+        s_downloadAttempts = 0;
+        expected_result.ResultCode = 1;
+        expected_result.ExtendedResultCode = 0;
+        break;
+
     default:
         throw std::invalid_argument("invalid scenario");
     }
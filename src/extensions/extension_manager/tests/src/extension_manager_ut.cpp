@@ -37,3 +37,41 @@ TEST_CASE("ExtensionManager::Download failure should return failure ResultCode a
     CHECK(actual_result.ResultCode == expected_result.ResultCode);
     CHECK(actual_result.ExtendedResultCode == expected_result.ExtendedResultCode);
 }
+
+TEST_CASE("ExtensionManager::Download does not retry a transient failure once the workflow is canceled")
+{
+    ExtensionManagerDownloadTestCase testCase{ DownloadTestScenario::TransientDownloadFailureCanceled };
+    REQUIRE_NOTHROW(testCase.RunScenario());
+
+    ADUC_Result actual_result = testCase.GetActualResult();
+    ADUC_Result expected_result = testCase.GetExpectedResult();
+
+    CHECK(actual_result.ResultCode == expected_result.ResultCode);
+    CHECK(actual_result.ExtendedResultCode == expected_result.ExtendedResultCode);
+}
+
+TEST_CASE("ExtensionManager::Download retries a transient curl failure")
+{
+    ExtensionManagerDownloadTestCase testCase{ DownloadTestScenario::TransientCurlDownloadFailureRetried };
+    REQUIRE_NOTHROW(testCase.RunScenario());
+
+    ADUC_Result actual_result = testCase.GetActualResult();
+    ADUC_Result expected_result = testCase.GetExpectedResult();
+
+    CHECK(actual_result.ResultCode == expected_result.ResultCode);
+    CHECK(actual_result.ExtendedResultCode == expected_result.ExtendedResultCode);
+}
+
+TEST_CASE("ExtensionManager::Download retries a transient Delivery Optimization failure")
+{
+    ExtensionManagerDownloadTestCase testCase{
+        DownloadTestScenario::TransientDeliveryOptimizationDownloadFailureRetried
+    };
+    REQUIRE_NOTHROW(testCase.RunScenario());
+
+    ADUC_Result actual_result = testCase.GetActualResult();
+    ADUC_Result expected_result = testCase.GetExpectedResult();
+
+    CHECK(actual_result.ResultCode == expected_result.ResultCode);
+    CHECK(actual_result.ExtendedResultCode == expected_result.ExtendedResultCode);
+}
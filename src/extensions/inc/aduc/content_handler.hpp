@@ -40,6 +40,15 @@ public:
     {
     }
 
+    /**
+     * @brief Whether the handler may be called from several threads at once, e.g. for reference steps that install
+     * concurrently. Calls to a handler that does not override this are serialized.
+     */
+    virtual bool IsConcurrencySafe() const
+    {
+        return false;
+    }
+
     void SetContractInfo(const ADUC_ExtensionContractInfo& info)
     {
         contractInfo = info;
@@ -211,6 +211,9 @@ ADUC_Result AptHandlerImpl::Download(const ADUC_WorkflowData* workflowData)
     {
         std::string aptOutput;
         int aptExitCode = -1;
+        ADUC_ChildProcessUsage downloadUsage;
+        ADUC_ChildProcessUsage usage;
+        ADUC_AduShellBrokerReference aduShellBroker{ workflow_get_adushell_broker(handle) };
 
         // Perform apt-get update to fetch latest packages catalog.
         // We'll log warning if failed, but will try to download specified packages.
@@ -223,7 +226,13 @@ ADUC_Result AptHandlerImpl::Download(const ADUC_WorkflowData* workflowData)
                 adushconst::update_action_opt, adushconst::update_action_initialize
             };
 
-            aptExitCode = ADUC_LaunchChildProcess(config->aduShellFilePath, args, aptOutput);
+            usage = {}; // A launch that fails does not fill it.
+            aptExitCode = ADUC_LaunchChildProcess(
+                config->aduShellFilePath,
+                args,
+                aptOutput,
+                ADUC_ChildProcessOptions_FromConfig(config, &usage, aduShellBroker.broker));
+            ADUC_ChildProcessUsage_Add(downloadUsage, usage);
 
             if (!aptOutput.empty())
             {
@@ -261,7 +270,13 @@ ADUC_Result AptHandlerImpl::Download(const ADUC_WorkflowData* workflowData)
             args.emplace_back(adushconst::target_data_opt);
             args.emplace_back(data.str());
 
-            aptExitCode = ADUC_LaunchChildProcess(config->aduShellFilePath, args, aptOutput);
+            usage = {};
+            aptExitCode = ADUC_LaunchChildProcess(
+                config->aduShellFilePath,
+                args,
+                aptOutput,
+                ADUC_ChildProcessOptions_FromConfig(config, &usage, aduShellBroker.broker));
+            ADUC_ChildProcessUsage_Add(downloadUsage, usage);
 
             if (!aptOutput.empty())
             {
@@ -274,6 +289,8 @@ ADUC_Result AptHandlerImpl::Download(const ADUC_WorkflowData* workflowData)
             aptExitCode = -1;
         }
 
+        workflow_set_resource_usage(handle, "download", ADUC_ChildProcessUsage_ToJsonValue(downloadUsage));
+
         if (aptExitCode != 0)
         {
             result.ResultCode = ADUC_Result_Failure;
@@ -303,6 +320,7 @@ ADUC_Result AptHandlerImpl::Install(const ADUC_WorkflowData* workflowData)
 {
     std::string aptOutput;
     int aptExitCode = -1;
+    ADUC_ChildProcessUsage usage;
     ADUC_Result result = { .ResultCode = ADUC_Result_Download_Success, .ExtendedResultCode = 0 };
     ADUC_FileEntity fileEntity;
     memset(&fileEntity, 0, sizeof(fileEntity));
@@ -343,6 +361,7 @@ ADUC_Result AptHandlerImpl::Install(const ADUC_WorkflowData* workflowData)
 
     try
     {
+        ADUC_AduShellBrokerReference aduShellBroker{ workflow_get_adushell_broker(handle) };
         std::vector<std::string> args = { adushconst::config_folder_opt, config->configFolder,
                                           adushconst::update_type_opt,   adushconst::update_type_microsoft_apt,
                                           adushconst::update_action_opt, adushconst::update_action_install };
@@ -361,7 +380,11 @@ ADUC_Result AptHandlerImpl::Install(const ADUC_WorkflowData* workflowData)
         args.emplace_back(adushconst::target_data_opt);
         args.emplace_back(data.str());
 
-        aptExitCode = ADUC_LaunchChildProcess(config->aduShellFilePath, args, aptOutput);
+        aptExitCode = ADUC_LaunchChildProcess(
+            config->aduShellFilePath,
+            args,
+            aptOutput,
+            ADUC_ChildProcessOptions_FromConfig(config, &usage, aduShellBroker.broker));
 
         if (!aptOutput.empty())
         {
@@ -374,6 +397,8 @@ ADUC_Result AptHandlerImpl::Install(const ADUC_WorkflowData* workflowData)
         aptExitCode = -1;
     }
 
+    workflow_set_resource_usage(handle, "install", ADUC_ChildProcessUsage_ToJsonValue(usage));
+
     if (aptExitCode != 0)
     {
         result.ResultCode = ADUC_Result_Failure;
@@ -44,7 +44,7 @@ public:
     ScriptHandlerImpl(ScriptHandlerImpl&&) = delete;
     ScriptHandlerImpl& operator=(ScriptHandlerImpl&&) = delete;
 
-    ~ScriptHandlerImpl() override = default;
+    ~ScriptHandlerImpl() override;
 
     ADUC_Result Download(const tagADUC_WorkflowData* workflowData) override;
     ADUC_Result Backup(const tagADUC_WorkflowData* workflowData) override;
@@ -54,6 +54,11 @@ public:
     ADUC_Result Cancel(const tagADUC_WorkflowData* workflowData) override;
     ADUC_Result IsInstalled(const tagADUC_WorkflowData* workflowData) override;
 
+    bool IsConcurrencySafe() const override
+    {
+        return true;
+    }
+
     static ADUC_Result PrepareScriptArguments(
         ADUC_WorkflowHandle workflowHandle,
         std::string resultFilePath,
@@ -109,6 +109,15 @@ ContentHandler* ScriptHandlerImpl::CreateContentHandler()
     return new ScriptHandlerImpl();
 }
 
+/**
+ * @brief Destructor for the Script Handler Impl class.
+ * @details Stops the logging threads of this extension, which is unloaded once its handler is deleted.
+ */
+ScriptHandlerImpl::~ScriptHandlerImpl() // override
+{
+    ADUC_Logging_Uninit();
+}
+
 static ADUC_Result Script_Handler_DownloadPrimaryScriptFile(ADUC_WorkflowHandle handle)
 {
     ADUC_Result result = { ADUC_Result_Failure };
@@ -529,6 +538,8 @@ ScriptHandler_PerformAction(const std::string& action, const tagADUC_WorkflowDat
     results.result.ResultCode = ADUC_GeneralResult_Failure;
 
     int exitCode = 0;
+    ADUC_ChildProcessUsage usage;
+    ADUC_AduShellBrokerReference aduShellBroker;
     results.commandLineArgs.clear();
 
     if (workflowData == nullptr || workflowData->WorkflowHandle == nullptr)
@@ -648,7 +659,14 @@ ScriptHandler_PerformAction(const std::string& action, const tagADUC_WorkflowDat
         goto done;
     }
 
-    exitCode = ADUC_LaunchChildProcess(config->aduShellFilePath, aduShellArgs, results.scriptOutput);
+    aduShellBroker.broker = workflow_get_adushell_broker(workflowData->WorkflowHandle);
+    exitCode = ADUC_LaunchChildProcess(
+        config->aduShellFilePath,
+        aduShellArgs,
+        results.scriptOutput,
+        ADUC_ChildProcessOptions_FromConfig(config, &usage, aduShellBroker.broker));
+    workflow_set_resource_usage(
+        workflowData->WorkflowHandle, action.c_str(), ADUC_ChildProcessUsage_ToJsonValue(usage));
 
     if (!results.scriptOutput.empty())
     {
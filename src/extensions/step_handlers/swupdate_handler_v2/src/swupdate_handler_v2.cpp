@@ -148,6 +148,8 @@ ADUC_Result SWUpdateHandler_PerformAction(
     const ADUC_ConfigInfo* config = nullptr;
 
     int exitCode = 0;
+    ADUC_ChildProcessUsage usage;
+    ADUC_AduShellBrokerReference aduShellBroker;
     commandLineArgs.clear();
 
     if (workflowData == nullptr || workflowData->WorkflowHandle == nullptr)
@@ -249,7 +251,14 @@ ADUC_Result SWUpdateHandler_PerformAction(
         goto done;
     }
 
-    exitCode = ADUC_LaunchChildProcess(config->aduShellFilePath, aduShellArgs, scriptOutput);
+    aduShellBroker.broker = workflow_get_adushell_broker(workflowData->WorkflowHandle);
+    exitCode = ADUC_LaunchChildProcess(
+        config->aduShellFilePath,
+        aduShellArgs,
+        scriptOutput,
+        ADUC_ChildProcessOptions_FromConfig(config, &usage, aduShellBroker.broker));
+    workflow_set_resource_usage(
+        workflowData->WorkflowHandle, action.c_str(), ADUC_ChildProcessUsage_ToJsonValue(usage));
     if (exitCode != 0)
     {
         int extendedCode = ADUC_ERC_SWUPDATE_HANDLER_CHILD_FAILURE_PROCESS_EXITCODE(exitCode);
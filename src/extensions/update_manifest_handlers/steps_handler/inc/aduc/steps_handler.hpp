@@ -10,6 +10,9 @@
 
 #include "aduc/content_handler.hpp"
 #include <aduc/result.h>
+#include <aduc/types/workflow.h> // ADUC_WorkflowHandle
+#include <functional>
+#include <vector>
 
 /**
  * @class StepsHandlerImpl
@@ -36,6 +39,11 @@ public:
     ADUC_Result Cancel(const tagADUC_WorkflowData* workflowData) override;
     ADUC_Result IsInstalled(const tagADUC_WorkflowData* workflowData) override;
 
+    bool IsConcurrencySafe() const override
+    {
+        return true;
+    }
+
 private:
     // Private constructor, must call CreateContentHandler factory method.
     StepsHandlerImpl()
@@ -43,4 +51,38 @@ private:
     }
 };
 
+/**
+ * @brief What the install loop does after a step instance is done.
+ * Ordered by precedence when several steps finish together.
+ */
+enum class StepInstanceAction
+{
+    NextStep, //!< Continue with the next step.
+    SkipRemainingSteps, //!< Skip the remaining steps for the current component.
+    Abort, //!< Skip all remaining steps and components.
+};
+
+/**
+ * @brief Installs step #stepIndex of the parent workflow @p handle.
+ * Sets @p abort to true when all remaining steps and components must be skipped.
+ */
+using StepInstanceInstaller = std::function<ADUC_Result(ADUC_WorkflowHandle handle, size_t stepIndex, bool* abort)>;
+
+/**
+ * @brief Installs reference steps that target disjoint components concurrently, one thread per step.
+ * Each step keeps its own reboot and agent restart requests while it installs. Results and requests are applied to
+ * the parent workflow in step order once every step is done.
+ *
+ * @param handle The parent workflow handle.
+ * @param steps The step indices.
+ * @param installStep Installs one step.
+ * @param[out] result The result of the first step that stops the install loop, or of the last step.
+ * @return StepInstanceAction What the install loop does next.
+ */
+StepInstanceAction InstallStepsConcurrently(
+    ADUC_WorkflowHandle handle,
+    const std::vector<size_t>& steps,
+    const StepInstanceInstaller& installStep,
+    ADUC_Result* result);
+
 #endif // ADUC_STEPS_HANDLER_HPP
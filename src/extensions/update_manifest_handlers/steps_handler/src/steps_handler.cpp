@@ -9,6 +9,8 @@
 
 #include "aduc/calloc_wrapper.hpp" // cstr_wrapper
 #include "aduc/component_enumerator_extension.hpp"
+#include "aduc/component_scheduler_utils.hpp"
+#include "aduc/config_utils.h" // ADUC_ConfigInfo_GetInstance
 #include "aduc/extension_manager.hpp"
 #include "aduc/extension_manager_download_options.h"
 #include "aduc/logging.h"
@@ -16,13 +18,21 @@
 #include "aduc/string_c_utils.h" // IsNullOrEmpty
 #include "aduc/string_utils.hpp"
 #include "aduc/system_utils.h"
+#include "aduc/trace_utils.hpp" // ADUC::TraceSpan
 #include "aduc/workflow_utils.h"
 
 #include <azure_c_shared_utility/crt_abstractions.h> // mallocAndStrcpy
 #include <azure_c_shared_utility/strings.h> // STRING_*
 #include <parson.h>
+#include <algorithm> // std::min
+#include <cstring> // strcmp
+#include <future>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 // keep this last to avoid interfering with system headers
 #include "aduc/aduc_banned.h"
@@ -45,6 +55,23 @@ static bool IsStepsHandlerExtraDebugLogsEnabled()
     return (!IsNullOrEmpty(getenv("DU_AGENT_ENABLE_STEPS_HANDLER_EXTRA_DEBUG_LOGS")));
 }
 
+/**
+ * @brief Check whether the next step's payload downloads while the current step installs.
+ *
+ * @return true if 'pipelineStepDownloads' is set in the agent configuration.
+ */
+static bool IsPipelinedStepDownloadEnabled()
+{
+    bool enabled = false;
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config != nullptr)
+    {
+        enabled = config->pipelineStepDownloads;
+        ADUC_ConfigInfo_ReleaseInstance(config);
+    }
+    return enabled;
+}
+
 /**
  * @brief Destructor for the Steps Handler Impl class.
  */
@@ -406,6 +433,13 @@ static ADUC_Result DoV1DownloadWork(
             // Propagate item's resultDetails to parent.
             workflow_set_result_details(handle, workflow_peek_result_details(stepHandle));
         }
+        else
+        {
+            // Report each step's download as it completes; with pipelined downloads, the parent's
+            // DownloadSucceeded state only covers the first step.
+            workflow_set_result(stepHandle, result);
+            workflow_set_state(stepHandle, ADUCITF_State_DownloadSucceeded);
+        }
     }
 
     return result;
@@ -484,6 +518,134 @@ done:
     return result;
 }
 
+/**
+ * @brief Gets the root workflow sandbox, which holds the workflow trace file when tracing is enabled.
+ *
+ * @param handle A workflow handle.
+ * @return std::string The root workflow sandbox, or an empty string.
+ */
+static std::string GetTraceFolder(ADUC_WorkflowHandle handle)
+{
+    cstr_wrapper workFolder{ workflow_get_workfolder(workflow_get_root(handle)) };
+    return workFolder.get() != nullptr ? workFolder.get() : "";
+}
+
+/**
+ * @brief Formats the trace span detail of a step.
+ */
+static std::string GetStepTraceDetail(size_t stepIndex, const char* stepUpdateType)
+{
+    std::stringstream detail;
+    detail << "step #" << stepIndex << " (" << (stepUpdateType == nullptr ? "NULL" : stepUpdateType) << ")";
+    return detail.str();
+}
+
+/**
+ * @brief Serializes the calls to a content handler that is not safe to call from several threads at once.
+ *
+ * @param contentHandler The content handler.
+ * @return std::unique_lock<std::recursive_mutex> A lock on the handler; or no lock if the handler is concurrency safe.
+ */
+static std::unique_lock<std::recursive_mutex> LockContentHandler(const ContentHandler* contentHandler)
+{
+    static std::mutex handlerMutexesMutex;
+    static std::unordered_map<const ContentHandler*, std::recursive_mutex> handlerMutexes;
+
+    if (contentHandler->IsConcurrencySafe())
+    {
+        return {};
+    }
+
+    std::recursive_mutex* handlerMutex = nullptr;
+    {
+        std::lock_guard<std::mutex> lock{ handlerMutexesMutex };
+        handlerMutex = &handlerMutexes[contentHandler];
+    }
+
+    return std::unique_lock<std::recursive_mutex>{ *handlerMutex };
+}
+
+/**
+ * @brief Performs the download action of step #stepIndex, unless the step is already installed.
+ *
+ * @param handle The parent workflow handle.
+ * @param stepIndex The step index.
+ * @param serializedComponentString The target component for inline steps. Can be nullptr.
+ * @param resultDetailsHandle The workflow that receives result details. nullptr when the step downloads on a
+ *        background thread; the caller propagates the step's result details once the download is joined.
+ * @return ADUC_Result The download result. Any failure aborts the remaining downloads.
+ */
+static ADUC_Result DownloadStepInstance(
+    ADUC_WorkflowHandle handle,
+    size_t stepIndex,
+    const char* serializedComponentString,
+    ADUC_WorkflowHandle resultDetailsHandle)
+{
+    ADUC_Result result = { ADUC_Result_Failure };
+    ContentHandler* contentHandler = nullptr;
+    const char* stepUpdateType = nullptr;
+
+    // Use a wrapper workflow to hold a stepHandle.
+    ADUC_WorkflowData stepWorkflow = {};
+
+    ADUC_WorkflowHandle stepHandle = workflow_get_child(handle, stepIndex);
+    if (stepHandle == nullptr)
+    {
+        const char* errorFmt = "Cannot process step #%lu due to missing (child) workflow data.";
+        Log_Error(errorFmt, stepIndex);
+        result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_DOWNLOAD_FAILURE_MISSING_CHILD_WORKFLOW;
+        workflow_set_result_details(resultDetailsHandle, errorFmt, stepIndex);
+        return result;
+    }
+    stepWorkflow.WorkflowHandle = stepHandle;
+
+    // For inline step - set current component info on the workflow.
+    if (serializedComponentString != nullptr && workflow_is_inline_step(handle, stepIndex))
+    {
+        if (!workflow_set_selected_components(stepHandle, serializedComponentString))
+        {
+            result.ResultCode = ADUC_Result_Failure;
+            result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_SET_SELECTED_COMPONENTS_FAILURE;
+            workflow_set_result_details(
+                resultDetailsHandle, "Cannot select target component(s) for step #%lu", stepIndex);
+            return result;
+        }
+    }
+
+    stepUpdateType = workflow_is_inline_step(handle, stepIndex)
+        ? workflow_peek_update_manifest_step_handler(handle, stepIndex)
+        : DEFAULT_REF_STEP_HANDLER;
+
+    Log_Info("Loading handler for step #%lu (handler: '%s')", stepIndex, stepUpdateType);
+
+    const std::string traceFolder = GetTraceFolder(handle);
+    const std::string traceDetail = GetStepTraceDetail(stepIndex, stepUpdateType);
+
+    ADUC::TraceSpan loadSpan{ traceFolder, "steps", "LoadHandler", traceDetail };
+    result = ExtensionManager::LoadUpdateContentHandlerExtension(stepUpdateType, &contentHandler);
+    loadSpan.End();
+
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        const char* errorFmt = "Cannot load a handler for step #%lu (handler :%s)";
+        Log_Error(errorFmt, stepIndex, stepUpdateType);
+        workflow_set_result(stepHandle, result);
+        workflow_set_result_details(
+            resultDetailsHandle, errorFmt, stepIndex, stepUpdateType == nullptr ? "NULL" : stepUpdateType);
+        return result;
+    }
+
+    ADUC_ExtensionContractInfo contractInfo = contentHandler->GetContractInfo();
+    if (!ADUC_ContractUtils_IsV1Contract(&contractInfo))
+    {
+        return handleUnsupportedContractVersion(&contractInfo, stepUpdateType, resultDetailsHandle);
+    }
+
+    std::unique_lock<std::recursive_mutex> handlerLock = LockContentHandler(contentHandler);
+    ADUC::TraceSpan downloadSpan{ traceFolder, "steps", "Download", traceDetail };
+    return DoV1DownloadWork(&stepWorkflow, contentHandler, resultDetailsHandle, stepHandle);
+}
+
 /**
  * @brief Performs 'Download' task by iterating through all steps and invoke each step's handler
  * to download file(s), if needed.
@@ -502,7 +664,6 @@ static ADUC_Result StepsHandler_Download(const tagADUC_WorkflowData* workflowDat
     result.ResultCode = ADUC_Result_Failure;
     result.ExtendedResultCode = 0;
     ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
-    ADUC_WorkflowHandle stepHandle = nullptr;
     char* workFolder = workflow_get_workfolder(handle);
     JSON_Array* selectedComponentsArray = nullptr;
     int workflowLevel = workflow_get_level(handle);
@@ -511,6 +672,7 @@ static ADUC_Result StepsHandler_Download(const tagADUC_WorkflowData* workflowDat
     char* serializedComponentString = nullptr;
     bool isComponentsEnumeratorRegistered = ExtensionManager::IsComponentsEnumeratorRegistered();
     int createResult = 0;
+    size_t stepsToDownload = 0;
 
     if (workflow_is_cancel_requested(handle))
     {
@@ -554,16 +716,21 @@ static ADUC_Result StepsHandler_Download(const tagADUC_WorkflowData* workflowDat
         goto done;
     }
 
-    // For each selected component, perform step's backup, install & apply phase, restore phase if needed, in order.
-    for (size_t iCom = 0, stepsCount = workflow_get_children_count(handle); iCom < selectedComponentsCount; iCom++)
+    stepsToDownload = workflow_get_children_count(handle);
+
+    // When downloads are pipelined, only the first top-level step is downloaded here. The install phase downloads
+    // each remaining step while the previous step installs.
+    if (workflowLevel == 0 && IsPipelinedStepDownloadEnabled())
+    {
+        stepsToDownload = std::min<size_t>(stepsToDownload, 1);
+    }
+
+    // For each selected component, download each step's payload, in order.
+    for (size_t iCom = 0; iCom < selectedComponentsCount; iCom++)
     {
         serializedComponentString = CreateComponentSerializedString(selectedComponentsArray, iCom);
 
-        //
-        // For each step (child workflow), invoke backup, install and apply actions.
-        // if install or apply fails, invoke restore action.
-        //
-        for (size_t i = 0; i < stepsCount; i++)
+        for (size_t i = 0; i < stepsToDownload; i++)
         {
             if (IsStepsHandlerExtraDebugLogsEnabled())
             {
@@ -574,90 +741,15 @@ static ADUC_Result StepsHandler_Download(const tagADUC_WorkflowData* workflowDat
                     serializedComponentString);
             }
 
-            // Use a wrapper workflow to hold a stepHandle.
-            ADUC_WorkflowData stepWorkflow = {};
-
-            stepHandle = workflow_get_child(handle, i);
-            if (stepHandle == nullptr)
-            {
-                const char* errorFmt = "Cannot process step #%lu due to missing (child) workflow data.";
-                Log_Error(errorFmt, i);
-                result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_DOWNLOAD_FAILURE_MISSING_CHILD_WORKFLOW;
-                workflow_set_result_details(handle, errorFmt, i);
-                goto done;
-            }
-            stepWorkflow.WorkflowHandle = stepHandle;
-
-            // For inline step - set current component info on the workflow.
-            if (serializedComponentString != nullptr && workflow_is_inline_step(handle, i))
-            {
-                if (!workflow_set_selected_components(stepHandle, serializedComponentString))
-                {
-                    result.ResultCode = ADUC_Result_Failure;
-                    result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_SET_SELECTED_COMPONENTS_FAILURE;
-                    workflow_set_result_details(handle, "Cannot select target component(s) for step #%lu", i);
-                    goto done;
-                }
-            }
-
-            ContentHandler* contentHandler = nullptr;
-            const char* stepUpdateType = workflow_is_inline_step(handle, i)
-                ? workflow_peek_update_manifest_step_handler(handle, i)
-                : DEFAULT_REF_STEP_HANDLER;
-
-            Log_Info("Loading handler for step #%lu (handler: '%s')", i, stepUpdateType);
-
-            result = ExtensionManager::LoadUpdateContentHandlerExtension(stepUpdateType, &contentHandler);
-
+            result = DownloadStepInstance(handle, i, serializedComponentString, handle);
             if (IsAducResultCodeFailure(result.ResultCode))
             {
-                const char* errorFmt = "Cannot load a handler for step #%lu (handler :%s)";
-                Log_Error(errorFmt, i, stepUpdateType);
-                workflow_set_result(stepHandle, result);
-                workflow_set_result_details(handle, errorFmt, i, stepUpdateType == nullptr ? "NULL" : stepUpdateType);
-                goto done;
-            }
-
-            ADUC_ExtensionContractInfo contractInfo = contentHandler->GetContractInfo();
-            if (ADUC_ContractUtils_IsV1Contract(&contractInfo))
-            {
-                result = DoV1DownloadWork(&stepWorkflow, contentHandler, handle, stepHandle);
-
-                if (IsAducResultCodeFailure(result.ResultCode))
-                {
-                    goto done;
-                }
-
-                if (result.ResultCode == ADUC_Result_Install_Skipped_UpdateAlreadyInstalled)
-                {
-                    goto instanceDone;
-                }
-            }
-            else
-            {
-                result = handleUnsupportedContractVersion(&contractInfo, stepUpdateType, handle);
                 goto done;
             }
+        }
 
-        instanceDone:
-            stepHandle = nullptr;
-
-            if (IsAducResultCodeFailure(result.ResultCode))
-            {
-                goto componentDone;
-            }
-        } // instances loop
-
-    componentDone:
         json_free_serialized_string(serializedComponentString);
         serializedComponentString = nullptr;
-
-        if (IsAducResultCodeFailure(result.ResultCode))
-        {
-            goto done;
-        }
-
-        // Set step's result.
     }
 
     result.ResultCode = ADUC_Result_Download_Success;
@@ -706,123 +798,729 @@ ADUC_Result StepsHandlerImpl::Download(const tagADUC_WorkflowData* workflowData)
 }
 
 /**
- * @brief Performs 'Install' phase.
- * All files required for installation must be downloaded in to sandbox.
- * During this phase, we will not re-download any file.
- * If file(s) missing, install will be aborted.
- *
- * Algorithm:
- *      - Top-level inline step is intended for the host.
- *          - [Process the step]
- *              - Load step handler
- *              - Invoke contentHandler::Install
- *                  - If failed, return with 'Install' result.
- *                  - If success with Reboot or Agent Restart request, then call workflow api accordingly, then return with 'Install' result.
- *                  - Otherwise, continue...
- *              - Invoke contentHandler::Apply
- *              - Return 'Apply' result
- *
- *     - For reference step(s):
- *         - If component enumerator is registered...
- *              - The reference step must be installed onto 'selected-components'
- *              - Components are selected using compat properties specified in reference step's update manifest.
- *              - If no components matched, the reference step are considered "optional".
- *                   - Install resultCode for optional step is ADUC_Result_Install_Skipped_NoMatchingComponents (604)
- *              - For each selected component [Process the step]
- *                   - Load step handler
- *                   - Invoke contentHandler::Install
- *                      - If failed, return with 'Install' result.
- *                      - If success with Reboot or Agent Restart request, then call workflow api accordingly, then return with 'Install' result.
- *                      - Otherwise, continue...
- *                   - Invoke contentHandler::Apply
- *                      - If failed, invoke contentHandler::Restore, then return with 'Apply' result
- *                      - If success, continue to next *component*
- *                   - Once done with every components, return ADUC_Result_Install_Success (600)
- *
- *         - If component enumerator is not registered, every child steps of this reference step will be installed onto the host.
- *           In this case, if the reference step is intended to be install onto a component, it's likely to be failed, due to missing component info.
- *              - [Process the step] (same as above, but w/o selected component data)
+ * @brief Downloads top-level steps ahead of the install loop when pipelined step downloads are enabled.
  *
- * @return ADUC_Result The 'install' result
+ * At most one download runs in the background, for the step after the one being installed.
+ * A step whose handlerProperties set 'dependsOnPreviousStep' to "true" is only downloaded once the previous step
+ * has been installed, as is a step whose handler is the previous step's, when that handler is not concurrency safe.
  */
-static ADUC_Result StepsHandler_Install(const tagADUC_WorkflowData* workflowData)
+class StepDownloadPipeline
 {
-    ADUC_Result result;
-    result.ResultCode = ADUC_Result_Failure;
-    result.ExtendedResultCode = 0;
-    ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
-    ADUC_WorkflowHandle stepHandle = nullptr;
-
-    const char* workflowId = workflow_peek_id(handle);
-    char* workFolder = workflow_get_workfolder(handle);
-    JSON_Array* selectedComponentsArray = nullptr;
-    int workflowLevel = workflow_get_level(handle);
-    int workflowStep = workflow_get_step_index(handle);
-    int selectedComponentsCount = 0;
-    char* serializedComponentString = nullptr;
-    bool isComponentsEnumeratorRegistered = ExtensionManager::IsComponentsEnumeratorRegistered();
-    int createResult = 0;
-
-    if (workflow_is_cancel_requested(handle))
+public:
+    explicit StepDownloadPipeline(ADUC_WorkflowHandle handle) : _handle{ handle }
     {
-        Log_Info(
-            "Install task cancelled (level: %d, step:%d, wfid:%s, h_addr:0x%x).",
-            workflowLevel,
-            workflowStep,
-            workflowId,
-            handle);
-        result.ResultCode = ADUC_Result_Failure_Cancelled;
-        result.ExtendedResultCode = 0;
-        goto done;
     }
 
-    Log_Debug(
-        "\n#\n#Install task begin (level: %d, step:%d, wfid:%s, h_addr:0x%x).",
-        workflowLevel,
-        workflowStep,
-        workflowId,
-        handle);
+    StepDownloadPipeline(const StepDownloadPipeline&) = delete;
+    StepDownloadPipeline& operator=(const StepDownloadPipeline&) = delete;
+    StepDownloadPipeline(StepDownloadPipeline&&) = delete;
+    StepDownloadPipeline& operator=(StepDownloadPipeline&&) = delete;
 
-    createResult = ADUC_SystemUtils_MkSandboxDirRecursive(workFolder);
-    if (createResult != 0)
+    /**
+     * @brief Waits for the background download, if any, so that it does not outlive the install phase.
+     */
+    ~StepDownloadPipeline()
     {
-        Log_Error("Unable to create folder %s, error %d", workFolder, createResult);
-        result = { ADUC_Result_Failure, ADUC_ERC_STEPS_HANDLER_CREATE_SANDBOX_FAILURE };
-        goto done;
+        if (_prefetch.valid())
+        {
+            _prefetch.wait();
+        }
     }
 
-    result = PrepareStepsWorkflowDataObject(handle);
-    if (IsAducResultCodeFailure(result.ResultCode))
+    /**
+     * @brief Ensures step #stepIndex is downloaded, waiting for its background download or downloading it now.
+     * Payloads that are already in the sandbox are verified and not downloaded again.
+     *
+     * @param stepIndex The step index.
+     * @return ADUC_Result The download result.
+     */
+    ADUC_Result WaitForStep(size_t stepIndex)
     {
-        workflow_set_result_details(handle, "Invalid steps workflow collection");
-        goto done;
-    }
+        ADUC_Result result = {};
 
-    if (workflowLevel == 0 || !isComponentsEnumeratorRegistered)
-    {
-        // If this is a top-level step or component enumerator is not registered, we will assume that this step is
-        // intended for the host device and will set selectedComponentCount to 1 to iterate through
-        // every step once  without setting any component data on the workflow.
-        selectedComponentsCount = 1;
+        if (_prefetch.valid() && _prefetchedStep == stepIndex)
+        {
+            result = _prefetch.get();
+
+            if (IsAducResultCodeFailure(result.ResultCode))
+            {
+                // Propagate item's resultDetails to parent.
+                workflow_set_result_details(
+                    _handle, workflow_peek_result_details(workflow_get_child(_handle, stepIndex)));
+            }
+        }
+        else
+        {
+            result = DownloadStepInstance(_handle, stepIndex, nullptr, _handle);
+        }
+
+        return result;
     }
-    else
+
+    /**
+     * @brief Starts downloading step #stepIndex in the background, unless it is out of range, depends on the
+     * previous step, or another download is still in flight.
+     *
+     * @param stepIndex The step index.
+     */
+    void Prefetch(size_t stepIndex)
     {
-        // This is a reference step (workflowLevel == 1), this intended for one or more components.
-        result = GetSelectedComponentsArray(handle, &selectedComponentsArray);
-        if (IsAducResultCodeFailure(result.ResultCode))
+        if (stepIndex >= workflow_get_children_count(_handle) || _prefetch.valid() || DependsOnPreviousStep(stepIndex))
         {
-            const char* fmt = "Missing selected components. workflow level %d, step %d";
-            Log_Error(fmt, workflowLevel, workflowStep);
-            workflow_set_result_details(handle, fmt, workflowLevel, workflowStep);
-            goto done;
+            return;
         }
 
-        selectedComponentsCount = static_cast<int>(json_array_get_count(selectedComponentsArray));
+        if (SharesSerializedHandlerWithPreviousStep(stepIndex))
+        {
+            Log_Info(
+                "Not downloading step #%lu in the background: its handler does not download while it installs.",
+                stepIndex);
+            return;
+        }
 
-        if (selectedComponentsCount == 0)
+        Log_Info("Downloading step #%lu in the background.", stepIndex);
+
+        try
         {
-            // If there's no matching component, we will consider this step 'optional' and this
-            // step is no-op.
+            ADUC_WorkflowHandle handle = _handle;
+            _prefetch = std::async(std::launch::async, [handle, stepIndex]() {
+                return DownloadStepInstance(handle, stepIndex, nullptr, nullptr);
+            });
+            _prefetchedStep = stepIndex;
+        }
+        catch (...)
+        {
+            // WaitForStep() downloads the step on the install thread instead.
+            Log_Warn("Cannot start a background download for step #%lu.", stepIndex);
+        }
+    }
+
+private:
+    /**
+     * @brief Whether step #stepIndex has the same handler as the previous step, and that handler is not concurrency
+     * safe. Its download would only start once the previous step is installed, since calls to the handler are
+     * serialized, so it is not downloaded in the background.
+     */
+    bool SharesSerializedHandlerWithPreviousStep(size_t stepIndex) const
+    {
+        if (stepIndex == 0)
+        {
+            return false;
+        }
+
+        const char* stepUpdateType = workflow_is_inline_step(_handle, stepIndex)
+            ? workflow_peek_update_manifest_step_handler(_handle, stepIndex)
+            : DEFAULT_REF_STEP_HANDLER;
+        const char* previousStepUpdateType = workflow_is_inline_step(_handle, stepIndex - 1)
+            ? workflow_peek_update_manifest_step_handler(_handle, stepIndex - 1)
+            : DEFAULT_REF_STEP_HANDLER;
+
+        if (stepUpdateType == nullptr || previousStepUpdateType == nullptr
+            || strcmp(stepUpdateType, previousStepUpdateType) != 0)
+        {
+            return false;
+        }
+
+        ContentHandler* contentHandler = nullptr;
+        const ADUC_Result result = ExtensionManager::LoadUpdateContentHandlerExtension(stepUpdateType, &contentHandler);
+        return IsAducResultCodeSuccess(result.ResultCode) && contentHandler != nullptr
+            && !contentHandler->IsConcurrencySafe();
+    }
+
+    bool DependsOnPreviousStep(size_t stepIndex) const
+    {
+        const char* value = workflow_peek_update_manifest_handler_properties_string(
+            workflow_get_child(_handle, stepIndex), "dependsOnPreviousStep");
+        return value != nullptr && strcmp(value, "true") == 0;
+    }
+
+    ADUC_WorkflowHandle _handle;
+    size_t _prefetchedStep{ 0 };
+    std::future<ADUC_Result> _prefetch;
+};
+
+/**
+ * @brief Performs the backup, install & apply actions of step #stepIndex, and the restore action if needed.
+ *
+ * @param handle The parent workflow handle.
+ * @param stepIndex The step index.
+ * @param serializedComponentString The target component for inline steps. Can be nullptr.
+ * @param resultDetailsHandle The workflow that receives result details. nullptr when the step runs on a worker thread;
+ *        the caller propagates the step's result details once the worker is joined.
+ * @param[out] abort Set to true when all remaining steps and components must be skipped.
+ * @return ADUC_Result The step result.
+ */
+static ADUC_Result InstallStepInstance(
+    ADUC_WorkflowHandle handle,
+    size_t stepIndex,
+    const char* serializedComponentString,
+    ADUC_WorkflowHandle resultDetailsHandle,
+    bool* abort)
+{
+    ADUC_Result result = { ADUC_Result_Failure };
+    ContentHandler* contentHandler = nullptr;
+    const char* stepUpdateType = nullptr;
+
+    // Use a wrapper workflow to hold a stepHandle.
+    ADUC_WorkflowData stepWorkflow = {};
+
+    *abort = true;
+
+    ADUC_WorkflowHandle stepHandle = workflow_get_child(handle, stepIndex);
+    if (stepHandle == nullptr)
+    {
+        const char* errorFmt = "Cannot process step #%lu due to missing (child) workflow data.";
+        Log_Error(errorFmt, stepIndex);
+        result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_FAILURE_MISSING_CHILD_WORKFLOW;
+        workflow_set_result_details(resultDetailsHandle, errorFmt, stepIndex);
+        return result;
+    }
+    stepWorkflow.WorkflowHandle = stepHandle;
+
+    // For inline step - set current component info on the workflow.
+    if (serializedComponentString != nullptr && workflow_is_inline_step(handle, stepIndex))
+    {
+        if (!workflow_set_selected_components(stepHandle, serializedComponentString))
+        {
+            result.ResultCode = ADUC_Result_Failure;
+            result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_SET_SELECTED_COMPONENTS_FAILURE;
+            workflow_set_result_details(resultDetailsHandle, "Cannot set target component(s) for step #%d", stepIndex);
+            return result;
+        }
+    }
+
+    stepUpdateType = workflow_is_inline_step(handle, stepIndex)
+        ? workflow_peek_update_manifest_step_handler(handle, stepIndex)
+        : DEFAULT_REF_STEP_HANDLER;
+
+    Log_Info("Loading handler for child step #%lu (handler: '%s')", stepIndex, stepUpdateType);
+
+    const std::string traceFolder = GetTraceFolder(handle);
+    const std::string traceDetail = GetStepTraceDetail(stepIndex, stepUpdateType);
+
+    ADUC::TraceSpan loadSpan{ traceFolder, "steps", "LoadHandler", traceDetail };
+    result = ExtensionManager::LoadUpdateContentHandlerExtension(stepUpdateType, &contentHandler);
+    loadSpan.End();
+
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        const char* errorFmt = "Cannot load a handler for step #%lu (handler :%s)";
+        Log_Error(errorFmt, stepIndex, stepUpdateType);
+        workflow_set_result(stepHandle, result);
+        workflow_set_result_details(
+            resultDetailsHandle, errorFmt, stepIndex, stepUpdateType == nullptr ? "NULL" : stepUpdateType);
+        return result;
+    }
+
+    *abort = false;
+
+    std::unique_lock<std::recursive_mutex> handlerLock = LockContentHandler(contentHandler);
+
+    // If this item is already installed, skip to the next one.
+    try
+    {
+        ADUC::TraceSpan span{ traceFolder, "steps", "IsInstalled", traceDetail };
+        result = contentHandler->IsInstalled(&stepWorkflow);
+    }
+    catch (...)
+    {
+        // Cannot determine whether the step has been applied, so, we'll try to process the step.
+        result.ResultCode = ADUC_Result_IsInstalled_NotInstalled;
+        result.ExtendedResultCode = 0;
+    }
+
+    if (IsAducResultCodeSuccess(result.ResultCode) && result.ResultCode == ADUC_Result_IsInstalled_Installed)
+    {
+        result.ResultCode = ADUC_Result_Install_Skipped_UpdateAlreadyInstalled;
+        result.ExtendedResultCode = 0;
+        workflow_set_result(stepHandle, result);
+        workflow_set_result_details(resultDetailsHandle, workflow_peek_result_details(stepHandle));
+        // Skipping 'backup', 'install' and 'apply'.
+        return result;
+    }
+
+    //
+    // Perform 'backup' action before install.
+    //
+    try
+    {
+        ADUC::TraceSpan span{ traceFolder, "steps", "Backup", traceDetail };
+        result = contentHandler->Backup(&stepWorkflow);
+    }
+    catch (...)
+    {
+        result.ResultCode = ADUC_Result_Failure;
+        result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_BACKUP_CHILD_STEP;
+        *abort = true;
+        return result;
+    }
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        // Propagate item's resultDetails to parent.
+        workflow_set_result_details(resultDetailsHandle, workflow_peek_result_details(stepHandle));
+        *abort = true;
+        return result;
+    }
+
+    //
+    // Perform 'install' action.
+    //
+    try
+    {
+        ADUC::TraceSpan span{ traceFolder, "steps", "Install", traceDetail };
+        result = contentHandler->Install(&stepWorkflow);
+    }
+    catch (...)
+    {
+        Log_Error("The handler throws an exception inside Install().");
+        result.ResultCode = ADUC_Result_Failure;
+        result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_INSTALL_CHILD_STEP;
+        *abort = true;
+        return result;
+    }
+
+    // If the workflow interruption is required as part of the Install action,
+    // we must propagate that request to the wrapping workflow.
+
+    if (workflow_is_immediate_reboot_requested(stepHandle) || workflow_is_immediate_agent_restart_requested(stepHandle))
+    {
+        // Skip remaining tasks for this instance.
+        // And then skip remaining instance(s) if requested.
+        return result;
+    }
+
+    // If any step reported that the update is already installed on the
+    // selected component, we will skip the 'apply' phase, and skip all
+    // remaining step(s).
+    switch (result.ResultCode)
+    {
+    case ADUC_Result_Install_Skipped_UpdateAlreadyInstalled:
+    case ADUC_Result_Install_Skipped_NoMatchingComponents:
+        return result;
+    }
+
+    // If Install task failed, try to restore (best effort).
+    // The restore result is discarded, since install result is more important to customer.
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        // Propagate item's resultDetails to parent.
+        workflow_set_result_details(resultDetailsHandle, workflow_peek_result_details(stepHandle));
+
+        // When install fails, invoke Restore action
+        try
+        {
+            // Try to restore from the install failure, but it shouldn't impact the result code.
+            // To know the restore result on each step, the corresponding Update Handler will need to
+            // implement proper logging and send it up through Diagnostics service.
+            ADUC::TraceSpan span{ traceFolder, "steps", "Restore", traceDetail };
+            contentHandler->Restore(&stepWorkflow);
+        }
+        catch (...)
+        {
+            Log_Warn("Unexpected error happened during restore action.");
+        }
+        *abort = true;
+        return result;
+    }
+
+    //
+    // Perform 'apply' action.
+    //
+    try
+    {
+        ADUC::TraceSpan span{ traceFolder, "steps", "Apply", traceDetail };
+        result = contentHandler->Apply(&stepWorkflow);
+        Log_Debug("Step's apply() return r:0x%x rc:0x%x", result.ResultCode, result.ExtendedResultCode);
+    }
+    catch (...)
+    {
+        Log_Error("The handler throws an exception inside Apply().");
+        result.ResultCode = ADUC_Result_Failure;
+        result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_APPLY_CHILD_STEP;
+        *abort = true;
+        return result;
+    }
+
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        // Propagate item's resultDetails to parent.
+        workflow_set_result_details(resultDetailsHandle, workflow_peek_result_details(stepHandle));
+
+        // when apply fails, invoke restore action
+        try
+        {
+            Log_Info("Failed to install or apply. Try to restore now...");
+            // Try to restore from the apply failure, but it shouldn't impact the result code.
+            // To know the restore result on each step, the corresponding Update Handler will need to
+            // implement proper logging and send it up through Diagnostics service.
+            ADUC::TraceSpan span{ traceFolder, "steps", "Restore", traceDetail };
+            contentHandler->Restore(&stepWorkflow);
+        }
+        catch (...)
+        {
+            Log_Warn("Unexpected error happened during restore action.");
+            *abort = true;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Propagates the step's reboot and agent restart requests, and records the step result.
+ *
+ * @param handle The parent workflow handle.
+ * @param stepHandle The step workflow handle.
+ * @param result The step result.
+ * @return StepInstanceAction What the install loop does next.
+ */
+static StepInstanceAction CompleteStepInstance(ADUC_WorkflowHandle handle, ADUC_WorkflowHandle stepHandle, ADUC_Result result)
+{
+    // If the workflow interruption is required as part of the Install action,
+    // we must propagate that request to the wrapping workflow.
+
+    if (workflow_is_immediate_reboot_requested(stepHandle))
+    {
+        workflow_request_immediate_reboot(handle);
+        // We must skip the remaining instance(s).
+        return StepInstanceAction::Abort;
+    }
+
+    if (workflow_is_immediate_agent_restart_requested(stepHandle))
+    {
+        // We must skip the remaining instance(s).
+        workflow_request_immediate_agent_restart(handle);
+        return StepInstanceAction::Abort;
+    }
+
+    if (workflow_is_reboot_requested(stepHandle))
+    {
+        // Continue with the remaining instance(s).
+        workflow_request_reboot(handle);
+        return StepInstanceAction::SkipRemainingSteps;
+    }
+
+    if (workflow_is_agent_restart_requested(stepHandle))
+    {
+        // Continue with the remaining instance(s).
+        workflow_request_agent_restart(handle);
+        return StepInstanceAction::SkipRemainingSteps;
+    }
+
+    workflow_set_result(stepHandle, result);
+
+    return IsAducResultCodeFailure(result.ResultCode) ? StepInstanceAction::SkipRemainingSteps
+                                                      : StepInstanceAction::NextStep;
+}
+
+/**
+ * @brief Gets the ids of the components selected for the step workflow.
+ * A component without an 'id' is identified by its serialized value.
+ *
+ * @param stepHandle The step workflow handle.
+ * @param[out] componentIds The component ids. Empty if no components are selected.
+ * @return bool false if the selected components data is invalid.
+ */
+static bool GetSelectedComponentIds(ADUC_WorkflowHandle stepHandle, std::vector<std::string>& componentIds)
+{
+    bool succeeded = false;
+    JSON_Value* rootValue = nullptr;
+    JSON_Array* components = nullptr;
+
+    componentIds.clear();
+
+    const char* selectedComponents = workflow_peek_selected_components(stepHandle);
+    if (IsNullOrEmpty(selectedComponents))
+    {
+        return true;
+    }
+
+    rootValue = json_parse_string(selectedComponents);
+    components = json_object_get_array(json_value_get_object(rootValue), "components");
+    if (components == nullptr)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < json_array_get_count(components); i++)
+    {
+        JSON_Value* component = json_array_get_value(components, i);
+        const char* id = json_object_get_string(json_value_get_object(component), "id");
+        if (id != nullptr)
+        {
+            componentIds.emplace_back(id);
+        }
+        else
+        {
+            cstr_wrapper serialized{ json_serialize_to_string(component) };
+            if (serialized.get() == nullptr)
+            {
+                goto done;
+            }
+            componentIds.emplace_back(serialized.get());
+        }
+    }
+
+    succeeded = true;
+
+done:
+    json_value_free(rootValue);
+    return succeeded;
+}
+
+/**
+ * @brief Reserves the components of consecutive reference steps, starting at @p firstStep, until a step is not a
+ * reference step, targets no component, overlaps an already reserved component, or @p maxConcurrentSteps is reached.
+ *
+ * @param handle The parent workflow handle.
+ * @param firstStep The first step to consider.
+ * @param stepsCount The number of steps.
+ * @param maxConcurrentSteps The maximum number of steps to reserve.
+ * @param scheduler The scheduler holding the reservations. Owners are named after the step index.
+ * @return std::vector<size_t> The reserved step indices.
+ */
+static std::vector<size_t> ReserveDisjointReferenceSteps(
+    ADUC_WorkflowHandle handle,
+    size_t firstStep,
+    size_t stepsCount,
+    size_t maxConcurrentSteps,
+    ADUC::ComponentScheduler& scheduler)
+{
+    std::vector<size_t> steps;
+    std::vector<std::string> componentIds;
+
+    for (size_t i = firstStep; i < stepsCount && steps.size() < maxConcurrentSteps; i++)
+    {
+        ADUC_WorkflowHandle stepHandle = workflow_get_child(handle, i);
+        if (stepHandle == nullptr || workflow_is_inline_step(handle, i)
+            || !GetSelectedComponentIds(stepHandle, componentIds) || componentIds.empty()
+            || !scheduler.TryReserve(std::to_string(i), componentIds))
+        {
+            break;
+        }
+
+        steps.push_back(i);
+    }
+
+    return steps;
+}
+
+/**
+ * @brief The outcome of a step instance run on a worker thread.
+ */
+struct StepInstanceOutcome
+{
+    ADUC_Result result{ ADUC_Result_Failure };
+    bool abort{ true };
+};
+
+StepInstanceAction InstallStepsConcurrently(
+    ADUC_WorkflowHandle handle,
+    const std::vector<size_t>& steps,
+    const StepInstanceInstaller& installStep,
+    ADUC_Result* result)
+{
+    std::vector<StepInstanceOutcome> outcomes(steps.size());
+    std::vector<std::thread> workers;
+    StepInstanceAction action = StepInstanceAction::NextStep;
+
+    Log_Info("Installing %lu steps on disjoint components concurrently (first step #%lu).", steps.size(), steps[0]);
+
+    // A reboot or agent restart requested by one step must not change how the other steps proceed.
+    for (size_t step : steps)
+    {
+        workflow_set_interruption_requests_isolated(workflow_get_child(handle, step), true);
+    }
+
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+        auto work = [handle, &steps, &outcomes, &installStep, i]() {
+            outcomes[i].result = installStep(handle, steps[i], &outcomes[i].abort);
+        };
+
+        try
+        {
+            workers.emplace_back(work);
+        }
+        catch (...)
+        {
+            Log_Warn("Cannot start a thread for step #%lu. Installing it on the current thread.", steps[i]);
+            work();
+        }
+    }
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+        ADUC_WorkflowHandle stepHandle = workflow_get_child(handle, steps[i]);
+        const StepInstanceOutcome& outcome = outcomes[i];
+
+        StepInstanceAction stepAction =
+            outcome.abort ? StepInstanceAction::Abort : CompleteStepInstance(handle, stepHandle, outcome.result);
+
+        // Hands the step's requests, if any, to the parent workflow.
+        workflow_set_interruption_requests_isolated(stepHandle, false);
+
+        if (IsAducResultCodeFailure(outcome.result.ResultCode) && action == StepInstanceAction::NextStep)
+        {
+            // Propagate item's resultDetails to parent.
+            workflow_set_result_details(handle, workflow_peek_result_details(stepHandle));
+        }
+
+        if (stepAction > action || (i == steps.size() - 1 && action == StepInstanceAction::NextStep))
+        {
+            *result = outcome.result;
+        }
+
+        if (stepAction > action)
+        {
+            action = stepAction;
+        }
+    }
+
+    return action;
+}
+
+/**
+ * @brief Performs 'Install' phase.
+ * All files required for installation must be downloaded in to sandbox.
+ * During this phase, we will not re-download any file.
+ * If file(s) missing, install will be aborted.
+ *
+ * Algorithm:
+ *      - Top-level inline step is intended for the host.
+ *          - [Process the step]
+ *              - Load step handler
+ *              - Invoke contentHandler::Install
+ *                  - If failed, return with 'Install' result.
+ *                  - If success with Reboot or Agent Restart request, then call workflow api accordingly, then return with 'Install' result.
+ *                  - Otherwise, continue...
+ *              - Invoke contentHandler::Apply
+ *              - Return 'Apply' result
+ *
+ *     - For reference step(s):
+ *         - If component enumerator is registered...
+ *              - The reference step must be installed onto 'selected-components'
+ *              - Components are selected using compat properties specified in reference step's update manifest.
+ *              - If no components matched, the reference step are considered "optional".
+ *                   - Install resultCode for optional step is ADUC_Result_Install_Skipped_NoMatchingComponents (604)
+ *              - For each selected component [Process the step]
+ *                   - Load step handler
+ *                   - Invoke contentHandler::Install
+ *                      - If failed, return with 'Install' result.
+ *                      - If success with Reboot or Agent Restart request, then call workflow api accordingly, then return with 'Install' result.
+ *                      - Otherwise, continue...
+ *                   - Invoke contentHandler::Apply
+ *                      - If failed, invoke contentHandler::Restore, then return with 'Apply' result
+ *                      - If success, continue to next *component*
+ *                   - Once done with every components, return ADUC_Result_Install_Success (600)
+ *
+ *         - If 'maxConcurrentComponentUpdates' is greater than one, consecutive top-level reference steps whose selected
+ *           components are disjoint are installed concurrently, each on its own thread and in its own sandbox.
+ *           A step that overlaps a running step, or targets the host, waits until the running steps are done.
+ *
+ *         - If 'pipelineStepDownloads' is enabled, the download phase only downloads the first top-level step. Each
+ *           remaining step downloads in the background while the previous step installs, unless the step's
+ *           handlerProperties set 'dependsOnPreviousStep' to "true".
+ *
+ *         - If component enumerator is not registered, every child steps of this reference step will be installed onto the host.
+ *           In this case, if the reference step is intended to be install onto a component, it's likely to be failed, due to missing component info.
+ *              - [Process the step] (same as above, but w/o selected component data)
+ *
+ * @return ADUC_Result The 'install' result
+ */
+static ADUC_Result StepsHandler_Install(const tagADUC_WorkflowData* workflowData)
+{
+    ADUC_Result result;
+    result.ResultCode = ADUC_Result_Failure;
+    result.ExtendedResultCode = 0;
+    ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
+
+    const char* workflowId = workflow_peek_id(handle);
+    char* workFolder = workflow_get_workfolder(handle);
+    JSON_Array* selectedComponentsArray = nullptr;
+    int workflowLevel = workflow_get_level(handle);
+    int workflowStep = workflow_get_step_index(handle);
+    int selectedComponentsCount = 0;
+    char* serializedComponentString = nullptr;
+    bool isComponentsEnumeratorRegistered = ExtensionManager::IsComponentsEnumeratorRegistered();
+    int createResult = 0;
+    size_t maxConcurrentSteps = 1;
+    ADUC::ComponentScheduler componentScheduler;
+    const bool isDownloadPipelined = (workflowLevel == 0 && IsPipelinedStepDownloadEnabled());
+    StepDownloadPipeline downloadPipeline{ handle };
+
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config != nullptr)
+    {
+        maxConcurrentSteps = config->maxConcurrentComponentUpdates;
+        ADUC_ConfigInfo_ReleaseInstance(config);
+    }
+
+    if (workflow_is_cancel_requested(handle))
+    {
+        Log_Info(
+            "Install task cancelled (level: %d, step:%d, wfid:%s, h_addr:0x%x).",
+            workflowLevel,
+            workflowStep,
+            workflowId,
+            handle);
+        result.ResultCode = ADUC_Result_Failure_Cancelled;
+        result.ExtendedResultCode = 0;
+        goto done;
+    }
+
+    Log_Debug(
+        "\n#\n#Install task begin (level: %d, step:%d, wfid:%s, h_addr:0x%x).",
+        workflowLevel,
+        workflowStep,
+        workflowId,
+        handle);
+
+    createResult = ADUC_SystemUtils_MkSandboxDirRecursive(workFolder);
+    if (createResult != 0)
+    {
+        Log_Error("Unable to create folder %s, error %d", workFolder, createResult);
+        result = { ADUC_Result_Failure, ADUC_ERC_STEPS_HANDLER_CREATE_SANDBOX_FAILURE };
+        goto done;
+    }
+
+    result = PrepareStepsWorkflowDataObject(handle);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        workflow_set_result_details(handle, "Invalid steps workflow collection");
+        goto done;
+    }
+
+    if (workflowLevel == 0 || !isComponentsEnumeratorRegistered)
+    {
+        // If this is a top-level step or component enumerator is not registered, we will assume that this step is
+        // intended for the host device and will set selectedComponentCount to 1 to iterate through
+        // every step once  without setting any component data on the workflow.
+        selectedComponentsCount = 1;
+    }
+    else
+    {
+        // This is a reference step (workflowLevel == 1), this intended for one or more components.
+        result = GetSelectedComponentsArray(handle, &selectedComponentsArray);
+        if (IsAducResultCodeFailure(result.ResultCode))
+        {
+            const char* fmt = "Missing selected components. workflow level %d, step %d";
+            Log_Error(fmt, workflowLevel, workflowStep);
+            workflow_set_result_details(handle, fmt, workflowLevel, workflowStep);
+            goto done;
+        }
+
+        selectedComponentsCount = static_cast<int>(json_array_get_count(selectedComponentsArray));
+
+        if (selectedComponentsCount == 0)
+        {
+            // If there's no matching component, we will consider this step 'optional' and this
+            // step is no-op.
             const char* msg = "Optional step (no matching components)";
             Log_Debug(msg);
             result = { ADUC_Result_Install_Skipped_NoMatchingComponents };
@@ -853,238 +1551,78 @@ static ADUC_Result StepsHandler_Install(const tagADUC_WorkflowData* workflowData
         //
         for (size_t i = 0; i < stepsCount; i++)
         {
-            if (IsStepsHandlerExtraDebugLogsEnabled())
-            {
-                Log_Debug(
-                    "Perform install action of child step #%d on component #%d.\n#### Component ####\n%s\n###################\n",
-                    i,
-                    iCom,
-                    serializedComponentString);
-            }
-
-            // Use a wrapper workflow to hold a stepHandle.
-            ADUC_WorkflowData stepWorkflow = {};
+            StepInstanceAction action = StepInstanceAction::NextStep;
 
-            stepHandle = workflow_get_child(handle, i);
-            if (stepHandle == nullptr)
+            // Reference steps that target disjoint components may be installed concurrently.
+            std::vector<size_t> concurrentSteps;
+            if (workflowLevel == 0 && maxConcurrentSteps > 1 && isComponentsEnumeratorRegistered)
             {
-                const char* errorFmt = "Cannot process step #%lu due to missing (child) workflow data.";
-                Log_Error(errorFmt, i);
-                result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_FAILURE_MISSING_CHILD_WORKFLOW;
-                workflow_set_result_details(handle, errorFmt, i);
-                goto done;
+                concurrentSteps =
+                    ReserveDisjointReferenceSteps(handle, i, stepsCount, maxConcurrentSteps, componentScheduler);
             }
-            stepWorkflow.WorkflowHandle = stepHandle;
 
-            // For inline step - set current component info on the workflow.
-            if (serializedComponentString != nullptr && workflow_is_inline_step(handle, i))
+            const size_t lastStep = concurrentSteps.size() > 1 ? concurrentSteps.back() : i;
+
+            // Make sure the payloads of the steps about to install are downloaded, then start downloading the
+            // following step so that it downloads while these steps install.
+            if (isDownloadPipelined)
             {
-                if (!workflow_set_selected_components(stepHandle, serializedComponentString))
+                for (size_t step = i; step <= lastStep; step++)
                 {
-                    result.ResultCode = ADUC_Result_Failure;
-                    result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_SET_SELECTED_COMPONENTS_FAILURE;
-                    workflow_set_result_details(handle, "Cannot set target component(s) for step #%d", i);
-                    goto done;
+                    result = downloadPipeline.WaitForStep(step);
+                    if (IsAducResultCodeFailure(result.ResultCode))
+                    {
+                        goto done;
+                    }
                 }
-            }
-
-            ContentHandler* contentHandler = nullptr;
-            const char* stepUpdateType = workflow_is_inline_step(handle, i)
-                ? workflow_peek_update_manifest_step_handler(handle, i)
-                : DEFAULT_REF_STEP_HANDLER;
-
-            Log_Info("Loading handler for child step #%lu (handler: '%s')", i, stepUpdateType);
 
-            result = ExtensionManager::LoadUpdateContentHandlerExtension(stepUpdateType, &contentHandler);
-
-            if (IsAducResultCodeFailure(result.ResultCode))
-            {
-                const char* errorFmt = "Cannot load a handler for step #%lu (handler :%s)";
-                Log_Error(errorFmt, i, stepUpdateType);
-                workflow_set_result(stepHandle, result);
-                workflow_set_result_details(handle, errorFmt, i, stepUpdateType == nullptr ? "NULL" : stepUpdateType);
-                goto done;
+                downloadPipeline.Prefetch(lastStep + 1);
             }
 
-            // If this item is already installed, skip to the next one.
-            try
+            if (concurrentSteps.size() > 1)
             {
-                result = contentHandler->IsInstalled(&stepWorkflow);
-            }
-            catch (...)
-            {
-                // Cannot determine whether the step has been applied, so, we'll try to process the step.
-                result.ResultCode = ADUC_Result_IsInstalled_NotInstalled;
-                result.ExtendedResultCode = 0;
+                action = InstallStepsConcurrently(
+                    handle,
+                    concurrentSteps,
+                    [](ADUC_WorkflowHandle parent, size_t stepIndex, bool* abort) {
+                        return InstallStepInstance(parent, stepIndex, nullptr, nullptr, abort);
+                    },
+                    &result);
+                i = lastStep;
             }
-
-            if (IsAducResultCodeSuccess(result.ResultCode) && result.ResultCode == ADUC_Result_IsInstalled_Installed)
-            {
-                result.ResultCode = ADUC_Result_Install_Skipped_UpdateAlreadyInstalled;
-                result.ExtendedResultCode = 0;
-                workflow_set_result(stepHandle, result);
-                workflow_set_result_details(handle, workflow_peek_result_details(stepHandle));
-                // Skipping 'backup', 'install' and 'apply'.
-                goto instanceDone;
-            }
-
-            //
-            // Perform 'backup' action before install.
-            //
-            try
-            {
-                result = contentHandler->Backup(&stepWorkflow);
-            }
-            catch (...)
-            {
-                result.ResultCode = ADUC_Result_Failure;
-                result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_BACKUP_CHILD_STEP;
-                goto done;
-            }
-            if (IsAducResultCodeFailure(result.ResultCode))
-            {
-                // Propagate item's resultDetails to parent.
-                workflow_set_result_details(handle, workflow_peek_result_details(stepHandle));
-                goto done;
-            }
-
-            //
-            // Perform 'install' action.
-            //
-            try
-            {
-                result = contentHandler->Install(&stepWorkflow);
-            }
-            catch (...)
-            {
-                Log_Error("The handler throws an exception inside Install().");
-                result.ResultCode = ADUC_Result_Failure;
-                result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_INSTALL_CHILD_STEP;
-                goto done;
-            }
-
-            // If the workflow interruption is required as part of the Install action,
-            // we must propagate that request to the wrapping workflow.
-
-            if (workflow_is_immediate_reboot_requested(stepHandle)
-                || workflow_is_immediate_agent_restart_requested(stepHandle))
-            {
-                // Skip remaining tasks for this instance.
-                // And then skip remaining instance(s) if requested.
-                goto instanceDone;
-            }
-
-            // If any step reported that the update is already installed on the
-            // selected component, we will skip the 'apply' phase, and skip all
-            // remaining step(s).
-            switch (result.ResultCode)
-            {
-            case ADUC_Result_Install_Skipped_UpdateAlreadyInstalled:
-            case ADUC_Result_Install_Skipped_NoMatchingComponents:
-                goto instanceDone;
-            }
-
-            // If Install task failed, try to restore (best effort).
-            // The restore result is discarded, since install result is more important to customer.
-            if (IsAducResultCodeFailure(result.ResultCode))
+            else
             {
-                // Propagate item's resultDetails to parent.
-                workflow_set_result_details(handle, workflow_peek_result_details(stepHandle));
-
-                // When install fails, invoke Restore action
-                try
+                if (IsStepsHandlerExtraDebugLogsEnabled())
                 {
-                    // Try to restore from the install failure, but it shouldn't impact the result code.
-                    // To know the restore result on each step, the corresponding Update Handler will need to
-                    // implement proper logging and send it up through Diagnostics service.
-                    contentHandler->Restore(&stepWorkflow);
-                }
-                catch (...)
-                {
-                    Log_Warn("Unexpected error happened during restore action.");
+                    Log_Debug(
+                        "Perform install action of child step #%d on component #%d.\n#### Component ####\n%s\n###################\n",
+                        i,
+                        iCom,
+                        serializedComponentString);
                 }
-                goto done;
-            }
 
-            //
-            // Perform 'apply' action.
-            //
-            try
-            {
-                result = contentHandler->Apply(&stepWorkflow);
-                Log_Debug("Step's apply() return r:0x%x rc:0x%x", result.ResultCode, result.ExtendedResultCode);
+                bool abort = false;
+                result = InstallStepInstance(handle, i, serializedComponentString, handle, &abort);
+                action = abort ? StepInstanceAction::Abort
+                               : CompleteStepInstance(handle, workflow_get_child(handle, i), result);
             }
-            catch (...)
-            {
-                Log_Error("The handler throws an exception inside Apply().");
-                result.ResultCode = ADUC_Result_Failure;
-                result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_APPLY_CHILD_STEP;
-                goto done;
-            }
-
-            if (IsAducResultCodeFailure(result.ResultCode))
-            {
-                // Propagate item's resultDetails to parent.
-                workflow_set_result_details(handle, workflow_peek_result_details(stepHandle));
-
-                // when apply fails, invoke restore action
-                try
-                {
-                    Log_Info("Failed to install or apply. Try to restore now...");
-                    // Try to restore from the apply failure, but it shouldn't impact the result code.
-                    // To know the restore result on each step, the corresponding Update Handler will need to
-                    // implement proper logging and send it up through Diagnostics service.
-                    contentHandler->Restore(&stepWorkflow);
-                }
-                catch (...)
-                {
-                    Log_Warn("Unexpected error happened during restore action.");
-                    goto done;
-                }
-            }
-
-        instanceDone:
-            // If the workflow interruption is required as part of the Install action,
-            // we must propagate that request to the wrapping workflow.
 
-            if (workflow_is_immediate_reboot_requested(stepHandle))
+            for (size_t step : concurrentSteps)
             {
-                workflow_request_immediate_reboot(handle);
-                // We must skip the remaining instance(s).
-                goto done;
+                componentScheduler.Release(std::to_string(step));
             }
 
-            if (workflow_is_immediate_agent_restart_requested(stepHandle))
+            if (action == StepInstanceAction::Abort)
             {
-                // We must skip the remaining instance(s).
-                workflow_request_immediate_agent_restart(handle);
                 goto done;
             }
 
-            if (workflow_is_reboot_requested(stepHandle))
+            if (action == StepInstanceAction::SkipRemainingSteps)
             {
-                // Continue with the remaining instance(s).
-                workflow_request_reboot(handle);
                 break;
             }
-
-            if (workflow_is_agent_restart_requested(stepHandle))
-            {
-                // Continue with the remaining instance(s).
-                workflow_request_agent_restart(handle);
-                break;
-            }
-
-            workflow_set_result(stepHandle, result);
-            stepHandle = nullptr;
-
-            if (IsAducResultCodeFailure(result.ResultCode))
-            {
-                goto componentDone;
-            }
         } // steps
 
-    componentDone:
         json_free_serialized_string(serializedComponentString);
         serializedComponentString = nullptr;
 
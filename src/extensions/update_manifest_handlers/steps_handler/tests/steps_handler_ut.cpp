@@ -0,0 +1,232 @@
+/**
+ * @file steps_handler_ut.cpp
+ * @brief Steps handler unit tests
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/steps_handler.hpp"
+#include "aduc/workflow_utils.h"
+
+#include <catch2/catch.hpp>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// clang-format off
+
+const char* action_parent_update =
+    R"( {                                                          )"
+    R"(     "rootKeyPackageUrl": "http://foo.bar/rootkeypkg.json", )"
+    R"(     "workflow": {                                          )"
+    R"(         "action": 3,                                       )"
+    R"(         "id": "dcb112da-bfc9-47b7-b7ed-617feba1e6c4"       )"
+    R"(     },                                                     )"
+    R"(     "updateManifest": "{\"manifestVersion\":\"5\",\"updateId\":{\"provider\":\"Contoso\",\"name\":\"Virtual-Vacuum\",\"version\":\"20.0\"},\"compatibility\":[{\"deviceManufacturer\":\"contoso\",\"deviceModel\":\"virtual-vacuum-v1\"}],\"instructions\":{\"steps\":[{\"handler\":\"microsoft/apt:1\",\"files\":[\"f483750ebb885d32c\"],\"handlerProperties\":{\"installedCriteria\":\"apt-update-tree-1.0\"}},{\"type\":\"reference\",\"detachedManifestFileId\":\"f222b9ffefaaac577\"}]},\"files\":{\"f483750ebb885d32c\":{\"fileName\":\"apt-manifest-tree-1.0.json\",\"sizeInBytes\":136,\"hashes\":{\"sha256\":\"Uk1vsEL/nT4btMngo0YSJjheOL2aqm6/EAFhzPb0rXs=\"}},\"f222b9ffefaaac577\":{\"fileName\":\"contoso.contoso-virtual-motors.1.1.updatemanifest.json\",\"sizeInBytes\":1031,\"hashes\":{\"sha256\":\"9Rnjw7ThZhGacOGn3uvvVq0ccQTHc/UFSL9khR2oKsc=\"}}},\"createdDateTime\":\"2022-01-27T13:45:05.8993329Z\"}",  )"
+    R"(     "updateManifestSignature": "eyJhbGciOiJSUzI1NiIsInNqd2siOiJleUpoYkdjaU9pSlNVekkxTmlJc0ltdHBaQ0k2SWtGRVZTNHlNREEzTURJdVVpSjkuZXlKcmRIa2lPaUpTVTBFaUxDSnVJam9pYkV4bWMwdHZPRmwwWW1Oak1sRXpUalV3VlhSTVNXWlhVVXhXVTBGRlltTm9LMFl2WTJVM1V6Rlpja3BvV0U5VGNucFRaa051VEhCVmFYRlFWSGMwZWxndmRHbEJja0ZGZFhrM1JFRmxWVzVGU0VWamVEZE9hM2QzZVRVdk9IcExaV3AyWTBWWWNFRktMMlV6UWt0SE5FVTBiMjVtU0ZGRmNFOXplSGRQUzBWbFJ6QkhkamwzVjB3emVsUmpUblprUzFoUFJGaEdNMVZRWlVveGIwZGlVRkZ0Y3pKNmJVTktlRUppZEZOSldVbDBiWFpwWTNneVpXdGtWbnBYUm5jdmRrdFVUblZMYXpob2NVczNTRkptYWs5VlMzVkxXSGxqSzNsSVVVa3dZVVpDY2pKNmEyc3plR2d4ZEVWUFN6azRWMHBtZUdKamFsQnpSRTgyWjNwWmVtdFlla05OZW1Fd1R6QkhhV0pDWjB4QlZGUTVUV1k0V1ZCd1dVY3lhblpQWVVSVmIwTlJiakpWWTFWU1RtUnNPR2hLWW5scWJscHZNa3B5SzFVNE5IbDFjVTlyTjBZMFdubFRiMEoyTkdKWVNrZ3lXbEpTV2tab0wzVlRiSE5XT1hkU2JWbG9XWEoyT1RGRVdtbHhhemhJVWpaRVUyeHVabTVsZFRJNFJsUm9SVzF0YjNOVlRUTnJNbGxNYzBKak5FSnZkWEIwTTNsaFNEaFpia3BVTnpSMU16TjFlakU1TDAxNlZIVnFTMmMzVkdGcE1USXJXR0owYmxwRU9XcFVSMkY1U25Sc2FFWmxWeXRJUXpVM1FYUkJSbHBvY1ZsM2VVZHJXQ3M0TTBGaFVGaGFOR0V4VHpoMU1qTk9WVWQxTWtGd04yOU5NVTR3ZVVKS0swbHNUM29pTENKbElqb2lRVkZCUWlJc0ltRnNaeUk2SWxKVE1qVTJJaXdpYTJsa0lqb2lRVVJWTGpJeE1EWXdPUzVTTGxNaWZRLlJLS2VBZE02dGFjdWZpSVU3eTV2S3dsNFpQLURMNnEteHlrTndEdkljZFpIaTBIa2RIZ1V2WnoyZzZCTmpLS21WTU92dXp6TjhEczhybXo1dnMwT1RJN2tYUG1YeDZFLUYyUXVoUXNxT3J5LS1aN2J3TW5LYTNkZk1sbkthWU9PdURtV252RWMyR0hWdVVTSzREbmw0TE9vTTQxOVlMNThWTDAtSEthU18xYmNOUDhXYjVZR08xZXh1RmpiVGtIZkNIU0duVThJeUFjczlGTjhUT3JETHZpVEtwcWtvM3RiSUwxZE1TN3NhLWJkZExUVWp6TnVLTmFpNnpIWTdSanZGbjhjUDN6R2xjQnN1aVQ0XzVVaDZ0M05rZW1UdV9tZjdtZUFLLTBTMTAzMFpSNnNTR281azgtTE1sX0ZaUmh4djNFZFNtR2RBUTNlMDVMRzNnVVAyNzhTQWVzWHhNQUlHWmcxUFE3aEpoZGZHdmVGanJNdkdTSVFEM09wRnEtZHREcEFXbUo2Zm5sZFA1UWxYek5tQkJTMlZRQUtXZU9BYjh0Yjl5aVhsemhtT1dLRjF4SzlseHpYUG9GNmllOFRUWlJ4T0hxTjNiSkVISkVoQmVLclh6YkViV2tFNm4zTEoxbkd5M1htUlVFcER0Umdpa0tBUzZybFhFT0VneXNjIn0.eyJzaGEyNTYiOiJqSW12eGpsc2pqZ29JeUJuYThuZTk2d0RYYlVsU3N6eGFoM0NibkF6STFJPSJ9.PzpvU13h6VhN8VHXUTYKAlpDW5t3JaQ-gs895_Q10XshKPYpeZUtViXGHGC-aQSQAYPhhYV-lLia9niXzZz4Qs4ehwFLHJfkmKR8eRwWvoOgJtAY0IIUA_8SeShmoOc9cdpC35N3OeaM4hV9shxvvrphDib5sLpkrv3LQrt3DHvK_L2n0HsybC-pwS7MzaSUIYoU-fXwZo6x3z7IbSaSNwS0P-50qeV99Mc0AUSIvB26GjmjZ2gEH5R3YD9kp0DOrYvE5tIymVHPTqkmunv2OrjKu2UOhNj8Om3RoVzxIkVM89cVGb1u1yB2kxEmXogXPz64cKqQWm22tV-jalS4dAc_1p9A9sKzZ632HxnlavOBjTKDGFgM95gg8M5npXBP3QIvkwW3yervCukViRUKIm-ljpDmnBJsZTMx0uzTaAk5XgoCUCADuLLol8EXB-0V4m2w-6tV6kAzRiwkqw1PRrGqplf-gmfU7TuFlQ142-EZLU5rK_dAiQRXx-f7LxNH",  )"
+    R"(     "fileUrls": {                                          )"
+    R"(         "f483750ebb885d32c": "http://duinstance2.b.nlu.dl.adu.microsoft.com/westus2/duinstance2/e5cc19d5e9174c93ada35cc315f1fb1d/apt-manifest-tree-1.0.json",      )"
+    R"(         "f222b9ffefaaac577": "http://duinstance2.b.nlu.dl.adu.microsoft.com/westus2/duinstance2/31c38c3340a84e38ae8d30ce340f4a49/contoso.contoso-virtual-motors.1.1.updatemanifest.json",  )"
+    R"(         "f2c5d1f3b0295db0f": "http://duinstance2.b.nlu.dl.adu.microsoft.com/westus2/duinstance2/9ff068f7c2bf43eb9561da14a7cbcecd/motor-firmware-1.1.json",         )"
+    R"(         "f13b5435aab7c18da": "http://duinstance2.b.nlu.dl.adu.microsoft.com/westus2/duinstance2/c02058a476a242d7bc0e3c576c180051/contoso-motor-installscript.sh"   )"
+    R"(     }                                                      )"
+    R"( }                                                          )";
+
+const char* action_child_update_0 =
+    R"( { "updateManifest":"{\"manifestVersion\":\"4\",\"updateId\":{\"provider\":\"contoso\",\"name\":\"contoso-virtual-motors\",\"version\":\"1.1\"},\"compatibility\":[{\"group\":\"motors\"}],\"instructions\":{\"steps\":[{\"handler\":\"microsoft/script:1\",\"files\":[\"f13b5435aab7c18da\",\"f2c5d1f3b0295db0f\"],\"handlerProperties\":{\"scriptFileName\":\"contoso-motor-installscript.sh\",\"arguments\":\"--firmware-file motor-firmware-1.1.json --component-name --component-name-val --component-group --component-group-val --component-prop path --component-prop-val path\",\"installedCriteria\":\"contoso-contoso-virtual-motors-1.1-step-1\"}}]},\"files\":{\"f13b5435aab7c18da\":{\"fileName\":\"contoso-motor-installscript.sh\",\"sizeInBytes\":27030,\"hashes\":{\"sha256\":\"DYb4/+P3mq2yjq6n987msufTo3GUb5tpMtk+f7IeHx0=\"}},\"f2c5d1f3b0295db0f\":{\"fileName\":\"motor-firmware-1.1.json\",\"sizeInBytes\":123,\"hashes\":{\"sha256\":\"b8CC9E/93hUuMT19VjGVLDWGShq4GzpMYBO8vzlej74=\"}}},\"createdDateTime\":\"2022-01-27T13:45:05.8836909Z\"}"} )";
+
+// clang-format on
+
+/**
+ * @brief A parent workflow with three child steps.
+ */
+class ParentWorkflow
+{
+public:
+    ADUC_WorkflowHandle handle = nullptr;
+
+    ParentWorkflow()
+    {
+        REQUIRE(IsAducResultCodeSuccess(
+            workflow_init(action_parent_update, false /* validateManifest */, &handle).ResultCode));
+
+        for (int i = 0; i < 3; i++)
+        {
+            ADUC_WorkflowHandle child = nullptr;
+            REQUIRE(IsAducResultCodeSuccess(
+                workflow_init(action_child_update_0, false /* validateManifest */, &child).ResultCode));
+            REQUIRE(workflow_insert_child(handle, -1, child));
+        }
+    }
+
+    ParentWorkflow(const ParentWorkflow&) = delete;
+    ParentWorkflow& operator=(const ParentWorkflow&) = delete;
+    ParentWorkflow(ParentWorkflow&&) = delete;
+    ParentWorkflow& operator=(ParentWorkflow&&) = delete;
+
+    ~ParentWorkflow()
+    {
+        workflow_free(handle);
+    }
+
+    ADUC_WorkflowHandle Step(size_t stepIndex) const
+    {
+        return workflow_get_child(handle, stepIndex);
+    }
+};
+
+/**
+ * @brief Holds the other steps back until the requesting step has made its request.
+ */
+class RequestGate
+{
+public:
+    void Open()
+    {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        _open = true;
+        _cv.notify_all();
+    }
+
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock{ _mutex };
+        _cv.wait(lock, [this]() { return _open; });
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _open{ false };
+};
+
+/**
+ * @brief Installs three steps concurrently. Step @p requestingStep makes a request with @p request; every other
+ * step checks, once the request is made, that it does not see it, and then applies successfully.
+ *
+ * @param workflow The parent workflow.
+ * @param requestingStep The step that makes the request.
+ * @param request Makes the request on the step workflow.
+ * @param[out] otherStepsInterrupted Whether another step saw the request.
+ * @param[out] result The result of InstallStepsConcurrently.
+ * @return StepInstanceAction The action returned by InstallStepsConcurrently.
+ */
+static StepInstanceAction InstallWithRequest(
+    const ParentWorkflow& workflow,
+    size_t requestingStep,
+    const std::function<bool(ADUC_WorkflowHandle)>& request,
+    bool* otherStepsInterrupted,
+    ADUC_Result* result)
+{
+    RequestGate gate;
+    std::mutex interruptedMutex;
+    *otherStepsInterrupted = false;
+
+    auto installStep = [&](ADUC_WorkflowHandle handle, size_t stepIndex, bool* abort) {
+        ADUC_WorkflowHandle stepHandle = workflow_get_child(handle, stepIndex);
+        *abort = false;
+
+        if (stepIndex == requestingStep)
+        {
+            request(stepHandle);
+            gate.Open();
+            return ADUC_Result{ ADUC_Result_Install_Success, 0 };
+        }
+
+        gate.Wait();
+
+        if (workflow_is_reboot_requested(stepHandle) || workflow_is_immediate_reboot_requested(stepHandle)
+            || workflow_is_agent_restart_requested(stepHandle)
+            || workflow_is_immediate_agent_restart_requested(stepHandle))
+        {
+            std::lock_guard<std::mutex> lock{ interruptedMutex };
+            *otherStepsInterrupted = true;
+        }
+
+        return ADUC_Result{ ADUC_Result_Apply_Success, 0 };
+    };
+
+    return InstallStepsConcurrently(workflow.handle, { 0, 1, 2 }, installStep, result);
+}
+
+TEST_CASE("Concurrent steps keep their own reboot and agent restart requests")
+{
+    ParentWorkflow workflow;
+    ADUC_Result result = {};
+    bool otherStepsInterrupted = true;
+
+    SECTION("Immediate reboot")
+    {
+        StepInstanceAction action =
+            InstallWithRequest(workflow, 0, workflow_request_immediate_reboot, &otherStepsInterrupted, &result);
+
+        CHECK(action == StepInstanceAction::Abort);
+        CHECK(result.ResultCode == ADUC_Result_Install_Success);
+        CHECK(workflow_is_immediate_reboot_requested(workflow.handle));
+        CHECK_FALSE(workflow_is_agent_restart_requested(workflow.handle));
+    }
+
+    SECTION("Reboot")
+    {
+        StepInstanceAction action =
+            InstallWithRequest(workflow, 1, workflow_request_reboot, &otherStepsInterrupted, &result);
+
+        CHECK(action == StepInstanceAction::SkipRemainingSteps);
+        CHECK(result.ResultCode == ADUC_Result_Install_Success);
+        CHECK(workflow_is_reboot_requested(workflow.handle));
+        CHECK_FALSE(workflow_is_immediate_reboot_requested(workflow.handle));
+    }
+
+    SECTION("Agent restart")
+    {
+        StepInstanceAction action =
+            InstallWithRequest(workflow, 2, workflow_request_agent_restart, &otherStepsInterrupted, &result);
+
+        CHECK(action == StepInstanceAction::SkipRemainingSteps);
+        CHECK(result.ResultCode == ADUC_Result_Install_Success);
+        CHECK(workflow_is_agent_restart_requested(workflow.handle));
+        CHECK_FALSE(workflow_is_reboot_requested(workflow.handle));
+    }
+
+    CHECK_FALSE(otherStepsInterrupted);
+
+    // The steps that did not make the request applied, and have their results.
+    size_t appliedSteps = 0;
+    for (size_t i = 0; i < 3; i++)
+    {
+        if (workflow_get_result(workflow.Step(i)).ResultCode == ADUC_Result_Apply_Success)
+        {
+            appliedSteps++;
+        }
+    }
+    CHECK(appliedSteps == 2);
+}
+
+TEST_CASE("Concurrent step results are applied in step order")
+{
+    ParentWorkflow workflow;
+    ADUC_Result result = {};
+
+    auto installStep = [](ADUC_WorkflowHandle handle, size_t stepIndex, bool* abort) {
+        *abort = false;
+        if (stepIndex == 1)
+        {
+            workflow_set_result_details(workflow_get_child(handle, stepIndex), "step 1 failed");
+            return ADUC_Result{ ADUC_Result_Failure, 42 };
+        }
+        return ADUC_Result{ ADUC_Result_Apply_Success, 0 };
+    };
+
+    StepInstanceAction action = InstallStepsConcurrently(workflow.handle, { 0, 1, 2 }, installStep, &result);
+
+    CHECK(action == StepInstanceAction::SkipRemainingSteps);
+    CHECK(result.ResultCode == ADUC_Result_Failure);
+    CHECK(result.ExtendedResultCode == 42);
+    CHECK(workflow_get_result(workflow.Step(0)).ResultCode == ADUC_Result_Apply_Success);
+    CHECK(workflow_get_result(workflow.Step(1)).ResultCode == ADUC_Result_Failure);
+    CHECK(workflow_get_result(workflow.Step(2)).ResultCode == ADUC_Result_Apply_Success);
+    CHECK(std::string(workflow_peek_result_details(workflow.handle)) == "step 1 failed");
+}
@@ -648,6 +648,11 @@ MAKE_ADUC_EXTENDEDRESULTCODE_FOR_FACILITY_ADUC_FACILITY_UNUSED_F(const int32_t c
  */
 #define ADUC_ERC_INVAL MAKE_ADUC_EXTENDEDRESULTCODE_FOR_COMPONENT_ERRNO(22)
 
+/**
+ * @brief ADUC_ERC_SHUTDOWN, ERC Value: 108 (0x6c)
+ */
+#define ADUC_ERC_SHUTDOWN MAKE_ADUC_EXTENDEDRESULTCODE_FOR_COMPONENT_ERRNO(108)
+
 /**
  * @brief ADUC_ERC_NOTRECOVERABLE, ERC Value: 131 (0x83)
  */
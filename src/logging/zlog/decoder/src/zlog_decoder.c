@@ -0,0 +1,510 @@
+/**
+ * @file zlog_decoder.c
+ * @brief Rebuilds the text log from zlog binary log files.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "zlog-binary.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+// Must match LOG_FORMAT and PRELUDE_FORMAT in zlog.c.
+#define LOG_FORMAT_PREFIX "%04d-%02d-%02dT%02d:%02d:%02d.%04dZ %d[%d] [%c] "
+#define LOG_FORMAT_SUFFIX " [%.64s:%u]\n"
+
+// The longest conversion specification, with '*' replaced by its value.
+#define MAX_SPEC_LENGTH 64
+
+static const char level_names[] = { 'D', 'I', 'W', 'E' }; // Must align with ZLOG_SEVERITY enum in zlog.h
+
+typedef struct tagDECODER_CALLSITE
+{
+    char* func;
+    char* fmt;
+    unsigned int line;
+    unsigned int level;
+    int arg_count;
+    unsigned char arg_types[ZLOG_BINARY_MAX_ARGS];
+} DECODER_CALLSITE;
+
+typedef struct tagDECODER_ARG
+{
+    uint64_t value;
+    const char* str; // For ZLOG_BINARY_ARG_STRING; NULL for a NULL string.
+    uint32_t str_length;
+} DECODER_ARG;
+
+typedef struct tagDECODER
+{
+    const char* path;
+    int pid;
+    DECODER_CALLSITE callsites[ZLOG_BINARY_MAX_CALLSITES];
+} DECODER;
+
+static uint32_t read_u32(const uint8_t* data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static void reset_callsites(DECODER* decoder)
+{
+    for (size_t i = 0; i < ZLOG_BINARY_MAX_CALLSITES; ++i)
+    {
+        free(decoder->callsites[i].func);
+        free(decoder->callsites[i].fmt);
+    }
+    memset(decoder->callsites, 0, sizeof(decoder->callsites));
+}
+
+static char* copy_string(const char* str, size_t length)
+{
+    char* copy = (char*)malloc(length + 1);
+    if (copy != NULL)
+    {
+        memcpy(copy, str, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+static bool decode_format_record(DECODER* decoder, const uint8_t* body, size_t length)
+{
+    if (length < 3 * sizeof(uint32_t))
+    {
+        return false;
+    }
+
+    const uint32_t id = read_u32(body);
+    const uint32_t level = read_u32(body + 4);
+    const uint32_t line = read_u32(body + 8);
+
+    const char* func = (const char*)body + 12;
+    const size_t strings_length = length - 12;
+    const char* func_end = memchr(func, '\0', strings_length);
+    if (func_end == NULL || id >= ZLOG_BINARY_MAX_CALLSITES || level >= sizeof(level_names))
+    {
+        return false;
+    }
+
+    const char* fmt = func_end + 1;
+    const char* fmt_end = memchr(fmt, '\0', strings_length - (size_t)(fmt - func));
+    if (fmt_end == NULL)
+    {
+        return false;
+    }
+
+    DECODER_CALLSITE* callsite = &decoder->callsites[id];
+    free(callsite->func);
+    free(callsite->fmt);
+
+    callsite->func = copy_string(func, (size_t)(func_end - func));
+    callsite->fmt = copy_string(fmt, (size_t)(fmt_end - fmt));
+    callsite->line = line;
+    callsite->level = level;
+    callsite->arg_count = (callsite->fmt == NULL)
+        ? -1
+        : zlog_binary_parse_format(callsite->fmt, callsite->arg_types, ZLOG_BINARY_MAX_ARGS);
+
+    return callsite->func != NULL && callsite->arg_count >= 0;
+}
+
+// Prints one conversion specification with its argument(s). Returns the number of arguments used.
+static int print_spec(const ZLOG_BINARY_SPEC* spec, const char* spec_text, const DECODER_ARG* args, int arg_count)
+{
+    char format[MAX_SPEC_LENGTH];
+    size_t format_length = 0;
+    int used = 0;
+
+    for (size_t i = 0; i < spec->length; ++i)
+    {
+        if (spec_text[i] == '*')
+        {
+            const int value = (used < arg_count) ? (int)args[used].value : 0;
+            ++used;
+            format_length += (size_t)snprintf(format + format_length, sizeof(format) - format_length, "%d", value);
+        }
+        else if (format_length + 1 < sizeof(format))
+        {
+            format[format_length++] = spec_text[i];
+        }
+
+        if (format_length >= sizeof(format) - 1)
+        {
+            // Too long to be a real conversion specification. Print it as is.
+            printf("%.*s", (int)spec->length, spec_text);
+            return used;
+        }
+    }
+    format[format_length] = '\0';
+
+    if (used >= arg_count)
+    {
+        printf("%.*s", (int)spec->length, spec_text);
+        return used;
+    }
+
+    const DECODER_ARG* arg = &args[used++];
+    const uint64_t v = arg->value;
+
+    switch (spec->type)
+    {
+    case ZLOG_BINARY_ARG_INT:
+        printf(format, (int)(int64_t)v);
+        break;
+    case ZLOG_BINARY_ARG_UINT:
+        printf(format, (unsigned int)v);
+        break;
+    case ZLOG_BINARY_ARG_LONG:
+        printf(format, (long)(int64_t)v);
+        break;
+    case ZLOG_BINARY_ARG_ULONG:
+        printf(format, (unsigned long)v);
+        break;
+    case ZLOG_BINARY_ARG_LLONG:
+        printf(format, (long long)v);
+        break;
+    case ZLOG_BINARY_ARG_SIZE:
+        printf(format, (size_t)v);
+        break;
+    case ZLOG_BINARY_ARG_INTMAX:
+        printf(format, (intmax_t)v);
+        break;
+    case ZLOG_BINARY_ARG_PTRDIFF:
+        printf(format, (ptrdiff_t)(int64_t)v);
+        break;
+    case ZLOG_BINARY_ARG_DOUBLE:
+    {
+        double d;
+        memcpy(&d, &v, sizeof(d));
+        printf(format, d);
+        break;
+    }
+    case ZLOG_BINARY_ARG_POINTER:
+        printf(format, (void*)(uintptr_t)v);
+        break;
+    case ZLOG_BINARY_ARG_STRING:
+    {
+        char* str = (arg->str == NULL) ? NULL : copy_string(arg->str, arg->str_length);
+        printf(format, str == NULL ? "(null)" : str);
+        free(str);
+        break;
+    }
+    default:
+        break;
+    }
+
+    return used;
+}
+
+static void print_message(const char* fmt, const DECODER_ARG* args, int arg_count)
+{
+    int used = 0;
+
+    while (*fmt != '\0')
+    {
+        const char* percent = strchr(fmt, '%');
+        if (percent == NULL)
+        {
+            fputs(fmt, stdout);
+            return;
+        }
+
+        fwrite(fmt, 1, (size_t)(percent - fmt), stdout);
+
+        ZLOG_BINARY_SPEC spec;
+        if (!zlog_binary_scan_spec(percent, &spec))
+        {
+            // Not recorded in binary, so not reached for a valid file.
+            fputs(percent, stdout);
+            return;
+        }
+
+        if (spec.type == ZLOG_BINARY_ARG_NONE)
+        {
+            putchar('%');
+        }
+        else
+        {
+            used += print_spec(&spec, percent, args + used, arg_count - used);
+        }
+
+        fmt = percent + spec.length;
+    }
+}
+
+static bool decode_event_record(DECODER* decoder, const uint8_t* body, size_t length)
+{
+    if (length < ZLOG_BINARY_EVENT_HEADER_SIZE - ZLOG_BINARY_RECORD_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    const uint32_t id = read_u32(body);
+    const uint32_t tid = read_u32(body + 4);
+    int64_t seconds;
+    memcpy(&seconds, body + 8, sizeof(seconds));
+    const uint32_t nanoseconds = read_u32(body + 16);
+
+    if (id >= ZLOG_BINARY_MAX_CALLSITES || decoder->callsites[id].fmt == NULL)
+    {
+        return false;
+    }
+
+    const DECODER_CALLSITE* callsite = &decoder->callsites[id];
+    DECODER_ARG args[ZLOG_BINARY_MAX_ARGS];
+    size_t offset = 20;
+
+    for (int i = 0; i < callsite->arg_count; ++i)
+    {
+        memset(&args[i], 0, sizeof(args[i]));
+
+        if (callsite->arg_types[i] == ZLOG_BINARY_ARG_STRING)
+        {
+            if (offset + 4 > length)
+            {
+                return false;
+            }
+
+            const uint32_t str_length = read_u32(body + offset);
+            offset += 4;
+
+            if (str_length != ZLOG_BINARY_NULL_STRING)
+            {
+                if (offset + str_length > length)
+                {
+                    return false;
+                }
+
+                args[i].str = (const char*)body + offset;
+                args[i].str_length = str_length;
+                offset += str_length;
+            }
+        }
+        else
+        {
+            if (offset + 8 > length)
+            {
+                return false;
+            }
+
+            memcpy(&args[i].value, body + offset, sizeof(args[i].value));
+            offset += 8;
+        }
+    }
+
+    const time_t time_seconds = (time_t)seconds;
+    struct tm gmtval;
+    if (gmtime_r(&time_seconds, &gmtval) == NULL)
+    {
+        memset(&gmtval, 0, sizeof(gmtval));
+    }
+
+    printf(
+        LOG_FORMAT_PREFIX,
+        gmtval.tm_year + 1900,
+        gmtval.tm_mon + 1,
+        gmtval.tm_mday % 100,
+        gmtval.tm_hour % 100,
+        gmtval.tm_min % 100,
+        gmtval.tm_sec % 100,
+        (int)(nanoseconds / 100000),
+        decoder->pid,
+        (int)tid,
+        level_names[callsite->level]);
+
+    print_message(callsite->fmt, args, callsite->arg_count);
+
+    printf(LOG_FORMAT_SUFFIX, callsite->func, callsite->line);
+    return true;
+}
+
+static bool decode_file(DECODER* decoder, const uint8_t* data, size_t size)
+{
+    size_t offset = 0;
+    bool header_seen = false;
+
+    while (offset < size)
+    {
+        // zlog appends to an existing file of the same name, so headers can appear mid-file.
+        if (size - offset >= ZLOG_BINARY_FILE_HEADER_SIZE
+            && memcmp(data + offset, ZLOG_BINARY_MAGIC, ZLOG_BINARY_MAGIC_SIZE) == 0)
+        {
+            if (read_u32(data + offset + ZLOG_BINARY_MAGIC_SIZE) != ZLOG_BINARY_BYTE_ORDER_MARK)
+            {
+                fprintf(stderr, "%s: the file was written with a different byte order.\n", decoder->path);
+                return false;
+            }
+
+            decoder->pid = (int)read_u32(data + offset + ZLOG_BINARY_MAGIC_SIZE + 4);
+            reset_callsites(decoder);
+            header_seen = true;
+            offset += ZLOG_BINARY_FILE_HEADER_SIZE;
+            continue;
+        }
+
+        if (!header_seen)
+        {
+            fprintf(stderr, "%s: not a zlog binary log file.\n", decoder->path);
+            return false;
+        }
+
+        if (size - offset < ZLOG_BINARY_RECORD_HEADER_SIZE)
+        {
+            fprintf(stderr, "%s: truncated record at offset %zu.\n", decoder->path, offset);
+            return false;
+        }
+
+        const uint32_t length = read_u32(data + offset);
+        const uint32_t type = read_u32(data + offset + 4);
+
+        if (length < ZLOG_BINARY_RECORD_HEADER_SIZE || length > size - offset)
+        {
+            fprintf(stderr, "%s: truncated record at offset %zu.\n", decoder->path, offset);
+            return false;
+        }
+
+        const uint8_t* body = data + offset + ZLOG_BINARY_RECORD_HEADER_SIZE;
+        const size_t body_length = length - ZLOG_BINARY_RECORD_HEADER_SIZE;
+        bool valid = true;
+
+        switch (type)
+        {
+        case ZLOG_BINARY_RECORD_FORMAT:
+            valid = decode_format_record(decoder, body, body_length);
+            break;
+
+        case ZLOG_BINARY_RECORD_EVENT:
+            valid = decode_event_record(decoder, body, body_length);
+            break;
+
+        case ZLOG_BINARY_RECORD_TEXT:
+            fwrite(body, 1, body_length, stdout);
+            break;
+
+        default:
+            // Unknown record types are skipped, so that newer files can still be read.
+            break;
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "%s: invalid record at offset %zu.\n", decoder->path, offset);
+        }
+
+        offset += length;
+    }
+
+    return true;
+}
+
+// Reads a binary log file, either as written or compressed by the zlog compressor (.blog.gz).
+static uint8_t* read_file(const char* path, size_t* size)
+{
+    uint8_t* data = NULL;
+    size_t capacity = 0;
+    size_t length = 0;
+
+    // gzread reads uncompressed files as is.
+    gzFile file = gzopen(path, "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    for (;;)
+    {
+        if (length == capacity)
+        {
+            const size_t new_capacity = capacity == 0 ? 64 * 1024 : capacity * 2;
+            uint8_t* new_data = (uint8_t*)realloc(data, new_capacity);
+            if (new_data == NULL)
+            {
+                goto error;
+            }
+            data = new_data;
+            capacity = new_capacity;
+        }
+
+        const int bytes_read = gzread(file, data + length, (unsigned int)(capacity - length));
+        if (bytes_read < 0)
+        {
+            // A truncated compressed file, e.g. copied while being compressed: decode what was read.
+            int errnum = Z_OK;
+            fprintf(stderr, "%s: %s\n", path, gzerror(file, &errnum));
+            if (length == 0)
+            {
+                goto error;
+            }
+            break;
+        }
+
+        if (bytes_read == 0)
+        {
+            break;
+        }
+
+        length += (size_t)bytes_read;
+    }
+
+    gzclose(file);
+    *size = length;
+    return data;
+
+error:
+    gzclose(file);
+    free(data);
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <binary log file>...\n", argv[0]);
+        return 1;
+    }
+
+    DECODER* decoder = (DECODER*)calloc(1, sizeof(DECODER));
+    if (decoder == NULL)
+    {
+        return 1;
+    }
+
+    for (int i = 1; i < argc; ++i)
+    {
+        size_t size = 0;
+        uint8_t* data = read_file(argv[i], &size);
+        if (data == NULL)
+        {
+            fprintf(stderr, "%s: cannot read the file.\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+
+        decoder->path = argv[i];
+        decoder->pid = 0;
+        reset_callsites(decoder);
+
+        if (!decode_file(decoder, data, size))
+        {
+            ret = 1;
+        }
+
+        free(data);
+    }
+
+    reset_callsites(decoder);
+    free(decoder);
+
+    return ret;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file zlog-binary.h
+ * @brief The zlog binary log file format, shared by zlog and the zlog decoder.
+ *
+ * In binary mode, zlog_log does not format lines. It records the callsite id, the
+ * timestamp and the raw arguments, and the decoder rebuilds the text offline.
+ *
+ * A binary log file is a file header followed by records. All integers are in the
+ * byte order of the device; the decoder rejects files whose byte order mark differs.
+ *
+ *   File header:    char magic[8] ZLOG_BINARY_MAGIC, u32 byte order mark, u32 pid
+ *   Record header:  u32 length (including the record header), u32 type
+ *   FORMAT record:  u32 id, u32 level, u32 line, char func[] '\0', char fmt[] '\0'
+ *   EVENT record:   u32 id, u32 tid, i64 seconds, u32 nanoseconds, arguments
+ *   TEXT record:    char text[], a formatted line including the newline
+ *
+ * Each file defines a callsite with a FORMAT record before the first EVENT record
+ * that refers to it. Scalar arguments are stored as 8 bytes: integers sign- or
+ * zero-extended to 64 bits, doubles as is, pointers as their address. Strings are
+ * stored as a u32 length followed by the characters, without a terminator; NULL
+ * strings have the length ZLOG_BINARY_NULL_STRING.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ZLOG_BINARY_H
+#define ZLOG_BINARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "zlog.h"
+
+// Binary log files are named like text log files, with this extension instead of "log".
+#define ZLOG_BINARY_FILE_EXTENSION "blog"
+
+#define ZLOG_BINARY_MAGIC "ZLOGBIN1"
+#define ZLOG_BINARY_MAGIC_SIZE 8
+#define ZLOG_BINARY_BYTE_ORDER_MARK 0x01020304u
+#define ZLOG_BINARY_FILE_HEADER_SIZE (ZLOG_BINARY_MAGIC_SIZE + 4 + 4)
+
+#define ZLOG_BINARY_RECORD_HEADER_SIZE 8
+#define ZLOG_BINARY_EVENT_HEADER_SIZE (ZLOG_BINARY_RECORD_HEADER_SIZE + 4 + 4 + 8 + 4)
+
+#define ZLOG_BINARY_NULL_STRING UINT32_MAX
+
+// Callsites beyond this count are logged as TEXT records.
+#define ZLOG_BINARY_MAX_CALLSITES 4096
+
+// Callsites with more arguments, including '*' widths and precisions, are logged as TEXT records.
+#define ZLOG_BINARY_MAX_ARGS 16
+
+enum ZLOG_BINARY_RECORD_TYPE
+{
+    ZLOG_BINARY_RECORD_FORMAT = 1,
+    ZLOG_BINARY_RECORD_EVENT = 2,
+    ZLOG_BINARY_RECORD_TEXT = 3
+};
+
+// How an argument is read with va_arg. Conversions that cannot be recorded, e.g. %n,
+// %ls or %Lf, make the whole callsite a TEXT callsite.
+enum ZLOG_BINARY_ARG_TYPE
+{
+    ZLOG_BINARY_ARG_NONE, // "%%"
+    ZLOG_BINARY_ARG_INT,
+    ZLOG_BINARY_ARG_UINT,
+    ZLOG_BINARY_ARG_LONG,
+    ZLOG_BINARY_ARG_ULONG,
+    ZLOG_BINARY_ARG_LLONG,
+    ZLOG_BINARY_ARG_SIZE,
+    ZLOG_BINARY_ARG_INTMAX,
+    ZLOG_BINARY_ARG_PTRDIFF,
+    ZLOG_BINARY_ARG_DOUBLE,
+    ZLOG_BINARY_ARG_POINTER,
+    ZLOG_BINARY_ARG_STRING
+};
+
+typedef struct tagZLOG_BINARY_SPEC
+{
+    size_t length; // The length of the conversion specification, including the '%'.
+    bool star_width; // The width is read from an int argument, before the value.
+    bool star_precision; // The precision is read from an int argument, before the value.
+    enum ZLOG_BINARY_ARG_TYPE type; // The value argument.
+} ZLOG_BINARY_SPEC;
+
+EXTERN_C_BEGIN
+
+// Scans the conversion specification that starts at spec[0] == '%'.
+// Returns false if the conversion cannot be recorded in binary.
+bool zlog_binary_scan_spec(const char* spec, ZLOG_BINARY_SPEC* result);
+
+// Gets the va_arg types of the arguments of fmt, in order.
+// Returns the argument count, or -1 if fmt cannot be recorded in binary.
+int zlog_binary_parse_format(const char* fmt, unsigned char* arg_types, int max_args);
+
+EXTERN_C_END
+
+#endif // ZLOG_BINARY_H
@@ -19,22 +19,53 @@
 // in the log directory after a 1 GB update payload was downloaded and installed.
 // The average line length was around 200 chars with a standard deviation of 100,
 // so a value of 328 (41 * 8) was chosen to ensure adequate buffer size and avoid
-// unnecessary flushing and direct FD writes. The majority of logs had between
-// a dozen and 64 lines, with du-agent.* logs having 100-300 lines. A value of
-// 128 was chosen to balance a smaller working set (41 KB) with log responsiveness
-// when tailing logs and allowing for diagnostics upload.
+// unnecessary flushing and direct FD writes. Longer lines are copied to the heap.
 #define ZLOG_BUFFER_LINE_MAXCHARS 328
-#define ZLOG_BUFFER_MAXLINES 128
+
+// Each logging thread owns a ring of ZLOG_RING_MAXLINES lines (21 KB), drained by
+// the writer thread. The majority of logs had between a dozen and 64 lines per
+// burst, so 64 lines absorb a burst while the writer is blocked on a slow disk.
+// Lines logged while the ring is full are dropped and counted.
+// Must be a power of 2.
+#define ZLOG_RING_MAXLINES 64
 
 #define ZLOG_FLUSH_INTERVAL_SEC 30
+
+// The writer thread drains the rings at least this often.
 #define ZLOG_SLEEP_TIME_SEC 2
-// In practice: flush size < .8 * BUFFER_SIZE
-#define ZLOG_BUFFER_FLUSH_MAXLINES (0.8 * ZLOG_BUFFER_MAXLINES)
 
-// Maximum number of log files to keep
-#define ZLOG_MAX_FILE_COUNT 3
+// Wake the writer early once a ring holds this many lines.
+// In practice: wake size < .8 * ZLOG_RING_MAXLINES
+#define ZLOG_RING_WAKE_LINES 48
+
+// Finished log files are compressed in the background (about 8x for text logs), and the
+// oldest are deleted once the finished files exceed ZLOG_MAX_RETAINED_KB on disk, or
+// ZLOG_MAX_FILE_COUNT files. The budget matches the previous 3 uncompressed files.
+#define ZLOG_MAX_RETAINED_KB 150
+
+// Maximum number of finished log files to keep
+#define ZLOG_MAX_FILE_COUNT 64
+
+// The gzip level of compressed log files, 1 (fastest) to 9 (smallest).
+#define ZLOG_COMPRESSION_LEVEL "6"
 
 // Maximum size in KB per logfile.
 #define ZLOG_FILE_MAX_SIZE_KB 50
 
+// Each callsite (function and line) may log a burst of ZLOG_RATE_LIMIT_BURST lines,
+// then ZLOG_RATE_LIMIT_LINES_PER_SEC lines per second. This bounds the flash wear of
+// failure loops, e.g. connection or D2C retries, that log the same line thousands of
+// times. Suppressed lines are summarized as a warning, in the log file and on the console,
+// once the oldest has waited ZLOG_RATE_LIMIT_SUMMARY_SEC.
+#define ZLOG_RATE_LIMIT_BURST 50
+#define ZLOG_RATE_LIMIT_LINES_PER_SEC 1
+#define ZLOG_RATE_LIMIT_SUMMARY_SEC 30
+
+// The most severe level that is rate limited. Warnings and errors are always logged.
+#define ZLOG_RATE_LIMIT_MAX_LEVEL ZLOG_INFO
+
+// The number of callsites tracked by the rate limit. Lines of untracked callsites are not limited.
+// Must be a power of 2.
+#define ZLOG_RATE_LIMIT_TABLE_SIZE 1024
+
 #endif // ZLOG_CONFIG_H
@@ -23,6 +23,13 @@ enum ZLOG_SEVERITY
     ZLOG_ERROR
 };
 
+// The format of the log files
+enum ZLOG_FILE_FORMAT
+{
+    ZLOG_FILE_FORMAT_TEXT,
+    ZLOG_FILE_FORMAT_BINARY // Deferred-format records, see zlog-binary.h
+};
+
 // Start API
 // clang-format off
 #define log_debug(...) zlog_log(ZLOG_DEBUG, __FUNCTION__, __LINE__, __VA_ARGS__) // NOLINT(misc-lambda-function-name)
@@ -43,6 +50,8 @@ enum ZLOG_SEVERITY
 
 EXTERN_C_BEGIN
 
+// set the log file format; call before zlog_init
+void zlog_set_file_format(enum ZLOG_FILE_FORMAT format);
 // initialize zlog log settings
 int zlog_init(
     const char* log_dir,
@@ -53,8 +62,12 @@ int zlog_init(
     enum ZLOG_SEVERITY file_level);
 // finish using the zlog; clean up
 void zlog_finish(void);
-// explicitly flush the buffer in memory
+// explicitly flush the buffered lines; waits until the writer thread has written them
 void zlog_flush_buffer(void);
+// the number of lines dropped because the logging thread's ring was full
+unsigned long zlog_get_dropped_line_count(void);
+// the number of lines suppressed by the per-callsite rate limit
+unsigned long zlog_get_suppressed_line_count(void);
 // log an entry with the function scope and timestamp
 void zlog_log(enum ZLOG_SEVERITY msg_level, const char* func, unsigned int line, const char* fmt, ...);
 
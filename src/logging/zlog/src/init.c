@@ -8,6 +8,8 @@
 #include "aduc/logging.h"
 #include "aduc/system_utils.h"
 #include <stdio.h> // printf
+#include <stdlib.h> // getenv
+#include <string.h> // strcmp
 #include <sys/stat.h> // stat
 
 /**
@@ -80,6 +82,14 @@ void ADUC_Logging_Init(ADUC_LOG_SEVERITY logLevel, const char* filePrefix)
         }
     }
 
+    // DU_AGENT_LOG_FORMAT=binary writes deferred-format binary log files instead of text.
+    // Use the zlog-decoder tool to convert them to text.
+    const char* logFormat = getenv("DU_AGENT_LOG_FORMAT");
+    if (logFormat != NULL && strcmp(logFormat, "binary") == 0)
+    {
+        zlog_set_file_format(ZLOG_FILE_FORMAT_BINARY);
+    }
+
     if (zlog_init(
             ADUC_LOG_FOLDER,
             filePrefix == NULL ? "aduc" : filePrefix,
@@ -8,7 +8,6 @@
  * Licensed under the MIT License.
  */
 
-#include <aducpal/dirent.h>
 #include <aducpal/sys_time.h> // gettimeofday
 #include <aducpal/time.h> // clock_gettime, gmtime_r
 #include <aducpal/unistd.h> // getpid, sleep, syscall
@@ -17,15 +16,19 @@
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> // for strcmp, memset, strlen, etc.
+#include <sys/file.h> // flock
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 
+#include "zlog-binary.h"
 #include "zlog-config.h"
 #include "zlog.h"
+#include "zlog_compressor.h"
 
 typedef enum tagCONSOLE_LOGGING_MODE
 {
@@ -49,21 +52,149 @@ static const char level_names[] = { 'D', 'I', 'W', 'E' }; // Must align with ZLO
 static FILE* zlog_fout = NULL;
 static char* zlog_file_log_dir = NULL;
 static char* zlog_file_log_prefix = NULL;
+
+// The path of zlog_fout. Written on the writer thread, or before it starts.
+static char zlog_file_log_current_path[512];
 static time_t zlog_last_flushed = 0;
+static enum ZLOG_FILE_FORMAT zlog_file_format = ZLOG_FILE_FORMAT_TEXT;
+
+// ------------------------- Per-thread rings -------------------------
+//
+// Each logging thread formats its lines into its own single-producer/single-consumer ring.
+// A dedicated writer thread drains all rings to the log file, so logging threads never
+// block on file I/O. The writer owns zlog_fout, including roll over.
+
+// Wake reasons, see _zlog_wake_writer().
+#define ZLOG_WAKE_DRAIN 0x1
+#define ZLOG_WAKE_FLUSH 0x2
+
+typedef struct tagZLOG_RING_SLOT
+{
+    char* heap_line; // A line longer than ZLOG_BUFFER_LINE_MAXCHARS, owned by the slot. NULL if the line is inline.
+    unsigned int binary_length; // The length of the binary EVENT record in the slot, or 0 for a text line.
+    char line[ZLOG_BUFFER_LINE_MAXCHARS];
+} ZLOG_RING_SLOT;
 
-char _zlog_buffer[ZLOG_BUFFER_MAXLINES][ZLOG_BUFFER_LINE_MAXCHARS];
-static int _zlog_buffer_count = 0;
-static pthread_mutex_t _zlog_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+typedef struct tagZLOG_RING
+{
+    ZLOG_RING_SLOT slots[ZLOG_RING_MAXLINES];
+    unsigned int head; // Next slot to fill. Written by the owner thread only.
+    unsigned int tail; // Next slot to drain. Written by the writer thread only.
+    int orphaned; // Set once the owner thread has exited.
+    struct tagZLOG_RING* next;
+} ZLOG_RING;
+
+static __thread ZLOG_RING* t_zlog_ring = NULL;
+static __thread unsigned int t_zlog_ring_generation = 0;
+
+// The registered rings. New rings are pushed at the head; only the writer thread and zlog_finish unlink rings.
+static ZLOG_RING* _zlog_rings = NULL;
+static pthread_mutex_t _zlog_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Created with the first ring, and deleted by zlog_finish, so that no destructor of an unloaded extension is left.
+static pthread_key_t _zlog_ring_key;
+static bool _zlog_ring_key_created = false;
+// Bumped by zlog_finish, which frees the rings; a thread whose t_zlog_ring_generation differs registers a new ring.
+static unsigned int _zlog_ring_generation = 1;
+
+// Lines that could not be queued since the last drop report, and in total.
+static unsigned long _zlog_dropped_unreported = 0;
+static unsigned long _zlog_dropped_total = 0;
+
+static pthread_t _zlog_writer_thread;
+static bool _zlog_writer_running = false;
+static int _zlog_file_log_enabled = 0;
+static int _zlog_writer_stop = 0;
+static int _zlog_writer_wake = 0;
+static unsigned long _zlog_flush_requested = 0;
+static unsigned long _zlog_flush_completed = 0;
+static pthread_mutex_t _zlog_writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _zlog_writer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _zlog_flush_cond = PTHREAD_COND_INITIALIZER;
+
+// ------------------------- Rate limit -------------------------
+//
+// A token bucket per callsite, keyed on the function name pointer and line. The writer
+// thread summarizes the suppressed lines of each callsite in the log file and on the console.
+// Without a log file, there is no writer: a callsite summarizes its own suppressed lines on the
+// console when it is allowed to log again.
+
+#define ZLOG_RATE_LIMIT_MAX_PROBES 8
+
+typedef struct tagZLOG_RATE_LIMIT
+{
+    const char* func; // NULL if the entry is free. Set once, under the lock.
+    unsigned int line;
+    char lock; // Guards the fields below.
+    uint64_t refilled_ms; // When tokens were last refilled, in monotonic milliseconds.
+    unsigned long tokens_ms; // Tokens, in thousandths of a line.
+    unsigned long suppressed; // Lines suppressed since the last summary.
+    uint64_t first_suppressed_ms;
+} ZLOG_RATE_LIMIT;
+
+static ZLOG_RATE_LIMIT _zlog_rate_limits[ZLOG_RATE_LIMIT_TABLE_SIZE];
+static unsigned long _zlog_suppressed_total = 0;
+
+// ------------------------- Binary callsites -------------------------
+//
+// In binary mode, each distinct (level, function, line, format) gets an id the first time it logs.
+// Threads cache their callsites, so the registry lock is only taken on a cache miss.
+
+#define ZLOG_CALLSITE_TABLE_SIZE (ZLOG_BINARY_MAX_CALLSITES * 2)
+#define ZLOG_CALLSITE_CACHE_SIZE 256
+
+typedef struct tagZLOG_CALLSITE
+{
+    const char* fmt_key; // The format string pointer of the caller.
+    const char* func_key; // The function name pointer of the caller.
+    unsigned int line;
+    enum ZLOG_SEVERITY level;
+    char* fmt; // Copies, so that callsites of an unloaded extension can still be written.
+    char* func;
+    uint32_t id;
+    int arg_count; // -1 if the callsite is logged as text.
+    unsigned char arg_types[ZLOG_BINARY_MAX_ARGS];
+} ZLOG_CALLSITE;
+
+static ZLOG_CALLSITE* _zlog_callsites[ZLOG_BINARY_MAX_CALLSITES]; // By id.
+static ZLOG_CALLSITE* _zlog_callsite_table[ZLOG_CALLSITE_TABLE_SIZE]; // Open addressing, by hash.
+static unsigned int _zlog_callsite_count = 0;
+static pthread_mutex_t _zlog_callsites_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread const ZLOG_CALLSITE* t_zlog_callsite_cache[ZLOG_CALLSITE_CACHE_SIZE];
+// The cache is cleared when this differs from _zlog_ring_generation, as zlog_finish frees the callsites.
+static __thread unsigned int t_zlog_callsite_cache_generation = 0;
+
+// The callsites defined in the current binary log file. Used by the writer thread only.
+static unsigned char _zlog_binary_defined[ZLOG_BINARY_MAX_CALLSITES / 8];
 
 struct tm* get_current_utctime();
 bool get_current_utctime_filename(char* fullpath, size_t fullpath_len);
-static inline void _zlog_buffer_lock(void);
-static inline void _zlog_buffer_unlock(void);
 static void _zlog_roll_over_if_file_size_too_large(size_t additional_log_len);
-static void _zlog_flush_buffer(void);
-static inline char* zlog_lock_and_get_buffer(void);
-static inline void zlog_finish_buffer_and_unlock(void);
-void zlog_ensure_at_most_n_logfiles(int max_num);
+static bool _zlog_start_writer(void);
+static void _zlog_stop_writer(void);
+static void _zlog_count_dropped_line(void);
+static ZLOG_RING_SLOT* _zlog_ring_reserve(void);
+static void _zlog_ring_commit(enum ZLOG_SEVERITY msg_level);
+static void _zlog_free_rings(void);
+static void _zlog_free_callsites(void);
+static void _zlog_open_log_file(const char* fullpath, const char* mode);
+static bool _zlog_rate_limit_allows(
+    const char* func, unsigned int line, unsigned long* unreported, uint64_t* unreported_waited_ms);
+static void _zlog_format_suppressed_message(
+    char* message,
+    size_t message_size,
+    unsigned long suppressed,
+    const char* func,
+    unsigned int line,
+    uint64_t waited_ms);
+static void _zlog_print_console_line(
+    enum ZLOG_SEVERITY msg_level, const char* prelude, const char* message, const char* func, unsigned int line);
+static bool _zlog_log_binary(
+    enum ZLOG_SEVERITY msg_level,
+    const char* func,
+    unsigned int line,
+    const struct timespec* curtime,
+    const char* fmt,
+    va_list va);
 
 static bool zlog_is_file_log_open()
 {
@@ -113,6 +244,11 @@ static bool zlog_term_supports_color()
 
 // ------------------------- Logging Utilities -------------------------
 
+void zlog_set_file_format(enum ZLOG_FILE_FORMAT format)
+{
+    zlog_file_format = format;
+}
+
 // Initialize zlog logging settings:
 // Return true when the settings are initialized exactly as specified
 // Otherwise leave zlog_fout = NULL and return false
@@ -128,6 +264,12 @@ int zlog_init(
     ADUCPAL_gettimeofday(&tv, NULL);
     zlog_last_flushed = tv.tv_sec;
 
+    if (zlog_file_format == ZLOG_FILE_FORMAT_BINARY && console_level < ZLOG_WARN)
+    {
+        // Formatting every line for the console would defeat the binary file format.
+        console_level = ZLOG_WARN;
+    }
+
     memset(&log_setting, 0, sizeof(log_setting));
     log_setting.console_level = console_level;
     log_setting.file_level = file_level;
@@ -177,35 +319,72 @@ int zlog_init(
             return -1;
         }
 
-        zlog_fout = fopen(zlog_file_log_fullpath, "a+");
+        _zlog_open_log_file(zlog_file_log_fullpath, "a+");
         if (zlog_fout == NULL)
         {
             return -1;
         }
-        log_debug("Log file created: %s", zlog_file_log_fullpath);
 
-        zlog_ensure_at_most_n_logfiles(ZLOG_MAX_FILE_COUNT);
+        // Compresses the files of earlier runs and enforces the retention in the background.
+        (void)zlog_compressor_start(zlog_file_log_dir, zlog_file_log_prefix);
+
+        if (!_zlog_start_writer())
+        {
+            zlog_close_file_log();
+            return -1;
+        }
+
+        log_debug("Log file created: %s", zlog_file_log_fullpath);
     }
     return 0;
 }
 
-// Caller should NOT hold the lock
+// Waits until the lines logged so far are written to the log file.
 void zlog_flush_buffer(void)
 {
-    _zlog_buffer_lock();
-    _zlog_flush_buffer();
-    _zlog_buffer_unlock();
+    pthread_mutex_lock(&_zlog_writer_mutex);
+
+    if (_zlog_writer_running)
+    {
+        const unsigned long request = ++_zlog_flush_requested;
+        pthread_cond_signal(&_zlog_writer_cond);
+
+        while (_zlog_writer_running && _zlog_flush_completed < request)
+        {
+            pthread_cond_wait(&_zlog_flush_cond, &_zlog_writer_mutex);
+        }
+    }
+
+    pthread_mutex_unlock(&_zlog_writer_mutex);
+}
+
+unsigned long zlog_get_dropped_line_count(void)
+{
+    return __atomic_load_n(&_zlog_dropped_total, __ATOMIC_RELAXED);
+}
+
+unsigned long zlog_get_suppressed_line_count(void)
+{
+    return __atomic_load_n(&_zlog_suppressed_total, __ATOMIC_RELAXED);
 }
 
-// Caller should NOT hold the lock
 void zlog_finish(void)
 {
-    zlog_flush_buffer();
+    // The writer drains the rings before it exits.
+    _zlog_stop_writer();
 
     zlog_close_file_log();
 
+    zlog_compressor_stop();
+
+    // Leave no thread, thread-local destructor or heap block behind, as an extension is unloaded right after.
+    _zlog_free_rings();
+    _zlog_free_callsites();
+
     free(zlog_file_log_dir);
+    zlog_file_log_dir = NULL;
     free(zlog_file_log_prefix);
+    zlog_file_log_prefix = NULL;
 }
 
 #define MAX_FUNCTION_NAME 64
@@ -233,34 +412,73 @@ void zlog_finish(void)
 // (prelude, level, func, line)
 #define MULTILINE_END_FORMAT "%s [%c] [%s:%u] ==== MULTI-LINE LOG END ====\n\n"
 
-void zlog_log(enum ZLOG_SEVERITY msg_level, const char* func, unsigned int line, const char* fmt, ...)
+// Per-thread ids and prelude, so that most lines neither make syscalls nor format the date.
+typedef struct tagZLOG_PRELUDE_CACHE
 {
-    const bool console_log_needed =
-        (log_setting.console_logging_mode != ZLOG_CLM_DISABLED) && (msg_level >= log_setting.console_level);
-    const bool file_log_needed = zlog_is_file_log_open() && (msg_level >= log_setting.file_level);
+    unsigned int fork_generation; // The ids are refreshed when this differs from _zlog_fork_generation.
+    pid_t pid;
+    pid_t tid;
+    time_t seconds; // The second that prelude was formatted for.
+    size_t fraction_offset; // The offset of the 4 sub-second digits in prelude.
+    char prelude[PRELUDE_BUFFER_SIZE];
+} ZLOG_PRELUDE_CACHE;
+
+static __thread ZLOG_PRELUDE_CACHE t_zlog_prelude_cache;
+static unsigned int _zlog_fork_generation = 1;
+static pthread_once_t _zlog_atfork_once = PTHREAD_ONCE_INIT;
+
+// The child of fork() has a new pid, and its thread a new tid.
+static void _zlog_atfork_child(void)
+{
+    __atomic_add_fetch(&_zlog_fork_generation, 1, __ATOMIC_RELAXED);
+}
 
-    if (!console_log_needed && !file_log_needed)
+static void _zlog_register_atfork(void)
+{
+    (void)pthread_atfork(NULL, NULL, _zlog_atfork_child);
+}
+
+static ZLOG_PRELUDE_CACHE* _zlog_get_prelude_cache(void)
+{
+    ZLOG_PRELUDE_CACHE* cache = &t_zlog_prelude_cache;
+    const unsigned int fork_generation = __atomic_load_n(&_zlog_fork_generation, __ATOMIC_RELAXED);
+
+    if (cache->fork_generation != fork_generation)
     {
-        // If we're not logging to console or file, there's nothing to do.
-        return;
+        (void)pthread_once(&_zlog_atfork_once, _zlog_register_atfork);
+
+        cache->fork_generation = fork_generation;
+        cache->pid = ADUCPAL_getpid();
+        cache->tid = (pid_t)ADUCPAL_syscall(SYS_gettid); /* cannot call gettid() directly */
+        cache->seconds = (time_t)-1;
     }
 
-    char prelude_buffer[PRELUDE_BUFFER_SIZE];
-    prelude_buffer[0] = '\0';
+    return cache;
+}
 
-    struct timespec curtime;
-    ADUCPAL_clock_gettime(CLOCK_REALTIME, &curtime);
+// Formats the prelude of a line logged at curtime by the calling thread.
+// The date is formatted once per second per thread; only the sub-second digits are patched per line.
+// Returns false on failure.
+static bool _zlog_format_prelude(char* prelude_buffer, const struct timespec* curtime)
+{
+    ZLOG_PRELUDE_CACHE* cache = _zlog_get_prelude_cache();
 
-    const time_t seconds = curtime.tv_sec;
+    if (cache->seconds != curtime->tv_sec)
+    {
+        const time_t seconds = curtime->tv_sec;
 
-    struct tm gmtval;
-    struct tm* tmval = ADUCPAL_gmtime_r(&seconds, &gmtval);
+        struct tm gmtval;
+        struct tm* tmval = ADUCPAL_gmtime_r(&seconds, &gmtval);
+
+        if (tmval == NULL)
+        {
+            prelude_buffer[0] = '\0';
+            return true;
+        }
 
-    if (tmval != NULL)
-    {
         // % 100 below to ensure the values fit in 2-digits template.
         int ret = snprintf(
-            prelude_buffer,
+            cache->prelude,
             PRELUDE_BUFFER_SIZE,
             PRELUDE_FORMAT,
             tmval->tm_year + 1900,
@@ -269,15 +487,121 @@ void zlog_log(enum ZLOG_SEVERITY msg_level, const char* func, unsigned int line,
             tmval->tm_hour % 100,
             tmval->tm_min % 100,
             tmval->tm_sec % 100,
-            (int)(curtime.tv_nsec / 100000),
-            ADUCPAL_getpid(),
-            (pid_t)ADUCPAL_syscall(SYS_gettid) /* cannot call gettid() directly */
-        );
+            0,
+            cache->pid,
+            cache->tid);
 
-        if (ret < 0)
+        const char* fraction = strchr(cache->prelude, '.');
+        if (ret < 0 || fraction == NULL)
         {
-            return;
+            return false;
         }
+
+        cache->fraction_offset = (size_t)(fraction + 1 - cache->prelude);
+        cache->seconds = seconds;
+    }
+
+    memcpy(prelude_buffer, cache->prelude, PRELUDE_BUFFER_SIZE);
+
+    unsigned int fraction = (unsigned int)(curtime->tv_nsec / 100000);
+    for (int i = 3; i >= 0; --i)
+    {
+        prelude_buffer[cache->fraction_offset + (size_t)i] = (char)('0' + (fraction % 10));
+        fraction /= 10;
+    }
+
+    return true;
+}
+
+static void
+_zlog_get_console_colors(enum ZLOG_SEVERITY msg_level, const char** color_prefix, const char** color_suffix)
+{
+    if (log_setting.console_logging_mode != ZLOG_CLM_ENABLED_TTYCOLOR)
+    {
+        *color_prefix = "";
+        *color_suffix = "";
+        return;
+    }
+
+    // Use Bold Red for error, Bold Yellow for warn.
+    *color_prefix = (msg_level == ZLOG_ERROR) ? "\033[1;31m" : (msg_level == ZLOG_WARN) ? "\033[1;33m" : "";
+    *color_suffix = "\033[m";
+}
+
+static void _zlog_print_console_line(
+    enum ZLOG_SEVERITY msg_level, const char* prelude, const char* message, const char* func, unsigned int line)
+{
+    const char* color_prefix;
+    const char* color_suffix;
+    _zlog_get_console_colors(msg_level, &color_prefix, &color_suffix);
+
+    fprintf(
+        msg_level == ZLOG_ERROR ? stderr : stdout,
+        "%s %s[%c]%s %s [%s:%u]\n",
+        prelude,
+        color_prefix,
+        level_names[msg_level],
+        color_suffix,
+        message,
+        func,
+        line);
+}
+
+void zlog_log(enum ZLOG_SEVERITY msg_level, const char* func, unsigned int line, const char* fmt, ...)
+{
+    const bool console_log_needed =
+        (log_setting.console_logging_mode != ZLOG_CLM_DISABLED) && (msg_level >= log_setting.console_level);
+    bool file_log_needed =
+        __atomic_load_n(&_zlog_file_log_enabled, __ATOMIC_ACQUIRE) && (msg_level >= log_setting.file_level);
+
+    if (!console_log_needed && !file_log_needed)
+    {
+        // If we're not logging to console or file, there's nothing to do.
+        return;
+    }
+
+    // With a log file, the writer summarizes the suppressed lines; without one, this callsite does.
+    unsigned long unreported_suppressed = 0;
+    uint64_t unreported_waited_ms = 0;
+    const bool writer_reports = __atomic_load_n(&_zlog_file_log_enabled, __ATOMIC_ACQUIRE) != 0;
+
+    if (msg_level <= ZLOG_RATE_LIMIT_MAX_LEVEL
+        && !_zlog_rate_limit_allows(
+            func,
+            line,
+            writer_reports ? NULL : &unreported_suppressed,
+            writer_reports ? NULL : &unreported_waited_ms))
+    {
+        return;
+    }
+
+    char prelude_buffer[PRELUDE_BUFFER_SIZE];
+    prelude_buffer[0] = '\0';
+
+    struct timespec curtime;
+    ADUCPAL_clock_gettime(CLOCK_REALTIME, &curtime);
+
+    if (file_log_needed && zlog_file_format == ZLOG_FILE_FORMAT_BINARY)
+    {
+        va_list binary_va;
+        va_start(binary_va, fmt);
+        const bool recorded = _zlog_log_binary(msg_level, func, line, &curtime, fmt, binary_va);
+        va_end(binary_va);
+
+        if (recorded)
+        {
+            file_log_needed = false;
+
+            if (!console_log_needed)
+            {
+                return;
+            }
+        }
+    }
+
+    if (!_zlog_format_prelude(prelude_buffer, &curtime))
+    {
+        return;
     }
 
     char va_buffer[LOG_CONTENT_BUFFER_SIZE];
@@ -303,21 +627,18 @@ void zlog_log(enum ZLOG_SEVERITY msg_level, const char* func, unsigned int line,
     {
         // Output to console
 
-        const char* color_prefix;
-        const char* color_suffix;
-
-        if (log_setting.console_logging_mode != ZLOG_CLM_ENABLED_TTYCOLOR)
-        {
-            color_prefix = "";
-            color_suffix = "";
-        }
-        else
+        if (unreported_suppressed != 0 && ZLOG_WARN >= log_setting.console_level)
         {
-            // Use Bold Red for error, Bold Yellow for warn.
-            color_prefix = (msg_level == ZLOG_ERROR) ? "\033[1;31m" : (msg_level == ZLOG_WARN) ? "\033[1;33m" : "";
-            color_suffix = "\033[m";
+            char message[192];
+            _zlog_format_suppressed_message(
+                message, sizeof(message), unreported_suppressed, func, line, unreported_waited_ms);
+            _zlog_print_console_line(ZLOG_WARN, prelude_buffer, message, __func__, __LINE__);
         }
 
+        const char* color_prefix;
+        const char* color_suffix;
+        _zlog_get_console_colors(msg_level, &color_prefix, &color_suffix);
+
         FILE* output = msg_level == ZLOG_ERROR ? stderr : stdout;
 
         if (log_truncated)
@@ -333,28 +654,24 @@ void zlog_log(enum ZLOG_SEVERITY msg_level, const char* func, unsigned int line,
         }
         else
         {
-            fprintf(
-                msg_level == ZLOG_ERROR ? stderr : stdout,
-                "%s %s[%c]%s %s [%s:%u]\n",
-                prelude_buffer,
-                color_prefix,
-                level_names[msg_level],
-                color_suffix,
-                va_buffer,
-                func,
-                line);
+            _zlog_print_console_line(msg_level, prelude_buffer, va_buffer, func, line);
         }
     }
 
     if (file_log_needed)
     {
-        if ((full_log_len + RESERVED_INFO_SIZE) < ZLOG_BUFFER_LINE_MAXCHARS)
+        ZLOG_RING_SLOT* slot = _zlog_ring_reserve();
+        if (slot == NULL)
         {
-            // The log can fit in one line. Just add to zlog buffer.
-            char* buffer = zlog_lock_and_get_buffer();
+            // The ring is full. The line is dropped and counted.
+            return;
+        }
 
+        if ((full_log_len + RESERVED_INFO_SIZE) < ZLOG_BUFFER_LINE_MAXCHARS)
+        {
+            // The log can fit in one line.
             (void)snprintf(
-                buffer,
+                slot->line,
                 ZLOG_BUFFER_LINE_MAXCHARS,
                 LOG_FORMAT,
                 prelude_buffer,
@@ -362,55 +679,44 @@ void zlog_log(enum ZLOG_SEVERITY msg_level, const char* func, unsigned int line,
                 va_buffer,
                 func,
                 line);
-
-            zlog_finish_buffer_and_unlock();
         }
         else
         {
-            // The log is too long, let's flush the buffer then write to log file directly.
-            _zlog_buffer_lock();
-            _zlog_flush_buffer();
+            // The log is too long for a slot, so format it to the heap. The writer frees it.
+            const size_t heap_line_size = full_log_len + sizeof(MULTILINE_BEGIN_FORMAT) + sizeof(MULTILINE_END_FORMAT)
+                + (PRELUDE_BUFFER_SIZE + MAX_FUNCTION_NAME) * 2;
+
+            char* heap_line = (char*)malloc(heap_line_size);
+            if (heap_line == NULL)
+            {
+                _zlog_count_dropped_line();
+                return;
+            }
 
-            _zlog_roll_over_if_file_size_too_large(
-                full_log_len + sizeof(MULTILINE_BEGIN_FORMAT) + sizeof(MULTILINE_END_FORMAT)
-                + (PRELUDE_BUFFER_SIZE + MAX_FUNCTION_NAME) * 2);
-            fprintf(zlog_fout, MULTILINE_BEGIN_FORMAT, prelude_buffer, level_names[msg_level], func, line);
+            int offset = snprintf(
+                heap_line, heap_line_size, MULTILINE_BEGIN_FORMAT, prelude_buffer, level_names[msg_level], func, line);
 
             va_start(va, fmt);
-            (void)vfprintf(zlog_fout, fmt, va);
+            offset += vsnprintf(heap_line + offset, heap_line_size - (size_t)offset, fmt, va);
             va_end(va);
 
-            fprintf(zlog_fout, MULTILINE_END_FORMAT, prelude_buffer, level_names[msg_level], func, line);
-            fflush(zlog_fout);
+            (void)snprintf(
+                heap_line + offset,
+                heap_line_size - (size_t)offset,
+                MULTILINE_END_FORMAT,
+                prelude_buffer,
+                level_names[msg_level],
+                func,
+                line);
 
-            _zlog_buffer_unlock();
+            slot->heap_line = heap_line;
         }
-    }
 
-    if (msg_level == ZLOG_ERROR || (seconds - zlog_last_flushed) >= ZLOG_FLUSH_INTERVAL_SEC)
-    {
-        zlog_flush_buffer();
-        zlog_last_flushed = seconds;
+        _zlog_ring_commit(msg_level);
     }
 }
 
 // ------------------------- Helper Functions ---------------------------
-static int file_select(const struct dirent* logfile)
-{
-    // Filter: 1. File and 2. filename contains the log file pattern
-    return (logfile->d_type == DT_REG && strstr(logfile->d_name, zlog_file_log_prefix) != NULL);
-}
-
-static inline void _zlog_buffer_lock(void)
-{
-    pthread_mutex_lock(&_zlog_buffer_mutex);
-}
-
-static inline void _zlog_buffer_unlock(void)
-{
-    pthread_mutex_unlock(&_zlog_buffer_mutex);
-}
-
 bool get_current_utctime_filename(char* fullpath, size_t fullpath_len)
 {
     // Timestamp the log file
@@ -419,7 +725,14 @@ bool get_current_utctime_filename(char* fullpath, size_t fullpath_len)
     const struct tm* tm = gmtime(&current_time);
 
     strftime(timebuf, sizeof(timebuf), "%Y%m%d-%H%M%S", tm);
-    int res = snprintf(fullpath, fullpath_len, "%s/%s%s.log", zlog_file_log_dir, zlog_file_log_prefix, timebuf);
+    int res = snprintf(
+        fullpath,
+        fullpath_len,
+        "%s/%s%s.%s",
+        zlog_file_log_dir,
+        zlog_file_log_prefix,
+        timebuf,
+        zlog_file_format == ZLOG_FILE_FORMAT_BINARY ? ZLOG_BINARY_FILE_EXTENSION : "log");
     if (res < 0 || res >= fullpath_len)
     {
         // When error occurs to snprintf filepath, return false
@@ -447,11 +760,6 @@ static void _zlog_roll_over_if_file_size_too_large(size_t additional_log_len)
     // Roll over to new log file once the current file size exceeds the limit
     if (((size_t)ftellVal + additional_log_len) > (ZLOG_FILE_MAX_SIZE_KB * 1024))
     {
-        zlog_close_file_log();
-
-        // Clean up the log folder
-        zlog_ensure_at_most_n_logfiles(ZLOG_MAX_FILE_COUNT);
-
         // Timestamp the new log file
         char zlog_file_log_fullpath[512];
         if (!get_current_utctime_filename(zlog_file_log_fullpath, sizeof(zlog_file_log_fullpath)))
@@ -459,89 +767,921 @@ static void _zlog_roll_over_if_file_size_too_large(size_t additional_log_len)
             return;
         }
 
+        // Within the same second, keep appending to the current file rather than reopening
+        // it, so the compressor never picks up a file that is about to be written again.
+        if (strcmp(zlog_file_log_fullpath, zlog_file_log_current_path) == 0)
+        {
+            return;
+        }
+
+        zlog_close_file_log();
+
+        // Compress the finished file and clean up the log folder
+        zlog_compressor_notify();
+
         // INVARIANT: zlog_fout == NULL due to zlog_close_file_log() call above.
-        zlog_fout = fopen(zlog_file_log_fullpath, "a");
+        _zlog_open_log_file(zlog_file_log_fullpath, "a");
+    }
+}
+
+// ------------------------- Rate limit ---------------------------------
+
+static uint64_t _zlog_monotonic_ms(void)
+{
+    struct timespec now;
+    ADUCPAL_clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+static void _zlog_rate_limit_lock(ZLOG_RATE_LIMIT* entry)
+{
+    while (__atomic_test_and_set(&entry->lock, __ATOMIC_ACQUIRE))
+    {
+        // Held for a few instructions only.
+    }
+}
+
+static void _zlog_rate_limit_unlock(ZLOG_RATE_LIMIT* entry)
+{
+    __atomic_clear(&entry->lock, __ATOMIC_RELEASE);
+}
+
+// Finds or claims the entry of a callsite, and returns it locked. Returns NULL if the table is full.
+static ZLOG_RATE_LIMIT* _zlog_rate_limit_lock_entry(const char* func, unsigned int line)
+{
+    const unsigned int hash = (unsigned int)(((uintptr_t)func >> 3) ^ ((uintptr_t)line * 2654435761u));
+
+    for (unsigned int probe = 0; probe < ZLOG_RATE_LIMIT_MAX_PROBES; ++probe)
+    {
+        ZLOG_RATE_LIMIT* entry = &_zlog_rate_limits[(hash + probe) & (ZLOG_RATE_LIMIT_TABLE_SIZE - 1)];
+
+        const char* entry_func = __atomic_load_n(&entry->func, __ATOMIC_ACQUIRE);
+        if (entry_func != NULL && (entry_func != func || entry->line != line))
+        {
+            continue;
+        }
+
+        _zlog_rate_limit_lock(entry);
+
+        if (entry->func == NULL)
+        {
+            entry->line = line;
+            entry->refilled_ms = _zlog_monotonic_ms();
+            entry->tokens_ms = ZLOG_RATE_LIMIT_BURST * 1000UL;
+            entry->suppressed = 0;
+            __atomic_store_n(&entry->func, func, __ATOMIC_RELEASE);
+        }
+
+        if (entry->func == func && entry->line == line)
+        {
+            return entry;
+        }
+
+        // Claimed by another callsite meanwhile.
+        _zlog_rate_limit_unlock(entry);
+    }
+
+    return NULL;
+}
+
+// Takes a token from the bucket of the callsite. Returns false if the line must be suppressed.
+// If unreported is not NULL, an allowed line takes the count of the lines suppressed before it,
+// and how long ago the first of them was, to be summarized by the caller.
+static bool _zlog_rate_limit_allows(
+    const char* func, unsigned int line, unsigned long* unreported, uint64_t* unreported_waited_ms)
+{
+    if (func == NULL)
+    {
+        return true;
+    }
+
+    ZLOG_RATE_LIMIT* entry = _zlog_rate_limit_lock_entry(func, line);
+    if (entry == NULL)
+    {
+        return true;
+    }
+
+    const uint64_t now_ms = _zlog_monotonic_ms();
+    const uint64_t elapsed_ms = now_ms - entry->refilled_ms;
+    const unsigned long max_tokens_ms = ZLOG_RATE_LIMIT_BURST * 1000UL;
+
+    // Each elapsed millisecond adds ZLOG_RATE_LIMIT_LINES_PER_SEC thousandths of a line.
+    if (elapsed_ms >= (max_tokens_ms - entry->tokens_ms) / ZLOG_RATE_LIMIT_LINES_PER_SEC)
+    {
+        entry->tokens_ms = max_tokens_ms;
+    }
+    else
+    {
+        entry->tokens_ms += (unsigned long)elapsed_ms * ZLOG_RATE_LIMIT_LINES_PER_SEC;
+    }
+    entry->refilled_ms = now_ms;
+
+    bool allowed = true;
+    if (entry->tokens_ms >= 1000)
+    {
+        entry->tokens_ms -= 1000;
+
+        if (unreported != NULL && entry->suppressed != 0)
+        {
+            *unreported = entry->suppressed;
+            *unreported_waited_ms = now_ms - entry->first_suppressed_ms;
+            entry->suppressed = 0;
+        }
+    }
+    else
+    {
+        if (entry->suppressed == 0)
+        {
+            entry->first_suppressed_ms = now_ms;
+        }
+        ++entry->suppressed;
+        allowed = false;
+    }
+
+    _zlog_rate_limit_unlock(entry);
+
+    if (!allowed)
+    {
+        __atomic_fetch_add(&_zlog_suppressed_total, 1, __ATOMIC_RELAXED);
+    }
+
+    return allowed;
+}
+
+// ------------------------- Ring and writer ----------------------------
+
+// Counts a line that could not be queued. Reported to the log file by the writer.
+static void _zlog_count_dropped_line(void)
+{
+    __atomic_fetch_add(&_zlog_dropped_unreported, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&_zlog_dropped_total, 1, __ATOMIC_RELAXED);
+}
+
+// Wakes the writer thread, unless it was already woken for the same reason.
+static void _zlog_wake_writer(int reason)
+{
+    if ((__atomic_fetch_or(&_zlog_writer_wake, reason, __ATOMIC_ACQ_REL) & reason) == 0)
+    {
+        pthread_mutex_lock(&_zlog_writer_mutex);
+        pthread_cond_signal(&_zlog_writer_cond);
+        pthread_mutex_unlock(&_zlog_writer_mutex);
+    }
+}
+
+// Called when the owner thread of a ring exits. The writer frees the ring once drained.
+static void _zlog_orphan_ring(void* ring)
+{
+    __atomic_store_n(&((ZLOG_RING*)ring)->orphaned, 1, __ATOMIC_RELEASE);
+
+    // Lines logged later by other thread-local destructors go to a new ring.
+    t_zlog_ring = NULL;
+}
+
+// Gets the ring of the calling thread, registering one on first use.
+static ZLOG_RING* _zlog_get_thread_ring(void)
+{
+    const unsigned int generation = __atomic_load_n(&_zlog_ring_generation, __ATOMIC_ACQUIRE);
+    if (t_zlog_ring != NULL && t_zlog_ring_generation == generation)
+    {
+        return t_zlog_ring;
+    }
+
+    ZLOG_RING* ring = (ZLOG_RING*)calloc(1, sizeof(*ring));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&_zlog_rings_mutex);
+
+    if (!_zlog_ring_key_created)
+    {
+        _zlog_ring_key_created = (pthread_key_create(&_zlog_ring_key, _zlog_orphan_ring) == 0);
+    }
+
+    if (_zlog_ring_key_created)
+    {
+        (void)pthread_setspecific(_zlog_ring_key, ring);
+    }
+
+    ring->next = _zlog_rings;
+    __atomic_store_n(&_zlog_rings, ring, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&_zlog_rings_mutex);
+
+    t_zlog_ring = ring;
+    t_zlog_ring_generation = generation;
+    return ring;
+}
+
+// Frees all rings, once the writer has drained them, and deletes the ring key.
+// Lines must not be logged to the file while this runs; zlog_finish has disabled file logging.
+static void _zlog_free_rings(void)
+{
+    pthread_mutex_lock(&_zlog_rings_mutex);
+
+    ZLOG_RING* ring = _zlog_rings;
+    __atomic_store_n(&_zlog_rings, NULL, __ATOMIC_RELEASE);
+
+    // Threads that still point to a freed ring register a new one if zlog is initialized again.
+    __atomic_add_fetch(&_zlog_ring_generation, 1, __ATOMIC_RELEASE);
+
+    if (_zlog_ring_key_created)
+    {
+        // Threads that exit later must not call _zlog_orphan_ring, whose code may be unloaded by then.
+        (void)pthread_key_delete(_zlog_ring_key);
+        _zlog_ring_key_created = false;
+    }
+
+    pthread_mutex_unlock(&_zlog_rings_mutex);
+
+    while (ring != NULL)
+    {
+        ZLOG_RING* next = ring->next;
+
+        for (unsigned int i = 0; i < ZLOG_RING_MAXLINES; ++i)
+        {
+            free(ring->slots[i].heap_line);
+        }
+
+        free(ring);
+        ring = next;
+    }
+}
+
+// Gets the next free slot of the calling thread's ring, or NULL if the ring is full.
+// Call _zlog_ring_commit() once the slot is filled.
+static ZLOG_RING_SLOT* _zlog_ring_reserve(void)
+{
+    ZLOG_RING* ring = _zlog_get_thread_ring();
+    if (ring == NULL)
+    {
+        _zlog_count_dropped_line();
+        return NULL;
+    }
+
+    if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ZLOG_RING_MAXLINES)
+    {
+        _zlog_count_dropped_line();
+        _zlog_wake_writer(ZLOG_WAKE_DRAIN);
+        return NULL;
+    }
+
+    ZLOG_RING_SLOT* slot = &ring->slots[ring->head & (ZLOG_RING_MAXLINES - 1)];
+    slot->heap_line = NULL;
+    slot->binary_length = 0;
+    return slot;
+}
+
+// Publishes the slot returned by _zlog_ring_reserve() to the writer.
+static void _zlog_ring_commit(enum ZLOG_SEVERITY msg_level)
+{
+    ZLOG_RING* ring = t_zlog_ring;
+    const unsigned int head = ring->head + 1;
+
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+    if (msg_level == ZLOG_ERROR)
+    {
+        // Errors are written and flushed promptly, without waiting for the flush interval.
+        _zlog_wake_writer(ZLOG_WAKE_DRAIN | ZLOG_WAKE_FLUSH);
+    }
+    else if (head - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) >= ZLOG_RING_WAKE_LINES)
+    {
+        _zlog_wake_writer(ZLOG_WAKE_DRAIN);
+    }
+}
+
+// Called on the writer thread.
+static void _zlog_write_line(const char* line)
+{
+    const size_t length = strlen(line);
+
+    if (zlog_file_format == ZLOG_FILE_FORMAT_BINARY)
+    {
+        _zlog_roll_over_if_file_size_too_large(ZLOG_BINARY_RECORD_HEADER_SIZE + length);
+
+        if (zlog_is_file_log_open())
+        {
+            const uint32_t header[2] = { (uint32_t)(ZLOG_BINARY_RECORD_HEADER_SIZE + length),
+                                         ZLOG_BINARY_RECORD_TEXT };
+            fwrite(header, sizeof(header), 1, zlog_fout);
+            fwrite(line, 1, length, zlog_fout);
+        }
+        return;
+    }
+
+    _zlog_roll_over_if_file_size_too_large(length);
+
+    // Roll over fails if the new log file cannot be created.
+    if (zlog_is_file_log_open())
+    {
+        fputs(line, zlog_fout);
     }
 }
 
-// Caller should hold the lock
-static void _zlog_flush_buffer()
+// The length of the FORMAT record of callsite.
+static size_t _zlog_format_record_length(const ZLOG_CALLSITE* callsite)
 {
+    return ZLOG_BINARY_RECORD_HEADER_SIZE + (3 * sizeof(uint32_t)) + strlen(callsite->func) + 1 + strlen(callsite->fmt)
+        + 1;
+}
+
+// Writes an EVENT record, preceded by the FORMAT record of its callsite if this file does not define it yet.
+// Called on the writer thread.
+static void _zlog_write_event(const uint8_t* record, size_t length)
+{
+    uint32_t id;
+    memcpy(&id, record + ZLOG_BINARY_RECORD_HEADER_SIZE, sizeof(id));
+
+    const ZLOG_CALLSITE* callsite = __atomic_load_n(&_zlog_callsites[id], __ATOMIC_ACQUIRE);
+    const bool defined = (_zlog_binary_defined[id / 8] & (1u << (id % 8))) != 0;
+
+    // Roll over first, so that the definition and the event land in the same file.
+    _zlog_roll_over_if_file_size_too_large(length + (defined ? 0 : _zlog_format_record_length(callsite)));
+
     if (!zlog_is_file_log_open())
     {
         return;
     }
 
-    // Flush buffer to file
-    int i = 0;
-    for (i = 0; i < _zlog_buffer_count; i++)
+    // Roll over clears the definitions.
+    if ((_zlog_binary_defined[id / 8] & (1u << (id % 8))) == 0)
     {
-        _zlog_roll_over_if_file_size_too_large(strlen(_zlog_buffer[i]));
-        fputs(_zlog_buffer[i], zlog_fout);
+        const uint32_t header[5] = { (uint32_t)_zlog_format_record_length(callsite),
+                                     ZLOG_BINARY_RECORD_FORMAT,
+                                     callsite->id,
+                                     (uint32_t)callsite->level,
+                                     callsite->line };
+        fwrite(header, sizeof(header), 1, zlog_fout);
+        fwrite(callsite->func, 1, strlen(callsite->func) + 1, zlog_fout);
+        fwrite(callsite->fmt, 1, strlen(callsite->fmt) + 1, zlog_fout);
+
+        _zlog_binary_defined[id / 8] |= (unsigned char)(1u << (id % 8));
     }
-    fflush(zlog_fout);
 
-    _zlog_buffer_count = 0;
+    fwrite(record, 1, length, zlog_fout);
+}
+
+// Writes the queued lines of all rings, and frees the rings of exited threads.
+// Called on the writer thread.
+static void _zlog_drain_rings(void)
+{
+    ZLOG_RING* ring = __atomic_load_n(&_zlog_rings, __ATOMIC_ACQUIRE);
+
+    while (ring != NULL)
+    {
+        // Load orphaned before head, so that an orphaned ring is drained completely.
+        const int orphaned = __atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE);
+        const unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        unsigned int tail = ring->tail;
+
+        for (; tail != head; ++tail)
+        {
+            ZLOG_RING_SLOT* slot = &ring->slots[tail & (ZLOG_RING_MAXLINES - 1)];
+
+            const char* data = (slot->heap_line != NULL) ? slot->heap_line : slot->line;
 
-    _zlog_roll_over_if_file_size_too_large(0);
+            if (slot->binary_length != 0)
+            {
+                _zlog_write_event((const uint8_t*)data, slot->binary_length);
+            }
+            else
+            {
+                _zlog_write_line(data);
+            }
+
+            free(slot->heap_line);
+            slot->heap_line = NULL;
+        }
+
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        ZLOG_RING* next = ring->next;
+
+        if (orphaned)
+        {
+            // Rings are only pushed at the head, so unlink under the lock.
+            pthread_mutex_lock(&_zlog_rings_mutex);
+            ZLOG_RING** link = &_zlog_rings;
+            while (*link != ring)
+            {
+                link = &(*link)->next;
+            }
+            *link = next;
+            pthread_mutex_unlock(&_zlog_rings_mutex);
+
+            free(ring);
+        }
+
+        ring = next;
+    }
 }
 
-// Caller should NOT hold the lock
-static inline char* zlog_lock_and_get_buffer(void)
+// Writes a warning line for the lines dropped since the last report.
+// Called on the writer thread.
+static void _zlog_report_dropped_lines(void)
 {
-    _zlog_buffer_lock();
-    // Flush the buffer if it is full
-    if (_zlog_buffer_count == ZLOG_BUFFER_MAXLINES)
+    const unsigned long dropped = __atomic_exchange_n(&_zlog_dropped_unreported, 0, __ATOMIC_ACQ_REL);
+    if (dropped == 0)
     {
-        _zlog_flush_buffer();
+        return;
+    }
+
+    char prelude_buffer[PRELUDE_BUFFER_SIZE];
+    prelude_buffer[0] = '\0';
+
+    struct timespec curtime;
+    ADUCPAL_clock_gettime(CLOCK_REALTIME, &curtime);
+    (void)_zlog_format_prelude(prelude_buffer, &curtime);
+
+    char message[128];
+    (void)snprintf(
+        message,
+        sizeof(message),
+        "Dropped %lu log lines because a logging thread's ring was full (%lu in total).",
+        dropped,
+        zlog_get_dropped_line_count());
+
+    char line[ZLOG_BUFFER_LINE_MAXCHARS];
+    (void)snprintf(line, sizeof(line), LOG_FORMAT, prelude_buffer, level_names[ZLOG_WARN], message, __func__, __LINE__);
+
+    _zlog_write_line(line);
+}
+
+static void _zlog_format_suppressed_message(
+    char* message,
+    size_t message_size,
+    unsigned long suppressed,
+    const char* func,
+    unsigned int line,
+    uint64_t waited_ms)
+{
+    (void)snprintf(
+        message,
+        message_size,
+        "Suppressed %lu repeated lines from %.64s:%u in %lu seconds (per-callsite rate limit).",
+        suppressed,
+        func,
+        line,
+        (unsigned long)(waited_ms / 1000));
+}
+
+// Summarizes the lines suppressed by the rate limit, for callsites whose oldest suppressed
+// line has waited ZLOG_RATE_LIMIT_SUMMARY_SEC, or for all callsites on stop.
+static void _zlog_report_suppressed_lines(bool all)
+{
+    const uint64_t now_ms = _zlog_monotonic_ms();
+
+    for (unsigned int i = 0; i < ZLOG_RATE_LIMIT_TABLE_SIZE; ++i)
+    {
+        ZLOG_RATE_LIMIT* entry = &_zlog_rate_limits[i];
+        if (__atomic_load_n(&entry->func, __ATOMIC_ACQUIRE) == NULL)
+        {
+            continue;
+        }
+
+        _zlog_rate_limit_lock(entry);
+
+        const unsigned long suppressed = entry->suppressed;
+        const uint64_t waited_ms = now_ms - entry->first_suppressed_ms;
+        const bool report = suppressed != 0 && (all || waited_ms >= ZLOG_RATE_LIMIT_SUMMARY_SEC * 1000UL);
+        if (report)
+        {
+            entry->suppressed = 0;
+        }
+
+        _zlog_rate_limit_unlock(entry);
+
+        if (!report)
+        {
+            continue;
+        }
+
+        char prelude_buffer[PRELUDE_BUFFER_SIZE];
+        prelude_buffer[0] = '\0';
+
+        struct timespec curtime;
+        ADUCPAL_clock_gettime(CLOCK_REALTIME, &curtime);
+        (void)_zlog_format_prelude(prelude_buffer, &curtime);
+
+        char message[192];
+        _zlog_format_suppressed_message(message, sizeof(message), suppressed, entry->func, entry->line, waited_ms);
+
+        // The suppressed lines were kept from every sink.
+        if (log_setting.console_logging_mode != ZLOG_CLM_DISABLED && ZLOG_WARN >= log_setting.console_level)
+        {
+            _zlog_print_console_line(ZLOG_WARN, prelude_buffer, message, __func__, __LINE__);
+        }
+
+        char line[ZLOG_BUFFER_LINE_MAXCHARS];
+        (void)snprintf(
+            line, sizeof(line), LOG_FORMAT, prelude_buffer, level_names[ZLOG_WARN], message, __func__, __LINE__);
+
+        _zlog_write_line(line);
+    }
+}
+
+static void* _zlog_writer_main(void* arg)
+{
+    (void)arg;
+
+    unsigned long flush_completed = 0;
+    bool stop = false;
+
+    while (!stop)
+    {
+        pthread_mutex_lock(&_zlog_writer_mutex);
+
+        if (!_zlog_writer_stop && _zlog_flush_requested == flush_completed
+            && __atomic_load_n(&_zlog_writer_wake, __ATOMIC_ACQUIRE) == 0)
+        {
+            struct timespec deadline;
+            ADUCPAL_clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += ZLOG_SLEEP_TIME_SEC;
+
+            (void)pthread_cond_timedwait(&_zlog_writer_cond, &_zlog_writer_mutex, &deadline);
+        }
+
+        stop = (_zlog_writer_stop != 0);
+        const unsigned long flush_requested = _zlog_flush_requested;
+        const int wake = __atomic_exchange_n(&_zlog_writer_wake, 0, __ATOMIC_ACQ_REL);
+
+        pthread_mutex_unlock(&_zlog_writer_mutex);
+
+        _zlog_drain_rings();
+        _zlog_report_dropped_lines();
+        _zlog_report_suppressed_lines(stop);
+
+        const time_t now = time(NULL);
+
+        if (stop || (wake & ZLOG_WAKE_FLUSH) != 0 || flush_requested != flush_completed
+            || (now - zlog_last_flushed) >= ZLOG_FLUSH_INTERVAL_SEC)
+        {
+            if (zlog_is_file_log_open())
+            {
+                fflush(zlog_fout);
+            }
+            zlog_last_flushed = now;
+        }
+
+        if (flush_requested != flush_completed)
+        {
+            flush_completed = flush_requested;
+
+            pthread_mutex_lock(&_zlog_writer_mutex);
+            _zlog_flush_completed = flush_completed;
+            pthread_cond_broadcast(&_zlog_flush_cond);
+            pthread_mutex_unlock(&_zlog_writer_mutex);
+        }
     }
 
-    // allocate buffer
-    _zlog_buffer_count++;
-    return _zlog_buffer[_zlog_buffer_count - 1];
+    return NULL;
 }
 
-// Caller should hold the lock
-static inline void zlog_finish_buffer_and_unlock()
+static bool _zlog_start_writer(void)
 {
-#ifdef ZLOG_FORCE_FLUSH_BUFFER
-    _zlog_flush_buffer();
-#endif
-    _zlog_buffer_unlock();
+    _zlog_writer_stop = 0;
+
+    if (pthread_create(&_zlog_writer_thread, NULL, _zlog_writer_main, NULL) != 0)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&_zlog_writer_mutex);
+    _zlog_writer_running = true;
+    pthread_mutex_unlock(&_zlog_writer_mutex);
+
+    __atomic_store_n(&_zlog_file_log_enabled, 1, __ATOMIC_RELEASE);
+    return true;
 }
 
-// Clean up until max of num old log files left
-// Caller should hold the lock
-void zlog_ensure_at_most_n_logfiles(int max_num)
+static void _zlog_stop_writer(void)
 {
-    struct dirent** logfiles;
+    // Stop queuing lines for the file before the final drain.
+    __atomic_store_n(&_zlog_file_log_enabled, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&_zlog_writer_mutex);
+    const bool running = _zlog_writer_running;
+    _zlog_writer_stop = 1;
+    pthread_cond_signal(&_zlog_writer_cond);
+    pthread_mutex_unlock(&_zlog_writer_mutex);
 
-    // List the files specified by file_select in alphabetical order
-    const int total = ADUCPAL_scandir(zlog_file_log_dir, &logfiles, file_select, ADUCPAL_alphasort);
-    if (total == -1)
+    if (!running)
     {
         return;
     }
 
-    if (total > max_num)
+    pthread_join(_zlog_writer_thread, NULL);
+
+    pthread_mutex_lock(&_zlog_writer_mutex);
+    _zlog_writer_running = false;
+    pthread_cond_broadcast(&_zlog_flush_cond);
+    pthread_mutex_unlock(&_zlog_writer_mutex);
+}
+
+// Opens the log file, and writes the file header in binary mode.
+// Called on the writer thread, or before it starts.
+static void _zlog_open_log_file(const char* fullpath, const char* mode)
+{
+    zlog_fout = fopen(fullpath, mode);
+
+    if (snprintf(zlog_file_log_current_path, sizeof(zlog_file_log_current_path), "%s", fullpath)
+        >= (int)sizeof(zlog_file_log_current_path))
+    {
+        zlog_file_log_current_path[0] = '\0';
+    }
+
+    // The compressor skips files that are locked, i.e. still being written by a process.
+    if (zlog_fout != NULL)
+    {
+        (void)flock(fileno(zlog_fout), LOCK_SH | LOCK_NB);
+    }
+
+    if (zlog_fout != NULL && zlog_file_format == ZLOG_FILE_FORMAT_BINARY)
+    {
+        const uint32_t header[2] = { ZLOG_BINARY_BYTE_ORDER_MARK, (uint32_t)ADUCPAL_getpid() };
+
+        fwrite(ZLOG_BINARY_MAGIC, 1, ZLOG_BINARY_MAGIC_SIZE, zlog_fout);
+        fwrite(header, sizeof(header), 1, zlog_fout);
+
+        memset(_zlog_binary_defined, 0, sizeof(_zlog_binary_defined));
+    }
+}
+
+// ------------------------- Binary logging -----------------------------
+
+static unsigned int _zlog_callsite_hash(const char* func, unsigned int line, const char* fmt)
+{
+    uintptr_t hash = (uintptr_t)fmt ^ ((uintptr_t)func << 7) ^ ((uintptr_t)line * 2654435761u);
+    hash ^= hash >> 15;
+    hash ^= hash >> 7;
+    return (unsigned int)hash;
+}
+
+static bool _zlog_callsite_matches(
+    const ZLOG_CALLSITE* callsite, enum ZLOG_SEVERITY level, const char* func, unsigned int line, const char* fmt)
+{
+    // Compare the strings too, in case an unloaded extension's address is reused.
+    return callsite->fmt_key == fmt && callsite->func_key == func && callsite->line == line
+        && callsite->level == level && strcmp(callsite->fmt, fmt) == 0 && strcmp(callsite->func, func) == 0;
+}
+
+static char* _zlog_copy_string(const char* str)
+{
+    const size_t size = strlen(str) + 1;
+    char* copy = (char*)malloc(size);
+    if (copy != NULL)
+    {
+        memcpy(copy, str, size);
+    }
+    return copy;
+}
+
+// Finds the callsite in the registry, adding it if needed. Returns NULL if the registry is full.
+static const ZLOG_CALLSITE* _zlog_find_or_add_callsite(
+    unsigned int hash, enum ZLOG_SEVERITY level, const char* func, unsigned int line, const char* fmt)
+{
+    ZLOG_CALLSITE* result = NULL;
+    ZLOG_CALLSITE** entry = NULL;
+
+    pthread_mutex_lock(&_zlog_callsites_mutex);
+
+    // The table is at most half full, so probing ends at an empty entry.
+    for (unsigned int i = hash;; ++i)
     {
-        // Delete until only max_num of files left
-        for (int i = 0; i < total - max_num; ++i)
+        entry = &_zlog_callsite_table[i & (ZLOG_CALLSITE_TABLE_SIZE - 1)];
+        if (*entry == NULL)
         {
-            char filepath[512];
-            const unsigned int max_filepath = sizeof(filepath) / sizeof(filepath[0]);
-            int res = snprintf(filepath, max_filepath, "%s/%s", zlog_file_log_dir, logfiles[i]->d_name);
-            if (res > 0 && res < (int)max_filepath)
+            break;
+        }
+
+        if (_zlog_callsite_matches(*entry, level, func, line, fmt))
+        {
+            result = *entry;
+            goto done;
+        }
+    }
+
+    if (_zlog_callsite_count >= ZLOG_BINARY_MAX_CALLSITES)
+    {
+        goto done;
+    }
+
+    result = (ZLOG_CALLSITE*)calloc(1, sizeof(*result));
+    if (result == NULL)
+    {
+        goto done;
+    }
+
+    result->fmt = _zlog_copy_string(fmt);
+    result->func = _zlog_copy_string(func);
+    if (result->fmt == NULL || result->func == NULL)
+    {
+        free(result->fmt);
+        free(result->func);
+        free(result);
+        result = NULL;
+        goto done;
+    }
+
+    result->fmt_key = fmt;
+    result->func_key = func;
+    result->line = line;
+    result->level = level;
+    result->id = _zlog_callsite_count++;
+    result->arg_count = zlog_binary_parse_format(fmt, result->arg_types, ZLOG_BINARY_MAX_ARGS);
+
+    __atomic_store_n(&_zlog_callsites[result->id], result, __ATOMIC_RELEASE);
+    *entry = result;
+
+done:
+    pthread_mutex_unlock(&_zlog_callsites_mutex);
+    return result;
+}
+
+// Frees the registered callsites. Called by zlog_finish, once the writer has exited.
+static void _zlog_free_callsites(void)
+{
+    pthread_mutex_lock(&_zlog_callsites_mutex);
+
+    for (unsigned int id = 0; id < _zlog_callsite_count; ++id)
+    {
+        free(_zlog_callsites[id]->fmt);
+        free(_zlog_callsites[id]->func);
+        free(_zlog_callsites[id]);
+        _zlog_callsites[id] = NULL;
+    }
+
+    memset(_zlog_callsite_table, 0, sizeof(_zlog_callsite_table));
+    _zlog_callsite_count = 0;
+
+    pthread_mutex_unlock(&_zlog_callsites_mutex);
+}
+
+// Gets the binary callsite of a log call, or NULL if the call must be logged as text.
+static const ZLOG_CALLSITE*
+_zlog_get_callsite(enum ZLOG_SEVERITY level, const char* func, unsigned int line, const char* fmt)
+{
+    const unsigned int generation = __atomic_load_n(&_zlog_ring_generation, __ATOMIC_ACQUIRE);
+    if (t_zlog_callsite_cache_generation != generation)
+    {
+        memset(t_zlog_callsite_cache, 0, sizeof(t_zlog_callsite_cache));
+        t_zlog_callsite_cache_generation = generation;
+    }
+
+    const unsigned int hash = _zlog_callsite_hash(func, line, fmt);
+    const ZLOG_CALLSITE** cached = &t_zlog_callsite_cache[hash & (ZLOG_CALLSITE_CACHE_SIZE - 1)];
+    const ZLOG_CALLSITE* callsite = *cached;
+
+    if (callsite == NULL || !_zlog_callsite_matches(callsite, level, func, line, fmt))
+    {
+        callsite = _zlog_find_or_add_callsite(hash, level, func, line, fmt);
+        if (callsite == NULL)
+        {
+            return NULL;
+        }
+
+        *cached = callsite;
+    }
+
+    return callsite->arg_count < 0 ? NULL : callsite;
+}
+
+// Appends data to an encoded record, if it fits. Returns the offset past data.
+static size_t _zlog_put(uint8_t* buffer, size_t size, size_t offset, const void* data, size_t length)
+{
+    if (offset + length <= size)
+    {
+        memcpy(buffer + offset, data, length);
+    }
+    return offset + length;
+}
+
+// Encodes the EVENT record of a log call into buffer.
+// Returns the record length; when larger than size, the record did not fit and buffer is incomplete.
+static size_t _zlog_encode_event(
+    uint8_t* buffer, size_t size, const ZLOG_CALLSITE* callsite, const struct timespec* curtime, va_list va)
+{
+    const uint32_t tid = (uint32_t)_zlog_get_prelude_cache()->tid;
+    const int64_t seconds = (int64_t)curtime->tv_sec;
+    const uint32_t nanoseconds = (uint32_t)curtime->tv_nsec;
+
+    size_t offset = ZLOG_BINARY_RECORD_HEADER_SIZE;
+    offset = _zlog_put(buffer, size, offset, &callsite->id, sizeof(callsite->id));
+    offset = _zlog_put(buffer, size, offset, &tid, sizeof(tid));
+    offset = _zlog_put(buffer, size, offset, &seconds, sizeof(seconds));
+    offset = _zlog_put(buffer, size, offset, &nanoseconds, sizeof(nanoseconds));
+
+    for (int i = 0; i < callsite->arg_count; ++i)
+    {
+        uint64_t value = 0;
+
+        switch (callsite->arg_types[i])
+        {
+        case ZLOG_BINARY_ARG_INT:
+            value = (uint64_t)(int64_t)va_arg(va, int);
+            break;
+        case ZLOG_BINARY_ARG_UINT:
+            value = (uint64_t)va_arg(va, unsigned int);
+            break;
+        case ZLOG_BINARY_ARG_LONG:
+            value = (uint64_t)(int64_t)va_arg(va, long);
+            break;
+        case ZLOG_BINARY_ARG_ULONG:
+            value = (uint64_t)va_arg(va, unsigned long);
+            break;
+        case ZLOG_BINARY_ARG_LLONG:
+            value = (uint64_t)va_arg(va, long long);
+            break;
+        case ZLOG_BINARY_ARG_SIZE:
+            value = (uint64_t)va_arg(va, size_t);
+            break;
+        case ZLOG_BINARY_ARG_INTMAX:
+            value = (uint64_t)va_arg(va, intmax_t);
+            break;
+        case ZLOG_BINARY_ARG_PTRDIFF:
+            value = (uint64_t)(int64_t)va_arg(va, ptrdiff_t);
+            break;
+        case ZLOG_BINARY_ARG_DOUBLE:
+        {
+            const double d = va_arg(va, double);
+            memcpy(&value, &d, sizeof(value));
+            break;
+        }
+        case ZLOG_BINARY_ARG_POINTER:
+            value = (uint64_t)(uintptr_t)va_arg(va, void*);
+            break;
+        case ZLOG_BINARY_ARG_STRING:
+        {
+            const char* str = va_arg(va, const char*);
+            const uint32_t length = (str == NULL) ? ZLOG_BINARY_NULL_STRING : (uint32_t)strlen(str);
+
+            offset = _zlog_put(buffer, size, offset, &length, sizeof(length));
+            if (str != NULL)
             {
-                remove(filepath);
+                offset = _zlog_put(buffer, size, offset, str, length);
             }
+            continue;
+        }
+        default:
+            break;
         }
+
+        offset = _zlog_put(buffer, size, offset, &value, sizeof(value));
     }
 
-    // Free memory allocated by scandir.
-    for (int i = 0; i < total; ++i)
+    const uint32_t header[2] = { (uint32_t)offset, ZLOG_BINARY_RECORD_EVENT };
+    (void)_zlog_put(buffer, size, 0, header, sizeof(header));
+
+    return offset;
+}
+
+// Queues the EVENT record of a log call, or drops and counts it if the ring is full.
+// Returns false if the call must be logged as text.
+static bool _zlog_log_binary(
+    enum ZLOG_SEVERITY msg_level,
+    const char* func,
+    unsigned int line,
+    const struct timespec* curtime,
+    const char* fmt,
+    va_list va)
+{
+    const ZLOG_CALLSITE* callsite = _zlog_get_callsite(msg_level, func, line, fmt);
+    if (callsite == NULL)
+    {
+        return false;
+    }
+
+    ZLOG_RING_SLOT* slot = _zlog_ring_reserve();
+    if (slot == NULL)
     {
-        free(logfiles[i]);
+        return true;
     }
-    free(logfiles);
+
+    va_list args;
+    va_copy(args, va);
+    const size_t length = _zlog_encode_event((uint8_t*)slot->line, sizeof(slot->line), callsite, curtime, args);
+    va_end(args);
+
+    if (length > sizeof(slot->line))
+    {
+        // Long string arguments. Encode again to the heap; the writer frees it.
+        uint8_t* record = (uint8_t*)malloc(length);
+        if (record == NULL)
+        {
+            _zlog_count_dropped_line();
+            return true;
+        }
+
+        va_copy(args, va);
+        (void)_zlog_encode_event(record, length, callsite, curtime, args);
+        va_end(args);
+
+        slot->heap_line = (char*)record;
+    }
+
+    slot->binary_length = (unsigned int)length;
+    _zlog_ring_commit(msg_level);
+    return true;
 }
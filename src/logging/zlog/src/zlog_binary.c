@@ -0,0 +1,195 @@
+/**
+ * @file zlog_binary.c
+ * @brief Parses printf format strings for the zlog binary log format.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "zlog-binary.h"
+
+#include <string.h> // strchr
+
+bool zlog_binary_scan_spec(const char* spec, ZLOG_BINARY_SPEC* result)
+{
+    const char* p = spec + 1;
+
+    memset(result, 0, sizeof(*result));
+
+    if (*p == '%')
+    {
+        result->length = 2;
+        result->type = ZLOG_BINARY_ARG_NONE;
+        return true;
+    }
+
+    // Flags. '\'' is the thousands grouping flag of glibc.
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+    {
+        ++p;
+    }
+
+    // Width.
+    if (*p == '*')
+    {
+        result->star_width = true;
+        ++p;
+    }
+    else
+    {
+        while (*p >= '0' && *p <= '9')
+        {
+            ++p;
+        }
+    }
+
+    // Precision.
+    if (*p == '.')
+    {
+        ++p;
+        if (*p == '*')
+        {
+            result->star_precision = true;
+            ++p;
+        }
+        else
+        {
+            while (*p >= '0' && *p <= '9')
+            {
+                ++p;
+            }
+        }
+    }
+
+    // Length modifier.
+    char length_modifier = '\0';
+    if (p[0] == 'h' && p[1] == 'h')
+    {
+        length_modifier = 'H';
+        p += 2;
+    }
+    else if (p[0] == 'l' && p[1] == 'l')
+    {
+        length_modifier = 'q';
+        p += 2;
+    }
+    else if (*p != '\0' && strchr("hljztL", *p) != NULL)
+    {
+        length_modifier = *p;
+        ++p;
+    }
+
+    const char conversion = *p;
+    if (conversion == '\0')
+    {
+        return false;
+    }
+
+    result->length = (size_t)(p - spec) + 1;
+
+    switch (conversion)
+    {
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+    {
+        const bool is_signed = (conversion == 'd' || conversion == 'i');
+        switch (length_modifier)
+        {
+        case '\0':
+        case 'H':
+        case 'h':
+            result->type = is_signed ? ZLOG_BINARY_ARG_INT : ZLOG_BINARY_ARG_UINT;
+            return true;
+        case 'l':
+            result->type = is_signed ? ZLOG_BINARY_ARG_LONG : ZLOG_BINARY_ARG_ULONG;
+            return true;
+        case 'q':
+            result->type = ZLOG_BINARY_ARG_LLONG;
+            return true;
+        case 'j':
+            result->type = ZLOG_BINARY_ARG_INTMAX;
+            return true;
+        case 'z':
+            result->type = ZLOG_BINARY_ARG_SIZE;
+            return true;
+        case 't':
+            result->type = ZLOG_BINARY_ARG_PTRDIFF;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    case 'c':
+        result->type = ZLOG_BINARY_ARG_INT;
+        return length_modifier == '\0';
+
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        result->type = ZLOG_BINARY_ARG_DOUBLE;
+        return length_modifier == '\0' || length_modifier == 'l';
+
+    case 's':
+        result->type = ZLOG_BINARY_ARG_STRING;
+        return length_modifier == '\0';
+
+    case 'p':
+        result->type = ZLOG_BINARY_ARG_POINTER;
+        return length_modifier == '\0';
+
+    default:
+        // %n, and anything unknown.
+        return false;
+    }
+}
+
+int zlog_binary_parse_format(const char* fmt, unsigned char* arg_types, int max_args)
+{
+    int count = 0;
+
+    for (const char* p = strchr(fmt, '%'); p != NULL; p = strchr(p, '%'))
+    {
+        ZLOG_BINARY_SPEC spec;
+        if (!zlog_binary_scan_spec(p, &spec))
+        {
+            return -1;
+        }
+
+        p += spec.length;
+
+        if (spec.type == ZLOG_BINARY_ARG_NONE)
+        {
+            continue;
+        }
+
+        const int needed = 1 + (spec.star_width ? 1 : 0) + (spec.star_precision ? 1 : 0);
+        if (count + needed > max_args)
+        {
+            return -1;
+        }
+
+        if (spec.star_width)
+        {
+            arg_types[count++] = ZLOG_BINARY_ARG_INT;
+        }
+
+        if (spec.star_precision)
+        {
+            arg_types[count++] = ZLOG_BINARY_ARG_INT;
+        }
+
+        arg_types[count++] = (unsigned char)spec.type;
+    }
+
+    return count;
+}
@@ -0,0 +1,403 @@
+/**
+ * @file zlog_compressor.c
+ * @brief Compresses finished zlog files in the background and enforces the log retention.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "zlog_compressor.h"
+
+#include <aducpal/dirent.h> // ADUCPAL_scandir, ADUCPAL_alphasort
+
+#include <fcntl.h> // open
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h> // flock
+#include <sys/stat.h>
+#include <unistd.h> // close
+#include <zlib.h>
+
+#include "zlog-config.h"
+
+#define ZLOG_TEMP_FILE_EXTENSION ".tmp"
+
+static char* _zlog_compressor_dir = NULL;
+static char* _zlog_compressor_prefix = NULL;
+
+static pthread_t _zlog_compressor_thread;
+static bool _zlog_compressor_running = false;
+static bool _zlog_compressor_stop = false;
+static bool _zlog_compressor_pending = false;
+static pthread_mutex_t _zlog_compressor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _zlog_compressor_cond = PTHREAD_COND_INITIALIZER;
+
+static bool has_suffix(const char* str, const char* suffix)
+{
+    const size_t length = strlen(str);
+    const size_t suffix_length = strlen(suffix);
+    return length >= suffix_length && strcmp(str + length - suffix_length, suffix) == 0;
+}
+
+static int file_select(const struct dirent* logfile)
+{
+    // Filter: 1. File and 2. filename contains the log file pattern
+    return (logfile->d_type == DT_REG && strstr(logfile->d_name, _zlog_compressor_prefix) != NULL);
+}
+
+// Opens path and takes an exclusive lock on it, or returns -1 if the file is in use or cannot be opened.
+static int open_and_lock_unused_file(const char* path)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Appends the file at from_path to the file at to_path.
+static bool append_file(const char* from_path, const char* to_path)
+{
+    char buffer[16 * 1024];
+    bool success = false;
+
+    FILE* from = fopen(from_path, "rb");
+    FILE* to = fopen(to_path, "ab");
+    if (from == NULL || to == NULL)
+    {
+        goto done;
+    }
+
+    size_t bytes_read = 0;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), from)) > 0)
+    {
+        if (fwrite(buffer, 1, bytes_read, to) != bytes_read)
+        {
+            goto done;
+        }
+    }
+
+    success = !ferror(from);
+
+done:
+    if (from != NULL)
+    {
+        fclose(from);
+    }
+
+    if (to != NULL && fclose(to) != 0)
+    {
+        success = false;
+    }
+
+    return success;
+}
+
+// Compresses path to path.gz, then deletes path. Skips files in use.
+// Log files rolled over within the same second share a name; the compressed data of the
+// later file is appended to path.gz as another gzip member, which gunzip reads in order.
+static void compress_file(const char* path)
+{
+    char compressed_path[512];
+    char temp_path[512];
+    char buffer[16 * 1024];
+    bool success = false;
+    gzFile out = NULL;
+    FILE* in = NULL;
+
+    int res = snprintf(compressed_path, sizeof(compressed_path), "%s%s", path, ZLOG_COMPRESSED_FILE_EXTENSION);
+    if (res < 0 || (size_t)res >= sizeof(compressed_path))
+    {
+        return;
+    }
+
+    res = snprintf(temp_path, sizeof(temp_path), "%s%s", compressed_path, ZLOG_TEMP_FILE_EXTENSION);
+    if (res < 0 || (size_t)res >= sizeof(temp_path))
+    {
+        return;
+    }
+
+    const int fd = open_and_lock_unused_file(path);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    // in owns fd, and the lock, from here.
+    in = fdopen(fd, "rb");
+    if (in == NULL)
+    {
+        close(fd);
+        return;
+    }
+
+    out = gzopen(temp_path, "wb" ZLOG_COMPRESSION_LEVEL);
+    if (out == NULL)
+    {
+        goto done;
+    }
+
+    size_t bytes_read = 0;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    {
+        if (gzwrite(out, buffer, (unsigned int)bytes_read) != (int)bytes_read)
+        {
+            goto done;
+        }
+    }
+
+    if (ferror(in))
+    {
+        goto done;
+    }
+
+    const int close_result = gzclose(out);
+    out = NULL;
+
+    if (close_result == Z_OK)
+    {
+        struct stat st;
+        if (stat(compressed_path, &st) == 0)
+        {
+            success = append_file(temp_path, compressed_path);
+            remove(temp_path);
+        }
+        else
+        {
+            success = (rename(temp_path, compressed_path) == 0);
+        }
+    }
+
+done:
+    if (out != NULL)
+    {
+        (void)gzclose(out);
+    }
+
+    if (success)
+    {
+        remove(path);
+    }
+    else
+    {
+        remove(temp_path);
+    }
+
+    fclose(in);
+}
+
+// Compresses the finished log files. Files are listed in alphabetical, i.e. chronological, order.
+static void compress_finished_files(struct dirent** logfiles, int total)
+{
+    for (int i = 0; i < total; ++i)
+    {
+        const char* name = logfiles[i]->d_name;
+        if (has_suffix(name, ZLOG_COMPRESSED_FILE_EXTENSION) || has_suffix(name, ZLOG_TEMP_FILE_EXTENSION))
+        {
+            continue;
+        }
+
+        char path[512];
+        int res = snprintf(path, sizeof(path), "%s/%s", _zlog_compressor_dir, name);
+        if (res > 0 && (size_t)res < sizeof(path))
+        {
+            compress_file(path);
+        }
+    }
+}
+
+// Deletes the oldest finished log files until they fit ZLOG_MAX_RETAINED_KB and ZLOG_MAX_FILE_COUNT.
+static void enforce_retention(void)
+{
+    struct dirent** logfiles;
+
+    // List the files specified by file_select in alphabetical order
+    const int total = ADUCPAL_scandir(_zlog_compressor_dir, &logfiles, file_select, ADUCPAL_alphasort);
+    if (total == -1)
+    {
+        return;
+    }
+
+    off_t* sizes = (off_t*)calloc((size_t)total + 1, sizeof(off_t));
+    if (sizes != NULL)
+    {
+        off_t retained_bytes = 0;
+        int retained_files = 0;
+
+        // Files in use are neither counted nor deleted.
+        for (int i = 0; i < total; ++i)
+        {
+            char path[512];
+            struct stat st;
+            int res = snprintf(path, sizeof(path), "%s/%s", _zlog_compressor_dir, logfiles[i]->d_name);
+            if (res < 0 || (size_t)res >= sizeof(path) || stat(path, &st) != 0)
+            {
+                sizes[i] = -1;
+                continue;
+            }
+
+            const int fd = open_and_lock_unused_file(path);
+            if (fd < 0)
+            {
+                sizes[i] = -1;
+                continue;
+            }
+            close(fd);
+
+            sizes[i] = st.st_size;
+            retained_bytes += st.st_size;
+            ++retained_files;
+        }
+
+        for (int i = 0; i < total; ++i)
+        {
+            if (retained_bytes <= (off_t)ZLOG_MAX_RETAINED_KB * 1024 && retained_files <= ZLOG_MAX_FILE_COUNT)
+            {
+                break;
+            }
+
+            if (sizes[i] < 0)
+            {
+                continue;
+            }
+
+            char path[512];
+            int res = snprintf(path, sizeof(path), "%s/%s", _zlog_compressor_dir, logfiles[i]->d_name);
+            if (res > 0 && (size_t)res < sizeof(path) && remove(path) == 0)
+            {
+                retained_bytes -= sizes[i];
+                --retained_files;
+            }
+        }
+
+        free(sizes);
+    }
+
+    // Free memory allocated by scandir.
+    for (int i = 0; i < total; ++i)
+    {
+        free(logfiles[i]);
+    }
+    free(logfiles);
+}
+
+static void compress_and_enforce_retention(void)
+{
+    struct dirent** logfiles;
+
+    const int total = ADUCPAL_scandir(_zlog_compressor_dir, &logfiles, file_select, ADUCPAL_alphasort);
+    if (total != -1)
+    {
+        compress_finished_files(logfiles, total);
+
+        for (int i = 0; i < total; ++i)
+        {
+            free(logfiles[i]);
+        }
+        free(logfiles);
+    }
+
+    enforce_retention();
+}
+
+static void* compressor_main(void* arg)
+{
+    (void)arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&_zlog_compressor_mutex);
+
+        while (!_zlog_compressor_pending && !_zlog_compressor_stop)
+        {
+            pthread_cond_wait(&_zlog_compressor_cond, &_zlog_compressor_mutex);
+        }
+
+        const bool stop = _zlog_compressor_stop;
+        _zlog_compressor_pending = false;
+
+        pthread_mutex_unlock(&_zlog_compressor_mutex);
+
+        if (stop)
+        {
+            break;
+        }
+
+        compress_and_enforce_retention();
+    }
+
+    return NULL;
+}
+
+static char* copy_string(const char* str)
+{
+    const size_t size = strlen(str) + 1;
+    char* copy = (char*)malloc(size);
+    if (copy != NULL)
+    {
+        memcpy(copy, str, size);
+    }
+    return copy;
+}
+
+bool zlog_compressor_start(const char* log_dir, const char* log_prefix)
+{
+    _zlog_compressor_dir = copy_string(log_dir);
+    _zlog_compressor_prefix = copy_string(log_prefix);
+    if (_zlog_compressor_dir == NULL || _zlog_compressor_prefix == NULL)
+    {
+        zlog_compressor_stop();
+        return false;
+    }
+
+    _zlog_compressor_stop = false;
+    _zlog_compressor_pending = true;
+
+    if (pthread_create(&_zlog_compressor_thread, NULL, compressor_main, NULL) != 0)
+    {
+        // Keep the log folder bounded, without compression.
+        enforce_retention();
+        zlog_compressor_stop();
+        return false;
+    }
+
+    _zlog_compressor_running = true;
+    return true;
+}
+
+void zlog_compressor_notify(void)
+{
+    pthread_mutex_lock(&_zlog_compressor_mutex);
+    _zlog_compressor_pending = true;
+    pthread_cond_signal(&_zlog_compressor_cond);
+    pthread_mutex_unlock(&_zlog_compressor_mutex);
+}
+
+void zlog_compressor_stop(void)
+{
+    if (_zlog_compressor_running)
+    {
+        pthread_mutex_lock(&_zlog_compressor_mutex);
+        _zlog_compressor_stop = true;
+        pthread_cond_signal(&_zlog_compressor_cond);
+        pthread_mutex_unlock(&_zlog_compressor_mutex);
+
+        pthread_join(_zlog_compressor_thread, NULL);
+        _zlog_compressor_running = false;
+    }
+
+    free(_zlog_compressor_dir);
+    _zlog_compressor_dir = NULL;
+    free(_zlog_compressor_prefix);
+    _zlog_compressor_prefix = NULL;
+}
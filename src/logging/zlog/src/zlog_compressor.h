@@ -0,0 +1,30 @@
+/**
+ * @file zlog_compressor.h
+ * @brief Compresses finished zlog files in the background and enforces the log retention.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ZLOG_COMPRESSOR_H
+#define ZLOG_COMPRESSOR_H
+
+#include <stdbool.h>
+
+// The extension appended to compressed log files.
+#define ZLOG_COMPRESSED_FILE_EXTENSION ".gz"
+
+// Starts the compressor thread, which compresses the finished log files left by earlier
+// runs and enforces the retention. Log files in use hold a shared flock(), so the active
+// files of this and other processes are never compressed or deleted.
+// Returns false if the thread cannot be started; the retention is then enforced inline.
+bool zlog_compressor_start(const char* log_dir, const char* log_prefix);
+
+// Asks the compressor thread to compress the finished log files and enforce the retention.
+// Does not block; called by the writer thread after roll over.
+void zlog_compressor_notify(void);
+
+// Stops the compressor thread, after it finishes the current file.
+void zlog_compressor_stop(void);
+
+#endif // ZLOG_COMPRESSOR_H
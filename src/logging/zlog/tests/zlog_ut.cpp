@@ -0,0 +1,333 @@
+/**
+ * @file zlog_ut.cpp
+ * @brief Unit Tests for zlog: the per-thread rings, the binary format and the compressor.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+
+#include "zlog-binary.h"
+#include "zlog-config.h" // ZLOG_RATE_LIMIT_BURST
+#include "zlog.h"
+#include <aduc/auto_dir.hpp>
+
+#include <algorithm> // std::sort
+#include <chrono>
+#include <condition_variable>
+#include <cstdio> // popen
+#include <dirent.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+#define ZLOG_UT_LOG_DIR "/tmp/adu-zlog-ut"
+#define ZLOG_UT_LOG_PREFIX "zlog-ut"
+
+/**
+ * @brief Gets the paths of the log files, in chronological order.
+ */
+static std::vector<std::string> GetLogFiles(const std::string& extension)
+{
+    std::vector<std::string> paths;
+
+    DIR* dir = opendir(ZLOG_UT_LOG_DIR);
+    REQUIRE(dir != nullptr);
+
+    for (const dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        const std::string name = entry->d_name;
+        if (name.rfind(ZLOG_UT_LOG_PREFIX ".", 0) == 0 && name.find(extension) != std::string::npos)
+        {
+            paths.push_back(ZLOG_UT_LOG_DIR "/" + name);
+        }
+    }
+
+    closedir(dir);
+
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+/**
+ * @brief Reads a log file, compressed or not.
+ */
+static std::string ReadLogFile(const std::string& path)
+{
+    std::string content;
+
+    gzFile file = gzopen(path.c_str(), "rb");
+    REQUIRE(file != nullptr);
+
+    char buffer[4096];
+    int read = 0;
+    while ((read = gzread(file, buffer, sizeof(buffer))) > 0)
+    {
+        content.append(buffer, static_cast<size_t>(read));
+    }
+
+    gzclose(file);
+    return content;
+}
+
+/**
+ * @brief Reads all text log files.
+ */
+static std::string ReadTextLogs()
+{
+    std::string content;
+    for (const std::string& path : GetLogFiles(".log"))
+    {
+        content += ReadLogFile(path);
+    }
+    return content;
+}
+
+/**
+ * @brief Decodes all binary log files with the zlog decoder.
+ */
+static std::string DecodeBinaryLogs()
+{
+    std::string command = ZLOG_DECODER_PATH;
+    for (const std::string& path : GetLogFiles("." ZLOG_BINARY_FILE_EXTENSION))
+    {
+        command += " " + path;
+    }
+
+    FILE* decoder = popen(command.c_str(), "r");
+    REQUIRE(decoder != nullptr);
+
+    std::string output;
+    char buffer[4096];
+    size_t read = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), decoder)) > 0)
+    {
+        output.append(buffer, read);
+    }
+
+    CHECK(pclose(decoder) == 0);
+    return output;
+}
+
+static size_t CountOccurrences(const std::string& text, const std::string& pattern)
+{
+    size_t count = 0;
+    for (size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos + 1))
+    {
+        ++count;
+    }
+    return count;
+}
+
+static void InitTestLog()
+{
+    REQUIRE(
+        zlog_init(ZLOG_UT_LOG_DIR, ZLOG_UT_LOG_PREFIX, ZLOG_DISABLED, ZLOG_ENABLED, ZLOG_DEBUG, ZLOG_DEBUG) == 0);
+}
+
+TEST_CASE("Lines of each thread's ring are written in order")
+{
+    aduc::AutoDir logDir{ ZLOG_UT_LOG_DIR };
+    REQUIRE(logDir.CreateDir());
+    zlog_set_file_format(ZLOG_FILE_FORMAT_TEXT);
+    InitTestLog();
+
+    // Fewer lines per thread than a ring holds, and per callsite than the rate limit bursts.
+    const int threadCount = 4;
+    const int lineCount = 10;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([t]() {
+            for (int i = 0; i < lineCount; ++i)
+            {
+                zlog_log(ZLOG_INFO, __func__, __LINE__, "thread %d line %d.", t, i);
+            }
+        });
+    }
+
+    for (std::thread& thread : threads)
+    {
+        // The rings of exited threads are orphaned, and still drained.
+        thread.join();
+    }
+
+    zlog_flush_buffer();
+    const std::string logs = ReadTextLogs();
+    zlog_finish();
+
+    CHECK(zlog_get_dropped_line_count() == 0);
+
+    for (int t = 0; t < threadCount; ++t)
+    {
+        size_t previous = 0;
+        for (int i = 0; i < lineCount; ++i)
+        {
+            const std::string line = "thread " + std::to_string(t) + " line " + std::to_string(i) + ".";
+            CHECK(CountOccurrences(logs, line) == 1);
+
+            const size_t pos = logs.find(line);
+            CHECK(pos >= previous);
+            previous = pos;
+        }
+    }
+}
+
+TEST_CASE("zlog can be initialized again after zlog_finish")
+{
+    aduc::AutoDir logDir{ ZLOG_UT_LOG_DIR };
+    REQUIRE(logDir.CreateDir());
+    zlog_set_file_format(ZLOG_FILE_FORMAT_TEXT);
+    InitTestLog();
+
+    // A thread that logged, and exits only after zlog_finish, as threads do when an extension is unloaded.
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool isLogged = false;
+    bool isFinished = false;
+
+    std::thread lingeringThread{ [&]() {
+        zlog_log(ZLOG_INFO, __func__, __LINE__, "before finish.");
+
+        std::unique_lock<std::mutex> lock{ mutex };
+        isLogged = true;
+        changed.notify_one();
+        changed.wait(lock, [&]() { return isFinished; });
+    } };
+
+    {
+        std::unique_lock<std::mutex> lock{ mutex };
+        changed.wait(lock, [&]() { return isLogged; });
+    }
+
+    zlog_log(ZLOG_INFO, __func__, __LINE__, "first run.");
+    zlog_flush_buffer();
+    zlog_finish();
+
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        isFinished = true;
+    }
+    changed.notify_one();
+    lingeringThread.join();
+
+    // This thread's ring was freed by zlog_finish, so it registers a new one.
+    InitTestLog();
+    zlog_log(ZLOG_INFO, __func__, __LINE__, "second run.");
+    zlog_finish();
+
+    const std::string logs = ReadTextLogs();
+    CHECK(CountOccurrences(logs, "before finish.") == 1);
+    CHECK(CountOccurrences(logs, "first run.") == 1);
+    CHECK(CountOccurrences(logs, "second run.") == 1);
+}
+
+TEST_CASE("Binary log files decode to the text lines")
+{
+    aduc::AutoDir logDir{ ZLOG_UT_LOG_DIR };
+    REQUIRE(logDir.CreateDir());
+    zlog_set_file_format(ZLOG_FILE_FORMAT_BINARY);
+    InitTestLog();
+
+    const char* nullString = nullptr;
+    zlog_log(ZLOG_INFO, __func__, __LINE__, "int %d, unsigned %u, hex %#x.", -42, 42u, 255u);
+    zlog_log(ZLOG_WARN, __func__, __LINE__, "long %ld, size %zu, long long %lld.", -1L, sizeof(int), 1LL << 40);
+    zlog_log(ZLOG_INFO, __func__, __LINE__, "double %.3f, width %*d|, string %s, null %s.", 3.14159, 5, 7, "abc",
+             nullString);
+    zlog_log(ZLOG_ERROR, __func__, __LINE__, "percent 100%%, char %c.", 'z');
+    // A long double cannot be recorded, so this callsite is written as text.
+    zlog_log(ZLOG_INFO, __func__, __LINE__, "text record %.1Lf.", 2.5L);
+
+    zlog_finish();
+    zlog_set_file_format(ZLOG_FILE_FORMAT_TEXT);
+
+    const std::string text = DecodeBinaryLogs();
+    CHECK(CountOccurrences(text, "int -42, unsigned 42, hex 0xff.") == 1);
+    CHECK(CountOccurrences(text, "long -1, size 4, long long 1099511627776.") == 1);
+    CHECK(CountOccurrences(text, "double 3.142, width     7|, string abc, null (null).") == 1);
+    CHECK(CountOccurrences(text, "percent 100%, char z.") == 1);
+    CHECK(CountOccurrences(text, "text record 2.5.") == 1);
+    CHECK(CountOccurrences(text, " [E] ") == 1);
+}
+
+TEST_CASE("The compressor compresses the log files of earlier runs")
+{
+    aduc::AutoDir logDir{ ZLOG_UT_LOG_DIR };
+    REQUIRE(logDir.CreateDir());
+    zlog_set_file_format(ZLOG_FILE_FORMAT_TEXT);
+
+    const std::string earlierLog = ZLOG_UT_LOG_DIR "/" ZLOG_UT_LOG_PREFIX ".20200101-000000.log";
+    const std::string earlierContent = "2020-01-01T00:00:00.0000Z 1[1] [I] an earlier run. [main:1]\n";
+    {
+        FILE* file = fopen(earlierLog.c_str(), "w");
+        REQUIRE(file != nullptr);
+        fputs(earlierContent.c_str(), file);
+        fclose(file);
+    }
+
+    InitTestLog();
+
+    // The compressor runs in the background; the file of this run stays locked, and is not compressed.
+    const std::string compressedLog = earlierLog + ".gz";
+    std::vector<std::string> compressed;
+    for (int attempt = 0; attempt < 500; ++attempt)
+    {
+        compressed = GetLogFiles(".gz");
+        if (!compressed.empty())
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    zlog_finish();
+
+    REQUIRE(compressed.size() == 1);
+    CHECK(compressed[0] == compressedLog);
+    CHECK(GetLogFiles(".20200101-000000.log").size() == 1); // Only the .gz.
+    CHECK(ReadLogFile(compressedLog) == earlierContent);
+    CHECK(GetLogFiles(".log").size() == 2); // The compressed file, and the file of this run.
+}
+
+TEST_CASE("The rate limit suppresses repeated info lines, not warnings")
+{
+    aduc::AutoDir logDir{ ZLOG_UT_LOG_DIR };
+    REQUIRE(logDir.CreateDir());
+    zlog_set_file_format(ZLOG_FILE_FORMAT_TEXT);
+    InitTestLog();
+
+    const unsigned long suppressedBefore = zlog_get_suppressed_line_count();
+    const unsigned long droppedBefore = zlog_get_dropped_line_count();
+    const int lineCount = ZLOG_RATE_LIMIT_BURST * 2;
+
+    for (int i = 0; i < lineCount; ++i)
+    {
+        zlog_log(ZLOG_INFO, __func__, __LINE__, "info line %d.", i);
+        zlog_log(ZLOG_WARN, __func__, __LINE__, "warn line %d.", i);
+
+        // Keeps the ring from filling up.
+        if (i % 16 == 15)
+        {
+            zlog_flush_buffer();
+        }
+    }
+
+    // Stopping the writer summarizes the suppressed lines.
+    zlog_finish();
+
+    const std::string logs = ReadTextLogs();
+    const size_t infoLines = CountOccurrences(logs, "info line ");
+    const unsigned long suppressed = zlog_get_suppressed_line_count() - suppressedBefore;
+
+    CHECK(zlog_get_dropped_line_count() == droppedBefore);
+
+    // A token may be refilled during the loop.
+    CHECK(infoLines >= ZLOG_RATE_LIMIT_BURST);
+    CHECK(infoLines <= ZLOG_RATE_LIMIT_BURST + 1);
+    CHECK(infoLines + suppressed == static_cast<size_t>(lineCount));
+    CHECK(CountOccurrences(logs, "warn line ") == static_cast<size_t>(lineCount));
+    CHECK(CountOccurrences(logs, "Suppressed " + std::to_string(suppressed) + " repeated lines") == 1);
+}
@@ -86,13 +86,143 @@ ADUC_Result LinuxPlatformLayer::SetUpdateActionCallbacks(ADUC_UpdateActionCallba
     return ADUC_Result{ ADUC_Result_Register_Success };
 }
 
+/**
+ * @brief Queues a workflow operation (e.g. Download) on the platform layer worker pool.
+ *
+ * @param token Opaque token, a pointer to the LinuxPlatformLayer instance.
+ * @param workCompletionData Contains information on what to do when the operation is completed.
+ * @param workflowData The workflow data. Guaranteed to be valid until WorkCompletionCallback is called.
+ * @param operationName The operation name, for logging and metrics.
+ * @param operation The member function that performs the operation synchronously.
+ * @param inProgressResultCode The result code to return when the operation has been queued.
+ * @return ADUC_Result @p inProgressResultCode on success.
+ */
+ADUC_Result LinuxPlatformLayer::QueueWorkflowOperation(
+    ADUC_Token token,
+    const ADUC_WorkCompletionData* workCompletionData,
+    const ADUC_WorkflowData* workflowData,
+    const char* operationName,
+    ADUC_Result (LinuxPlatformLayer::*operation)(const ADUC_WorkflowData*, const ADUC::CancellationToken&),
+    ADUC_Result_t inProgressResultCode) noexcept
+{
+    try
+    {
+        auto* platformLayer = static_cast<LinuxPlatformLayer*>(token);
+
+        Log_Info("Queueing %s operation.", operationName);
+
+        const char* workflowId = workflow_peek_id(workflowData->WorkflowHandle);
+        const ADUC::CancellationToken workflowCancellationToken =
+            platformLayer->GetWorkflowCancellationToken(workflowId == nullptr ? "" : workflowId);
+
+        // Pointers passed to this method are guaranteed to be valid until WorkCompletionCallback is called.
+        const bool queued = platformLayer->_workerPool.Submit(
+            operationName,
+            [platformLayer, workCompletionData, workflowData, operation, operationName](
+                const ADUC::CancellationToken& cancellationToken) {
+                ADUC_Result result{ ADUC_Result_Failure_Cancelled };
+                if (!cancellationToken.IsCancellationRequested())
+                {
+                    Log_Info("%s thread started.", operationName);
+                    result = ADUC::ExceptionUtils::CallResultMethodAndHandleExceptions(
+                        ADUC_Result_Failure,
+                        [platformLayer, operation, workflowData, &cancellationToken]() -> ADUC_Result {
+                            return (platformLayer->*operation)(workflowData, cancellationToken);
+                        });
+                }
+                else
+                {
+                    Log_Warn("%s operation was cancelled before it started.", operationName);
+                }
+
+                if (platformLayer->_workerPool.IsShuttingDown())
+                {
+                    // The workflow resumes from its persisted state when the agent restarts.
+                    Log_Warn("Agent is shutting down. Completing %s operation as cancelled.", operationName);
+                    result = ADUC_Result{ ADUC_Result_Failure_Cancelled, ADUC_ERC_SHUTDOWN };
+                }
+
+                // Report result to main thread.
+                workCompletionData->WorkCompletionCallback(
+                    workCompletionData->WorkCompletionToken, result, true /* isAsync */);
+            },
+            workflowCancellationToken);
+
+        if (!queued)
+        {
+            Log_Error("Cannot queue %s operation.", operationName);
+            return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
+        }
+
+        // Indicate that a worker will do the actual work.
+        return ADUC_Result{ inProgressResultCode };
+    }
+    catch (const ADUC::Exception& e)
+    {
+        Log_Error("Unhandled ADU Agent exception. code: %d, message: %s", e.Code(), e.Message().c_str());
+        return ADUC_Result{ ADUC_Result_Failure, e.Code() };
+    }
+    catch (const std::exception& e)
+    {
+        Log_Error("Unhandled std exception: %s", e.what());
+        return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
+    }
+    catch (...)
+    {
+        return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
+    }
+}
+
 /**
  * @brief Class implementation of Idle method.
  */
 void LinuxPlatformLayer::Idle(const char* workflowId)
 {
     Log_Info("Now idle. workflowId: %s", workflowId);
-    _IsCancellationRequested = false;
+
+    std::lock_guard<std::mutex> lock{ _workflowCancellationTokensMutex };
+    _workflowCancellationTokens.erase(workflowId == nullptr ? "" : workflowId);
+}
+
+ADUC::CancellationToken LinuxPlatformLayer::GetWorkflowCancellationToken(const std::string& workflowId)
+{
+    std::lock_guard<std::mutex> lock{ _workflowCancellationTokensMutex };
+    return _workflowCancellationTokens[workflowId];
+}
+
+void LinuxPlatformLayer::CancelWorkflowOperations(const std::string& workflowId)
+{
+    ADUC::CancellationToken cancellationToken;
+
+    {
+        std::lock_guard<std::mutex> lock{ _workflowCancellationTokensMutex };
+        auto it = _workflowCancellationTokens.find(workflowId);
+        if (it == _workflowCancellationTokens.end())
+        {
+            return;
+        }
+
+        cancellationToken = it->second;
+        _workflowCancellationTokens.erase(it);
+    }
+
+    // Operations that are still queued complete as cancelled without running.
+    cancellationToken.RequestCancellation();
+}
+
+/**
+ * @brief Requests cancellation of the workflow, which the handlers check, once the token of its operations is
+ * cancelled: by Cancel, or by the worker pool when the agent shuts down.
+ *
+ * @param workflowData The workflow data.
+ * @param cancellationToken The cancellation token of the workflow.
+ * @return ADUC::CancellationToken::Subscription The subscription, to hold while the handler runs.
+ */
+static ADUC::CancellationToken::Subscription SubscribeWorkflowCancellation(
+    const ADUC_WorkflowData* workflowData, const ADUC::CancellationToken& cancellationToken)
+{
+    ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
+    return cancellationToken.Subscribe([handle]() { workflow_request_cancel(handle); });
 }
 
 static ContentHandler* GetUpdateManifestHandler(const ADUC_WorkflowData* workflowData, ADUC_Result* result)
@@ -145,9 +275,12 @@ static ContentHandler* GetUpdateManifestHandler(const ADUC_WorkflowData* workflo
  * @brief Class implementation of Download method.
  * @return ADUC_Result
  */
-ADUC_Result LinuxPlatformLayer::Download(const ADUC_WorkflowData* workflowData)
+ADUC_Result
+LinuxPlatformLayer::Download(const ADUC_WorkflowData* workflowData, const ADUC::CancellationToken& cancellationToken)
 {
     ADUC_Result result{ ADUC_Result_Failure };
+    const ADUC::CancellationToken::Subscription cancellationSubscription =
+        SubscribeWorkflowCancellation(workflowData, cancellationToken);
     ContentHandler* contentHandler = GetUpdateManifestHandler(workflowData, &result);
 
     if (contentHandler == nullptr)
@@ -156,10 +289,9 @@ ADUC_Result LinuxPlatformLayer::Download(const ADUC_WorkflowData* workflowData)
     }
 
     result = contentHandler->Download(workflowData);
-    if (_IsCancellationRequested)
+    if (cancellationToken.IsCancellationRequested())
     {
         result = ADUC_Result{ ADUC_Result_Failure_Cancelled };
-        _IsCancellationRequested = false; // For replacement, we can't call Idle so reset here
     }
 
 done:
@@ -170,9 +302,12 @@ done:
  * @brief Class implementation of Install method.
  * @return ADUC_Result
  */
-ADUC_Result LinuxPlatformLayer::Install(const ADUC_WorkflowData* workflowData)
+ADUC_Result
+LinuxPlatformLayer::Install(const ADUC_WorkflowData* workflowData, const ADUC::CancellationToken& cancellationToken)
 {
     ADUC_Result result{ ADUC_Result_Failure };
+    const ADUC::CancellationToken::Subscription cancellationSubscription =
+        SubscribeWorkflowCancellation(workflowData, cancellationToken);
     ContentHandler* contentHandler = GetUpdateManifestHandler(workflowData, &result);
     if (contentHandler == nullptr)
     {
@@ -180,10 +315,9 @@ ADUC_Result LinuxPlatformLayer::Install(const ADUC_WorkflowData* workflowData)
     }
 
     result = contentHandler->Install(workflowData);
-    if (_IsCancellationRequested)
+    if (cancellationToken.IsCancellationRequested())
     {
         result = ADUC_Result{ ADUC_Result_Failure_Cancelled };
-        _IsCancellationRequested = false; // For replacement, we can't call Idle so reset here
     }
 
 done:
@@ -194,9 +328,12 @@ done:
  * @brief Class implementation of Apply method.
  * @return ADUC_Result
  */
-ADUC_Result LinuxPlatformLayer::Apply(const ADUC_WorkflowData* workflowData)
+ADUC_Result
+LinuxPlatformLayer::Apply(const ADUC_WorkflowData* workflowData, const ADUC::CancellationToken& cancellationToken)
 {
     ADUC_Result result{ ADUC_Result_Failure };
+    const ADUC::CancellationToken::Subscription cancellationSubscription =
+        SubscribeWorkflowCancellation(workflowData, cancellationToken);
     ContentHandler* contentHandler = GetUpdateManifestHandler(workflowData, &result);
     if (contentHandler == nullptr)
     {
@@ -204,10 +341,9 @@ ADUC_Result LinuxPlatformLayer::Apply(const ADUC_WorkflowData* workflowData)
     }
 
     result = contentHandler->Apply(workflowData);
-    if (_IsCancellationRequested)
+    if (cancellationToken.IsCancellationRequested())
     {
         result = ADUC_Result{ ADUC_Result_Failure_Cancelled };
-        _IsCancellationRequested = false; // For replacement, we can't call Idle so reset here
     }
 
 done:
@@ -218,7 +354,8 @@ done:
  * @brief Class implementation of Backup method.
  * @return ADUC_Result
  */
-ADUC_Result LinuxPlatformLayer::Backup(const ADUC_WorkflowData* workflowData)
+ADUC_Result
+LinuxPlatformLayer::Backup(const ADUC_WorkflowData* workflowData, const ADUC::CancellationToken& cancellationToken)
 {
     ADUC_Result result{ ADUC_Result_Failure };
     ContentHandler* contentHandler = GetUpdateManifestHandler(workflowData, &result);
@@ -227,13 +364,12 @@ ADUC_Result LinuxPlatformLayer::Backup(const ADUC_WorkflowData* workflowData)
         goto done;
     }
 
+    // If cancel is requested during backup, we will proceed to finish the backup, so the handler is not interrupted.
     result = contentHandler->Backup(workflowData);
 
-    // If cancel is requested during backup, we will proceed to finish the backup.
-    if (_IsCancellationRequested)
+    if (cancellationToken.IsCancellationRequested())
     {
         result = ADUC_Result{ ADUC_Result_Failure_Cancelled };
-        _IsCancellationRequested = false; // For replacement, we can't call Idle so reset here
     }
 
 done:
@@ -243,7 +379,8 @@ done:
  * @brief Class implementation of Restore method.
  * @return ADUC_Result
  */
-ADUC_Result LinuxPlatformLayer::Restore(const ADUC_WorkflowData* workflowData)
+ADUC_Result
+LinuxPlatformLayer::Restore(const ADUC_WorkflowData* workflowData, const ADUC::CancellationToken& cancellationToken)
 {
     ADUC_Result result{ ADUC_Result_Failure };
     ContentHandler* contentHandler = GetUpdateManifestHandler(workflowData, &result);
@@ -252,10 +389,10 @@ ADUC_Result LinuxPlatformLayer::Restore(const ADUC_WorkflowData* workflowData)
         goto done;
     }
 
-    result = contentHandler->Restore(workflowData);
-
     // If cancel is requested during restore, it means that the user wants to cancel the deployment (which already failed),
     // so the agent should try to restore to the previous state - proceed to finish the restore.
+    UNREFERENCED_PARAMETER(cancellationToken);
+    result = contentHandler->Restore(workflowData);
 
 done:
     return result;
@@ -268,7 +405,9 @@ void LinuxPlatformLayer::Cancel(const ADUC_WorkflowData* workflowData)
 {
     ADUC_Result result{ ADUC_Result_Failure };
 
-    _IsCancellationRequested = true;
+    // Only the operations of this workflow are cancelled; those of other workflows keep running.
+    const char* workflowId = workflow_peek_id(workflowData->WorkflowHandle);
+    CancelWorkflowOperations(workflowId == nullptr ? "" : workflowId);
 
     ContentHandler* contentHandler = GetUpdateManifestHandler(workflowData, &result);
     if (contentHandler == nullptr)
@@ -282,7 +421,7 @@ void LinuxPlatformLayer::Cancel(const ADUC_WorkflowData* workflowData)
     // worker thread. Cancel on the contentHandler is blocking call and once handler confirms the
     // operation has been cancelled, it returns success or failure for the cancel.
     // After each blocking Download, Install, Apply calls above into handler, it checks if
-    // _IsCancellationRequested is true and sets result to ADUC_Result_Failure_Cancelled
+    // the workflow cancellation token is cancelled and sets result to ADUC_Result_Failure_Cancelled
     result = contentHandler->Cancel(workflowData);
     if (IsAducResultCodeSuccess(result.ResultCode))
     {
@@ -8,9 +8,10 @@
 #ifndef LINUX_ADU_CORE_IMPL_HPP
 #define LINUX_ADU_CORE_IMPL_HPP
 
-#include <atomic>
 #include <exception>
-#include <thread>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 #include <time.h>
 
@@ -19,6 +20,7 @@
 #include "aduc/logging.h"
 #include "aduc/result.h"
 #include "aduc/types/workflow.h"
+#include "aduc/worker_pool_utils.hpp"
 #include "aduc/workflow_utils.h"
 
 namespace ADUC
@@ -34,6 +36,21 @@ public:
     ADUC_Result SetUpdateActionCallbacks(ADUC_UpdateActionCallbacks* data);
 
 private:
+    /**
+     * @brief Worker pool name. Threads are named "<name>-<index>".
+     */
+    static constexpr const char* WorkerPoolName = "du-workflow";
+
+    /**
+     * @brief Number of worker threads for workflow operations.
+     */
+    static constexpr size_t WorkerPoolThreadCount = 2;
+
+    /**
+     * @brief Maximum number of workflow operations waiting for a worker.
+     */
+    static constexpr size_t WorkerPoolMaxQueueDepth = 8;
+
     static std::string g_componentsInfo;
     static time_t g_lastComponentsCheckTime;
 
@@ -59,50 +76,19 @@ private:
      *
      * @param token Opaque token.
      * @param workCompletionData Contains information on what to do when task is completed.
-     * @param info ADUC_WorkflowDataToken with information on how to download.
+     * @param info #ADUC_WorkflowData with information on how to download.
      * @return ADUC_Result
      */
     static ADUC_Result DownloadCallback(
         ADUC_Token token, const ADUC_WorkCompletionData* workCompletionData, ADUC_WorkflowDataToken info) noexcept
     {
-        const ADUC_WorkflowData* workflowData = static_cast<const ADUC_WorkflowData*>(info);
-
-        try
-        {
-            Log_Info("Download thread started.");
-
-            // Pointers passed to this method are guaranteed to be valid until WorkCompletionCallback is called.
-            std::thread worker{ [token, workCompletionData, workflowData] {
-                const ADUC_Result result{ ADUC::ExceptionUtils::CallResultMethodAndHandleExceptions(
-                    ADUC_Result_Failure, [&token, &workCompletionData, &workflowData]() -> ADUC_Result {
-                        return static_cast<LinuxPlatformLayer*>(token)->Download(workflowData);
-                    }) };
-
-                // Report result to main thread.
-                workCompletionData->WorkCompletionCallback(
-                    workCompletionData->WorkCompletionToken, result, true /* isAsync */);
-            } };
-
-            // Allow the thread to work independently of this main thread.
-            worker.detach();
-
-            // Indicate that we've spun off a thread to do the actual work.
-            return ADUC_Result{ ADUC_Result_Download_InProgress };
-        }
-        catch (const ADUC::Exception& e)
-        {
-            Log_Error("Unhandled ADU Agent exception. code: %d, message: %s", e.Code(), e.Message().c_str());
-            return ADUC_Result{ ADUC_Result_Failure, e.Code() };
-        }
-        catch (const std::exception& e)
-        {
-            Log_Error("Unhandled std exception: %s", e.what());
-            return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
-        }
-        catch (...)
-        {
-            return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
-        };
+        return QueueWorkflowOperation(
+            token,
+            workCompletionData,
+            static_cast<const ADUC_WorkflowData*>(info),
+            "Download",
+            &LinuxPlatformLayer::Download,
+            ADUC_Result_Download_InProgress);
     }
 
     /**
@@ -116,46 +102,13 @@ private:
     static ADUC_Result BackupCallback(
         ADUC_Token token, const ADUC_WorkCompletionData* workCompletionData, ADUC_WorkflowDataToken info) noexcept
     {
-        ADUC_Result result;
-        const ADUC_WorkflowData* workflowData = static_cast<const ADUC_WorkflowData*>(info);
-        try
-        {
-            Log_Info("Backup thread started");
-
-            // Pointers passed to this method are guaranteed to be valid until WorkCompletionCallback is called.
-            std::thread worker{ [token, workCompletionData, workflowData] {
-                const ADUC_Result result{ ADUC::ExceptionUtils::CallResultMethodAndHandleExceptions(
-                    ADUC_Result_Failure, [&token, &workCompletionData, &workflowData]() -> ADUC_Result {
-                        return static_cast<LinuxPlatformLayer*>(token)->Backup(workflowData);
-                    }) };
-
-                // Report result to main thread.
-                workCompletionData->WorkCompletionCallback(
-                    workCompletionData->WorkCompletionToken, result, true /* isAsync */);
-            } };
-
-            // Allow the thread to work independently of this main thread.
-            worker.detach();
-
-            // Indicate that we've spun off a thread to do the actual work.
-            result = { ADUC_Result_Backup_InProgress };
-        }
-        catch (const ADUC::Exception& e)
-        {
-            Log_Error("Unhandled ADU Agent exception. code: %d, message: %s", e.Code(), e.Message().c_str());
-            result = { ADUC_Result_Failure, e.Code() };
-        }
-        catch (const std::exception& e)
-        {
-            Log_Error("Unhandled std exception: %s", e.what());
-            result = ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
-        }
-        catch (...)
-        {
-            result = ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
-        }
-
-        return result;
+        return QueueWorkflowOperation(
+            token,
+            workCompletionData,
+            static_cast<const ADUC_WorkflowData*>(info),
+            "Backup",
+            &LinuxPlatformLayer::Backup,
+            ADUC_Result_Backup_InProgress);
     }
 
     /**
@@ -169,46 +122,13 @@ private:
     static ADUC_Result InstallCallback(
         ADUC_Token token, const ADUC_WorkCompletionData* workCompletionData, ADUC_WorkflowDataToken info) noexcept
     {
-        ADUC_Result result;
-        const ADUC_WorkflowData* workflowData = static_cast<const ADUC_WorkflowData*>(info);
-        try
-        {
-            Log_Info("Install thread started");
-
-            // Pointers passed to this method are guaranteed to be valid until WorkCompletionCallback is called.
-            std::thread worker{ [token, workCompletionData, workflowData] {
-                const ADUC_Result result{ ADUC::ExceptionUtils::CallResultMethodAndHandleExceptions(
-                    ADUC_Result_Failure, [&token, &workCompletionData, &workflowData]() -> ADUC_Result {
-                        return static_cast<LinuxPlatformLayer*>(token)->Install(workflowData);
-                    }) };
-
-                // Report result to main thread.
-                workCompletionData->WorkCompletionCallback(
-                    workCompletionData->WorkCompletionToken, result, true /* isAsync */);
-            } };
-
-            // Allow the thread to work independently of this main thread.
-            worker.detach();
-
-            // Indicate that we've spun off a thread to do the actual work.
-            result = { ADUC_Result_Install_InProgress };
-        }
-        catch (const ADUC::Exception& e)
-        {
-            Log_Error("Unhandled ADU Agent exception. code: %d, message: %s", e.Code(), e.Message().c_str());
-            result = { ADUC_Result_Failure, e.Code() };
-        }
-        catch (const std::exception& e)
-        {
-            Log_Error("Unhandled std exception: %s", e.what());
-            result = ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
-        }
-        catch (...)
-        {
-            result = ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
-        }
-
-        return result;
+        return QueueWorkflowOperation(
+            token,
+            workCompletionData,
+            static_cast<const ADUC_WorkflowData*>(info),
+            "Install",
+            &LinuxPlatformLayer::Install,
+            ADUC_Result_Install_InProgress);
     }
 
     /**
@@ -222,42 +142,13 @@ private:
     static ADUC_Result ApplyCallback(
         ADUC_Token token, const ADUC_WorkCompletionData* workCompletionData, ADUC_WorkflowDataToken info) noexcept
     {
-        const ADUC_WorkflowData* workflowData = static_cast<const ADUC_WorkflowData*>(info);
-        try
-        {
-            Log_Info("Apply thread started");
-
-            // Pointers passed to this method are guaranteed to be valid until WorkCompletionCallback is called.
-            std::thread worker{ [token, workCompletionData, workflowData] {
-                const ADUC_Result result{ ADUC::ExceptionUtils::CallResultMethodAndHandleExceptions(
-                    ADUC_Result_Failure, [&token, &workCompletionData, &workflowData]() -> ADUC_Result {
-                        return static_cast<LinuxPlatformLayer*>(token)->Apply(workflowData);
-                    }) };
-                // Report result to main thread.
-                workCompletionData->WorkCompletionCallback(
-                    workCompletionData->WorkCompletionToken, result, true /* isAsync */);
-            } };
-
-            // Allow the thread to work independently of this main thread.
-            worker.detach();
-
-            // Indicate that we've spun off a thread to do the actual work.
-            return ADUC_Result{ ADUC_Result_Apply_InProgress };
-        }
-        catch (const ADUC::Exception& e)
-        {
-            Log_Error("Unhandled ADU Agent exception. code: %d, message: %s", e.Code(), e.Message().c_str());
-            return ADUC_Result{ ADUC_Result_Failure, e.Code() };
-        }
-        catch (const std::exception& e)
-        {
-            Log_Error("Unhandled std exception: %s", e.what());
-            return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
-        }
-        catch (...)
-        {
-            return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
-        }
+        return QueueWorkflowOperation(
+            token,
+            workCompletionData,
+            static_cast<const ADUC_WorkflowData*>(info),
+            "Apply",
+            &LinuxPlatformLayer::Apply,
+            ADUC_Result_Apply_InProgress);
     }
 
     /**
@@ -271,42 +162,13 @@ private:
     static ADUC_Result RestoreCallback(
         ADUC_Token token, const ADUC_WorkCompletionData* workCompletionData, ADUC_WorkflowDataToken info) noexcept
     {
-        const ADUC_WorkflowData* workflowData = static_cast<const ADUC_WorkflowData*>(info);
-        try
-        {
-            Log_Info("Restore thread started");
-
-            // Pointers passed to this method are guaranteed to be valid until WorkCompletionCallback is called.
-            std::thread worker{ [token, workCompletionData, workflowData] {
-                const ADUC_Result result{ ADUC::ExceptionUtils::CallResultMethodAndHandleExceptions(
-                    ADUC_Result_Failure, [&token, &workCompletionData, &workflowData]() -> ADUC_Result {
-                        return static_cast<LinuxPlatformLayer*>(token)->Restore(workflowData);
-                    }) };
-                // Report result to main thread.
-                workCompletionData->WorkCompletionCallback(
-                    workCompletionData->WorkCompletionToken, result, true /* isAsync */);
-            } };
-
-            // Allow the thread to work independently of this main thread.
-            worker.detach();
-
-            // Indicate that we've spun off a thread to do the actual work.
-            return ADUC_Result{ ADUC_Result_Restore_InProgress };
-        }
-        catch (const ADUC::Exception& e)
-        {
-            Log_Error("Unhandled ADU Agent exception. code: %d, message: %s", e.Code(), e.Message().c_str());
-            return ADUC_Result{ ADUC_Result_Failure, e.Code() };
-        }
-        catch (const std::exception& e)
-        {
-            Log_Error("Unhandled std exception: %s", e.what());
-            return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
-        }
-        catch (...)
-        {
-            return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
-        }
+        return QueueWorkflowOperation(
+            token,
+            workCompletionData,
+            static_cast<const ADUC_WorkflowData*>(info),
+            "Restore",
+            &LinuxPlatformLayer::Restore,
+            ADUC_Result_Restore_InProgress);
     }
 
     /**
@@ -379,6 +241,26 @@ private:
         UNREFERENCED_PARAMETER(workflowData);
     }
 
+    /**
+     * @brief Queues a workflow operation (e.g. Download) on the platform layer worker pool.
+     *
+     * @param token Opaque token, a pointer to the LinuxPlatformLayer instance.
+     * @param workCompletionData Contains information on what to do when the operation is completed.
+     * @param workflowData The workflow data. Guaranteed to be valid until WorkCompletionCallback is called.
+     * @param operationName The operation name, for logging and metrics.
+     * @param operation The member function that performs the operation synchronously. It gets the cancellation token
+     * of the workflow.
+     * @param inProgressResultCode The result code to return when the operation has been queued.
+     * @return ADUC_Result @p inProgressResultCode on success.
+     */
+    static ADUC_Result QueueWorkflowOperation(
+        ADUC_Token token,
+        const ADUC_WorkCompletionData* workCompletionData,
+        const ADUC_WorkflowData* workflowData,
+        const char* operationName,
+        ADUC_Result (LinuxPlatformLayer::*operation)(const ADUC_WorkflowData*, const ADUC::CancellationToken&),
+        ADUC_Result_t inProgressResultCode) noexcept;
+
     //
     // Implementation.
     //
@@ -387,13 +269,29 @@ private:
     LinuxPlatformLayer() = default;
 
     void Idle(const char* workflowId);
-    ADUC_Result Download(const ADUC_WorkflowData* workflowData);
-    ADUC_Result Backup(const ADUC_WorkflowData* workflowData);
-    ADUC_Result Install(const ADUC_WorkflowData* workflowData);
-    ADUC_Result Apply(const ADUC_WorkflowData* workflowData);
-    ADUC_Result Restore(const ADUC_WorkflowData* workflowData);
+    ADUC_Result Download(const ADUC_WorkflowData* workflowData, const ADUC::CancellationToken& cancellationToken);
+    ADUC_Result Backup(const ADUC_WorkflowData* workflowData, const ADUC::CancellationToken& cancellationToken);
+    ADUC_Result Install(const ADUC_WorkflowData* workflowData, const ADUC::CancellationToken& cancellationToken);
+    ADUC_Result Apply(const ADUC_WorkflowData* workflowData, const ADUC::CancellationToken& cancellationToken);
+    ADUC_Result Restore(const ADUC_WorkflowData* workflowData, const ADUC::CancellationToken& cancellationToken);
     void Cancel(const ADUC_WorkflowData* workflowData);
 
+    /**
+     * @brief Gets the cancellation token of a workflow, creating it for the first operation of the workflow.
+     *
+     * @param workflowId The workflow identifier.
+     * @return ADUC::CancellationToken The token, shared by the operations of the workflow.
+     */
+    ADUC::CancellationToken GetWorkflowCancellationToken(const std::string& workflowId);
+
+    /**
+     * @brief Cancels the operations of a workflow, and forgets its token, so that the operations of a retry start
+     * with a new one.
+     *
+     * @param workflowId The workflow identifier.
+     */
+    void CancelWorkflowOperations(const std::string& workflowId);
+
     ADUC_Result IsInstalled(const ADUC_WorkflowData* workflowData);
 
     /**
@@ -415,9 +313,22 @@ private:
     void SandboxDestroy(const char* workflowId, const char* workFolder);
 
     /**
-     * @brief Was Cancel called?
+     * @brief Guards _workflowCancellationTokens.
+     */
+    std::mutex _workflowCancellationTokensMutex;
+
+    /**
+     * @brief The cancellation token of each workflow that has operations, by workflow identifier.
+     */
+    std::unordered_map<std::string, ADUC::CancellationToken> _workflowCancellationTokens;
+
+    /**
+     * @brief Workers that run the Download, Backup, Install, Apply and Restore operations.
+     *
+     * @remark Declared last so that it is destroyed first; its destructor joins the workers, which
+     *         may still be running member functions of this object.
      */
-    std::atomic_bool _IsCancellationRequested{ false };
+    ADUC::WorkerPool _workerPool{ WorkerPoolName, WorkerPoolThreadCount, WorkerPoolMaxQueueDepth };
 };
 } // namespace ADUC
 
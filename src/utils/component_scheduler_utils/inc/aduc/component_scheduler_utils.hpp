@@ -0,0 +1,62 @@
+/**
+ * @file component_scheduler_utils.hpp
+ * @brief Reserves component sets for concurrently running workflows and refuses overlapping sets.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_COMPONENT_SCHEDULER_UTILS_HPP
+#define ADUC_COMPONENT_SCHEDULER_UTILS_HPP
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ADUC
+{
+/**
+ * @brief Tracks which components are owned by which in-flight workflow.
+ *
+ * A workflow may only start when none of its components are owned by another workflow.
+ * A workflow with an empty component set targets the host device and is exclusive: it can
+ * only start when nothing else is running, and nothing else can start while it runs.
+ */
+class ComponentScheduler
+{
+public:
+    /**
+     * @brief Reserves @p componentIds for @p owner.
+     *
+     * @param owner A unique name for the workflow, e.g. the step index.
+     * @param componentIds The ids of the components targeted by the workflow. Empty means the host device.
+     * @return true if reserved; false if @p owner already holds a reservation or the set overlaps an existing one.
+     */
+    bool TryReserve(const std::string& owner, const std::vector<std::string>& componentIds);
+
+    /**
+     * @brief Releases the reservation held by @p owner, if any.
+     */
+    void Release(const std::string& owner);
+
+    /**
+     * @brief Whether @p componentId is currently reserved.
+     */
+    bool IsReserved(const std::string& componentId) const;
+
+    /**
+     * @brief Gets the number of owners holding a reservation.
+     */
+    size_t ActiveCount() const;
+
+private:
+    bool OverlapsLocked(const std::vector<std::string>& componentIds) const;
+
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, std::vector<std::string>> _reservations;
+    bool _exclusiveHeld{ false };
+};
+
+} // namespace ADUC
+
+#endif // ADUC_COMPONENT_SCHEDULER_UTILS_HPP
@@ -0,0 +1,87 @@
+/**
+ * @file component_scheduler_utils.cpp
+ * @brief Implements the component set scheduler.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/component_scheduler_utils.hpp"
+
+#include <algorithm>
+
+namespace ADUC
+{
+bool ComponentScheduler::TryReserve(const std::string& owner, const std::vector<std::string>& componentIds)
+{
+    std::lock_guard<std::mutex> lock{ _mutex };
+
+    if (_reservations.count(owner) > 0 || _exclusiveHeld)
+    {
+        return false;
+    }
+
+    if (componentIds.empty())
+    {
+        if (!_reservations.empty())
+        {
+            return false;
+        }
+
+        _exclusiveHeld = true;
+    }
+    else if (OverlapsLocked(componentIds))
+    {
+        return false;
+    }
+
+    _reservations.emplace(owner, componentIds);
+    return true;
+}
+
+void ComponentScheduler::Release(const std::string& owner)
+{
+    std::lock_guard<std::mutex> lock{ _mutex };
+
+    auto it = _reservations.find(owner);
+    if (it == _reservations.end())
+    {
+        return;
+    }
+
+    if (it->second.empty())
+    {
+        _exclusiveHeld = false;
+    }
+
+    _reservations.erase(it);
+}
+
+bool ComponentScheduler::IsReserved(const std::string& componentId) const
+{
+    std::lock_guard<std::mutex> lock{ _mutex };
+    return OverlapsLocked(std::vector<std::string>{ componentId });
+}
+
+size_t ComponentScheduler::ActiveCount() const
+{
+    std::lock_guard<std::mutex> lock{ _mutex };
+    return _reservations.size();
+}
+
+bool ComponentScheduler::OverlapsLocked(const std::vector<std::string>& componentIds) const
+{
+    for (const auto& reservation : _reservations)
+    {
+        for (const std::string& id : componentIds)
+        {
+            if (std::find(reservation.second.begin(), reservation.second.end(), id) != reservation.second.end())
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+} // namespace ADUC
@@ -0,0 +1,66 @@
+/**
+ * @file component_scheduler_utils_ut.cpp
+ * @brief Unit Tests for component_scheduler_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/component_scheduler_utils.hpp"
+
+#include <catch2/catch.hpp>
+
+using ADUC::ComponentScheduler;
+
+TEST_CASE("ComponentScheduler disjoint sets")
+{
+    ComponentScheduler scheduler;
+
+    CHECK(scheduler.TryReserve("step-0", { "camera-0", "camera-1" }));
+    CHECK(scheduler.TryReserve("step-1", { "sensor-0" }));
+    CHECK(scheduler.ActiveCount() == 2);
+    CHECK(scheduler.IsReserved("camera-1"));
+    CHECK_FALSE(scheduler.IsReserved("sensor-1"));
+}
+
+TEST_CASE("ComponentScheduler refuses overlapping sets")
+{
+    ComponentScheduler scheduler;
+
+    REQUIRE(scheduler.TryReserve("step-0", { "camera-0", "camera-1" }));
+    CHECK_FALSE(scheduler.TryReserve("step-1", { "camera-1", "sensor-0" }));
+    CHECK_FALSE(scheduler.IsReserved("sensor-0"));
+
+    SECTION("Same owner twice")
+    {
+        CHECK_FALSE(scheduler.TryReserve("step-0", { "sensor-0" }));
+    }
+
+    SECTION("Release frees the components")
+    {
+        scheduler.Release("step-0");
+        CHECK(scheduler.ActiveCount() == 0);
+        CHECK(scheduler.TryReserve("step-1", { "camera-1", "sensor-0" }));
+    }
+}
+
+TEST_CASE("ComponentScheduler empty set is exclusive")
+{
+    ComponentScheduler scheduler;
+
+    SECTION("Host step waits for component steps")
+    {
+        REQUIRE(scheduler.TryReserve("step-0", { "camera-0" }));
+        CHECK_FALSE(scheduler.TryReserve("host", {}));
+        scheduler.Release("step-0");
+        CHECK(scheduler.TryReserve("host", {}));
+    }
+
+    SECTION("Component steps wait for host step")
+    {
+        REQUIRE(scheduler.TryReserve("host", {}));
+        CHECK_FALSE(scheduler.TryReserve("step-0", { "camera-0" }));
+        CHECK_FALSE(scheduler.TryReserve("host-2", {}));
+        scheduler.Release("host");
+        CHECK(scheduler.TryReserve("step-0", { "camera-0" }));
+    }
+}
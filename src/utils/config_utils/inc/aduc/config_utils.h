@@ -80,6 +80,41 @@ typedef struct tagADUC_ConfigInfo
     unsigned int
         downloadTimeoutInMinutes; /**< The timeout for downloading an update payload. A value of zero means to use the default. */
 
+    unsigned int
+        mainLoopMaxIdleIntervalInMilliseconds; /**< The longest the agent main loop may sleep when there is no pending work. A value of zero means to use the default. */
+
+    unsigned int
+        maxConcurrentComponentUpdates; /**< The number of reference steps targeting disjoint components that may be installed at the same time. Zero or one means one at a time. */
+
+    unsigned int
+        maxReportedPropertySizeInBytes; /**< The byte budget for the reported update state and results; step results are trimmed to fit. A value of zero means to use the default. */
+
+    bool pipelineStepDownloads; /**< Whether the next step's payload downloads while the current step installs. */
+
+    bool enableWorkflowTracing; /**< Whether workflow phase spans are recorded to a trace file in the sandbox. */
+
+    bool
+        includeWorkflowTraceInDiagnostics; /**< Whether the workflow trace is copied to the log folder, and thus uploaded with the diagnostics logs. */
+
+    bool enableAduShellBroker; /**< Whether one adu-shell broker process runs the adu-shell tasks of each workflow. */
+
+    const char*
+        childProcessCgroup; /**< A cgroup v2 directory, delegated to the agent, in which each child process of a step handler gets a transient cgroup. NULL disables it. */
+
+    const char* childProcessCpuMax; /**< The cpu.max of the transient cgroup of a child process. */
+
+    const char* childProcessMemoryMax; /**< The memory.max of the transient cgroup of a child process. */
+
+    const char* childProcessIoMax; /**< The io.max of the transient cgroup of a child process. */
+
+    unsigned int
+        childProcessTimeoutInSeconds; /**< How long a child process of a step handler may run before it gets SIGTERM, then SIGKILL. Zero means no limit. */
+
+    bool childProcessLogOutput; /**< Whether each line of output of a child process of a step handler is logged. */
+
+    const char*
+        metricsSocketPath; /**< The Unix domain socket on which the agent serves its metrics. NULL disables the exporter. */
+
     const char* aduShellFolder; /**< The folder where ADU shell is installed. */
 
     char* aduShellFilePath; /**< The full path to ADU shell binary. */
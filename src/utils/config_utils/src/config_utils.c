@@ -51,6 +51,20 @@ static const char* CONFIG_MANUFACTURER = "manufacturer";
 static const char* CONFIG_MODEL = "model";
 static const char* CONFIG_SCHEMA_VERSION = "schemaVersion";
 static const char* CONFIG_DOWNLOAD_TIMEOUT_IN_MINUTES = "downloadTimeoutInMinutes";
+static const char* CONFIG_MAIN_LOOP_MAX_IDLE_INTERVAL_IN_MILLISECONDS = "mainLoopMaxIdleIntervalInMilliseconds";
+static const char* CONFIG_MAX_CONCURRENT_COMPONENT_UPDATES = "maxConcurrentComponentUpdates";
+static const char* CONFIG_MAX_REPORTED_PROPERTY_SIZE_IN_BYTES = "maxReportedPropertySizeInBytes";
+static const char* CONFIG_PIPELINE_STEP_DOWNLOADS = "pipelineStepDownloads";
+static const char* CONFIG_ENABLE_ADU_SHELL_BROKER = "enableAduShellBroker";
+static const char* CONFIG_CHILD_PROCESS_CGROUP = "childProcessCgroup";
+static const char* CONFIG_CHILD_PROCESS_CPU_MAX = "childProcessCpuMax";
+static const char* CONFIG_CHILD_PROCESS_MEMORY_MAX = "childProcessMemoryMax";
+static const char* CONFIG_CHILD_PROCESS_IO_MAX = "childProcessIoMax";
+static const char* CONFIG_CHILD_PROCESS_TIMEOUT_IN_SECONDS = "childProcessTimeoutInSeconds";
+static const char* CONFIG_CHILD_PROCESS_LOG_OUTPUT = "childProcessLogOutput";
+static const char* CONFIG_METRICS_SOCKET_PATH = "metricsSocketPath";
+static const char* CONFIG_ENABLE_WORKFLOW_TRACING = "enableWorkflowTracing";
+static const char* CONFIG_INCLUDE_WORKFLOW_TRACE_IN_DIAGNOSTICS = "includeWorkflowTraceInDiagnostics";
 
 static const char* CONFIG_NAME = "name";
 static const char* CONFIG_RUN_AS = "runas";
@@ -413,6 +427,46 @@ bool ADUC_ConfigInfo_Init(ADUC_ConfigInfo* config, const char* configFolder)
     ADUC_JSON_GetUnsignedIntegerField(
         config->rootJsonValue, CONFIG_DOWNLOAD_TIMEOUT_IN_MINUTES, &(config->downloadTimeoutInMinutes));
 
+    // Note: main loop max idle interval is optional.
+    ADUC_JSON_GetUnsignedIntegerField(
+        config->rootJsonValue,
+        CONFIG_MAIN_LOOP_MAX_IDLE_INTERVAL_IN_MILLISECONDS,
+        &(config->mainLoopMaxIdleIntervalInMilliseconds));
+
+    // Note: max concurrent component updates is optional.
+    ADUC_JSON_GetUnsignedIntegerField(
+        config->rootJsonValue, CONFIG_MAX_CONCURRENT_COMPONENT_UPDATES, &(config->maxConcurrentComponentUpdates));
+
+    // Note: max reported property size is optional.
+    ADUC_JSON_GetUnsignedIntegerField(
+        config->rootJsonValue, CONFIG_MAX_REPORTED_PROPERTY_SIZE_IN_BYTES, &(config->maxReportedPropertySizeInBytes));
+
+    // Note: pipelined step downloads is optional, and off by default.
+    config->pipelineStepDownloads = ADUC_JSON_GetBooleanField(config->rootJsonValue, CONFIG_PIPELINE_STEP_DOWNLOADS);
+
+    // Note: the adu-shell broker is optional, and off by default.
+    config->enableAduShellBroker = ADUC_JSON_GetBooleanField(config->rootJsonValue, CONFIG_ENABLE_ADU_SHELL_BROKER);
+
+    // Note: the transient cgroups of child processes, and their limits, are optional, and disabled by default.
+    config->childProcessCgroup = ADUC_JSON_GetStringFieldPtr(config->rootJsonValue, CONFIG_CHILD_PROCESS_CGROUP);
+    config->childProcessCpuMax = ADUC_JSON_GetStringFieldPtr(config->rootJsonValue, CONFIG_CHILD_PROCESS_CPU_MAX);
+    config->childProcessMemoryMax =
+        ADUC_JSON_GetStringFieldPtr(config->rootJsonValue, CONFIG_CHILD_PROCESS_MEMORY_MAX);
+    config->childProcessIoMax = ADUC_JSON_GetStringFieldPtr(config->rootJsonValue, CONFIG_CHILD_PROCESS_IO_MAX);
+
+    // Note: the child process timeout, and the logging of child process output, are optional, and off by default.
+    ADUC_JSON_GetUnsignedIntegerField(
+        config->rootJsonValue, CONFIG_CHILD_PROCESS_TIMEOUT_IN_SECONDS, &(config->childProcessTimeoutInSeconds));
+    config->childProcessLogOutput = ADUC_JSON_GetBooleanField(config->rootJsonValue, CONFIG_CHILD_PROCESS_LOG_OUTPUT);
+
+    // Note: the metrics exporter is optional, and disabled by default.
+    config->metricsSocketPath = ADUC_JSON_GetStringFieldPtr(config->rootJsonValue, CONFIG_METRICS_SOCKET_PATH);
+
+    // Note: workflow tracing is optional, and off by default.
+    config->enableWorkflowTracing = ADUC_JSON_GetBooleanField(config->rootJsonValue, CONFIG_ENABLE_WORKFLOW_TRACING);
+    config->includeWorkflowTraceInDiagnostics =
+        ADUC_JSON_GetBooleanField(config->rootJsonValue, CONFIG_INCLUDE_WORKFLOW_TRACE_IN_DIAGNOSTICS);
+
     // Ensure that adu-shell folder is valid.
     config->aduShellFolder = ADUC_JSON_GetStringFieldPtr(config->rootJsonValue, CONFIG_ADU_SHELL_FOLDER);
 
@@ -281,6 +281,20 @@ static const char* validConfigContentDownloadTimeout =
         R"("manufacturer": "device_info_manufacturer",)"
         R"("model": "device_info_model",)"
         R"("downloadTimeoutInMinutes": 1440,)"
+        R"("mainLoopMaxIdleIntervalInMilliseconds": 30000,)"
+        R"("maxConcurrentComponentUpdates": 4,)"
+        R"("maxReportedPropertySizeInBytes": 8192,)"
+        R"("pipelineStepDownloads": true,)"
+        R"("enableAduShellBroker": true,)"
+        R"("childProcessCgroup": "/sys/fs/cgroup/system.slice/deviceupdate-agent.service",)"
+        R"("childProcessCpuMax": "50000 100000",)"
+        R"("childProcessMemoryMax": "256M",)"
+        R"("childProcessIoMax": "8:0 wbps=1048576",)"
+        R"("childProcessTimeoutInSeconds": 3600,)"
+        R"("childProcessLogOutput": true,)"
+        R"("metricsSocketPath": "/run/adu/metrics.sock",)"
+        R"("enableWorkflowTracing": true,)"
+        R"("includeWorkflowTraceInDiagnostics": true,)"
         R"("compatPropertyNames": "manufacturer,model",)"
         R"("agents": [)"
             R"({ )"
@@ -535,6 +549,241 @@ TEST_CASE_METHOD(GlobalMockHookTestCaseFixture, "ADUC_ConfigInfo_Init Functional
         ADUC_ConfigInfo_UnInit(&config);
     }
 
+    SECTION("Valid config content, mainLoopMaxIdleIntervalInMilliseconds")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.mainLoopMaxIdleIntervalInMilliseconds == 30000);
+
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Missing config content, mainLoopMaxIdleIntervalInMilliseconds")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, invalidConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.mainLoopMaxIdleIntervalInMilliseconds == 0);
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Valid config content, maxConcurrentComponentUpdates")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.maxConcurrentComponentUpdates == 4);
+
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Missing config content, maxConcurrentComponentUpdates")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, invalidConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.maxConcurrentComponentUpdates == 0);
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Valid config content, maxReportedPropertySizeInBytes")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.maxReportedPropertySizeInBytes == 8192);
+
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Missing config content, maxReportedPropertySizeInBytes")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, invalidConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.maxReportedPropertySizeInBytes == 0);
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Valid config content, enableAduShellBroker")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.enableAduShellBroker);
+
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Missing config content, enableAduShellBroker")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, invalidConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK_FALSE(config.enableAduShellBroker);
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Valid config content, child process cgroup")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK_THAT(config.childProcessCgroup, Equals("/sys/fs/cgroup/system.slice/deviceupdate-agent.service"));
+        CHECK_THAT(config.childProcessCpuMax, Equals("50000 100000"));
+        CHECK_THAT(config.childProcessMemoryMax, Equals("256M"));
+        CHECK_THAT(config.childProcessIoMax, Equals("8:0 wbps=1048576"));
+
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Missing config content, child process cgroup")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, invalidConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.childProcessCgroup == nullptr);
+        CHECK(config.childProcessCpuMax == nullptr);
+        CHECK(config.childProcessMemoryMax == nullptr);
+        CHECK(config.childProcessIoMax == nullptr);
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Valid config content, child process timeout and output logging")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.childProcessTimeoutInSeconds == 3600);
+        CHECK(config.childProcessLogOutput);
+
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Missing config content, child process timeout and output logging")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, invalidConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.childProcessTimeoutInSeconds == 0);
+        CHECK_FALSE(config.childProcessLogOutput);
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Valid config content, pipelineStepDownloads")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.pipelineStepDownloads);
+
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Missing config content, pipelineStepDownloads")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, invalidConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK_FALSE(config.pipelineStepDownloads);
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Valid config content, metricsSocketPath")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK_THAT(config.metricsSocketPath, Equals("/run/adu/metrics.sock"));
+
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Missing config content, metricsSocketPath")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, invalidConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.metricsSocketPath == nullptr);
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Valid config content, workflow tracing")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK(config.enableWorkflowTracing);
+        CHECK(config.includeWorkflowTraceInDiagnostics);
+
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
+    SECTION("Missing config content, workflow tracing")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, invalidConfigContentDownloadTimeout) == 0);
+        ADUC::StringUtils::cstr_wrapper configStr{ g_configContentString };
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu"));
+        CHECK_FALSE(config.enableWorkflowTracing);
+        CHECK_FALSE(config.includeWorkflowTraceInDiagnostics);
+        ADUC_ConfigInfo_UnInit(&config);
+    }
+
     SECTION("Valid config content, mqtt iotHubProtocol")
     {
         REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentMqttIotHubProtocol) == 0);
@@ -0,0 +1,102 @@
+/**
+ * @file d2c_journal.h
+ * @brief A size-bounded, append-only journal of the newest undelivered Device-to-Cloud message per key.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_D2C_JOURNAL_H
+#define ADUC_D2C_JOURNAL_H
+
+#include "aduc/c_utils.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief The number of keys a journal holds. Keys are ADUC_D2C_Message_Type values.
+ */
+#define ADUC_D2C_JOURNAL_MAX_KEYS 16
+
+/**
+ * @brief An open journal.
+ */
+typedef struct _tagADUC_D2C_Journal ADUC_D2C_Journal;
+
+/**
+ * @brief Opens the journal at @p path, creating it if needed, and loads the pending message of each key.
+ *
+ *        The file is compacted on open, so only the pending messages remain. A record torn by a crash
+ *        or power loss ends the replay; the records before it are kept.
+ *
+ * @param path The journal file path. Its directory must exist.
+ * @param maxSizeBytes The size the journal file is kept under, by compacting it when an append would exceed it.
+ * @return The journal, or NULL on failure. To be closed with ADUC_D2C_Journal_Close().
+ */
+ADUC_D2C_Journal* ADUC_D2C_Journal_Open(const char* path, size_t maxSizeBytes);
+
+/**
+ * @brief Closes the journal. The pending messages stay in the file.
+ *
+ * @param journal The journal, or NULL.
+ */
+void ADUC_D2C_Journal_Close(ADUC_D2C_Journal* journal);
+
+/**
+ * @brief Records @p content as the pending message of @p key, superseding the previous one.
+ *
+ *        The record is written, but not synced to disk: call ADUC_D2C_Journal_Sync() with the returned sequence
+ *        number, outside of any lock the callers of Put() contend on.
+ *
+ * @param journal The journal.
+ * @param key The message key, less than ADUC_D2C_JOURNAL_MAX_KEYS.
+ * @param content The message content.
+ * @return The sequence number of the message, to be passed to ADUC_D2C_Journal_Complete(); 0 on failure.
+ *         On failure, @p key has no pending message, so a stale one is never replayed.
+ */
+unsigned long long ADUC_D2C_Journal_Put(ADUC_D2C_Journal* journal, unsigned int key, const char* content);
+
+/**
+ * @brief Syncs the journal file to disk, up to the message with sequence number @p sequence at least.
+ *
+ *        Concurrent callers share one fsync: a caller whose message was covered by another caller's fsync returns
+ *        without one. Appends are not blocked while the file is synced.
+ *
+ * @param journal The journal.
+ * @param sequence The sequence number returned by ADUC_D2C_Journal_Put().
+ * @return true if the message is on disk.
+ */
+bool ADUC_D2C_Journal_Sync(ADUC_D2C_Journal* journal, unsigned long long sequence);
+
+/**
+ * @brief Records that the message with sequence number @p sequence no longer needs to be sent.
+ *
+ *        No-op if the message was superseded. Not synced to disk: if the record is lost, the message is sent again.
+ *
+ * @param journal The journal.
+ * @param sequence The sequence number returned by ADUC_D2C_Journal_Put().
+ */
+void ADUC_D2C_Journal_Complete(ADUC_D2C_Journal* journal, unsigned long long sequence);
+
+/**
+ * @brief Gets a copy of the pending message of @p key.
+ *
+ * @param journal The journal.
+ * @param key The message key.
+ * @param[out] sequence The sequence number of the pending message.
+ * @return A copy of the content to be freed by the caller, or NULL if @p key has no pending message.
+ */
+char* ADUC_D2C_Journal_GetPending(ADUC_D2C_Journal* journal, unsigned int key, unsigned long long* sequence);
+
+/**
+ * @brief Gets the current size of the journal file, in bytes.
+ *
+ * @param journal The journal.
+ * @return The size of the journal file.
+ */
+size_t ADUC_D2C_Journal_GetSize(ADUC_D2C_Journal* journal);
+
+EXTERN_C_END
+
+#endif // ADUC_D2C_JOURNAL_H
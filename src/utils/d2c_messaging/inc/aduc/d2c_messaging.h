@@ -11,6 +11,7 @@
 #include "aduc/c_utils.h"
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <aducpal/time.h> // time_t
 
@@ -130,6 +131,7 @@ typedef struct _tagADUC_D2C_Message
     void* userData; /**< A data provided by caller */
     int lastHttpStatus; /**< The latest http status code received for this message */
     unsigned int attempts; /**< Total number of a send attempts */
+    unsigned long long journalSequence; /**< The outbox journal sequence number, or 0 if not journaled */
 } ADUC_D2C_Message;
 
 /**
@@ -148,7 +150,7 @@ typedef struct _tagADUC_D2C_Message_Processing_Context
     ADUC_D2C_Message message; /**< The message data to be send to the cloud service */
     ADUC_D2C_RetryStrategy* retryStrategy; /**< Retry strategy information */
     unsigned int retries; /**< Number of retries */
-    time_t nextRetryTimeStampEpoch; /**< The next retry time stamp. This is the time since epoch, in seconds */
+    uint64_t nextRetryTimeMs; /**< The next retry time. This is the monotonic time, in milliseconds */
 } ADUC_D2C_Message_Processing_Context;
 
 /**
@@ -163,10 +165,51 @@ bool ADUC_D2C_Messaging_Init();
  */
 void ADUC_D2C_Messaging_Uninit();
 
+/**
+ * @brief Enables batching: messages of different types that are ready within @p coalescingWindowMs of each other are
+ *        merged into one reported-properties patch, and each message's callbacks get the patch's response.
+ *
+ *        Messages are batched only when they share a transport function and a client handle, and their patches
+ *        don't set the same property to different values. Other messages are sent individually.
+ *
+ * @param coalescingWindowMs How long a new message waits for others to batch with, in milliseconds.
+ *                           Zero disables batching, which is the default, and ADUC_D2C_Messaging_Uninit() resets it.
+ */
+void ADUC_D2C_Messaging_EnableBatching(unsigned int coalescingWindowMs);
+
+/**
+ * @brief Persists the undelivered message of each type in an on-disk outbox journal, so it survives a restart.
+ *
+ *        Once enabled, every submitted message is journaled, and synced to disk before it is sent. It is removed
+ *        from the journal when the cloud accepts it, rejects it, or the maximum number of retries is reached. A
+ *        message canceled by ADUC_D2C_Messaging_Uninit(), e.g. at shutdown while offline, stays journaled, as does a
+ *        message left undelivered by a crash. Call ADUC_D2C_Messaging_ReplayJournal() to resend them after a
+ *        restart. The journal is closed by ADUC_D2C_Messaging_Uninit().
+ *
+ * @param journalPath The journal file path. Its directory must exist.
+ * @param maxJournalSizeBytes The size the journal file is kept under. A message that does not fit is not journaled.
+ * @return Returns true if success.
+ */
+bool ADUC_D2C_Messaging_EnableJournal(const char* journalPath, size_t maxJournalSizeBytes);
+
+/**
+ * @brief Resends the journaled message of the specified @p type, if no newer message was submitted since startup.
+ *
+ *        Component properties that a newer journaled message of another type sets are removed from it first, so
+ *        stale values do not overwrite newer ones. A message left without properties is dropped from the journal.
+ *
+ * @param type The message type.
+ * @param cloudServiceHandle An opaque pointer to the underlying cloud service handle.
+ * @return Returns true if a journaled message was queued.
+ */
+bool ADUC_D2C_Messaging_ReplayJournal(ADUC_D2C_Message_Type type, void* cloudServiceHandle);
+
 /**
  * @brief Performs messaging processing tasks.
  *
- * Note: must call this function every 100ms - 200ms to ensure that the Device to Cloud messages are processed in timely manner.
+ * Note: must be called from the agent main loop, which is woken through the reactor (see reactor_utils.h)
+ *       whenever a message is submitted, a response is received, or a retry is due. Only the message types
+ *       with new work are processed, so the call is cheap when nothing is due.
  *
  **/
 void ADUC_D2C_Messaging_DoWork();
@@ -0,0 +1,599 @@
+/**
+ * @file d2c_journal.c
+ * @brief Implements the size-bounded, append-only journal of undelivered Device-to-Cloud messages.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/d2c_journal.h"
+#include "aduc/logging.h"
+
+#include <azure_c_shared_utility/crt_abstractions.h> // mallocAndStrcpy_s
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h> // close, dup, fsync
+
+//
+// Journal records:
+//
+//   P <key> <sequence> <length> <checksum>\n<content>\n    the pending message of <key> is <content>
+//   C <sequence>\n                                         the message <sequence> no longer needs to be sent
+//
+// <checksum> is the FNV-1a hash of <content>, in hex. A record that is incomplete or fails its checksum was torn
+// by a crash, and ends the replay.
+//
+
+#define JOURNAL_TEMP_FILE_SUFFIX ".tmp"
+
+/**
+ * @brief Upper bound of a record header, including the newline.
+ */
+#define JOURNAL_MAX_HEADER_LENGTH 96
+
+typedef struct _tagADUC_D2C_Journal_Entry
+{
+    char* content; /**< The pending message, or NULL */
+    size_t length; /**< The length of content */
+    unsigned long long sequence; /**< The sequence number of content */
+} ADUC_D2C_Journal_Entry;
+
+struct _tagADUC_D2C_Journal
+{
+    pthread_mutex_t mutex; /**< Protects the journal, but for syncedSequence */
+    pthread_mutex_t syncMutex; /**< Serializes ADUC_D2C_Journal_Sync(), so concurrent callers share one fsync */
+    unsigned long long syncedSequence; /**< Messages up to this sequence number are on disk. Atomic */
+    char* path; /**< The journal file path */
+    FILE* file; /**< The journal file, opened for appending */
+    size_t size; /**< The size of the journal file */
+    size_t maxSizeBytes; /**< The size the journal file is kept under */
+    unsigned long long nextSequence; /**< The sequence number of the next message */
+    ADUC_D2C_Journal_Entry pending[ADUC_D2C_JOURNAL_MAX_KEYS]; /**< The pending message of each key */
+};
+
+static uint32_t Checksum(const char* data, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void ClearEntry(ADUC_D2C_Journal_Entry* entry)
+{
+    free(entry->content);
+    memset(entry, 0, sizeof(*entry));
+}
+
+static size_t FormatPutHeader(char* header, unsigned int key, const ADUC_D2C_Journal_Entry* entry)
+{
+    int length = snprintf(
+        header,
+        JOURNAL_MAX_HEADER_LENGTH,
+        "P %u %llu %zu %08x\n",
+        key,
+        entry->sequence,
+        entry->length,
+        (unsigned int)Checksum(entry->content, entry->length));
+    return length > 0 ? (size_t)length : 0;
+}
+
+/**
+ * @brief Records that the messages up to @p sequence are on disk, unless a later sequence number already is.
+ */
+static void AdvanceSyncedSequence(ADUC_D2C_Journal* journal, unsigned long long sequence)
+{
+    unsigned long long synced = __atomic_load_n(&journal->syncedSequence, __ATOMIC_ACQUIRE);
+    while (synced < sequence
+           && !__atomic_compare_exchange_n(
+               &journal->syncedSequence, &synced, sequence, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+    }
+}
+
+/**
+ * @brief Appends a record header, followed by @p content and a newline if not NULL, to @p file and flushes it.
+ */
+static bool AppendRecord(FILE* file, const char* header, size_t headerLength, const char* content, size_t length)
+{
+    if (fwrite(header, 1, headerLength, file) != headerLength)
+    {
+        return false;
+    }
+
+    if (content != NULL && (fwrite(content, 1, length, file) != length || fputc('\n', file) == EOF))
+    {
+        return false;
+    }
+
+    return fflush(file) == 0;
+}
+
+/**
+ * @brief Rewrites the journal with only the pending messages, through a temp file renamed over it.
+ *
+ * @return true on success. On failure, the previous journal file is left in place.
+ */
+static bool Compact(ADUC_D2C_Journal* journal)
+{
+    bool succeeded = false;
+    char* tempPath = NULL;
+    FILE* tempFile = NULL;
+    size_t size = 0;
+
+    const size_t tempPathLength = strlen(journal->path) + sizeof(JOURNAL_TEMP_FILE_SUFFIX);
+    tempPath = malloc(tempPathLength);
+    if (tempPath == NULL)
+    {
+        goto done;
+    }
+    (void)snprintf(tempPath, tempPathLength, "%s%s", journal->path, JOURNAL_TEMP_FILE_SUFFIX);
+
+    tempFile = fopen(tempPath, "wb");
+    if (tempFile == NULL)
+    {
+        Log_Error("Cannot create '%s', errno: %d", tempPath, errno);
+        goto done;
+    }
+
+    for (unsigned int key = 0; key < ADUC_D2C_JOURNAL_MAX_KEYS; ++key)
+    {
+        const ADUC_D2C_Journal_Entry* entry = &journal->pending[key];
+        if (entry->content == NULL)
+        {
+            continue;
+        }
+
+        char header[JOURNAL_MAX_HEADER_LENGTH];
+        const size_t headerLength = FormatPutHeader(header, key, entry);
+        if (!AppendRecord(tempFile, header, headerLength, entry->content, entry->length))
+        {
+            goto done;
+        }
+        size += headerLength + entry->length + 1;
+    }
+
+    if (fsync(fileno(tempFile)) != 0 || fclose(tempFile) != 0)
+    {
+        tempFile = NULL;
+        goto done;
+    }
+    tempFile = NULL;
+
+    if (rename(tempPath, journal->path) != 0)
+    {
+        Log_Error("Cannot replace '%s', errno: %d", journal->path, errno);
+        goto done;
+    }
+
+    if (journal->file != NULL)
+    {
+        fclose(journal->file);
+    }
+
+    journal->file = fopen(journal->path, "ab");
+    if (journal->file == NULL)
+    {
+        Log_Error("Cannot open '%s', errno: %d", journal->path, errno);
+        goto done;
+    }
+
+    journal->size = size;
+
+    // The pending messages were synced to the temp file.
+    AdvanceSyncedSequence(journal, journal->nextSequence - 1);
+    succeeded = true;
+
+done:
+    if (tempFile != NULL)
+    {
+        fclose(tempFile);
+    }
+
+    if (!succeeded && tempPath != NULL)
+    {
+        (void)remove(tempPath);
+    }
+
+    free(tempPath);
+
+    return succeeded;
+}
+
+/**
+ * @brief Parses the records in @p data into the pending messages of @p journal.
+ */
+static void Replay(ADUC_D2C_Journal* journal, const char* data, size_t dataLength)
+{
+    size_t offset = 0;
+    unsigned long long maxSequence = 0;
+
+    while (offset < dataLength)
+    {
+        const char* record = data + offset;
+        const size_t searchLength = dataLength - offset < JOURNAL_MAX_HEADER_LENGTH ? dataLength - offset
+                                                                                     : JOURNAL_MAX_HEADER_LENGTH;
+        const char* newline = memchr(record, '\n', searchLength);
+        if (newline == NULL)
+        {
+            break;
+        }
+
+        char header[JOURNAL_MAX_HEADER_LENGTH + 1];
+        memcpy(header, record, (size_t)(newline - record));
+        header[newline - record] = '\0';
+        offset += (size_t)(newline - record) + 1;
+
+        unsigned int key = 0;
+        unsigned long long sequence = 0;
+        size_t length = 0;
+        unsigned int checksum = 0;
+
+        if (sscanf(header, "P %u %llu %zu %x", &key, &sequence, &length, &checksum) == 4)
+        {
+            if (key >= ADUC_D2C_JOURNAL_MAX_KEYS || length > dataLength - offset
+                || dataLength - offset - length < 1 || data[offset + length] != '\n'
+                || Checksum(data + offset, length) != checksum)
+            {
+                break;
+            }
+
+            ADUC_D2C_Journal_Entry* entry = &journal->pending[key];
+            char* content = malloc(length + 1);
+            if (content == NULL)
+            {
+                break;
+            }
+            memcpy(content, data + offset, length);
+            content[length] = '\0';
+
+            ClearEntry(entry);
+            entry->content = content;
+            entry->length = length;
+            entry->sequence = sequence;
+
+            offset += length + 1;
+        }
+        else if (sscanf(header, "C %llu", &sequence) == 1)
+        {
+            for (unsigned int i = 0; i < ADUC_D2C_JOURNAL_MAX_KEYS; ++i)
+            {
+                if (journal->pending[i].content != NULL && journal->pending[i].sequence == sequence)
+                {
+                    ClearEntry(&journal->pending[i]);
+                }
+            }
+        }
+        else
+        {
+            break;
+        }
+
+        if (sequence > maxSequence)
+        {
+            maxSequence = sequence;
+        }
+    }
+
+    if (offset < dataLength)
+    {
+        Log_Warn("Ignoring %zu bytes of torn records at the end of the D2C journal", dataLength - offset);
+    }
+
+    journal->nextSequence = maxSequence + 1;
+}
+
+/**
+ * @brief Reads the whole file at @p path.
+ *
+ * @return The contents, to be freed by the caller, or NULL if the file is missing or cannot be read.
+ */
+static char* ReadFile(const char* path, size_t* length)
+{
+    char* data = NULL;
+    FILE* file = fopen(path, "rb");
+
+    *length = 0;
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    if (fseek(file, 0, SEEK_END) != 0)
+    {
+        goto done;
+    }
+
+    const long size = ftell(file);
+    if (size <= 0 || fseek(file, 0, SEEK_SET) != 0)
+    {
+        goto done;
+    }
+
+    data = malloc((size_t)size);
+    if (data == NULL)
+    {
+        goto done;
+    }
+
+    *length = fread(data, 1, (size_t)size, file);
+
+done:
+    fclose(file);
+
+    return data;
+}
+
+ADUC_D2C_Journal* ADUC_D2C_Journal_Open(const char* path, size_t maxSizeBytes)
+{
+    bool succeeded = false;
+    ADUC_D2C_Journal* journal = NULL;
+    char* data = NULL;
+
+    if (path == NULL || maxSizeBytes == 0)
+    {
+        goto done;
+    }
+
+    journal = calloc(1, sizeof(*journal));
+    if (journal == NULL)
+    {
+        goto done;
+    }
+
+    if (pthread_mutex_init(&journal->mutex, NULL) != 0)
+    {
+        free(journal);
+        journal = NULL;
+        goto done;
+    }
+
+    if (pthread_mutex_init(&journal->syncMutex, NULL) != 0)
+    {
+        pthread_mutex_destroy(&journal->mutex);
+        free(journal);
+        journal = NULL;
+        goto done;
+    }
+
+    journal->maxSizeBytes = maxSizeBytes;
+    journal->nextSequence = 1;
+
+    if (mallocAndStrcpy_s(&journal->path, path) != 0)
+    {
+        goto done;
+    }
+
+    size_t dataLength = 0;
+    data = ReadFile(path, &dataLength);
+    if (data != NULL)
+    {
+        Replay(journal, data, dataLength);
+    }
+
+    if (!Compact(journal))
+    {
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    free(data);
+
+    if (!succeeded)
+    {
+        ADUC_D2C_Journal_Close(journal);
+        journal = NULL;
+    }
+
+    return journal;
+}
+
+void ADUC_D2C_Journal_Close(ADUC_D2C_Journal* journal)
+{
+    if (journal == NULL)
+    {
+        return;
+    }
+
+    if (journal->file != NULL)
+    {
+        fclose(journal->file);
+    }
+
+    for (unsigned int key = 0; key < ADUC_D2C_JOURNAL_MAX_KEYS; ++key)
+    {
+        ClearEntry(&journal->pending[key]);
+    }
+
+    free(journal->path);
+    pthread_mutex_destroy(&journal->syncMutex);
+    pthread_mutex_destroy(&journal->mutex);
+    free(journal);
+}
+
+unsigned long long ADUC_D2C_Journal_Put(ADUC_D2C_Journal* journal, unsigned int key, const char* content)
+{
+    unsigned long long sequence = 0;
+
+    if (journal == NULL || key >= ADUC_D2C_JOURNAL_MAX_KEYS || content == NULL)
+    {
+        return 0;
+    }
+
+    char* contentCopy = NULL;
+    if (mallocAndStrcpy_s(&contentCopy, content) != 0)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+
+    ADUC_D2C_Journal_Entry* entry = &journal->pending[key];
+    ClearEntry(entry);
+    entry->content = contentCopy;
+    entry->length = strlen(contentCopy);
+    entry->sequence = journal->nextSequence++;
+
+    char header[JOURNAL_MAX_HEADER_LENGTH];
+    const size_t headerLength = FormatPutHeader(header, key, entry);
+    const size_t recordLength = headerLength + entry->length + 1;
+
+    if (journal->size + recordLength <= journal->maxSizeBytes && journal->file != NULL)
+    {
+        if (!AppendRecord(journal->file, header, headerLength, entry->content, entry->length))
+        {
+            Log_Error("Cannot append to the D2C journal, errno: %d", errno);
+            ClearEntry(entry);
+            // Rewrite the journal, so the superseded message is not replayed.
+            (void)Compact(journal);
+            goto done;
+        }
+
+        journal->size += recordLength;
+    }
+    else if (!Compact(journal) || journal->size > journal->maxSizeBytes)
+    {
+        Log_Warn("D2C message of %zu bytes does not fit the journal (t:%u)", entry->length, key);
+        ClearEntry(entry);
+        (void)Compact(journal);
+        goto done;
+    }
+
+    sequence = entry->sequence;
+
+done:
+    pthread_mutex_unlock(&journal->mutex);
+
+    return sequence;
+}
+
+bool ADUC_D2C_Journal_Sync(ADUC_D2C_Journal* journal, unsigned long long sequence)
+{
+    bool synced = false;
+
+    if (journal == NULL || sequence == 0)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&journal->syncMutex);
+
+    // Covered by the fsync of a concurrent caller, or by a compaction.
+    if (__atomic_load_n(&journal->syncedSequence, __ATOMIC_ACQUIRE) >= sequence)
+    {
+        synced = true;
+        goto done;
+    }
+
+    // Every record appended so far is flushed, and covered by this fsync. It runs on a duplicate of the file
+    // descriptor, without the journal mutex, so appends are not blocked meanwhile, and a compaction may
+    // replace the file.
+    pthread_mutex_lock(&journal->mutex);
+    const unsigned long long appendedSequence = journal->nextSequence - 1;
+    const int fd = journal->file == NULL ? -1 : dup(fileno(journal->file));
+    pthread_mutex_unlock(&journal->mutex);
+
+    if (fd == -1)
+    {
+        Log_Error("Cannot sync the D2C journal, errno: %d", errno);
+        goto done;
+    }
+
+    if (fsync(fd) != 0)
+    {
+        Log_Error("Cannot sync the D2C journal, errno: %d", errno);
+    }
+    else
+    {
+        AdvanceSyncedSequence(journal, appendedSequence);
+        synced = true;
+    }
+
+    close(fd);
+
+done:
+    pthread_mutex_unlock(&journal->syncMutex);
+
+    return synced;
+}
+
+void ADUC_D2C_Journal_Complete(ADUC_D2C_Journal* journal, unsigned long long sequence)
+{
+    if (journal == NULL || sequence == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+
+    for (unsigned int key = 0; key < ADUC_D2C_JOURNAL_MAX_KEYS; ++key)
+    {
+        if (journal->pending[key].content == NULL || journal->pending[key].sequence != sequence)
+        {
+            continue;
+        }
+
+        ClearEntry(&journal->pending[key]);
+
+        char header[JOURNAL_MAX_HEADER_LENGTH];
+        const int headerLength = snprintf(header, sizeof(header), "C %llu\n", sequence);
+
+        if (journal->file == NULL || headerLength <= 0
+            || journal->size + (size_t)headerLength > journal->maxSizeBytes
+            || !AppendRecord(journal->file, header, (size_t)headerLength, NULL, 0))
+        {
+            (void)Compact(journal);
+        }
+        else
+        {
+            journal->size += (size_t)headerLength;
+        }
+        break;
+    }
+
+    pthread_mutex_unlock(&journal->mutex);
+}
+
+char* ADUC_D2C_Journal_GetPending(ADUC_D2C_Journal* journal, unsigned int key, unsigned long long* sequence)
+{
+    char* content = NULL;
+
+    if (journal == NULL || key >= ADUC_D2C_JOURNAL_MAX_KEYS || sequence == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+
+    if (journal->pending[key].content != NULL && mallocAndStrcpy_s(&content, journal->pending[key].content) == 0)
+    {
+        *sequence = journal->pending[key].sequence;
+    }
+
+    pthread_mutex_unlock(&journal->mutex);
+
+    return content;
+}
+
+size_t ADUC_D2C_Journal_GetSize(ADUC_D2C_Journal* journal)
+{
+    if (journal == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+    const size_t size = journal->size;
+    pthread_mutex_unlock(&journal->mutex);
+
+    return size;
+}
@@ -7,11 +7,18 @@
  */
 #include "aduc/d2c_messaging.h"
 #include "aduc/client_handle_helper.h"
+#include "aduc/d2c_journal.h"
+#include "aduc/metrics_utils.h"
+#include "aduc/reactor_utils.h"
 #include "aduc/retry_utils.h"
 
 #include <limits.h>
 #include <math.h>
+#include <parson.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <aducpal/sys_time.h> // ADUCPAL_clock_gettime
 #include <aducpal/unistd.h>
@@ -31,13 +38,85 @@
 #define FATAL_ERROR_WAIT_TIME_SEC 10 // 10 seconds
 #define ONE_DAY_IN_SECONDS (1 * 24 * 60 * 60)
 
+/**
+ * @brief Consecutive throttled or failed IoT Hub responses after which no D2C message is sent for
+ * HUB_CIRCUIT_OPEN_DURATION_MS, except one probe.
+ */
+#define HUB_CIRCUIT_FAILURE_THRESHOLD 5
+#define HUB_CIRCUIT_OPEN_DURATION_MS (60 * 1000) // 1 minute
+
+/**
+ * @brief The maximum size of a batched reported-properties patch. IoT Hub limits the whole reported-properties
+ * document to 32 KB.
+ */
+#define MAX_BATCH_CONTENT_LENGTH (16 * 1024)
+
+/**
+ * @brief Serializes the producers of s_pendingMessageStore, and Init/Uninit. Not taken by the main loop.
+ */
 static pthread_mutex_t s_pendingMessageStoreMutex = PTHREAD_MUTEX_INITIALIZER;
 static bool s_core_initialized = false;
 
-static ADUC_D2C_Message s_pendingMessageStore[ADUC_D2C_Message_Type_Max];
+/**
+ * @brief The newest submitted message of each type, not yet picked up by ProcessMessage().
+ *
+ * Producers swap a message in under s_pendingMessageStoreMutex, so the journal records them in submission order.
+ * The main loop swaps it out atomically, without taking a lock.
+ */
+static ADUC_D2C_Message* s_pendingMessageStore[ADUC_D2C_Message_Type_Max];
 static ADUC_D2C_Message_Processing_Context s_messageProcessingContext[ADUC_D2C_Message_Type_Max];
 
-static void ProcessMessage(ADUC_D2C_Message_Processing_Context* context);
+/**
+ * @brief Bitmask of the message types that have a new message or a response to process.
+ */
+static unsigned int s_readyMessageTypes = 0;
+
+/**
+ * @brief The monotonic time, in milliseconds, at which each message type needs processing next; UINT64_MAX if idle.
+ */
+static uint64_t s_nextProcessingTimeMs[ADUC_D2C_Message_Type_Max];
+
+/**
+ * @brief How long a new message waits for others to batch with, in milliseconds. Zero disables batching.
+ */
+static unsigned int s_coalescingWindowMs = 0;
+
+/**
+ * @brief Messages sent as one merged reported-properties patch.
+ */
+typedef struct _tagADUC_D2C_Message_Batch
+{
+    ADUC_D2C_Message_Processing_Context context; /**< The context the merged patch is sent with. Must be first. */
+    size_t count; /**< The number of batched messages */
+    ADUC_D2C_Message_Processing_Context* members[ADUC_D2C_Message_Type_Max]; /**< The contexts of the messages */
+} ADUC_D2C_Message_Batch;
+
+/**
+ * @brief The outbox journal of undelivered messages, or NULL if not enabled. Protected by s_pendingMessageStoreMutex
+ * when set or cleared.
+ */
+static ADUC_D2C_Journal* s_journal = NULL;
+
+/**
+ * @brief Held for reading while the journal is synced outside s_pendingMessageStoreMutex, so concurrent producers
+ * share one fsync, and for writing while s_journal is set or cleared.
+ */
+static pthread_rwlock_t s_journalLock = PTHREAD_RWLOCK_INITIALIZER;
+
+static ADUC_Metric* s_sendAttemptsMetric = NULL;
+static ADUC_Metric* s_sendFailuresMetric = NULL;
+static ADUC_Metric* s_retriesMetric = NULL;
+static ADUC_Metric* s_maxRetriesReachedMetric = NULL;
+static ADUC_Metric* s_batchedMessagesMetric = NULL;
+
+/**
+ * @brief The circuit breaker of the IoT Hub endpoint, shared by all message types. Initialized once, and kept
+ * across Uninit(), since late transport callbacks may still record their response.
+ */
+static ADUC_Retry_Policy s_hubRetryPolicy;
+static bool s_hubRetryPolicyInitialized = false;
+
+static bool ProcessMessage(ADUC_D2C_Message_Processing_Context* context, uint64_t nowMs, bool batching);
 
 static time_t GetTimeSinceEpochInSeconds()
 {
@@ -132,6 +211,17 @@ static ADUC_D2C_RetryStrategy g_defaultRetryStrategy = {
     .maxJitterPercent = DEFAULT_MAX_JITTER_PERCENT,
 };
 
+/**
+ * @brief Marks @p type as having work for ADUC_D2C_Messaging_DoWork(), and wakes the main loop.
+ *
+ * @param type The message type.
+ */
+static void SignalMessageTypeReady(ADUC_D2C_Message_Type type)
+{
+    __atomic_fetch_or(&s_readyMessageTypes, 1u << type, __ATOMIC_RELEASE);
+    ADUC_Reactor_Wakeup();
+}
+
 /**
  * Release resources allocated for the @p message and reset all message fields.
 */
@@ -178,6 +268,20 @@ static void OnMessageProcessingCompleted(ADUC_D2C_Message* message, ADUC_D2C_Mes
         return;
     }
     SetMessageStatus(message, status);
+    if (status == ADUC_D2C_Message_Status_Max_Retries_Reached)
+    {
+        ADUC_Metrics_CounterAdd(s_maxRetriesReachedMetric, 1);
+    }
+
+    // Only delivered or permanently rejected messages leave the journal. A replaced message is superseded in the
+    // journal by its replacement. A message canceled at shutdown stays, and is replayed on the next start unless a
+    // newer message was submitted by then.
+    if (status == ADUC_D2C_Message_Status_Success || status == ADUC_D2C_Message_Status_Failed
+        || status == ADUC_D2C_Message_Status_Max_Retries_Reached)
+    {
+        ADUC_D2C_Journal_Complete(s_journal, message->journalSequence);
+    }
+
     if (message->completedCallback != NULL)
     {
         message->completedCallback(message, status);
@@ -186,7 +290,24 @@ static void OnMessageProcessingCompleted(ADUC_D2C_Message* message, ADUC_D2C_Mes
 }
 
 /**
- * @brief The function that is called when a 'reported property' patch response is received from the IoT Hub.
+ * @brief Records an IoT Hub response in the circuit breaker: throttling and server errors count as failures.
+ *
+ * @param http_status_code A HTTP Status Code
+ */
+static void RecordHubResponse(int http_status_code)
+{
+    if (http_status_code >= 200 && http_status_code < 300)
+    {
+        ADUC_Retry_Policy_OnSuccess(&s_hubRetryPolicy);
+    }
+    else if (http_status_code == 429 || (http_status_code >= 500 && http_status_code < 600))
+    {
+        (void)ADUC_Retry_Policy_OnFailure(&s_hubRetryPolicy, ADUC_Reactor_GetMonotonicTimeMs(), 0);
+    }
+}
+
+/**
+ * @brief Handles the IoT Hub response to the 'reported property' patch of one message.
  *
  * @param statusCode A HTTP Status Code
  * @param context A pointer to the ADUC_D2C_Message_Processing_Context object.
@@ -200,7 +321,7 @@ static void OnMessageProcessingCompleted(ADUC_D2C_Message* message, ADUC_D2C_Mes
  *      Otherwise, the context.processed will be set to true to indicates that the message has been processed,
  *  thus no further action is required.
  */
-static void DefaultIoTHubSendReportedStateCompletedCallback(int http_status_code, void* context)
+static void HandleSendReportedStateResponse(int http_status_code, void* context)
 {
     Log_Debug("context:0x%x", context);
     ADUC_D2C_Message_Processing_Context* message_processing_context = (ADUC_D2C_Message_Processing_Context*)context;
@@ -216,6 +337,9 @@ static void DefaultIoTHubSendReportedStateCompletedCallback(int http_status_code
         goto done;
     }
 
+    // Captured before the responseCallback() runs, to detect whether it set the next retry time.
+    uint64_t previousRetryTimeMs = message_processing_context->nextRetryTimeMs;
+
     // Note, stop processing the message if the responseCallback() returned false,
     // or http_status_code is >= 200 and < 300.
     bool success =
@@ -223,7 +347,6 @@ static void DefaultIoTHubSendReportedStateCompletedCallback(int http_status_code
          && !message_processing_context->message.responseCallback(http_status_code, message_processing_context))
         || ((http_status_code >= 200 && http_status_code < 300));
 
-    time_t previousRetryTimeStamp = message_processing_context->nextRetryTimeStampEpoch;
     // Call the responseCallback to allow the message owner to make a decision whether
     // to continue trying, and specified the 'nextRetryTimestamp' if needed.
     if (success)
@@ -239,7 +362,7 @@ static void DefaultIoTHubSendReportedStateCompletedCallback(int http_status_code
         goto done;
     }
 
-    if (message_processing_context->nextRetryTimeStampEpoch != previousRetryTimeStamp)
+    if (message_processing_context->nextRetryTimeMs != previousRetryTimeMs)
     {
         // It's possible that the next retry time has been set by the responseCallback(),
         // we don't need to do anything here.
@@ -279,6 +402,7 @@ static void DefaultIoTHubSendReportedStateCompletedCallback(int http_status_code
             }
 
             message_processing_context->retries++;
+            ADUC_Metrics_CounterAdd(s_retriesMetric, 1);
             time_t newTime = info->retryTimestampCalcFunc(
                 info->additionalDelaySecs,
                 message_processing_context->retries,
@@ -286,14 +410,18 @@ static void DefaultIoTHubSendReportedStateCompletedCallback(int http_status_code
                 message_processing_context->retryStrategy->maxDelaySecs,
                 message_processing_context->retryStrategy->maxJitterPercent);
 
+            // The calculator returns a wall-clock time; schedule against the monotonic clock.
+            time_t delaySecs = MAX(newTime - GetTimeSinceEpochInSeconds(), 0);
+
             Log_Debug(
-                "Will resend the message in %d second(s) (epoch:%d, t:%d, r:%d, c:0x%x)",
-                newTime - message_processing_context->nextRetryTimeStampEpoch,
-                newTime,
+                "Will resend the message in %ld second(s) (epoch:%ld, t:%d, r:%d, c:0x%x)",
+                (long)delaySecs,
+                (long)newTime,
                 message_processing_context->type,
                 message_processing_context->retries,
                 message_processing_context->message.content);
-            message_processing_context->nextRetryTimeStampEpoch = newTime;
+            message_processing_context->nextRetryTimeMs =
+                ADUC_Reactor_GetMonotonicTimeMs() + (uint64_t)delaySecs * 1000;
             SetMessageStatus(&message_processing_context->message, ADUC_D2C_Message_Status_In_Progress);
             goto done;
         }
@@ -301,8 +429,8 @@ static void DefaultIoTHubSendReportedStateCompletedCallback(int http_status_code
 
     if (!computed)
     {
-        message_processing_context->nextRetryTimeStampEpoch +=
-            (time_t)message_processing_context->retryStrategy->fallbackWaitTimeSec;
+        message_processing_context->nextRetryTimeMs = ADUC_Reactor_GetMonotonicTimeMs()
+            + (uint64_t)message_processing_context->retryStrategy->fallbackWaitTimeSec * 1000;
         Log_Warn(
             "Failed to calculate the next retry timestamp. Next retry in %lu seconds.",
             message_processing_context->retryStrategy->fallbackWaitTimeSec);
@@ -311,104 +439,444 @@ static void DefaultIoTHubSendReportedStateCompletedCallback(int http_status_code
 
 done:
     pthread_mutex_unlock(&message_processing_context->mutex);
+
+    // Let the main loop pick up the next message or schedule the retry without waiting for its idle timeout.
+    SignalMessageTypeReady(message_processing_context->type);
+}
+
+/**
+ * @brief The transport callback for a single message. See HandleSendReportedStateResponse().
+ *
+ * @param http_status_code A HTTP Status Code
+ * @param context A pointer to the ADUC_D2C_Message_Processing_Context object.
+ */
+static void DefaultIoTHubSendReportedStateCompletedCallback(int http_status_code, void* context)
+{
+    RecordHubResponse(http_status_code);
+    HandleSendReportedStateResponse(http_status_code, context);
+}
+
+/**
+ * @brief Hands the message of @p message_processing_context to its transport.
+ *
+ * Note: must be called with message_processing_context->mutex held.
+ */
+static void SendMessage(ADUC_D2C_Message_Processing_Context* message_processing_context, uint64_t nowMs)
+{
+    const ADUC_D2C_Message_Type type = message_processing_context->type;
+
+    if (message_processing_context->transportFunc == NULL)
+    {
+        Log_Error(
+            "Cannot send message. Transport function is NULL. Will retry in the next %d seconds. (t:%d)",
+            FATAL_ERROR_WAIT_TIME_SEC,
+            type);
+        message_processing_context->nextRetryTimeMs += FATAL_ERROR_WAIT_TIME_SEC * 1000;
+        return;
+    }
+
+    uint64_t retryAtMs = 0;
+    if (!ADUC_Retry_Policy_AllowAttempt(&s_hubRetryPolicy, nowMs, &retryAtMs))
+    {
+        Log_Debug("IoT Hub circuit is open. Deferring D2C message (t:%d).", type);
+        message_processing_context->nextRetryTimeMs = retryAtMs;
+        return;
+    }
+
+    message_processing_context->message.attempts++;
+    ADUC_Metrics_CounterAdd(s_sendAttemptsMetric, 1);
+    Log_Debug("Sending D2C message (t:%d, retries:%d).", type, message_processing_context->retries);
+    if (message_processing_context->transportFunc(
+            message_processing_context->message.cloudServiceHandle,
+            message_processing_context,
+            DefaultIoTHubSendReportedStateCompletedCallback)
+        != 0)
+    {
+        message_processing_context->nextRetryTimeMs += FATAL_ERROR_WAIT_TIME_SEC * 1000;
+        ADUC_Metrics_CounterAdd(s_sendFailuresMetric, 1);
+        Log_Error(
+            "Failed to send message. Will retry in the next %d seconds. (t:%d)", FATAL_ERROR_WAIT_TIME_SEC, type);
+    }
+    else if (
+        message_processing_context->message.status == ADUC_D2C_Message_Status_In_Progress
+        && message_processing_context->nextRetryTimeMs <= nowMs)
+    {
+        // The transport neither failed nor awaits a response; don't resend in a tight loop.
+        message_processing_context->nextRetryTimeMs = nowMs + ADUC_REACTOR_TRANSPORT_BUSY_INTERVAL_MS;
+    }
+}
+
+/**
+ * @brief Publishes the time at which ADUC_D2C_Messaging_DoWork() needs to process @p message_processing_context.
+ *
+ * Note: must be called with message_processing_context->mutex held.
+ */
+static void UpdateNextProcessingTime(ADUC_D2C_Message_Processing_Context* message_processing_context, uint64_t nowMs)
+{
+    uint64_t nextProcessingTimeMs = UINT64_MAX;
+
+    if (message_processing_context->message.content != NULL)
+    {
+        if (message_processing_context->message.status == ADUC_D2C_Message_Status_Waiting_For_Response)
+        {
+            // The transport must be serviced until the response arrives.
+            nextProcessingTimeMs = nowMs + ADUC_REACTOR_TRANSPORT_BUSY_INTERVAL_MS;
+        }
+        else if (message_processing_context->message.status == ADUC_D2C_Message_Status_In_Progress)
+        {
+            nextProcessingTimeMs = message_processing_context->nextRetryTimeMs;
+        }
+    }
+
+    __atomic_store_n(
+        &s_nextProcessingTimeMs[message_processing_context->type], nextProcessingTimeMs, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Returns true if merging the @p source patch into @p target would change a value already in @p target.
+ */
+static bool PatchesConflict(const JSON_Object* target, const JSON_Object* source)
+{
+    for (size_t i = 0; i < json_object_get_count(source); ++i)
+    {
+        const JSON_Value* targetValue = json_object_get_value(target, json_object_get_name(source, i));
+        const JSON_Value* sourceValue = json_object_get_value_at(source, i);
+
+        if (targetValue == NULL)
+        {
+            continue;
+        }
+
+        if (json_value_get_type(targetValue) == JSONObject && json_value_get_type(sourceValue) == JSONObject)
+        {
+            if (PatchesConflict(json_value_get_object(targetValue), json_value_get_object(sourceValue)))
+            {
+                return true;
+            }
+        }
+        else if (!json_value_equals(targetValue, sourceValue))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Merges the @p source patch into @p target. The patches must not conflict (see PatchesConflict).
+ */
+static bool MergePatch(JSON_Object* target, const JSON_Object* source)
+{
+    for (size_t i = 0; i < json_object_get_count(source); ++i)
+    {
+        const char* name = json_object_get_name(source, i);
+        JSON_Value* targetValue = json_object_get_value(target, name);
+        JSON_Value* sourceValue = json_object_get_value_at(source, i);
+
+        if (targetValue == NULL)
+        {
+            JSON_Value* copy = json_value_deep_copy(sourceValue);
+            if (copy == NULL || json_object_set_value(target, name, copy) != JSONSuccess)
+            {
+                json_value_free(copy);
+                return false;
+            }
+        }
+        else if (
+            json_value_get_type(targetValue) == JSONObject
+            && !MergePatch(json_value_get_object(targetValue), json_value_get_object(sourceValue)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Returns true if @p a and @p b can be sent in one batch: same transport and same client handle.
+ */
+static bool
+CanBatchTogether(const ADUC_D2C_Message_Processing_Context* a, const ADUC_D2C_Message_Processing_Context* b)
+{
+    if (a->transportFunc != b->transportFunc || a->message.cloudServiceHandle == NULL
+        || b->message.cloudServiceHandle == NULL)
+    {
+        return false;
+    }
+
+    return *((ADUC_ClientHandle*)a->message.cloudServiceHandle)
+        == *((ADUC_ClientHandle*)b->message.cloudServiceHandle);
+}
+
+/**
+ * @brief The function that is called when the response to a batched patch is received. Fans the response out
+ * to each batched message.
+ *
+ * @param http_status_code A HTTP Status Code
+ * @param context A pointer to the ADUC_D2C_Message_Batch object.
+ */
+static void BatchSendReportedStateCompletedCallback(int http_status_code, void* context)
+{
+    ADUC_D2C_Message_Batch* batch = (ADUC_D2C_Message_Batch*)context;
+
+    RecordHubResponse(http_status_code);
+    for (size_t i = 0; i < batch->count; i++)
+    {
+        HandleSendReportedStateResponse(http_status_code, batch->members[i]);
+    }
+
+    free(batch->context.message.content);
+    free(batch);
+}
+
+/**
+ * @brief Sends the due messages flagged in @p due, and the messages still in their coalescing window,
+ * as one merged patch per transport. Messages that cannot be merged are sent individually.
+ *
+ * @param due The message types whose message is due, indexed by type.
+ * @param nowMs The current monotonic time, in milliseconds.
+ */
+static void SendBatch(const bool* due, uint64_t nowMs)
+{
+    ADUC_D2C_Message_Batch* batch = NULL;
+    JSON_Value* patchValue = json_value_init_object();
+    char* patch = NULL;
+    size_t patchLength = 2; // "{}"
+    uint64_t retryAtMs = 0;
+
+    batch = calloc(1, sizeof(*batch));
+    if (batch == NULL || patchValue == NULL)
+    {
+        Log_Error("Cannot allocate D2C message batch.");
+    }
+
+    // Locked in type order; the members stay locked until their status reflects the send.
+    for (int i = 0; i < ADUC_D2C_Message_Type_Max; i++)
+    {
+        ADUC_D2C_Message_Processing_Context* message_processing_context = &s_messageProcessingContext[i];
+        JSON_Value* messageValue = NULL;
+        bool added = false;
+
+        pthread_mutex_lock(&message_processing_context->mutex);
+
+        // A message still in its coalescing window joins, as long as it was never sent.
+        const bool eligible = message_processing_context->message.content != NULL
+            && message_processing_context->message.status == ADUC_D2C_Message_Status_In_Progress
+            && (due[i] || message_processing_context->message.attempts == 0);
+
+        if (eligible && batch != NULL && patchValue != NULL && message_processing_context->transportFunc != NULL
+            && (batch->count == 0 || CanBatchTogether(batch->members[0], message_processing_context))
+            && patchLength + strlen(message_processing_context->message.content) <= MAX_BATCH_CONTENT_LENGTH)
+        {
+            messageValue = json_parse_string(message_processing_context->message.content);
+            if (json_value_get_type(messageValue) == JSONObject
+                && !PatchesConflict(json_value_get_object(patchValue), json_value_get_object(messageValue))
+                && MergePatch(json_value_get_object(patchValue), json_value_get_object(messageValue)))
+            {
+                patchLength = json_serialization_size(patchValue);
+                batch->members[batch->count++] = message_processing_context;
+                added = true;
+            }
+            json_value_free(messageValue);
+        }
+
+        if (!added)
+        {
+            if (eligible && due[i])
+            {
+                SendMessage(message_processing_context, nowMs);
+            }
+            UpdateNextProcessingTime(message_processing_context, nowMs);
+            pthread_mutex_unlock(&message_processing_context->mutex);
+        }
+    }
+
+    if (batch == NULL || batch->count == 0)
+    {
+        goto done;
+    }
+
+    if (batch->count > 1 && !ADUC_Retry_Policy_AllowAttempt(&s_hubRetryPolicy, nowMs, &retryAtMs))
+    {
+        Log_Debug("IoT Hub circuit is open. Deferring %zu D2C messages.", batch->count);
+        for (size_t i = 0; i < batch->count; i++)
+        {
+            batch->members[i]->nextRetryTimeMs = retryAtMs;
+            UpdateNextProcessingTime(batch->members[i], nowMs);
+            pthread_mutex_unlock(&batch->members[i]->mutex);
+        }
+        goto done;
+    }
+
+    if (batch->count > 1)
+    {
+        patch = json_serialize_to_string(patchValue);
+        if (patch != NULL && mallocAndStrcpy_s(&batch->context.message.content, patch) == 0)
+        {
+            ADUC_D2C_Message_Processing_Context* first = batch->members[0];
+            batch->context.type = first->type;
+            batch->context.transportFunc = first->transportFunc;
+            batch->context.message.cloudServiceHandle = first->message.cloudServiceHandle;
+            batch->context.message.status = ADUC_D2C_Message_Status_In_Progress;
+
+            ADUC_Metrics_CounterAdd(s_sendAttemptsMetric, 1);
+            Log_Debug("Sending %zu D2C messages as one patch.", batch->count);
+
+            // On failure, the default transport completes, and frees, the batch message.
+            const int result = first->transportFunc(
+                batch->context.message.cloudServiceHandle, &batch->context, BatchSendReportedStateCompletedCallback);
+
+            if (result == 0 && batch->context.message.status == ADUC_D2C_Message_Status_Waiting_For_Response)
+            {
+                ADUC_Metrics_CounterAdd(s_batchedMessagesMetric, batch->count);
+                for (size_t i = 0; i < batch->count; i++)
+                {
+                    batch->members[i]->message.attempts++;
+                    SetMessageStatus(&batch->members[i]->message, ADUC_D2C_Message_Status_Waiting_For_Response);
+                    UpdateNextProcessingTime(batch->members[i], nowMs);
+                    pthread_mutex_unlock(&batch->members[i]->mutex);
+                }
+
+                // The response callback owns the batch now.
+                batch = NULL;
+                goto done;
+            }
+
+            ADUC_Metrics_CounterAdd(s_sendFailuresMetric, 1);
+            Log_Warn("Failed to send %zu D2C messages as one patch. Sending them individually.", batch->count);
+        }
+    }
+
+    // A lone message still in its coalescing window keeps waiting.
+    for (size_t i = 0; i < batch->count; i++)
+    {
+        ADUC_D2C_Message_Processing_Context* member = batch->members[i];
+        if (batch->count > 1 || due[member->type])
+        {
+            SendMessage(member, nowMs);
+        }
+        UpdateNextProcessingTime(member, nowMs);
+        pthread_mutex_unlock(&member->mutex);
+    }
+
+done:
+    if (batch != NULL)
+    {
+        free(batch->context.message.content);
+        free(batch);
+    }
+    json_free_serialized_string(patch);
+    json_value_free(patchValue);
 }
 
 /**
  * @brief Performs messages processing tasks.
  *
- * Note: must call this function every 100ms - 200ms to ensure that the Device to Cloud messages
- *       are processed in timely manner.
+ * Note: only the message types that were signaled (a new message or a response) or whose deadline is due are
+ *       processed. This function then requests its own next wakeup from the reactor (see reactor_utils.h), for
+ *       the earliest deadline.
  *
  **/
 void ADUC_D2C_Messaging_DoWork()
 {
+    const uint64_t nowMs = ADUC_Reactor_GetMonotonicTimeMs();
+    const unsigned int readyMessageTypes = __atomic_exchange_n(&s_readyMessageTypes, 0, __ATOMIC_ACQ_REL);
+    const bool batching = __atomic_load_n(&s_coalescingWindowMs, __ATOMIC_RELAXED) > 0;
+    bool due[ADUC_D2C_Message_Type_Max] = { false };
+    bool anyDue = false;
+    uint64_t earliestProcessingTimeMs = UINT64_MAX;
+
+    for (int i = 0; i < ADUC_D2C_Message_Type_Max; i++)
+    {
+        if ((readyMessageTypes & (1u << i)) != 0
+            || __atomic_load_n(&s_nextProcessingTimeMs[i], __ATOMIC_ACQUIRE) <= nowMs)
+        {
+            due[i] = ProcessMessage(&s_messageProcessingContext[i], nowMs, batching);
+            anyDue = anyDue || due[i];
+        }
+    }
+
+    if (anyDue)
+    {
+        SendBatch(due, nowMs);
+    }
+
     for (int i = 0; i < ADUC_D2C_Message_Type_Max; i++)
     {
-        ProcessMessage(&s_messageProcessingContext[i]);
+        earliestProcessingTimeMs =
+            MIN(earliestProcessingTimeMs, __atomic_load_n(&s_nextProcessingTimeMs[i], __ATOMIC_ACQUIRE));
+    }
+
+    if (earliestProcessingTimeMs != UINT64_MAX)
+    {
+        const uint64_t delayMs = earliestProcessingTimeMs > nowMs ? earliestProcessingTimeMs - nowMs : 0;
+        ADUC_Reactor_RequestWakeupInMs((unsigned int)MIN(delayMs, UINT_MAX));
     }
 }
 
-static void ProcessMessage(ADUC_D2C_Message_Processing_Context* message_processing_context)
+/**
+ * @brief Picks up the pending message of @p message_processing_context, and sends it if due.
+ *
+ * @param message_processing_context The message processing context.
+ * @param nowMs The current monotonic time, in milliseconds.
+ * @param batching If true, a due message is not sent, but reported to the caller to be batched.
+ * @return true if @p batching and the message is due.
+ */
+static bool ProcessMessage(
+    ADUC_D2C_Message_Processing_Context* message_processing_context, uint64_t nowMs, bool batching)
 {
     bool shouldSend = false;
-    time_t now = GetTimeSinceEpochInSeconds();
-    pthread_mutex_lock(&s_pendingMessageStoreMutex);
+    const ADUC_D2C_Message_Type type = message_processing_context->type;
+
     pthread_mutex_lock(&message_processing_context->mutex);
 
-    if (s_pendingMessageStore[message_processing_context->type].content != NULL)
+    // While waiting for a response, a new message stays pending; the response signals this type again.
+    const bool waitingForResponse = message_processing_context->message.content != NULL
+        && message_processing_context->message.status == ADUC_D2C_Message_Status_Waiting_For_Response;
+
+    ADUC_D2C_Message* pendingMessage =
+        waitingForResponse ? NULL : __atomic_exchange_n(&s_pendingMessageStore[type], NULL, __ATOMIC_ACQ_REL);
+
+    if (pendingMessage != NULL)
     {
         if (message_processing_context->message.content != NULL)
         {
-            if (message_processing_context->message.status == ADUC_D2C_Message_Status_Waiting_For_Response)
-            {
-                // Let's wait to see what the response is.
-                goto done;
-            }
-
             // Discard old message.
-            Log_Info(
-                "New D2C message content (t:%d, content:0x%x).",
-                message_processing_context->type,
-                s_pendingMessageStore[message_processing_context->type].content);
+            Log_Info("New D2C message content (t:%d, content:0x%x).", type, pendingMessage->content);
             OnMessageProcessingCompleted(&message_processing_context->message, ADUC_D2C_Message_Status_Replaced);
         }
 
-        // Use new message
-        memset(&message_processing_context->message, 0, sizeof(message_processing_context->message));
-        message_processing_context->message = s_pendingMessageStore[message_processing_context->type];
+        // Use new message. When batching, it waits for others to batch with.
+        message_processing_context->message = *pendingMessage;
+        free(pendingMessage);
         message_processing_context->message.attempts = 0;
         message_processing_context->retries = 0;
-        message_processing_context->nextRetryTimeStampEpoch = now;
-
-        // Empty pending message store.
-        memset(&s_pendingMessageStore[message_processing_context->type], 0, sizeof(ADUC_D2C_Message));
-        shouldSend = message_processing_context->message.content != NULL;
+        message_processing_context->nextRetryTimeMs =
+            nowMs + (batching ? __atomic_load_n(&s_coalescingWindowMs, __ATOMIC_RELAXED) : 0);
+        shouldSend = !batching;
 
         SetMessageStatus(&message_processing_context->message, ADUC_D2C_Message_Status_In_Progress);
     }
     else if (
         (message_processing_context->message.content != NULL)
         && (message_processing_context->message.status == ADUC_D2C_Message_Status_In_Progress)
-        && (now >= message_processing_context->nextRetryTimeStampEpoch))
+        && (nowMs >= message_processing_context->nextRetryTimeMs))
     {
         shouldSend = true;
     }
 
-    if (shouldSend)
+    if (shouldSend && !batching)
     {
-        if (message_processing_context->transportFunc == NULL)
-        {
-            Log_Error(
-                "Cannot send message. Transport function is NULL. Will retry in the next %d seconds. (t:%d)",
-                FATAL_ERROR_WAIT_TIME_SEC,
-                message_processing_context->type);
-            message_processing_context->nextRetryTimeStampEpoch += FATAL_ERROR_WAIT_TIME_SEC;
-        }
-        else
-        {
-            message_processing_context->message.attempts++;
-            Log_Debug(
-                "Sending D2C message (t:%d, retries:%d).",
-                message_processing_context->type,
-                message_processing_context->retries);
-            if (message_processing_context->transportFunc(
-                    message_processing_context->message.cloudServiceHandle,
-                    message_processing_context,
-                    DefaultIoTHubSendReportedStateCompletedCallback)
-                != 0)
-            {
-                message_processing_context->nextRetryTimeStampEpoch += FATAL_ERROR_WAIT_TIME_SEC;
-                Log_Error(
-                    "Failed to send message. Will retry in the next %d seconds. (t:%d)",
-                    FATAL_ERROR_WAIT_TIME_SEC,
-                    message_processing_context->type);
-            }
-        }
+        SendMessage(message_processing_context, nowMs);
     }
 
-done:
+    UpdateNextProcessingTime(message_processing_context, nowMs);
+
     pthread_mutex_unlock(&message_processing_context->mutex);
-    pthread_mutex_unlock(&s_pendingMessageStoreMutex);
+
+    return shouldSend && batching;
 }
 
 /**
@@ -425,8 +893,10 @@ bool ADUC_D2C_Messaging_Init()
     {
         memset(&s_messageProcessingContext, 0, sizeof(s_messageProcessingContext));
         memset(&s_pendingMessageStore, 0, sizeof(s_pendingMessageStore));
+        __atomic_store_n(&s_readyMessageTypes, 0, __ATOMIC_RELEASE);
         for (i = 0; i < ADUC_D2C_Message_Type_Max; i++)
         {
+            __atomic_store_n(&s_nextProcessingTimeMs[i], UINT64_MAX, __ATOMIC_RELEASE);
             s_messageProcessingContext[i].type = i;
             s_messageProcessingContext[i].transportFunc = ADUC_D2C_Default_Message_Transport_Function;
             s_messageProcessingContext[i].retryStrategy = &g_defaultRetryStrategy;
@@ -437,6 +907,38 @@ bool ADUC_D2C_Messaging_Init()
                 goto done;
             }
         }
+
+        s_sendAttemptsMetric = ADUC_Metrics_RegisterCounter(
+            "adu_d2c_send_attempts_total", "Number of D2C messages handed to the transport.");
+        s_sendFailuresMetric = ADUC_Metrics_RegisterCounter(
+            "adu_d2c_send_failures_total", "Number of D2C messages the transport failed to send.");
+        s_retriesMetric = ADUC_Metrics_RegisterCounter(
+            "adu_d2c_retries_total", "Number of D2C message retries scheduled after an IoT Hub response.");
+        s_maxRetriesReachedMetric = ADUC_Metrics_RegisterCounter(
+            "adu_d2c_max_retries_reached_total",
+            "Number of D2C messages abandoned after the maximum number of retries.");
+        s_batchedMessagesMetric = ADUC_Metrics_RegisterCounter(
+            "adu_d2c_batched_messages_total", "Number of D2C messages sent as part of a merged patch.");
+
+        if (!s_hubRetryPolicyInitialized)
+        {
+            s_hubRetryPolicyInitialized = ADUC_Retry_Policy_Init(
+                &s_hubRetryPolicy,
+                ADUC_RETRY_DEFAULT_INITIAL_DELAY_MS,
+                ADUC_RETRY_DEFAULT_MAX_BACKOFF_TIME_MS,
+                HUB_CIRCUIT_FAILURE_THRESHOLD,
+                HUB_CIRCUIT_OPEN_DURATION_MS);
+            if (!s_hubRetryPolicyInitialized)
+            {
+                Log_Error("Can't init the IoT Hub retry policy.");
+                goto done;
+            }
+        }
+        else
+        {
+            ADUC_Retry_Policy_OnSuccess(&s_hubRetryPolicy);
+        }
+
         s_core_initialized = true;
     }
     success = true;
@@ -459,22 +961,258 @@ void ADUC_D2C_Messaging_Uninit()
         for (int i = 0; i < ADUC_D2C_Message_Type_Max; i++)
         {
             pthread_mutex_lock(&s_messageProcessingContext[i].mutex);
-            if (s_pendingMessageStore[i].content != NULL)
+            ADUC_D2C_Message* pendingMessage = __atomic_exchange_n(&s_pendingMessageStore[i], NULL, __ATOMIC_ACQ_REL);
+            if (pendingMessage != NULL)
             {
-                OnMessageProcessingCompleted(&s_pendingMessageStore[i], ADUC_D2C_Message_Status_Canceled);
+                OnMessageProcessingCompleted(pendingMessage, ADUC_D2C_Message_Status_Canceled);
+                free(pendingMessage);
             }
 
             if (s_messageProcessingContext[i].message.content != NULL)
             {
                 OnMessageProcessingCompleted(&s_messageProcessingContext[i].message, ADUC_D2C_Message_Status_Canceled);
             }
+            __atomic_store_n(&s_nextProcessingTimeMs[i], UINT64_MAX, __ATOMIC_RELEASE);
             pthread_mutex_unlock(&s_messageProcessingContext[i].mutex);
             pthread_mutex_destroy(&s_messageProcessingContext[i].mutex);
             s_messageProcessingContext[i].initialized = false;
         }
         s_core_initialized = false;
     }
+
+    pthread_rwlock_wrlock(&s_journalLock);
+    ADUC_D2C_Journal_Close(s_journal);
+    s_journal = NULL;
+    pthread_rwlock_unlock(&s_journalLock);
+    __atomic_store_n(&s_coalescingWindowMs, 0, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&s_pendingMessageStoreMutex);
+}
+
+void ADUC_D2C_Messaging_EnableBatching(unsigned int coalescingWindowMs)
+{
+    __atomic_store_n(&s_coalescingWindowMs, coalescingWindowMs, __ATOMIC_RELAXED);
+    Log_Info(
+        "D2C message batching %s (window:%u ms)", coalescingWindowMs > 0 ? "enabled" : "disabled", coalescingWindowMs);
+}
+
+bool ADUC_D2C_Messaging_EnableJournal(const char* journalPath, size_t maxJournalSizeBytes)
+{
+    bool success = false;
+
+    pthread_mutex_lock(&s_pendingMessageStoreMutex);
+
+    if (s_journal != NULL)
+    {
+        Log_Error("D2C journal is already enabled.");
+        goto done;
+    }
+
+    pthread_rwlock_wrlock(&s_journalLock);
+    s_journal = ADUC_D2C_Journal_Open(journalPath, maxJournalSizeBytes);
+    pthread_rwlock_unlock(&s_journalLock);
+    if (s_journal == NULL)
+    {
+        Log_Error("Cannot open D2C journal '%s'", journalPath);
+        goto done;
+    }
+
+    Log_Info("D2C journal '%s' enabled (size:%zu)", journalPath, ADUC_D2C_Journal_GetSize(s_journal));
+    success = true;
+
+done:
+    pthread_mutex_unlock(&s_pendingMessageStoreMutex);
+    return success;
+}
+
+/**
+ * @brief The property IoT Hub marks the components of a reported-properties patch with.
+ */
+#define PNP_COMPONENT_MARKER "__t"
+
+/**
+ * @brief Removes from the @p stale patch the component properties that the @p newer patch sets, and the components
+ * left without properties.
+ *
+ * @return true if anything was removed.
+ */
+static bool RemoveSupersededProperties(JSON_Object* stale, const JSON_Object* newer)
+{
+    bool removed = false;
+
+    for (size_t i = 0; i < json_object_get_count(newer); ++i)
+    {
+        const char* name = json_object_get_name(newer, i);
+        JSON_Object* staleComponent = json_object_get_object(stale, name);
+        const JSON_Object* newerComponent = json_object_get_object(newer, name);
+
+        if (staleComponent == NULL || newerComponent == NULL)
+        {
+            // A root property, or a component replaced as a whole.
+            removed = json_object_remove(stale, name) == JSONSuccess || removed;
+            continue;
+        }
+
+        for (size_t j = 0; j < json_object_get_count(newerComponent); ++j)
+        {
+            const char* propertyName = json_object_get_name(newerComponent, j);
+            if (strcmp(propertyName, PNP_COMPONENT_MARKER) != 0)
+            {
+                removed = json_object_remove(staleComponent, propertyName) == JSONSuccess || removed;
+            }
+        }
+
+        const size_t markerCount = json_object_get_value(staleComponent, PNP_COMPONENT_MARKER) != NULL ? 1 : 0;
+        if (json_object_get_count(staleComponent) <= markerCount)
+        {
+            (void)json_object_remove(stale, name);
+            removed = true;
+        }
+    }
+
+    return removed;
+}
+
+/**
+ * @brief Removes from the journaled message @p content of @p type the component properties that a newer journaled
+ * message of another type sets. Must be called with s_pendingMessageStoreMutex held.
+ *
+ * The remaining properties are journaled again, so they stay pruned once the newer message is delivered.
+ *
+ * @param type The message type.
+ * @param content The journaled message. Ownership is transferred.
+ * @param sequence In: the sequence number of @p content. Out: the sequence number it was journaled again with.
+ * @return The message to replay, to be freed by the caller, or NULL if every property was superseded.
+ *         Content that is not a JSON object is returned as is.
+ */
+static char*
+RemoveSupersededJournaledProperties(ADUC_D2C_Message_Type type, char* content, unsigned long long* sequence)
+{
+    bool removed = false;
+    JSON_Value* patchValue = json_parse_string(content);
+    JSON_Object* patch = json_value_get_object(patchValue);
+
+    if (patch == NULL)
+    {
+        json_value_free(patchValue);
+        return content;
+    }
+
+    for (int otherType = 0; otherType < ADUC_D2C_Message_Type_Max; ++otherType)
+    {
+        unsigned long long otherSequence = 0;
+        char* otherContent = otherType == (int)type
+            ? NULL
+            : ADUC_D2C_Journal_GetPending(s_journal, (unsigned int)otherType, &otherSequence);
+
+        if (otherContent != NULL && otherSequence > *sequence)
+        {
+            JSON_Value* newerValue = json_parse_string(otherContent);
+            if (json_value_get_object(newerValue) != NULL)
+            {
+                removed = RemoveSupersededProperties(patch, json_value_get_object(newerValue)) || removed;
+            }
+            json_value_free(newerValue);
+        }
+
+        free(otherContent);
+    }
+
+    if (json_object_get_count(patch) == 0)
+    {
+        free(content);
+        content = NULL;
+    }
+    else if (removed)
+    {
+        char* remaining = json_serialize_to_string(patchValue);
+        const unsigned long long remainingSequence =
+            remaining != NULL ? ADUC_D2C_Journal_Put(s_journal, type, remaining) : 0;
+        if (remainingSequence != 0)
+        {
+            free(content);
+            content = remaining;
+            *sequence = remainingSequence;
+        }
+        else
+        {
+            // Replays the journaled message as is, rather than one that is not journaled.
+            free(remaining);
+        }
+    }
+
+    json_value_free(patchValue);
+    return content;
+}
+
+bool ADUC_D2C_Messaging_ReplayJournal(ADUC_D2C_Message_Type type, void* cloudServiceHandle)
+{
+    bool replayed = false;
+    unsigned long long sequence = 0;
+    char* content = NULL;
+    ADUC_D2C_Message* replayMessage = NULL;
+
+    if (type >= ADUC_D2C_Message_Type_Max)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&s_pendingMessageStoreMutex);
+    pthread_mutex_lock(&s_messageProcessingContext[type].mutex);
+
+    // A message submitted since startup is newer than the journaled one.
+    if (__atomic_load_n(&s_pendingMessageStore[type], __ATOMIC_ACQUIRE) != NULL
+        || s_messageProcessingContext[type].message.content != NULL)
+    {
+        goto done;
+    }
+
+    content = ADUC_D2C_Journal_GetPending(s_journal, type, &sequence);
+    if (content == NULL)
+    {
+        goto done;
+    }
+
+    // Stale properties must not overwrite the newer values set by the messages of other types.
+    content = RemoveSupersededJournaledProperties(type, content, &sequence);
+    if (content == NULL)
+    {
+        Log_Info("Dropping journaled D2C message superseded by newer messages (t:%d, seq:%llu)", type, sequence);
+        ADUC_D2C_Journal_Complete(s_journal, sequence);
+        goto done;
+    }
+
+    replayMessage = calloc(1, sizeof(*replayMessage));
+    if (replayMessage == NULL)
+    {
+        free(content);
+        goto done;
+    }
+
+    Log_Info("Replaying journaled D2C message (t:%d, seq:%llu)", type, sequence);
+    replayMessage->cloudServiceHandle = cloudServiceHandle;
+    replayMessage->content = content;
+    replayMessage->contentSubmitTime = GetTimeSinceEpochInSeconds();
+    replayMessage->journalSequence = sequence;
+    SetMessageStatus(replayMessage, ADUC_D2C_Message_Status_Pending);
+    __atomic_store_n(&s_pendingMessageStore[type], replayMessage, __ATOMIC_RELEASE);
+    replayed = true;
+
+done:
+    pthread_mutex_unlock(&s_messageProcessingContext[type].mutex);
     pthread_mutex_unlock(&s_pendingMessageStoreMutex);
+
+    if (replayed)
+    {
+        // Only syncs when the pruned message was journaled again.
+        pthread_rwlock_rdlock(&s_journalLock);
+        (void)ADUC_D2C_Journal_Sync(s_journal, sequence);
+        pthread_rwlock_unlock(&s_journalLock);
+
+        SignalMessageTypeReady(type);
+    }
+
+    return replayed;
 }
 
 /**
@@ -511,30 +1249,54 @@ bool ADUC_D2C_Message_SendAsync(
     {
         return false;
     }
-    pthread_mutex_lock(&s_pendingMessageStoreMutex);
 
-    // Replace pending message if exist.
-    if (s_pendingMessageStore[type].content != NULL)
+    ADUC_D2C_Message* newMessage = calloc(1, sizeof(*newMessage));
+    if (newMessage == NULL)
     {
-        if (s_pendingMessageStore[type].completedCallback != NULL)
-        {
-            Log_Debug("Replacing existing pending message. (t:%d, s:%s)", type, s_pendingMessageStore[type].content);
-            OnMessageProcessingCompleted(&s_pendingMessageStore[type], ADUC_D2C_Message_Status_Replaced);
-        }
+        free(messageToSend);
+        return false;
     }
 
     Log_Debug("Queueing message (t:%d, c:0x%x, m:%s)", type, message, message);
-    memset(&s_pendingMessageStore[type], 0, sizeof(s_pendingMessageStore[0]));
-    s_pendingMessageStore[type].cloudServiceHandle = cloudServiceHandle;
-    s_pendingMessageStore[type].originalContent = message;
-    s_pendingMessageStore[type].content = messageToSend;
-    s_pendingMessageStore[type].responseCallback = responseCallback;
-    s_pendingMessageStore[type].completedCallback = completedCallback;
-    s_pendingMessageStore[type].statusChangedCallback = statusChangedCallback;
-    s_pendingMessageStore[type].contentSubmitTime = GetTimeSinceEpochInSeconds();
-    s_pendingMessageStore[type].userData = userData;
-    SetMessageStatus(&s_pendingMessageStore[type], ADUC_D2C_Message_Status_Pending);
+    newMessage->cloudServiceHandle = cloudServiceHandle;
+    newMessage->originalContent = message;
+    newMessage->content = messageToSend;
+    newMessage->responseCallback = responseCallback;
+    newMessage->completedCallback = completedCallback;
+    newMessage->statusChangedCallback = statusChangedCallback;
+    newMessage->contentSubmitTime = GetTimeSinceEpochInSeconds();
+    newMessage->userData = userData;
+
+    pthread_mutex_lock(&s_pendingMessageStoreMutex);
+    if (s_journal != NULL)
+    {
+        // Journaled under the store mutex, so the journal order matches the submission order.
+        newMessage->journalSequence = ADUC_D2C_Journal_Put(s_journal, type, messageToSend);
+    }
+    const unsigned long long journalSequence = newMessage->journalSequence;
+    SetMessageStatus(newMessage, ADUC_D2C_Message_Status_Pending);
+
+    // Replace pending message if exist.
+    ADUC_D2C_Message* replacedMessage =
+        __atomic_exchange_n(&s_pendingMessageStore[type], newMessage, __ATOMIC_ACQ_REL);
+    if (replacedMessage != NULL)
+    {
+        Log_Debug("Replacing existing pending message. (t:%d, s:%s)", type, replacedMessage->content);
+        OnMessageProcessingCompleted(replacedMessage, ADUC_D2C_Message_Status_Replaced);
+        free(replacedMessage);
+    }
     pthread_mutex_unlock(&s_pendingMessageStoreMutex);
+
+    // Synced outside the store mutex, and before the message is signaled to be sent. Producers that get here
+    // together share one fsync.
+    if (journalSequence != 0)
+    {
+        pthread_rwlock_rdlock(&s_journalLock);
+        (void)ADUC_D2C_Journal_Sync(s_journal, journalSequence);
+        pthread_rwlock_unlock(&s_journalLock);
+    }
+
+    SignalMessageTypeReady(type);
     return true;
 }
 
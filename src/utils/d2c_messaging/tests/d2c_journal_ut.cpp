@@ -0,0 +1,244 @@
+/**
+ * @file d2c_journal_ut.cpp
+ * @brief Unit Tests for the D2C outbox journal.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/d2c_journal.h"
+
+#include <aduc/auto_dir.hpp>
+#include <catch2/catch.hpp>
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define D2C_JOURNAL_UT_DIR "/tmp/adu-d2c-journal-ut"
+#define D2C_JOURNAL_UT_PATH D2C_JOURNAL_UT_DIR "/d2c.journal"
+
+static std::string ReadJournalFile()
+{
+    std::ifstream file{ D2C_JOURNAL_UT_PATH, std::ios::binary };
+    return std::string{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+}
+
+static void AppendJournalFile(const std::string& data)
+{
+    std::ofstream file{ D2C_JOURNAL_UT_PATH, std::ios::binary | std::ios::app };
+    file << data;
+}
+
+static std::string GetPending(ADUC_D2C_Journal* journal, unsigned int key, unsigned long long* sequence = nullptr)
+{
+    unsigned long long pendingSequence = 0;
+    char* content = ADUC_D2C_Journal_GetPending(journal, key, &pendingSequence);
+    if (content == nullptr)
+    {
+        return "";
+    }
+
+    std::string result{ content };
+    free(content);
+
+    if (sequence != nullptr)
+    {
+        *sequence = pendingSequence;
+    }
+    return result;
+}
+
+TEST_CASE("ADUC_D2C_Journal keeps the newest pending message per key across reopen")
+{
+    aduc::AutoDir tempDir{ D2C_JOURNAL_UT_DIR };
+    REQUIRE(tempDir.CreateDir());
+
+    ADUC_D2C_Journal* journal = ADUC_D2C_Journal_Open(D2C_JOURNAL_UT_PATH, 4096);
+    REQUIRE(journal != nullptr);
+
+    const unsigned long long first = ADUC_D2C_Journal_Put(journal, 0, R"({"state":1})");
+    const unsigned long long second = ADUC_D2C_Journal_Put(journal, 0, R"({"state":2})");
+    const unsigned long long other = ADUC_D2C_Journal_Put(journal, 3, R"({"diag":"x"})");
+    const unsigned long long completed = ADUC_D2C_Journal_Put(journal, 5, R"({"props":1})");
+    CHECK(first != 0);
+    CHECK(second > first);
+    CHECK(other > second);
+
+    // Completing a superseded message is a no-op.
+    ADUC_D2C_Journal_Complete(journal, first);
+    ADUC_D2C_Journal_Complete(journal, completed);
+
+    ADUC_D2C_Journal_Close(journal);
+
+    journal = ADUC_D2C_Journal_Open(D2C_JOURNAL_UT_PATH, 4096);
+    REQUIRE(journal != nullptr);
+
+    unsigned long long sequence = 0;
+    CHECK(GetPending(journal, 0, &sequence) == R"({"state":2})");
+    CHECK(sequence == second);
+    CHECK(GetPending(journal, 3) == R"({"diag":"x"})");
+    CHECK(GetPending(journal, 5).empty());
+    CHECK(GetPending(journal, 1).empty());
+
+    // Sequence numbers keep increasing across reopen.
+    CHECK(ADUC_D2C_Journal_Put(journal, 1, "{}") > completed);
+
+    ADUC_D2C_Journal_Close(journal);
+}
+
+TEST_CASE("ADUC_D2C_Journal_Sync syncs the messages put by concurrent callers")
+{
+    aduc::AutoDir tempDir{ D2C_JOURNAL_UT_DIR };
+    REQUIRE(tempDir.CreateDir());
+
+    ADUC_D2C_Journal* journal = ADUC_D2C_Journal_Open(D2C_JOURNAL_UT_PATH, 4096);
+    REQUIRE(journal != nullptr);
+
+    const unsigned long long first = ADUC_D2C_Journal_Put(journal, 0, "first");
+    const unsigned long long second = ADUC_D2C_Journal_Put(journal, 1, "second");
+    REQUIRE(first != 0);
+    REQUIRE(second != 0);
+
+    // One sync covers the messages put before it.
+    CHECK(ADUC_D2C_Journal_Sync(journal, second));
+    CHECK(ADUC_D2C_Journal_Sync(journal, first));
+    CHECK_FALSE(ADUC_D2C_Journal_Sync(journal, 0));
+
+    const int threadCount = 4;
+    const int putCount = 25;
+    std::vector<int> failures(threadCount, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([journal, t, &failures]() {
+            for (int i = 0; i < putCount; ++i)
+            {
+                const std::string content = std::to_string(t) + ":" + std::to_string(i);
+                const unsigned long long sequence = ADUC_D2C_Journal_Put(journal, 2 + t, content.c_str());
+                if (sequence == 0 || !ADUC_D2C_Journal_Sync(journal, sequence))
+                {
+                    ++failures[t];
+                }
+            }
+        });
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    for (int t = 0; t < threadCount; ++t)
+    {
+        CHECK(failures[t] == 0);
+    }
+
+    ADUC_D2C_Journal_Close(journal);
+
+    journal = ADUC_D2C_Journal_Open(D2C_JOURNAL_UT_PATH, 4096);
+    REQUIRE(journal != nullptr);
+    CHECK(GetPending(journal, 0) == "first");
+    CHECK(GetPending(journal, 1) == "second");
+    for (int t = 0; t < threadCount; ++t)
+    {
+        CHECK(GetPending(journal, 2 + t) == std::to_string(t) + ":" + std::to_string(putCount - 1));
+    }
+    ADUC_D2C_Journal_Close(journal);
+}
+
+TEST_CASE("ADUC_D2C_Journal compacts to stay under its maximum size")
+{
+    aduc::AutoDir tempDir{ D2C_JOURNAL_UT_DIR };
+    REQUIRE(tempDir.CreateDir());
+    const size_t maxSize = 512;
+
+    ADUC_D2C_Journal* journal = ADUC_D2C_Journal_Open(D2C_JOURNAL_UT_PATH, maxSize);
+    REQUIRE(journal != nullptr);
+
+    std::string last;
+    for (int i = 0; i < 200; ++i)
+    {
+        last = R"({"state":)" + std::to_string(i) + "}";
+        const unsigned long long sequence = ADUC_D2C_Journal_Put(journal, i % 2, last.c_str());
+        REQUIRE(sequence != 0);
+        if (i % 3 == 0)
+        {
+            ADUC_D2C_Journal_Complete(journal, sequence);
+        }
+        CHECK(ADUC_D2C_Journal_GetSize(journal) <= maxSize);
+        CHECK(ReadJournalFile().size() == ADUC_D2C_Journal_GetSize(journal));
+    }
+
+    ADUC_D2C_Journal_Close(journal);
+
+    journal = ADUC_D2C_Journal_Open(D2C_JOURNAL_UT_PATH, maxSize);
+    REQUIRE(journal != nullptr);
+    CHECK(GetPending(journal, 1) == last);
+    // The last message of key 0, 198, was completed.
+    CHECK(GetPending(journal, 0).empty());
+    ADUC_D2C_Journal_Close(journal);
+}
+
+TEST_CASE("ADUC_D2C_Journal ignores a torn record at the end")
+{
+    aduc::AutoDir tempDir{ D2C_JOURNAL_UT_DIR };
+    REQUIRE(tempDir.CreateDir());
+
+    ADUC_D2C_Journal* journal = ADUC_D2C_Journal_Open(D2C_JOURNAL_UT_PATH, 4096);
+    REQUIRE(journal != nullptr);
+    REQUIRE(ADUC_D2C_Journal_Put(journal, 0, "kept") != 0);
+    ADUC_D2C_Journal_Close(journal);
+
+    SECTION("Truncated content")
+    {
+        AppendJournalFile("P 1 7 10 00000000\nlost");
+    }
+
+    SECTION("Bad checksum")
+    {
+        AppendJournalFile("P 1 7 4 00000000\nlost\n");
+    }
+
+    SECTION("Truncated header")
+    {
+        AppendJournalFile("P 1 7");
+    }
+
+    journal = ADUC_D2C_Journal_Open(D2C_JOURNAL_UT_PATH, 4096);
+    REQUIRE(journal != nullptr);
+    CHECK(GetPending(journal, 0) == "kept");
+    CHECK(GetPending(journal, 1).empty());
+
+    // The torn record is dropped by the compaction on open.
+    CHECK(ReadJournalFile().find("lost") == std::string::npos);
+    ADUC_D2C_Journal_Close(journal);
+}
+
+TEST_CASE("ADUC_D2C_Journal rejects a message that does not fit")
+{
+    aduc::AutoDir tempDir{ D2C_JOURNAL_UT_DIR };
+    REQUIRE(tempDir.CreateDir());
+
+    ADUC_D2C_Journal* journal = ADUC_D2C_Journal_Open(D2C_JOURNAL_UT_PATH, 256);
+    REQUIRE(journal != nullptr);
+
+    REQUIRE(ADUC_D2C_Journal_Put(journal, 0, "small") != 0);
+    REQUIRE(ADUC_D2C_Journal_Put(journal, 2, "stale") != 0);
+
+    CHECK(ADUC_D2C_Journal_Put(journal, 2, std::string(300, 'x').c_str()) == 0);
+    CHECK(ADUC_D2C_Journal_Put(journal, ADUC_D2C_JOURNAL_MAX_KEYS, "bad key") == 0);
+
+    // The stale message of the key is not replayed in place of the rejected one.
+    CHECK(GetPending(journal, 2).empty());
+    CHECK(GetPending(journal, 0) == "small");
+    CHECK(ADUC_D2C_Journal_GetSize(journal) <= 256);
+
+    ADUC_D2C_Journal_Close(journal);
+
+    journal = ADUC_D2C_Journal_Open(D2C_JOURNAL_UT_PATH, 256);
+    REQUIRE(journal != nullptr);
+    CHECK(GetPending(journal, 2).empty());
+    CHECK(GetPending(journal, 0) == "small");
+    ADUC_D2C_Journal_Close(journal);
+}
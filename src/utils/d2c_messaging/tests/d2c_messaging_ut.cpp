@@ -1,11 +1,18 @@
 // To run functional tests in this UT, add '[functional]' to command line.
 
 #include "aduc/client_handle.h"
+#include "aduc/d2c_journal.h"
 #include "aduc/d2c_messaging.h"
+#include "aduc/reactor_utils.h"
 #include "aduc/retry_utils.h"
 
+#include <aduc/auto_dir.hpp>
+#include <algorithm> // std::sort
 #include <catch2/catch.hpp>
+#include <parson.h>
 #include <stdexcept> // runtime_error
+#include <string>
+#include <vector>
 #include <string.h>
 
 #include <aducpal/time.h> // nanosleep
@@ -258,7 +265,7 @@ int MockMessageTransportFunc(
     else
     {
         static int nextWait = 30;
-        message_processing_context->nextRetryTimeStampEpoch += nextWait;
+        message_processing_context->nextRetryTimeMs += nextWait * 1000;
     }
 
     return createResult;
@@ -765,3 +772,434 @@ TEST_CASE("30 retries - httpStatus 401", "[.][functional]")
     ADUC_D2C_Messaging_Uninit();
     g_testCaseSyncMutex.unlock();
 }
+
+//
+// A transport that holds the responses until the test delivers them, outside of ADUC_D2C_Messaging_DoWork().
+//
+struct DeferredResponse
+{
+    void* context;
+    ADUC_C2D_RESPONSE_HANDLER_FUNCTION handlerFunc;
+    std::string content;
+};
+
+static std::vector<DeferredResponse> g_deferredResponses;
+static int g_deferredTransportCalls = 0;
+
+static int DeferredResponseTransportFunc(
+    void* cloudServiceHandle, void* context, ADUC_C2D_RESPONSE_HANDLER_FUNCTION c2dResponseHandlerFunc)
+{
+    UNREFERENCED_PARAMETER(cloudServiceHandle);
+    auto message_processing_context = static_cast<ADUC_D2C_Message_Processing_Context*>(context);
+    g_deferredResponses.push_back({ context, c2dResponseHandlerFunc, message_processing_context->message.content });
+    g_deferredTransportCalls++;
+    MockSetMessageStatus(&message_processing_context->message, ADUC_D2C_Message_Status_Waiting_For_Response);
+    return 0;
+}
+
+// Responds to the oldest message sent through DeferredResponseTransportFunc.
+static void RespondToDeferredMessage(int httpStatus)
+{
+    REQUIRE_FALSE(g_deferredResponses.empty());
+    DeferredResponse response = g_deferredResponses.front();
+    g_deferredResponses.erase(g_deferredResponses.begin());
+    response.handlerFunc(httpStatus, response.context);
+}
+
+// Retries the message 50 ms after an error response.
+static bool RetryIn50Ms_ResponseCallback(int http_status_code, void* context)
+{
+    if (http_status_code >= 200 && http_status_code < 300)
+    {
+        return false;
+    }
+
+    auto message_processing_context = static_cast<ADUC_D2C_Message_Processing_Context*>(context);
+    message_processing_context->nextRetryTimeMs = ADUC_Reactor_GetMonotonicTimeMs() + 50;
+    return true;
+}
+
+TEST_CASE("Messages are sent on the next DoWork, and retried on millisecond deadlines")
+{
+    g_testCaseSyncMutex.lock();
+
+    const auto type = ADUC_D2C_Message_Type_Device_Information;
+    auto handle = reinterpret_cast<ADUC_ClientHandle>(-1); // We don't need real handle.
+    ADUC_D2C_Message_Status status = ADUC_D2C_Message_Status_Pending;
+    g_deferredTransportCalls = 0;
+    g_deferredResponses.clear();
+
+    REQUIRE(ADUC_D2C_Messaging_Init());
+    ADUC_D2C_Messaging_Set_Transport(type, DeferredResponseTransportFunc);
+
+    REQUIRE(ADUC_D2C_Message_SendAsync(
+        type,
+        &handle,
+        "first",
+        RetryIn50Ms_ResponseCallback,
+        OnMessageProcessCompleted_SaveStatus,
+        nullptr /* statusChangedCallback */,
+        &status));
+
+    // Sent right away, without waiting for a retry tick.
+    ADUC_D2C_Messaging_DoWork();
+    CHECK(g_deferredTransportCalls == 1);
+
+    // Not resent before the retry deadline.
+    RespondToDeferredMessage(500);
+    ADUC_D2C_Messaging_DoWork();
+    CHECK(g_deferredTransportCalls == 1);
+
+    timespec t;
+    set_timespec_ms(&t, 60);
+    (void)ADUCPAL_nanosleep(&t, nullptr);
+
+    ADUC_D2C_Messaging_DoWork();
+    CHECK(g_deferredTransportCalls == 2);
+
+    // A message submitted while waiting for a response is sent once the response arrives.
+    ADUC_D2C_Message_Status secondStatus = ADUC_D2C_Message_Status_Pending;
+    REQUIRE(ADUC_D2C_Message_SendAsync(
+        type,
+        &handle,
+        "second",
+        nullptr /* responseCallback */,
+        OnMessageProcessCompleted_SaveStatus,
+        nullptr /* statusChangedCallback */,
+        &secondStatus));
+
+    ADUC_D2C_Messaging_DoWork();
+    CHECK(g_deferredTransportCalls == 2);
+
+    RespondToDeferredMessage(200);
+    CHECK(status == ADUC_D2C_Message_Status_Success);
+
+    ADUC_D2C_Messaging_DoWork();
+    CHECK(g_deferredTransportCalls == 3);
+
+    RespondToDeferredMessage(200);
+    CHECK(secondStatus == ADUC_D2C_Message_Status_Success);
+
+    ADUC_D2C_Messaging_Uninit();
+    g_testCaseSyncMutex.unlock();
+}
+
+TEST_CASE("Messages ready within the coalescing window are sent as one patch")
+{
+    g_testCaseSyncMutex.lock();
+
+    auto handle = reinterpret_cast<ADUC_ClientHandle>(-1); // We don't need real handle.
+    auto sameHandle = handle;
+    ADUC_D2C_Message_Status resultStatus = ADUC_D2C_Message_Status_Pending;
+    ADUC_D2C_Message_Status infoStatus = ADUC_D2C_Message_Status_Pending;
+    ADUC_D2C_Message_Status ackStatus = ADUC_D2C_Message_Status_Pending;
+    g_deferredTransportCalls = 0;
+    g_deferredResponses.clear();
+
+    REQUIRE(ADUC_D2C_Messaging_Init());
+    ADUC_D2C_Messaging_EnableBatching(50);
+    ADUC_D2C_Messaging_Set_Transport(ADUC_D2C_Message_Type_Device_Update_Result, DeferredResponseTransportFunc);
+    ADUC_D2C_Messaging_Set_Transport(ADUC_D2C_Message_Type_Device_Information, DeferredResponseTransportFunc);
+    ADUC_D2C_Messaging_Set_Transport(ADUC_D2C_Message_Type_Device_Update_ACK, DeferredResponseTransportFunc);
+
+    REQUIRE(ADUC_D2C_Message_SendAsync(
+        ADUC_D2C_Message_Type_Device_Update_Result,
+        &handle,
+        R"({"deviceUpdate":{"__t":"c","agent":{"state":0}}})",
+        nullptr /* responseCallback */,
+        OnMessageProcessCompleted_SaveStatus,
+        nullptr /* statusChangedCallback */,
+        &resultStatus));
+
+    // Waits for others to batch with.
+    ADUC_D2C_Messaging_DoWork();
+    CHECK(g_deferredTransportCalls == 0);
+
+    REQUIRE(ADUC_D2C_Message_SendAsync(
+        ADUC_D2C_Message_Type_Device_Information,
+        &sameHandle,
+        R"({"deviceInformation":{"__t":"c","manufacturer":"contoso"}})",
+        nullptr /* responseCallback */,
+        OnMessageProcessCompleted_SaveStatus,
+        nullptr /* statusChangedCallback */,
+        &infoStatus));
+
+    // Sets the same property as the result message, to a different value.
+    REQUIRE(ADUC_D2C_Message_SendAsync(
+        ADUC_D2C_Message_Type_Device_Update_ACK,
+        &handle,
+        R"({"deviceUpdate":{"__t":"c","agent":{"state":6}}})",
+        nullptr /* responseCallback */,
+        OnMessageProcessCompleted_SaveStatus,
+        nullptr /* statusChangedCallback */,
+        &ackStatus));
+
+    // Picks up both; none is due yet.
+    ADUC_D2C_Messaging_DoWork();
+    CHECK(g_deferredTransportCalls == 0);
+
+    timespec t;
+    set_timespec_ms(&t, 60);
+    (void)ADUCPAL_nanosleep(&t, nullptr);
+
+    // All three are due. The conflicting ACK is sent on its own; the others as one patch.
+    ADUC_D2C_Messaging_DoWork();
+    REQUIRE(g_deferredTransportCalls == 2);
+    REQUIRE(g_deferredResponses.size() == 2);
+    CHECK(g_deferredResponses[0].content == R"({"deviceUpdate":{"__t":"c","agent":{"state":6}}})");
+
+    JSON_Value* patch = json_parse_string(g_deferredResponses[1].content.c_str());
+    REQUIRE(patch != nullptr);
+    CHECK(json_object_dotget_number(json_object(patch), "deviceUpdate.agent.state") == 0);
+    CHECK(
+        std::string{ json_object_dotget_string(json_object(patch), "deviceInformation.manufacturer") } == "contoso");
+    json_value_free(patch);
+
+    RespondToDeferredMessage(200);
+    CHECK(ackStatus == ADUC_D2C_Message_Status_Success);
+    CHECK(resultStatus == ADUC_D2C_Message_Status_Pending);
+
+    // The response to the patch is fanned out to both messages.
+    RespondToDeferredMessage(200);
+    CHECK(resultStatus == ADUC_D2C_Message_Status_Success);
+    CHECK(infoStatus == ADUC_D2C_Message_Status_Success);
+
+    ADUC_D2C_Messaging_Uninit();
+    g_testCaseSyncMutex.unlock();
+}
+
+TEST_CASE("Messages are deferred while the IoT Hub circuit is open")
+{
+    g_testCaseSyncMutex.lock();
+
+    const auto type = ADUC_D2C_Message_Type_Device_Information;
+    auto handle = reinterpret_cast<ADUC_ClientHandle>(-1); // We don't need real handle.
+    ADUC_D2C_Message_Status status = ADUC_D2C_Message_Status_Pending;
+    g_deferredTransportCalls = 0;
+    g_deferredResponses.clear();
+
+    REQUIRE(ADUC_D2C_Messaging_Init());
+    ADUC_D2C_Messaging_Set_Transport(type, DeferredResponseTransportFunc);
+
+    REQUIRE(ADUC_D2C_Message_SendAsync(
+        type,
+        &handle,
+        R"({"deviceInformation":{"__t":"c","manufacturer":"contoso"}})",
+        RetryIn50Ms_ResponseCallback,
+        OnMessageProcessCompleted_SaveStatus,
+        nullptr /* statusChangedCallback */,
+        &status));
+
+    timespec t;
+    set_timespec_ms(&t, 60);
+
+    // Five throttled responses in a row open the circuit.
+    for (int i = 1; i <= 5; i++)
+    {
+        ADUC_D2C_Messaging_DoWork();
+        REQUIRE(g_deferredTransportCalls == i);
+        RespondToDeferredMessage(429);
+        (void)ADUCPAL_nanosleep(&t, nullptr);
+    }
+
+    ADUC_D2C_Messaging_DoWork();
+    CHECK(g_deferredTransportCalls == 5);
+    CHECK(status == ADUC_D2C_Message_Status_Pending);
+
+    ADUC_D2C_Messaging_Uninit();
+
+    // A new session starts with a closed circuit.
+    REQUIRE(ADUC_D2C_Messaging_Init());
+    ADUC_D2C_Messaging_Set_Transport(type, DeferredResponseTransportFunc);
+    REQUIRE(ADUC_D2C_Message_SendAsync(
+        type,
+        &handle,
+        R"({"deviceInformation":{"__t":"c","manufacturer":"contoso"}})",
+        nullptr /* responseCallback */,
+        OnMessageProcessCompleted_SaveStatus,
+        nullptr /* statusChangedCallback */,
+        &status));
+    ADUC_D2C_Messaging_DoWork();
+    CHECK(g_deferredTransportCalls == 6);
+    RespondToDeferredMessage(200);
+    CHECK(status == ADUC_D2C_Message_Status_Success);
+
+    ADUC_D2C_Messaging_Uninit();
+    g_testCaseSyncMutex.unlock();
+}
+
+#define D2C_MESSAGING_UT_JOURNAL_DIR "/tmp/adu-d2c-messaging-ut"
+#define D2C_MESSAGING_UT_JOURNAL_PATH D2C_MESSAGING_UT_JOURNAL_DIR "/d2c.journal"
+
+// Whether the journal at D2C_MESSAGING_UT_JOURNAL_PATH has a pending message of any type.
+static bool HasJournaledMessages()
+{
+    ADUC_D2C_Journal* journal = ADUC_D2C_Journal_Open(D2C_MESSAGING_UT_JOURNAL_PATH, 4096);
+    REQUIRE(journal != nullptr);
+
+    bool found = false;
+    for (unsigned int type = 0; type < ADUC_D2C_Message_Type_Max; type++)
+    {
+        unsigned long long sequence = 0;
+        char* content = ADUC_D2C_Journal_GetPending(journal, type, &sequence);
+        found = found || content != nullptr;
+        free(content);
+    }
+
+    ADUC_D2C_Journal_Close(journal);
+    return found;
+}
+
+TEST_CASE("Journaled messages are replayed without the properties set by newer messages")
+{
+    g_testCaseSyncMutex.lock();
+
+    aduc::AutoDir tempDir{ D2C_MESSAGING_UT_JOURNAL_DIR };
+    REQUIRE(tempDir.CreateDir());
+    auto handle = reinterpret_cast<ADUC_ClientHandle>(-1); // We don't need real handle.
+    g_deferredTransportCalls = 0;
+    g_deferredResponses.clear();
+
+    // The messages left undelivered by a crash, oldest first.
+    ADUC_D2C_Journal* journal = ADUC_D2C_Journal_Open(D2C_MESSAGING_UT_JOURNAL_PATH, 4096);
+    REQUIRE(journal != nullptr);
+    REQUIRE(
+        ADUC_D2C_Journal_Put(
+            journal,
+            ADUC_D2C_Message_Type_Device_Update_Result,
+            R"({"deviceUpdate":{"__t":"c","agent":{"state":0},"service":{"status":200}}})")
+        != 0);
+    REQUIRE(
+        ADUC_D2C_Journal_Put(
+            journal, ADUC_D2C_Message_Type_Diagnostics, R"({"diagnosticInformation":{"__t":"c","status":1}})")
+        != 0);
+    REQUIRE(
+        ADUC_D2C_Journal_Put(
+            journal, ADUC_D2C_Message_Type_Device_Update_ACK, R"({"deviceUpdate":{"__t":"c","agent":{"state":6}}})")
+        != 0);
+    REQUIRE(
+        ADUC_D2C_Journal_Put(
+            journal, ADUC_D2C_Message_Type_Diagnostics_ACK, R"({"diagnosticInformation":{"__t":"c","status":2}})")
+        != 0);
+    ADUC_D2C_Journal_Close(journal);
+
+    REQUIRE(ADUC_D2C_Messaging_Init());
+    REQUIRE(ADUC_D2C_Messaging_EnableJournal(D2C_MESSAGING_UT_JOURNAL_PATH, 4096));
+    for (int type = 0; type < ADUC_D2C_Message_Type_Max; type++)
+    {
+        ADUC_D2C_Messaging_Set_Transport(static_cast<ADUC_D2C_Message_Type>(type), DeferredResponseTransportFunc);
+    }
+
+    CHECK(ADUC_D2C_Messaging_ReplayJournal(ADUC_D2C_Message_Type_Device_Update_Result, &handle));
+    CHECK(ADUC_D2C_Messaging_ReplayJournal(ADUC_D2C_Message_Type_Device_Update_ACK, &handle));
+    CHECK(ADUC_D2C_Messaging_ReplayJournal(ADUC_D2C_Message_Type_Diagnostics_ACK, &handle));
+    CHECK(ADUC_D2C_Messaging_ReplayJournal(ADUC_D2C_Message_Type_Device_Information, &handle) == false);
+
+    // Every property of the diagnostics message is set by the newer diagnostics ACK.
+    CHECK(ADUC_D2C_Messaging_ReplayJournal(ADUC_D2C_Message_Type_Diagnostics, &handle) == false);
+
+    ADUC_D2C_Messaging_DoWork();
+    REQUIRE(g_deferredTransportCalls == 3);
+
+    std::vector<std::string> contents;
+    for (const DeferredResponse& response : g_deferredResponses)
+    {
+        contents.push_back(response.content);
+    }
+
+    // The agent state of the result message is set by the newer ACK.
+    JSON_Value* result = json_parse_string(contents[0].c_str());
+    REQUIRE(result != nullptr);
+    CHECK(json_object_dotget_value(json_object(result), "deviceUpdate.agent") == nullptr);
+    CHECK(json_object_dotget_number(json_object(result), "deviceUpdate.service.status") == 200);
+    json_value_free(result);
+
+    CHECK(contents[1] == R"({"deviceUpdate":{"__t":"c","agent":{"state":6}}})");
+    CHECK(contents[2] == R"({"diagnosticInformation":{"__t":"c","status":2}})");
+
+    for (int i = 0; i < 3; i++)
+    {
+        RespondToDeferredMessage(200);
+    }
+
+    ADUC_D2C_Messaging_Uninit();
+    CHECK_FALSE(HasJournaledMessages());
+    g_testCaseSyncMutex.unlock();
+}
+
+TEST_CASE("Messages canceled at shutdown are replayed on the next start")
+{
+    g_testCaseSyncMutex.lock();
+
+    aduc::AutoDir tempDir{ D2C_MESSAGING_UT_JOURNAL_DIR };
+    REQUIRE(tempDir.CreateDir());
+    auto handle = reinterpret_cast<ADUC_ClientHandle>(-1); // We don't need real handle.
+    const char* inFlightContent = R"({"deviceInformation":{"__t":"c","manufacturer":"contoso"}})";
+    const char* pendingContent = R"({"diagnosticInformation":{"__t":"c","status":1}})";
+    ADUC_D2C_Message_Status inFlightStatus = ADUC_D2C_Message_Status_Pending;
+    ADUC_D2C_Message_Status pendingStatus = ADUC_D2C_Message_Status_Pending;
+    g_deferredTransportCalls = 0;
+    g_deferredResponses.clear();
+
+    REQUIRE(ADUC_D2C_Messaging_Init());
+    REQUIRE(ADUC_D2C_Messaging_EnableJournal(D2C_MESSAGING_UT_JOURNAL_PATH, 4096));
+    ADUC_D2C_Messaging_Set_Transport(ADUC_D2C_Message_Type_Device_Information, DeferredResponseTransportFunc);
+    ADUC_D2C_Messaging_Set_Transport(ADUC_D2C_Message_Type_Diagnostics, DeferredResponseTransportFunc);
+
+    // The device goes offline: one message is sent without a response, the other is not sent yet.
+    REQUIRE(ADUC_D2C_Message_SendAsync(
+        ADUC_D2C_Message_Type_Device_Information,
+        &handle,
+        inFlightContent,
+        nullptr /* responseCallback */,
+        OnMessageProcessCompleted_SaveStatus,
+        nullptr /* statusChangedCallback */,
+        &inFlightStatus));
+    ADUC_D2C_Messaging_DoWork();
+    REQUIRE(g_deferredTransportCalls == 1);
+
+    REQUIRE(ADUC_D2C_Message_SendAsync(
+        ADUC_D2C_Message_Type_Diagnostics,
+        &handle,
+        pendingContent,
+        nullptr /* responseCallback */,
+        OnMessageProcessCompleted_SaveStatus,
+        nullptr /* statusChangedCallback */,
+        &pendingStatus));
+
+    // The agent stops.
+    ADUC_D2C_Messaging_Uninit();
+    CHECK(inFlightStatus == ADUC_D2C_Message_Status_Canceled);
+    CHECK(pendingStatus == ADUC_D2C_Message_Status_Canceled);
+    CHECK(HasJournaledMessages());
+
+    // The agent starts again, and reports the canceled messages.
+    g_deferredTransportCalls = 0;
+    g_deferredResponses.clear();
+
+    REQUIRE(ADUC_D2C_Messaging_Init());
+    REQUIRE(ADUC_D2C_Messaging_EnableJournal(D2C_MESSAGING_UT_JOURNAL_PATH, 4096));
+    ADUC_D2C_Messaging_Set_Transport(ADUC_D2C_Message_Type_Device_Information, DeferredResponseTransportFunc);
+    ADUC_D2C_Messaging_Set_Transport(ADUC_D2C_Message_Type_Diagnostics, DeferredResponseTransportFunc);
+
+    CHECK(ADUC_D2C_Messaging_ReplayJournal(ADUC_D2C_Message_Type_Device_Information, &handle));
+    CHECK(ADUC_D2C_Messaging_ReplayJournal(ADUC_D2C_Message_Type_Diagnostics, &handle));
+
+    ADUC_D2C_Messaging_DoWork();
+    REQUIRE(g_deferredTransportCalls == 2);
+
+    std::vector<std::string> contents;
+    for (const DeferredResponse& response : g_deferredResponses)
+    {
+        contents.push_back(response.content);
+    }
+    std::sort(contents.begin(), contents.end());
+    CHECK(contents == std::vector<std::string>{ inFlightContent, pendingContent });
+
+    RespondToDeferredMessage(200);
+    RespondToDeferredMessage(200);
+
+    ADUC_D2C_Messaging_Uninit();
+    CHECK_FALSE(HasJournaledMessages());
+    g_testCaseSyncMutex.unlock();
+}
@@ -0,0 +1,132 @@
+/**
+ * @file metrics_utils.h
+ * @brief A lightweight, process-wide registry of counters, gauges and fixed-bucket histograms.
+ *
+ * Metrics are registered once by name and updated lock-free. Counter and histogram updates go to
+ * per-thread shards that are only summed when the registry is exported in the Prometheus text format,
+ * either on demand with ADUC_Metrics_FormatPrometheusText() or through a local Unix domain socket.
+ *
+ * Names and help strings are not copied and must outlive the registry, e.g. string literals.
+ *
+ * @remark The registry lives in the static library. Extension modules that link the library get their
+ *         own registry, which is not exported by the agent.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_METRICS_UTILS_H
+#define ADUC_METRICS_UTILS_H
+
+#include "aduc/c_utils.h"
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h>
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief The maximum number of metrics in the registry.
+ */
+#define ADUC_METRICS_MAX_METRICS 64
+
+/**
+ * @brief The maximum number of upper bounds of a histogram, excluding the implicit +Inf bucket.
+ */
+#define ADUC_METRICS_MAX_HISTOGRAM_BOUNDS 16
+
+/**
+ * @brief An opaque registered metric.
+ */
+typedef struct tagADUC_Metric ADUC_Metric;
+
+/**
+ * @brief Registers a monotonically increasing counter.
+ *
+ * @param name The metric name, e.g. "adu_download_bytes_total".
+ * @param help The metric description.
+ * @return ADUC_Metric* The metric. Registering an existing name returns the existing metric, if it has the same type.
+ *         NULL if the registry is full, or the name is registered with another type.
+ */
+ADUC_Metric* ADUC_Metrics_RegisterCounter(const char* name, const char* help);
+
+/**
+ * @brief Registers a gauge.
+ *
+ * @param name The metric name.
+ * @param help The metric description.
+ * @return ADUC_Metric* The metric, or NULL on failure. See ADUC_Metrics_RegisterCounter().
+ */
+ADUC_Metric* ADUC_Metrics_RegisterGauge(const char* name, const char* help);
+
+/**
+ * @brief Registers a histogram with fixed buckets.
+ *
+ * @param name The metric name, e.g. "adu_workflow_download_duration_ms".
+ * @param help The metric description.
+ * @param upperBounds The bucket upper bounds, in ascending order.
+ * @param boundCount The number of bounds. At most ADUC_METRICS_MAX_HISTOGRAM_BOUNDS.
+ * @return ADUC_Metric* The metric, or NULL on failure. See ADUC_Metrics_RegisterCounter().
+ */
+ADUC_Metric* ADUC_Metrics_RegisterHistogram(
+    const char* name, const char* help, const uint64_t* upperBounds, size_t boundCount);
+
+/**
+ * @brief Adds @p value to a counter. No-op if @p metric is NULL or not a counter.
+ */
+void ADUC_Metrics_CounterAdd(ADUC_Metric* metric, uint64_t value);
+
+/**
+ * @brief Sets a gauge. No-op if @p metric is NULL or not a gauge.
+ */
+void ADUC_Metrics_GaugeSet(ADUC_Metric* metric, int64_t value);
+
+/**
+ * @brief Adds @p delta to a gauge. No-op if @p metric is NULL or not a gauge.
+ */
+void ADUC_Metrics_GaugeAdd(ADUC_Metric* metric, int64_t delta);
+
+/**
+ * @brief Records an observation in a histogram. No-op if @p metric is NULL or not a histogram.
+ */
+void ADUC_Metrics_HistogramObserve(ADUC_Metric* metric, uint64_t value);
+
+/**
+ * @brief Gets the current value of a counter, or the current observation count of a histogram.
+ */
+uint64_t ADUC_Metrics_GetCounterValue(const ADUC_Metric* metric);
+
+/**
+ * @brief Gets the current value of a gauge.
+ */
+int64_t ADUC_Metrics_GetGaugeValue(const ADUC_Metric* metric);
+
+/**
+ * @brief Formats all registered metrics in the Prometheus text exposition format.
+ *
+ * @return char* The text. The caller must free() it. NULL on allocation failure.
+ */
+char* ADUC_Metrics_FormatPrometheusText();
+
+/**
+ * @brief Starts serving the metrics on a Unix domain stream socket.
+ *
+ * Every accepted connection receives the current ADUC_Metrics_FormatPrometheusText() output, then is closed,
+ * e.g. `socat - UNIX-CONNECT:<socketPath>`.
+ *
+ * @param socketPath The socket path. An existing socket file at this path is replaced.
+ * @return true on success.
+ *
+ * @remark The listening socket is serviced by the reactor, so ADUC_Reactor_Init() must have been called.
+ * The socket file has mode 0660 and the ADUC_FILE_GROUP group. A client that does not read its metrics before the
+ * socket buffer fills up is disconnected.
+ */
+bool ADUC_Metrics_StartSocketExporter(const char* socketPath);
+
+/**
+ * @brief Stops the socket exporter and removes the socket file. No-op if the exporter is not running.
+ */
+void ADUC_Metrics_StopSocketExporter();
+
+EXTERN_C_END
+
+#endif // ADUC_METRICS_UTILS_H
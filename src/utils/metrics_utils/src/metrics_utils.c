@@ -0,0 +1,599 @@
+/**
+ * @file metrics_utils.c
+ * @brief Implements the metrics registry and the Prometheus text exporter.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/metrics_utils.h"
+#include "aduc/logging.h"
+#include "aduc/reactor_utils.h"
+#include "aduc/string_c_utils.h" // ADUC_Safe_StrCopyN
+
+#include <errno.h>
+#include <inttypes.h> // PRIu64, PRId64
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h> // vsnprintf
+#include <stdlib.h> // calloc, free, posix_memalign, realloc
+#include <string.h> // memset, strcmp
+
+#ifdef __linux__
+#    include <fcntl.h>
+#    include <grp.h> // getgrnam
+#    include <sys/socket.h>
+#    include <sys/stat.h> // chmod
+#    include <sys/un.h>
+#    include <unistd.h> // chown, close, unlink
+#    define ADUC_METRICS_USE_UNIX_SOCKET 1
+#endif
+
+/**
+ * @brief The number of update shards of each counter and histogram.
+ *
+ * Threads are assigned a shard round-robin on first use, so up to this many threads update a metric
+ * without contending on the same cache line.
+ */
+#define METRICS_SHARD_COUNT 8
+
+/**
+ * @brief The cache line size, in bytes. The shards of a metric start on a cache line boundary.
+ */
+#define METRICS_CACHE_LINE_SIZE 64
+
+/**
+ * @brief The number of uint64_t slots per cache line. Shards are padded to a multiple of this.
+ */
+#define METRICS_SLOTS_PER_CACHE_LINE (METRICS_CACHE_LINE_SIZE / sizeof(uint64_t))
+
+typedef enum tagADUC_MetricType
+{
+    ADUC_MetricType_Counter,
+    ADUC_MetricType_Gauge,
+    ADUC_MetricType_Histogram,
+} ADUC_MetricType;
+
+/**
+ * @brief A registered metric.
+ *
+ * Each shard is a run of uint64_t slots. Counters use slot 0. Histograms use slots [0, boundCount] for the
+ * (non-cumulative) bucket counts, including +Inf, then one slot for the sum of the observations.
+ */
+struct tagADUC_Metric
+{
+    ADUC_MetricType type; /**< The metric type. */
+    const char* name; /**< The metric name. */
+    const char* help; /**< The metric description. */
+    size_t boundCount; /**< The number of histogram upper bounds. */
+    uint64_t upperBounds[ADUC_METRICS_MAX_HISTOGRAM_BOUNDS]; /**< The histogram upper bounds. */
+    size_t shardStride; /**< The distance between two shards, in slots. */
+    uint64_t* shards; /**< METRICS_SHARD_COUNT shards of shardStride slots. */
+    int64_t gaugeValue; /**< The gauge value. */
+};
+
+static pthread_mutex_t s_metricsMutex = PTHREAD_MUTEX_INITIALIZER;
+static ADUC_Metric* s_metrics[ADUC_METRICS_MAX_METRICS]; // Guarded by s_metricsMutex.
+static size_t s_metricCount = 0; // Guarded by s_metricsMutex.
+
+static unsigned int s_nextShard = 0;
+static __thread unsigned int s_threadShard = UINT32_MAX;
+
+#ifdef ADUC_METRICS_USE_UNIX_SOCKET
+static int s_exporterFd = -1;
+static char s_exporterPath[sizeof(((struct sockaddr_un*)0)->sun_path)];
+#endif
+
+/**
+ * @brief Gets the shard of the calling thread.
+ */
+static unsigned int GetThreadShard()
+{
+    if (s_threadShard == UINT32_MAX)
+    {
+        s_threadShard = __atomic_fetch_add(&s_nextShard, 1, __ATOMIC_RELAXED) % METRICS_SHARD_COUNT;
+    }
+
+    return s_threadShard;
+}
+
+/**
+ * @brief Sums @p slot across all shards of @p metric.
+ */
+static uint64_t SumShards(const ADUC_Metric* metric, size_t slot)
+{
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < METRICS_SHARD_COUNT; ++i)
+    {
+        sum += __atomic_load_n(&metric->shards[(i * metric->shardStride) + slot], __ATOMIC_RELAXED);
+    }
+
+    return sum;
+}
+
+/**
+ * @brief Looks up or creates a metric.
+ *
+ * @param type The metric type.
+ * @param name The metric name.
+ * @param help The metric description.
+ * @param upperBounds The histogram upper bounds, if @p type is ADUC_MetricType_Histogram.
+ * @param boundCount The number of histogram upper bounds.
+ * @return ADUC_Metric* The metric, or NULL on failure.
+ */
+static ADUC_Metric* RegisterMetric(
+    ADUC_MetricType type, const char* name, const char* help, const uint64_t* upperBounds, size_t boundCount)
+{
+    ADUC_Metric* metric = NULL;
+    ADUC_Metric* newMetric = NULL;
+
+    if (name == NULL || help == NULL || boundCount > ADUC_METRICS_MAX_HISTOGRAM_BOUNDS
+        || (boundCount > 0 && upperBounds == NULL))
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&s_metricsMutex);
+
+    for (size_t i = 0; i < s_metricCount; ++i)
+    {
+        if (strcmp(s_metrics[i]->name, name) == 0)
+        {
+            if (s_metrics[i]->type != type)
+            {
+                Log_Error("Metric '%s' is already registered with another type.", name);
+                goto done;
+            }
+
+            metric = s_metrics[i];
+            goto done;
+        }
+    }
+
+    if (s_metricCount == ADUC_METRICS_MAX_METRICS)
+    {
+        Log_Error("Cannot register metric '%s'. The registry is full.", name);
+        goto done;
+    }
+
+    newMetric = calloc(1, sizeof(*newMetric));
+    if (newMetric == NULL)
+    {
+        goto done;
+    }
+
+    newMetric->type = type;
+    newMetric->name = name;
+    newMetric->help = help;
+    newMetric->boundCount = boundCount;
+    for (size_t i = 0; i < boundCount; ++i)
+    {
+        newMetric->upperBounds[i] = upperBounds[i];
+    }
+
+    if (type != ADUC_MetricType_Gauge)
+    {
+        // Buckets, +Inf and sum for histograms; a single slot for counters.
+        size_t slots = (type == ADUC_MetricType_Histogram) ? boundCount + 2 : 1;
+        newMetric->shardStride = ((slots + METRICS_SLOTS_PER_CACHE_LINE - 1) / METRICS_SLOTS_PER_CACHE_LINE)
+            * METRICS_SLOTS_PER_CACHE_LINE;
+
+        // Aligned, so that with the padded stride no two shards share a cache line.
+        const size_t shardsSize = METRICS_SHARD_COUNT * newMetric->shardStride * sizeof(uint64_t);
+        void* shards = NULL;
+        if (posix_memalign(&shards, METRICS_CACHE_LINE_SIZE, shardsSize) != 0)
+        {
+            goto done;
+        }
+
+        memset(shards, 0, shardsSize);
+        newMetric->shards = shards;
+    }
+
+    s_metrics[s_metricCount++] = newMetric;
+    metric = newMetric;
+    newMetric = NULL;
+
+done:
+    pthread_mutex_unlock(&s_metricsMutex);
+
+    if (newMetric != NULL)
+    {
+        free(newMetric->shards);
+        free(newMetric);
+    }
+
+    return metric;
+}
+
+ADUC_Metric* ADUC_Metrics_RegisterCounter(const char* name, const char* help)
+{
+    return RegisterMetric(ADUC_MetricType_Counter, name, help, NULL, 0);
+}
+
+ADUC_Metric* ADUC_Metrics_RegisterGauge(const char* name, const char* help)
+{
+    return RegisterMetric(ADUC_MetricType_Gauge, name, help, NULL, 0);
+}
+
+ADUC_Metric* ADUC_Metrics_RegisterHistogram(
+    const char* name, const char* help, const uint64_t* upperBounds, size_t boundCount)
+{
+    return RegisterMetric(ADUC_MetricType_Histogram, name, help, upperBounds, boundCount);
+}
+
+void ADUC_Metrics_CounterAdd(ADUC_Metric* metric, uint64_t value)
+{
+    if (metric == NULL || metric->type != ADUC_MetricType_Counter)
+    {
+        return;
+    }
+
+    __atomic_fetch_add(&metric->shards[GetThreadShard() * metric->shardStride], value, __ATOMIC_RELAXED);
+}
+
+void ADUC_Metrics_GaugeSet(ADUC_Metric* metric, int64_t value)
+{
+    if (metric == NULL || metric->type != ADUC_MetricType_Gauge)
+    {
+        return;
+    }
+
+    __atomic_store_n(&metric->gaugeValue, value, __ATOMIC_RELAXED);
+}
+
+void ADUC_Metrics_GaugeAdd(ADUC_Metric* metric, int64_t delta)
+{
+    if (metric == NULL || metric->type != ADUC_MetricType_Gauge)
+    {
+        return;
+    }
+
+    __atomic_fetch_add(&metric->gaugeValue, delta, __ATOMIC_RELAXED);
+}
+
+void ADUC_Metrics_HistogramObserve(ADUC_Metric* metric, uint64_t value)
+{
+    if (metric == NULL || metric->type != ADUC_MetricType_Histogram)
+    {
+        return;
+    }
+
+    size_t bucket = 0;
+    while (bucket < metric->boundCount && value > metric->upperBounds[bucket])
+    {
+        ++bucket;
+    }
+
+    uint64_t* shard = &metric->shards[GetThreadShard() * metric->shardStride];
+    __atomic_fetch_add(&shard[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard[metric->boundCount + 1], value, __ATOMIC_RELAXED);
+}
+
+uint64_t ADUC_Metrics_GetCounterValue(const ADUC_Metric* metric)
+{
+    if (metric == NULL || metric->type == ADUC_MetricType_Gauge)
+    {
+        return 0;
+    }
+
+    if (metric->type == ADUC_MetricType_Counter)
+    {
+        return SumShards(metric, 0);
+    }
+
+    uint64_t count = 0;
+    for (size_t bucket = 0; bucket <= metric->boundCount; ++bucket)
+    {
+        count += SumShards(metric, bucket);
+    }
+
+    return count;
+}
+
+int64_t ADUC_Metrics_GetGaugeValue(const ADUC_Metric* metric)
+{
+    if (metric == NULL || metric->type != ADUC_MetricType_Gauge)
+    {
+        return 0;
+    }
+
+    return __atomic_load_n(&metric->gaugeValue, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief A growable text buffer.
+ */
+typedef struct tagADUC_Metrics_TextBuffer
+{
+    char* data; /**< The NUL-terminated text. */
+    size_t length; /**< The text length. */
+    size_t capacity; /**< The allocated size of data. */
+    bool failed; /**< Whether an allocation failed. */
+} ADUC_Metrics_TextBuffer;
+
+/**
+ * @brief Appends formatted text to @p buffer. Sets buffer->failed on allocation failure.
+ */
+static void AppendFormat(ADUC_Metrics_TextBuffer* buffer, const char* fmt, ...)
+{
+    if (buffer->failed)
+    {
+        return;
+    }
+
+    for (;;)
+    {
+        va_list args;
+        va_start(args, fmt);
+        int written = vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, fmt, args);
+        va_end(args);
+
+        if (written < 0)
+        {
+            buffer->failed = true;
+            return;
+        }
+
+        if ((size_t)written < buffer->capacity - buffer->length)
+        {
+            buffer->length += (size_t)written;
+            return;
+        }
+
+        size_t newCapacity = buffer->capacity * 2 + (size_t)written;
+        char* newData = realloc(buffer->data, newCapacity);
+        if (newData == NULL)
+        {
+            buffer->failed = true;
+            return;
+        }
+
+        buffer->data = newData;
+        buffer->capacity = newCapacity;
+    }
+}
+
+/**
+ * @brief Appends the HELP and TYPE lines and the samples of @p metric.
+ */
+static void AppendMetric(ADUC_Metrics_TextBuffer* buffer, const ADUC_Metric* metric)
+{
+    static const char* typeNames[] = { "counter", "gauge", "histogram" };
+
+    AppendFormat(
+        buffer, "# HELP %s %s\n# TYPE %s %s\n", metric->name, metric->help, metric->name, typeNames[metric->type]);
+
+    switch (metric->type)
+    {
+    case ADUC_MetricType_Counter:
+        AppendFormat(buffer, "%s %" PRIu64 "\n", metric->name, SumShards(metric, 0));
+        break;
+
+    case ADUC_MetricType_Gauge:
+        AppendFormat(buffer, "%s %" PRId64 "\n", metric->name, ADUC_Metrics_GetGaugeValue(metric));
+        break;
+
+    case ADUC_MetricType_Histogram:
+    {
+        uint64_t cumulative = 0;
+        for (size_t bucket = 0; bucket < metric->boundCount; ++bucket)
+        {
+            cumulative += SumShards(metric, bucket);
+            AppendFormat(
+                buffer,
+                "%s_bucket{le=\"%" PRIu64 "\"} %" PRIu64 "\n",
+                metric->name,
+                metric->upperBounds[bucket],
+                cumulative);
+        }
+
+        cumulative += SumShards(metric, metric->boundCount);
+        AppendFormat(buffer, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", metric->name, cumulative);
+        AppendFormat(buffer, "%s_sum %" PRIu64 "\n", metric->name, SumShards(metric, metric->boundCount + 1));
+        AppendFormat(buffer, "%s_count %" PRIu64 "\n", metric->name, cumulative);
+        break;
+    }
+    }
+}
+
+char* ADUC_Metrics_FormatPrometheusText()
+{
+    ADUC_Metrics_TextBuffer buffer = { NULL, 0, 1024, false };
+
+    buffer.data = malloc(buffer.capacity);
+    if (buffer.data == NULL)
+    {
+        return NULL;
+    }
+
+    buffer.data[0] = '\0';
+
+    pthread_mutex_lock(&s_metricsMutex);
+    for (size_t i = 0; i < s_metricCount; ++i)
+    {
+        AppendMetric(&buffer, s_metrics[i]);
+    }
+    pthread_mutex_unlock(&s_metricsMutex);
+
+    if (buffer.failed)
+    {
+        free(buffer.data);
+        return NULL;
+    }
+
+    return buffer.data;
+}
+
+#ifdef ADUC_METRICS_USE_UNIX_SOCKET
+
+/**
+ * @brief Reactor callback for the listening socket. Writes the metrics to every pending connection.
+ *
+ * @param fd The listening socket.
+ * @param context Unused.
+ */
+static void OnExporterConnection(int fd, void* context)
+{
+    UNREFERENCED_PARAMETER(context);
+
+    int client = -1;
+    while ((client = accept(fd, NULL, NULL)) >= 0)
+    {
+        fcntl(client, F_SETFD, FD_CLOEXEC);
+
+        // A scraper that does not read must not stall the reactor: it is dropped once the socket buffer is full.
+        if (fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK) != 0)
+        {
+            Log_Warn("Cannot make the metrics client socket non-blocking (errno:%d)", errno);
+            close(client);
+            continue;
+        }
+
+        char* text = ADUC_Metrics_FormatPrometheusText();
+        if (text != NULL)
+        {
+            size_t length = strlen(text);
+            size_t offset = 0;
+            while (offset < length)
+            {
+                ssize_t sent = send(client, text + offset, length - offset, MSG_NOSIGNAL);
+                if (sent < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+
+                if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    Log_Warn("Dropping a metrics client that is not reading.");
+                    break;
+                }
+
+                if (sent <= 0)
+                {
+                    break;
+                }
+
+                offset += (size_t)sent;
+            }
+
+            free(text);
+        }
+
+        close(client);
+    }
+}
+
+bool ADUC_Metrics_StartSocketExporter(const char* socketPath)
+{
+    bool success = false;
+    int fd = -1;
+    struct sockaddr_un addr;
+    const struct group* aduGroup = NULL;
+
+    if (socketPath == NULL || *socketPath == '\0')
+    {
+        return false;
+    }
+
+    if (s_exporterFd != -1)
+    {
+        Log_Warn("Metrics exporter is already running on '%s'.", s_exporterPath);
+        return true;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (ADUC_Safe_StrCopyN(addr.sun_path, socketPath, sizeof(addr.sun_path), strlen(socketPath)) < strlen(socketPath))
+    {
+        Log_Error("Metrics socket path is too long: '%s'", socketPath);
+        goto done;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        Log_Error("socket failed (errno:%d)", errno);
+        goto done;
+    }
+
+    // Replace a stale socket left behind by a previous instance.
+    unlink(socketPath);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        Log_Error("Cannot bind metrics socket '%s' (errno:%d)", socketPath, errno);
+        goto done;
+    }
+
+    // Only the agent user and group may connect; no connection is accepted before listen().
+    if (chmod(socketPath, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) != 0)
+    {
+        Log_Error("Cannot set the mode of metrics socket '%s' (errno:%d)", socketPath, errno);
+        goto done;
+    }
+
+    aduGroup = getgrnam(ADUC_FILE_GROUP);
+    if (aduGroup == NULL || chown(socketPath, (uid_t)-1, aduGroup->gr_gid) != 0)
+    {
+        Log_Warn("Cannot set the group of metrics socket '%s' to '%s' (errno:%d)", socketPath, ADUC_FILE_GROUP, errno);
+    }
+
+    if (listen(fd, 4) != 0)
+    {
+        Log_Error("listen failed (errno:%d)", errno);
+        goto done;
+    }
+
+    if (!ADUC_Reactor_AddFd(fd, OnExporterConnection, NULL))
+    {
+        Log_Error("Cannot register the metrics socket with the reactor.");
+        goto done;
+    }
+
+    s_exporterFd = fd;
+    ADUC_Safe_StrCopyN(s_exporterPath, socketPath, sizeof(s_exporterPath), strlen(socketPath));
+    fd = -1;
+    success = true;
+
+    Log_Info("Metrics exporter listening on '%s'.", socketPath);
+
+done:
+    if (fd != -1)
+    {
+        close(fd);
+        unlink(socketPath);
+    }
+
+    return success;
+}
+
+void ADUC_Metrics_StopSocketExporter()
+{
+    if (s_exporterFd == -1)
+    {
+        return;
+    }
+
+    ADUC_Reactor_RemoveFd(s_exporterFd);
+    close(s_exporterFd);
+    unlink(s_exporterPath);
+
+    s_exporterFd = -1;
+    s_exporterPath[0] = '\0';
+}
+
+#else // ADUC_METRICS_USE_UNIX_SOCKET
+
+bool ADUC_Metrics_StartSocketExporter(const char* socketPath)
+{
+    UNREFERENCED_PARAMETER(socketPath);
+    Log_Warn("The metrics socket exporter is not supported on this platform.");
+    return false;
+}
+
+void ADUC_Metrics_StopSocketExporter()
+{
+}
+
+#endif // ADUC_METRICS_USE_UNIX_SOCKET
@@ -0,0 +1,140 @@
+/**
+ * @file metrics_utils_ut.cpp
+ * @brief Unit Tests for metrics_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/metrics_utils.h"
+#include "aduc/reactor_utils.h"
+
+#include <catch2/catch.hpp>
+#include <cstdlib> // free
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h> // stat
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h> // close, read
+#include <vector>
+
+static std::string FormatText()
+{
+    char* text = ADUC_Metrics_FormatPrometheusText();
+    REQUIRE(text != nullptr);
+    std::string result{ text };
+    free(text);
+    return result;
+}
+
+TEST_CASE("ADUC_Metrics counter")
+{
+    ADUC_Metric* counter = ADUC_Metrics_RegisterCounter("ut_counter_total", "A test counter.");
+    REQUIRE(counter != nullptr);
+
+    SECTION("Registration is idempotent by name")
+    {
+        CHECK(ADUC_Metrics_RegisterCounter("ut_counter_total", "A test counter.") == counter);
+        CHECK(ADUC_Metrics_RegisterGauge("ut_counter_total", "Wrong type.") == nullptr);
+    }
+
+    SECTION("Sums updates from many threads")
+    {
+        const uint64_t before = ADUC_Metrics_GetCounterValue(counter);
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 16; ++i)
+        {
+            threads.emplace_back([counter]() {
+                for (int j = 0; j < 1000; ++j)
+                {
+                    ADUC_Metrics_CounterAdd(counter, 2);
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        CHECK(ADUC_Metrics_GetCounterValue(counter) - before == 32000);
+    }
+
+    SECTION("Updates on NULL are ignored")
+    {
+        ADUC_Metrics_CounterAdd(nullptr, 1);
+        ADUC_Metrics_HistogramObserve(counter, 1);
+        CHECK(ADUC_Metrics_GetCounterValue(nullptr) == 0);
+    }
+}
+
+TEST_CASE("ADUC_Metrics_FormatPrometheusText")
+{
+    const uint64_t bounds[] = { 10, 100 };
+    ADUC_Metric* histogram = ADUC_Metrics_RegisterHistogram("ut_duration_ms", "A test histogram.", bounds, 2);
+    ADUC_Metric* gauge = ADUC_Metrics_RegisterGauge("ut_gauge", "A test gauge.");
+    REQUIRE(histogram != nullptr);
+    REQUIRE(gauge != nullptr);
+
+    ADUC_Metrics_HistogramObserve(histogram, 5);
+    ADUC_Metrics_HistogramObserve(histogram, 10);
+    ADUC_Metrics_HistogramObserve(histogram, 50);
+    ADUC_Metrics_HistogramObserve(histogram, 5000);
+
+    ADUC_Metrics_GaugeSet(gauge, 7);
+    ADUC_Metrics_GaugeAdd(gauge, -10);
+
+    const std::string text = FormatText();
+
+    CHECK(text.find("# TYPE ut_duration_ms histogram\n") != std::string::npos);
+    CHECK(text.find("ut_duration_ms_bucket{le=\"10\"} 2\n") != std::string::npos);
+    CHECK(text.find("ut_duration_ms_bucket{le=\"100\"} 3\n") != std::string::npos);
+    CHECK(text.find("ut_duration_ms_bucket{le=\"+Inf\"} 4\n") != std::string::npos);
+    CHECK(text.find("ut_duration_ms_sum 5065\n") != std::string::npos);
+    CHECK(text.find("ut_duration_ms_count 4\n") != std::string::npos);
+    CHECK(ADUC_Metrics_GetCounterValue(histogram) == 4);
+
+    CHECK(text.find("# HELP ut_gauge A test gauge.\n# TYPE ut_gauge gauge\nut_gauge -3\n") != std::string::npos);
+}
+
+TEST_CASE("ADUC_Metrics socket exporter")
+{
+    const std::string socketPath = "/tmp/adu_metrics_ut_" + std::to_string(getpid()) + ".sock";
+
+    REQUIRE(ADUC_Reactor_Init());
+    ADUC_Metric* counter = ADUC_Metrics_RegisterCounter("ut_exported_total", "An exported counter.");
+    ADUC_Metrics_CounterAdd(counter, 42);
+
+    REQUIRE(ADUC_Metrics_StartSocketExporter(socketPath.c_str()));
+
+    struct stat socketStat = {};
+    REQUIRE(stat(socketPath.c_str(), &socketStat) == 0);
+    CHECK((socketStat.st_mode & 0777) == 0660);
+
+    int client = socket(AF_UNIX, SOCK_STREAM, 0);
+    REQUIRE(client >= 0);
+
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    socketPath.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+    REQUIRE(connect(client, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+
+    // Dispatch the pending connection on this thread.
+    CHECK(ADUC_Reactor_Wait(1000) >= 1);
+
+    std::string received;
+    char buffer[256];
+    ssize_t bytesRead = 0;
+    while ((bytesRead = read(client, buffer, sizeof(buffer))) > 0)
+    {
+        received.append(buffer, static_cast<size_t>(bytesRead));
+    }
+    close(client);
+
+    ADUC_Metrics_StopSocketExporter();
+    ADUC_Reactor_Uninit();
+
+    CHECK(received.find("ut_exported_total 42\n") != std::string::npos);
+    CHECK(access(socketPath.c_str(), F_OK) != 0);
+}
@@ -0,0 +1,152 @@
+/**
+ * @file adushell_broker.h
+ * @brief Starts and serves the adu-shell broker, a privileged adu-shell process that runs the adu-shell tasks of a
+ * workflow without a new adu-shell launch per task.
+ *
+ * While the workflow has a broker, ADUC_LaunchChildProcess sends each adu-shell command line whose options name the
+ * broker to it over a socketpair, instead of launching adu-shell. The broker checks the credentials of each request
+ * against the adu-shell trusted users and group, and runs the task in a forked process. If the broker cannot be
+ * reached, adu-shell is launched as usual.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_ADUSHELL_BROKER_H
+#define ADUC_ADUSHELL_BROKER_H
+
+#include <aduc/c_utils.h>
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h>
+#include <sys/types.h> // gid_t, pid_t, uid_t
+
+/**
+ * @brief The adu-shell option that starts adu-shell as a broker, serving the socket with the given descriptor.
+ */
+#define ADUC_ADUSHELL_BROKER_FD_OPT "--broker-fd"
+
+/**
+ * @brief The descriptor of the broker socket in the adu-shell broker process.
+ */
+#define ADUC_ADUSHELL_BROKER_CHILD_FD 3
+
+/**
+ * @brief The largest request the broker accepts: an ADUC_AduShellBrokerTaskLimits, then the adu-shell arguments,
+ * each terminated by a null character.
+ * @details A request comes with two descriptors: a socket, on which the broker reports the pid of the task, as an
+ * int32_t, and then an ADUC_AduShellBrokerTaskStatus; and the write end of a pipe, to which the task's standard
+ * output and error go. A rejected request reports a pid of -1.
+ */
+#define ADUC_ADUSHELL_BROKER_MAX_REQUEST_SIZE (64 * 1024)
+
+/**
+ * @brief The limits of a task, at the start of a request.
+ */
+typedef struct tagADUC_AduShellBrokerTaskLimits
+{
+    uint32_t timeoutInSeconds; /**< How long the task may run. Zero means no limit. */
+    uint32_t killGracePeriodInSeconds; /**< Time between SIGTERM and SIGKILL on timeout. */
+} ADUC_AduShellBrokerTaskLimits;
+
+/**
+ * @brief The exit status and resource usage of a task, reported once it exits.
+ */
+typedef struct tagADUC_AduShellBrokerTaskStatus
+{
+    int32_t exitStatus; /**< The exit status; or the number of the signal that terminated the task. */
+    int32_t timedOut; /**< Whether the task was terminated because it ran out of time. */
+    int64_t userTimeInMilliseconds; /**< CPU time spent in user mode, by the task and the processes it waited for. */
+    int64_t systemTimeInMilliseconds; /**< CPU time spent in kernel mode. */
+    int64_t maxResidentSetSizeInKilobytes; /**< Peak resident set size. */
+    int64_t ioReadBytes; /**< Bytes read from storage, from the rusage block counts. */
+    int64_t ioWriteBytes; /**< Bytes written to storage, from the rusage block counts. */
+} ADUC_AduShellBrokerTaskStatus;
+
+/**
+ * @brief A running broker. Reference counted: the socket is closed, and the broker reaped, when the last reference is
+ * released, so a task being sent never uses a closed, or reused, descriptor.
+ * @details The agent and each extension have their own copy of this library, so the broker is reached through the
+ * workflow (see workflow_get_adushell_broker), not through a global.
+ */
+typedef struct tagADUC_AduShellBroker ADUC_AduShellBroker;
+
+/**
+ * @brief Checks the credentials of the process that sent a request.
+ *
+ * @param uid The effective user id of the peer.
+ * @param gid The effective group id of the peer.
+ * @param groups The supplementary groups of the peer.
+ * @param groupCount The number of @p groups.
+ * @return true if the peer may run adu-shell tasks.
+ */
+typedef bool (*ADUC_AduShellBroker_PeerCheckFunc)(uid_t uid, gid_t gid, const gid_t* groups, size_t groupCount);
+
+/**
+ * @brief Runs a task, in a process forked from the broker, with its standard output and error going to the agent.
+ *
+ * @param argc The number of @p argv, including the program name.
+ * @param argv "adu-shell", then the arguments of the request.
+ * @return int The exit status of the task.
+ */
+typedef int (*ADUC_AduShellBroker_TaskFunc)(int argc, char** argv);
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Starts an adu-shell broker.
+ *
+ * @param aduShellFilePath The path of the adu-shell binary.
+ * @param configFolder The configuration folder to pass to adu-shell.
+ * @return ADUC_AduShellBroker* The broker, with one reference that the caller owns; or NULL on failure, in which
+ * case adu-shell is launched for each task.
+ */
+ADUC_AduShellBroker* ADUC_AduShellBroker_Start(const char* aduShellFilePath, const char* configFolder);
+
+/**
+ * @brief Wraps the agent's end of a broker socket, e.g. one served by ADUC_AduShellBroker_Serve in tests.
+ *
+ * @param fd The socket. The broker takes ownership of it.
+ * @param pid The broker process, which is waited for when the broker is released; or -1.
+ * @return ADUC_AduShellBroker* The broker, with one reference that the caller owns; or NULL on failure.
+ */
+ADUC_AduShellBroker* ADUC_AduShellBroker_Create(int fd, pid_t pid);
+
+/**
+ * @brief Adds a reference to a broker.
+ *
+ * @param broker The broker, or NULL.
+ * @return ADUC_AduShellBroker* @p broker.
+ */
+ADUC_AduShellBroker* ADUC_AduShellBroker_AddRef(ADUC_AduShellBroker* broker);
+
+/**
+ * @brief Releases a reference to a broker. The last one closes the socket, which stops the broker, and waits for it.
+ * Tasks that are still running are not interrupted.
+ *
+ * @param broker The broker, or NULL.
+ */
+void ADUC_AduShellBroker_Release(ADUC_AduShellBroker* broker);
+
+/**
+ * @brief Gets the agent's end of the broker socket. It stays open while the caller holds a reference.
+ */
+int ADUC_AduShellBroker_GetFd(const ADUC_AduShellBroker* broker);
+
+/**
+ * @brief Serves the tasks requested on the broker socket, until the agent closes it at the end of the workflow.
+ * @details Each request is checked with @p peerCheck, using the credentials the kernel recorded for the status
+ * socket that comes with it (SO_PEERCRED, and SO_PEERGROUPS for the supplementary groups). The task then runs in a
+ * forked process, so that tasks can run at the same time, and a crash does not take the broker down. That process
+ * enforces the time limit of the request, and reports the exit status and resource usage of the task.
+ *
+ * @param brokerFd The broker socket.
+ * @param peerCheck Checks the credentials of each request.
+ * @param task Runs each task.
+ * @return int The exit code of the broker.
+ */
+int ADUC_AduShellBroker_Serve(
+    int brokerFd, ADUC_AduShellBroker_PeerCheckFunc peerCheck, ADUC_AduShellBroker_TaskFunc task);
+
+EXTERN_C_END
+
+#endif // ADUC_ADUSHELL_BROKER_H
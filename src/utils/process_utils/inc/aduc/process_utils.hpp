@@ -12,14 +12,128 @@
 #include <aducpal/pwd.h> // getpwnam
 #include <aducpal/unistd.h> // getegid, geteuid
 
+#include <aduc/adushell_broker.h> // ADUC_AduShellBroker
+#include <aduc/config_utils.h> // ADUC_ConfigInfo
 #include <azure_c_shared_utility/vector.h>
 #include <functional>
+#include <parson.h>
 
 #include <string>
 #include <sys/types.h>
 
 #include <vector>
 
+/**
+ * @brief The default bound on the output kept in memory for a child process. Only the tail is kept beyond it.
+ */
+#define ADUC_CHILD_PROCESS_DEFAULT_MAX_OUTPUT_SIZE (1024 * 1024)
+
+/**
+ * @brief The default time a child process has to exit after SIGTERM, before it is sent SIGKILL.
+ */
+#define ADUC_CHILD_PROCESS_DEFAULT_KILL_GRACE_PERIOD_IN_SECONDS 10
+
+/**
+ * @brief Resource usage of a child process, as reported by wait4(), and by its cgroup if it had one.
+ * @details wait4() only accounts for the child process and the descendants it waited for. The cgroup accounts for
+ * every process in it.
+ */
+struct ADUC_ChildProcessUsage
+{
+    long userTimeInMilliseconds = 0; /**< CPU time spent in user mode. */
+    long systemTimeInMilliseconds = 0; /**< CPU time spent in kernel mode. */
+    long maxResidentSetSizeInKilobytes = 0; /**< Peak resident set size. */
+    long long ioReadBytes = 0; /**< Bytes read from storage. From the cgroup's io.stat, or rusage block counts. */
+    long long ioWriteBytes = 0; /**< Bytes written to storage. From the cgroup's io.stat, or rusage block counts. */
+    bool timedOut = false; /**< Whether the child process was terminated because it ran out of time. */
+
+    bool inCgroup = false; /**< Whether the child process ran in a transient cgroup; the fields below are valid. */
+    long long cgroupCpuTimeInMilliseconds = 0; /**< CPU time of all the processes of the cgroup, from cpu.stat. */
+    long long cgroupMemoryPeakInBytes = 0; /**< Peak memory of the cgroup, from memory.peak. */
+    long cgroupOomKillCount = 0; /**< Processes killed for exceeding memory.max, from memory.events. */
+};
+
+/**
+ * @brief Options for launching a child process.
+ */
+struct ADUC_ChildProcessOptions
+{
+    unsigned int timeoutInSeconds = 0; /**< How long the child process may run. Zero means no limit. */
+
+    unsigned int killGracePeriodInSeconds =
+        ADUC_CHILD_PROCESS_DEFAULT_KILL_GRACE_PERIOD_IN_SECONDS; /**< Time between SIGTERM and SIGKILL on timeout. */
+
+    size_t maxOutputSize =
+        ADUC_CHILD_PROCESS_DEFAULT_MAX_OUTPUT_SIZE; /**< Bytes of output kept in memory; older output is dropped. */
+
+    bool logOutput = false; /**< Whether each line of output is also written to the log, at debug level. */
+
+    ADUC_ChildProcessUsage* usage = nullptr; /**< Optional. Receives the resource usage of the child process. */
+
+    const char* cgroupParent =
+        nullptr; /**< Optional. A delegated cgroup v2 directory, in which the child process gets a transient cgroup. */
+
+    const char* cpuMax = nullptr; /**< Optional. Written to cpu.max of the transient cgroup, e.g. "50000 100000". */
+
+    const char* memoryMax = nullptr; /**< Optional. Written to memory.max of the transient cgroup, e.g. "256M". */
+
+    const char* ioMax = nullptr; /**< Optional. Written to io.max of the transient cgroup, e.g. "8:0 wbps=10485760". */
+
+    ADUC_AduShellBroker* aduShellBroker =
+        nullptr; /**< Optional. Runs the adu-shell command line. The caller holds a reference meanwhile. */
+};
+
+/**
+ * @brief Holds a reference to an adu-shell broker, e.g. from workflow_get_adushell_broker, and releases it when it
+ * goes out of scope.
+ */
+struct ADUC_AduShellBrokerReference
+{
+    explicit ADUC_AduShellBrokerReference(ADUC_AduShellBroker* referencedBroker = nullptr) : broker(referencedBroker)
+    {
+    }
+
+    ADUC_AduShellBrokerReference(const ADUC_AduShellBrokerReference&) = delete;
+    ADUC_AduShellBrokerReference& operator=(const ADUC_AduShellBrokerReference&) = delete;
+
+    ~ADUC_AduShellBrokerReference()
+    {
+        ADUC_AduShellBroker_Release(broker);
+    }
+
+    ADUC_AduShellBroker* broker; /**< The broker, or nullptr. */
+};
+
+/**
+ * @brief Gets the options for launching the child processes of a step handler: the timeout, whether output is
+ * logged, and the transient cgroup and its limits, from the agent configuration.
+ *
+ * @param config The agent configuration. Must outlive the options.
+ * @param usage Optional. Receives the resource usage of the child process.
+ * @param aduShellBroker Optional. The adu-shell broker of the workflow, for an adu-shell command line. The caller
+ * keeps a reference to it while the options are in use.
+ * @return ADUC_ChildProcessOptions The options.
+ */
+ADUC_ChildProcessOptions ADUC_ChildProcessOptions_FromConfig(
+    const ADUC_ConfigInfo* config, ADUC_ChildProcessUsage* usage, ADUC_AduShellBroker* aduShellBroker = nullptr);
+
+/**
+ * @brief Adds the resource usage of a child process to @p total, e.g. for a step that launches several.
+ * Times and bytes are summed; peaks are the largest.
+ *
+ * @param total The resource usage to add to.
+ * @param usage The resource usage of a child process.
+ */
+void ADUC_ChildProcessUsage_Add(ADUC_ChildProcessUsage& total, const ADUC_ChildProcessUsage& usage);
+
+/**
+ * @brief Gets the resource usage of a child process as a JSON object, for the step result.
+ *
+ * @param usage The resource usage.
+ * @return JSON_Value* The JSON object, or nullptr on failure. Caller must free with json_value_free().
+ */
+JSON_Value* ADUC_ChildProcessUsage_ToJsonValue(const ADUC_ChildProcessUsage& usage);
+
 /**
  * @brief Runs specified command in a new process and captures output, error messages, and exit code.
  *
@@ -32,6 +146,27 @@
  */
 int ADUC_LaunchChildProcess(const std::string& command, std::vector<std::string> args, std::string& output);
 
+/**
+ * @brief Runs specified command in a new process and captures output, error messages, and exit code.
+ * @details The child process is started with posix_spawn, so the agent's address space is not copied. Its standard
+ * output and standard error are read line by line as they are written. Only the last options.maxOutputSize bytes
+ * are kept in @p output.
+ *
+ * @param command Name of a command to run. If command doesn't contain '/', this function will
+ *               search for the specified command in PATH.
+ * @param args List of arguments for the command.
+ * @param output A standard output and standard error from the command, combined with linefeeds into a string.
+ * @param options The timeout, output bound, and logging options; and where to return the resource usage.
+ *
+ * @return An exit code from the command. If the command was terminated by a signal, e.g. on timeout, the number of
+ * the signal.
+ */
+int ADUC_LaunchChildProcess(
+    const std::string& command,
+    std::vector<std::string> args,
+    std::string& output,
+    const ADUC_ChildProcessOptions& options);
+
 /**
  * @brief Runs specified command in a new process and captures output, error messages, and exit code.
  *
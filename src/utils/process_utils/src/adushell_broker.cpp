@@ -0,0 +1,484 @@
+/**
+ * @file adushell_broker.cpp
+ * @brief Implements starting, stopping and serving the adu-shell broker.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/adushell_broker.h"
+
+#include <aduc/logging.h>
+
+#include <errno.h>
+#include <stdlib.h> // EXIT_FAILURE
+#include <string.h> // strerror, strlen
+#include <string>
+
+#ifndef WIN32
+#    include <chrono>
+#    include <mutex>
+#    include <new> // std::nothrow
+#    include <signal.h> // kill, sigprocmask, sigtimedwait
+#    include <spawn.h>
+#    include <stdio.h> // fflush
+#    include <sys/resource.h> // struct rusage
+#    include <sys/socket.h>
+#    include <sys/wait.h>
+#    include <unistd.h>
+#    include <vector>
+
+/**
+ * @brief The size of a block in the rusage block counts.
+ */
+#    define RUSAGE_BLOCK_SIZE 512
+
+struct tagADUC_AduShellBroker
+{
+    std::mutex mutex; /**< Guards refCount. */
+    unsigned int refCount; /**< The number of references. The last one closes fd. */
+    int fd; /**< The agent's end of the broker socket. */
+    pid_t pid; /**< The broker process, or -1. */
+};
+
+ADUC_AduShellBroker* ADUC_AduShellBroker_Create(int fd, pid_t pid)
+{
+    ADUC_AduShellBroker* broker = new (std::nothrow) ADUC_AduShellBroker;
+    if (broker == nullptr)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    broker->refCount = 1;
+    broker->fd = fd;
+    broker->pid = pid;
+    return broker;
+}
+
+ADUC_AduShellBroker* ADUC_AduShellBroker_Start(const char* aduShellFilePath, const char* configFolder)
+{
+    int fds[2] = { -1, -1 };
+    pid_t pid = -1;
+    int spawnResult = 0;
+    posix_spawn_file_actions_t fileActions;
+    const std::string childFd = std::to_string(ADUC_ADUSHELL_BROKER_CHILD_FD);
+
+    if (aduShellFilePath == nullptr || configFolder == nullptr)
+    {
+        return nullptr;
+    }
+
+    // SOCK_SEQPACKET keeps each request, and the descriptors sent with it, in one message, even when several
+    // threads send requests at once.
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0)
+    {
+        Log_Error("Cannot create the adu-shell broker socket. %s (errno %d).", strerror(errno), errno);
+        return nullptr;
+    }
+
+    const char* argv[] = { aduShellFilePath,
+                           "--config-folder",
+                           configFolder,
+                           ADUC_ADUSHELL_BROKER_FD_OPT,
+                           childFd.c_str(),
+                           nullptr };
+
+    posix_spawn_file_actions_init(&fileActions);
+    posix_spawn_file_actions_adddup2(&fileActions, fds[1], ADUC_ADUSHELL_BROKER_CHILD_FD);
+
+    spawnResult = posix_spawn(
+        &pid,
+        aduShellFilePath,
+        &fileActions,
+        nullptr,
+        const_cast<char* const*>(argv), // NOLINT(cppcoreguidelines-pro-type-const-cast)
+        environ);
+
+    posix_spawn_file_actions_destroy(&fileActions);
+    close(fds[1]);
+
+    if (spawnResult != 0)
+    {
+        Log_Error("Cannot launch the adu-shell broker. %s (errno %d).", strerror(spawnResult), spawnResult);
+        close(fds[0]);
+        return nullptr;
+    }
+
+    ADUC_AduShellBroker* broker = ADUC_AduShellBroker_Create(fds[0], pid);
+    if (broker == nullptr)
+    {
+        waitpid(pid, nullptr, 0);
+        return nullptr;
+    }
+
+    Log_Info("Started the adu-shell broker (pid %d).", pid);
+    return broker;
+}
+
+ADUC_AduShellBroker* ADUC_AduShellBroker_AddRef(ADUC_AduShellBroker* broker)
+{
+    if (broker != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(broker->mutex);
+        ++broker->refCount;
+    }
+
+    return broker;
+}
+
+void ADUC_AduShellBroker_Release(ADUC_AduShellBroker* broker)
+{
+    if (broker == nullptr)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(broker->mutex);
+        if (--broker->refCount > 0)
+        {
+            return;
+        }
+    }
+
+    // The broker exits once its end of the socket reports end-of-file.
+    close(broker->fd);
+    if (broker->pid != -1)
+    {
+        while (waitpid(broker->pid, nullptr, 0) == -1 && errno == EINTR)
+        {
+        }
+
+        Log_Info("Stopped the adu-shell broker (pid %d).", broker->pid);
+    }
+
+    delete broker;
+}
+
+int ADUC_AduShellBroker_GetFd(const ADUC_AduShellBroker* broker)
+{
+    return broker != nullptr ? broker->fd : -1;
+}
+
+/**
+ * @brief Writes @p size bytes to a task's status socket.
+ */
+static void WriteBrokerStatus(int statusFd, const void* data, size_t size)
+{
+    while (write(statusFd, data, size) == -1 && errno == EINTR)
+    {
+    }
+}
+
+/**
+ * @brief Reports that a request was not run: a pid of -1, then @p exitStatus.
+ */
+static void WriteBrokerRejection(int statusFd, int32_t exitStatus)
+{
+    const int32_t pid = -1;
+    ADUC_AduShellBrokerTaskStatus status = {};
+    status.exitStatus = exitStatus;
+
+    WriteBrokerStatus(statusFd, &pid, sizeof(pid));
+    WriteBrokerStatus(statusFd, &status, sizeof(status));
+}
+
+/**
+ * @brief Gets the supplementary groups of the process that created the socket @p fd.
+ */
+static std::vector<gid_t> GetPeerGroups(int fd)
+{
+    std::vector<gid_t> groups;
+#    ifdef SO_PEERGROUPS
+    // The first call reports the size of the list, with ERANGE.
+    socklen_t size = 0;
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERGROUPS, nullptr, &size) == -1 && errno == ERANGE && size > 0)
+    {
+        groups.resize(size / sizeof(gid_t));
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERGROUPS, groups.data(), &size) != 0)
+        {
+            size = 0;
+        }
+        groups.resize(size / sizeof(gid_t));
+    }
+#    endif
+    return groups;
+}
+
+/**
+ * @brief Runs one task requested from the broker, in a process forked from the broker. Does not return.
+ * @details The task itself runs in a child process that leads its own process group, so that this process can
+ * terminate it, and the processes it starts, on timeout, and report its resource usage.
+ *
+ * @param limits The limits of the task.
+ * @param args The arguments of the task, each terminated by a null character.
+ * @param argsSize The size of @p args.
+ * @param statusFd The socket on which the pid, then the status, of the task are reported.
+ * @param outputFd The pipe to which the standard output and error of the task go.
+ * @param task Runs the task.
+ */
+[[noreturn]] static void RunBrokerTask(
+    const ADUC_AduShellBrokerTaskLimits& limits,
+    char* args,
+    size_t argsSize,
+    int statusFd,
+    int outputFd,
+    ADUC_AduShellBroker_TaskFunc task)
+{
+    // The broker ignores SIGCHLD, but this process waits for the task. SIGCHLD stays blocked, for sigtimedwait.
+    signal(SIGCHLD, SIG_DFL);
+    sigset_t childSignal;
+    sigset_t previousMask;
+    sigemptyset(&childSignal);
+    sigaddset(&childSignal, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childSignal, &previousMask);
+
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(statusFd);
+        sigprocmask(SIG_SETMASK, &previousMask, nullptr);
+        setpgid(0, 0);
+
+        dup2(outputFd, STDOUT_FILENO);
+        dup2(outputFd, STDERR_FILENO);
+        close(outputFd);
+
+        std::vector<char*> argv{ const_cast<char*>("adu-shell") }; // NOLINT(cppcoreguidelines-pro-type-const-cast)
+        for (size_t i = 0; i < argsSize; i += strlen(args + i) + 1)
+        {
+            argv.emplace_back(args + i);
+        }
+        argv.emplace_back(nullptr);
+
+        const int ret = task(static_cast<int>(argv.size() - 1), argv.data());
+
+        fflush(stdout);
+        fflush(stderr);
+        _exit(ret);
+    }
+
+    close(outputFd);
+
+    if (pid == -1)
+    {
+        Log_Error("Cannot fork a task process. errno %d", errno);
+        WriteBrokerRejection(statusFd, EXIT_FAILURE);
+        _exit(EXIT_FAILURE);
+    }
+
+    // Also set here, so that a timeout cannot reach the task before it leads its process group.
+    setpgid(pid, pid);
+
+    const int32_t taskPid = pid;
+    WriteBrokerStatus(statusFd, &taskPid, sizeof(taskPid));
+
+    // On timeout, the process group gets SIGTERM, then SIGKILL after the grace period.
+    using Clock = std::chrono::steady_clock;
+    ADUC_AduShellBrokerTaskStatus status = {};
+    Clock::time_point deadline = limits.timeoutInSeconds == 0
+        ? Clock::time_point::max()
+        : Clock::now() + std::chrono::seconds(limits.timeoutInSeconds);
+    int signalsSent = 0;
+    int wstatus = 0;
+    struct rusage usage = {};
+    pid_t waited = 0;
+
+    while ((waited = wait4(pid, &wstatus, WNOHANG, &usage)) != pid)
+    {
+        if (waited == -1 && errno != EINTR)
+        {
+            break;
+        }
+
+        const Clock::time_point now = Clock::now();
+        if (deadline == Clock::time_point::max())
+        {
+            sigwaitinfo(&childSignal, nullptr);
+        }
+        else if (now < deadline)
+        {
+            const auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count();
+            const struct timespec timeout = { static_cast<time_t>(remaining / 1000000000),
+                                              static_cast<long>(remaining % 1000000000) };
+            sigtimedwait(&childSignal, nullptr, &timeout);
+        }
+        else if (signalsSent++ == 0)
+        {
+            status.timedOut = 1;
+            kill(-pid, SIGTERM);
+            deadline = now + std::chrono::seconds(limits.killGracePeriodInSeconds);
+        }
+        else
+        {
+            kill(-pid, SIGKILL);
+            deadline = Clock::time_point::max();
+        }
+    }
+
+    if (waited == pid && WIFEXITED(wstatus))
+    {
+        status.exitStatus = WEXITSTATUS(wstatus);
+    }
+    else if (waited == pid && WIFSIGNALED(wstatus))
+    {
+        status.exitStatus = WTERMSIG(wstatus);
+    }
+    else
+    {
+        status.exitStatus = EXIT_FAILURE;
+    }
+
+    status.userTimeInMilliseconds = usage.ru_utime.tv_sec * 1000LL + usage.ru_utime.tv_usec / 1000;
+    status.systemTimeInMilliseconds = usage.ru_stime.tv_sec * 1000LL + usage.ru_stime.tv_usec / 1000;
+    status.maxResidentSetSizeInKilobytes = usage.ru_maxrss;
+    status.ioReadBytes = static_cast<int64_t>(usage.ru_inblock) * RUSAGE_BLOCK_SIZE;
+    status.ioWriteBytes = static_cast<int64_t>(usage.ru_oublock) * RUSAGE_BLOCK_SIZE;
+
+    WriteBrokerStatus(statusFd, &status, sizeof(status));
+    _exit(EXIT_SUCCESS);
+}
+
+int ADUC_AduShellBroker_Serve(
+    int brokerFd, ADUC_AduShellBroker_PeerCheckFunc peerCheck, ADUC_AduShellBroker_TaskFunc task)
+{
+    // Task processes report their own status, so the broker does not wait for them.
+    signal(SIGCHLD, SIG_IGN);
+
+    for (;;)
+    {
+        char request[ADUC_ADUSHELL_BROKER_MAX_REQUEST_SIZE];
+        int fds[2] = { -1, -1 };
+        union
+        {
+            struct cmsghdr align;
+            char buffer[CMSG_SPACE(sizeof(fds))];
+        } control = {};
+
+        struct iovec iov = { request, sizeof(request) };
+        struct msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+
+        const ssize_t size = recvmsg(brokerFd, &message, MSG_CMSG_CLOEXEC);
+        if (size == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (size <= 0)
+        {
+            break;
+        }
+
+        const struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        if (header != nullptr && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS
+            && header->cmsg_len == CMSG_LEN(sizeof(fds)))
+        {
+            memcpy(fds, CMSG_DATA(header), sizeof(fds));
+        }
+
+        if (fds[0] == -1 || fds[1] == -1 || (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0
+            || static_cast<size_t>(size) <= sizeof(ADUC_AduShellBrokerTaskLimits) || request[size - 1] != '\0')
+        {
+            Log_Error("Ignoring a malformed task request.");
+        }
+        else
+        {
+            struct ucred peer = {};
+            socklen_t peerSize = sizeof(peer);
+            const bool hasPeer = getsockopt(fds[0], SOL_SOCKET, SO_PEERCRED, &peer, &peerSize) == 0;
+            const std::vector<gid_t> groups = hasPeer ? GetPeerGroups(fds[0]) : std::vector<gid_t>{};
+
+            if (!hasPeer || !peerCheck(peer.uid, peer.gid, groups.data(), groups.size()))
+            {
+                Log_Error("Rejecting a task from pid %d, uid %d.", peer.pid, peer.uid);
+                WriteBrokerRejection(fds[0], EPERM);
+            }
+            else
+            {
+                // Otherwise, the task would write the broker's buffered output again.
+                fflush(stdout);
+                fflush(stderr);
+
+                const pid_t pid = fork();
+                if (pid == 0)
+                {
+                    ADUC_AduShellBrokerTaskLimits limits;
+                    memcpy(&limits, request, sizeof(limits));
+
+                    close(brokerFd);
+                    RunBrokerTask(
+                        limits,
+                        request + sizeof(limits),
+                        static_cast<size_t>(size) - sizeof(limits),
+                        fds[0],
+                        fds[1],
+                        task);
+                }
+
+                if (pid == -1)
+                {
+                    Log_Error("Cannot fork a task process. errno %d", errno);
+                    WriteBrokerRejection(fds[0], EXIT_FAILURE);
+                }
+            }
+        }
+
+        for (int fd : fds)
+        {
+            if (fd != -1)
+            {
+                close(fd);
+            }
+        }
+    }
+
+    Log_Info("The broker socket is closed. Exiting.");
+    return EXIT_SUCCESS;
+}
+
+#else
+
+ADUC_AduShellBroker* ADUC_AduShellBroker_Start(const char* aduShellFilePath, const char* configFolder)
+{
+    UNREFERENCED_PARAMETER(aduShellFilePath);
+    UNREFERENCED_PARAMETER(configFolder);
+    return nullptr;
+}
+
+ADUC_AduShellBroker* ADUC_AduShellBroker_Create(int fd, pid_t pid)
+{
+    UNREFERENCED_PARAMETER(fd);
+    UNREFERENCED_PARAMETER(pid);
+    return nullptr;
+}
+
+ADUC_AduShellBroker* ADUC_AduShellBroker_AddRef(ADUC_AduShellBroker* broker)
+{
+    return broker;
+}
+
+void ADUC_AduShellBroker_Release(ADUC_AduShellBroker* broker)
+{
+    UNREFERENCED_PARAMETER(broker);
+}
+
+int ADUC_AduShellBroker_GetFd(const ADUC_AduShellBroker* broker)
+{
+    UNREFERENCED_PARAMETER(broker);
+    return -1;
+}
+
+int ADUC_AduShellBroker_Serve(
+    int brokerFd, ADUC_AduShellBroker_PeerCheckFunc peerCheck, ADUC_AduShellBroker_TaskFunc task)
+{
+    UNREFERENCED_PARAMETER(brokerFd);
+    UNREFERENCED_PARAMETER(peerCheck);
+    UNREFERENCED_PARAMETER(task);
+    return EXIT_FAILURE;
+}
+
+#endif
@@ -15,9 +15,12 @@
 #include <string.h>
 #include <sys/types.h>
 
+#include <aduc/adushell_broker.h>
 #include <aduc/c_utils.h>
 #include <aduc/config_utils.h>
 #include <aduc/logging.h>
+#include <aduc/process_utils.hpp>
+#include <aduc/string_c_utils.h> // IsNullOrEmpty
 #include <aduc/string_utils.hpp>
 
 #include <aducpal/stdio.h> // popen,pclose
@@ -25,10 +28,20 @@
 #include <azure_c_shared_utility/strings.h>
 #include <azure_c_shared_utility/vector.h>
 
+#include <algorithm> // std::max, std::replace
+#include <atomic>
 #include <chrono>
+#include <fstream>
 #include <functional> // for std::function
+#include <sstream>
 #include <string>
 #ifndef WIN32 // Note: Only included when not in windows since a different wait signal is used.
+#    include <poll.h>
+#    include <signal.h> // kill, sigemptyset
+#    include <spawn.h>
+#    include <sys/resource.h> // struct rusage
+#    include <sys/socket.h> // socketpair, sendmsg
+#    include <sys/stat.h> // mkdir
 #    include <sys/wait.h>
 #    include <unistd.h>
 #endif
@@ -41,14 +54,20 @@
  * @param command Name of a command to run. If command doesn't contain '/', this function will
  *               search for the specified command in PATH.
  * @param args List of arguments for the command.
+ * @param options The timeout and logging options; and where to return the resource usage.
  * @param func Callback function for each line of output.
  *
  * @return 0 on success.
  */
 #ifdef WIN32
 static int ADUC_LaunchChildProcessHelper(
-    const std::string& command, std::vector<std::string> args, std::function<void(const char*)> func)
+    const std::string& command,
+    std::vector<std::string> args,
+    const ADUC_ChildProcessOptions& options,
+    std::function<void(const char*)> func)
 {
+    UNREFERENCED_PARAMETER(options);
+
     int ret = 0;
 
     std::string redirected_command{ command };
@@ -89,80 +108,695 @@ static int ADUC_LaunchChildProcessHelper(
 }
 #else
 
-static int ADUC_LaunchChildProcessHelper(
-    const std::string& command, std::vector<std::string> args, std::function<void(const char*)> func)
-{
 #    define READ_END 0
 #    define WRITE_END 1
 
-    int filedes[2];
-    const int ret = pipe(filedes);
-    if (ret != 0)
+/**
+ * @brief The longest line kept while waiting for its linefeed. A longer line is passed on in pieces.
+ */
+#    define CHILD_PROCESS_MAX_LINE_LENGTH 4096
+
+/**
+ * @brief A pipe from which the output of a child process is read, and the line read so far.
+ */
+struct ChildProcessStream
+{
+    int fd; /**< The read end of the pipe, or -1 once it is closed. */
+    const char* name; /**< The name of the stream, for the log. */
+    std::string pendingLine; /**< The end of the output read so far, not yet terminated by a linefeed. */
+};
+
+/**
+ * @brief Passes a line of output to the caller, and to the log if requested.
+ */
+static void EmitChildProcessLine(
+    const ChildProcessStream& stream,
+    const std::string& line,
+    pid_t pid,
+    const ADUC_ChildProcessOptions& options,
+    const std::function<void(const char*)>& func)
+{
+    if (options.logOutput)
     {
-        Log_Error("Cannot create output and error pipes. %s (errno %d).", strerror(errno), errno);
-        return ret;
+        const size_t length = line.back() == '\n' ? line.size() - 1 : line.size();
+        Log_Debug("[%s %d] %.*s", stream.name, pid, static_cast<int>(length), line.c_str());
     }
 
-    const int pid = fork();
+    func(line.c_str());
+}
 
-    if (pid == 0)
+/**
+ * @brief Reads what is available from a child process stream, and passes on each completed line.
+ *
+ * @return false at the end of the stream; true otherwise.
+ */
+static bool ReadChildProcessStream(
+    ChildProcessStream& stream,
+    pid_t pid,
+    const ADUC_ChildProcessOptions& options,
+    const std::function<void(const char*)>& func)
+{
+    char buffer[4096];
+    const ssize_t count = read(stream.fd, buffer, sizeof(buffer));
+
+    if (count < 0 && errno == EINTR)
     {
-        // Running inside child process.
+        return true;
+    }
 
-        // Redirect stdout and stderr to WRITE_END
-        dup2(filedes[WRITE_END], STDOUT_FILENO);
-        dup2(filedes[WRITE_END], STDERR_FILENO);
+    if (count <= 0)
+    {
+        if (count < 0)
+        {
+            Log_Error("Read failed, error %d", errno);
+        }
+
+        if (!stream.pendingLine.empty())
+        {
+            EmitChildProcessLine(stream, stream.pendingLine, pid, options, func);
+            stream.pendingLine.clear();
+        }
+
+        return false;
+    }
+
+    stream.pendingLine.append(buffer, static_cast<size_t>(count));
 
-        close(filedes[READ_END]);
-        close(filedes[WRITE_END]);
+    size_t lineStart = 0;
+    size_t lineFeed = 0;
+    while ((lineFeed = stream.pendingLine.find('\n', lineStart)) != std::string::npos)
+    {
+        EmitChildProcessLine(
+            stream, stream.pendingLine.substr(lineStart, lineFeed + 1 - lineStart), pid, options, func);
+        lineStart = lineFeed + 1;
+    }
+
+    stream.pendingLine.erase(0, lineStart);
+
+    if (stream.pendingLine.size() >= CHILD_PROCESS_MAX_LINE_LENGTH)
+    {
+        EmitChildProcessLine(stream, stream.pendingLine, pid, options, func);
+        stream.pendingLine.clear();
+    }
 
-        std::vector<char*> argv;
-        argv.reserve(args.size() + 2);
-        argv.emplace_back(const_cast<char*>(command.c_str())); // NOLINT(cppcoreguidelines-pro-type-const-cast)
-        for (const std::string& arg : args)
+    return true;
+}
+
+/**
+ * @brief Reads @p size bytes from a socket.
+ *
+ * @return true if they were all read; false on end-of-file or error.
+ */
+static bool ReadExactly(int fd, void* data, size_t size)
+{
+    char* next = static_cast<char*>(data);
+    while (size > 0)
+    {
+        const ssize_t count = read(fd, next, size);
+        if (count == -1 && errno == EINTR)
         {
-            argv.emplace_back(const_cast<char*>(arg.c_str())); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+            continue;
         }
-        argv.emplace_back(nullptr);
 
-        // The exec() functions only return if an error has occurred.
-        // The return value is -1, and errno is set to indicate the error.
-        int status = execvp(command.c_str(), &argv[0]);
+        if (count <= 0)
+        {
+            return false;
+        }
+
+        next += count;
+        size -= static_cast<size_t>(count);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Runs an adu-shell command line on the adu-shell broker. See adushell_broker.h for the protocol.
+ *
+ * @param brokerFd The agent's end of the broker socket.
+ * @param args The adu-shell arguments.
+ * @param options The timeout, which the broker enforces; the logging options; and where to return the resource
+ * usage, which the broker reports.
+ * @param func Callback function for each line of output.
+ * @param[out] exitStatus The exit status of the task.
+ *
+ * @return true if the broker took the request; false if it could not be sent, e.g. because the broker exited.
+ */
+static bool LaunchOnAduShellBroker(
+    int brokerFd,
+    const std::vector<std::string>& args,
+    const ADUC_ChildProcessOptions& options,
+    const std::function<void(const char*)>& func,
+    int* exitStatus)
+{
+    ADUC_AduShellBrokerTaskLimits limits = {};
+    limits.timeoutInSeconds = options.timeoutInSeconds;
+    limits.killGracePeriodInSeconds = options.killGracePeriodInSeconds;
+
+    std::string request(reinterpret_cast<const char*>(&limits), sizeof(limits));
+    for (const std::string& arg : args)
+    {
+        request.append(arg.c_str(), arg.size() + 1);
+    }
+
+    if (request.size() > ADUC_ADUSHELL_BROKER_MAX_REQUEST_SIZE)
+    {
+        return false;
+    }
+
+    int statusFds[2] = { -1, -1 };
+    int outputFds[2] = { -1, -1 };
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, statusFds) != 0)
+    {
+        return false;
+    }
+
+    if (pipe2(outputFds, O_CLOEXEC) != 0)
+    {
+        close(statusFds[0]);
+        close(statusFds[1]);
+        return false;
+    }
+
+    const int passedFds[2] = { statusFds[WRITE_END], outputFds[WRITE_END] };
+    union
+    {
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(sizeof(passedFds))];
+    } control = {};
+
+    struct iovec iov = { &request[0], request.size() };
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
 
-        fprintf(stderr, "execvp failed, returned %d, error %d\n", status, errno);
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(passedFds));
+    memcpy(CMSG_DATA(header), passedFds, sizeof(passedFds));
 
-        _exit(EXIT_FAILURE);
+    ssize_t sent = 0;
+    while ((sent = sendmsg(brokerFd, &message, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+    {
+    }
+
+    close(statusFds[WRITE_END]);
+    close(outputFds[WRITE_END]);
+
+    if (sent == -1)
+    {
+        Log_Warn("Cannot send the task to the adu-shell broker. %s (errno %d).", strerror(errno), errno);
+        close(statusFds[READ_END]);
+        close(outputFds[READ_END]);
+        return false;
     }
 
-    close(filedes[WRITE_END]);
+    int32_t taskPid = -1;
+    ReadExactly(statusFds[READ_END], &taskPid, sizeof(taskPid));
+
+    // The output is read until the status arrives, and then until its end, for at most the grace period: a process
+    // that left the task's process group may hold it open.
+    using Clock = std::chrono::steady_clock;
+    ChildProcessStream stream{ outputFds[READ_END], "adu-shell", {} };
+    int statusFd = statusFds[READ_END];
+    bool hasStatus = false;
+    ADUC_AduShellBrokerTaskStatus status = {};
+    Clock::time_point deadline = Clock::time_point::max();
+
+    while (stream.fd != -1 || statusFd != -1)
+    {
+        struct pollfd fds[2];
+        nfds_t nfds = 0;
+        if (stream.fd != -1)
+        {
+            fds[nfds++] = { stream.fd, POLLIN, 0 };
+        }
+        if (statusFd != -1)
+        {
+            fds[nfds++] = { statusFd, POLLIN, 0 };
+        }
+
+        int pollTimeoutMs = -1;
+        if (deadline != Clock::time_point::max())
+        {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+            pollTimeoutMs = static_cast<int>(std::max<std::chrono::milliseconds::rep>(remaining.count(), 0));
+        }
+
+        const int ready = poll(fds, nfds, pollTimeoutMs);
+        if (ready < 0 && errno != EINTR)
+        {
+            Log_Error("Poll failed, error %d", errno);
+            break;
+        }
+
+        // Checked whatever poll returned: a process that keeps writing would otherwise be read from forever.
+        if (Clock::now() >= deadline)
+        {
+            Log_Warn("The output of adu-shell task %d is still open after the task exited. Not reading it.", taskPid);
+            break;
+        }
+
+        for (nfds_t i = 0; ready > 0 && i < nfds; ++i)
+        {
+            if (fds[i].revents == 0)
+            {
+                continue;
+            }
+
+            if (fds[i].fd == stream.fd && !ReadChildProcessStream(stream, taskPid, options, func))
+            {
+                close(stream.fd);
+                stream.fd = -1;
+            }
+            else if (fds[i].fd == statusFd)
+            {
+                hasStatus = ReadExactly(statusFd, &status, sizeof(status));
+                close(statusFd);
+                statusFd = -1;
+                deadline = Clock::now() + std::chrono::seconds(options.killGracePeriodInSeconds);
+            }
+        }
+    }
+
+    if (stream.fd != -1)
+    {
+        close(stream.fd);
+    }
+
+    if (statusFd != -1)
+    {
+        close(statusFd);
+    }
+
+    if (!hasStatus)
+    {
+        Log_Error("The adu-shell task (pid %d) ended without an exit status.", taskPid);
+        status = {};
+        status.exitStatus = EXIT_FAILURE;
+    }
+    else if (status.timedOut != 0)
+    {
+        Log_Warn("The adu-shell task (pid %d) timed out after %u seconds.", taskPid, options.timeoutInSeconds);
+    }
+
+    if (options.usage != nullptr)
+    {
+        ADUC_ChildProcessUsage usage;
+        usage.userTimeInMilliseconds = static_cast<long>(status.userTimeInMilliseconds);
+        usage.systemTimeInMilliseconds = static_cast<long>(status.systemTimeInMilliseconds);
+        usage.maxResidentSetSizeInKilobytes = static_cast<long>(status.maxResidentSetSizeInKilobytes);
+        usage.ioReadBytes = status.ioReadBytes;
+        usage.ioWriteBytes = status.ioWriteBytes;
+        usage.timedOut = status.timedOut != 0;
+        *options.usage = usage;
+    }
+
+    *exitStatus = status.exitStatus;
+    return true;
+}
+
+/**
+ * @brief The size of a block in the rusage block counts.
+ */
+#    define RUSAGE_BLOCK_SIZE 512
+
+/**
+ * @brief Writes @p value to the interface file @p name of a cgroup.
+ *
+ * @return true on success.
+ */
+static bool WriteCgroupFile(const std::string& cgroupPath, const char* name, const std::string& value)
+{
+    const std::string filePath = cgroupPath + "/" + name;
+
+    // Note: cgroupfs does not create files; O_CREAT only matters for a plain directory, e.g. in tests.
+    const int fd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+    if (fd == -1)
+    {
+        Log_Warn("Cannot open %s. %s (errno %d).", filePath.c_str(), strerror(errno), errno);
+        return false;
+    }
+
+    const ssize_t written = write(fd, value.c_str(), value.size());
+    const int writeErrno = errno;
+    close(fd);
+
+    if (written != static_cast<ssize_t>(value.size()))
+    {
+        Log_Warn(
+            "Cannot write '%s' to %s. %s (errno %d).",
+            value.c_str(),
+            filePath.c_str(),
+            strerror(writeErrno),
+            writeErrno);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Reads the interface file @p name of a cgroup.
+ *
+ * @return The content of the file; empty if it cannot be read.
+ */
+static std::string ReadCgroupFile(const std::string& cgroupPath, const char* name)
+{
+    std::ifstream file(cgroupPath + "/" + name);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+/**
+ * @brief Sums the values of @p key in the content of a cgroup statistics file, in "key value" (e.g. cpu.stat) or
+ * "key=value" (e.g. io.stat, one line per device) form.
+ */
+static long long SumCgroupStat(const std::string& content, const std::string& key)
+{
+    long long sum = 0;
+    std::istringstream words(content);
+    std::string word;
+    while (words >> word)
+    {
+        if (word == key)
+        {
+            words >> word;
+            sum += strtoll(word.c_str(), nullptr, 10);
+        }
+        else if (word.compare(0, key.size() + 1, key + "=") == 0)
+        {
+            sum += strtoll(word.c_str() + key.size() + 1, nullptr, 10);
+        }
+    }
+
+    return sum;
+}
+
+/**
+ * @brief Creates a transient cgroup for a child process under options.cgroupParent, and sets its limits.
+ *
+ * @return The path of the cgroup; empty if it cannot be created, in which case the child process runs in the
+ * cgroup of the agent.
+ */
+static std::string CreateChildProcessCgroup(const ADUC_ChildProcessOptions& options)
+{
+    static std::atomic<unsigned int> s_cgroupCount{ 0 };
+
+    const std::string parent = options.cgroupParent;
+
+    // The controllers must be enabled for the children of the parent, for the limits and the statistics.
+    std::string enabledControllers = " " + ReadCgroupFile(parent, "cgroup.subtree_control") + " ";
+    std::replace(enabledControllers.begin(), enabledControllers.end(), '\n', ' ');
+    for (const char* controller : { "cpu", "memory", "io" })
+    {
+        if (enabledControllers.find(std::string(" ") + controller + " ") == std::string::npos)
+        {
+            WriteCgroupFile(parent, "cgroup.subtree_control", std::string("+") + controller);
+        }
+    }
+
+    const std::string cgroupPath =
+        parent + "/adu-child-" + std::to_string(getpid()) + "-" + std::to_string(++s_cgroupCount);
+    if (mkdir(cgroupPath.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0)
+    {
+        Log_Warn("Cannot create cgroup %s. %s (errno %d).", cgroupPath.c_str(), strerror(errno), errno);
+        return std::string{};
+    }
+
+    // A limit that cannot be set is logged; the child process still runs, and is still accounted for.
+    const std::pair<const char*, const char*> limits[] = {
+        { "cpu.max", options.cpuMax }, { "memory.max", options.memoryMax }, { "io.max", options.ioMax }
+    };
+    for (const auto& limit : limits)
+    {
+        if (limit.second != nullptr && *limit.second != '\0')
+        {
+            WriteCgroupFile(cgroupPath, limit.first, limit.second);
+        }
+    }
+
+    return cgroupPath;
+}
+
+/**
+ * @brief Reads the statistics of the transient cgroup of a child process that exited, then removes the cgroup.
+ */
+static void RemoveChildProcessCgroup(const std::string& cgroupPath, ADUC_ChildProcessUsage* usage)
+{
+    usage->inCgroup = true;
+    usage->cgroupCpuTimeInMilliseconds = SumCgroupStat(ReadCgroupFile(cgroupPath, "cpu.stat"), "usage_usec") / 1000;
+    usage->cgroupMemoryPeakInBytes = strtoll(ReadCgroupFile(cgroupPath, "memory.peak").c_str(), nullptr, 10);
+    usage->cgroupOomKillCount =
+        static_cast<long>(SumCgroupStat(ReadCgroupFile(cgroupPath, "memory.events"), "oom_kill"));
+
+    // Unlike rusage, io.stat also accounts for the processes the child process did not wait for.
+    const std::string ioStat = ReadCgroupFile(cgroupPath, "io.stat");
+    if (!ioStat.empty())
+    {
+        usage->ioReadBytes = SumCgroupStat(ioStat, "rbytes");
+        usage->ioWriteBytes = SumCgroupStat(ioStat, "wbytes");
+    }
+
+    if (rmdir(cgroupPath.c_str()) != 0)
+    {
+        Log_Warn(
+            "Cannot remove cgroup %s; processes started by the child process may still run. %s (errno %d).",
+            cgroupPath.c_str(),
+            strerror(errno),
+            errno);
+    }
+}
+
+static int ADUC_LaunchChildProcessHelper(
+    const std::string& command,
+    std::vector<std::string> args,
+    const ADUC_ChildProcessOptions& options,
+    std::function<void(const char*)> func)
+{
+    // While a workflow has an adu-shell broker, adu-shell tasks run there rather than in a new adu-shell; unless they
+    // must run in a cgroup of their own, which the broker's tasks do not.
+    const int brokerFd = ADUC_AduShellBroker_GetFd(options.aduShellBroker);
+    if (brokerFd != -1 && options.cgroupParent == nullptr)
+    {
+        int exitStatus = EXIT_FAILURE;
+        if (LaunchOnAduShellBroker(brokerFd, args, options, func, &exitStatus))
+        {
+            return exitStatus;
+        }
+
+        Log_Warn("The adu-shell broker is not available. Launching adu-shell.");
+    }
+
+    int outPipe[2] = { -1, -1 };
+    int errPipe[2] = { -1, -1 };
+    if (pipe2(outPipe, O_CLOEXEC) != 0 || pipe2(errPipe, O_CLOEXEC) != 0)
+    {
+        const int pipeErrno = errno;
+        Log_Error("Cannot create output and error pipes. %s (errno %d).", strerror(pipeErrno), pipeErrno);
+        for (int fd : { outPipe[READ_END], outPipe[WRITE_END], errPipe[READ_END], errPipe[WRITE_END] })
+        {
+            if (fd != -1)
+            {
+                close(fd);
+            }
+        }
+        return pipeErrno;
+    }
+
+    // Redirect stdout and stderr to the write ends. dup2 clears O_CLOEXEC on the copies only.
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    posix_spawn_file_actions_adddup2(&fileActions, outPipe[WRITE_END], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fileActions, errPipe[WRITE_END], STDERR_FILENO);
+
+    // The child process leads its own process group, so that a timeout also stops the processes it starts.
+    // It does not inherit the signal mask of the calling thread.
+    sigset_t emptyMask;
+    sigemptyset(&emptyMask);
+    posix_spawnattr_t spawnAttr;
+    posix_spawnattr_init(&spawnAttr);
+    posix_spawnattr_setpgroup(&spawnAttr, 0);
+    posix_spawnattr_setsigmask(&spawnAttr, &emptyMask);
+    short spawnFlags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK;
+
+    const std::string cgroupPath =
+        options.cgroupParent != nullptr ? CreateChildProcessCgroup(options) : std::string{};
+#    ifdef POSIX_SPAWN_SETCGROUP
+    // The child process starts in its cgroup, so that none of the processes it starts can escape it.
+    int cgroupFd = -1;
+    if (!cgroupPath.empty())
+    {
+        cgroupFd = open(cgroupPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (cgroupFd != -1 && posix_spawnattr_setcgroup_np(&spawnAttr, cgroupFd) == 0)
+        {
+            spawnFlags |= POSIX_SPAWN_SETCGROUP;
+        }
+    }
+#    endif
+    posix_spawnattr_setflags(&spawnAttr, spawnFlags);
+
+    std::vector<char*> argv;
+    argv.reserve(args.size() + 2);
+    argv.emplace_back(const_cast<char*>(command.c_str())); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+    for (const std::string& arg : args)
+    {
+        argv.emplace_back(const_cast<char*>(arg.c_str())); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+    }
+    argv.emplace_back(nullptr);
+
+    // Unlike fork(), posix_spawn does not copy the page tables of the agent, which is costly for a large process on
+    // a small device; and it reports a failure to exec the command to the caller.
+    pid_t pid = -1;
+    const int spawnResult = posix_spawnp(&pid, command.c_str(), &fileActions, &spawnAttr, &argv[0], environ);
+
+    posix_spawnattr_destroy(&spawnAttr);
+    posix_spawn_file_actions_destroy(&fileActions);
+    close(outPipe[WRITE_END]);
+    close(errPipe[WRITE_END]);
+
+    bool movedToCgroup = false;
+#    ifdef POSIX_SPAWN_SETCGROUP
+    if (cgroupFd != -1)
+    {
+        close(cgroupFd);
+    }
+    movedToCgroup = (spawnFlags & POSIX_SPAWN_SETCGROUP) != 0;
+#    endif
+
+    if (spawnResult != 0)
+    {
+        Log_Error("Cannot launch '%s'. %s (errno %d).", command.c_str(), strerror(spawnResult), spawnResult);
+        func((std::string("posix_spawnp failed, error ") + std::to_string(spawnResult) + "\n").c_str());
+        close(outPipe[READ_END]);
+        close(errPipe[READ_END]);
+        if (!cgroupPath.empty())
+        {
+            rmdir(cgroupPath.c_str());
+        }
+        return EXIT_FAILURE;
+    }
+
+    // Without posix_spawnattr_setcgroup_np (glibc 2.39), the child process is moved to its cgroup once it runs.
+    // A process it starts before then stays in the agent's cgroup.
+    if (!cgroupPath.empty() && !movedToCgroup)
+    {
+        WriteCgroupFile(cgroupPath, "cgroup.procs", std::to_string(pid));
+    }
+
+    ChildProcessStream streams[] = { { outPipe[READ_END], "stdout", {} }, { errPipe[READ_END], "stderr", {} } };
+
+    // On timeout, the process group gets SIGTERM, then SIGKILL after the grace period. If the output is still open
+    // a grace period after that, e.g. held by a process that left the group, it is no longer read.
+    using Clock = std::chrono::steady_clock;
+    int signalsSent = 0;
+    bool timedOut = false;
+    Clock::time_point deadline = options.timeoutInSeconds == 0
+        ? Clock::time_point::max()
+        : Clock::now() + std::chrono::seconds(options.timeoutInSeconds);
 
     for (;;)
     {
-        char buffer[1024];
-        ssize_t count;
-        count = read(filedes[READ_END], buffer, sizeof(buffer) - 1);
+        struct pollfd fds[2];
+        ChildProcessStream* polled[2];
+        nfds_t nfds = 0;
+        for (ChildProcessStream& stream : streams)
+        {
+            if (stream.fd != -1)
+            {
+                fds[nfds] = { stream.fd, POLLIN, 0 };
+                polled[nfds] = &stream;
+                ++nfds;
+            }
+        }
 
-        if (count == -1)
+        if (nfds == 0)
         {
-            Log_Error("Read failed, error %d", errno);
             break;
         }
 
-        if (count <= 0)
+        int pollTimeoutMs = -1;
+        if (deadline != Clock::time_point::max())
+        {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+            pollTimeoutMs = static_cast<int>(std::max<std::chrono::milliseconds::rep>(remaining.count(), 0));
+        }
+
+        const int ready = poll(fds, nfds, pollTimeoutMs);
+        if (ready < 0 && errno != EINTR)
         {
+            Log_Error("Poll failed, error %d", errno);
             break;
         }
 
-        // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-constant-array-index)
-        buffer[count] = 0;
-        func(buffer); // Make call to the recording function to put in log data
+        if (ready > 0)
+        {
+            for (nfds_t i = 0; i < nfds; ++i)
+            {
+                if (fds[i].revents != 0 && !ReadChildProcessStream(*polled[i], pid, options, func))
+                {
+                    close(polled[i]->fd);
+                    polled[i]->fd = -1;
+                }
+            }
+        }
+
+        // Checked whatever poll returned: a child process that keeps writing must still time out.
+        if (Clock::now() >= deadline)
+        {
+            if (signalsSent == 0)
+            {
+                Log_Warn(
+                    "'%s' (pid %d) timed out after %u seconds. Sending SIGTERM.",
+                    command.c_str(),
+                    pid,
+                    options.timeoutInSeconds);
+                timedOut = true;
+                kill(-pid, SIGTERM);
+            }
+            else if (signalsSent == 1)
+            {
+                Log_Warn("'%s' (pid %d) did not exit after SIGTERM. Sending SIGKILL.", command.c_str(), pid);
+                kill(-pid, SIGKILL);
+
+                // The cgroup also holds the processes that left the process group.
+                if (!cgroupPath.empty())
+                {
+                    WriteCgroupFile(cgroupPath, "cgroup.kill", "1");
+                }
+            }
+            else
+            {
+                Log_Warn(
+                    "The output of '%s' (pid %d) is still open after SIGKILL. Not reading it.", command.c_str(), pid);
+                break;
+            }
+
+            ++signalsSent;
+            deadline = Clock::now() + std::chrono::seconds(options.killGracePeriodInSeconds);
+        }
+    }
+
+    for (const ChildProcessStream& stream : streams)
+    {
+        if (stream.fd != -1)
+        {
+            close(stream.fd);
+        }
+    }
+
+    int wstatus = 0;
+    struct rusage usage = {};
+    while (wait4(pid, &wstatus, 0, &usage) == -1 && errno == EINTR)
+    {
     }
 
-    int wstatus;
     int childExitStatus;
 
-    waitpid(pid, &wstatus, 0);
-
     // Get the child process exit code.
     if (WIFEXITED(wstatus))
     {
@@ -191,7 +825,44 @@ static int ADUC_LaunchChildProcessHelper(
         Log_Error("Child process terminated abnormally.", childExitStatus);
     }
 
-    close(filedes[READ_END]);
+    ADUC_ChildProcessUsage childUsage;
+    childUsage.userTimeInMilliseconds = usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000;
+    childUsage.systemTimeInMilliseconds = usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000;
+    childUsage.maxResidentSetSizeInKilobytes = usage.ru_maxrss;
+    childUsage.ioReadBytes = static_cast<long long>(usage.ru_inblock) * RUSAGE_BLOCK_SIZE;
+    childUsage.ioWriteBytes = static_cast<long long>(usage.ru_oublock) * RUSAGE_BLOCK_SIZE;
+    childUsage.timedOut = timedOut;
+
+    if (!cgroupPath.empty())
+    {
+        RemoveChildProcessCgroup(cgroupPath, &childUsage);
+    }
+
+    Log_Debug(
+        "'%s' (pid %d) used %ld ms user, %ld ms system CPU time, %ld KB max RSS, and read %lld, wrote %lld bytes.",
+        command.c_str(),
+        pid,
+        childUsage.userTimeInMilliseconds,
+        childUsage.systemTimeInMilliseconds,
+        childUsage.maxResidentSetSizeInKilobytes,
+        childUsage.ioReadBytes,
+        childUsage.ioWriteBytes);
+
+    if (childUsage.inCgroup)
+    {
+        Log_Debug(
+            "The cgroup of '%s' (pid %d) used %lld ms CPU time, and %lld bytes peak memory; %ld OOM kills.",
+            command.c_str(),
+            pid,
+            childUsage.cgroupCpuTimeInMilliseconds,
+            childUsage.cgroupMemoryPeakInBytes,
+            childUsage.cgroupOomKillCount);
+    }
+
+    if (options.usage != nullptr)
+    {
+        *options.usage = childUsage;
+    }
 
     return childExitStatus;
 }
@@ -209,13 +880,144 @@ static int ADUC_LaunchChildProcessHelper(
  * @return An exit code from the command.
  */
 int ADUC_LaunchChildProcess(const std::string& command, std::vector<std::string> args, std::string& output)
+{
+    return ADUC_LaunchChildProcess(command, args, output, ADUC_ChildProcessOptions{});
+}
+
+/**
+ * @brief Runs specified command in a new process and captures output, error messages, and exit code.
+ *
+ * @param command Name of a command to run. If command doesn't contain '/', this function will
+ *               search for the specified command in PATH.
+ * @param args List of arguments for the command.
+ * @param output A standard output and standard error from the command, combined with linefeeds into a string.
+ * @param options The timeout, output bound, and logging options; and where to return the resource usage.
+ *
+ * @return An exit code from the command.
+ */
+int ADUC_LaunchChildProcess(
+    const std::string& command,
+    std::vector<std::string> args,
+    std::string& output,
+    const ADUC_ChildProcessOptions& options)
 {
     output.clear();
 
-    return ADUC_LaunchChildProcessHelper(command, args, [&output](const char* line) -> void {
-        // fgets includes the newline character.
+    size_t droppedSize = 0;
+    // Keeps the last maxOutputSize bytes, once the output is longer than threshold.
+    const auto dropOutputBeyond = [&output, &droppedSize, &options](size_t threshold) {
+        if (output.size() > threshold)
+        {
+            droppedSize += output.size() - options.maxOutputSize;
+            output.erase(0, output.size() - options.maxOutputSize);
+        }
+    };
+
+    const int exitCode = ADUC_LaunchChildProcessHelper(command, args, options, [&](const char* line) -> void {
         output += line;
+
+        // Drop in batches, so that a long output is moved once per maxOutputSize bytes, rather than once per line.
+        dropOutputBeyond(2 * options.maxOutputSize);
     });
+
+    dropOutputBeyond(options.maxOutputSize);
+
+    if (droppedSize > 0)
+    {
+        output.insert(0, "[" + std::to_string(droppedSize) + " bytes of earlier output dropped]\n");
+    }
+
+    return exitCode;
+}
+
+ADUC_ChildProcessOptions ADUC_ChildProcessOptions_FromConfig(
+    const ADUC_ConfigInfo* config, ADUC_ChildProcessUsage* usage, ADUC_AduShellBroker* aduShellBroker)
+{
+    ADUC_ChildProcessOptions options;
+    options.usage = usage;
+    options.aduShellBroker = aduShellBroker;
+
+    if (config != nullptr)
+    {
+        options.timeoutInSeconds = config->childProcessTimeoutInSeconds;
+        options.logOutput = config->childProcessLogOutput;
+    }
+
+    if (config != nullptr && !IsNullOrEmpty(config->childProcessCgroup))
+    {
+        options.cgroupParent = config->childProcessCgroup;
+        options.cpuMax = config->childProcessCpuMax;
+        options.memoryMax = config->childProcessMemoryMax;
+        options.ioMax = config->childProcessIoMax;
+    }
+
+    return options;
+}
+
+void ADUC_ChildProcessUsage_Add(ADUC_ChildProcessUsage& total, const ADUC_ChildProcessUsage& usage)
+{
+    total.userTimeInMilliseconds += usage.userTimeInMilliseconds;
+    total.systemTimeInMilliseconds += usage.systemTimeInMilliseconds;
+    total.maxResidentSetSizeInKilobytes =
+        std::max(total.maxResidentSetSizeInKilobytes, usage.maxResidentSetSizeInKilobytes);
+    total.ioReadBytes += usage.ioReadBytes;
+    total.ioWriteBytes += usage.ioWriteBytes;
+    total.timedOut = total.timedOut || usage.timedOut;
+
+    if (usage.inCgroup)
+    {
+        total.inCgroup = true;
+        total.cgroupCpuTimeInMilliseconds += usage.cgroupCpuTimeInMilliseconds;
+        total.cgroupMemoryPeakInBytes = std::max(total.cgroupMemoryPeakInBytes, usage.cgroupMemoryPeakInBytes);
+        total.cgroupOomKillCount += usage.cgroupOomKillCount;
+    }
+}
+
+JSON_Value* ADUC_ChildProcessUsage_ToJsonValue(const ADUC_ChildProcessUsage& usage)
+{
+    JSON_Value* usageValue = json_value_init_object();
+    JSON_Object* usageObject = json_value_get_object(usageValue);
+    if (usageObject == nullptr)
+    {
+        json_value_free(usageValue);
+        return nullptr;
+    }
+
+    const std::pair<const char*, double> fields[] = {
+        { "userTimeMs", static_cast<double>(usage.userTimeInMilliseconds) },
+        { "systemTimeMs", static_cast<double>(usage.systemTimeInMilliseconds) },
+        { "maxRssKB", static_cast<double>(usage.maxResidentSetSizeInKilobytes) },
+        { "ioReadBytes", static_cast<double>(usage.ioReadBytes) },
+        { "ioWriteBytes", static_cast<double>(usage.ioWriteBytes) },
+    };
+
+    bool succeeded = json_object_set_boolean(usageObject, "timedOut", usage.timedOut) == JSONSuccess;
+    for (const auto& field : fields)
+    {
+        succeeded = succeeded && json_object_set_number(usageObject, field.first, field.second) == JSONSuccess;
+    }
+
+    if (usage.inCgroup)
+    {
+        const std::pair<const char*, double> cgroupFields[] = {
+            { "cgroupCpuTimeMs", static_cast<double>(usage.cgroupCpuTimeInMilliseconds) },
+            { "cgroupMemoryPeakBytes", static_cast<double>(usage.cgroupMemoryPeakInBytes) },
+            { "cgroupOomKills", static_cast<double>(usage.cgroupOomKillCount) },
+        };
+
+        for (const auto& field : cgroupFields)
+        {
+            succeeded = succeeded && json_object_set_number(usageObject, field.first, field.second) == JSONSuccess;
+        }
+    }
+
+    if (!succeeded)
+    {
+        json_value_free(usageValue);
+        return nullptr;
+    }
+
+    return usageValue;
 }
 
 /**
@@ -231,14 +1033,18 @@ int ADUC_LaunchChildProcess(const std::string& command, std::vector<std::string>
 int ADUC_LaunchChildProcess(
     const std::string& command, std::vector<std::string> args, std::vector<std::string>& output)
 {
-    output.clear();
+    std::string combinedOutput;
+    const int exitCode = ADUC_LaunchChildProcess(command, args, combinedOutput, ADUC_ChildProcessOptions{});
 
-    return ADUC_LaunchChildProcessHelper(command, args, [&output](const char* line) -> void {
-        // fgets includes the newline character.
-        std::string str{ line };
-        output.push_back(str.substr(0, str.size() - 1));
-    });
+    output = ADUC::StringUtils::Split(combinedOutput, '\n');
+    if (!output.empty() && output.back().empty())
+    {
+        output.pop_back();
+    }
+
+    return exitCode;
 }
+
 /**
  * @brief Ensure that the effective group of the process is the given group (or is root).
  * @remark This function is not thread-safe if called with the defaults for the optional args.
@@ -0,0 +1,185 @@
+/**
+ * @file adushell_broker_ut.cpp
+ * @brief Unit Tests for the adu-shell broker protocol.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+
+#include "aduc/adushell_broker.h"
+#include "aduc/process_utils.hpp" // ADUC_LaunchChildProcess
+
+#include <algorithm> // std::sort
+#include <chrono>
+#include <csignal> // SIGTERM
+#include <string>
+#include <vector>
+#if !defined(WIN32)
+#    include <sys/socket.h> // socketpair
+#    include <unistd.h> // fork, getgroups
+
+/**
+ * @brief The task of the test broker: "echo" prints its arguments and exits with 3; "sleep" sleeps.
+ */
+static int RunTestTask(int argc, char** argv)
+{
+    const std::string action = argc > 1 ? argv[1] : "";
+    if (action == "echo")
+    {
+        for (int i = 2; i < argc; ++i)
+        {
+            printf("%s\n", argv[i]);
+        }
+        return 3;
+    }
+
+    if (action == "sleep")
+    {
+        sleep(30);
+        return EXIT_SUCCESS;
+    }
+
+    return EXIT_FAILURE;
+}
+
+static bool AcceptAll(uid_t /*uid*/, gid_t /*gid*/, const gid_t* /*groups*/, size_t /*groupCount*/)
+{
+    return true;
+}
+
+static bool RejectAll(uid_t /*uid*/, gid_t /*gid*/, const gid_t* /*groups*/, size_t /*groupCount*/)
+{
+    return false;
+}
+
+/**
+ * @brief Accepts a peer with the credentials of the broker, which are those of the test: the broker is forked from it.
+ */
+static bool AcceptOwnCredentials(uid_t uid, gid_t gid, const gid_t* groups, size_t groupCount)
+{
+    std::vector<gid_t> ownGroups(static_cast<size_t>(getgroups(0, nullptr)));
+    ownGroups.resize(static_cast<size_t>(getgroups(static_cast<int>(ownGroups.size()), ownGroups.data())));
+
+    std::vector<gid_t> peerGroups(groups, groups + groupCount);
+    std::sort(ownGroups.begin(), ownGroups.end());
+    std::sort(peerGroups.begin(), peerGroups.end());
+
+    return uid == geteuid() && gid == getegid() && peerGroups == ownGroups;
+}
+
+/**
+ * @brief Serves a broker socket in a forked process.
+ */
+static ADUC_AduShellBroker* StartTestBroker(ADUC_AduShellBroker_PeerCheckFunc peerCheck)
+{
+    int fds[2] = { -1, -1 };
+    REQUIRE(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == 0);
+
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        _exit(ADUC_AduShellBroker_Serve(fds[1], peerCheck, RunTestTask));
+    }
+
+    close(fds[1]);
+    REQUIRE(pid != -1);
+    return ADUC_AduShellBroker_Create(fds[0], pid);
+}
+
+TEST_CASE("A task runs on the broker, which reports its output, exit status and usage")
+{
+    ADUC_AduShellBroker* broker = StartTestBroker(AcceptAll);
+    REQUIRE(broker != nullptr);
+
+    ADUC_ChildProcessUsage usage;
+    ADUC_ChildProcessOptions options;
+    options.usage = &usage;
+    options.aduShellBroker = broker;
+
+    std::string output;
+    const int exitCode = ADUC_LaunchChildProcess("adu-shell", { "echo", "hello", "world" }, output, options);
+
+    CHECK(exitCode == 3);
+    CHECK(output == "hello\nworld\n");
+    CHECK_FALSE(usage.timedOut);
+    CHECK(usage.maxResidentSetSizeInKilobytes > 0);
+
+    ADUC_AduShellBroker_Release(broker);
+}
+
+TEST_CASE("The broker enforces the timeout of a task")
+{
+    ADUC_AduShellBroker* broker = StartTestBroker(AcceptAll);
+    REQUIRE(broker != nullptr);
+
+    ADUC_ChildProcessUsage usage;
+    ADUC_ChildProcessOptions options;
+    options.timeoutInSeconds = 1;
+    options.killGracePeriodInSeconds = 1;
+    options.usage = &usage;
+    options.aduShellBroker = broker;
+
+    std::string output;
+    const auto start = std::chrono::steady_clock::now();
+    const int exitCode = ADUC_LaunchChildProcess("adu-shell", { "sleep" }, output, options);
+
+    CHECK(exitCode == SIGTERM);
+    CHECK(usage.timedOut);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+
+    ADUC_AduShellBroker_Release(broker);
+}
+
+TEST_CASE("The broker checks the credentials of each request")
+{
+    ADUC_ChildProcessOptions options;
+    std::string output;
+
+    SECTION("a request that fails the check is rejected")
+    {
+        ADUC_AduShellBroker* broker = StartTestBroker(RejectAll);
+        REQUIRE(broker != nullptr);
+        options.aduShellBroker = broker;
+
+        CHECK(ADUC_LaunchChildProcess("adu-shell", { "echo", "hello" }, output, options) == EPERM);
+        CHECK(output.empty());
+
+        ADUC_AduShellBroker_Release(broker);
+    }
+
+    SECTION("the check gets the user, group and supplementary groups of the sender")
+    {
+        ADUC_AduShellBroker* broker = StartTestBroker(AcceptOwnCredentials);
+        REQUIRE(broker != nullptr);
+        options.aduShellBroker = broker;
+
+        CHECK(ADUC_LaunchChildProcess("adu-shell", { "echo", "hello" }, output, options) == 3);
+        CHECK(output == "hello\n");
+
+        ADUC_AduShellBroker_Release(broker);
+    }
+}
+
+TEST_CASE("The broker socket stays open while a reference is held")
+{
+    ADUC_AduShellBroker* broker = StartTestBroker(AcceptAll);
+    REQUIRE(broker != nullptr);
+
+    // The owner releases its reference, e.g. as the workflow goes idle, while a launch still holds one.
+    ADUC_AduShellBroker* launcherReference = ADUC_AduShellBroker_AddRef(broker);
+    const int fd = ADUC_AduShellBroker_GetFd(broker);
+    ADUC_AduShellBroker_Release(broker);
+
+    ADUC_ChildProcessOptions options;
+    options.aduShellBroker = launcherReference;
+
+    std::string output;
+    CHECK(ADUC_AduShellBroker_GetFd(launcherReference) == fd);
+    CHECK(ADUC_LaunchChildProcess("adu-shell", { "echo", "still served" }, output, options) == 3);
+    CHECK(output == "still served\n");
+
+    ADUC_AduShellBroker_Release(launcherReference);
+}
+#endif
@@ -10,8 +10,17 @@
 #include <catch2/catch.hpp>
 
 #include "aduc/process_utils.hpp" // ADUC_LaunchChildProcess
+#include <aduc/auto_dir.hpp>
 
+#include <algorithm> // std::find
+#include <chrono>
+#include <csignal> // SIGTERM, SIGKILL
+#include <fstream>
+#include <sstream>
 #include <vector>
+#if !defined(WIN32)
+#    include <dirent.h> // opendir
+#endif
 
 using Catch::Matchers::Contains;
 
@@ -81,6 +90,218 @@ TEST_CASE("Bad parameter error")
     CHECK_THAT(output.c_str(), Contains(bogusOption));
 }
 
+#if !defined(WIN32)
+TEST_CASE("Capture standard output and standard error line by line")
+{
+    std::vector<std::string> args{ "-c", "echo out1; echo err1 >&2; printf 'no linefeed'" };
+    std::vector<std::string> output;
+    const int exitCode = ADUC_LaunchChildProcess("sh", args, output);
+
+    CHECK(exitCode == EXIT_SUCCESS);
+    REQUIRE(output.size() == 3);
+    CHECK(std::find(output.begin(), output.end(), "out1") != output.end());
+    CHECK(std::find(output.begin(), output.end(), "err1") != output.end());
+    CHECK(std::find(output.begin(), output.end(), "no linefeed") != output.end());
+}
+
+TEST_CASE("Missing command")
+{
+    std::string output;
+    const int exitCode = ADUC_LaunchChildProcess("/nonexistent/command", {}, output);
+
+    CHECK(exitCode != EXIT_SUCCESS);
+    CHECK_THAT(output.c_str(), Contains("posix_spawnp failed"));
+}
+
+TEST_CASE("Only the tail of the output is kept")
+{
+    ADUC_ChildProcessOptions options;
+    options.maxOutputSize = 100;
+
+    std::vector<std::string> args{ "-c", "i=0; while [ $i -lt 1000 ]; do echo line$i; i=$((i+1)); done" };
+    std::string output;
+    const int exitCode = ADUC_LaunchChildProcess("sh", args, output, options);
+
+    CHECK(exitCode == EXIT_SUCCESS);
+    CHECK_THAT(output.c_str(), Contains("bytes of earlier output dropped]"));
+    CHECK_THAT(output.c_str(), Contains("line999\n"));
+    CHECK_THAT(output.c_str(), !Contains("line0\n"));
+    CHECK(output.size() < 150);
+}
+
+TEST_CASE("Timeout")
+{
+    ADUC_ChildProcessUsage usage;
+    ADUC_ChildProcessOptions options;
+    options.timeoutInSeconds = 1;
+    options.killGracePeriodInSeconds = 1;
+    options.usage = &usage;
+    std::string output;
+
+    SECTION("the child process is terminated with SIGTERM")
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const int exitCode = ADUC_LaunchChildProcess("sh", { "-c", "echo started; sleep 30" }, output, options);
+
+        CHECK(exitCode == SIGTERM);
+        CHECK(usage.timedOut);
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+        CHECK_THAT(output.c_str(), Contains("started\n"));
+    }
+
+    SECTION("the child process is killed when it ignores SIGTERM")
+    {
+        const int exitCode = ADUC_LaunchChildProcess("sh", { "-c", "trap '' TERM; sleep 30" }, output, options);
+
+        CHECK(exitCode == SIGKILL);
+        CHECK(usage.timedOut);
+    }
+
+    SECTION("a child process that keeps writing is terminated")
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const int exitCode =
+            ADUC_LaunchChildProcess("sh", { "-c", "while true; do echo spam; sleep 0.01; done" }, output, options);
+
+        CHECK(exitCode == SIGTERM);
+        CHECK(usage.timedOut);
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+    }
+
+    SECTION("a child process that exits in time is not terminated")
+    {
+        const int exitCode = ADUC_LaunchChildProcess("sh", { "-c", "exit 3" }, output, options);
+
+        CHECK(exitCode == 3);
+        CHECK_FALSE(usage.timedOut);
+        CHECK(usage.maxResidentSetSizeInKilobytes > 0);
+    }
+}
+
+TEST_CASE("ADUC_ChildProcessOptions_FromConfig")
+{
+    ADUC_ConfigInfo config = {};
+    config.childProcessTimeoutInSeconds = 3600;
+    config.childProcessLogOutput = true;
+    ADUC_ChildProcessUsage usage;
+
+    SECTION("the timeout and output logging are set without a cgroup")
+    {
+        const ADUC_ChildProcessOptions options = ADUC_ChildProcessOptions_FromConfig(&config, &usage);
+
+        CHECK(options.timeoutInSeconds == 3600);
+        CHECK(options.logOutput);
+        CHECK(options.usage == &usage);
+        CHECK(options.cgroupParent == nullptr);
+    }
+
+    SECTION("no config leaves the defaults")
+    {
+        const ADUC_ChildProcessOptions options = ADUC_ChildProcessOptions_FromConfig(nullptr, &usage);
+
+        CHECK(options.timeoutInSeconds == 0);
+        CHECK_FALSE(options.logOutput);
+    }
+}
+
+static std::string ReadFile(const std::string& path)
+{
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+TEST_CASE("Transient cgroup")
+{
+    // A plain directory stands in for the delegated cgroup: the interface files are created as regular files.
+    aduc::AutoDir parentDir{ "/tmp/adu-process-utils-ut-cgroup" };
+    REQUIRE(parentDir.CreateDir());
+    const std::string parent = parentDir.GetDir();
+
+    ADUC_ChildProcessUsage usage;
+    ADUC_ChildProcessOptions options;
+    options.usage = &usage;
+    options.cgroupParent = parent.c_str();
+    options.cpuMax = "50000 100000";
+    options.memoryMax = "256M";
+
+    std::string output;
+    const int exitCode = ADUC_LaunchChildProcess("sh", { "-c", "echo in cgroup" }, output, options);
+
+    CHECK(exitCode == EXIT_SUCCESS);
+    CHECK(output == "in cgroup\n");
+    CHECK(usage.inCgroup);
+    CHECK(usage.maxResidentSetSizeInKilobytes > 0);
+
+    // The cgroup is left in place, because the plain directory is not empty.
+    std::string cgroup;
+    DIR* dir = opendir(parent.c_str());
+    REQUIRE(dir != nullptr);
+    for (const struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        if (std::string(entry->d_name).compare(0, 10, "adu-child-") == 0)
+        {
+            cgroup = parent + "/" + entry->d_name;
+        }
+    }
+    closedir(dir);
+
+    REQUIRE_FALSE(cgroup.empty());
+    CHECK(ReadFile(cgroup + "/cpu.max") == "50000 100000");
+    CHECK(ReadFile(cgroup + "/memory.max") == "256M");
+    CHECK(atoi(ReadFile(cgroup + "/cgroup.procs").c_str()) > 0);
+}
+
+TEST_CASE("A missing cgroup parent does not prevent the launch")
+{
+    ADUC_ChildProcessUsage usage;
+    ADUC_ChildProcessOptions options;
+    options.usage = &usage;
+    options.cgroupParent = "/nonexistent/cgroup";
+
+    std::string output;
+    CHECK(ADUC_LaunchChildProcess("sh", { "-c", "exit 4" }, output, options) == 4);
+    CHECK_FALSE(usage.inCgroup);
+}
+#endif
+
+TEST_CASE("ADUC_ChildProcessUsage_Add and ADUC_ChildProcessUsage_ToJsonValue")
+{
+    ADUC_ChildProcessUsage total;
+    ADUC_ChildProcessUsage usage;
+    usage.userTimeInMilliseconds = 10;
+    usage.maxResidentSetSizeInKilobytes = 2048;
+    usage.ioWriteBytes = 4096;
+
+    ADUC_ChildProcessUsage_Add(total, usage);
+    usage.maxResidentSetSizeInKilobytes = 1024;
+    usage.inCgroup = true;
+    usage.cgroupMemoryPeakInBytes = 1 << 20;
+    ADUC_ChildProcessUsage_Add(total, usage);
+
+    CHECK(total.userTimeInMilliseconds == 20);
+    CHECK(total.maxResidentSetSizeInKilobytes == 2048);
+    CHECK(total.ioWriteBytes == 8192);
+    CHECK(total.inCgroup);
+    CHECK(total.cgroupMemoryPeakInBytes == 1 << 20);
+
+    JSON_Value* value = ADUC_ChildProcessUsage_ToJsonValue(total);
+    REQUIRE(value != nullptr);
+    const JSON_Object* object = json_value_get_object(value);
+    CHECK(json_object_get_number(object, "userTimeMs") == 20);
+    CHECK(json_object_get_number(object, "maxRssKB") == 2048);
+    CHECK(json_object_get_number(object, "ioWriteBytes") == 8192);
+    CHECK(json_object_get_boolean(object, "timedOut") == 0);
+    CHECK(json_object_get_number(object, "cgroupMemoryPeakBytes") == 1 << 20);
+    json_value_free(value);
+
+    value = ADUC_ChildProcessUsage_ToJsonValue(ADUC_ChildProcessUsage{});
+    REQUIRE(value != nullptr);
+    CHECK_FALSE(json_object_has_value(json_value_get_object(value), "cgroupCpuTimeMs"));
+    json_value_free(value);
+}
+
 TEST_CASE("VerifyProcessEffectiveGroup")
 {
     SECTION("it should return false when gegrnam returns nullptr and sets errno")
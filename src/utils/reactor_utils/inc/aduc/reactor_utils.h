@@ -0,0 +1,107 @@
+/**
+ * @file reactor_utils.h
+ * @brief Event-driven wait primitive for the Device Update Agent main loop.
+ *
+ * The agent main thread blocks in ADUC_Reactor_Wait() until one of the following occurs:
+ *   - Another thread (or a signal handler) calls ADUC_Reactor_Wakeup().
+ *   - A registered file descriptor becomes readable.
+ *   - The earliest deadline requested through ADUC_Reactor_RequestWakeupInMs() is reached.
+ *   - The caller-supplied maximum wait time elapses.
+ *
+ * Deadlines are one-shot. Components are expected to re-arm them from their DoWork functions.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_REACTOR_UTILS_H
+#define ADUC_REACTOR_UTILS_H
+
+#include "aduc/c_utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief The interval at which the IoT Hub low-level client must be serviced while it has in-flight work.
+ */
+#define ADUC_REACTOR_TRANSPORT_BUSY_INTERVAL_MS 100
+
+/**
+ * @brief The default upper bound of time the main loop may stay idle.
+ */
+#define ADUC_REACTOR_DEFAULT_MAX_IDLE_INTERVAL_MS 1000
+
+/**
+ * @brief A callback that is invoked on the reactor thread when a registered file descriptor is readable.
+ *
+ * @param fd The file descriptor that is ready.
+ * @param context The context supplied to ADUC_Reactor_AddFd().
+ */
+typedef void (*ADUC_REACTOR_FD_CALLBACK)(int fd, void* context);
+
+/**
+ * @brief Initializes the reactor.
+ *
+ * @return true on success.
+ */
+bool ADUC_Reactor_Init();
+
+/**
+ * @brief Uninitializes the reactor and releases all registrations.
+ *
+ * @remark Waits for the concurrent ADUC_Reactor_Wakeup() calls to return before closing the eventfd.
+ */
+void ADUC_Reactor_Uninit();
+
+/**
+ * @brief Wakes the thread blocked in ADUC_Reactor_Wait().
+ *
+ * @remark Safe to call from any thread, and from a signal handler on Linux.
+ *         No-op if the reactor is not initialized.
+ */
+void ADUC_Reactor_Wakeup();
+
+/**
+ * @brief Requests that ADUC_Reactor_Wait() returns no later than @p delayMs from now.
+ *
+ * @param delayMs The delay, in milliseconds. Zero behaves like ADUC_Reactor_Wakeup().
+ */
+void ADUC_Reactor_RequestWakeupInMs(unsigned int delayMs);
+
+/**
+ * @brief Registers a file descriptor to be watched for readability.
+ *
+ * @param fd The file descriptor.
+ * @param callback The callback to invoke when @p fd is readable.
+ * @param context The callback context.
+ * @return true on success.
+ */
+bool ADUC_Reactor_AddFd(int fd, ADUC_REACTOR_FD_CALLBACK callback, void* context);
+
+/**
+ * @brief Unregisters a file descriptor previously registered with ADUC_Reactor_AddFd().
+ *
+ * @param fd The file descriptor.
+ */
+void ADUC_Reactor_RemoveFd(int fd);
+
+/**
+ * @brief Blocks until there is work to do, or @p maxWaitMs elapses.
+ *
+ * @param maxWaitMs The upper bound of the wait, in milliseconds.
+ * @return unsigned int The number of events (wakeups, ready file descriptors) that were handled.
+ *         Zero means that a deadline or @p maxWaitMs elapsed.
+ */
+unsigned int ADUC_Reactor_Wait(unsigned int maxWaitMs);
+
+/**
+ * @brief Gets the current monotonic time, in milliseconds.
+ *
+ * @return uint64_t The current monotonic time.
+ */
+uint64_t ADUC_Reactor_GetMonotonicTimeMs();
+
+EXTERN_C_END
+
+#endif // ADUC_REACTOR_UTILS_H
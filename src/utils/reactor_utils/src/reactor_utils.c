@@ -0,0 +1,416 @@
+/**
+ * @file reactor_utils.c
+ * @brief Implements the event-driven wait primitive for the Device Update Agent main loop.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/reactor_utils.h"
+#include "aduc/logging.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h> // sched_yield
+#include <stddef.h> // NULL
+
+#include <aducpal/time.h> // ADUCPAL_clock_gettime, ADUCPAL_nanosleep
+
+#ifdef __linux__
+#    include <sys/epoll.h>
+#    include <sys/eventfd.h>
+#    include <unistd.h> // read, write, close
+#    define ADUC_REACTOR_USE_EPOLL 1
+#endif
+
+#ifndef CLOCK_MONOTONIC
+#    define CLOCK_MONOTONIC CLOCK_REALTIME
+#endif
+
+#define REACTOR_MAX_REGISTRATIONS 8
+#define REACTOR_NO_DEADLINE UINT64_MAX
+
+/**
+ * @brief A file descriptor registration.
+ */
+typedef struct _tagADUC_Reactor_Registration
+{
+    int fd; /**< The watched file descriptor, or -1 if the slot is free. */
+    ADUC_REACTOR_FD_CALLBACK callback; /**< The readability callback. */
+    void* context; /**< The callback context. */
+} ADUC_Reactor_Registration;
+
+static pthread_mutex_t s_reactorMutex = PTHREAD_MUTEX_INITIALIZER;
+static bool s_reactorInitialized = false;
+static uint64_t s_nextDeadlineMs = REACTOR_NO_DEADLINE; // Guarded by s_reactorMutex.
+static ADUC_Reactor_Registration s_registrations[REACTOR_MAX_REGISTRATIONS];
+
+#ifdef ADUC_REACTOR_USE_EPOLL
+static int s_epollFd = -1;
+static int s_eventFd = -1; // Atomic: read by ADUC_Reactor_Wakeup() without the lock.
+static unsigned int s_wakeupsInProgress = 0; // Atomic: the ADUC_Reactor_Wakeup() calls that may write s_eventFd.
+#endif
+
+uint64_t ADUC_Reactor_GetMonotonicTimeMs()
+{
+    struct timespec now;
+    ADUCPAL_clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000) + ((uint64_t)now.tv_nsec / 1000000);
+}
+
+/**
+ * @brief Sleeps for @p ms milliseconds.
+ *
+ * @param ms The sleep duration.
+ */
+static void SleepMs(int ms)
+{
+    struct timespec duration;
+    duration.tv_sec = ms / 1000;
+    duration.tv_nsec = (long)(ms % 1000) * 1000000;
+    ADUCPAL_nanosleep(&duration, NULL);
+}
+
+bool ADUC_Reactor_Init()
+{
+    bool success = false;
+
+    pthread_mutex_lock(&s_reactorMutex);
+
+    if (s_reactorInitialized)
+    {
+        success = true;
+        goto done;
+    }
+
+    for (int i = 0; i < REACTOR_MAX_REGISTRATIONS; i++)
+    {
+        s_registrations[i].fd = -1;
+        s_registrations[i].callback = NULL;
+        s_registrations[i].context = NULL;
+    }
+
+    s_nextDeadlineMs = REACTOR_NO_DEADLINE;
+
+#ifdef ADUC_REACTOR_USE_EPOLL
+    s_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (s_epollFd < 0)
+    {
+        Log_Error("epoll_create1 failed (errno:%d)", errno);
+        goto done;
+    }
+
+    int eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0)
+    {
+        Log_Error("eventfd failed (errno:%d)", errno);
+        goto done;
+    }
+
+    struct epoll_event ev = { 0 };
+    ev.events = EPOLLIN;
+    ev.data.fd = eventFd;
+    if (epoll_ctl(s_epollFd, EPOLL_CTL_ADD, eventFd, &ev) != 0)
+    {
+        Log_Error("epoll_ctl(ADD eventfd) failed (errno:%d)", errno);
+        close(eventFd);
+        goto done;
+    }
+
+    // Published last, so that ADUC_Reactor_Wakeup() never writes to an eventfd that is not watched.
+    __atomic_store_n(&s_eventFd, eventFd, __ATOMIC_RELEASE);
+#else
+    Log_Info("epoll is not available. The main loop will fall back to periodic polling.");
+#endif
+
+    s_reactorInitialized = true;
+    success = true;
+
+done:
+#ifdef ADUC_REACTOR_USE_EPOLL
+    if (!success)
+    {
+        if (s_epollFd >= 0)
+        {
+            close(s_epollFd);
+            s_epollFd = -1;
+        }
+    }
+#endif
+
+    pthread_mutex_unlock(&s_reactorMutex);
+    return success;
+}
+
+void ADUC_Reactor_Uninit()
+{
+    pthread_mutex_lock(&s_reactorMutex);
+
+    if (s_reactorInitialized)
+    {
+#ifdef ADUC_REACTOR_USE_EPOLL
+        // Unpublish the eventfd, then wait for the wakeups that may still write to it: once closed, its number can
+        // be reused by an unrelated file.
+        int eventFd = __atomic_exchange_n(&s_eventFd, -1, __ATOMIC_ACQ_REL);
+        while (__atomic_load_n(&s_wakeupsInProgress, __ATOMIC_ACQUIRE) != 0)
+        {
+            sched_yield();
+        }
+
+        close(eventFd);
+        close(s_epollFd);
+        s_epollFd = -1;
+#endif
+        for (int i = 0; i < REACTOR_MAX_REGISTRATIONS; i++)
+        {
+            s_registrations[i].fd = -1;
+        }
+
+        s_reactorInitialized = false;
+    }
+
+    pthread_mutex_unlock(&s_reactorMutex);
+}
+
+void ADUC_Reactor_Wakeup()
+{
+    // Note: must stay async-signal-safe, hence no locking and no logging here.
+#ifdef ADUC_REACTOR_USE_EPOLL
+    // Counted before s_eventFd is read, so that ADUC_Reactor_Uninit() does not close it while it is written to.
+    __atomic_add_fetch(&s_wakeupsInProgress, 1, __ATOMIC_ACQ_REL);
+    int fd = __atomic_load_n(&s_eventFd, __ATOMIC_ACQUIRE);
+    if (fd >= 0)
+    {
+        uint64_t one = 1;
+        // EAGAIN means the counter is saturated, which already guarantees a wakeup.
+        (void)!write(fd, &one, sizeof(one));
+    }
+    __atomic_sub_fetch(&s_wakeupsInProgress, 1, __ATOMIC_ACQ_REL);
+#endif
+}
+
+void ADUC_Reactor_RequestWakeupInMs(unsigned int delayMs)
+{
+    if (delayMs == 0)
+    {
+        ADUC_Reactor_Wakeup();
+        return;
+    }
+
+    uint64_t deadline = ADUC_Reactor_GetMonotonicTimeMs() + delayMs;
+
+    pthread_mutex_lock(&s_reactorMutex);
+    if (deadline < s_nextDeadlineMs)
+    {
+        s_nextDeadlineMs = deadline;
+    }
+    pthread_mutex_unlock(&s_reactorMutex);
+
+    // The reactor thread may already be blocked with a later deadline. This is only
+    // needed when the request comes from another thread, but it's cheap either way.
+    ADUC_Reactor_Wakeup();
+}
+
+bool ADUC_Reactor_AddFd(int fd, ADUC_REACTOR_FD_CALLBACK callback, void* context)
+{
+    bool success = false;
+
+    if (fd < 0 || callback == NULL)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&s_reactorMutex);
+
+    if (!s_reactorInitialized)
+    {
+        Log_Error("Reactor is not initialized.");
+        goto done;
+    }
+
+#ifdef ADUC_REACTOR_USE_EPOLL
+    int slot = -1;
+    for (int i = 0; i < REACTOR_MAX_REGISTRATIONS; i++)
+    {
+        if (s_registrations[i].fd == fd)
+        {
+            Log_Error("fd %d is already registered.", fd);
+            goto done;
+        }
+
+        if (slot == -1 && s_registrations[i].fd == -1)
+        {
+            slot = i;
+        }
+    }
+
+    if (slot == -1)
+    {
+        Log_Error("No reactor registration slot available for fd %d.", fd);
+        goto done;
+    }
+
+    struct epoll_event ev = { 0 };
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(s_epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        Log_Error("epoll_ctl(ADD %d) failed (errno:%d)", fd, errno);
+        goto done;
+    }
+
+    s_registrations[slot].fd = fd;
+    s_registrations[slot].callback = callback;
+    s_registrations[slot].context = context;
+    success = true;
+#else
+    Log_Warn("fd registration is not supported on this platform.");
+#endif
+
+done:
+    pthread_mutex_unlock(&s_reactorMutex);
+
+    if (success)
+    {
+        // Let the reactor thread pick up the new registration right away.
+        ADUC_Reactor_Wakeup();
+    }
+
+    return success;
+}
+
+void ADUC_Reactor_RemoveFd(int fd)
+{
+    pthread_mutex_lock(&s_reactorMutex);
+
+    for (int i = 0; i < REACTOR_MAX_REGISTRATIONS; i++)
+    {
+        if (s_registrations[i].fd == fd)
+        {
+#ifdef ADUC_REACTOR_USE_EPOLL
+            if (s_epollFd >= 0)
+            {
+                epoll_ctl(s_epollFd, EPOLL_CTL_DEL, fd, NULL);
+            }
+#endif
+            s_registrations[i].fd = -1;
+            s_registrations[i].callback = NULL;
+            s_registrations[i].context = NULL;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&s_reactorMutex);
+}
+
+/**
+ * @brief Computes the wait timeout from the earliest deadline and @p maxWaitMs.
+ *
+ * @param maxWaitMs The upper bound of the wait.
+ * @return int The timeout in milliseconds.
+ */
+static int GetWaitTimeoutMs(unsigned int maxWaitMs)
+{
+    uint64_t now = ADUC_Reactor_GetMonotonicTimeMs();
+    uint64_t timeout = maxWaitMs;
+
+    pthread_mutex_lock(&s_reactorMutex);
+    if (s_nextDeadlineMs != REACTOR_NO_DEADLINE)
+    {
+        timeout = (s_nextDeadlineMs <= now) ? 0 : (s_nextDeadlineMs - now);
+        if (timeout > maxWaitMs)
+        {
+            timeout = maxWaitMs;
+        }
+    }
+    pthread_mutex_unlock(&s_reactorMutex);
+
+    return (int)timeout;
+}
+
+/**
+ * @brief Clears the deadline if it has been reached.
+ */
+static void ExpireDeadline()
+{
+    uint64_t now = ADUC_Reactor_GetMonotonicTimeMs();
+
+    pthread_mutex_lock(&s_reactorMutex);
+    if (s_nextDeadlineMs <= now)
+    {
+        s_nextDeadlineMs = REACTOR_NO_DEADLINE;
+    }
+    pthread_mutex_unlock(&s_reactorMutex);
+}
+
+unsigned int ADUC_Reactor_Wait(unsigned int maxWaitMs)
+{
+    unsigned int handled = 0;
+    int timeoutMs = GetWaitTimeoutMs(maxWaitMs);
+
+#ifdef ADUC_REACTOR_USE_EPOLL
+    if (s_epollFd < 0)
+    {
+        SleepMs(timeoutMs);
+        goto done;
+    }
+
+    const int eventFd = __atomic_load_n(&s_eventFd, __ATOMIC_ACQUIRE);
+    struct epoll_event events[REACTOR_MAX_REGISTRATIONS + 1];
+    int count = epoll_wait(s_epollFd, events, REACTOR_MAX_REGISTRATIONS + 1, timeoutMs);
+    if (count < 0)
+    {
+        // EINTR is expected when a signal (e.g. SIGTERM) is delivered.
+        if (errno != EINTR)
+        {
+            Log_Error("epoll_wait failed (errno:%d)", errno);
+        }
+        goto done;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        int fd = events[i].data.fd;
+        if (fd == eventFd)
+        {
+            uint64_t value = 0;
+            (void)!read(eventFd, &value, sizeof(value));
+            handled++;
+            continue;
+        }
+
+        ADUC_REACTOR_FD_CALLBACK callback = NULL;
+        void* context = NULL;
+
+        pthread_mutex_lock(&s_reactorMutex);
+        for (int j = 0; j < REACTOR_MAX_REGISTRATIONS; j++)
+        {
+            if (s_registrations[j].fd == fd)
+            {
+                callback = s_registrations[j].callback;
+                context = s_registrations[j].context;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&s_reactorMutex);
+
+        // Invoke outside of the lock so that the callback may (un)register file descriptors.
+        if (callback != NULL)
+        {
+            callback(fd, context);
+            handled++;
+        }
+    }
+#else
+    // Without epoll, keep the original polling cadence.
+    if (timeoutMs > ADUC_REACTOR_TRANSPORT_BUSY_INTERVAL_MS)
+    {
+        timeoutMs = ADUC_REACTOR_TRANSPORT_BUSY_INTERVAL_MS;
+    }
+    SleepMs(timeoutMs);
+    goto done;
+#endif
+
+done:
+    ExpireDeadline();
+    return handled;
+}
@@ -0,0 +1,129 @@
+/**
+ * @file reactor_utils_ut.cpp
+ * @brief Unit Tests for reactor_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/reactor_utils.h"
+
+#include <algorithm> // std::sort
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <unistd.h> // pipe, write, close
+
+static std::vector<int> g_dispatchedFds;
+
+static void TestFdCallback(int fd, void* context)
+{
+    char buffer[16];
+    (void)!read(fd, buffer, sizeof(buffer));
+    g_dispatchedFds.push_back(fd);
+    ++*static_cast<int*>(context);
+}
+
+TEST_CASE("ADUC_Reactor_Wait")
+{
+    REQUIRE(ADUC_Reactor_Init());
+
+    SECTION("Handles no event when idle")
+    {
+        CHECK(ADUC_Reactor_Wait(0) == 0);
+    }
+
+    SECTION("Wakeups are coalesced into one event")
+    {
+        ADUC_Reactor_Wakeup();
+        ADUC_Reactor_Wakeup();
+        CHECK(ADUC_Reactor_Wait(0) == 1);
+        CHECK(ADUC_Reactor_Wait(0) == 0);
+    }
+
+    SECTION("Returns on a requested deadline")
+    {
+        ADUC_Reactor_RequestWakeupInMs(20);
+        CHECK(ADUC_Reactor_Wait(0) == 1); // The wakeup posted by RequestWakeupInMs.
+
+        // Times out on the deadline, rather than after maxWaitMs, and the deadline is then cleared.
+        CHECK(ADUC_Reactor_Wait(60000) == 0);
+        CHECK(ADUC_Reactor_Wait(0) == 0);
+    }
+
+    SECTION("Wakeup from another thread")
+    {
+        std::thread waker{ []() { ADUC_Reactor_Wakeup(); } };
+        CHECK(ADUC_Reactor_Wait(60000) == 1);
+        waker.join();
+    }
+
+    SECTION("Registered fds that became readable are dispatched once each")
+    {
+        int first[2];
+        int second[2];
+        REQUIRE(pipe(first) == 0);
+        REQUIRE(pipe(second) == 0);
+
+        int calls = 0;
+        g_dispatchedFds.clear();
+        REQUIRE(ADUC_Reactor_AddFd(first[0], TestFdCallback, &calls));
+        REQUIRE(ADUC_Reactor_AddFd(second[0], TestFdCallback, &calls));
+        CHECK_FALSE(ADUC_Reactor_AddFd(first[0], TestFdCallback, &calls));
+        CHECK(ADUC_Reactor_Wait(0) == 1); // The registration wakeups.
+
+        REQUIRE(write(second[1], "x", 1) == 1);
+        REQUIRE(write(first[1], "x", 1) == 1);
+        CHECK(ADUC_Reactor_Wait(60000) == 2);
+        CHECK(calls == 2);
+        // epoll does not report ready fds in any particular order.
+        std::vector<int> expectedFds{ first[0], second[0] };
+        std::sort(expectedFds.begin(), expectedFds.end());
+        std::sort(g_dispatchedFds.begin(), g_dispatchedFds.end());
+        CHECK(g_dispatchedFds == expectedFds);
+
+        // A removed fd is no longer dispatched.
+        ADUC_Reactor_RemoveFd(second[0]);
+        REQUIRE(write(second[1], "x", 1) == 1);
+        CHECK(ADUC_Reactor_Wait(0) == 0);
+        CHECK(calls == 2);
+
+        ADUC_Reactor_RemoveFd(first[0]);
+        close(first[0]);
+        close(first[1]);
+        close(second[0]);
+        close(second[1]);
+    }
+
+    ADUC_Reactor_Uninit();
+}
+
+TEST_CASE("ADUC_Reactor_Wakeup does not write to the eventfd once ADUC_Reactor_Uninit closed it")
+{
+    std::atomic<bool> stop{ false };
+    std::thread waker{ [&stop]() {
+        while (!stop.load())
+        {
+            ADUC_Reactor_Wakeup();
+        }
+    } };
+
+    for (int i = 0; i < 200; ++i)
+    {
+        REQUIRE(ADUC_Reactor_Init());
+        ADUC_Reactor_Uninit();
+
+        // Likely reuses the number of the closed eventfd.
+        int fds[2];
+        REQUIRE(pipe(fds) == 0);
+
+        pollfd readable = { fds[0], POLLIN, 0 };
+        CHECK(poll(&readable, 1, 0) == 0);
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    stop.store(true);
+    waker.join();
+}
@@ -4,14 +4,41 @@
 #include <aduc/c_utils.h>
 #include <azure_c_shared_utility/strings.h>
 #include <azure_c_shared_utility/vector.h>
+#include <parson.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+/**
+ * @brief The default byte budget for the serialized 'agent' reported property.
+ * IoT Hub rejects reported-property patches that push the twin past its size limit (32 KB), and the rejected
+ * patch is retried as is, so the agent keeps well below that.
+ */
+#define ADUC_REPORTING_DEFAULT_MAX_SIZE_IN_BYTES (16 * 1024)
+
+/**
+ * @brief The length to which a failing step's 'resultDetails' is truncated, when the report is over budget.
+ */
+#define ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH 128
+
 EXTERN_C_BEGIN
 
 STRING_HANDLE ADUC_ReportingUtils_CreateReportingErcHexStr(const int32_t erc, bool is_first);
 STRING_HANDLE ADUC_ReportingUtils_StringHandleFromVectorInt32(VECTOR_HANDLE vec, size_t max);
 
+/**
+ * @brief Trims the 'lastInstallResult.stepResults' of a reporting value until it serializes to @p maxSizeInBytes
+ * or less. The steps' 'resourceUsage' goes first, then details of succeeded steps, then failing steps' details are
+ * truncated, then succeeded steps are removed, and only then failing steps' details and, from the last step, the
+ * failing steps themselves.
+ *
+ * @param reportingValue The 'agent' reported property value, as built by GetReportingJsonValue.
+ * @param maxSizeInBytes The byte budget for the serialized value.
+ * @return true if the value now fits the budget; false if it is still over budget, e.g. because the fields other
+ * than 'stepResults' alone exceed it.
+ */
+bool ADUC_ReportingUtils_FitStepResultsToBudget(JSON_Value* reportingValue, size_t maxSizeInBytes);
+
 EXTERN_C_END
 
 #endif // ADUC_REPORTING_UTILS_H
@@ -1,6 +1,23 @@
 #include "aduc/reporting_utils.h"
+#include "aduc/result.h" // IsAducResultCodeSuccess
+#include "aduc/types/update_content.h" // ADUCITF_FIELDNAME_*
 #include <stddef.h> // size_t
-#include <stdint.h> // int32_t
+#include <stdint.h> // int32_t, SIZE_MAX
+#include <string.h> // memcpy, strlen
+
+/**
+ * @brief The ways a step result is trimmed, in the order they are applied to all steps.
+ */
+typedef enum tagADUC_StepResultTrim
+{
+    ADUC_StepResultTrim_ResourceUsage, /**< Remove the 'resourceUsage' of a step. */
+    ADUC_StepResultTrim_SucceededDetails, /**< Clear the 'resultDetails' of a succeeded step. */
+    ADUC_StepResultTrim_FailedDetailsTruncate, /**< Truncate the 'resultDetails' of a failing step. */
+    ADUC_StepResultTrim_SucceededStep, /**< Remove a succeeded step. */
+    ADUC_StepResultTrim_FailedDetails, /**< Clear the 'resultDetails' of a failing step. */
+    ADUC_StepResultTrim_FailedStep, /**< Remove a failing step. */
+    ADUC_StepResultTrim_Count
+} ADUC_StepResultTrim;
 
 STRING_HANDLE ADUC_ReportingUtils_CreateReportingErcHexStr(const int32_t erc, bool is_first)
 {
@@ -55,3 +72,175 @@ done:
 
     return delimited;
 }
+
+/**
+ * @brief Gets the length of @p value once serialized, or SIZE_MAX if it cannot be serialized.
+ */
+static size_t GetSerializedLength(const JSON_Value* value)
+{
+    const size_t size = json_serialization_size(value);
+    return size == 0 ? SIZE_MAX : size - 1; // size includes the null terminator.
+}
+
+/**
+ * @brief Truncates the 'resultDetails' of a step result to ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH bytes,
+ * without splitting a UTF-8 sequence, and marks it with a trailing ellipsis.
+ *
+ * @return true if the details were truncated.
+ */
+static bool TruncateResultDetails(JSON_Object* stepObject)
+{
+    char truncated[ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH + sizeof("...")];
+
+    const char* details = json_object_get_string(stepObject, ADUCITF_FIELDNAME_RESULTDETAILS);
+    if (details == NULL || strlen(details) <= ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH)
+    {
+        return false;
+    }
+
+    size_t length = ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH;
+    while (length > 0 && (details[length] & 0xC0) == 0x80)
+    {
+        --length;
+    }
+
+    memcpy(truncated, details, length);
+    memcpy(truncated + length, "...", sizeof("..."));
+
+    return json_object_set_string(stepObject, ADUCITF_FIELDNAME_RESULTDETAILS, truncated) == JSONSuccess;
+}
+
+/**
+ * @brief Applies one kind of trimming to the step result at @p index, if it applies to that step.
+ *
+ * @param removedLength Set to the number of bytes the trimming removed from the serialized step results; 0 if that
+ * cannot be told.
+ * @return true if the step result was trimmed.
+ */
+static bool TrimStepResult(
+    JSON_Object* stepResultsObject, size_t index, ADUC_StepResultTrim trim, size_t* removedLength)
+{
+    *removedLength = 0;
+
+    JSON_Value* stepValue = json_object_get_value_at(stepResultsObject, index);
+    JSON_Object* stepObject = json_value_get_object(stepValue);
+    if (stepObject == NULL)
+    {
+        return false;
+    }
+
+    const bool succeeded =
+        IsAducResultCodeSuccess((ADUC_Result_t)json_object_get_number(stepObject, ADUCITF_FIELDNAME_RESULTCODE));
+    // Clearing details no longer than 'null' would not make the step any smaller.
+    const char* details = json_object_get_string(stepObject, ADUCITF_FIELDNAME_RESULTDETAILS);
+    const bool hasDetails = details != NULL && strlen(details) > sizeof("null") - 1;
+
+    bool removesStep = false;
+    bool trimmed = false;
+    const size_t stepLength = GetSerializedLength(stepValue);
+
+    switch (trim)
+    {
+    case ADUC_StepResultTrim_ResourceUsage:
+        trimmed = json_object_has_value(stepObject, ADUCITF_FIELDNAME_RESOURCEUSAGE)
+            && json_object_remove(stepObject, ADUCITF_FIELDNAME_RESOURCEUSAGE) == JSONSuccess;
+        break;
+
+    case ADUC_StepResultTrim_SucceededDetails:
+        trimmed = succeeded && hasDetails
+            && json_object_set_null(stepObject, ADUCITF_FIELDNAME_RESULTDETAILS) == JSONSuccess;
+        break;
+
+    case ADUC_StepResultTrim_FailedDetailsTruncate:
+        trimmed = !succeeded && TruncateResultDetails(stepObject);
+        break;
+
+    case ADUC_StepResultTrim_SucceededStep:
+        removesStep = succeeded;
+        break;
+
+    case ADUC_StepResultTrim_FailedDetails:
+        trimmed = !succeeded && hasDetails
+            && json_object_set_null(stepObject, ADUCITF_FIELDNAME_RESULTDETAILS) == JSONSuccess;
+        break;
+
+    case ADUC_StepResultTrim_FailedStep:
+        removesStep = !succeeded;
+        break;
+
+    default:
+        break;
+    }
+
+    if (removesStep)
+    {
+        const char* name = json_object_get_name(stepResultsObject, index);
+        // The step is serialized as "name":step, and separated from the others by a comma. Step names need no
+        // escaping.
+        const size_t memberLength = strlen(name) + sizeof("\"\":") - 1 + stepLength
+            + (json_object_get_count(stepResultsObject) > 1 ? 1 : 0);
+
+        trimmed = json_object_remove(stepResultsObject, name) == JSONSuccess;
+        if (trimmed && stepLength != SIZE_MAX)
+        {
+            *removedLength = memberLength;
+        }
+
+        return trimmed;
+    }
+
+    if (trimmed && stepLength != SIZE_MAX)
+    {
+        const size_t trimmedLength = GetSerializedLength(stepValue);
+        if (trimmedLength < stepLength)
+        {
+            *removedLength = stepLength - trimmedLength;
+        }
+    }
+
+    return trimmed;
+}
+
+bool ADUC_ReportingUtils_FitStepResultsToBudget(JSON_Value* reportingValue, size_t maxSizeInBytes)
+{
+    size_t length = GetSerializedLength(reportingValue);
+    if (length <= maxSizeInBytes)
+    {
+        return true;
+    }
+
+    JSON_Object* stepResultsObject = json_object_dotget_object(
+        json_value_get_object(reportingValue), ADUCITF_FIELDNAME_LASTINSTALLRESULT "." ADUCITF_FIELDNAME_STEPRESULTS);
+    if (stepResultsObject == NULL)
+    {
+        return false;
+    }
+
+    for (int trim = 0; trim < ADUC_StepResultTrim_Count; ++trim)
+    {
+        // Walk backwards, so that removing a step does not move the ones still to visit, and the first steps,
+        // which usually explain why the later ones failed or never ran, are kept longest.
+        for (size_t i = json_object_get_count(stepResultsObject); i > 0; --i)
+        {
+            size_t removedLength = 0;
+            if (!TrimStepResult(stepResultsObject, i - 1, (ADUC_StepResultTrim)trim, &removedLength))
+            {
+                continue;
+            }
+
+            // The length is tracked from the trimmed step alone, so each step is serialized a bounded number of
+            // times; the whole value is serialized again only to confirm that it fits.
+            length = removedLength < length ? length - removedLength : 0;
+            if (length <= maxSizeInBytes)
+            {
+                length = GetSerializedLength(reportingValue);
+                if (length <= maxSizeInBytes)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return GetSerializedLength(reportingValue) <= maxSizeInBytes;
+}
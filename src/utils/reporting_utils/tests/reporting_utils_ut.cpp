@@ -9,7 +9,11 @@
 using Catch::Matchers::Equals;
 #include <aduc/reporting_utils.h>
 #include <aduc/string_handle_wrapper.hpp>
+#include <parson.h>
 #include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 TEST_CASE("ADUC_ReportingUtils_StringHandleFromVectorInt32")
 {
@@ -92,3 +96,145 @@ TEST_CASE("ADUC_ReportingUtils_StringHandleFromVectorInt32")
         CHECK_THAT(STRING_c_str(wrapped.get()), Equals(",00000001,00000002"));
     }
 }
+
+/**
+ * @brief Builds an 'agent' reporting value with one step result per (resultCode, resultDetails) pair.
+ */
+static JSON_Value* CreateReportingValue(const std::vector<std::pair<int, std::string>>& steps)
+{
+    JSON_Value* value = json_parse_string(
+        R"({"state":255,"lastInstallResult":{"resultCode":0,"extendedResultCodes":"00000000",)"
+        R"("resultDetails":"failed","stepResults":{}}})");
+    JSON_Object* stepResults =
+        json_object_dotget_object(json_value_get_object(value), "lastInstallResult.stepResults");
+
+    for (size_t i = 0; i < steps.size(); ++i)
+    {
+        JSON_Value* stepValue = json_value_init_object();
+        JSON_Object* stepObject = json_value_get_object(stepValue);
+        json_object_set_number(stepObject, "resultCode", steps[i].first);
+        json_object_set_string(stepObject, "extendedResultCodes", "00000000");
+        json_object_set_string(stepObject, "resultDetails", steps[i].second.c_str());
+        json_object_set_value(stepResults, ("step_" + std::to_string(i)).c_str(), stepValue);
+    }
+
+    return value;
+}
+
+static std::string Serialize(const JSON_Value* value)
+{
+    char* serialized = json_serialize_to_string(value);
+    std::string result{ serialized };
+    json_free_serialized_string(serialized);
+    return result;
+}
+
+TEST_CASE("ADUC_ReportingUtils_FitStepResultsToBudget")
+{
+    const std::string longDetails(1000, 'x');
+
+    SECTION("within budget is left alone")
+    {
+        JSON_Value* value = CreateReportingValue({ { 700, longDetails }, { 0, longDetails } });
+        const std::string before = Serialize(value);
+
+        CHECK(ADUC_ReportingUtils_FitStepResultsToBudget(value, before.size()));
+        CHECK(Serialize(value) == before);
+        json_value_free(value);
+    }
+
+    SECTION("succeeded step details are cleared before failing step details are truncated")
+    {
+        JSON_Value* value = CreateReportingValue({ { 700, longDetails }, { 0, longDetails } });
+        const size_t budget = Serialize(value).size() - 500;
+
+        CHECK(ADUC_ReportingUtils_FitStepResultsToBudget(value, budget));
+        CHECK(Serialize(value).size() <= budget);
+
+        const JSON_Object* root = json_value_get_object(value);
+        CHECK(json_object_dotget_string(root, "lastInstallResult.stepResults.step_0.resultDetails") == nullptr);
+        CHECK(
+            json_object_dotget_string(root, "lastInstallResult.stepResults.step_1.resultDetails") == longDetails);
+        json_value_free(value);
+    }
+
+    SECTION("failing step details are truncated, and succeeded steps removed, before failing steps are dropped")
+    {
+        JSON_Value* value =
+            CreateReportingValue({ { 700, longDetails }, { 0, longDetails }, { 700, "ok" }, { 0, longDetails } });
+        const size_t budget = 500;
+
+        CHECK(ADUC_ReportingUtils_FitStepResultsToBudget(value, budget));
+        CHECK(Serialize(value).size() <= budget);
+
+        const JSON_Object* stepResults =
+            json_object_dotget_object(json_value_get_object(value), "lastInstallResult.stepResults");
+        CHECK(json_object_get_value(stepResults, "step_0") == nullptr);
+        CHECK(json_object_get_value(stepResults, "step_2") == nullptr);
+
+        const char* details = json_object_dotget_string(stepResults, "step_1.resultDetails");
+        REQUIRE(details != nullptr);
+        CHECK(std::string{ details } == std::string(ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH, 'x') + "...");
+        CHECK(json_object_dotget_number(stepResults, "step_3.resultCode") == 0);
+        json_value_free(value);
+    }
+
+    SECTION("resource usage is removed before any details")
+    {
+        JSON_Value* value = CreateReportingValue({ { 700, "done" }, { 700, "done" } });
+        JSON_Object* stepResults =
+            json_object_dotget_object(json_value_get_object(value), "lastInstallResult.stepResults");
+        for (const char* step : { "step_0", "step_1" })
+        {
+            json_object_set_value(
+                json_object_get_object(stepResults, step),
+                "resourceUsage",
+                json_parse_string(R"({"install":{"userTimeMs":1,"systemTimeMs":2,"maxRssKB":3}})"));
+        }
+
+        const size_t budget = Serialize(value).size() - 10;
+
+        CHECK(ADUC_ReportingUtils_FitStepResultsToBudget(value, budget));
+        CHECK(json_object_dotget_value(stepResults, "step_0.resourceUsage") != nullptr);
+        CHECK(json_object_dotget_value(stepResults, "step_1.resourceUsage") == nullptr);
+        CHECK(json_object_dotget_string(stepResults, "step_1.resultDetails") != nullptr);
+        json_value_free(value);
+    }
+
+    SECTION("truncation does not split a UTF-8 sequence")
+    {
+        std::string details(ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH - 1, 'x');
+        details += "\xC3\xA9" + longDetails; // U+00E9 straddles the truncation point.
+        JSON_Value* value = CreateReportingValue({ { 0, details } });
+
+        CHECK(ADUC_ReportingUtils_FitStepResultsToBudget(value, 400));
+        const char* truncated = json_object_dotget_string(
+            json_value_get_object(value), "lastInstallResult.stepResults.step_0.resultDetails");
+        REQUIRE(truncated != nullptr);
+        CHECK(
+            std::string{ truncated }
+            == std::string(ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH - 1, 'x') + "...");
+        json_value_free(value);
+    }
+
+    SECTION("failing steps are dropped from the last one when nothing else is left")
+    {
+        JSON_Value* value = CreateReportingValue({ { 0, "a" }, { 0, "b" }, { 0, "c" } });
+        const std::string withoutSteps =
+            Serialize(value).substr(0, Serialize(value).find("\"step_1\"")); // Up to and including step_0.
+
+        CHECK(ADUC_ReportingUtils_FitStepResultsToBudget(value, withoutSteps.size() + 2));
+        const JSON_Object* stepResults =
+            json_object_dotget_object(json_value_get_object(value), "lastInstallResult.stepResults");
+        CHECK(json_object_get_count(stepResults) == 1);
+        CHECK(json_object_get_value(stepResults, "step_0") != nullptr);
+        json_value_free(value);
+    }
+
+    SECTION("over budget without step results")
+    {
+        JSON_Value* value = CreateReportingValue({});
+        CHECK_FALSE(ADUC_ReportingUtils_FitStepResultsToBudget(value, 10));
+        json_value_free(value);
+    }
+}
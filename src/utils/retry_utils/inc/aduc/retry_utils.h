@@ -12,6 +12,7 @@
 #include <aducpal/sys_time.h> // time_t
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 EXTERN_C_BEGIN
 
@@ -65,6 +66,88 @@ time_t ADUC_Retry_Delay_Calculator(
     unsigned long maxDelaySecs,
     double maxJitterPercent);
 
+/**
+ * @brief A retry policy for one endpoint: decorrelated-jitter backoff, server-hinted delays and a circuit breaker.
+ *
+ * Retry delays follow the decorrelated jitter algorithm:
+ *      delay = MIN(maxDelayMs, random_between(initialDelayMs, previousDelay * 3))
+ *
+ * so that a fleet of devices that failed at the same time does not retry at the same time. Each policy has its own
+ * random generator, seeded from the clocks and the process id.
+ *
+ * After failureThreshold consecutive failures, the circuit opens: no attempt is allowed for a jittered
+ * openDurationMs. Then one probe attempt is allowed per openDurationMs until a success closes the circuit.
+ *
+ * All times are in milliseconds of a monotonic clock, supplied by the caller.
+ */
+typedef struct _tagADUC_Retry_Policy
+{
+    unsigned long initialDelayMs; /**< The minimum, and first, retry delay. */
+    unsigned long maxDelayMs; /**< The maximum retry delay, unless the server asks for longer. */
+    unsigned int failureThreshold; /**< Consecutive failures that open the circuit. 0 disables the breaker. */
+    unsigned long openDurationMs; /**< How long the circuit stays open. */
+
+    pthread_mutex_t mutex; /**< Guards the fields below. */
+    unsigned long previousDelayMs; /**< The previous retry delay, or 0 after a success. */
+    unsigned int consecutiveFailures; /**< Failures since the last success. */
+    uint64_t circuitOpenUntilMs; /**< No attempt is allowed before this time, while the circuit is open. */
+    uint64_t randomState; /**< The state of the random generator. */
+} ADUC_Retry_Policy;
+
+/**
+ * @brief Initializes @p policy.
+ *
+ * @param policy The policy to initialize.
+ * @param initialDelayMs The minimum, and first, retry delay, in milliseconds.
+ * @param maxDelayMs The maximum retry delay, in milliseconds.
+ * @param failureThreshold Consecutive failures that open the circuit. 0 disables the circuit breaker.
+ * @param openDurationMs How long the circuit stays open, in milliseconds.
+ * @return true on success.
+ */
+bool ADUC_Retry_Policy_Init(
+    ADUC_Retry_Policy* policy,
+    unsigned long initialDelayMs,
+    unsigned long maxDelayMs,
+    unsigned int failureThreshold,
+    unsigned long openDurationMs);
+
+/**
+ * @brief Releases the resources of @p policy.
+ *
+ * @param policy The policy.
+ */
+void ADUC_Retry_Policy_Deinit(ADUC_Retry_Policy* policy);
+
+/**
+ * @brief Returns whether an attempt is allowed now. While the circuit is open, this returns false, and sets
+ *        @p retryAtMs to the time the next probe attempt is allowed.
+ *
+ * @param policy The policy.
+ * @param nowMs The current monotonic time, in milliseconds.
+ * @param[out] retryAtMs Optional. Set when the attempt is not allowed.
+ * @return true if the caller may attempt now.
+ */
+bool ADUC_Retry_Policy_AllowAttempt(ADUC_Retry_Policy* policy, uint64_t nowMs, uint64_t* retryAtMs);
+
+/**
+ * @brief Records a failed attempt, and returns how long to wait before the next one.
+ *
+ * @param policy The policy.
+ * @param nowMs The current monotonic time, in milliseconds.
+ * @param serverHintMs How long the server asked the client to wait (e.g. Retry-After, or a throttling
+ *                     response), in milliseconds, or 0. The delay is never shorter than the hint, but jittered
+ *                     above it.
+ * @return The delay before the next attempt, in milliseconds.
+ */
+unsigned long ADUC_Retry_Policy_OnFailure(ADUC_Retry_Policy* policy, uint64_t nowMs, unsigned long serverHintMs);
+
+/**
+ * @brief Records a successful attempt. Resets the backoff, and closes the circuit.
+ *
+ * @param policy The policy.
+ */
+void ADUC_Retry_Policy_OnSuccess(ADUC_Retry_Policy* policy);
+
 EXTERN_C_END
 
 #endif // RETRY_UTILS_H
@@ -10,14 +10,29 @@
 #include <limits.h>
 #include <math.h>
 #include <stdbool.h>
-#include <stdlib.h> // rand
+#include <stdint.h> // uintptr_t
 
 #include <aducpal/time.h> // clock_gettime
+#include <aducpal/unistd.h> // getpid
+
+#ifndef CLOCK_MONOTONIC
+#    define CLOCK_MONOTONIC CLOCK_REALTIME
+#endif
 
 #ifndef MIN
 #    define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #endif
 
+#ifndef MAX
+#    define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+/**
+ * @brief The state of the random generator of ADUC_Retry_Delay_Calculator, shared by its callers.
+ */
+static pthread_mutex_t s_randomStateMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t s_randomState = 0;
+
 static time_t GetTimeSinceEpochInSeconds()
 {
     struct timespec timeSinceEpoch;
@@ -25,6 +40,58 @@ static time_t GetTimeSinceEpochInSeconds()
     return timeSinceEpoch.tv_sec;
 }
 
+/**
+ * @brief Returns a seed that differs across devices, processes and calls, so that devices do not draw the same
+ *        jitter. rand() is not seeded by the agent, so every device used to draw the same sequence.
+ *
+ * @param salt A value mixed into the seed, e.g. the address of the generator state.
+ * @return uint64_t A non-zero seed.
+ */
+static uint64_t GetRandomSeed(uintptr_t salt)
+{
+    struct timespec realtime;
+    struct timespec monotonic;
+    ADUCPAL_clock_gettime(CLOCK_REALTIME, &realtime);
+    ADUCPAL_clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+    // splitmix64 finalizer.
+    uint64_t seed = ((uint64_t)realtime.tv_sec * 1000000000ULL + (uint64_t)realtime.tv_nsec)
+        ^ ((uint64_t)monotonic.tv_nsec << 32) ^ ((uint64_t)ADUCPAL_getpid() << 16) ^ (uint64_t)salt;
+    seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+    seed = seed ^ (seed >> 31);
+    return seed != 0 ? seed : 0x9e3779b97f4a7c15ULL;
+}
+
+/**
+ * @brief Advances the xorshift64* generator @p state.
+ *
+ * @param state The generator state. Must not be zero.
+ * @return uint64_t The next random value.
+ */
+static uint64_t NextRandom(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * @brief Returns a random value in [@p min, @p max].
+ */
+static unsigned long RandomBetween(uint64_t* state, unsigned long min, unsigned long max)
+{
+    if (max <= min)
+    {
+        return min;
+    }
+
+    return min + (unsigned long)(NextRandom(state) % ((uint64_t)(max - min) + 1));
+}
+
 /**
  * @brief The default function for calculating the next retry timestamp based on current time (since epoch) and input parameters,
  *        using exponential backoff with jitter algorithm.
@@ -33,7 +100,7 @@ static time_t GetTimeSinceEpochInSeconds()
  *      next-retry-timestamp = nowTimeSec + additionalDelaySecs + (MIN( ( (2 ^ MIN(MAX_RETRY_EXPONENT, retries))) * initialDelayUnitMilliSecs) / 1000), maxDelaySecs ) * (1 + jitter))
  *
  *      where:
- *         -  jitter =  (maxJitterPercent / 100.0) * (rand() / RAND_MAX)
+ *         -  jitter =  (maxJitterPercent / 100.0) * random(0, 1), from a generator seeded per device
  *         -  MAX_RETRY_EXPONENT help avoid large exponential value (recommended value is 9)
  *         -  additionalDelaySecs can be customized to suits different type of http response error
  *
@@ -52,7 +119,15 @@ time_t ADUC_Retry_Delay_Calculator(
     unsigned long maxDelaySecs,
     double maxJitterPercent)
 {
-    double jitterPercent = (maxJitterPercent / 100.0) * (rand() / ((double)RAND_MAX));
+    pthread_mutex_lock(&s_randomStateMutex);
+    if (s_randomState == 0)
+    {
+        s_randomState = GetRandomSeed((uintptr_t)&s_randomState);
+    }
+    const uint64_t random = NextRandom(&s_randomState);
+    pthread_mutex_unlock(&s_randomStateMutex);
+
+    double jitterPercent = (maxJitterPercent / 100.0) * ((double)(random >> 11) / (double)(1ULL << 53));
     double delay = (pow(2, MIN(retries, ADUC_RETRY_MAX_RETRY_EXPONENT)) * (double)initialDelayUnitMilliSecs) / 1000.0;
     if ((unsigned long)delay > maxDelaySecs)
     {
@@ -62,3 +137,116 @@ time_t ADUC_Retry_Delay_Calculator(
         (time_t)(GetTimeSinceEpochInSeconds() + (time_t)additionalDelaySecs + (time_t)(delay * (1 + jitterPercent)));
     return retryTimestampSec;
 }
+
+bool ADUC_Retry_Policy_Init(
+    ADUC_Retry_Policy* policy,
+    unsigned long initialDelayMs,
+    unsigned long maxDelayMs,
+    unsigned int failureThreshold,
+    unsigned long openDurationMs)
+{
+    if (policy == NULL || pthread_mutex_init(&policy->mutex, NULL) != 0)
+    {
+        return false;
+    }
+
+    policy->initialDelayMs = initialDelayMs;
+    policy->maxDelayMs = MAX(maxDelayMs, initialDelayMs);
+    policy->failureThreshold = failureThreshold;
+    policy->openDurationMs = openDurationMs;
+    policy->previousDelayMs = 0;
+    policy->consecutiveFailures = 0;
+    policy->circuitOpenUntilMs = 0;
+    policy->randomState = GetRandomSeed((uintptr_t)policy);
+    return true;
+}
+
+void ADUC_Retry_Policy_Deinit(ADUC_Retry_Policy* policy)
+{
+    if (policy != NULL)
+    {
+        pthread_mutex_destroy(&policy->mutex);
+    }
+}
+
+/**
+ * @brief Opens the circuit of @p policy for a jittered openDurationMs, so that devices whose circuits opened
+ *        together do not all probe at the same time. Must be called with the policy mutex held.
+ */
+static void OpenCircuit(ADUC_Retry_Policy* policy, uint64_t nowMs)
+{
+    const unsigned long openDurationMs = RandomBetween(
+        &policy->randomState, policy->openDurationMs, policy->openDurationMs + policy->openDurationMs / 2);
+    policy->circuitOpenUntilMs = nowMs + openDurationMs;
+}
+
+bool ADUC_Retry_Policy_AllowAttempt(ADUC_Retry_Policy* policy, uint64_t nowMs, uint64_t* retryAtMs)
+{
+    bool allowed = true;
+
+    pthread_mutex_lock(&policy->mutex);
+
+    if (policy->failureThreshold != 0 && policy->consecutiveFailures >= policy->failureThreshold)
+    {
+        if (nowMs < policy->circuitOpenUntilMs)
+        {
+            allowed = false;
+            if (retryAtMs != NULL)
+            {
+                *retryAtMs = policy->circuitOpenUntilMs;
+            }
+        }
+        else
+        {
+            // Half-open: this is the probe. The next one waits for its outcome, or for another open duration.
+            OpenCircuit(policy, nowMs);
+        }
+    }
+
+    pthread_mutex_unlock(&policy->mutex);
+
+    return allowed;
+}
+
+unsigned long ADUC_Retry_Policy_OnFailure(ADUC_Retry_Policy* policy, uint64_t nowMs, unsigned long serverHintMs)
+{
+    pthread_mutex_lock(&policy->mutex);
+
+    // Decorrelated jitter.
+    const unsigned long previousDelayMs =
+        policy->previousDelayMs != 0 ? policy->previousDelayMs : policy->initialDelayMs;
+    const unsigned long upperDelayMs =
+        previousDelayMs > policy->maxDelayMs / 3 ? policy->maxDelayMs : previousDelayMs * 3;
+    unsigned long delayMs = RandomBetween(&policy->randomState, policy->initialDelayMs, upperDelayMs);
+    policy->previousDelayMs = delayMs;
+
+    // Honor the server's hint, spreading the retries of the clients it throttled over one more initial delay.
+    if (serverHintMs != 0)
+    {
+        delayMs = MAX(delayMs, serverHintMs + RandomBetween(&policy->randomState, 0, policy->initialDelayMs));
+    }
+
+    if (policy->consecutiveFailures < UINT_MAX)
+    {
+        policy->consecutiveFailures++;
+    }
+
+    if (policy->failureThreshold != 0 && policy->consecutiveFailures >= policy->failureThreshold)
+    {
+        OpenCircuit(policy, nowMs);
+        delayMs = (unsigned long)MAX(delayMs, policy->circuitOpenUntilMs - nowMs);
+    }
+
+    pthread_mutex_unlock(&policy->mutex);
+
+    return delayMs;
+}
+
+void ADUC_Retry_Policy_OnSuccess(ADUC_Retry_Policy* policy)
+{
+    pthread_mutex_lock(&policy->mutex);
+    policy->previousDelayMs = 0;
+    policy->consecutiveFailures = 0;
+    policy->circuitOpenUntilMs = 0;
+    pthread_mutex_unlock(&policy->mutex);
+}
@@ -0,0 +1,108 @@
+/**
+ * @file retry_utils_ut.cpp
+ * @brief Unit Tests for retry_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/retry_utils.h"
+
+#include <catch2/catch.hpp>
+#include <set>
+
+TEST_CASE("ADUC_Retry_Policy_OnFailure")
+{
+    ADUC_Retry_Policy policy;
+    REQUIRE(ADUC_Retry_Policy_Init(&policy, 100, 10000, 0 /* failureThreshold */, 0 /* openDurationMs */));
+
+    SECTION("Delays grow with decorrelated jitter, up to the maximum")
+    {
+        unsigned long previousDelayMs = 100;
+        for (int i = 0; i < 50; ++i)
+        {
+            const unsigned long delayMs = ADUC_Retry_Policy_OnFailure(&policy, 0, 0);
+            CHECK(delayMs >= 100);
+            CHECK(delayMs <= std::min(10000UL, previousDelayMs * 3));
+            previousDelayMs = delayMs;
+        }
+
+        ADUC_Retry_Policy_OnSuccess(&policy);
+        CHECK(ADUC_Retry_Policy_OnFailure(&policy, 0, 0) <= 300);
+    }
+
+    SECTION("Delays are never shorter than the server hint, and jittered above it")
+    {
+        std::set<unsigned long> delays;
+        for (int i = 0; i < 20; ++i)
+        {
+            const unsigned long delayMs = ADUC_Retry_Policy_OnFailure(&policy, 0, 60000);
+            CHECK(delayMs >= 60000);
+            CHECK(delayMs <= 60100);
+            delays.insert(delayMs);
+            ADUC_Retry_Policy_OnSuccess(&policy);
+        }
+        CHECK(delays.size() > 1);
+    }
+
+    ADUC_Retry_Policy_Deinit(&policy);
+}
+
+TEST_CASE("Policies draw different delays")
+{
+    ADUC_Retry_Policy first;
+    ADUC_Retry_Policy second;
+    REQUIRE(ADUC_Retry_Policy_Init(&first, 1000, 3600000, 0, 0));
+    REQUIRE(ADUC_Retry_Policy_Init(&second, 1000, 3600000, 0, 0));
+
+    bool differ = false;
+    for (int i = 0; i < 10 && !differ; ++i)
+    {
+        differ = ADUC_Retry_Policy_OnFailure(&first, 0, 0) != ADUC_Retry_Policy_OnFailure(&second, 0, 0);
+    }
+    CHECK(differ);
+
+    ADUC_Retry_Policy_Deinit(&first);
+    ADUC_Retry_Policy_Deinit(&second);
+}
+
+TEST_CASE("ADUC_Retry_Policy circuit breaker")
+{
+    ADUC_Retry_Policy policy;
+    REQUIRE(ADUC_Retry_Policy_Init(&policy, 10, 100, 3 /* failureThreshold */, 1000 /* openDurationMs */));
+
+    uint64_t retryAtMs = 0;
+    CHECK(ADUC_Retry_Policy_AllowAttempt(&policy, 0, &retryAtMs));
+
+    (void)ADUC_Retry_Policy_OnFailure(&policy, 0, 0);
+    (void)ADUC_Retry_Policy_OnFailure(&policy, 0, 0);
+    CHECK(ADUC_Retry_Policy_AllowAttempt(&policy, 0, &retryAtMs));
+
+    // The third failure opens the circuit, for a jittered open duration.
+    const unsigned long delayMs = ADUC_Retry_Policy_OnFailure(&policy, 0, 0);
+    CHECK(delayMs >= 1000);
+    CHECK(delayMs <= 1500);
+    CHECK_FALSE(ADUC_Retry_Policy_AllowAttempt(&policy, 999, &retryAtMs));
+    CHECK(retryAtMs >= 1000);
+    CHECK(retryAtMs <= 1500);
+
+    // Half-open: one probe, then the circuit stays open until its outcome.
+    CHECK(ADUC_Retry_Policy_AllowAttempt(&policy, 1500, &retryAtMs));
+    CHECK_FALSE(ADUC_Retry_Policy_AllowAttempt(&policy, 1501, &retryAtMs));
+    CHECK(retryAtMs >= 2500);
+
+    ADUC_Retry_Policy_OnSuccess(&policy);
+    CHECK(ADUC_Retry_Policy_AllowAttempt(&policy, 1502, &retryAtMs));
+
+    ADUC_Retry_Policy_Deinit(&policy);
+}
+
+TEST_CASE("ADUC_Retry_Delay_Calculator")
+{
+    const time_t before = time(nullptr);
+    const time_t retryAt = ADUC_Retry_Delay_Calculator(10, 3, 1000, 60, 50);
+    const time_t after = time(nullptr);
+
+    // 10s + 8s, with up to 50% jitter on the 8s.
+    CHECK(retryAt >= before + 18);
+    CHECK(retryAt <= after + 22);
+}
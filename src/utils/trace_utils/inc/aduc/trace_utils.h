@@ -0,0 +1,97 @@
+/**
+ * @file trace_utils.h
+ * @brief Records workflow phase spans in the Chrome trace-event format.
+ *
+ * The agent starts a trace by creating ADUC_TRACE_FILE_NAME in the workflow sandbox. Spans ended afterwards, by the
+ * agent or by any extension, are appended to that file as complete ("ph":"X") events, one per line. The file uses
+ * the JSON array format without the closing bracket, which chrome://tracing and Perfetto accept as-is.
+ *
+ * When the sandbox has no trace file, ending a span is a no-op, so callers do not need to know whether tracing is
+ * enabled.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_TRACE_UTILS_H
+#define ADUC_TRACE_UTILS_H
+
+#include "aduc/c_utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief The name of the trace file in the workflow sandbox.
+ */
+#define ADUC_TRACE_FILE_NAME "du-trace.json"
+
+/**
+ * @brief The prefix of the trace files exported by ADUC_Trace_ExportWorkflowTrace().
+ */
+#define ADUC_TRACE_EXPORT_FILE_PREFIX "du-trace-"
+
+/**
+ * @brief The number of exported trace files kept in the export folder.
+ */
+#define ADUC_TRACE_MAX_EXPORTED_FILES 5
+
+/**
+ * @brief An in-flight span.
+ */
+typedef struct tagADUC_TraceSpan
+{
+    const char* category; /**< The span category, e.g. "workflow". Must be a string literal. */
+    const char* name; /**< The span name, e.g. "Download". Must be a string literal. */
+    uint64_t startUs; /**< The monotonic start time, in microseconds. */
+} ADUC_TraceSpan;
+
+/**
+ * @brief Gets the current monotonic time, in microseconds.
+ */
+uint64_t ADUC_Trace_GetTimestampUs();
+
+/**
+ * @brief Creates the trace file in @p workFolder. Spans are only recorded for sandboxes that have a trace file.
+ *
+ * @param workFolder The workflow sandbox.
+ * @param workflowId The workflow id, recorded as the trace process name.
+ * @return true on success, or if the trace file already exists.
+ */
+bool ADUC_Trace_StartWorkflowTrace(const char* workFolder, const char* workflowId);
+
+/**
+ * @brief Starts a span.
+ *
+ * @param[out] span The span.
+ * @param category The span category. Must be a string literal.
+ * @param name The span name. Must be a string literal.
+ */
+void ADUC_Trace_BeginSpan(ADUC_TraceSpan* span, const char* category, const char* name);
+
+/**
+ * @brief Ends a span and appends it to the trace file in @p workFolder, if any.
+ *
+ * @param span The span.
+ * @param workFolder The root workflow sandbox. May be NULL.
+ * @param detail An optional detail, e.g. a file name or step index, recorded in the event args. May be NULL.
+ *
+ * @remark Whether the sandbox has a trace file is cached: a trace started by another module is picked up within a
+ * second.
+ */
+void ADUC_Trace_EndSpan(const ADUC_TraceSpan* span, const char* workFolder, const char* detail);
+
+/**
+ * @brief Copies the trace file of @p workFolder to @p exportFolder so that it outlives the sandbox and is collected
+ * with the agent logs. Only the newest ADUC_TRACE_MAX_EXPORTED_FILES exported traces are kept.
+ *
+ * @param workFolder The workflow sandbox.
+ * @param workflowId The workflow id, used to name the exported file.
+ * @param exportFolder The destination folder, e.g. the agent log folder.
+ * @return true if the trace was exported; false if there is no trace, or on failure.
+ */
+bool ADUC_Trace_ExportWorkflowTrace(const char* workFolder, const char* workflowId, const char* exportFolder);
+
+EXTERN_C_END
+
+#endif // ADUC_TRACE_UTILS_H
@@ -0,0 +1,68 @@
+/**
+ * @file trace_utils.hpp
+ * @brief A scoped workflow trace span for C++ callers.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_TRACE_UTILS_HPP
+#define ADUC_TRACE_UTILS_HPP
+
+#include "aduc/trace_utils.h"
+
+#include <string>
+
+namespace ADUC
+{
+/**
+ * @brief Records a span from construction until End() or destruction, whichever comes first.
+ */
+class TraceSpan
+{
+public:
+    /**
+     * @brief Starts the span.
+     *
+     * @param workFolder The root workflow sandbox. The span is dropped if empty or if the sandbox has no trace file.
+     * @param category The span category. Must be a string literal.
+     * @param name The span name. Must be a string literal.
+     * @param detail An optional detail, e.g. a file name or step index.
+     */
+    TraceSpan(std::string workFolder, const char* category, const char* name, std::string detail = std::string{})
+        : _workFolder{ std::move(workFolder) }, _detail{ std::move(detail) }
+    {
+        ADUC_Trace_BeginSpan(&_span, category, name);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+    TraceSpan(TraceSpan&&) = delete;
+    TraceSpan& operator=(TraceSpan&&) = delete;
+
+    ~TraceSpan()
+    {
+        End();
+    }
+
+    /**
+     * @brief Ends the span. Subsequent calls are no-ops.
+     */
+    void End()
+    {
+        if (!_ended)
+        {
+            _ended = true;
+            ADUC_Trace_EndSpan(&_span, _workFolder.c_str(), _detail.c_str());
+        }
+    }
+
+private:
+    ADUC_TraceSpan _span{};
+    std::string _workFolder;
+    std::string _detail;
+    bool _ended{ false };
+};
+
+} // namespace ADUC
+
+#endif // ADUC_TRACE_UTILS_HPP
@@ -0,0 +1,385 @@
+/**
+ * @file trace_utils.c
+ * @brief Implements the Chrome trace-event span recorder.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/trace_utils.h"
+#include "aduc/logging.h"
+#include "aduc/string_c_utils.h" // ADUC_StringFormat, IsNullOrEmpty
+
+#include <errno.h>
+#include <fcntl.h> // open, O_APPEND
+#include <inttypes.h> // PRIu64
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h> // free
+#include <string.h> // strcmp, strlen, strncmp
+#include <sys/stat.h>
+
+#include <aducpal/dirent.h> // ADUCPAL_opendir, ADUCPAL_readdir, ADUCPAL_closedir
+#include <aducpal/time.h> // ADUCPAL_clock_gettime
+#include <aducpal/unistd.h> // ADUCPAL_access, ADUCPAL_getpid, ADUCPAL_syscall
+
+#ifndef CLOCK_MONOTONIC
+#    define CLOCK_MONOTONIC CLOCK_REALTIME
+#endif
+
+/**
+ * @brief The longest detail, in bytes, recorded in an event. Longer details are truncated.
+ */
+#define TRACE_MAX_DETAIL_LENGTH 256
+
+/**
+ * @brief How long, in microseconds, a sandbox found without a trace file is assumed to still have none.
+ */
+#define TRACE_FILE_RECHECK_INTERVAL_US 1000000
+
+/**
+ * @brief Caches whether the trace file of the last sandbox that ended a span exists, so that ending a span does not
+ * look the file up every time while tracing is disabled. Guarded by s_traceFileMutex.
+ */
+static pthread_mutex_t s_traceFileMutex = PTHREAD_MUTEX_INITIALIZER;
+static char* s_cachedWorkFolder = NULL;
+static bool s_cachedTraceFileExists = false;
+static uint64_t s_cachedTraceFileCheckUs = 0;
+
+uint64_t ADUC_Trace_GetTimestampUs()
+{
+    struct timespec now;
+    ADUCPAL_clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000) + ((uint64_t)now.tv_nsec / 1000);
+}
+
+/**
+ * @brief Copies @p src into @p dest as the contents of a JSON string, escaping as needed.
+ *
+ * @param dest The destination buffer.
+ * @param destSize The size of @p dest. Must be at least 1.
+ * @param src The source string.
+ */
+static void JsonEscape(char* dest, size_t destSize, const char* src)
+{
+    size_t length = 0;
+
+    for (; *src != '\0' && length + 7 < destSize; ++src)
+    {
+        unsigned char c = (unsigned char)*src;
+        if (c == '"' || c == '\\')
+        {
+            dest[length++] = '\\';
+            dest[length++] = (char)c;
+        }
+        else if (c < 0x20)
+        {
+            length += (size_t)snprintf(dest + length, destSize - length, "\\u%04x", c);
+        }
+        else
+        {
+            dest[length++] = (char)c;
+        }
+    }
+
+    dest[length] = '\0';
+}
+
+/**
+ * @brief Records whether the trace file of @p workFolder exists. Must be called with s_traceFileMutex held.
+ */
+static void CacheTraceFileExists(const char* workFolder, bool exists)
+{
+    if (s_cachedWorkFolder == NULL || strcmp(s_cachedWorkFolder, workFolder) != 0)
+    {
+        free(s_cachedWorkFolder);
+        s_cachedWorkFolder = ADUC_StringFormat("%s", workFolder);
+    }
+
+    s_cachedTraceFileExists = exists;
+    s_cachedTraceFileCheckUs = ADUC_Trace_GetTimestampUs();
+}
+
+/**
+ * @brief Gets whether the trace file of @p workFolder exists.
+ *
+ * The file is looked up once per sandbox, then again at most every TRACE_FILE_RECHECK_INTERVAL_US while it does not
+ * exist, in case the trace was started by another module.
+ */
+static bool HasTraceFile(const char* workFolder, const char* tracePath)
+{
+    pthread_mutex_lock(&s_traceFileMutex);
+
+    if (s_cachedWorkFolder == NULL || strcmp(s_cachedWorkFolder, workFolder) != 0
+        || (!s_cachedTraceFileExists
+            && ADUC_Trace_GetTimestampUs() - s_cachedTraceFileCheckUs >= TRACE_FILE_RECHECK_INTERVAL_US))
+    {
+        CacheTraceFileExists(workFolder, ADUCPAL_access(tracePath, F_OK) == 0);
+    }
+
+    const bool exists = s_cachedTraceFileExists;
+    pthread_mutex_unlock(&s_traceFileMutex);
+    return exists;
+}
+
+/**
+ * @brief Appends @p line to the trace file of @p workFolder, if the trace file exists.
+ *
+ * @remark Each line is written with a single append, so spans ended concurrently do not interleave.
+ */
+static void AppendTraceLine(const char* workFolder, const char* line)
+{
+    char* tracePath = ADUC_StringFormat("%s/%s", workFolder, ADUC_TRACE_FILE_NAME);
+    if (tracePath == NULL)
+    {
+        return;
+    }
+
+    if (HasTraceFile(workFolder, tracePath))
+    {
+        // Not created: the sandbox may have been removed, or recreated for a workflow that is not traced.
+        int fd = open(tracePath, O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            const size_t length = strlen(line);
+            (void)!write(fd, line, length);
+            close(fd);
+        }
+        else if (errno == ENOENT)
+        {
+            pthread_mutex_lock(&s_traceFileMutex);
+            CacheTraceFileExists(workFolder, false);
+            pthread_mutex_unlock(&s_traceFileMutex);
+        }
+    }
+
+    free(tracePath);
+}
+
+bool ADUC_Trace_StartWorkflowTrace(const char* workFolder, const char* workflowId)
+{
+    bool success = false;
+    char* tracePath = NULL;
+    FILE* file = NULL;
+    char escapedId[TRACE_MAX_DETAIL_LENGTH];
+
+    if (IsNullOrEmpty(workFolder))
+    {
+        goto done;
+    }
+
+    tracePath = ADUC_StringFormat("%s/%s", workFolder, ADUC_TRACE_FILE_NAME);
+    if (tracePath == NULL)
+    {
+        goto done;
+    }
+
+    if (ADUCPAL_access(tracePath, F_OK) == 0)
+    {
+        // Resuming a workflow after an agent restart. Keep appending to the existing trace.
+        success = true;
+        goto done;
+    }
+
+    file = fopen(tracePath, "w");
+    if (file == NULL)
+    {
+        Log_Warn("Cannot create trace file '%s'", tracePath);
+        goto done;
+    }
+
+    JsonEscape(escapedId, sizeof(escapedId), workflowId != NULL ? workflowId : "");
+    fprintf(
+        file,
+        "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"workflow %s\"}},\n",
+        (int)ADUCPAL_getpid(),
+        escapedId);
+
+    Log_Info("Recording workflow trace to '%s'", tracePath);
+    success = true;
+
+done:
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+
+    if (success)
+    {
+        pthread_mutex_lock(&s_traceFileMutex);
+        CacheTraceFileExists(workFolder, true);
+        pthread_mutex_unlock(&s_traceFileMutex);
+    }
+
+    free(tracePath);
+    return success;
+}
+
+void ADUC_Trace_BeginSpan(ADUC_TraceSpan* span, const char* category, const char* name)
+{
+    span->category = category;
+    span->name = name;
+    span->startUs = ADUC_Trace_GetTimestampUs();
+}
+
+void ADUC_Trace_EndSpan(const ADUC_TraceSpan* span, const char* workFolder, const char* detail)
+{
+    char line[TRACE_MAX_DETAIL_LENGTH + 256];
+    char escapedDetail[TRACE_MAX_DETAIL_LENGTH];
+
+    if (span == NULL || span->name == NULL || IsNullOrEmpty(workFolder))
+    {
+        return;
+    }
+
+    const uint64_t endUs = ADUC_Trace_GetTimestampUs();
+
+    JsonEscape(escapedDetail, sizeof(escapedDetail), detail != NULL ? detail : "");
+    snprintf(
+        line,
+        sizeof(line),
+        "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%" PRIu64 ",\"dur\":%" PRIu64
+        ",\"pid\":%d,\"tid\":%ld,\"args\":{\"detail\":\"%s\"}},\n",
+        span->name,
+        span->category != NULL ? span->category : "",
+        span->startUs,
+        endUs - span->startUs,
+        (int)ADUCPAL_getpid(),
+        (long)ADUCPAL_syscall(SYS_gettid),
+        escapedDetail);
+
+    AppendTraceLine(workFolder, line);
+}
+
+/**
+ * @brief Deletes the oldest exported traces in @p exportFolder so that at most ADUC_TRACE_MAX_EXPORTED_FILES remain.
+ */
+static void PruneExportedTraces(const char* exportFolder)
+{
+    const size_t prefixLength = strlen(ADUC_TRACE_EXPORT_FILE_PREFIX);
+
+    for (;;)
+    {
+        unsigned int count = 0;
+        time_t oldestTime = 0;
+        char* oldestPath = NULL;
+
+        DIR* dir = ADUCPAL_opendir(exportFolder);
+        if (dir == NULL)
+        {
+            return;
+        }
+
+        struct dirent* entry = NULL;
+        while ((entry = ADUCPAL_readdir(dir)) != NULL)
+        {
+            if (strncmp(entry->d_name, ADUC_TRACE_EXPORT_FILE_PREFIX, prefixLength) != 0)
+            {
+                continue;
+            }
+
+            char* path = ADUC_StringFormat("%s/%s", exportFolder, entry->d_name);
+            struct stat st;
+            if (path == NULL || stat(path, &st) != 0)
+            {
+                free(path);
+                continue;
+            }
+
+            ++count;
+            if (oldestPath == NULL || st.st_mtime < oldestTime)
+            {
+                free(oldestPath);
+                oldestPath = path;
+                oldestTime = st.st_mtime;
+            }
+            else
+            {
+                free(path);
+            }
+        }
+
+        ADUCPAL_closedir(dir);
+
+        const bool removed =
+            count > ADUC_TRACE_MAX_EXPORTED_FILES && oldestPath != NULL && remove(oldestPath) == 0;
+        free(oldestPath);
+
+        if (!removed)
+        {
+            return;
+        }
+    }
+}
+
+bool ADUC_Trace_ExportWorkflowTrace(const char* workFolder, const char* workflowId, const char* exportFolder)
+{
+    bool success = false;
+    char* tracePath = NULL;
+    char* exportPath = NULL;
+    FILE* src = NULL;
+    FILE* dest = NULL;
+    char buffer[4096];
+    size_t bytesRead = 0;
+
+    if (IsNullOrEmpty(workFolder) || IsNullOrEmpty(workflowId) || IsNullOrEmpty(exportFolder))
+    {
+        goto done;
+    }
+
+    tracePath = ADUC_StringFormat("%s/%s", workFolder, ADUC_TRACE_FILE_NAME);
+    exportPath = ADUC_StringFormat("%s/%s%s.json", exportFolder, ADUC_TRACE_EXPORT_FILE_PREFIX, workflowId);
+    if (tracePath == NULL || exportPath == NULL)
+    {
+        goto done;
+    }
+
+    src = fopen(tracePath, "r");
+    if (src == NULL)
+    {
+        goto done;
+    }
+
+    dest = fopen(exportPath, "w");
+    if (dest == NULL)
+    {
+        Log_Warn("Cannot create '%s'", exportPath);
+        goto done;
+    }
+
+    while ((bytesRead = fread(buffer, 1, sizeof(buffer), src)) > 0)
+    {
+        if (fwrite(buffer, 1, bytesRead, dest) != bytesRead)
+        {
+            Log_Warn("Cannot write '%s'", exportPath);
+            goto done;
+        }
+    }
+
+    success = true;
+
+done:
+    if (src != NULL)
+    {
+        fclose(src);
+    }
+
+    if (dest != NULL)
+    {
+        fclose(dest);
+
+        if (!success)
+        {
+            remove(exportPath);
+        }
+    }
+
+    if (success)
+    {
+        Log_Info("Exported workflow trace to '%s'", exportPath);
+        PruneExportedTraces(exportFolder);
+    }
+
+    free(tracePath);
+    free(exportPath);
+    return success;
+}
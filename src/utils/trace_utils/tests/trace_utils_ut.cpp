@@ -0,0 +1,100 @@
+/**
+ * @file trace_utils_ut.cpp
+ * @brief Unit Tests for trace_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/trace_utils.h"
+#include "aduc/trace_utils.hpp"
+
+#include <aduc/auto_dir.hpp>
+#include <catch2/catch.hpp>
+#include <cstdio> // remove
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#define TRACE_UT_SANDBOX_DIR "/tmp/adu-trace-ut-sandbox"
+#define TRACE_UT_EXPORT_DIR "/tmp/adu-trace-ut-export"
+#define TRACE_UT_TRACE_PATH TRACE_UT_SANDBOX_DIR "/" ADUC_TRACE_FILE_NAME
+
+static std::string ReadFile(const std::string& path)
+{
+    std::ifstream file{ path };
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+TEST_CASE("ADUC_Trace spans are dropped without a trace file")
+{
+    aduc::AutoDir sandbox{ TRACE_UT_SANDBOX_DIR };
+    REQUIRE(sandbox.CreateDir());
+
+    {
+        ADUC::TraceSpan span{ TRACE_UT_SANDBOX_DIR, "workflow", "Download" };
+    }
+
+    CHECK(ReadFile(TRACE_UT_TRACE_PATH).empty());
+}
+
+TEST_CASE("ADUC_Trace records complete events")
+{
+    aduc::AutoDir sandbox{ TRACE_UT_SANDBOX_DIR };
+    REQUIRE(sandbox.CreateDir());
+
+    REQUIRE(ADUC_Trace_StartWorkflowTrace(TRACE_UT_SANDBOX_DIR, "wf-1"));
+
+    ADUC_TraceSpan span;
+    ADUC_Trace_BeginSpan(&span, "steps", "Install");
+    ADUC_Trace_EndSpan(&span, TRACE_UT_SANDBOX_DIR, "step #0 \"quoted\"");
+
+    {
+        ADUC::TraceSpan scoped{ TRACE_UT_SANDBOX_DIR, "download", "Hash", "file.swu" };
+        scoped.End();
+        scoped.End();
+    }
+
+    const std::string trace = ReadFile(TRACE_UT_TRACE_PATH);
+
+    CHECK(trace.rfind("[\n", 0) == 0);
+    CHECK(trace.find("\"name\":\"workflow wf-1\"") != std::string::npos);
+    CHECK(trace.find("\"name\":\"Install\",\"cat\":\"steps\",\"ph\":\"X\"") != std::string::npos);
+    CHECK(trace.find("\"detail\":\"step #0 \\\"quoted\\\"\"") != std::string::npos);
+    CHECK(trace.find("\"name\":\"Hash\",\"cat\":\"download\"") != std::string::npos);
+
+    // The opening bracket, one metadata line and two span lines.
+    size_t lines = 0;
+    for (char c : trace)
+    {
+        lines += (c == '\n') ? 1 : 0;
+    }
+    CHECK(lines == 4);
+
+    SECTION("Export copies the trace")
+    {
+        aduc::AutoDir exportFolder{ TRACE_UT_EXPORT_DIR };
+        REQUIRE(exportFolder.CreateDir());
+
+        CHECK(ADUC_Trace_ExportWorkflowTrace(TRACE_UT_SANDBOX_DIR, "wf-1", TRACE_UT_EXPORT_DIR));
+        CHECK(ReadFile(TRACE_UT_EXPORT_DIR "/" ADUC_TRACE_EXPORT_FILE_PREFIX "wf-1.json") == trace);
+    }
+}
+
+TEST_CASE("ADUC_Trace does not recreate a removed trace file")
+{
+    aduc::AutoDir sandbox{ TRACE_UT_SANDBOX_DIR };
+    REQUIRE(sandbox.CreateDir());
+
+    REQUIRE(ADUC_Trace_StartWorkflowTrace(TRACE_UT_SANDBOX_DIR, "wf-2"));
+    REQUIRE(std::remove(TRACE_UT_TRACE_PATH) == 0);
+
+    ADUC_TraceSpan span;
+    ADUC_Trace_BeginSpan(&span, "steps", "Install");
+    ADUC_Trace_EndSpan(&span, TRACE_UT_SANDBOX_DIR, nullptr);
+    ADUC_Trace_EndSpan(&span, TRACE_UT_SANDBOX_DIR, nullptr);
+
+    CHECK(ReadFile(TRACE_UT_TRACE_PATH).empty());
+    CHECK_FALSE(std::ifstream{ TRACE_UT_TRACE_PATH }.good());
+}
@@ -0,0 +1,233 @@
+/**
+ * @file worker_pool_utils.hpp
+ * @brief A small named worker pool with a bounded task queue and cooperative cancellation.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_WORKER_POOL_UTILS_HPP
+#define ADUC_WORKER_POOL_UTILS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility> // std::pair
+#include <vector>
+
+namespace ADUC
+{
+/**
+ * @brief A cooperative cancellation token. Copies share the same cancellation state.
+ */
+class CancellationToken
+{
+    struct State
+    {
+        std::atomic_bool cancelled{ false };
+        std::mutex mutex; // Guards the fields below, and is held while the callbacks run.
+        uint64_t nextCallbackId{ 1 };
+        std::vector<std::pair<uint64_t, std::function<void()>>> callbacks;
+    };
+
+public:
+    /**
+     * @brief Unsubscribes a callback from its token when destroyed.
+     */
+    class Subscription
+    {
+    public:
+        Subscription() = default;
+
+        Subscription(const Subscription&) = delete;
+        Subscription& operator=(const Subscription&) = delete;
+
+        Subscription(Subscription&& other) noexcept :
+            _state{ std::move(other._state) }, _callbackId{ other._callbackId }
+        {
+        }
+
+        Subscription& operator=(Subscription&& other) noexcept
+        {
+            Reset();
+            _state = std::move(other._state);
+            _callbackId = other._callbackId;
+            return *this;
+        }
+
+        ~Subscription()
+        {
+            Reset();
+        }
+
+        /**
+         * @brief Unsubscribes the callback. Waits if it is running.
+         */
+        void Reset();
+
+    private:
+        friend class CancellationToken;
+
+        std::shared_ptr<State> _state;
+        uint64_t _callbackId{ 0 };
+    };
+
+    CancellationToken() : _state{ std::make_shared<State>() }
+    {
+    }
+
+    /**
+     * @brief Requests cancellation, and runs the subscribed callbacks. Observers may also poll
+     * IsCancellationRequested().
+     */
+    void RequestCancellation() const;
+
+    /**
+     * @brief Whether cancellation has been requested on this token or any of its copies.
+     */
+    bool IsCancellationRequested() const
+    {
+        return _state->cancelled.load();
+    }
+
+    /**
+     * @brief Runs @p callback when cancellation is requested, e.g. to interrupt a blocking operation.
+     * @details The callback runs on the thread that requests cancellation; or right away, on the calling thread, if
+     * cancellation was already requested. It must not subscribe to, or unsubscribe from, this token.
+     *
+     * @param callback The callback.
+     * @return Subscription The subscription. The callback is not run once it is destroyed.
+     */
+    Subscription Subscribe(std::function<void()> callback) const;
+
+    /**
+     * @brief Whether both tokens share the same cancellation state.
+     */
+    bool operator==(const CancellationToken& other) const
+    {
+        return _state == other._state;
+    }
+
+private:
+    std::shared_ptr<State> _state;
+};
+
+/**
+ * @brief A snapshot of the worker pool counters.
+ */
+struct WorkerPoolMetrics
+{
+    size_t queueDepth{ 0 }; /**< Tasks currently waiting for a worker. */
+    size_t maxQueueDepth{ 0 }; /**< High-water mark of queueDepth. */
+    size_t activeTasks{ 0 }; /**< Tasks currently running. */
+    uint64_t tasksSubmitted{ 0 }; /**< Tasks accepted by Submit(). */
+    uint64_t tasksRejected{ 0 }; /**< Tasks refused because the queue was full or the pool was shutting down. */
+    uint64_t tasksCompleted{ 0 }; /**< Tasks that ran to completion. */
+    uint64_t tasksCancelledAtShutdown{ 0 }; /**< Queued tasks that ran with a cancelled token at shutdown. */
+    uint64_t totalQueueLatencyMs{ 0 }; /**< Sum of the time tasks spent queued. */
+    uint64_t maxQueueLatencyMs{ 0 }; /**< Longest time a task spent queued. */
+    uint64_t totalRunTimeMs{ 0 }; /**< Sum of the task run times. */
+};
+
+/**
+ * @brief A fixed-size pool of named, joinable worker threads fed by a bounded FIFO queue.
+ */
+class WorkerPool
+{
+public:
+    /**
+     * @brief A unit of work. Its token is cancelled by the submitter, or by Shutdown().
+     */
+    using Task = std::function<void(const CancellationToken& token)>;
+
+    /**
+     * @brief Construct and start the worker pool.
+     *
+     * @param name The pool name. Worker threads are named "<name>-<index>" (truncated to the OS limit).
+     * @param workerCount The number of worker threads. Must be at least 1.
+     * @param maxQueueDepth The maximum number of tasks waiting for a worker.
+     */
+    WorkerPool(std::string name, size_t workerCount, size_t maxQueueDepth);
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    WorkerPool(WorkerPool&&) = delete;
+    WorkerPool& operator=(WorkerPool&&) = delete;
+
+    /**
+     * @brief Shuts down the pool. See Shutdown().
+     */
+    ~WorkerPool();
+
+    /**
+     * @brief Queues a task.
+     *
+     * @param taskName A name used for logging and metrics.
+     * @param task The task to run.
+     * @param token The token passed to @p task. A default token is created if not supplied.
+     * @return true if the task was queued; false if the queue is full or the pool is shutting down.
+     */
+    bool Submit(const std::string& taskName, Task task, CancellationToken token = CancellationToken{});
+
+    /**
+     * @brief Stops accepting tasks, cancels the queued and running tasks, and joins the workers.
+     *
+     * @remark The workers still run the queued tasks, with their token cancelled, so that each task can complete,
+     *         e.g. report that it was cancelled. Blocks until every task returns. Tasks are expected to check their
+     *         token, or to subscribe to it to interrupt blocking work.
+     */
+    void Shutdown();
+
+    /**
+     * @brief Whether Shutdown() has been called.
+     */
+    bool IsShuttingDown() const
+    {
+        return _shuttingDown.load();
+    }
+
+    /**
+     * @brief Gets the pool name.
+     */
+    const std::string& Name() const
+    {
+        return _name;
+    }
+
+    /**
+     * @brief Gets a snapshot of the pool metrics.
+     */
+    WorkerPoolMetrics GetMetrics() const;
+
+private:
+    struct QueuedTask
+    {
+        std::string name;
+        Task task;
+        CancellationToken token;
+        std::chrono::steady_clock::time_point enqueueTime;
+    };
+
+    void WorkerMain(size_t index);
+
+    const std::string _name;
+    const size_t _maxQueueDepth;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _taskAvailable;
+    std::deque<QueuedTask> _queue;
+    std::vector<CancellationToken> _runningTokens;
+    std::vector<std::thread> _workers;
+    std::atomic_bool _shuttingDown{ false };
+    WorkerPoolMetrics _metrics;
+};
+
+} // namespace ADUC
+
+#endif // ADUC_WORKER_POOL_UTILS_HPP
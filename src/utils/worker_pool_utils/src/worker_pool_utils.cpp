@@ -0,0 +1,336 @@
+/**
+ * @file worker_pool_utils.cpp
+ * @brief Implements the bounded worker pool.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/worker_pool_utils.hpp"
+#include "aduc/logging.h"
+#include "aduc/metrics_utils.h"
+
+#include <algorithm>
+#include <inttypes.h> // PRIu64
+
+#ifdef __linux__
+#    include <pthread.h> // pthread_setname_np
+#endif
+
+namespace ADUC
+{
+namespace
+{
+/**
+ * @brief Maximum thread name length on Linux, excluding the null terminator.
+ */
+const size_t MaxThreadNameLength = 15;
+
+uint64_t ElapsedMs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count());
+}
+
+/**
+ * @brief Bucket upper bounds of the queue latency and run time histograms, in milliseconds.
+ */
+const uint64_t TaskDurationBoundsMs[] = { 10, 100, 1000, 10000, 60000, 300000, 1800000 };
+
+/**
+ * @brief The exported pool metrics. The registry is process wide, so the pools of the process share them.
+ */
+struct ExportedMetrics
+{
+    ADUC_Metric* queueDepth;
+    ADUC_Metric* activeTasks;
+    ADUC_Metric* tasksSubmitted;
+    ADUC_Metric* tasksRejected;
+    ADUC_Metric* tasksCompleted;
+    ADUC_Metric* tasksCancelledAtShutdown;
+    ADUC_Metric* queueLatencyMs;
+    ADUC_Metric* runTimeMs;
+};
+
+const ExportedMetrics& GetExportedMetrics()
+{
+    static const ExportedMetrics metrics{
+        ADUC_Metrics_RegisterGauge("adu_worker_pool_queue_depth", "Tasks waiting for a worker."),
+        ADUC_Metrics_RegisterGauge("adu_worker_pool_active_tasks", "Tasks running on a worker."),
+        ADUC_Metrics_RegisterCounter("adu_worker_pool_tasks_submitted_total", "Tasks queued on a worker pool."),
+        ADUC_Metrics_RegisterCounter(
+            "adu_worker_pool_tasks_rejected_total", "Tasks refused because the queue was full or shutting down."),
+        ADUC_Metrics_RegisterCounter("adu_worker_pool_tasks_completed_total", "Tasks that ran to completion."),
+        ADUC_Metrics_RegisterCounter(
+            "adu_worker_pool_tasks_cancelled_at_shutdown_total", "Queued tasks cancelled by a pool shutdown."),
+        ADUC_Metrics_RegisterHistogram(
+            "adu_worker_pool_queue_latency_ms",
+            "Time tasks spent queued, in milliseconds.",
+            TaskDurationBoundsMs,
+            sizeof(TaskDurationBoundsMs) / sizeof(TaskDurationBoundsMs[0])),
+        ADUC_Metrics_RegisterHistogram(
+            "adu_worker_pool_run_time_ms",
+            "Time tasks spent running, in milliseconds.",
+            TaskDurationBoundsMs,
+            sizeof(TaskDurationBoundsMs) / sizeof(TaskDurationBoundsMs[0])),
+    };
+
+    return metrics;
+}
+
+void SetCurrentThreadName(const std::string& name)
+{
+#ifdef __linux__
+    std::string truncated = name.substr(0, MaxThreadNameLength);
+    pthread_setname_np(pthread_self(), truncated.c_str());
+#else
+    (void)name;
+#endif
+}
+} // namespace
+
+void CancellationToken::Subscription::Reset()
+{
+    if (_state == nullptr)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{ _state->mutex };
+        auto& callbacks = _state->callbacks;
+        callbacks.erase(
+            std::remove_if(
+                callbacks.begin(),
+                callbacks.end(),
+                [this](const std::pair<uint64_t, std::function<void()>>& callback) {
+                    return callback.first == _callbackId;
+                }),
+            callbacks.end());
+    }
+
+    _state.reset();
+}
+
+void CancellationToken::RequestCancellation() const
+{
+    if (_state->cancelled.exchange(true))
+    {
+        return;
+    }
+
+    // Hold the lock while the callbacks run, so that they are not run after their subscription is reset.
+    std::lock_guard<std::mutex> lock{ _state->mutex };
+    for (const auto& callback : _state->callbacks)
+    {
+        callback.second();
+    }
+}
+
+CancellationToken::Subscription CancellationToken::Subscribe(std::function<void()> callback) const
+{
+    Subscription subscription;
+
+    {
+        std::lock_guard<std::mutex> lock{ _state->mutex };
+        if (!_state->cancelled)
+        {
+            subscription._state = _state;
+            subscription._callbackId = _state->nextCallbackId++;
+            _state->callbacks.emplace_back(subscription._callbackId, std::move(callback));
+            return subscription;
+        }
+    }
+
+    callback();
+    return subscription;
+}
+
+WorkerPool::WorkerPool(std::string name, size_t workerCount, size_t maxQueueDepth) :
+    _name{ std::move(name) }, _maxQueueDepth{ maxQueueDepth }
+{
+    // Register the metrics before the workers start.
+    (void)GetExportedMetrics();
+
+    workerCount = std::max<size_t>(workerCount, 1);
+    _workers.reserve(workerCount);
+    for (size_t i = 0; i < workerCount; ++i)
+    {
+        _workers.emplace_back(&WorkerPool::WorkerMain, this, i);
+    }
+
+    Log_Info("Worker pool '%s' started (workers: %zu, queue: %zu).", _name.c_str(), workerCount, maxQueueDepth);
+}
+
+WorkerPool::~WorkerPool()
+{
+    Shutdown();
+}
+
+bool WorkerPool::Submit(const std::string& taskName, Task task, CancellationToken token)
+{
+    std::unique_lock<std::mutex> lock{ _mutex };
+
+    if (_shuttingDown)
+    {
+        ++_metrics.tasksRejected;
+        ADUC_Metrics_CounterAdd(GetExportedMetrics().tasksRejected, 1);
+        Log_Warn("Worker pool '%s' is shutting down. Rejected task '%s'.", _name.c_str(), taskName.c_str());
+        return false;
+    }
+
+    if (_queue.size() >= _maxQueueDepth)
+    {
+        ++_metrics.tasksRejected;
+        ADUC_Metrics_CounterAdd(GetExportedMetrics().tasksRejected, 1);
+        Log_Error(
+            "Worker pool '%s' queue is full (%zu). Rejected task '%s'.",
+            _name.c_str(),
+            _queue.size(),
+            taskName.c_str());
+        return false;
+    }
+
+    _queue.push_back(QueuedTask{ taskName, std::move(task), std::move(token), std::chrono::steady_clock::now() });
+    ++_metrics.tasksSubmitted;
+    _metrics.maxQueueDepth = std::max(_metrics.maxQueueDepth, _queue.size());
+    ADUC_Metrics_CounterAdd(GetExportedMetrics().tasksSubmitted, 1);
+    ADUC_Metrics_GaugeAdd(GetExportedMetrics().queueDepth, 1);
+
+    lock.unlock();
+    _taskAvailable.notify_one();
+    return true;
+}
+
+void WorkerPool::Shutdown()
+{
+    std::unique_lock<std::mutex> lock{ _mutex };
+
+    if (_workers.empty())
+    {
+        // Already shut down.
+        return;
+    }
+
+    _shuttingDown = true;
+
+    Log_Info(
+        "Worker pool '%s' shutting down (queued: %zu, running: %zu).",
+        _name.c_str(),
+        _queue.size(),
+        _runningTokens.size());
+
+    // The workers run the queued tasks with their token cancelled, so that each task completes.
+    std::vector<CancellationToken> tokens{ _runningTokens };
+    for (const QueuedTask& queued : _queue)
+    {
+        Log_Warn("Worker pool '%s' cancelling queued task '%s'.", _name.c_str(), queued.name.c_str());
+        tokens.push_back(queued.token);
+    }
+    _metrics.tasksCancelledAtShutdown += _queue.size();
+    ADUC_Metrics_CounterAdd(GetExportedMetrics().tasksCancelledAtShutdown, _queue.size());
+
+    std::vector<std::thread> workers;
+    workers.swap(_workers);
+
+    lock.unlock();
+
+    // Cancel outside the lock; the token callbacks may take other locks.
+    for (const CancellationToken& token : tokens)
+    {
+        token.RequestCancellation();
+    }
+
+    _taskAvailable.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    Log_Info("Worker pool '%s' stopped.", _name.c_str());
+}
+
+WorkerPoolMetrics WorkerPool::GetMetrics() const
+{
+    std::lock_guard<std::mutex> lock{ _mutex };
+    WorkerPoolMetrics metrics{ _metrics };
+    metrics.queueDepth = _queue.size();
+    metrics.activeTasks = _runningTokens.size();
+    return metrics;
+}
+
+void WorkerPool::WorkerMain(size_t index)
+{
+    SetCurrentThreadName(_name + "-" + std::to_string(index));
+
+    std::unique_lock<std::mutex> lock{ _mutex };
+
+    for (;;)
+    {
+        _taskAvailable.wait(lock, [this] { return _shuttingDown || !_queue.empty(); });
+
+        if (_queue.empty())
+        {
+            // Shutting down and nothing left to do.
+            break;
+        }
+
+        QueuedTask queued{ std::move(_queue.front()) };
+        _queue.pop_front();
+
+        const auto startTime = std::chrono::steady_clock::now();
+        const uint64_t queueLatencyMs = ElapsedMs(queued.enqueueTime, startTime);
+        _metrics.totalQueueLatencyMs += queueLatencyMs;
+        _metrics.maxQueueLatencyMs = std::max(_metrics.maxQueueLatencyMs, queueLatencyMs);
+        _runningTokens.push_back(queued.token);
+        const size_t queueDepth = _queue.size();
+
+        lock.unlock();
+
+        const ExportedMetrics& exportedMetrics = GetExportedMetrics();
+        ADUC_Metrics_GaugeAdd(exportedMetrics.queueDepth, -1);
+        ADUC_Metrics_GaugeAdd(exportedMetrics.activeTasks, 1);
+        ADUC_Metrics_HistogramObserve(exportedMetrics.queueLatencyMs, queueLatencyMs);
+
+        Log_Debug(
+            "Worker pool '%s' running task '%s' (queued %" PRIu64 " ms, queue depth %zu).",
+            _name.c_str(),
+            queued.name.c_str(),
+            queueLatencyMs,
+            queueDepth);
+
+        try
+        {
+            queued.task(queued.token);
+        }
+        catch (const std::exception& e)
+        {
+            Log_Error("Worker pool '%s' task '%s' threw: %s", _name.c_str(), queued.name.c_str(), e.what());
+        }
+        catch (...)
+        {
+            Log_Error("Worker pool '%s' task '%s' threw an unknown exception.", _name.c_str(), queued.name.c_str());
+        }
+
+        const uint64_t runTimeMs = ElapsedMs(startTime, std::chrono::steady_clock::now());
+
+        ADUC_Metrics_GaugeAdd(exportedMetrics.activeTasks, -1);
+        ADUC_Metrics_CounterAdd(exportedMetrics.tasksCompleted, 1);
+        ADUC_Metrics_HistogramObserve(exportedMetrics.runTimeMs, runTimeMs);
+
+        lock.lock();
+
+        ++_metrics.tasksCompleted;
+        _metrics.totalRunTimeMs += runTimeMs;
+
+        auto it = std::find(_runningTokens.begin(), _runningTokens.end(), queued.token);
+        if (it != _runningTokens.end())
+        {
+            _runningTokens.erase(it);
+        }
+
+        Log_Debug(
+            "Worker pool '%s' task '%s' completed in %" PRIu64 " ms.", _name.c_str(), queued.name.c_str(), runTimeMs);
+    }
+}
+
+} // namespace ADUC
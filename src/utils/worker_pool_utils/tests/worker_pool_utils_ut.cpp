@@ -0,0 +1,181 @@
+/**
+ * @file worker_pool_utils_ut.cpp
+ * @brief Unit Tests for worker_pool_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/worker_pool_utils.hpp"
+
+#include <catch2/catch.hpp>
+#include <future>
+
+using ADUC::CancellationToken;
+using ADUC::WorkerPool;
+
+TEST_CASE("WorkerPool runs submitted tasks")
+{
+    WorkerPool pool{ "ut", 2, 8 };
+
+    std::promise<void> done1;
+    std::promise<void> done2;
+
+    CHECK(pool.Submit("t1", [&done1](const CancellationToken&) { done1.set_value(); }));
+    CHECK(pool.Submit("t2", [&done2](const CancellationToken&) { done2.set_value(); }));
+
+    CHECK(done1.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    CHECK(done2.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+
+    pool.Shutdown();
+
+    const ADUC::WorkerPoolMetrics metrics = pool.GetMetrics();
+    CHECK(metrics.tasksSubmitted == 2);
+    CHECK(metrics.tasksCompleted == 2);
+    CHECK(metrics.queueDepth == 0);
+    CHECK(metrics.activeTasks == 0);
+}
+
+TEST_CASE("WorkerPool bounds its queue")
+{
+    WorkerPool pool{ "ut", 1, 1 };
+
+    std::promise<void> release;
+    std::shared_future<void> released{ release.get_future() };
+    std::promise<void> started;
+
+    // Occupy the only worker.
+    REQUIRE(pool.Submit("blocker", [&started, released](const CancellationToken&) {
+        started.set_value();
+        released.wait();
+    }));
+    REQUIRE(started.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+
+    // One slot in the queue, then rejection.
+    CHECK(pool.Submit("queued", [](const CancellationToken&) {}));
+    CHECK_FALSE(pool.Submit("rejected", [](const CancellationToken&) {}));
+
+    const ADUC::WorkerPoolMetrics metrics = pool.GetMetrics();
+    CHECK(metrics.queueDepth == 1);
+    CHECK(metrics.activeTasks == 1);
+    CHECK(metrics.tasksRejected == 1);
+
+    release.set_value();
+    pool.Shutdown();
+}
+
+TEST_CASE("WorkerPool shutdown cancels running tasks and runs queued ones cancelled")
+{
+    WorkerPool pool{ "ut", 1, 4 };
+
+    std::promise<void> started;
+    bool observedCancel = false;
+    bool queuedRan = false;
+    bool queuedCancelled = false;
+
+    REQUIRE(pool.Submit("long", [&started, &observedCancel](const CancellationToken& token) {
+        started.set_value();
+
+        // A blocking operation, interrupted through the token.
+        std::promise<void> interrupted;
+        const CancellationToken::Subscription subscription =
+            token.Subscribe([&interrupted]() { interrupted.set_value(); });
+        interrupted.get_future().wait();
+
+        observedCancel = token.IsCancellationRequested();
+    }));
+    REQUIRE(pool.Submit("queued", [&queuedRan, &queuedCancelled](const CancellationToken& token) {
+        queuedRan = true;
+        queuedCancelled = token.IsCancellationRequested();
+    }));
+    REQUIRE(started.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+
+    pool.Shutdown();
+
+    CHECK(observedCancel);
+    CHECK(queuedRan);
+    CHECK(queuedCancelled);
+    CHECK(pool.IsShuttingDown());
+    CHECK_FALSE(pool.Submit("late", [](const CancellationToken&) {}));
+
+    const ADUC::WorkerPoolMetrics metrics = pool.GetMetrics();
+    CHECK(metrics.tasksCancelledAtShutdown == 1);
+    CHECK(metrics.tasksCompleted == 2);
+}
+
+TEST_CASE("Cancelling a task's token leaves the other tasks running")
+{
+    WorkerPool pool{ "ut", 2, 4 };
+
+    CancellationToken cancelledWorkflow;
+    CancellationToken otherWorkflow;
+
+    std::promise<void> cancelledStarted;
+    std::promise<void> otherStarted;
+    std::promise<void> release;
+    std::shared_future<void> released{ release.get_future() };
+    std::promise<bool> cancelledResult;
+    std::promise<bool> otherResult;
+
+    REQUIRE(pool.Submit(
+        "cancelled",
+        [&](const CancellationToken& token) {
+            cancelledStarted.set_value();
+            released.wait();
+            cancelledResult.set_value(token.IsCancellationRequested());
+        },
+        cancelledWorkflow));
+    REQUIRE(pool.Submit(
+        "other",
+        [&](const CancellationToken& token) {
+            otherStarted.set_value();
+            released.wait();
+            otherResult.set_value(token.IsCancellationRequested());
+        },
+        otherWorkflow));
+
+    REQUIRE(cancelledStarted.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    REQUIRE(otherStarted.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+
+    cancelledWorkflow.RequestCancellation();
+    release.set_value();
+
+    CHECK(cancelledResult.get_future().get());
+    CHECK_FALSE(otherResult.get_future().get());
+
+    pool.Shutdown();
+}
+
+TEST_CASE("CancellationToken copies share state")
+{
+    CancellationToken token;
+    CancellationToken copy{ token };
+    CancellationToken other;
+
+    CHECK(token == copy);
+    CHECK_FALSE(token == other);
+
+    copy.RequestCancellation();
+    CHECK(token.IsCancellationRequested());
+    CHECK_FALSE(other.IsCancellationRequested());
+}
+
+TEST_CASE("CancellationToken runs its subscribed callbacks")
+{
+    CancellationToken token;
+    int calls = 0;
+    int resetCalls = 0;
+
+    CancellationToken::Subscription subscription = token.Subscribe([&calls]() { ++calls; });
+    CancellationToken::Subscription resetSubscription = token.Subscribe([&resetCalls]() { ++resetCalls; });
+    resetSubscription.Reset();
+
+    token.RequestCancellation();
+    token.RequestCancellation();
+    CHECK(calls == 1);
+    CHECK(resetCalls == 0);
+
+    // Once cancelled, a new callback runs right away.
+    int lateCalls = 0;
+    const CancellationToken::Subscription lateSubscription = token.Subscribe([&lateCalls]() { ++lateCalls; });
+    CHECK(lateCalls == 1);
+}
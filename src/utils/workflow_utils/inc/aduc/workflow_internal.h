@@ -9,12 +9,14 @@
 #ifndef WORKFLOW_INTERNAL_H
 #define WORKFLOW_INTERNAL_H
 
+#include <aduc/adushell_broker.h>
 #include <aduc/result.h>
 #include <aduc/types/update_content.h>
 #include <aduc/types/workflow.h>
 #include <azure_c_shared_utility/strings.h>
 #include <azure_c_shared_utility/vector.h>
 #include <parson.h>
+#include <pthread.h>
 
 /**
  * @brief A struct containing data needed for an update workflow.
@@ -29,6 +31,8 @@ typedef struct tagADUC_Workflow
     JSON_Object* UpdateActionObject; /**< The update action JSON object. */
     JSON_Object* UpdateManifestObject; /**< The update manifest JSON object. */
     JSON_Object* PropertiesObject; /**< The Property JSON object. */
+    pthread_mutex_t
+        PropertiesMutex; /**< Guards PropertiesObject. Child workflows installing concurrently share their root's properties. */
     JSON_Object* ResultsObject; /**< The results JSON object. */
 
     //
@@ -40,6 +44,8 @@ typedef struct tagADUC_Workflow
     VECTOR_HANDLE ResultExtraExtendedResultCodes; /**< The extra ERCs. */
     STRING_HANDLE ResultDetails; /**< The result details of the workflow. */
     STRING_HANDLE InstalledUpdateId; /**< The installed updateId to report on workflow success. */
+    JSON_Value* ResourceUsage; /**< The resource usage of the child processes of each phase, e.g. "install". */
+    ADUC_AduShellBroker* AduShellBroker; /**< The adu-shell broker, on the root only. Guarded by PropertiesMutex. */
 
     //
     // Nested steps workflow state.
@@ -50,6 +56,8 @@ typedef struct tagADUC_Workflow
     size_t ChildCount; /**< The count of children. */
     int Level; /**< The level of the workflow in the tree. */
     size_t StepIndex; /**< The step index for this workflow. */
+    bool
+        IsolatesInterruptionRequests; /**< Whether reboot and agent restart requests of this workflow and its children are kept here, instead of on the root. */
 
     //
     // Operation worker state including state for handling cancellation and completion.
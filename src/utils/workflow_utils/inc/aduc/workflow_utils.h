@@ -9,6 +9,7 @@
 #define ADUC_WORKFLOW_UTILS_H
 
 #include "aduc/adu_types.h"
+#include "aduc/adushell_broker.h"
 #include "aduc/result.h"
 #include "aduc/types/update_content.h"
 #include "aduc/types/workflow.h"
@@ -478,6 +479,42 @@ void workflow_set_result_details(ADUC_WorkflowHandle handle, const char* format,
  */
 const char* workflow_peek_result_details(ADUC_WorkflowHandle handle);
 
+/**
+ * @brief Sets the resource usage of the child processes that a step handler launched for a phase of the workflow.
+ * It is reported in the step result.
+ *
+ * @param handle A workflow object handle.
+ * @param phase The phase, e.g. "download" or "install". Replaces the earlier usage of the same phase.
+ * @param usage A JSON object, e.g. from ADUC_ChildProcessUsage_ToJsonValue. The workflow takes ownership of it,
+ * even on failure. NULL is ignored.
+ */
+void workflow_set_resource_usage(ADUC_WorkflowHandle handle, const char* phase, JSON_Value* usage);
+
+/**
+ * @brief Gets a copy of the resource usage of the child processes of the workflow, by phase.
+ *
+ * @param handle A workflow object handle.
+ * @return JSON_Value* A JSON object whose keys are phases; NULL if no usage was set. Caller must json_value_free it.
+ */
+JSON_Value* workflow_get_resource_usage(ADUC_WorkflowHandle handle);
+
+/**
+ * @brief Sets the adu-shell broker of the workflow, on which its adu-shell tasks run. A previous broker is released.
+ *
+ * @param handle A workflow object handle. The broker is set on its root.
+ * @param broker The broker, or NULL. The workflow takes ownership of the reference.
+ */
+void workflow_set_adushell_broker(ADUC_WorkflowHandle handle, ADUC_AduShellBroker* broker);
+
+/**
+ * @brief Gets the adu-shell broker of the workflow, for ADUC_ChildProcessOptions_FromConfig.
+ *
+ * @param handle A workflow object handle, e.g. of a step.
+ * @return ADUC_AduShellBroker* A new reference to the broker of the root workflow, or NULL if it has none. Caller
+ * must release it with ADUC_AduShellBroker_Release.
+ */
+ADUC_AduShellBroker* workflow_get_adushell_broker(ADUC_WorkflowHandle handle);
+
 void workflow_set_installed_update_id(ADUC_WorkflowHandle handle, const char* installedUpdateId);
 
 const char* workflow_peek_installed_update_id(ADUC_WorkflowHandle handle);
@@ -564,6 +601,17 @@ bool workflow_is_reboot_requested(ADUC_WorkflowHandle handle);
  */
 bool workflow_is_immediate_reboot_requested(ADUC_WorkflowHandle handle);
 
+/**
+ * @brief Keeps the reboot and agent restart requests of the workflow and its children on the workflow, instead of
+ * on the root workflow. Used for steps that install concurrently, so that the request of one step does not change
+ * how the other steps proceed. The root workflow always keeps its own requests.
+ *
+ * @param handle A child workflow data object handle.
+ * @param isolated Whether to keep the requests on @p handle. When false, the requests kept on @p handle are moved
+ * to the workflow that would have received them.
+ */
+void workflow_set_interruption_requests_isolated(ADUC_WorkflowHandle handle, bool isolated);
+
 /**
  * @brief Set workflow cancellation type.
  *
@@ -28,6 +28,7 @@
 #include "root_key_util.h"
 
 #include <parson.h>
+#include <pthread.h>
 #include <stdarg.h> // for va_*
 #include <stdlib.h> // for malloc, atoi
 #include <string.h>
@@ -1256,6 +1257,7 @@ ADUC_Result _workflow_parse(const JSON_Value* updateActionJson, bool validateMan
     }
 
     memset(wf, 0, sizeof(*wf));
+    pthread_mutex_init(&wf->PropertiesMutex, NULL);
 
     updateActionJsonClone = json_value_deep_copy(updateActionJson);
     updateActionJson = NULL;
@@ -1662,12 +1664,15 @@ const char* _workflow_peek_workflow_dot_retryTimestamp(ADUC_WorkflowHandle handl
  */
 bool workflow_set_string_property(ADUC_WorkflowHandle handle, const char* property, const char* value)
 {
+    bool succeeded = false;
     ADUC_Workflow* wf = workflow_from_handle(handle);
     if (wf == NULL)
     {
         return false;
     }
 
+    pthread_mutex_lock(&wf->PropertiesMutex);
+
     if (wf->PropertiesObject == NULL)
     {
         wf->PropertiesObject = json_object(json_value_init_object());
@@ -1675,21 +1680,28 @@ bool workflow_set_string_property(ADUC_WorkflowHandle handle, const char* proper
 
     if (wf->PropertiesObject == NULL)
     {
-        return false;
+        goto done;
     }
 
     if (value != NULL)
     {
         Log_Debug("set prop '%s' to '%s'", property, value);
-        return JSONSuccess == json_object_set_string(wf->PropertiesObject, property, value);
+        succeeded = (JSONSuccess == json_object_set_string(wf->PropertiesObject, property, value));
+        goto done;
     }
 
     Log_Debug("set prop '%s' to null", property);
-    return JSONSuccess == json_object_set_null(wf->PropertiesObject, property);
+    succeeded = (JSONSuccess == json_object_set_null(wf->PropertiesObject, property));
+
+done:
+    pthread_mutex_unlock(&wf->PropertiesMutex);
+    return succeeded;
 }
 
 char* workflow_get_string_property(ADUC_WorkflowHandle handle, const char* property)
 {
+    char* ret = NULL;
+
     if (handle == NULL)
     {
         return NULL;
@@ -1697,27 +1709,32 @@ char* workflow_get_string_property(ADUC_WorkflowHandle handle, const char* prope
 
     ADUC_Workflow* wf = workflow_from_handle(handle);
 
+    pthread_mutex_lock(&wf->PropertiesMutex);
+
     if (wf->PropertiesObject == NULL || !json_object_has_value(wf->PropertiesObject, property))
     {
-        return NULL;
+        goto done;
     }
 
     const char* value = json_object_get_string(wf->PropertiesObject, property);
 
     if (value != NULL)
     {
-        char* ret;
-        if (mallocAndStrcpy_s(&ret, (char*)value) == 0)
+        if (mallocAndStrcpy_s(&ret, (char*)value) != 0)
         {
-            return ret;
+            ret = NULL;
         }
     }
 
-    return NULL;
+done:
+    pthread_mutex_unlock(&wf->PropertiesMutex);
+    return ret;
 }
 
 bool workflow_set_boolean_property(ADUC_WorkflowHandle handle, const char* property, bool value)
 {
+    bool succeeded = false;
+
     if (handle == NULL)
     {
         return false;
@@ -1725,16 +1742,21 @@ bool workflow_set_boolean_property(ADUC_WorkflowHandle handle, const char* prope
 
     ADUC_Workflow* wf = workflow_from_handle(handle);
 
-    if (wf->PropertiesObject == NULL)
+    pthread_mutex_lock(&wf->PropertiesMutex);
+
+    if (wf->PropertiesObject != NULL)
     {
-        return false;
+        succeeded = (JSONSuccess == json_object_set_boolean(wf->PropertiesObject, property, value));
     }
 
-    return JSONSuccess == json_object_set_boolean(wf->PropertiesObject, property, value);
+    pthread_mutex_unlock(&wf->PropertiesMutex);
+    return succeeded;
 }
 
 bool workflow_get_boolean_property(ADUC_WorkflowHandle handle, const char* property)
 {
+    bool value = false;
+
     if (handle == NULL)
     {
         return false;
@@ -1742,12 +1764,15 @@ bool workflow_get_boolean_property(ADUC_WorkflowHandle handle, const char* prope
 
     ADUC_Workflow* wf = workflow_from_handle(handle);
 
-    if (wf->PropertiesObject == NULL || !json_object_has_value(wf->PropertiesObject, property))
+    pthread_mutex_lock(&wf->PropertiesMutex);
+
+    if (wf->PropertiesObject != NULL && json_object_has_value(wf->PropertiesObject, property))
     {
-        return false;
+        value = json_object_get_boolean(wf->PropertiesObject, property);
     }
 
-    return json_object_get_boolean(wf->PropertiesObject, property);
+    pthread_mutex_unlock(&wf->PropertiesMutex);
+    return value;
 }
 
 bool workflow_set_workfolder(ADUC_WorkflowHandle handle, const char* format, ...)
@@ -2679,6 +2704,7 @@ ADUC_Result workflow_create_from_inline_step(ADUC_WorkflowHandle base, size_t st
     }
 
     memset(wf, 0, sizeof(*wf));
+    pthread_mutex_init(&wf->PropertiesMutex, NULL);
 
     updateActionValue = json_value_deep_copy(json_object_get_wrapping_value(wfBase->UpdateActionObject));
     if (updateActionValue == NULL)
@@ -3050,6 +3076,10 @@ void workflow_uninit(ADUC_WorkflowHandle handle)
         wf->ResultDetails = NULL;
         STRING_delete(wf->InstalledUpdateId);
         wf->InstalledUpdateId = NULL;
+        json_value_free(wf->ResourceUsage);
+        wf->ResourceUsage = NULL;
+        ADUC_AduShellBroker_Release(wf->AduShellBroker);
+        wf->AduShellBroker = NULL;
 
         if (wf->ResultExtraExtendedResultCodes != NULL)
         {
@@ -3093,6 +3123,7 @@ void workflow_free(ADUC_WorkflowHandle handle)
     }
 
     workflow_uninit(handle);
+    pthread_mutex_destroy(&workflow_from_handle(handle)->PropertiesMutex);
     free(handle);
 }
 
@@ -3427,6 +3458,80 @@ const char* workflow_peek_result_details(ADUC_WorkflowHandle handle)
     return STRING_c_str(wf->ResultDetails);
 }
 
+void workflow_set_resource_usage(ADUC_WorkflowHandle handle, const char* phase, JSON_Value* usage)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL || IsNullOrEmpty(phase) || usage == NULL)
+    {
+        json_value_free(usage);
+        return;
+    }
+
+    pthread_mutex_lock(&wf->PropertiesMutex);
+
+    if (wf->ResourceUsage == NULL)
+    {
+        wf->ResourceUsage = json_value_init_object();
+    }
+
+    if (json_object_set_value(json_value_get_object(wf->ResourceUsage), phase, usage) != JSONSuccess)
+    {
+        Log_Warn("Cannot set the resource usage of phase '%s'.", phase);
+        json_value_free(usage);
+    }
+
+    pthread_mutex_unlock(&wf->PropertiesMutex);
+}
+
+JSON_Value* workflow_get_resource_usage(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return NULL;
+    }
+
+    // A copy, as the handlers may still set the usage of a phase from a worker thread.
+    pthread_mutex_lock(&wf->PropertiesMutex);
+    JSON_Value* usage = wf->ResourceUsage == NULL ? NULL : json_value_deep_copy(wf->ResourceUsage);
+    pthread_mutex_unlock(&wf->PropertiesMutex);
+
+    return usage;
+}
+
+void workflow_set_adushell_broker(ADUC_WorkflowHandle handle, ADUC_AduShellBroker* broker)
+{
+    ADUC_Workflow* wf = workflow_from_handle(workflow_get_root(handle));
+    if (wf == NULL)
+    {
+        ADUC_AduShellBroker_Release(broker);
+        return;
+    }
+
+    pthread_mutex_lock(&wf->PropertiesMutex);
+    ADUC_AduShellBroker* previous = wf->AduShellBroker;
+    wf->AduShellBroker = broker;
+    pthread_mutex_unlock(&wf->PropertiesMutex);
+
+    // Waits for the previous broker to exit, so it is released outside the lock.
+    ADUC_AduShellBroker_Release(previous);
+}
+
+ADUC_AduShellBroker* workflow_get_adushell_broker(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(workflow_get_root(handle));
+    if (wf == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&wf->PropertiesMutex);
+    ADUC_AduShellBroker* broker = ADUC_AduShellBroker_AddRef(wf->AduShellBroker);
+    pthread_mutex_unlock(&wf->PropertiesMutex);
+
+    return broker;
+}
+
 const char* workflow_peek_installed_update_id(ADUC_WorkflowHandle handle)
 {
     ADUC_Workflow* wf = workflow_from_handle(handle);
@@ -3595,49 +3700,112 @@ bool workflow_is_cancel_requested(ADUC_WorkflowHandle handle)
     return workflow_get_boolean_property(handle, WORKFLOW_PROPERTY_FIELD_CANCEL_REQUESTED);
 }
 
+/**
+ * @brief The workflow properties that hold reboot and agent restart requests.
+ */
+static const char* const s_interruptionRequestProperties[] = {
+    WORKFLOW_PROPERTY_FIELD_REBOOT_REQUESTED,
+    WORKFLOW_PROPERTY_FIELD_IMMEDIATE_REBOOT_REQUESTED,
+    WORKFLOW_PROPERTY_FIELD_AGENT_RESTART_REQUESTED,
+    WORKFLOW_PROPERTY_FIELD_IMMEDIATE_AGENT_RESTART_REQUESTED,
+};
+
+/**
+ * @brief Gets the workflow that holds the reboot and agent restart requests of @p handle: the nearest workflow,
+ * starting from @p handle, that isolates its requests, or else the root.
+ *
+ * @param handle A workflow object handle.
+ * @return ADUC_WorkflowHandle
+ */
+static ADUC_WorkflowHandle workflow_get_interruption_requests_owner(ADUC_WorkflowHandle handle)
+{
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    while (wf->Parent != NULL && !wf->IsolatesInterruptionRequests)
+    {
+        wf = wf->Parent;
+    }
+    return (ADUC_WorkflowHandle)wf;
+}
+
+void workflow_set_interruption_requests_isolated(ADUC_WorkflowHandle handle, bool isolated)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL || wf->Parent == NULL || wf->IsolatesInterruptionRequests == isolated)
+    {
+        return;
+    }
+
+    // Requests made before the isolation belong to the workflow that received them.
+    for (size_t i = 0; i < ARRAY_SIZE(s_interruptionRequestProperties); i++)
+    {
+        const char* property = s_interruptionRequestProperties[i];
+        bool requested = isolated ? false : workflow_get_boolean_property(handle, property);
+
+        workflow_set_boolean_property(handle, property, false);
+
+        if (requested)
+        {
+            workflow_set_boolean_property(
+                workflow_get_interruption_requests_owner((ADUC_WorkflowHandle)wf->Parent), property, true);
+        }
+    }
+
+    wf->IsolatesInterruptionRequests = isolated;
+}
+
 bool workflow_is_agent_restart_requested(ADUC_WorkflowHandle handle)
 {
-    return workflow_get_boolean_property(workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_AGENT_RESTART_REQUESTED);
+    return workflow_get_boolean_property(
+        workflow_get_interruption_requests_owner(handle), WORKFLOW_PROPERTY_FIELD_AGENT_RESTART_REQUESTED);
 }
 
 bool workflow_is_immediate_agent_restart_requested(ADUC_WorkflowHandle handle)
 {
     return workflow_get_boolean_property(
-        workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_IMMEDIATE_AGENT_RESTART_REQUESTED);
+        workflow_get_interruption_requests_owner(handle), WORKFLOW_PROPERTY_FIELD_IMMEDIATE_AGENT_RESTART_REQUESTED);
 }
 
 bool workflow_is_reboot_requested(ADUC_WorkflowHandle handle)
 {
-    return workflow_get_boolean_property(workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_REBOOT_REQUESTED);
+    return workflow_get_boolean_property(
+        workflow_get_interruption_requests_owner(handle), WORKFLOW_PROPERTY_FIELD_REBOOT_REQUESTED);
 }
 
 bool workflow_is_immediate_reboot_requested(ADUC_WorkflowHandle handle)
 {
     return workflow_get_boolean_property(
-        workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_IMMEDIATE_REBOOT_REQUESTED);
+        workflow_get_interruption_requests_owner(handle), WORKFLOW_PROPERTY_FIELD_IMMEDIATE_REBOOT_REQUESTED);
 }
 
 bool workflow_request_reboot(ADUC_WorkflowHandle handle)
 {
-    return workflow_set_boolean_property(workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_REBOOT_REQUESTED, true);
+    return workflow_set_boolean_property(
+        workflow_get_interruption_requests_owner(handle), WORKFLOW_PROPERTY_FIELD_REBOOT_REQUESTED, true);
 }
 
 bool workflow_request_immediate_reboot(ADUC_WorkflowHandle handle)
 {
     return workflow_set_boolean_property(
-        workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_IMMEDIATE_REBOOT_REQUESTED, true);
+        workflow_get_interruption_requests_owner(handle), WORKFLOW_PROPERTY_FIELD_IMMEDIATE_REBOOT_REQUESTED, true);
 }
 
 bool workflow_request_agent_restart(ADUC_WorkflowHandle handle)
 {
     return workflow_set_boolean_property(
-        workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_AGENT_RESTART_REQUESTED, true);
+        workflow_get_interruption_requests_owner(handle), WORKFLOW_PROPERTY_FIELD_AGENT_RESTART_REQUESTED, true);
 }
 
 bool workflow_request_immediate_agent_restart(ADUC_WorkflowHandle handle)
 {
     return workflow_set_boolean_property(
-        workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_IMMEDIATE_AGENT_RESTART_REQUESTED, true);
+        workflow_get_interruption_requests_owner(handle),
+        WORKFLOW_PROPERTY_FIELD_IMMEDIATE_AGENT_RESTART_REQUESTED,
+        true);
 }
 
 /**
@@ -3751,6 +3919,7 @@ workflow_create_from_instruction_value(ADUC_WorkflowHandle base, JSON_Value* ins
     }
 
     memset(wf, 0, sizeof(*wf));
+    pthread_mutex_init(&wf->PropertiesMutex, NULL);
 
     updateActionValue = json_value_deep_copy(json_object_get_wrapping_value(wfBase->UpdateActionObject));
     if (updateActionValue == NULL)
@@ -4146,6 +4315,7 @@ bool workflow_init_workflow_handle(ADUC_WorkflowData* workflowData)
     }
 
     memset(wf, 0, sizeof(*wf));
+    pthread_mutex_init(&wf->PropertiesMutex, NULL);
 
     workflowData->WorkflowHandle = wf;
     return true;
@@ -15,6 +15,7 @@ using Catch::Matchers::Equals;
 
 #include <sstream>
 #include <string>
+#include <thread>
 
 // clang-format off
 
@@ -359,6 +360,29 @@ TEST_CASE("Set workflow result")
     workflow_free(bundle);
 }
 
+TEST_CASE("Set workflow resource usage")
+{
+    ADUC_WorkflowHandle leaf0 = nullptr;
+    ADUC_Result result = workflow_init(action_child_update_0, false /* validateManifest */, &leaf0);
+    REQUIRE(result.ResultCode != 0);
+
+    CHECK(workflow_get_resource_usage(leaf0) == nullptr);
+
+    workflow_set_resource_usage(leaf0, "download", json_parse_string(R"({"userTimeMs":1})"));
+    workflow_set_resource_usage(leaf0, "install", json_parse_string(R"({"userTimeMs":2})"));
+    workflow_set_resource_usage(leaf0, "install", json_parse_string(R"({"userTimeMs":3})"));
+    workflow_set_resource_usage(leaf0, nullptr, json_parse_string(R"({"userTimeMs":4})"));
+
+    JSON_Value* usageValue = workflow_get_resource_usage(leaf0);
+    const JSON_Object* usage = json_value_get_object(usageValue);
+    CHECK(json_object_get_count(usage) == 2);
+    CHECK(json_object_dotget_number(usage, "download.userTimeMs") == 1);
+    CHECK(json_object_dotget_number(usage, "install.userTimeMs") == 3);
+    json_value_free(usageValue);
+
+    workflow_free(leaf0);
+}
+
 // clang-format off
 const char* manifest_1_0 =
     R"( {                    )"
@@ -728,3 +752,46 @@ TEST_CASE("Request workflow cancellation")
 
     workflow_free(handle);
 }
+
+TEST_CASE("Isolated interruption requests")
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    ADUC_Result result = workflow_init(action_parent_update, false /* validateManifest */, &handle);
+    REQUIRE(result.ResultCode != 0);
+
+    ADUC_WorkflowHandle childWorkflow[2];
+    for (int i = 0; i < ARRAY_SIZE(childWorkflow); i++)
+    {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-constant-array-index)
+        result = workflow_init(action_child_update_0, false /* validateManifest */, &childWorkflow[i]);
+        REQUIRE(result.ResultCode != 0);
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-constant-array-index)
+        REQUIRE(workflow_insert_child(handle, -1, childWorkflow[i]));
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-constant-array-index)
+        workflow_set_interruption_requests_isolated(childWorkflow[i], true);
+    }
+
+    std::thread rebootStep{ [&childWorkflow]() { workflow_request_immediate_reboot(childWorkflow[0]); } };
+    std::thread restartStep{ [&childWorkflow]() { workflow_request_agent_restart(childWorkflow[1]); } };
+    rebootStep.join();
+    restartStep.join();
+
+    // Each step only sees its own request.
+    CHECK(workflow_is_immediate_reboot_requested(childWorkflow[0]));
+    CHECK_FALSE(workflow_is_agent_restart_requested(childWorkflow[0]));
+    CHECK_FALSE(workflow_is_immediate_reboot_requested(childWorkflow[1]));
+    CHECK(workflow_is_agent_restart_requested(childWorkflow[1]));
+    CHECK_FALSE(workflow_is_immediate_reboot_requested(handle));
+    CHECK_FALSE(workflow_is_agent_restart_requested(handle));
+
+    // Ending the isolation moves the requests to the root.
+    workflow_set_interruption_requests_isolated(childWorkflow[0], false);
+    workflow_set_interruption_requests_isolated(childWorkflow[1], false);
+
+    CHECK(workflow_is_immediate_reboot_requested(handle));
+    CHECK(workflow_is_agent_restart_requested(handle));
+    CHECK_FALSE(workflow_is_reboot_requested(handle));
+    CHECK(workflow_is_immediate_reboot_requested(childWorkflow[1]));
+
+    workflow_free(handle);
+}